@@ -0,0 +1,483 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      Mile.Platform.Benchmarks.cpp
+ * PURPOSE:   Benchmarks for the Platform Neutral Units of Mile
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <Mile.Platform.h>
+#include <Mile.Platform.Environment.h>
+#include <Mile.Platform.Output.h>
+#include <Mile.Platform.Resource.h>
+#include <Mile.Platform.Trace.h>
+
+#include <atomic>
+#include <cwchar>
+#include <cwctype>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /**
+     * Runs a function on a number of threads at the same time, the calling
+     * thread is one of them.
+     */
+    template <typename FunctionType>
+    void RunOnThreads(
+        std::size_t ThreadCount,
+        FunctionType& Function)
+    {
+        std::vector<std::thread> Threads;
+        for (std::size_t i = 1; i < ThreadCount; ++i)
+        {
+            Threads.emplace_back(Function);
+        }
+        Function();
+        for (std::thread& Thread : Threads)
+        {
+            Thread.join();
+        }
+    }
+
+    /**
+     * The thread counts of the contention sweeps, they go beyond the logical
+     * processors to show the cost of the waiting threads.
+     */
+    const std::size_t ContentionThreadCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+    /**
+     * The number of the acquisitions of each sample, they are divided among
+     * the threads so the variants of a sweep do the same work.
+     */
+    const std::size_t ContentionLockCount = 1 << 18;
+
+    /**
+     * Measures the exclusive acquisitions of a lock with a thread count sweep.
+     */
+    template <typename LockType, typename GuardType>
+    void MeasureMutexContention(
+        const char* Name)
+    {
+        for (std::size_t ThreadCount : ContentionThreadCounts)
+        {
+            std::string Variant = std::string(Name) + ",threads=" +
+                std::to_string(ThreadCount);
+
+            LockType Lock;
+            std::uintptr_t Counter = 0;
+            auto Worker = [&]()
+            {
+                for (std::size_t i = 0;
+                    i < ContentionLockCount / ThreadCount;
+                    ++i)
+                {
+                    GuardType Guard(Lock);
+                    ++Counter;
+                }
+            };
+
+            NSudoBenchmarks::Measure(Variant.c_str(), 1, [&]()
+            {
+                RunOnThreads(ThreadCount, Worker);
+                NSudoBenchmarks::Consume(Counter);
+            });
+        }
+    }
+
+    /**
+     * Measures the shared acquisitions of a reader-writer lock with a thread
+     * count sweep, one acquisition of 64 is exclusive.
+     */
+    template <typename LockType, typename SharedGuardType,
+        typename ExclusiveGuardType>
+    void MeasureReaderWriterContention(
+        const char* Name)
+    {
+        for (std::size_t ThreadCount : ContentionThreadCounts)
+        {
+            std::string Variant = std::string(Name) + ",threads=" +
+                std::to_string(ThreadCount);
+
+            LockType Lock;
+            std::uintptr_t Counter = 0;
+            std::atomic<std::uintptr_t> Total(0);
+            auto Worker = [&]()
+            {
+                std::uintptr_t Sum = 0;
+                for (std::size_t i = 0;
+                    i < ContentionLockCount / ThreadCount;
+                    ++i)
+                {
+                    if (i % 64 == 0)
+                    {
+                        ExclusiveGuardType Guard(Lock);
+                        ++Counter;
+                    }
+                    else
+                    {
+                        SharedGuardType Guard(Lock);
+                        Sum += Counter;
+                    }
+                }
+                Total += Sum;
+            };
+
+            NSudoBenchmarks::Measure(Variant.c_str(), 1, [&]()
+            {
+                RunOnThreads(ThreadCount, Worker);
+                NSudoBenchmarks::Consume(Counter + Total.load());
+            });
+        }
+    }
+
+    /**
+     * Finds a variable with a linear scan of an environment block, the names
+     * are compared without case.
+     *
+     * @return The value, or nullptr if the variable is not defined.
+     */
+    const wchar_t* FindVariableLinear(
+        const wchar_t* Block,
+        const wchar_t* Name,
+        std::size_t NameLength)
+    {
+        for (const wchar_t* Entry = Block; *Entry; Entry += ::wcslen(Entry) + 1)
+        {
+            std::size_t i = 0;
+            while (i < NameLength && Entry[i] &&
+                std::towupper(Entry[i]) == std::towupper(Name[i]))
+            {
+                ++i;
+            }
+            if (i == NameLength && Entry[i] == L'=')
+            {
+                return &Entry[i + 1];
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Expands the references of a string like ExpandEnvironmentStringsW, the
+     * undefined references are kept.
+     *
+     * @return The length of the result including the terminating null
+     *         character. The destination is only written if it is large
+     *         enough.
+     */
+    std::size_t ExpandLinear(
+        const wchar_t* Block,
+        const wchar_t* Source,
+        wchar_t* Destination,
+        std::size_t Size)
+    {
+        std::size_t Length = 0;
+        auto Append = [&](const wchar_t* Characters, std::size_t Count)
+        {
+            if (Destination && Length + Count <= Size)
+            {
+                std::wmemcpy(&Destination[Length], Characters, Count);
+            }
+            Length += Count;
+        };
+
+        while (*Source)
+        {
+            const wchar_t* End = (*Source == L'%')
+                ? ::wcschr(Source + 1, L'%')
+                : nullptr;
+            const wchar_t* Value = (End && End != Source + 1)
+                ? FindVariableLinear(Block, Source + 1, End - Source - 1)
+                : nullptr;
+            if (Value)
+            {
+                Append(Value, ::wcslen(Value));
+                Source = End + 1;
+            }
+            else
+            {
+                Append(Source, 1);
+                ++Source;
+            }
+        }
+        Append(L"", 1);
+
+        return Length;
+    }
+
+    /**
+     * Creates an environment block with numbered variables.
+     */
+    std::wstring MakeEnvironmentBlock(
+        std::size_t VariableCount)
+    {
+        std::wstring Block;
+        for (std::size_t i = 0; i < VariableCount; ++i)
+        {
+            Block += L"VARIABLE_" + std::to_wstring(i) + L"=" +
+                std::wstring(8, L'v');
+            Block.push_back(L'\0');
+        }
+        Block.push_back(L'\0');
+        return Block;
+    }
+
+    /**
+     * Creates a command line of about 32K characters which refers to the
+     * variables of MakeEnvironmentBlock and a few undefined ones.
+     */
+    std::wstring MakeCommandLine(
+        std::size_t VariableCount)
+    {
+        std::wstring CommandLine;
+        for (std::size_t i = 0; CommandLine.size() < 32000; ++i)
+        {
+            CommandLine += L"\"%VARIABLE_" +
+                std::to_wstring(i * 37 % VariableCount) + L"%\\bin\" -opt ";
+            if (i % 10 == 0)
+            {
+                CommandLine += L"%UNDEFINED% ";
+            }
+        }
+        return CommandLine;
+    }
+}
+
+NSUDO_BENCHMARK(SyncPrimitives, MutexUncontended)
+{
+    Mile::Mutex Mutex;
+    NSudoBenchmarks::Measure("mile,threads=1", 1000000, [&]()
+    {
+        Mile::AutoMutexLock Lock(Mutex);
+    });
+
+    std::mutex StandardMutex;
+    NSudoBenchmarks::Measure("std,threads=1", 1000000, [&]()
+    {
+        std::lock_guard<std::mutex> Lock(StandardMutex);
+    });
+}
+
+NSUDO_BENCHMARK(SyncPrimitives, MutexContended)
+{
+    MeasureMutexContention<Mile::Mutex, Mile::AutoMutexLock>("mile");
+    MeasureMutexContention<std::mutex, std::lock_guard<std::mutex>>("std");
+}
+
+NSUDO_BENCHMARK(SyncPrimitives, ReaderWriterLockShared)
+{
+    Mile::ReaderWriterLock Lock;
+    NSudoBenchmarks::Measure("mile,threads=1", 1000000, [&]()
+    {
+        Mile::AutoSharedLock Shared(Lock);
+    });
+
+    std::shared_mutex StandardLock;
+    NSudoBenchmarks::Measure("std,threads=1", 1000000, [&]()
+    {
+        std::shared_lock<std::shared_mutex> Shared(StandardLock);
+    });
+}
+
+NSUDO_BENCHMARK(SyncPrimitives, ReaderWriterLockContended)
+{
+    MeasureReaderWriterContention<
+        Mile::ReaderWriterLock,
+        Mile::AutoSharedLock,
+        Mile::AutoExclusiveLock>("mile");
+    MeasureReaderWriterContention<
+        std::shared_mutex,
+        std::shared_lock<std::shared_mutex>,
+        std::unique_lock<std::shared_mutex>>("std");
+}
+
+NSUDO_BENCHMARK(Environment, NaiveTwoPassExpand)
+{
+    // The baseline which MileExpandEnvironmentStringsWithMemory replaced: it
+    // called ExpandEnvironmentStringsW once to size the result and once to
+    // fill it, and each reference is looked up with a linear scan.
+    const std::size_t VariableCount = 200;
+
+    std::wstring Block = MakeEnvironmentBlock(VariableCount);
+    std::wstring CommandLine = MakeCommandLine(VariableCount);
+
+    NSudoBenchmarks::Measure("characters=32000", 10, [&]()
+    {
+        std::size_t Length = ExpandLinear(
+            Block.c_str(),
+            CommandLine.c_str(),
+            nullptr,
+            0);
+        std::unique_ptr<wchar_t[]> Result(new wchar_t[Length]);
+        ExpandLinear(
+            Block.c_str(),
+            CommandLine.c_str(),
+            Result.get(),
+            Length);
+        NSudoBenchmarks::Consume(Length);
+    });
+}
+
+NSUDO_BENCHMARK(Environment, SnapshotExpand)
+{
+    const std::size_t VariableCount = 200;
+
+    std::wstring Block = MakeEnvironmentBlock(VariableCount);
+    std::wstring CommandLine = MakeCommandLine(VariableCount);
+
+    Mile::EnvironmentSnapshot Snapshot;
+    Snapshot.Assign(Block.c_str());
+
+    Mile::EnvironmentExpansionBuffer Buffer;
+    NSudoBenchmarks::Measure("characters=32000", 100, [&]()
+    {
+        Snapshot.Expand(
+            CommandLine.c_str(),
+            CommandLine.size(),
+            Buffer,
+            nullptr);
+        NSudoBenchmarks::Consume(Buffer.GetSize());
+    });
+}
+
+NSUDO_BENCHMARK(Environment, BlockExpand)
+{
+    const std::size_t VariableCount = 200;
+
+    std::wstring Block = MakeEnvironmentBlock(VariableCount);
+    std::wstring CommandLine = MakeCommandLine(VariableCount);
+
+    Mile::EnvironmentBlock Index;
+    Index.Parse(Block.c_str());
+
+    std::wstring Result;
+    NSudoBenchmarks::Measure("characters=32000", 100, [&]()
+    {
+        Mile::ExpandEnvironmentReferences(
+            Index,
+            nullptr,
+            CommandLine.c_str(),
+            Result);
+        NSudoBenchmarks::Consume(Result.size());
+    });
+}
+
+NSUDO_BENCHMARK(Environment, OverlaySerialize)
+{
+    std::wstring Block = MakeEnvironmentBlock(60);
+
+    Mile::EnvironmentBlock Index;
+    Index.Parse(Block.c_str());
+
+    std::vector<wchar_t> Result;
+    NSudoBenchmarks::Measure("variables=60", 10000, [&]()
+    {
+        Mile::EnvironmentOverlay Overlay;
+        Overlay.Set(L"A", 1, L"B", 1);
+        Overlay.Set(L"VARIABLE_5", 10, L"x", 1);
+        Mile::SerializeEnvironmentBlock(Index, &Overlay, Result);
+        NSudoBenchmarks::Consume(Result.size());
+    });
+}
+
+NSUDO_BENCHMARK(Trace, WriteEvent)
+{
+    Mile::TraceEvent Event = { 0, 0, Mile::CreateTraceActivity(), 0, 0, 0 };
+    NSudoBenchmarks::Measure("threads=1", 1000000, [&]()
+    {
+        ++Event.StartTime;
+        Mile::WriteTraceEvent(Event);
+    });
+}
+
+NSUDO_BENCHMARK(Trace, ReadEvents)
+{
+    std::uint32_t Activity = Mile::CreateTraceActivity();
+
+    Mile::TraceEvent Event = { 0, 0, Activity, 0, 0, 0 };
+    for (std::size_t i = 0; i < 256; ++i)
+    {
+        ++Event.StartTime;
+        Mile::WriteTraceEvent(Event);
+    }
+
+    std::vector<Mile::TraceEvent> Events(256);
+    NSudoBenchmarks::Measure("events=256", 1000, [&]()
+    {
+        NSudoBenchmarks::Consume(
+            Mile::ReadTraceEvents(Activity, Events.data(), Events.size()));
+    });
+}
+
+NSUDO_BENCHMARK(Resource, Utf8ChunkLength)
+{
+    std::string Text;
+    while (Text.size() < 1024 * 1024)
+    {
+        Text += "a\xE4\xB8\xAD" "b\xF0\x9F\x98\x80";
+    }
+
+    NSudoBenchmarks::Measure("bytes=1048576", 10, [&]()
+    {
+        std::string_view Remaining = Text;
+        std::size_t ChunkCount = 0;
+        while (!Remaining.empty())
+        {
+            Remaining.remove_prefix(
+                Mile::GetUtf8ChunkLength(Remaining, 4096));
+            ++ChunkCount;
+        }
+        NSudoBenchmarks::Consume(ChunkCount);
+    });
+}
+
+#if defined(__linux__)
+
+NSUDO_BENCHMARK(Output, WriteSegments)
+{
+    int Handle = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (Handle == -1)
+    {
+        return;
+    }
+
+    std::wstring Wide(1024, L'w');
+    std::string Utf8(1024, 'u');
+
+    {
+        Mile::OutputSink Sink(Handle);
+
+        NSudoBenchmarks::Measure("wide=1024", 1000, [&]()
+        {
+            Sink.Write(Wide);
+        });
+
+        NSudoBenchmarks::Measure("utf8=1024", 1000, [&]()
+        {
+            Sink.Write(Utf8);
+        });
+
+        NSudoBenchmarks::Measure("segments=4", 100000, [&]()
+        {
+            Sink.Write({ L"Logo ", "text ", Wide.c_str() + 1000, "\n" });
+        });
+    }
+
+    ::close(Handle);
+}
+
+#endif
@@ -0,0 +1,166 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      Mile.Platform.ThreadPool.Benchmarks.cpp
+ * PURPOSE:   Scaling Benchmarks for the Work-Stealing Thread Pool
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace
+{
+    const std::size_t ElementCount = 1 << 20;
+    const std::size_t Grain = 4096;
+
+    /**
+     * Gets the worker counts of the scaling variants, the powers of two up to
+     * the number of the logical processors and the number itself.
+     */
+    std::vector<std::uint32_t> GetWorkerCounts()
+    {
+        std::uint32_t Maximum = std::thread::hardware_concurrency();
+        if (!Maximum)
+        {
+            Maximum = 1;
+        }
+
+        std::vector<std::uint32_t> WorkerCounts;
+        for (std::uint32_t Count = 1; Count < Maximum; Count *= 2)
+        {
+            WorkerCounts.push_back(Count);
+        }
+        WorkerCounts.push_back(Maximum);
+
+        return WorkerCounts;
+    }
+
+    /**
+     * The work of an element, a few rounds of a 64-bit mixer.
+     */
+    std::uint64_t MixElement(
+        std::uint64_t Value) noexcept
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            Value ^= Value >> 33;
+            Value *= 0xFF51AFD7ED558CCDULL;
+            Value ^= Value >> 33;
+        }
+        return Value;
+    }
+
+    std::uint64_t MixRange(
+        std::size_t Begin,
+        std::size_t End) noexcept
+    {
+        std::uint64_t Result = 0;
+        for (std::size_t i = Begin; i < End; ++i)
+        {
+            Result += MixElement(i);
+        }
+        return Result;
+    }
+}
+
+NSUDO_BENCHMARK(ThreadPool, ParallelForScaling)
+{
+    for (std::uint32_t WorkerCount : GetWorkerCounts())
+    {
+        Mile::ThreadPool Pool(WorkerCount);
+        std::string Variant = "workers=" + std::to_string(WorkerCount);
+
+        NSudoBenchmarks::Measure(Variant.c_str(), 4, [&]()
+        {
+            std::atomic<std::uint64_t> Result(0);
+            Pool.ParallelFor(
+                0,
+                ElementCount,
+                Grain,
+                [&Result](std::size_t Begin, std::size_t End)
+            {
+                Result += MixRange(Begin, End);
+            });
+            NSudoBenchmarks::Consume(
+                static_cast<std::uintptr_t>(Result.load()));
+        });
+    }
+}
+
+NSUDO_BENCHMARK(ThreadPool, ThreadPerCallScaling)
+{
+    // The baseline which starts the threads for every call, as the Sweeper
+    // workers did before they moved to the pool.
+    for (std::uint32_t WorkerCount : GetWorkerCounts())
+    {
+        std::string Variant = "threads=" + std::to_string(WorkerCount);
+
+        NSudoBenchmarks::Measure(Variant.c_str(), 4, [&]()
+        {
+            std::atomic<std::uint64_t> Result(0);
+            std::atomic<std::size_t> NextChunk(0);
+
+            std::vector<std::thread> Threads;
+            for (std::uint32_t i = 0; i < WorkerCount; ++i)
+            {
+                Threads.emplace_back([&]()
+                {
+                    for (;;)
+                    {
+                        std::size_t Begin = Grain * NextChunk++;
+                        if (Begin >= ElementCount)
+                        {
+                            break;
+                        }
+                        Result += MixRange(
+                            Begin,
+                            std::min(Begin + Grain, ElementCount));
+                    }
+                });
+            }
+            for (std::thread& Thread : Threads)
+            {
+                Thread.join();
+            }
+
+            NSudoBenchmarks::Consume(
+                static_cast<std::uintptr_t>(Result.load()));
+        });
+    }
+}
+
+NSUDO_BENCHMARK(ThreadPool, TaskGroupOverhead)
+{
+    // The cost of queueing and waiting an empty task.
+    const std::size_t TaskCount = 1024;
+
+    for (std::uint32_t WorkerCount : GetWorkerCounts())
+    {
+        Mile::ThreadPool Pool(WorkerCount);
+        std::string Variant = "workers=" + std::to_string(WorkerCount);
+
+        NSudoBenchmarks::Measure(Variant.c_str(), 64, [&]()
+        {
+            std::atomic<std::size_t> Count(0);
+            Mile::TaskGroup Group(Pool);
+            for (std::size_t i = 0; i < TaskCount; ++i)
+            {
+                Group.Run([&Count]()
+                {
+                    Count.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            Group.Wait();
+            NSudoBenchmarks::Consume(Count.load());
+        });
+    }
+}
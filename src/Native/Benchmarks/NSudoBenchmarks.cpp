@@ -0,0 +1,293 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      NSudoBenchmarks.cpp
+ * PURPOSE:   Implementation for the Benchmark Runner
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <elf.h>
+
+#include <fstream>
+#include <iterator>
+#endif // defined(__linux__)
+
+namespace
+{
+    NSudoBenchmarks::Benchmark* g_FirstCase = nullptr;
+    NSudoBenchmarks::Benchmark** g_LastCase = &g_FirstCase;
+
+    NSudoBenchmarks::Benchmark* g_CurrentCase = nullptr;
+
+    std::size_t g_SampleCount = 15;
+
+    volatile std::uintptr_t g_Sink = 0;
+
+#if defined(__linux__)
+    /**
+     * Finds the .text section of an ELF file.
+     *
+     * @param File The content of the file.
+     * @param Code Receives the bytes of the section.
+     * @return If the section is found, the return value is true.
+     */
+    template <typename HeaderType, typename SectionType>
+    bool FindElfCodeSection(
+        const std::vector<std::uint8_t>& File,
+        std::vector<std::uint8_t>& Code)
+    {
+        if (File.size() < sizeof(HeaderType))
+        {
+            return false;
+        }
+
+        HeaderType Header;
+        std::memcpy(&Header, File.data(), sizeof(Header));
+        if (Header.e_shentsize != sizeof(SectionType) ||
+            Header.e_shstrndx >= Header.e_shnum ||
+            Header.e_shoff > File.size() ||
+            Header.e_shnum > (File.size() - Header.e_shoff)
+                / sizeof(SectionType))
+        {
+            return false;
+        }
+
+        auto ReadSection = [&](std::size_t Index) -> SectionType
+        {
+            SectionType Section;
+            std::memcpy(
+                &Section,
+                File.data() + Header.e_shoff + Index * sizeof(SectionType),
+                sizeof(Section));
+            return Section;
+        };
+
+        SectionType Names = ReadSection(Header.e_shstrndx);
+        if (Names.sh_offset > File.size() ||
+            Names.sh_size > File.size() - Names.sh_offset)
+        {
+            return false;
+        }
+
+        const char TextName[] = ".text";
+
+        for (std::size_t i = 0; i < Header.e_shnum; ++i)
+        {
+            SectionType Section = ReadSection(i);
+            if (Section.sh_type != SHT_PROGBITS ||
+                Section.sh_name >= Names.sh_size ||
+                Names.sh_size - Section.sh_name < sizeof(TextName) ||
+                std::memcmp(
+                    File.data() + Names.sh_offset + Section.sh_name,
+                    TextName,
+                    sizeof(TextName)) != 0)
+            {
+                continue;
+            }
+
+            if (Section.sh_offset > File.size() ||
+                Section.sh_size > File.size() - Section.sh_offset)
+            {
+                return false;
+            }
+
+            Code.assign(
+                File.data() + Section.sh_offset,
+                File.data() + Section.sh_offset + Section.sh_size);
+            return !Code.empty();
+        }
+
+        return false;
+    }
+#endif // defined(__linux__)
+}
+
+bool NSudoBenchmarks::RegisterBenchmark(
+    Benchmark* Case) noexcept
+{
+    // Keeps the order of the definitions in each source file.
+    *g_LastCase = Case;
+    g_LastCase = &Case->Next;
+    return true;
+}
+
+std::size_t NSudoBenchmarks::GetSampleCount() noexcept
+{
+    return g_SampleCount;
+}
+
+void NSudoBenchmarks::Report(
+    const char* Variant,
+    std::size_t Iterations,
+    const std::vector<double>& Samples) noexcept
+{
+    std::vector<double> Sorted(Samples);
+    std::sort(Sorted.begin(), Sorted.end());
+
+    const std::size_t Count = Sorted.size();
+
+    double Mean = 0.0;
+    for (double Sample : Sorted)
+    {
+        Mean += Sample;
+    }
+    Mean /= static_cast<double>(Count);
+
+    double Variance = 0.0;
+    for (double Sample : Sorted)
+    {
+        Variance += (Sample - Mean) * (Sample - Mean);
+    }
+    if (Count > 1)
+    {
+        // The sample standard deviation.
+        Variance /= static_cast<double>(Count - 1);
+    }
+
+    double Median = (Count % 2)
+        ? Sorted[Count / 2]
+        : (Sorted[Count / 2 - 1] + Sorted[Count / 2]) / 2.0;
+
+    std::printf(
+        "{\"suite\":\"%s\",\"name\":\"%s\",\"variant\":\"%s\","
+        "\"iterations\":%zu,\"samples\":%zu,\"unit\":\"ns\","
+        "\"mean\":%.3f,\"median\":%.3f,\"stddev\":%.3f,"
+        "\"min\":%.3f,\"max\":%.3f}\n",
+        g_CurrentCase->Suite,
+        g_CurrentCase->Name,
+        Variant,
+        Iterations,
+        Count,
+        Mean,
+        Median,
+        std::sqrt(Variance),
+        Sorted.front(),
+        Sorted.back());
+    std::fflush(stdout);
+}
+
+bool NSudoBenchmarks::ReadExecutableCodeSection(
+    std::vector<std::uint8_t>& Code,
+    bool& Is64Bit) noexcept
+{
+    Code.clear();
+    Is64Bit = false;
+
+#if defined(__linux__)
+    std::ifstream Stream("/proc/self/exe", std::ios::binary);
+    std::vector<std::uint8_t> File(
+        (std::istreambuf_iterator<char>(Stream)),
+        std::istreambuf_iterator<char>());
+    if (File.size() < EI_NIDENT ||
+        std::memcmp(File.data(), ELFMAG, SELFMAG) != 0)
+    {
+        return false;
+    }
+
+    if (File[EI_CLASS] == ELFCLASS64)
+    {
+        Elf64_Ehdr Header;
+        if (File.size() < sizeof(Header))
+        {
+            return false;
+        }
+        std::memcpy(&Header, File.data(), sizeof(Header));
+        Is64Bit = true;
+        return Header.e_machine == EM_X86_64 &&
+            FindElfCodeSection<Elf64_Ehdr, Elf64_Shdr>(File, Code);
+    }
+    else if (File[EI_CLASS] == ELFCLASS32)
+    {
+        Elf32_Ehdr Header;
+        if (File.size() < sizeof(Header))
+        {
+            return false;
+        }
+        std::memcpy(&Header, File.data(), sizeof(Header));
+        return Header.e_machine == EM_386 &&
+            FindElfCodeSection<Elf32_Ehdr, Elf32_Shdr>(File, Code);
+    }
+
+    return false;
+#else
+    // The Windows executables are PE files.
+    return false;
+#endif // defined(__linux__)
+}
+
+void NSudoBenchmarks::Consume(
+    std::uintptr_t Value) noexcept
+{
+    g_Sink = Value;
+}
+
+/**
+ * Runs the benchmarks of the suites named on the command line, or all
+ * benchmarks if no suite is named. Each variant is written as a JSON line to
+ * the standard output, the times are the nanoseconds per iteration.
+ *
+ * Usage: NSudoBenchmarks [--samples=<Count>] [Suite ...]
+ */
+int main(int argc, char* argv[])
+{
+    const char SamplesOption[] = "--samples=";
+    const std::size_t SamplesOptionLength = sizeof(SamplesOption) - 1;
+
+    int SuiteCount = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], SamplesOption, SamplesOptionLength) == 0)
+        {
+            long Value = std::strtol(
+                argv[i] + SamplesOptionLength,
+                nullptr,
+                10);
+            if (Value < 1)
+            {
+                std::fprintf(stderr, "invalid option: %s\n", argv[i]);
+                return 1;
+            }
+            g_SampleCount = static_cast<std::size_t>(Value);
+            argv[i] = nullptr;
+        }
+        else
+        {
+            ++SuiteCount;
+        }
+    }
+
+    std::size_t RunCount = 0;
+
+    for (g_CurrentCase = g_FirstCase;
+        g_CurrentCase;
+        g_CurrentCase = g_CurrentCase->Next)
+    {
+        bool Selected = !SuiteCount;
+        for (int i = 1; i < argc && !Selected; ++i)
+        {
+            Selected = argv[i] &&
+                std::strcmp(argv[i], g_CurrentCase->Suite) == 0;
+        }
+        if (!Selected)
+        {
+            continue;
+        }
+
+        g_CurrentCase->Function();
+        ++RunCount;
+    }
+
+    // A suite name which matches nothing is a mistake in the command line.
+    return RunCount ? 0 : 1;
+}
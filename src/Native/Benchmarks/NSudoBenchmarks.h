@@ -0,0 +1,138 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      NSudoBenchmarks.h
+ * PURPOSE:   Definition for the Benchmark Registration and Measurement
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_BENCHMARKS
+#define NSUDO_BENCHMARKS
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace NSudoBenchmarks
+{
+    /**
+     * A benchmark. The benchmarks register themselves before main runs.
+     */
+    struct Benchmark
+    {
+        const char* Suite;
+        const char* Name;
+        void (*Function)();
+        Benchmark* Next;
+    };
+
+    /**
+     * Registers a benchmark, it is called by NSUDO_BENCHMARK.
+     *
+     * @param Case The benchmark, it should live until the process exits.
+     * @return Always returns true.
+     */
+    bool RegisterBenchmark(
+        Benchmark* Case) noexcept;
+
+    /**
+     * Gets the number of the measured samples of each variant.
+     *
+     * @return The number of the samples, it is set by the --samples option.
+     */
+    std::size_t GetSampleCount() noexcept;
+
+    /**
+     * Writes the statistics of the samples of a variant of the running
+     * benchmark as a JSON line to the standard output.
+     *
+     * @param Variant The name of the variant, for example, "workers=4".
+     * @param Iterations The number of the iterations in each sample.
+     * @param Samples The nanoseconds per iteration of each sample.
+     */
+    void Report(
+        const char* Variant,
+        std::size_t Iterations,
+        const std::vector<double>& Samples) noexcept;
+
+    /**
+     * Keeps a value alive, so the compiler cannot remove the computation of
+     * the value.
+     *
+     * @param Value The value.
+     */
+    void Consume(
+        std::uintptr_t Value) noexcept;
+
+    /**
+     * Reads the .text section of the running executable, so the benchmarks
+     * can run over the code emitted by a real compiler.
+     *
+     * @param Code Receives the bytes of the section.
+     * @param Is64Bit Receives true if the section contains x64 code.
+     *                Otherwise, receives false for x86 code.
+     * @return If the executable is an x86 or x64 ELF file with a .text
+     *         section, the return value is true.
+     */
+    bool ReadExecutableCodeSection(
+        std::vector<std::uint8_t>& Code,
+        bool& Is64Bit) noexcept;
+
+    /**
+     * Measures a function and reports the statistics. A warm-up sample is
+     * run first and is not reported.
+     *
+     * @param Variant The name of the variant.
+     * @param Iterations The number of the calls in each sample.
+     * @param Function The function, it is called without arguments.
+     */
+    template <typename FunctionType>
+    void Measure(
+        const char* Variant,
+        std::size_t Iterations,
+        FunctionType&& Function) noexcept
+    {
+        std::vector<double> Samples;
+        Samples.reserve(GetSampleCount());
+
+        for (std::size_t Sample = 0; Sample <= GetSampleCount(); ++Sample)
+        {
+            std::chrono::steady_clock::time_point Start =
+                std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < Iterations; ++i)
+            {
+                Function();
+            }
+            std::chrono::steady_clock::duration Elapsed =
+                std::chrono::steady_clock::now() - Start;
+
+            if (Sample)
+            {
+                Samples.push_back(
+                    std::chrono::duration<double, std::nano>(Elapsed).count()
+                    / static_cast<double>(Iterations));
+            }
+        }
+
+        Report(Variant, Iterations, Samples);
+    }
+}
+
+/**
+ * Defines a benchmark which belongs to a suite. The suite name can be passed
+ * on the command line to run only the benchmarks of the suite.
+ */
+#define NSUDO_BENCHMARK(Suite, Name) \
+    static void Suite##Name##Benchmark(); \
+    static NSudoBenchmarks::Benchmark Suite##Name##Case = \
+    { \
+        #Suite, #Name, Suite##Name##Benchmark, nullptr \
+    }; \
+    static const bool Suite##Name##Registered = \
+        NSudoBenchmarks::RegisterBenchmark(&Suite##Name##Case); \
+    static void Suite##Name##Benchmark()
+
+#endif // !NSUDO_BENCHMARKS
@@ -0,0 +1,321 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      NSudoDevilModeBenchmarks.cpp
+ * PURPOSE:   Benchmarks for the Instruction Decoder, the Relocation Engine,
+ *            the Code Scanner and the Code Range Table
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <NSudoDevilModeCodeRange.h>
+#include <NSudoDevilModeCodeScanner.h>
+#include <NSudoDevilModeLengthDecoder.h>
+#include <NSudoDevilModeRelocation.h>
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+
+namespace
+{
+    /**
+     * The instructions of the x64 function prologues and bodies: mov [rsp+8],
+     * rbx; push rdi; sub rsp, 20h; mov rdi, rcx; call rel32; lea rax,
+     * [rip+disp32]; nop dword [rax+rax]; movdqa xmm0, [rip+disp32]; ret.
+     */
+    const std::uint8_t X64Instructions[] =
+    {
+        0x48, 0x89, 0x5C, 0x24, 0x08,
+        0x57,
+        0x48, 0x83, 0xEC, 0x20,
+        0x48, 0x8B, 0xF9,
+        0xE8, 0x00, 0x00, 0x00, 0x00,
+        0x48, 0x8D, 0x05, 0x00, 0x00, 0x00, 0x00,
+        0x0F, 0x1F, 0x44, 0x00, 0x00,
+        0x66, 0x0F, 0x6F, 0x05, 0x00, 0x00, 0x00, 0x00,
+        0xC3,
+    };
+
+    /**
+     * The instructions of the x86 function prologues and bodies: mov edi,
+     * edi; push ebp; mov ebp, esp; sub esp, 10h; push imm32; call [disp32];
+     * movzx eax, byte [ebp+8]; ret 8.
+     */
+    const std::uint8_t X86Instructions[] =
+    {
+        0x8B, 0xFF,
+        0x55,
+        0x8B, 0xEC,
+        0x83, 0xEC, 0x10,
+        0x68, 0x78, 0x56, 0x34, 0x12,
+        0xFF, 0x15, 0x00, 0x10, 0x00, 0x00,
+        0x0F, 0xB6, 0x45, 0x08,
+        0xC2, 0x08, 0x00,
+    };
+
+    /**
+     * Repeats the instructions into a buffer of about 64 KiB.
+     */
+    std::vector<std::uint8_t> MakeCode(
+        const std::uint8_t* Instructions,
+        std::size_t Size)
+    {
+        std::vector<std::uint8_t> Code;
+        while (Code.size() < 64 * 1024)
+        {
+            Code.insert(Code.end(), Instructions, Instructions + Size);
+        }
+        return Code;
+    }
+
+    /**
+     * Decodes all instructions of a buffer.
+     *
+     * @return The number of the instructions.
+     */
+    std::size_t DecodeAll(
+        const std::vector<std::uint8_t>& Code,
+        bool Is64Bit)
+    {
+        std::size_t Count = 0;
+        for (std::size_t Offset = 0; Offset < Code.size(); ++Count)
+        {
+            NSUDO_DEVIL_MODE_INSTRUCTION Instruction;
+            std::size_t Length = ::NSudoDevilModeDecodeLength(
+                Code.data() + Offset,
+                Code.size() - Offset,
+                Is64Bit,
+                &Instruction);
+
+            // The invalid bytes are skipped one by one.
+            Offset += Length ? Length : 1;
+        }
+        return Count;
+    }
+}
+
+NSUDO_BENCHMARK(LengthDecoder, DecodeStream)
+{
+    std::vector<std::uint8_t> X64Code =
+        MakeCode(X64Instructions, sizeof(X64Instructions));
+    NSudoBenchmarks::Measure("x64,bytes=65536", 100, [&]()
+    {
+        NSudoBenchmarks::Consume(DecodeAll(X64Code, true));
+    });
+
+    std::vector<std::uint8_t> X86Code =
+        MakeCode(X86Instructions, sizeof(X86Instructions));
+    NSudoBenchmarks::Measure("x86,bytes=65536", 100, [&]()
+    {
+        NSudoBenchmarks::Consume(DecodeAll(X86Code, false));
+    });
+}
+
+NSUDO_BENCHMARK(LengthDecoder, DecodeCodeSection)
+{
+    std::vector<std::uint8_t> Code;
+    bool Is64Bit = false;
+    if (!NSudoBenchmarks::ReadExecutableCodeSection(Code, Is64Bit))
+    {
+        // There is no ELF code section to decode on this platform.
+        return;
+    }
+
+    std::string Variant = std::string(Is64Bit ? "x64" : "x86")
+        + ",text,bytes=" + std::to_string(Code.size());
+    NSudoBenchmarks::Measure(Variant.c_str(), 5, [&]()
+    {
+        NSudoBenchmarks::Consume(DecodeAll(Code, Is64Bit));
+    });
+}
+
+NSUDO_BENCHMARK(CodeScanner, ScanCodeSection)
+{
+    std::vector<std::uint8_t> Code;
+    bool Is64Bit = false;
+    if (!NSudoBenchmarks::ReadExecutableCodeSection(Code, Is64Bit))
+    {
+        // There is no ELF code section to scan on this platform.
+        return;
+    }
+
+    // Each instruction adds a branch target at most, and each call adds a
+    // hook site besides the one after the padding.
+    std::vector<std::uint32_t> BranchTargets(Code.size());
+    std::vector<NSUDO_DEVIL_MODE_HOOK_SITE> Sites(
+        Code.size() + Code.size() / 4);
+
+    NSUDO_DEVIL_MODE_CODE_SCAN Scan = {};
+    Scan.Code = Code.data();
+    Scan.CodeSize = Code.size();
+    Scan.Is64Bit = Is64Bit;
+    Scan.BranchTargets = BranchTargets.data();
+    Scan.BranchTargetCapacity = BranchTargets.size();
+    Scan.Sites = Sites.data();
+    Scan.SiteCapacity = Sites.size();
+
+    std::string Prefix = std::string(Is64Bit ? "x64" : "x86")
+        + ",text,bytes=" + std::to_string(Code.size());
+
+    std::string Variant = Prefix + ",find";
+    NSudoBenchmarks::Measure(Variant.c_str(), 5, [&]()
+    {
+        ::NSudoDevilModeFindHookSites(&Scan);
+        NSudoBenchmarks::Consume(Scan.SiteCount);
+    });
+
+    Variant = Prefix + ",evaluate,sequential";
+    NSudoBenchmarks::Measure(Variant.c_str(), 5, [&]()
+    {
+        NSudoBenchmarks::Consume(::NSudoDevilModeEvaluateHookSiteRange(
+            &Scan,
+            0,
+            Scan.CodeSize));
+    });
+
+    // The section is split into chunks of 16 KiB, the hook sites which
+    // straddle a chunk boundary belong to the chunk they start in.
+    std::uint32_t MaximumWorkers = std::thread::hardware_concurrency();
+    for (std::uint32_t WorkerCount = 1;
+        WorkerCount <= std::max<std::uint32_t>(MaximumWorkers, 1);
+        WorkerCount *= 2)
+    {
+        Mile::ThreadPool Pool(WorkerCount);
+        Variant = Prefix + ",evaluate,workers="
+            + std::to_string(WorkerCount);
+        NSudoBenchmarks::Measure(Variant.c_str(), 5, [&]()
+        {
+            std::atomic<std::size_t> SafeCount(0);
+            Pool.ParallelFor(
+                0,
+                Scan.CodeSize,
+                16 * 1024,
+                [&](std::size_t Begin, std::size_t End)
+            {
+                SafeCount += ::NSudoDevilModeEvaluateHookSiteRange(
+                    &Scan,
+                    Begin,
+                    End);
+            });
+            NSudoBenchmarks::Consume(SafeCount.load());
+        });
+    }
+}
+
+NSUDO_BENCHMARK(Relocation, PlanAndEmit)
+{
+    const std::uint64_t SourceAddress = 0x140001000;
+    const std::uint64_t DestinationAddress = 0x140100000;
+
+    // The prologue is copied, the second window has a call and a short jump
+    // which are rewritten.
+    const std::vector<std::uint8_t> Prologue =
+    {
+        0x48, 0x89, 0x5C, 0x24, 0x08, 0x57, 0x48, 0x83, 0xEC, 0x20,
+    };
+    const std::vector<std::uint8_t> Branches =
+    {
+        0xE8, 0x10, 0x00, 0x00, 0x00, 0xEB, 0x02, 0x90, 0x90,
+    };
+
+    std::uint8_t Destination[256];
+
+    for (const std::vector<std::uint8_t>* Window : { &Prologue, &Branches })
+    {
+        NSudoBenchmarks::Measure(
+            Window == &Prologue ? "x64,prologue" : "x64,branches",
+            100000,
+            [&]()
+        {
+            NSUDO_DEVIL_MODE_RELOCATION Relocation;
+            if (NSudoDevilModeRelocationSuccess ==
+                ::NSudoDevilModePlanRelocation(
+                    Window->data(),
+                    Window->size(),
+                    SourceAddress,
+                    DestinationAddress,
+                    5,
+                    true,
+                    &Relocation))
+            {
+                ::NSudoDevilModeEmitRelocation(
+                    &Relocation,
+                    Window->data(),
+                    Destination,
+                    sizeof(Destination));
+            }
+            NSudoBenchmarks::Consume(Destination[0]);
+        });
+    }
+}
+
+NSUDO_BENCHMARK(CodeRange, SortAndFind)
+{
+    const std::size_t RangeCount = 4096;
+    const std::uintptr_t Base = 0x10000;
+
+    std::vector<NSUDO_DEVIL_MODE_CODE_RANGE> Ranges(RangeCount);
+    for (std::size_t i = 0; i < RangeCount; ++i)
+    {
+        NSUDO_DEVIL_MODE_CODE_RANGE& Range = Ranges[i];
+        Range = NSUDO_DEVIL_MODE_CODE_RANGE();
+        Range.Start = Base + i * 64;
+        Range.Size = 16;
+        Range.Destination = Base + 0x100000 + i * 64;
+        Range.OffsetCount = 2;
+        Range.SourceOffsets[1] = 5;
+        Range.DestinationOffsets[1] = 5;
+    }
+
+    std::mt19937 Random(1);
+    std::shuffle(Ranges.begin(), Ranges.end(), Random);
+
+    std::vector<NSUDO_DEVIL_MODE_CODE_RANGE> Sorted(Ranges);
+    NSudoBenchmarks::Measure("ranges=4096", 100, [&]()
+    {
+        Sorted = Ranges;
+        ::NSudoDevilModeSortCodeRanges(Sorted.data(), Sorted.size());
+        NSudoBenchmarks::Consume(Sorted[0].Start);
+    });
+
+    std::vector<std::uintptr_t> Addresses(1024);
+    for (std::uintptr_t& Address : Addresses)
+    {
+        Address = Base + Random() % (RangeCount * 64);
+    }
+
+    NSudoBenchmarks::Measure("ranges=4096,lookups=1024", 1000, [&]()
+    {
+        std::uintptr_t Found = 0;
+        for (std::uintptr_t Address : Addresses)
+        {
+            Found += ::NSudoDevilModeFindCodeRange(
+                Sorted.data(),
+                Sorted.size(),
+                Address) != nullptr;
+        }
+        NSudoBenchmarks::Consume(Found);
+    });
+
+    NSudoBenchmarks::Measure("ranges=4096,fixups=1024", 1000, [&]()
+    {
+        std::uintptr_t Moved = 0;
+        for (std::uintptr_t Address : Addresses)
+        {
+            std::uintptr_t InstructionPointer = Address;
+            Moved += ::NSudoDevilModeFixupInstructionPointer(
+                Sorted.data(),
+                Sorted.size(),
+                &InstructionPointer);
+        }
+        NSudoBenchmarks::Consume(Moved);
+    });
+}
@@ -0,0 +1,504 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      NSudoLauncherBenchmarks.cpp
+ * PURPOSE:   Benchmarks for the Command Line Parser, the JSON Helpers, the
+ *            Translation and Shortcut Lookups and the Token Pipeline of the
+ *            NSudo Launchers
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <NSudoLauncherCommandLine.h>
+#include <NSudoLauncherJson.h>
+
+#include <Mile.Platform.Handle.h>
+#include <Mile.Platform.Resource.h>
+#include <Mile.Platform.Trace.h>
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /**
+     * Reads a file of the launcher resources.
+     *
+     * @param Path The path relative to the source directory of NSudo.
+     * @return The content, it is empty if the file cannot be read.
+     */
+    std::string ReadSourceFile(
+        const char* Path)
+    {
+        std::ifstream File(
+            std::string(NSUDO_BENCHMARKS_SOURCE_DIRECTORY "/") + Path,
+            std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(File),
+            std::istreambuf_iterator<char>());
+    }
+
+    /**
+     * Converts UTF-8 text to wide text, the same as M2MakeUTF16String does
+     * with MultiByteToWideChar. The invalid sequences become U+FFFD.
+     */
+    std::wstring MakeWideString(
+        const char* Text,
+        std::size_t Length)
+    {
+        std::wstring Result;
+        Result.reserve(Length);
+
+        const unsigned char* Bytes =
+            reinterpret_cast<const unsigned char*>(Text);
+        for (std::size_t i = 0; i < Length;)
+        {
+            std::uint32_t CodePoint = Bytes[i];
+            std::size_t Count = CodePoint < 0x80 ? 0
+                : (CodePoint & 0xE0) == 0xC0 ? 1
+                : (CodePoint & 0xF0) == 0xE0 ? 2
+                : (CodePoint & 0xF8) == 0xF0 ? 3
+                : 4;
+            CodePoint &= 0x7F >> Count;
+            ++i;
+
+            for (std::size_t j = 0; j < Count && Count < 4; ++j, ++i)
+            {
+                if (i >= Length || (Bytes[i] & 0xC0) != 0x80)
+                {
+                    Count = 4;
+                    break;
+                }
+                CodePoint = (CodePoint << 6) | (Bytes[i] & 0x3F);
+            }
+            if (Count == 4)
+            {
+                CodePoint = 0xFFFD;
+            }
+
+            if (sizeof(wchar_t) == 2 && CodePoint >= 0x10000)
+            {
+                CodePoint -= 0x10000;
+                Result.push_back(
+                    static_cast<wchar_t>(0xD800 | (CodePoint >> 10)));
+                Result.push_back(
+                    static_cast<wchar_t>(0xDC00 | (CodePoint & 0x3FF)));
+            }
+            else
+            {
+                Result.push_back(static_cast<wchar_t>(CodePoint));
+            }
+        }
+
+        return Result;
+    }
+
+    /**
+     * Loads the members of an object of a JSON file, the same as the
+     * translation and shortcut adapters of the launchers do.
+     */
+    template <typename KeyType>
+    void LoadMembers(
+        std::string_view Json,
+        const char* ObjectName,
+        std::map<KeyType, std::wstring>& Members)
+    {
+        Members.clear();
+
+        jsmntok_t* JsonTokens = nullptr;
+        std::int32_t JsonTokensCount = 0;
+        if (!JsmnParseJson(
+            &JsonTokens,
+            &JsonTokensCount,
+            Json.data(),
+            Json.size()))
+        {
+            return;
+        }
+
+        JsmnEnumerateStringMembers(
+            Json.data(),
+            JsonTokens,
+            JsonTokensCount,
+            ObjectName,
+            [&](const jsmntok_t& Key, const jsmntok_t& Value)
+        {
+            const char* KeyString = Json.data() + Key.start;
+            std::size_t KeyLength = Key.end - Key.start;
+
+            KeyType Name;
+            if constexpr (sizeof(typename KeyType::value_type) == 1)
+            {
+                Name.assign(KeyString, KeyLength);
+            }
+            else
+            {
+                Name = MakeWideString(KeyString, KeyLength);
+            }
+
+            Members.emplace(
+                std::move(Name),
+                MakeWideString(
+                    Json.data() + Value.start,
+                    Value.end - Value.start));
+        });
+
+        std::free(JsonTokens);
+    }
+
+    /**
+     * The languages of the translations of the launchers.
+     */
+    const char* const Languages[] =
+    {
+        "en",
+        "es",
+        "fr",
+        "it",
+        "zh-Hans",
+        "zh-Hant",
+    };
+
+    /**
+     * Reads the translations of a language without the byte order mark.
+     */
+    std::string ReadTranslations(
+        const char* Language)
+    {
+        std::string Content = ReadSourceFile(
+            ("NSudoLauncherResources/" + std::string(Language) +
+                "/Translations.json").c_str());
+        Mile::ResourceView View =
+            Mile::MakeResourceView(Content.data(), Content.size());
+        return std::string(View.Content);
+    }
+}
+
+NSUDO_BENCHMARK(Launcher, SplitCommandLine)
+{
+    std::wstring Typical =
+        L"\"C:\\Program Files\\NSudo\\NSudoLC.exe\" -U:T -P:E -M:S "
+        L"-ShowWindowMode:Hide -Wait \"C:\\Windows\\System32\\cmd.exe\" "
+        L"/c \"echo \\\"quoted\\\" && dir C:\\\\\"";
+    NSudoBenchmarks::Measure("typical", 100000, [&]()
+    {
+        NSudoBenchmarks::Consume(M2SpiltCommandLine(Typical).size());
+    });
+
+    // The longest command line which CreateProcessW accepts.
+    std::wstring Longest = L"NSudoLC.exe";
+    for (std::size_t i = 0; Longest.size() < 32000; ++i)
+    {
+        Longest += (i % 3 == 0)
+            ? L" \"argument with spaces\""
+            : (i % 3 == 1) ? L" -switch:value" : L" a\\\\\\\"b";
+    }
+    NSudoBenchmarks::Measure("characters=32000", 100, [&]()
+    {
+        NSudoBenchmarks::Consume(M2SpiltCommandLine(Longest).size());
+    });
+}
+
+NSUDO_BENCHMARK(Launcher, ParseJson)
+{
+    for (const char* Language : Languages)
+    {
+        std::string Json = ReadTranslations(Language);
+        if (Json.empty())
+        {
+            continue;
+        }
+
+        std::string Variant = std::string("translations,lang=") + Language +
+            ",bytes=" + std::to_string(Json.size());
+        NSudoBenchmarks::Measure(Variant.c_str(), 1000, [&]()
+        {
+            jsmntok_t* JsonTokens = nullptr;
+            std::int32_t JsonTokensCount = 0;
+            if (JsmnParseJson(
+                &JsonTokens,
+                &JsonTokensCount,
+                Json.data(),
+                Json.size()))
+            {
+                std::free(JsonTokens);
+            }
+            NSudoBenchmarks::Consume(JsonTokensCount);
+        });
+    }
+}
+
+NSUDO_BENCHMARK(Launcher, LoadTranslations)
+{
+    // The startup cost of CNSudoTranslationAdapter::Load, the JSON is parsed
+    // and each member is converted to wide text.
+    for (const char* Language : Languages)
+    {
+        std::string Json = ReadTranslations(Language);
+        if (Json.empty())
+        {
+            continue;
+        }
+
+        std::string Variant = std::string("lang=") + Language;
+        std::map<std::string, std::wstring> Translations;
+        NSudoBenchmarks::Measure(Variant.c_str(), 1000, [&]()
+        {
+            LoadMembers(Json, "Translations", Translations);
+            NSudoBenchmarks::Consume(Translations.size());
+        });
+    }
+}
+
+NSUDO_BENCHMARK(Launcher, TranslationLookup)
+{
+    std::map<std::string, std::wstring> Translations;
+    LoadMembers(ReadTranslations("en"), "Translations", Translations);
+
+    std::vector<std::string> Keys;
+    for (const auto& Translation : Translations)
+    {
+        Keys.push_back(Translation.first);
+    }
+    Keys.push_back("Missing.Key");
+
+    // GetTranslation of the GUI copies the translation, and its operator[]
+    // inserts the missing keys.
+    std::string Variant = "copy,keys=" + std::to_string(Keys.size());
+    NSudoBenchmarks::Measure(Variant.c_str(), 10000, [&]()
+    {
+        std::size_t Length = 0;
+        for (const std::string& Key : Keys)
+        {
+            std::wstring Translation = Translations[Key];
+            Length += Translation.size();
+        }
+        NSudoBenchmarks::Consume(Length);
+    });
+
+    // GetTranslationView of the launchers returns a view of the translation.
+    Variant = "view,keys=" + std::to_string(Keys.size());
+    NSudoBenchmarks::Measure(Variant.c_str(), 10000, [&]()
+    {
+        std::size_t Length = 0;
+        for (const std::string& Key : Keys)
+        {
+            auto Iterator = Translations.find(Key);
+            std::wstring_view Translation = Iterator == Translations.end()
+                ? std::wstring_view()
+                : std::wstring_view(Iterator->second);
+            Length += Translation.size();
+        }
+        NSudoBenchmarks::Consume(Length);
+    });
+}
+
+NSUDO_BENCHMARK(Launcher, ShortCutLookup)
+{
+    std::string Content = ReadSourceFile(
+        "NSudoLauncherCUI/Resources/NSudo.json");
+    Mile::ResourceView View =
+        Mile::MakeResourceView(Content.data(), Content.size());
+
+    // The shortcut list is read when the launchers start, and each command
+    // line is translated with it.
+    std::map<std::wstring, std::wstring> ShortCutList;
+    NSudoBenchmarks::Measure("read", 1000, [&]()
+    {
+        LoadMembers(View.Content, "ShortCutList_V2", ShortCutList);
+        NSudoBenchmarks::Consume(ShortCutList.size());
+    });
+
+    std::vector<std::wstring> CommandLines;
+    for (const auto& ShortCut : ShortCutList)
+    {
+        CommandLines.push_back(ShortCut.first);
+    }
+    CommandLines.push_back(L"C:\\Windows\\System32\\cmd.exe /c dir");
+
+    std::string Variant =
+        "translate,commands=" + std::to_string(CommandLines.size());
+    NSudoBenchmarks::Measure(Variant.c_str(), 100000, [&]()
+    {
+        std::size_t Length = 0;
+        for (const std::wstring& CommandLine : CommandLines)
+        {
+            auto Iterator = ShortCutList.find(CommandLine);
+            const std::wstring& Translated =
+                Iterator == ShortCutList.end()
+                ? CommandLine
+                : Iterator->second;
+            Length += Translated.size();
+        }
+        NSudoBenchmarks::Consume(Length);
+    });
+}
+
+#if defined(__linux__)
+
+namespace
+{
+    /**
+     * The file descriptors stand for the kernel handles of the pipeline.
+     */
+    template <Mile::HandleKind HandleKind>
+    struct DescriptorTraits
+    {
+        typedef int ValueType;
+
+        static constexpr Mile::HandleKind Kind = HandleKind;
+
+        static int InvalidValue() noexcept
+        {
+            return -1;
+        }
+
+        static bool IsValid(
+            int Value) noexcept
+        {
+            return Value >= 0;
+        }
+
+        static void Close(
+            int Value) noexcept
+        {
+            ::close(Value);
+        }
+    };
+
+    /**
+     * A stage of the launch pipeline of NSudoCreateProcessWithEnvironment,
+     * with the numbers of the handles which it opens.
+     */
+    struct PipelineStage
+    {
+        std::uint32_t Stage;
+        std::uint32_t TokenCount;
+        std::uint32_t ProcessCount;
+        std::uint32_t ServiceCount;
+    };
+
+    /**
+     * The stages of a launch as TrustedInstaller, in the order of
+     * NSUDO_LAUNCH_STAGE.
+     */
+    const PipelineStage PipelineStages[] =
+    {
+        { 1, 2, 0, 0 },  // OPEN_CURRENT_PROCESS_TOKEN
+        { 2, 0, 0, 0 },  // ENABLE_DEBUG_PRIVILEGE
+        { 3, 0, 0, 0 },  // GET_ACTIVE_SESSION_ID
+        { 4, 0, 0, 0 },  // GET_LSASS_PROCESS_ID
+        { 5, 1, 1, 0 },  // OPEN_LSASS_PROCESS_TOKEN
+        { 6, 1, 0, 0 },  // IMPERSONATE_SYSTEM
+        { 7, 1, 1, 2 },  // START_TRUSTED_INSTALLER
+        { 8, 1, 0, 0 },  // OPEN_USER_TOKEN
+        { 9, 1, 0, 0 },  // PREPARE_USER_TOKEN
+        { 10, 0, 0, 0 }, // CREATE_ENVIRONMENT_BLOCK
+        { 11, 0, 0, 0 }, // PREPARE_ENVIRONMENT
+        { 12, 0, 2, 0 }, // CREATE_PROCESS
+        { 13, 0, 0, 0 }, // SET_PRIORITY_CLASS
+        { 14, 0, 0, 0 }, // RESUME_THREAD
+    };
+
+    typedef Mile::UniqueHandle<DescriptorTraits<Mile::HandleKind::Token>>
+        TokenHandle;
+    typedef Mile::UniqueHandle<DescriptorTraits<Mile::HandleKind::Process>>
+        ProcessHandle;
+    typedef Mile::UniqueHandle<DescriptorTraits<Mile::HandleKind::Service>>
+        ServiceHandle;
+
+    /**
+     * Runs the stages with the handles of the pipeline, each handle is a
+     * duplicate of a file descriptor, and records a trace event for each
+     * stage if Trace is true.
+     */
+    std::uint32_t RunPipeline(
+        int Source,
+        bool Trace)
+    {
+        // The handles are kept until the launch ends, as the real pipeline
+        // keeps them in its scope.
+        std::vector<TokenHandle> Tokens;
+        std::vector<ProcessHandle> Processes;
+        std::vector<ServiceHandle> Services;
+        Tokens.reserve(8);
+        Processes.reserve(4);
+        Services.reserve(2);
+
+        std::uint32_t Activity = Trace ? Mile::CreateTraceActivity() : 0;
+        std::uint32_t HandleCount = 0;
+
+        for (const PipelineStage& Stage : PipelineStages)
+        {
+            std::uint64_t StartTime = Trace ? Mile::GetTraceTimestamp() : 0;
+
+            for (std::uint32_t i = 0; i < Stage.TokenCount; ++i)
+            {
+                Tokens.emplace_back(::dup(Source));
+            }
+            for (std::uint32_t i = 0; i < Stage.ProcessCount; ++i)
+            {
+                Processes.emplace_back(::dup(Source));
+            }
+            for (std::uint32_t i = 0; i < Stage.ServiceCount; ++i)
+            {
+                Services.emplace_back(::dup(Source));
+            }
+            HandleCount = static_cast<std::uint32_t>(
+                Tokens.size() + Processes.size() + Services.size());
+
+            if (Trace)
+            {
+                Mile::TraceEvent Event;
+                Event.StartTime = StartTime;
+                Event.Duration = Mile::GetTraceTimestamp() - StartTime;
+                Event.Activity = Activity;
+                Event.Stage = Stage.Stage;
+                Event.Result = 0;
+                Event.HandleCount = HandleCount;
+                Mile::WriteTraceEvent(Event);
+            }
+        }
+
+        return HandleCount;
+    }
+}
+
+NSUDO_BENCHMARK(Launcher, TokenPipeline)
+{
+    // The token APIs are only available on Windows, so the pipeline is
+    // simulated with the handle wrappers and the trace of the real one.
+    int Source = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (Source < 0)
+    {
+        return;
+    }
+
+    std::string Variant = "stages=" + std::to_string(
+        sizeof(PipelineStages) / sizeof(*PipelineStages));
+    NSudoBenchmarks::Measure((Variant + ",trace=off").c_str(), 10000, [&]()
+    {
+        NSudoBenchmarks::Consume(RunPipeline(Source, false));
+    });
+    NSudoBenchmarks::Measure((Variant + ",trace=on").c_str(), 10000, [&]()
+    {
+        NSudoBenchmarks::Consume(RunPipeline(Source, true));
+    });
+
+    ::close(Source);
+}
+
+#endif
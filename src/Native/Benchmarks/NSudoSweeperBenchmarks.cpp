@@ -0,0 +1,379 @@
+﻿/*
+ * PROJECT:   NSudo Portable Benchmarks
+ * FILE:      NSudoSweeperBenchmarks.cpp
+ * PURPOSE:   Benchmarks for the Platform Neutral Units of NSudo Sweeper
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoBenchmarks.h"
+
+#include <NSudoSweeperDeletionCore.h>
+#include <NSudoSweeperSnapshotCore.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cwchar>
+#endif
+
+namespace
+{
+    /**
+     * A list of paths with the pointer array used by the Sweeper units.
+     */
+    struct FileList
+    {
+        std::vector<std::wstring> Names;
+        std::vector<const wchar_t*> Pointers;
+
+        void Add(
+            const std::wstring& Name)
+        {
+            this->Names.push_back(Name);
+            this->Pointers.clear();
+            for (const std::wstring& Item : this->Names)
+            {
+                this->Pointers.push_back(Item.c_str());
+            }
+        }
+    };
+
+    NSUDO_SWEEPER_DELETION_RESULT RemoveNothing(
+        void* Context,
+        const wchar_t* FileName,
+        bool RetryPass,
+        uint64_t* FreedSize)
+    {
+        (void)Context;
+        (void)RetryPass;
+        *FreedSize = static_cast<uint64_t>(FileName[0]);
+        return NSudoSweeperDeletionDeleted;
+    }
+
+#if defined(__linux__)
+    /**
+     * The directory opened by the last unlinkat of a thread. The lanes
+     * delete a batch of a directory at a time, so most of the files reuse
+     * the descriptor of their parent directory.
+     */
+    struct CachedDirectory
+    {
+        std::string Path;
+        int Descriptor = -1;
+
+        ~CachedDirectory()
+        {
+            if (this->Descriptor != -1)
+            {
+                ::close(this->Descriptor);
+            }
+        }
+    };
+
+    thread_local CachedDirectory g_CachedDirectory;
+
+    /**
+     * The POSIX backend of the deletion scheduler, it deletes the files with
+     * unlinkat relative to the descriptor of their parent directory.
+     */
+    NSUDO_SWEEPER_DELETION_RESULT RemoveFileAt(
+        void* Context,
+        const wchar_t* FileName,
+        bool RetryPass,
+        uint64_t* FreedSize)
+    {
+        (void)Context;
+        (void)RetryPass;
+
+        *FreedSize = 0;
+
+        std::string Path(FileName, FileName + std::wcslen(FileName));
+        std::size_t Separator = Path.rfind('/');
+        std::string Directory = Path.substr(0, Separator);
+
+        CachedDirectory& Cache = g_CachedDirectory;
+        if (Cache.Descriptor == -1 || Cache.Path != Directory)
+        {
+            if (Cache.Descriptor != -1)
+            {
+                ::close(Cache.Descriptor);
+            }
+            Cache.Path = Directory;
+            Cache.Descriptor = ::open(
+                Directory.c_str(),
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (Cache.Descriptor == -1)
+            {
+                return NSudoSweeperDeletionFailed;
+            }
+        }
+
+        const char* Name = Path.c_str() + Separator + 1;
+
+        struct stat Status;
+        if (::fstatat(Cache.Descriptor, Name, &Status, AT_SYMLINK_NOFOLLOW))
+        {
+            return NSudoSweeperDeletionFailed;
+        }
+
+        if (::unlinkat(Cache.Descriptor, Name, 0))
+        {
+            return (errno == EBUSY || errno == EACCES)
+                ? NSudoSweeperDeletionRetryable
+                : NSudoSweeperDeletionFailed;
+        }
+
+        if (Status.st_nlink == 1)
+        {
+            // The space is only freed when the last link is deleted.
+            *FreedSize = static_cast<uint64_t>(Status.st_blocks) * 512;
+        }
+
+        return NSudoSweeperDeletionDeleted;
+    }
+
+    /**
+     * Creates the empty files of a deletion benchmark.
+     */
+    bool CreateFiles(
+        const FileList& Files)
+    {
+        for (const std::wstring& Name : Files.Names)
+        {
+            std::string Path(Name.begin(), Name.end());
+            int Descriptor = ::open(
+                Path.c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+            if (Descriptor == -1)
+            {
+                return false;
+            }
+            ::close(Descriptor);
+        }
+        return true;
+    }
+#endif
+}
+
+NSUDO_BENCHMARK(SweeperDeletion, Scheduler)
+{
+    FileList Files;
+    for (int Directory = 0; Directory < 1000; ++Directory)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            Files.Add(
+                L"/tmp/sweeper/" + std::to_wstring(Directory) +
+                L"/" + std::to_wstring(i) + L".tmp");
+        }
+    }
+
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = {};
+    Backend.RemoveFile = RemoveNothing;
+
+    for (uint32_t LaneCount : { 1, 2, 4, 8 })
+    {
+        Mile::ThreadPool Pool(LaneCount);
+
+        NSUDO_SWEEPER_DELETION_OPTIONS Options = {};
+        Options.LaneCount = LaneCount;
+        Options.ReportInterval = 100;
+
+        std::string Variant =
+            "files=100000,lanes=" + std::to_string(LaneCount);
+        NSudoBenchmarks::Measure(Variant.c_str(), 1, [&]()
+        {
+            NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+            ::NSudoSweeperRunDeletion(
+                Files.Pointers.data(),
+                Files.Pointers.size(),
+                Pool,
+                &Options,
+                &Backend,
+                &Counters);
+            NSudoBenchmarks::Consume(
+                static_cast<std::uintptr_t>(Counters.FreedSize));
+        });
+    }
+}
+
+#if defined(__linux__)
+NSUDO_BENCHMARK(SweeperDeletion, UnlinkAt)
+{
+    char Template[] = "/tmp/NSudoSweeperBenchmarkXXXXXX";
+    if (!::mkdtemp(Template))
+    {
+        return;
+    }
+
+    const int DirectoryCount = 40;
+    const int FileCount = 100;
+
+    std::wstring Root(Template, Template + sizeof(Template) - 1);
+
+    FileList Files;
+    for (int Directory = 0; Directory < DirectoryCount; ++Directory)
+    {
+        std::wstring Path = Root + L"/" + std::to_wstring(Directory);
+        ::mkdir(std::string(Path.begin(), Path.end()).c_str(), 0700);
+        for (int i = 0; i < FileCount; ++i)
+        {
+            Files.Add(Path + L"/" + std::to_wstring(i) + L".tmp");
+        }
+    }
+
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = {};
+    Backend.RemoveFile = RemoveFileAt;
+
+    for (uint32_t LaneCount : { 1, 4 })
+    {
+        NSUDO_SWEEPER_DELETION_OPTIONS Options = {};
+        Options.LaneCount = LaneCount;
+        Options.ReportInterval = 100;
+
+        // The samples are the nanoseconds per file, the throughput in files
+        // per second is 1e9 divided by them. The files are created again
+        // before each sample, which is not measured.
+        std::vector<double> Samples;
+        for (std::size_t Sample = 0;
+            Sample <= NSudoBenchmarks::GetSampleCount();
+            ++Sample)
+        {
+            if (!CreateFiles(Files))
+            {
+                return;
+            }
+
+            Mile::ThreadPool Pool(LaneCount);
+
+            std::chrono::steady_clock::time_point Start =
+                std::chrono::steady_clock::now();
+            ::NSudoSweeperRunDeletion(
+                Files.Pointers.data(),
+                Files.Pointers.size(),
+                Pool,
+                &Options,
+                &Backend,
+                nullptr);
+            std::chrono::steady_clock::duration Elapsed =
+                std::chrono::steady_clock::now() - Start;
+
+            if (Sample)
+            {
+                Samples.push_back(
+                    std::chrono::duration<double, std::nano>(Elapsed).count()
+                    / static_cast<double>(Files.Names.size()));
+            }
+        }
+
+        std::string Variant =
+            "files=4000,lanes=" + std::to_string(LaneCount);
+        NSudoBenchmarks::Report(
+            Variant.c_str(),
+            Files.Names.size(),
+            Samples);
+    }
+
+    for (int Directory = 0; Directory < DirectoryCount; ++Directory)
+    {
+        std::string Path =
+            std::string(Template) + "/" + std::to_string(Directory);
+        ::rmdir(Path.c_str());
+    }
+    ::rmdir(Template);
+}
+#endif
+
+#if defined(__linux__)
+NSUDO_BENCHMARK(SweeperSnapshot, PosixScan)
+{
+    char Template[] = "/tmp/NSudoSweeperBenchmarkXXXXXX";
+    if (!::mkdtemp(Template))
+    {
+        return;
+    }
+
+    const int DirectoryCount = 200;
+    const int FileCount = 20;
+
+    std::wstring Root(Template, Template + sizeof(Template) - 1);
+
+    FileList Files;
+    for (int Directory = 0; Directory < DirectoryCount; ++Directory)
+    {
+        std::wstring Path = Root + L"/" + std::to_wstring(Directory);
+        ::mkdir(std::string(Path.begin(), Path.end()).c_str(), 0700);
+        for (int i = 0; i < FileCount; ++i)
+        {
+            Files.Add(Path + L"/" + std::to_wstring(i) + L".tmp");
+        }
+    }
+
+    if (CreateFiles(Files))
+    {
+        const NSUDO_SWEEPER_SCAN_BACKEND* Backend =
+            ::NSudoSweeperGetPosixScanBackend();
+        std::u16string RootPath(Root.begin(), Root.end());
+
+        NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+        NSudoBenchmarks::Measure("dirs=200,files=4000,full", 1, [&]()
+        {
+            ::NSudoSweeperScanDirectoryTree(
+                nullptr,
+                RootPath,
+                Backend,
+                &Scan);
+            NSudoBenchmarks::Consume(
+                static_cast<std::uintptr_t>(Scan.Entries[0].TotalSize));
+        });
+
+        std::vector<uint8_t> Content;
+        ::NSudoSweeperSerializeSnapshot(0, &Scan, Content);
+
+        NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+        NSudoBenchmarks::Measure("dirs=200,open", 1, [&]()
+        {
+            NSudoBenchmarks::Consume(::NSudoSweeperOpenSnapshotView(
+                Content.data(),
+                Content.size(),
+                &View));
+        });
+
+        // Only the directory identities are queried when nothing changed.
+        NSUDO_SWEEPER_SNAPSHOT_SCAN Rescan;
+        NSudoBenchmarks::Measure("dirs=200,files=4000,rescan", 1, [&]()
+        {
+            ::NSudoSweeperScanDirectoryTree(
+                &View,
+                RootPath,
+                Backend,
+                &Rescan);
+            NSudoBenchmarks::Consume(
+                static_cast<std::uintptr_t>(Rescan.Entries[0].TotalSize));
+        });
+    }
+
+    for (const std::wstring& Name : Files.Names)
+    {
+        ::unlink(std::string(Name.begin(), Name.end()).c_str());
+    }
+    for (int Directory = 0; Directory < DirectoryCount; ++Directory)
+    {
+        std::string Path =
+            std::string(Template) + "/" + std::to_string(Directory);
+        ::rmdir(Path.c_str());
+    }
+    ::rmdir(Template);
+}
+#endif
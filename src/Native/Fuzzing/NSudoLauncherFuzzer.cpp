@@ -0,0 +1,950 @@
+﻿/*
+ * PROJECT:   NSudo Portable Fuzzers
+ * FILE:      NSudoLauncherFuzzer.cpp
+ * PURPOSE:   Implementation for the differential fuzzer of the parsers of the
+ *            NSudo Launchers
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include <NSudoLauncherCommandLine.h>
+#include <NSudoLauncherJson.h>
+
+#include <Mile.Platform.Resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::map<std::string, std::string> MemberMap;
+
+    /**
+     * The behaviors of the parsers on an input. The harness has no coverage
+     * instrumentation, so the corpus keeps the inputs which show a behavior
+     * that no other input has shown.
+     */
+    typedef std::set<std::uint32_t> FeatureSet;
+
+    enum class Feature : std::uint32_t
+    {
+        JsonRejected = 1,
+        JsonTokenCount,
+        JsonMemberCount,
+        JsonIrregularMembers,
+        CommandLineArgumentCount,
+        CommandLineCharacters,
+        ShortCutFile,
+        ShortCutMemberCount,
+    };
+
+    void AddFeature(
+        FeatureSet& Features,
+        Feature Kind,
+        std::size_t Value = 0)
+    {
+        Features.insert(
+            (static_cast<std::uint32_t>(Kind) << 24) |
+            static_cast<std::uint32_t>(std::min<std::size_t>(Value, 0xFFFF)));
+    }
+
+    /**
+     * The counters of the behaviors which are reported in the summary.
+     */
+    struct FuzzCounters
+    {
+        std::size_t ComparedCount = 0;
+        std::size_t UnderflowCount = 0;
+    };
+
+    /**
+     * The walker of the launchers before the members were found from the
+     * token spans, with checked token access. It assumes that the values of
+     * the members are never objects or arrays.
+     *
+     * @return false if the walker would read past the last token.
+     */
+    bool ReferenceEnumerateStringMembers(
+        const char* JsonString,
+        jsmntok_t* JsonTokens,
+        std::int32_t JsonTokensCount,
+        const char* ObjectName,
+        MemberMap& Members)
+    {
+        std::size_t Count = static_cast<std::size_t>(JsonTokensCount);
+
+        for (std::size_t i = 0; i < Count; ++i)
+        {
+            if (!JsmnJsonEqual(JsonString, &JsonTokens[i], ObjectName))
+            {
+                continue;
+            }
+
+            if (i + 1 >= Count)
+            {
+                return false;
+            }
+
+            if (JsonTokens[i + 1].type != JSMN_OBJECT)
+            {
+                continue;
+            }
+
+            std::size_t Size = static_cast<std::size_t>(JsonTokens[i + 1].size);
+            for (std::size_t j = 0; j < Size; ++j)
+            {
+                std::size_t Key = i + j * 2 + 2;
+                std::size_t Value = Key + 1;
+                if (Value >= Count)
+                {
+                    return false;
+                }
+
+                if (JsonTokens[Key].type != JSMN_STRING ||
+                    JsonTokens[Value].type != JSMN_STRING)
+                {
+                    continue;
+                }
+
+                Members.emplace(
+                    std::string(
+                        JsonString + JsonTokens[Key].start,
+                        JsonTokens[Key].end - JsonTokens[Key].start),
+                    std::string(
+                        JsonString + JsonTokens[Value].start,
+                        JsonTokens[Value].end - JsonTokens[Value].start));
+            }
+
+            i += Size + 1;
+        }
+
+        return true;
+    }
+
+    /**
+     * Checks whether an object with the specified name has a member which is
+     * not a pair of a key and a primitive or string value, such as a nested
+     * value or a key without a separator. The reference walker only supports
+     * the objects whose size counts all of their pairs.
+     */
+    bool HasIrregularMembers(
+        const char* JsonString,
+        jsmntok_t* JsonTokens,
+        std::int32_t JsonTokensCount,
+        const char* ObjectName)
+    {
+        std::size_t Count = static_cast<std::size_t>(JsonTokensCount);
+
+        for (std::size_t i = 0; i + 1 < Count; ++i)
+        {
+            if (!JsmnJsonEqual(JsonString, &JsonTokens[i], ObjectName) ||
+                JsonTokens[i + 1].type != JSMN_OBJECT)
+            {
+                continue;
+            }
+
+            std::size_t j = i + 2;
+            for (;
+                j < Count && JsonTokens[j].start < JsonTokens[i + 1].end;
+                ++j)
+            {
+                if (JsonTokens[j].type == JSMN_OBJECT ||
+                    JsonTokens[j].type == JSMN_ARRAY)
+                {
+                    return true;
+                }
+            }
+
+            std::size_t Size = static_cast<std::size_t>(JsonTokens[i + 1].size);
+            if (j - (i + 2) != Size * 2)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * The command line parser of the launchers before the terminating NUL of
+     * a program name which ends the command line was dropped.
+     */
+    std::vector<std::wstring> ReferenceSpiltCommandLine(
+        const std::wstring& CommandLine)
+    {
+        // Initialize the SplitArguments.
+        std::vector<std::wstring> SplitArguments;
+
+        wchar_t c = L'\0';
+        int copy_character;                   /* 1 = copy char to *args */
+        unsigned numslash;              /* num of backslashes seen */
+
+        std::wstring Buffer;
+        Buffer.reserve(CommandLine.size());
+
+        /* first scan the program name, copy it, and count the bytes */
+        wchar_t* p = const_cast<wchar_t*>(CommandLine.c_str());
+
+        // A quoted program name is handled here. The handling is much simpler
+        // than for other arguments. Basically, whatever lies between the
+        // leading double-quote and next one, or a terminal null character is
+        // simply accepted. Fancier handling is not required because the
+        // program name must be a legal NTFS/HPFS file name. Note that the
+        // double-quote characters are not copied, nor do they contribute to
+        // character_count.
+        bool InQuotes = false;
+        do
+        {
+            if (*p == '"')
+            {
+                InQuotes = !InQuotes;
+                c = *p++;
+                continue;
+            }
+
+            // Copy character into argument:
+            Buffer.push_back(*p);
+
+            c = *p++;
+        } while (c != '\0' && (InQuotes || (c != ' ' && c != '\t')));
+
+        if (c == '\0')
+        {
+            p--;
+        }
+        else
+        {
+            Buffer.resize(Buffer.size() - 1);
+        }
+
+        // Save te argument.
+        SplitArguments.push_back(Buffer);
+
+        InQuotes = false;
+
+        // Loop on each argument
+        for (;;)
+        {
+            if (*p)
+            {
+                while (*p == ' ' || *p == '\t')
+                    ++p;
+            }
+
+            // End of arguments
+            if (*p == '\0')
+                break;
+
+            // Initialize the argument buffer.
+            Buffer.clear();
+
+            // Loop through scanning one argument:
+            for (;;)
+            {
+                copy_character = 1;
+
+                // Rules: 2N backslashes + " ==> N backslashes and begin/end
+                // quote 2N + 1 backslashes + " ==> N backslashes + literal " N
+                // backslashes ==> N backslashes
+                numslash = 0;
+
+                while (*p == '\\')
+                {
+                    // Count number of backslashes for use below
+                    ++p;
+                    ++numslash;
+                }
+
+                if (*p == '"')
+                {
+                    // if 2N backslashes before, start/end quote, otherwise copy
+                    // literally:
+                    if (numslash % 2 == 0)
+                    {
+                        if (InQuotes && p[1] == '"')
+                        {
+                            p++; // Double quote inside quoted string
+                        }
+                        else
+                        {
+                            // Skip first quote char and copy second:
+                            copy_character = 0; // Don't copy quote
+                            InQuotes = !InQuotes;
+                        }
+                    }
+
+                    numslash /= 2;
+                }
+
+                // Copy slashes:
+                while (numslash--)
+                {
+                    Buffer.push_back(L'\\');
+                }
+
+                // If at end of arg, break loop:
+                if (*p == '\0' || (!InQuotes && (*p == ' ' || *p == '\t')))
+                    break;
+
+                // Copy character into argument:
+                if (copy_character)
+                {
+                    Buffer.push_back(*p);
+                }
+
+                ++p;
+            }
+
+            // Save te argument.
+            SplitArguments.push_back(Buffer);
+        }
+
+        return SplitArguments;
+    }
+
+    const char* const g_Seeds[] =
+    {
+        "{\"Translations\":{\"a\":\"b\",\"c\":\"d\"}}",
+        "{\"ShortCutList_V2\":{\"cmd\":\"cmd.exe\",\"x\":\"y\"}}",
+        "{\"Translations\":{\"a\"}}",
+        "{\"Translations\"}",
+        "{\"Translations\":{\"a\":{\"b\":\"c\"},\"d\":\"e\"}}",
+        "\"C:\\\\Program Files\\\\x.exe\" -U:T -P:E \"a b\" c\\\\\\\"d",
+        "\xEF\xBB\xBF{\"ShortCutList_V2\":{\"cmd\":\"cmd.exe\"}}",
+        "\xEF\xBB\xBF",
+        "\xEF\xBB",
+        "",
+    };
+
+    const char* const g_ObjectNames[] =
+    {
+        "Translations",
+        "ShortCutList_V2",
+    };
+
+    const char g_Alphabet[] = "{}[]\":, \t\\-abTrnslio0123\xEF\xBB\xBF";
+
+#if !defined(NSUDO_FUZZER_LIBFUZZER)
+
+    /**
+     * Applies up to three random insertions, deletions or replacements of
+     * characters from an alphabet of the JSON and command line syntax.
+     */
+    void Mutate(
+        std::string& Input,
+        std::mt19937& Generator)
+    {
+        const std::size_t AlphabetLength = sizeof(g_Alphabet) - 1;
+
+        std::size_t MutationCount = Generator() % 4;
+        for (std::size_t i = 0; i < MutationCount; ++i)
+        {
+            std::size_t Position = Generator() % (Input.size() + 1);
+            char Character = g_Alphabet[Generator() % AlphabetLength];
+
+            switch (Generator() % 3)
+            {
+            case 0:
+                Input.insert(Input.begin() + Position, Character);
+                break;
+            case 1:
+                if (Position < Input.size())
+                {
+                    Input.erase(Position, 1);
+                }
+                break;
+            default:
+                if (Position < Input.size())
+                {
+                    Input[Position] = Character;
+                }
+                break;
+            }
+        }
+    }
+
+#endif
+
+    void ReportMismatch(
+        const char* Parser,
+        const std::string& Input)
+    {
+        std::fprintf(stderr, "mismatch in %s on input: ", Parser);
+        for (unsigned char Character : Input)
+        {
+            if (Character < 0x20 || Character > 0x7E || Character == '\\')
+            {
+                std::fprintf(stderr, "\\x%02X", Character);
+            }
+            else
+            {
+                std::fputc(Character, stderr);
+            }
+        }
+        std::fputc('\n', stderr);
+    }
+
+    /**
+     * Checks JsmnParseJson and JsmnEnumerateStringMembers with an input.
+     *
+     * @return true if the members agree with the reference walker or the
+     *         reference walker does not support the input.
+     */
+    bool CheckJson(
+        const std::string& Input,
+        FeatureSet& Features,
+        FuzzCounters& Counters)
+    {
+        jsmntok_t* JsonTokens = nullptr;
+        std::int32_t JsonTokensCount = 0;
+        if (!JsmnParseJson(
+            &JsonTokens,
+            &JsonTokensCount,
+            Input.data(),
+            Input.size()))
+        {
+            AddFeature(Features, Feature::JsonRejected);
+            return JsonTokens == nullptr && JsonTokensCount == 0;
+        }
+        AddFeature(Features, Feature::JsonTokenCount, JsonTokensCount);
+
+        bool Result = true;
+
+        for (std::size_t Name = 0;
+            Name < sizeof(g_ObjectNames) / sizeof(*g_ObjectNames);
+            ++Name)
+        {
+            const char* ObjectName = g_ObjectNames[Name];
+
+            MemberMap Members;
+            JsmnEnumerateStringMembers(
+                Input.data(),
+                JsonTokens,
+                JsonTokensCount,
+                ObjectName,
+                [&](const jsmntok_t& Key, const jsmntok_t& Value)
+            {
+                Members.emplace(
+                    Input.substr(Key.start, Key.end - Key.start),
+                    Input.substr(Value.start, Value.end - Value.start));
+            });
+            AddFeature(
+                Features,
+                Feature::JsonMemberCount,
+                (Name << 8) | std::min<std::size_t>(Members.size(), 0xFF));
+
+            MemberMap ReferenceMembers;
+            if (!ReferenceEnumerateStringMembers(
+                Input.data(),
+                JsonTokens,
+                JsonTokensCount,
+                ObjectName,
+                ReferenceMembers))
+            {
+                continue;
+            }
+
+            if (HasIrregularMembers(
+                Input.data(),
+                JsonTokens,
+                JsonTokensCount,
+                ObjectName))
+            {
+                AddFeature(Features, Feature::JsonIrregularMembers, Name);
+                continue;
+            }
+
+            ++Counters.ComparedCount;
+            if (Members != ReferenceMembers)
+            {
+                Result = false;
+                break;
+            }
+        }
+
+        std::free(JsonTokens);
+
+        return Result;
+    }
+
+    /**
+     * Checks M2SpiltCommandLine with an input.
+     *
+     * @return true if the arguments have no NUL and agree with the reference
+     *         parser after its stray NUL is dropped.
+     */
+    bool CheckCommandLine(
+        const std::string& Input,
+        FeatureSet& Features)
+    {
+        std::wstring CommandLine(Input.begin(), Input.end());
+
+        std::vector<std::wstring> Arguments =
+            M2SpiltCommandLine(CommandLine);
+        AddFeature(
+            Features,
+            Feature::CommandLineArgumentCount,
+            Arguments.size());
+
+        // The characters which change the state of the parser.
+        std::size_t Characters = 0;
+        for (const char* Special = "\"\\ \t"; *Special; ++Special)
+        {
+            Characters <<= 1;
+            if (Input.find(*Special) != std::string::npos)
+            {
+                Characters |= 1;
+            }
+        }
+        AddFeature(Features, Feature::CommandLineCharacters, Characters);
+        std::vector<std::wstring> ReferenceArguments =
+            ReferenceSpiltCommandLine(CommandLine);
+
+        std::wstring& ApplicationName = ReferenceArguments.front();
+        if (!ApplicationName.empty() && ApplicationName.back() == L'\0')
+        {
+            ApplicationName.pop_back();
+        }
+
+        for (const std::wstring& Argument : Arguments)
+        {
+            if (Argument.find(L'\0') != std::wstring::npos)
+            {
+                return false;
+            }
+        }
+
+        return Arguments == ReferenceArguments;
+    }
+
+    /**
+     * Enumerates the members of the shortcut list of a JSON string.
+     */
+    MemberMap ReadShortCutList(
+        const char* JsonString,
+        std::size_t JsonStringLength)
+    {
+        MemberMap Members;
+
+        jsmntok_t* JsonTokens = nullptr;
+        std::int32_t JsonTokensCount = 0;
+        if (JsmnParseJson(
+            &JsonTokens,
+            &JsonTokensCount,
+            JsonString,
+            JsonStringLength))
+        {
+            JsmnEnumerateStringMembers(
+                JsonString,
+                JsonTokens,
+                JsonTokensCount,
+                "ShortCutList_V2",
+                [&](const jsmntok_t& Key, const jsmntok_t& Value)
+            {
+                Members.emplace(
+                    std::string(
+                        JsonString + Key.start,
+                        Key.end - Key.start),
+                    std::string(
+                        JsonString + Value.start,
+                        Value.end - Value.start));
+            });
+
+            std::free(JsonTokens);
+        }
+
+        return Members;
+    }
+
+    /**
+     * Checks the way CNSudoShortCutAdapter::Read loads a shortcut list file.
+     *
+     * @return true if the byte order mark is skipped inside the file, and the
+     *         members agree with the reader before it was fixed when the file
+     *         starts with a byte order mark.
+     */
+    bool CheckShortCutFile(
+        const std::string& Input,
+        FeatureSet& Features,
+        FuzzCounters& Counters)
+    {
+        // The file is copied to a buffer of its exact size, so a read past
+        // its end is caught by AddressSanitizer.
+        std::size_t FileSize = Input.size();
+        std::unique_ptr<char[]> FileContent(new char[FileSize]);
+        std::memcpy(FileContent.get(), Input.data(), FileSize);
+
+        Mile::ResourceView View =
+            Mile::MakeResourceView(FileContent.get(), FileSize);
+        if (View.Content.size() > FileSize ||
+            (FileSize && (View.Content.data() < FileContent.get() ||
+                View.Content.data() + View.Content.size() >
+                FileContent.get() + FileSize)))
+        {
+            return false;
+        }
+
+        MemberMap Members = ReadShortCutList(
+            View.Content.data(),
+            View.Content.size());
+        AddFeature(Features, Feature::ShortCutMemberCount, Members.size());
+
+        bool HasMark = View.Encoding == Mile::TextEncoding::Utf8;
+
+        // The reader before the fix skipped three bytes without checking the
+        // file, so the length underflowed for the files shorter than three
+        // bytes. It is only run on the files which it could read.
+        bool Underflows = FileSize < 3;
+        AddFeature(
+            Features,
+            Feature::ShortCutFile,
+            (HasMark ? 2 : 0) | (Underflows ? 1 : 0));
+        if (Underflows)
+        {
+            ++Counters.UnderflowCount;
+            return true;
+        }
+
+        if (!HasMark)
+        {
+            // The reader before the fix dropped the first three characters
+            // of the files without a byte order mark.
+            return true;
+        }
+
+        return Members == ReadShortCutList(
+            FileContent.get() + 3,
+            FileSize - 3);
+    }
+
+    /**
+     * Runs all checks with an input.
+     *
+     * @return The name of the parser which disagrees with its reference, or
+     *         nullptr if all of them agree.
+     */
+    const char* RunInput(
+        const std::string& Input,
+        FeatureSet& Features,
+        FuzzCounters& Counters)
+    {
+        if (!CheckJson(Input, Features, Counters))
+        {
+            return "JsmnEnumerateStringMembers";
+        }
+
+        if (!CheckCommandLine(Input, Features))
+        {
+            return "M2SpiltCommandLine";
+        }
+
+        if (!CheckShortCutFile(Input, Features, Counters))
+        {
+            return "CNSudoShortCutAdapter::Read";
+        }
+
+        return nullptr;
+    }
+
+#if !defined(NSUDO_FUZZER_LIBFUZZER)
+
+    /**
+     * Gets the file name of an input in a corpus directory, it is the FNV-1a
+     * hash of the content so the same input is saved once.
+     */
+    std::string GetCorpusFileName(
+        const std::string& Input)
+    {
+        std::uint64_t Hash = 14695981039346656037ULL;
+        for (unsigned char Character : Input)
+        {
+            Hash = (Hash ^ Character) * 1099511628211ULL;
+        }
+
+        char Name[17];
+        std::snprintf(
+            Name,
+            sizeof(Name),
+            "%016llX",
+            static_cast<unsigned long long>(Hash));
+        return Name;
+    }
+
+    /**
+     * Reads the inputs of a corpus directory, the shortest inputs are first.
+     */
+    std::vector<std::pair<std::filesystem::path, std::string>> LoadCorpus(
+        const std::filesystem::path& Directory)
+    {
+        std::vector<std::pair<std::filesystem::path, std::string>> Corpus;
+
+        std::error_code Error;
+        for (const std::filesystem::directory_entry& Entry :
+            std::filesystem::directory_iterator(Directory, Error))
+        {
+            if (!Entry.is_regular_file(Error))
+            {
+                continue;
+            }
+
+            std::ifstream File(Entry.path(), std::ios::binary);
+            Corpus.emplace_back(
+                Entry.path(),
+                std::string(
+                    std::istreambuf_iterator<char>(File),
+                    std::istreambuf_iterator<char>()));
+        }
+
+        std::sort(
+            Corpus.begin(),
+            Corpus.end(),
+            [](const auto& Left, const auto& Right)
+        {
+            return Left.second.size() != Right.second.size()
+                ? Left.second.size() < Right.second.size()
+                : Left.first < Right.first;
+        });
+
+        return Corpus;
+    }
+
+    bool SaveCorpusInput(
+        const std::filesystem::path& Directory,
+        const std::string& Input)
+    {
+        std::ofstream File(
+            Directory / GetCorpusFileName(Input),
+            std::ios::binary | std::ios::trunc);
+        File.write(Input.data(), static_cast<std::streamsize>(Input.size()));
+        return static_cast<bool>(File);
+    }
+
+    /**
+     * Merges the features of an input into the features of the corpus.
+     *
+     * @return true if the input shows a new feature.
+     */
+    bool MergeFeatures(
+        FeatureSet& CorpusFeatures,
+        const FeatureSet& InputFeatures)
+    {
+        std::size_t Count = CorpusFeatures.size();
+        CorpusFeatures.insert(InputFeatures.begin(), InputFeatures.end());
+        return CorpusFeatures.size() != Count;
+    }
+
+    bool ParseOption(
+        const char* Argument,
+        const char* Option,
+        unsigned long& Value)
+    {
+        std::size_t OptionLength = std::strlen(Option);
+        if (std::strncmp(Argument, Option, OptionLength) != 0)
+        {
+            return false;
+        }
+
+        char* End = nullptr;
+        Value = std::strtoul(Argument + OptionLength, &End, 10);
+        return End != Argument + OptionLength && *End == '\0';
+    }
+
+#endif
+}
+
+#if defined(NSUDO_FUZZER_LIBFUZZER)
+
+/**
+ * The entry point of libFuzzer, it runs the same checks as the standalone
+ * driver and aborts on the first mismatch. libFuzzer provides the corpus, the
+ * minimization with -merge=1 and the coverage guidance.
+ */
+extern "C" int LLVMFuzzerTestOneInput(
+    const std::uint8_t* Data,
+    std::size_t Size)
+{
+    std::string Input(reinterpret_cast<const char*>(Data), Size);
+
+    FeatureSet Features;
+    FuzzCounters Counters;
+    if (const char* Parser = RunInput(Input, Features, Counters))
+    {
+        ReportMismatch(Parser, Input);
+        std::abort();
+    }
+
+    return 0;
+}
+
+#else
+
+/**
+ * Runs the parsers of the launchers and the reference parsers side by side on
+ * mutated inputs. The first mismatch is written to the standard error and
+ * fails the run, the summary is written to the standard output.
+ *
+ * The inputs of the corpus directory are added to the seeds, and a mutated
+ * input which shows a new behavior is kept for the later mutations and saved
+ * into the directory. With --minimize, the corpus is not fuzzed. It is run
+ * from the shortest input, and the inputs which show no new behavior are
+ * removed.
+ *
+ * Usage: NSudoLauncherFuzzer [--iterations=<Count>] [--seed=<Seed>]
+ *                            [--corpus=<Directory> [--minimize]]
+ */
+int main(int argc, char* argv[])
+{
+    unsigned long IterationCount = 100000;
+    unsigned long Seed = 1;
+    const char* CorpusDirectory = nullptr;
+    bool Minimize = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--corpus=", 9) == 0 && argv[i][9])
+        {
+            CorpusDirectory = argv[i] + 9;
+        }
+        else if (std::strcmp(argv[i], "--minimize") == 0)
+        {
+            Minimize = true;
+        }
+        else if (!ParseOption(argv[i], "--iterations=", IterationCount) &&
+            !ParseOption(argv[i], "--seed=", Seed))
+        {
+            std::fprintf(stderr, "invalid option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (Minimize && !CorpusDirectory)
+    {
+        std::fprintf(stderr, "--minimize needs --corpus\n");
+        return 1;
+    }
+
+    std::vector<std::pair<std::filesystem::path, std::string>> Corpus;
+    if (CorpusDirectory)
+    {
+        std::error_code Error;
+        std::filesystem::create_directories(CorpusDirectory, Error);
+        Corpus = LoadCorpus(CorpusDirectory);
+    }
+
+    FeatureSet CorpusFeatures;
+    FuzzCounters Counters;
+
+    if (Minimize)
+    {
+        std::size_t KeptCount = 0;
+        for (const auto& Entry : Corpus)
+        {
+            FeatureSet Features;
+            if (const char* Parser = RunInput(Entry.second, Features, Counters))
+            {
+                ReportMismatch(Parser, Entry.second);
+                return 1;
+            }
+
+            if (MergeFeatures(CorpusFeatures, Features))
+            {
+                ++KeptCount;
+            }
+            else
+            {
+                std::error_code Error;
+                std::filesystem::remove(Entry.first, Error);
+            }
+        }
+
+        std::printf(
+            "{\"corpus\":%zu,\"kept\":%zu,\"features\":%zu}\n",
+            Corpus.size(),
+            KeptCount,
+            CorpusFeatures.size());
+
+        return 0;
+    }
+
+    std::vector<std::string> Inputs(
+        std::begin(g_Seeds),
+        std::end(g_Seeds));
+    for (auto& Entry : Corpus)
+    {
+        Inputs.push_back(std::move(Entry.second));
+    }
+
+    for (const std::string& Input : Inputs)
+    {
+        FeatureSet Features;
+        if (const char* Parser = RunInput(Input, Features, Counters))
+        {
+            ReportMismatch(Parser, Input);
+            return 1;
+        }
+        MergeFeatures(CorpusFeatures, Features);
+    }
+
+    std::mt19937 Generator(static_cast<std::mt19937::result_type>(Seed));
+
+    std::size_t SavedCount = 0;
+
+    auto Start = std::chrono::steady_clock::now();
+
+    for (unsigned long i = 0; i < IterationCount; ++i)
+    {
+        std::string Input = Inputs[Generator() % Inputs.size()];
+        Mutate(Input, Generator);
+
+        FeatureSet Features;
+        if (const char* Parser = RunInput(Input, Features, Counters))
+        {
+            ReportMismatch(Parser, Input);
+            return 1;
+        }
+
+        if (MergeFeatures(CorpusFeatures, Features))
+        {
+            if (CorpusDirectory &&
+                SaveCorpusInput(CorpusDirectory, Input))
+            {
+                ++SavedCount;
+            }
+            Inputs.push_back(std::move(Input));
+        }
+    }
+
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+
+    std::printf(
+        "{\"iterations\":%lu,\"seed\":%lu,\"compared\":%zu,"
+        "\"underflows\":%zu,\"features\":%zu,\"saved\":%zu,"
+        "\"execs_per_second\":%.0f}\n",
+        IterationCount,
+        Seed,
+        Counters.ComparedCount,
+        Counters.UnderflowCount,
+        CorpusFeatures.size(),
+        SavedCount,
+        Elapsed.count() > 0.0 ? IterationCount / Elapsed.count() : 0.0);
+
+    return 0;
+}
+
+#endif
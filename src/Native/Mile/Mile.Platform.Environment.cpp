@@ -0,0 +1,739 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Environment.cpp
+ * PURPOSE:   Environment Block Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.Environment.h"
+
+#include <algorithm>
+
+namespace
+{
+    wchar_t FoldCharacter(
+        wchar_t Character) noexcept
+    {
+        if (Character >= L'a' && Character <= L'z')
+        {
+            return static_cast<wchar_t>(Character - (L'a' - L'A'));
+        }
+
+        return Character;
+    }
+
+    std::size_t GetStringLength(
+        const wchar_t* String) noexcept
+    {
+        const wchar_t* End = String;
+        while (*End)
+        {
+            ++End;
+        }
+        return static_cast<std::size_t>(End - String);
+    }
+
+    /**
+     * @brief Gets the length of the name of a NAME=VALUE string. The search
+     *        starts at the second character, so the names like =C: work.
+     * @return The length of the name, or the length of the string if it has
+     *         no = after the first character.
+    */
+    std::size_t GetNameLength(
+        const wchar_t* String,
+        std::size_t Length) noexcept
+    {
+        for (std::size_t i = 1; i < Length; ++i)
+        {
+            if (String[i] == L'=')
+            {
+                return i;
+            }
+        }
+        return Length;
+    }
+
+    bool IsNameLess(
+        const Mile::EnvironmentVariable& Left,
+        const Mile::EnvironmentVariable& Right) noexcept
+    {
+        return Mile::CompareEnvironmentNames(
+            Left.Name,
+            Left.NameLength,
+            Right.Name,
+            Right.NameLength) < 0;
+    }
+
+    const Mile::EnvironmentVariable* FindSorted(
+        const std::vector<Mile::EnvironmentVariable>& Variables,
+        const wchar_t* Name,
+        std::size_t NameLength) noexcept
+    {
+        Mile::EnvironmentVariable Key = { Name, NameLength, nullptr, 0 };
+        auto Iterator = std::lower_bound(
+            Variables.begin(),
+            Variables.end(),
+            Key,
+            IsNameLess);
+        if (Iterator != Variables.end() && !IsNameLess(Key, *Iterator))
+        {
+            return &*Iterator;
+        }
+        return nullptr;
+    }
+
+    void AppendVariable(
+        std::vector<wchar_t>& Block,
+        const Mile::EnvironmentVariable& Variable)
+    {
+        Block.insert(
+            Block.end(),
+            Variable.Name,
+            Variable.Name + Variable.NameLength);
+        Block.push_back(L'=');
+        Block.insert(
+            Block.end(),
+            Variable.Value,
+            Variable.Value + Variable.ValueLength);
+        Block.push_back(L'\0');
+    }
+}
+
+int Mile::CompareEnvironmentNames(
+    const wchar_t* Left,
+    std::size_t LeftLength,
+    const wchar_t* Right,
+    std::size_t RightLength) noexcept
+{
+    std::size_t Length = LeftLength < RightLength ? LeftLength : RightLength;
+    for (std::size_t i = 0; i < Length; ++i)
+    {
+        wchar_t LeftCharacter = FoldCharacter(Left[i]);
+        wchar_t RightCharacter = FoldCharacter(Right[i]);
+        if (LeftCharacter != RightCharacter)
+        {
+            return LeftCharacter < RightCharacter ? -1 : 1;
+        }
+    }
+
+    if (LeftLength == RightLength)
+    {
+        return 0;
+    }
+
+    return LeftLength < RightLength ? -1 : 1;
+}
+
+void Mile::EnvironmentBlock::Parse(
+    const wchar_t* Block)
+{
+    this->m_Variables.clear();
+
+    if (!Block)
+    {
+        return;
+    }
+
+    for (const wchar_t* Current = Block; *Current;)
+    {
+        std::size_t Length = GetStringLength(Current);
+        std::size_t NameLength = GetNameLength(Current, Length);
+        if (NameLength < Length)
+        {
+            EnvironmentVariable Variable;
+            Variable.Name = Current;
+            Variable.NameLength = NameLength;
+            Variable.Value = Current + NameLength + 1;
+            Variable.ValueLength = Length - NameLength - 1;
+            this->m_Variables.push_back(Variable);
+        }
+
+        Current += Length + 1;
+    }
+
+    // The blocks of CreateEnvironmentBlock are sorted already, so the stable
+    // sort is almost linear for them.
+    std::stable_sort(
+        this->m_Variables.begin(),
+        this->m_Variables.end(),
+        IsNameLess);
+    this->m_Variables.erase(
+        std::unique(
+            this->m_Variables.begin(),
+            this->m_Variables.end(),
+            [](
+                const EnvironmentVariable& Left,
+                const EnvironmentVariable& Right)
+            {
+                return !IsNameLess(Left, Right);
+            }),
+        this->m_Variables.end());
+}
+
+const Mile::EnvironmentVariable* Mile::EnvironmentBlock::Find(
+    const wchar_t* Name,
+    std::size_t NameLength) const noexcept
+{
+    return FindSorted(this->m_Variables, Name, NameLength);
+}
+
+const std::vector<Mile::EnvironmentVariable>&
+Mile::EnvironmentBlock::GetVariables() const noexcept
+{
+    return this->m_Variables;
+}
+
+void Mile::EnvironmentOverlay::Update(
+    const wchar_t* Name,
+    std::size_t NameLength,
+    const wchar_t* Value,
+    std::size_t ValueLength,
+    bool Removed)
+{
+    auto Iterator = std::lower_bound(
+        this->m_Entries.begin(),
+        this->m_Entries.end(),
+        std::make_pair(Name, NameLength),
+        [](
+            const Entry& Left,
+            const std::pair<const wchar_t*, std::size_t>& Right)
+        {
+            return Mile::CompareEnvironmentNames(
+                Left.Name.c_str(),
+                Left.Name.size(),
+                Right.first,
+                Right.second) < 0;
+        });
+    if (Iterator == this->m_Entries.end() ||
+        Mile::CompareEnvironmentNames(
+            Iterator->Name.c_str(),
+            Iterator->Name.size(),
+            Name,
+            NameLength))
+    {
+        Iterator = this->m_Entries.insert(Iterator, Entry());
+        Iterator->Name.assign(Name, NameLength);
+    }
+
+    Iterator->Value.assign(Value, ValueLength);
+    Iterator->Removed = Removed;
+
+    // The strings may move when the entries are inserted, so the views are
+    // created again.
+    this->m_Variables.resize(this->m_Entries.size());
+    for (std::size_t i = 0; i < this->m_Entries.size(); ++i)
+    {
+        const Entry& Current = this->m_Entries[i];
+        EnvironmentVariable& Variable = this->m_Variables[i];
+        Variable.Name = Current.Name.c_str();
+        Variable.NameLength = Current.Name.size();
+        Variable.Value = Current.Removed ? nullptr : Current.Value.c_str();
+        Variable.ValueLength = Current.Value.size();
+    }
+}
+
+void Mile::EnvironmentOverlay::Set(
+    const wchar_t* Name,
+    std::size_t NameLength,
+    const wchar_t* Value,
+    std::size_t ValueLength)
+{
+    this->Update(Name, NameLength, Value, ValueLength, false);
+}
+
+void Mile::EnvironmentOverlay::Remove(
+    const wchar_t* Name,
+    std::size_t NameLength)
+{
+    this->Update(Name, NameLength, L"", 0, true);
+}
+
+void Mile::EnvironmentOverlay::Parse(
+    const wchar_t* Overrides)
+{
+    if (!Overrides)
+    {
+        return;
+    }
+
+    for (const wchar_t* Current = Overrides; *Current;)
+    {
+        std::size_t Length = GetStringLength(Current);
+        std::size_t NameLength = GetNameLength(Current, Length);
+        if (NameLength < Length)
+        {
+            this->Set(
+                Current,
+                NameLength,
+                Current + NameLength + 1,
+                Length - NameLength - 1);
+        }
+        else
+        {
+            this->Remove(Current, Length);
+        }
+
+        Current += Length + 1;
+    }
+}
+
+const Mile::EnvironmentVariable* Mile::EnvironmentOverlay::Find(
+    const wchar_t* Name,
+    std::size_t NameLength) const noexcept
+{
+    return FindSorted(this->m_Variables, Name, NameLength);
+}
+
+const std::vector<Mile::EnvironmentVariable>&
+Mile::EnvironmentOverlay::GetVariables() const noexcept
+{
+    return this->m_Variables;
+}
+
+const Mile::EnvironmentVariable* Mile::FindEnvironmentVariable(
+    const EnvironmentBlock& Base,
+    const EnvironmentOverlay* Overlay,
+    const wchar_t* Name,
+    std::size_t NameLength) noexcept
+{
+    if (Overlay)
+    {
+        const EnvironmentVariable* Variable = Overlay->Find(Name, NameLength);
+        if (Variable)
+        {
+            return Variable->Value ? Variable : nullptr;
+        }
+    }
+
+    return Base.Find(Name, NameLength);
+}
+
+namespace
+{
+    /**
+     * @brief Merges the sorted variables of an environment block and an
+     *        overlay, the overlay wins on the same names and the removed
+     *        variables are skipped.
+    */
+    template <typename VisitorType>
+    void MergeVariables(
+        const Mile::EnvironmentBlock& Base,
+        const Mile::EnvironmentOverlay* Overlay,
+        VisitorType&& Visitor)
+    {
+        const std::vector<Mile::EnvironmentVariable>& BaseVariables =
+            Base.GetVariables();
+        static const std::vector<Mile::EnvironmentVariable> EmptyVariables;
+        const std::vector<Mile::EnvironmentVariable>& OverlayVariables =
+            Overlay ? Overlay->GetVariables() : EmptyVariables;
+
+        // Both lists are sorted, so they are merged in one pass.
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < BaseVariables.size() || j < OverlayVariables.size())
+        {
+            int Result = 0;
+            if (i == BaseVariables.size())
+            {
+                Result = 1;
+            }
+            else if (j == OverlayVariables.size())
+            {
+                Result = -1;
+            }
+            else
+            {
+                Result = Mile::CompareEnvironmentNames(
+                    BaseVariables[i].Name,
+                    BaseVariables[i].NameLength,
+                    OverlayVariables[j].Name,
+                    OverlayVariables[j].NameLength);
+            }
+
+            if (Result < 0)
+            {
+                Visitor(BaseVariables[i++]);
+                continue;
+            }
+
+            if (Result == 0)
+            {
+                ++i;
+            }
+
+            const Mile::EnvironmentVariable& Variable = OverlayVariables[j++];
+            if (Variable.Value)
+            {
+                Visitor(Variable);
+            }
+        }
+    }
+
+    /**
+     * @brief Expands the %NAME% references in a string in one pass. The
+     *        references to the undefined variables are kept, and the % which
+     *        ends such a reference can start the next one, the same as
+     *        ExpandEnvironmentStrings.
+    */
+    template <
+        typename LookupType,
+        typename AppendType,
+        typename UnresolvedType>
+    void ExpandReferences(
+        const wchar_t* Source,
+        std::size_t SourceLength,
+        LookupType&& Lookup,
+        AppendType&& Append,
+        UnresolvedType&& Unresolved)
+    {
+        const wchar_t* Current = Source;
+        const wchar_t* End = Source + SourceLength;
+        while (Current != End)
+        {
+            if (*Current != L'%')
+            {
+                const wchar_t* Start = Current;
+                while (Current != End && *Current != L'%')
+                {
+                    ++Current;
+                }
+                Append(Start, static_cast<std::size_t>(Current - Start));
+                continue;
+            }
+
+            const wchar_t* NameStart = Current + 1;
+            const wchar_t* NameEnd = NameStart;
+            while (NameEnd != End && *NameEnd != L'%')
+            {
+                ++NameEnd;
+            }
+
+            if (NameEnd == End)
+            {
+                // No closing %, the rest is copied as is.
+                Append(Current, static_cast<std::size_t>(End - Current));
+                break;
+            }
+
+            std::size_t NameLength =
+                static_cast<std::size_t>(NameEnd - NameStart);
+            const Mile::EnvironmentVariable* Variable =
+                NameLength ? Lookup(NameStart, NameLength) : nullptr;
+
+            if (Variable)
+            {
+                Append(Variable->Value, Variable->ValueLength);
+                Current = NameEnd + 1;
+            }
+            else
+            {
+                if (NameLength)
+                {
+                    Unresolved(
+                        static_cast<std::size_t>(NameStart - Source),
+                        NameLength);
+                }
+                Append(Current, NameLength + 1);
+                Current = NameEnd;
+            }
+        }
+    }
+
+    /**
+     * @brief Hashes a name with FNV-1a, the ASCII letters are folded first so
+     *        the names which are equal for CompareEnvironmentNames have the
+     *        same hash.
+    */
+    std::uint32_t HashEnvironmentName(
+        const wchar_t* Name,
+        std::size_t NameLength) noexcept
+    {
+        std::uint32_t Hash = 2166136261u;
+        for (std::size_t i = 0; i < NameLength; ++i)
+        {
+            Hash ^= static_cast<std::uint32_t>(FoldCharacter(Name[i]));
+            Hash *= 16777619u;
+        }
+        return Hash;
+    }
+}
+
+void Mile::SerializeEnvironmentBlock(
+    const EnvironmentBlock& Base,
+    const EnvironmentOverlay* Overlay,
+    std::vector<wchar_t>& Block)
+{
+    std::size_t Size = 1;
+    for (const EnvironmentVariable& Variable : Base.GetVariables())
+    {
+        Size += Variable.NameLength + Variable.ValueLength + 2;
+    }
+    if (Overlay)
+    {
+        for (const EnvironmentVariable& Variable : Overlay->GetVariables())
+        {
+            Size += Variable.NameLength + Variable.ValueLength + 2;
+        }
+    }
+
+    Block.clear();
+    Block.reserve(Size);
+
+    MergeVariables(Base, Overlay, [&](const EnvironmentVariable& Variable)
+    {
+        AppendVariable(Block, Variable);
+    });
+
+    // An empty block still needs two NUL characters.
+    if (Block.empty())
+    {
+        Block.push_back(L'\0');
+    }
+    Block.push_back(L'\0');
+}
+
+void Mile::ExpandEnvironmentReferences(
+    const EnvironmentBlock& Base,
+    const EnvironmentOverlay* Overlay,
+    const wchar_t* Source,
+    std::wstring& Destination)
+{
+    Destination.clear();
+
+    ExpandReferences(
+        Source,
+        GetStringLength(Source),
+        [&](const wchar_t* Name, std::size_t NameLength)
+        {
+            return FindEnvironmentVariable(Base, Overlay, Name, NameLength);
+        },
+        [&](const wchar_t* String, std::size_t Length)
+        {
+            Destination.append(String, Length);
+        },
+        [](std::size_t, std::size_t)
+        {
+        });
+}
+
+Mile::EnvironmentExpansionBuffer::EnvironmentExpansionBuffer() noexcept :
+    m_Data(m_Inline),
+    m_Size(0),
+    m_Capacity(InlineCapacity)
+{
+    this->m_Inline[0] = L'\0';
+}
+
+Mile::EnvironmentExpansionBuffer::~EnvironmentExpansionBuffer() noexcept
+{
+    if (this->m_Data != this->m_Inline)
+    {
+        delete[] this->m_Data;
+    }
+}
+
+void Mile::EnvironmentExpansionBuffer::Clear() noexcept
+{
+    this->m_Size = 0;
+    this->m_Data[0] = L'\0';
+}
+
+void Mile::EnvironmentExpansionBuffer::Reserve(
+    std::size_t Length)
+{
+    if (Length < this->m_Capacity)
+    {
+        return;
+    }
+
+    std::size_t Capacity = this->m_Capacity * 2;
+    if (Capacity <= Length)
+    {
+        Capacity = Length + 1;
+    }
+
+    wchar_t* Data = new wchar_t[Capacity];
+    std::copy(this->m_Data, this->m_Data + this->m_Size + 1, Data);
+    if (this->m_Data != this->m_Inline)
+    {
+        delete[] this->m_Data;
+    }
+
+    this->m_Data = Data;
+    this->m_Capacity = Capacity;
+}
+
+void Mile::EnvironmentExpansionBuffer::Append(
+    const wchar_t* String,
+    std::size_t Length)
+{
+    this->Reserve(this->m_Size + Length);
+    std::copy(String, String + Length, this->m_Data + this->m_Size);
+    this->m_Size += Length;
+    this->m_Data[this->m_Size] = L'\0';
+}
+
+const wchar_t* Mile::EnvironmentExpansionBuffer::GetData() const noexcept
+{
+    return this->m_Data;
+}
+
+std::size_t Mile::EnvironmentExpansionBuffer::GetSize() const noexcept
+{
+    return this->m_Size;
+}
+
+void Mile::EnvironmentSnapshot::BuildIndex()
+{
+    std::size_t BucketCount = 16;
+    while (BucketCount < this->m_Variables.size() * 2)
+    {
+        BucketCount *= 2;
+    }
+
+    this->m_Buckets.assign(BucketCount, Bucket{ 0, 0 });
+
+    std::size_t Mask = BucketCount - 1;
+    for (std::size_t i = 0; i < this->m_Variables.size(); ++i)
+    {
+        const EnvironmentVariable& Variable = this->m_Variables[i];
+        std::uint32_t Hash = HashEnvironmentName(
+            Variable.Name,
+            Variable.NameLength);
+
+        for (std::size_t Slot = Hash & Mask;; Slot = (Slot + 1) & Mask)
+        {
+            Bucket& Current = this->m_Buckets[Slot];
+            if (!Current.Index)
+            {
+                Current.Hash = Hash;
+                Current.Index = static_cast<std::uint32_t>(i + 1);
+                break;
+            }
+
+            // The first one of the variables with the same name wins.
+            const EnvironmentVariable& Existing =
+                this->m_Variables[Current.Index - 1];
+            if (Current.Hash == Hash && !CompareEnvironmentNames(
+                Existing.Name,
+                Existing.NameLength,
+                Variable.Name,
+                Variable.NameLength))
+            {
+                break;
+            }
+        }
+    }
+}
+
+void Mile::EnvironmentSnapshot::Assign(
+    const wchar_t* Block)
+{
+    this->m_Variables.clear();
+
+    if (Block)
+    {
+        for (const wchar_t* Current = Block; *Current;)
+        {
+            std::size_t Length = GetStringLength(Current);
+            std::size_t NameLength = GetNameLength(Current, Length);
+            if (NameLength < Length)
+            {
+                EnvironmentVariable Variable;
+                Variable.Name = Current;
+                Variable.NameLength = NameLength;
+                Variable.Value = Current + NameLength + 1;
+                Variable.ValueLength = Length - NameLength - 1;
+                this->m_Variables.push_back(Variable);
+            }
+
+            Current += Length + 1;
+        }
+    }
+
+    this->BuildIndex();
+}
+
+void Mile::EnvironmentSnapshot::Assign(
+    const EnvironmentBlock& Base,
+    const EnvironmentOverlay* Overlay)
+{
+    this->m_Variables.clear();
+
+    MergeVariables(Base, Overlay, [&](const EnvironmentVariable& Variable)
+    {
+        this->m_Variables.push_back(Variable);
+    });
+
+    this->BuildIndex();
+}
+
+const Mile::EnvironmentVariable* Mile::EnvironmentSnapshot::Find(
+    const wchar_t* Name,
+    std::size_t NameLength) const noexcept
+{
+    if (this->m_Buckets.empty())
+    {
+        return nullptr;
+    }
+
+    std::uint32_t Hash = HashEnvironmentName(Name, NameLength);
+    std::size_t Mask = this->m_Buckets.size() - 1;
+
+    for (std::size_t Slot = Hash & Mask;; Slot = (Slot + 1) & Mask)
+    {
+        const Bucket& Current = this->m_Buckets[Slot];
+        if (!Current.Index)
+        {
+            return nullptr;
+        }
+
+        const EnvironmentVariable& Variable =
+            this->m_Variables[Current.Index - 1];
+        if (Current.Hash == Hash && !CompareEnvironmentNames(
+            Variable.Name,
+            Variable.NameLength,
+            Name,
+            NameLength))
+        {
+            return &Variable;
+        }
+    }
+}
+
+bool Mile::EnvironmentSnapshot::Expand(
+    const wchar_t* Source,
+    std::size_t SourceLength,
+    EnvironmentExpansionBuffer& Destination,
+    std::vector<EnvironmentReference>* Unresolved) const
+{
+    bool Resolved = true;
+
+    Destination.Clear();
+    Destination.Reserve(SourceLength);
+
+    ExpandReferences(
+        Source,
+        SourceLength,
+        [this](const wchar_t* Name, std::size_t NameLength)
+        {
+            return this->Find(Name, NameLength);
+        },
+        [&](const wchar_t* String, std::size_t Length)
+        {
+            Destination.Append(String, Length);
+        },
+        [&](std::size_t Offset, std::size_t Length)
+        {
+            Resolved = false;
+            if (Unresolved)
+            {
+                Unresolved->push_back(EnvironmentReference{ Offset, Length });
+            }
+        });
+
+    return Resolved;
+}
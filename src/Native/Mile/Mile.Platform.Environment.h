@@ -0,0 +1,434 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Environment.h
+ * PURPOSE:   Environment Block Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_ENVIRONMENT
+#define MILE_PLATFORM_ENVIRONMENT
+
+#include "Mile.Platform.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Mile
+{
+    /**
+     * @brief A variable of an environment block. The strings are not
+     *        terminated by NUL.
+    */
+    struct EnvironmentVariable
+    {
+        const wchar_t* Name;
+        std::size_t NameLength;
+        const wchar_t* Value;
+        std::size_t ValueLength;
+    };
+
+    /**
+     * @brief Compares the names of two environment variables.
+     * @param Left The first name.
+     * @param LeftLength The number of the characters of the first name.
+     * @param Right The second name.
+     * @param RightLength The number of the characters of the second name.
+     * @return A negative value if the first name is less than the second
+     *         name, 0 if they are equal, and a positive value otherwise.
+     * @remark The names are compared case-insensitively for ASCII only, the
+     *         order is the same as the order of the blocks which are created
+     *         by CreateEnvironmentBlock for the ASCII names.
+    */
+    int CompareEnvironmentNames(
+        const wchar_t* Left,
+        std::size_t LeftLength,
+        const wchar_t* Right,
+        std::size_t RightLength) noexcept;
+
+    /**
+     * @brief A sorted index over an environment block in the format of
+     *        CREATE_UNICODE_ENVIRONMENT, which is NAME=VALUE strings followed
+     *        by an empty string.
+     * @remark The index refers to the block without copying it, so the block
+     *         should live as long as the index.
+    */
+    class EnvironmentBlock : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief The variables sorted by their names.
+        */
+        std::vector<EnvironmentVariable> m_Variables;
+
+    public:
+
+        /**
+         * @brief Creates an empty index.
+        */
+        EnvironmentBlock() = default;
+
+        /**
+         * @brief Indexes an environment block.
+         * @param Block The environment block, or nullptr for an empty one.
+         * @remark The entries without a name are skipped, and the first one
+         *         of the entries with the same name is used. The names which
+         *         start with = like =C: are kept.
+        */
+        void Parse(
+            const wchar_t* Block);
+
+        /**
+         * @brief Finds a variable.
+         * @param Name The name of the variable.
+         * @param NameLength The number of the characters of the name.
+         * @return The variable, or nullptr if it is not found.
+        */
+        const EnvironmentVariable* Find(
+            const wchar_t* Name,
+            std::size_t NameLength) const noexcept;
+
+        /**
+         * @brief Retrieves the variables sorted by their names.
+         * @return The variables.
+        */
+        const std::vector<EnvironmentVariable>& GetVariables() const noexcept;
+    };
+
+    /**
+     * @brief The variables which are set or removed on top of an environment
+     *        block for a launch. The base block is not copied, the overlay is
+     *        merged with it when the result is serialized.
+    */
+    class EnvironmentOverlay : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        struct Entry
+        {
+            std::wstring Name;
+            std::wstring Value;
+            bool Removed;
+        };
+
+        /**
+         * @brief The entries sorted by their names.
+        */
+        std::vector<Entry> m_Entries;
+
+        /**
+         * @brief The views of the entries, the value of a removed variable
+         *        is nullptr.
+        */
+        std::vector<EnvironmentVariable> m_Variables;
+
+        void Update(
+            const wchar_t* Name,
+            std::size_t NameLength,
+            const wchar_t* Value,
+            std::size_t ValueLength,
+            bool Removed);
+
+    public:
+
+        /**
+         * @brief Creates an empty overlay.
+        */
+        EnvironmentOverlay() = default;
+
+        /**
+         * @brief Sets a variable, it overrides the base block.
+         * @param Name The name of the variable.
+         * @param NameLength The number of the characters of the name.
+         * @param Value The value of the variable.
+         * @param ValueLength The number of the characters of the value.
+        */
+        void Set(
+            const wchar_t* Name,
+            std::size_t NameLength,
+            const wchar_t* Value,
+            std::size_t ValueLength);
+
+        /**
+         * @brief Removes a variable from the result, even if the base block
+         *        has it.
+         * @param Name The name of the variable.
+         * @param NameLength The number of the characters of the name.
+        */
+        void Remove(
+            const wchar_t* Name,
+            std::size_t NameLength);
+
+        /**
+         * @brief Applies a list of overrides.
+         * @param Overrides The NUL-terminated strings followed by an empty
+         *                  string, the same as an environment block. The
+         *                  NAME=VALUE strings set the variables and the NAME
+         *                  strings without = remove them.
+        */
+        void Parse(
+            const wchar_t* Overrides);
+
+        /**
+         * @brief Finds a variable.
+         * @param Name The name of the variable.
+         * @param NameLength The number of the characters of the name.
+         * @return The variable, or nullptr if the overlay does not have it.
+         *         The value is nullptr if the variable is removed.
+        */
+        const EnvironmentVariable* Find(
+            const wchar_t* Name,
+            std::size_t NameLength) const noexcept;
+
+        /**
+         * @brief Retrieves the variables sorted by their names.
+         * @return The variables.
+        */
+        const std::vector<EnvironmentVariable>& GetVariables() const noexcept;
+    };
+
+    /**
+     * @brief Finds a variable in an environment block and an overlay.
+     * @param Base The base environment block.
+     * @param Overlay The overlay, or nullptr if there is none.
+     * @param Name The name of the variable.
+     * @param NameLength The number of the characters of the name.
+     * @return The variable, or nullptr if it is not found or removed.
+    */
+    const EnvironmentVariable* FindEnvironmentVariable(
+        const EnvironmentBlock& Base,
+        const EnvironmentOverlay* Overlay,
+        const wchar_t* Name,
+        std::size_t NameLength) noexcept;
+
+    /**
+     * @brief Merges an environment block and an overlay into a new block in
+     *        the format of CREATE_UNICODE_ENVIRONMENT.
+     * @param Base The base environment block.
+     * @param Overlay The overlay, or nullptr if there is none.
+     * @param Block The result, the variables are sorted by their names.
+    */
+    void SerializeEnvironmentBlock(
+        const EnvironmentBlock& Base,
+        const EnvironmentOverlay* Overlay,
+        std::vector<wchar_t>& Block);
+
+    /**
+     * @brief Expands the %NAME% references in a string in one pass.
+     * @param Base The base environment block.
+     * @param Overlay The overlay, or nullptr if there is none.
+     * @param Source The NUL-terminated string to expand.
+     * @param Destination The expanded string.
+     * @remark The same as ExpandEnvironmentStrings, the references to the
+     *         undefined variables are kept, and the % which ends such a
+     *         reference can start the next one.
+    */
+    void ExpandEnvironmentReferences(
+        const EnvironmentBlock& Base,
+        const EnvironmentOverlay* Overlay,
+        const wchar_t* Source,
+        std::wstring& Destination);
+
+    /**
+     * @brief A growable string buffer for the expanded strings. The short
+     *        strings are stored in the buffer itself without allocations.
+    */
+    class EnvironmentExpansionBuffer :
+        DisableCopyConstruction,
+        DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief The number of the characters stored in the buffer itself,
+         *        which is enough for most paths and command lines.
+        */
+        static const std::size_t InlineCapacity = 260;
+
+        /**
+         * @brief The characters, it points to m_Inline or to a heap block.
+        */
+        wchar_t* m_Data;
+
+        /**
+         * @brief The number of the characters, without the terminating NUL.
+        */
+        std::size_t m_Size;
+
+        /**
+         * @brief The number of the characters which m_Data can hold, with
+         *        the terminating NUL.
+        */
+        std::size_t m_Capacity;
+
+        /**
+         * @brief The storage of the short strings.
+        */
+        wchar_t m_Inline[InlineCapacity];
+
+    public:
+
+        /**
+         * @brief Creates an empty buffer.
+        */
+        EnvironmentExpansionBuffer() noexcept;
+
+        /**
+         * @brief Frees the heap block if there is one.
+        */
+        ~EnvironmentExpansionBuffer() noexcept;
+
+        /**
+         * @brief Empties the buffer, the capacity is kept for reuse.
+        */
+        void Clear() noexcept;
+
+        /**
+         * @brief Makes sure the buffer can hold a number of characters
+         *        without growing again.
+         * @param Length The number of the characters, without the
+         *               terminating NUL.
+        */
+        void Reserve(
+            std::size_t Length);
+
+        /**
+         * @brief Appends characters to the buffer.
+         * @param String The characters.
+         * @param Length The number of the characters.
+        */
+        void Append(
+            const wchar_t* String,
+            std::size_t Length);
+
+        /**
+         * @brief Retrieves the NUL-terminated string.
+         * @return The string.
+        */
+        const wchar_t* GetData() const noexcept;
+
+        /**
+         * @brief Retrieves the number of the characters.
+         * @return The number of the characters, without the terminating NUL.
+        */
+        std::size_t GetSize() const noexcept;
+    };
+
+    /**
+     * @brief A reference to an undefined variable in an expanded string.
+    */
+    struct EnvironmentReference
+    {
+        /**
+         * @brief The offset of the name in the source string, the % before
+         *        it is not included.
+        */
+        std::size_t Offset;
+
+        /**
+         * @brief The number of the characters of the name.
+        */
+        std::size_t Length;
+    };
+
+    /**
+     * @brief A hashed index over the variables of an environment, it is
+     *        built once and expands many strings.
+     * @remark The snapshot refers to the strings of the environment without
+     *         copying them, so they should live as long as the snapshot. The
+     *         snapshot is read-only after it is built, so it can be used by
+     *         many threads at the same time.
+    */
+    class EnvironmentSnapshot :
+        DisableCopyConstruction,
+        DisableMoveConstruction
+    {
+    private:
+
+        struct Bucket
+        {
+            std::uint32_t Hash;
+
+            /**
+             * @brief The index of the variable plus 1, or 0 if the bucket is
+             *        empty.
+            */
+            std::uint32_t Index;
+        };
+
+        /**
+         * @brief The variables.
+        */
+        std::vector<EnvironmentVariable> m_Variables;
+
+        /**
+         * @brief The open addressing table of the variables, the number of
+         *        the buckets is a power of two.
+        */
+        std::vector<Bucket> m_Buckets;
+
+        void BuildIndex();
+
+    public:
+
+        /**
+         * @brief Creates an empty snapshot.
+        */
+        EnvironmentSnapshot() = default;
+
+        /**
+         * @brief Indexes an environment block in the format of
+         *        CREATE_UNICODE_ENVIRONMENT, for example, the result of
+         *        GetEnvironmentStringsW.
+         * @param Block The environment block, or nullptr for an empty one.
+         *              The first one of the entries with the same name is
+         *              used.
+        */
+        void Assign(
+            const wchar_t* Block);
+
+        /**
+         * @brief Indexes the result of merging an environment block and an
+         *        overlay.
+         * @param Base The base environment block.
+         * @param Overlay The overlay, or nullptr if there is none.
+        */
+        void Assign(
+            const EnvironmentBlock& Base,
+            const EnvironmentOverlay* Overlay);
+
+        /**
+         * @brief Finds a variable.
+         * @param Name The name of the variable.
+         * @param NameLength The number of the characters of the name.
+         * @return The variable, or nullptr if it is not found.
+        */
+        const EnvironmentVariable* Find(
+            const wchar_t* Name,
+            std::size_t NameLength) const noexcept;
+
+        /**
+         * @brief Expands the %NAME% references in a string in one pass.
+         * @param Source The string to expand, it does not need to be
+         *               terminated by NUL.
+         * @param SourceLength The number of the characters of the string.
+         * @param Destination The expanded string, the buffer is emptied
+         *                    first.
+         * @param Unresolved The references to the undefined variables are
+         *                   appended to it if it is not nullptr.
+         * @return If all references are resolved, the return value is true.
+         * @remark The rules are the same as ExpandEnvironmentReferences.
+        */
+        bool Expand(
+            const wchar_t* Source,
+            std::size_t SourceLength,
+            EnvironmentExpansionBuffer& Destination,
+            std::vector<EnvironmentReference>* Unresolved) const;
+    };
+}
+
+#endif // !MILE_PLATFORM_ENVIRONMENT
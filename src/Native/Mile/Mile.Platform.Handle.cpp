@@ -0,0 +1,76 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Handle.cpp
+ * PURPOSE:   Typed Handle Wrapper Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.Handle.h"
+
+namespace
+{
+    /**
+     * @brief The counters of a kind of handles. Each kind has its own cache
+     *        line, so the threads which use different kinds do not contend.
+    */
+    struct alignas(64) HandleCounters
+    {
+        std::atomic<std::intptr_t> LiveCount;
+        std::atomic<std::uint64_t> OpenedCount;
+    };
+
+    HandleCounters g_HandleCounters[
+        static_cast<std::size_t>(Mile::HandleKind::MaximumValue)];
+
+    HandleCounters* GetHandleCounters(
+        Mile::HandleKind Kind) noexcept
+    {
+        std::size_t Index = static_cast<std::size_t>(Kind);
+        if (Index >= static_cast<std::size_t>(Mile::HandleKind::MaximumValue))
+        {
+            return nullptr;
+        }
+        return &g_HandleCounters[Index];
+    }
+}
+
+void Mile::AccountHandleOpened(
+    HandleKind Kind) noexcept
+{
+    HandleCounters* Counters = ::GetHandleCounters(Kind);
+    if (Counters)
+    {
+        Counters->LiveCount.fetch_add(1, std::memory_order_relaxed);
+        Counters->OpenedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Mile::AccountHandleClosed(
+    HandleKind Kind) noexcept
+{
+    HandleCounters* Counters = ::GetHandleCounters(Kind);
+    if (Counters)
+    {
+        Counters->LiveCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+Mile::HandleStatistics Mile::QueryHandleStatistics(
+    HandleKind Kind) noexcept
+{
+    HandleStatistics Statistics = { 0, 0 };
+
+    HandleCounters* Counters = ::GetHandleCounters(Kind);
+    if (Counters)
+    {
+        Statistics.LiveCount =
+            Counters->LiveCount.load(std::memory_order_relaxed);
+        Statistics.OpenedCount =
+            Counters->OpenedCount.load(std::memory_order_relaxed);
+    }
+
+    return Statistics;
+}
@@ -0,0 +1,286 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Handle.h
+ * PURPOSE:   Typed Handle Wrapper Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_HANDLE
+#define MILE_PLATFORM_HANDLE
+
+#include "Mile.Platform.h"
+
+/**
+ * @brief Whether the handle wrappers count the live handles of each kind.
+ *        It is enabled in the debug builds by default, and it should be the
+ *        same for all modules of a process.
+*/
+#ifndef MILE_HANDLE_ACCOUNTING
+#ifdef _DEBUG
+#define MILE_HANDLE_ACCOUNTING 1
+#else
+#define MILE_HANDLE_ACCOUNTING 0
+#endif
+#endif
+
+namespace Mile
+{
+    /**
+     * @brief The kinds of the handles which are counted separately.
+    */
+    enum class HandleKind : std::uint32_t
+    {
+        Token,
+        Process,
+        Thread,
+        Service,
+        File,
+        Mapping,
+        HeapBlock,
+        MaximumValue,
+    };
+
+    /**
+     * @brief The statistics of a kind of handles.
+    */
+    struct HandleStatistics
+    {
+        /**
+         * @brief The number of the handles which are owned by the wrappers
+         *        now. It can be negative if the wrappers close the handles
+         *        which are opened by the modules without accounting.
+        */
+        std::intptr_t LiveCount;
+
+        /**
+         * @brief The number of the handles which have been owned by the
+         *        wrappers since the process started.
+        */
+        std::uint64_t OpenedCount;
+    };
+
+    /**
+     * @brief Records that a wrapper takes the ownership of a handle.
+     * @param Kind The kind of the handle.
+    */
+    void AccountHandleOpened(
+        HandleKind Kind) noexcept;
+
+    /**
+     * @brief Records that a wrapper gives up the ownership of a handle.
+     * @param Kind The kind of the handle.
+    */
+    void AccountHandleClosed(
+        HandleKind Kind) noexcept;
+
+    /**
+     * @brief Retrieves the statistics of a kind of handles.
+     * @param Kind The kind of the handles.
+     * @return The statistics. They are always zero if the accounting is
+     *         disabled.
+     * @remark The counters are updated without locks, so the statistics of
+     *         different kinds are not a consistent snapshot.
+    */
+    HandleStatistics QueryHandleStatistics(
+        HandleKind Kind) noexcept;
+
+    template <typename Traits>
+    class UniqueHandle;
+
+    /**
+     * @brief Receives a handle from a function which returns it through a
+     *        pointer, the handle is counted when the receiver is destroyed at
+     *        the end of the full expression.
+    */
+    template <typename Traits>
+    class UniqueHandleReceiver
+    {
+    private:
+
+        UniqueHandle<Traits>& m_Owner;
+
+    public:
+
+        explicit UniqueHandleReceiver(
+            UniqueHandle<Traits>& Owner) noexcept :
+            m_Owner(Owner)
+        {
+        }
+
+        UniqueHandleReceiver(
+            const UniqueHandleReceiver&) = delete;
+
+        UniqueHandleReceiver& operator=(
+            const UniqueHandleReceiver&) = delete;
+
+        ~UniqueHandleReceiver() noexcept
+        {
+            this->m_Owner.AccountOpened();
+        }
+
+        operator typename Traits::ValueType*() const noexcept
+        {
+            return &this->m_Owner.m_Value;
+        }
+    };
+
+    /**
+     * @brief Owns a handle and closes it when it goes out of scope. It can
+     *        be moved but not copied, and it is as large as the handle.
+     * @remark The traits define the handle:
+     *         - ValueType is the type of the handle.
+     *         - Kind is the HandleKind of the handle.
+     *         - InvalidValue() returns the value of an empty wrapper.
+     *         - IsValid(Value) checks whether a value should be closed.
+     *         - Close(Value) closes a valid value.
+    */
+    template <typename Traits>
+    class UniqueHandle
+    {
+    public:
+
+        typedef typename Traits::ValueType ValueType;
+
+    private:
+
+        friend class UniqueHandleReceiver<Traits>;
+
+        ValueType m_Value;
+
+        void AccountOpened() const noexcept
+        {
+#if MILE_HANDLE_ACCOUNTING
+            if (Traits::IsValid(this->m_Value))
+            {
+                Mile::AccountHandleOpened(Traits::Kind);
+            }
+#endif
+        }
+
+        void AccountClosed() const noexcept
+        {
+#if MILE_HANDLE_ACCOUNTING
+            if (Traits::IsValid(this->m_Value))
+            {
+                Mile::AccountHandleClosed(Traits::Kind);
+            }
+#endif
+        }
+
+    public:
+
+        /**
+         * @brief Creates an empty wrapper.
+        */
+        UniqueHandle() noexcept :
+            m_Value(Traits::InvalidValue())
+        {
+        }
+
+        /**
+         * @brief Takes the ownership of a handle.
+         * @param Value The handle.
+        */
+        explicit UniqueHandle(
+            ValueType Value) noexcept :
+            m_Value(Value)
+        {
+            this->AccountOpened();
+        }
+
+        UniqueHandle(
+            UniqueHandle&& Other) noexcept :
+            m_Value(Other.m_Value)
+        {
+            Other.m_Value = Traits::InvalidValue();
+        }
+
+        UniqueHandle& operator=(
+            UniqueHandle&& Other) noexcept
+        {
+            if (this != &Other)
+            {
+                this->Reset();
+                this->m_Value = Other.m_Value;
+                Other.m_Value = Traits::InvalidValue();
+            }
+            return *this;
+        }
+
+        UniqueHandle(
+            const UniqueHandle&) = delete;
+
+        UniqueHandle& operator=(
+            const UniqueHandle&) = delete;
+
+        /**
+         * @brief Closes the handle.
+        */
+        ~UniqueHandle() noexcept
+        {
+            this->Reset();
+        }
+
+        /**
+         * @brief Checks whether the wrapper owns a handle.
+        */
+        explicit operator bool() const noexcept
+        {
+            return Traits::IsValid(this->m_Value);
+        }
+
+        /**
+         * @brief Retrieves the handle, the wrapper keeps the ownership.
+         * @return The handle.
+        */
+        ValueType Get() const noexcept
+        {
+            return this->m_Value;
+        }
+
+        /**
+         * @brief Closes the handle and takes the ownership of another one.
+         * @param Value The new handle, or the invalid value to empty the
+         *              wrapper.
+        */
+        void Reset(
+            ValueType Value = Traits::InvalidValue()) noexcept
+        {
+            if (Traits::IsValid(this->m_Value))
+            {
+                this->AccountClosed();
+                Traits::Close(this->m_Value);
+            }
+            this->m_Value = Value;
+            this->AccountOpened();
+        }
+
+        /**
+         * @brief Gives up the ownership of the handle without closing it.
+         * @return The handle, the caller should close it.
+        */
+        ValueType Detach() noexcept
+        {
+            this->AccountClosed();
+            ValueType Value = this->m_Value;
+            this->m_Value = Traits::InvalidValue();
+            return Value;
+        }
+
+        /**
+         * @brief Closes the handle and receives a new one from a function
+         *        which returns it through a pointer.
+         * @return The receiver, it converts to a pointer to the handle.
+        */
+        UniqueHandleReceiver<Traits> Put() noexcept
+        {
+            this->Reset();
+            return UniqueHandleReceiver<Traits>(*this);
+        }
+    };
+}
+
+#endif // !MILE_PLATFORM_HANDLE
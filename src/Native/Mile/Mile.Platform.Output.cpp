@@ -0,0 +1,412 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Output.cpp
+ * PURPOSE:   Buffered Output Sink Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.Output.h"
+#include "Mile.Platform.Resource.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <unistd.h>
+#else
+#error "[Mile] The output sink is not implemented for the platform."
+#endif
+
+#include <cstring>
+#include <cwchar>
+
+namespace
+{
+    const std::uint32_t ReplacementCharacter = 0xFFFD;
+
+    bool IsHighSurrogate(
+        std::uint32_t CodeUnit) noexcept
+    {
+        return CodeUnit >= 0xD800 && CodeUnit <= 0xDBFF;
+    }
+
+    bool IsLowSurrogate(
+        std::uint32_t CodeUnit) noexcept
+    {
+        return CodeUnit >= 0xDC00 && CodeUnit <= 0xDFFF;
+    }
+}
+
+Mile::OutputSegment::OutputSegment(
+    std::string_view Text) noexcept :
+    Utf8(Text.data()),
+    Wide(nullptr),
+    Length(Text.size())
+{
+}
+
+Mile::OutputSegment::OutputSegment(
+    std::wstring_view Text) noexcept :
+    Utf8(nullptr),
+    Wide(Text.data()),
+    Length(Text.size())
+{
+}
+
+Mile::OutputSegment::OutputSegment(
+    const char* Text) noexcept :
+    Utf8(Text ? Text : ""),
+    Wide(nullptr),
+    Length(Text ? std::strlen(Text) : 0)
+{
+}
+
+Mile::OutputSegment::OutputSegment(
+    const wchar_t* Text) noexcept :
+    Utf8(nullptr),
+    Wide(Text ? Text : L""),
+    Length(Text ? std::wcslen(Text) : 0)
+{
+}
+
+Mile::OutputSegment::OutputSegment(
+    const std::string& Text) noexcept :
+    Utf8(Text.data()),
+    Wide(nullptr),
+    Length(Text.size())
+{
+}
+
+Mile::OutputSegment::OutputSegment(
+    const std::wstring& Text) noexcept :
+    Utf8(nullptr),
+    Wide(Text.data()),
+    Length(Text.size())
+{
+}
+
+bool Mile::OutputSink::WriteHandle(
+    const void* Data,
+    std::size_t Size) noexcept
+{
+    const char* Current = reinterpret_cast<const char*>(Data);
+
+#if defined(_WIN32)
+    HANDLE Handle = reinterpret_cast<HANDLE>(this->m_Handle);
+
+    if (this->m_IsConsole)
+    {
+        // The data of a console are UTF-16 characters.
+        const wchar_t* Characters = reinterpret_cast<const wchar_t*>(Current);
+        std::size_t Count = Size / sizeof(wchar_t);
+        while (Count)
+        {
+            DWORD NumberOfCharsWritten = 0;
+            if (!::WriteConsoleW(
+                Handle,
+                Characters,
+                static_cast<DWORD>(Count < 0x4000 ? Count : 0x4000),
+                &NumberOfCharsWritten,
+                nullptr))
+            {
+                return false;
+            }
+            Characters += NumberOfCharsWritten;
+            Count -= NumberOfCharsWritten;
+        }
+        return true;
+    }
+
+    while (Size)
+    {
+        DWORD NumberOfBytesWritten = 0;
+        if (!::WriteFile(
+            Handle,
+            Current,
+            static_cast<DWORD>(Size < 0x40000000 ? Size : 0x40000000),
+            &NumberOfBytesWritten,
+            nullptr))
+        {
+            return false;
+        }
+        Current += NumberOfBytesWritten;
+        Size -= NumberOfBytesWritten;
+    }
+#elif defined(__linux__)
+    while (Size)
+    {
+        ssize_t Written = ::write(this->m_Handle, Current, Size);
+        if (Written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        Current += Written;
+        Size -= static_cast<std::size_t>(Written);
+    }
+#endif
+
+    return true;
+}
+
+bool Mile::OutputSink::FlushBuffer() noexcept
+{
+    if (!this->m_Used)
+    {
+        return true;
+    }
+
+    bool Result = this->WriteHandle(this->m_Bytes, this->m_Used);
+    this->m_Used = 0;
+    return Result;
+}
+
+bool Mile::OutputSink::AppendCodePoint(
+    std::uint32_t CodePoint) noexcept
+{
+    if (BufferSize - this->m_Used < 4 && !this->FlushBuffer())
+    {
+        return false;
+    }
+
+    char* Current = this->m_Bytes + this->m_Used;
+    if (CodePoint < 0x80)
+    {
+        Current[0] = static_cast<char>(CodePoint);
+        this->m_Used += 1;
+    }
+    else if (CodePoint < 0x800)
+    {
+        Current[0] = static_cast<char>(0xC0 | (CodePoint >> 6));
+        Current[1] = static_cast<char>(0x80 | (CodePoint & 0x3F));
+        this->m_Used += 2;
+    }
+    else if (CodePoint < 0x10000)
+    {
+        Current[0] = static_cast<char>(0xE0 | (CodePoint >> 12));
+        Current[1] = static_cast<char>(0x80 | ((CodePoint >> 6) & 0x3F));
+        Current[2] = static_cast<char>(0x80 | (CodePoint & 0x3F));
+        this->m_Used += 3;
+    }
+    else
+    {
+        Current[0] = static_cast<char>(0xF0 | (CodePoint >> 18));
+        Current[1] = static_cast<char>(0x80 | ((CodePoint >> 12) & 0x3F));
+        Current[2] = static_cast<char>(0x80 | ((CodePoint >> 6) & 0x3F));
+        Current[3] = static_cast<char>(0x80 | (CodePoint & 0x3F));
+        this->m_Used += 4;
+    }
+
+    return true;
+}
+
+bool Mile::OutputSink::WriteUtf8(
+    const char* Text,
+    std::size_t Length) noexcept
+{
+#if defined(_WIN32)
+    if (this->m_IsConsole)
+    {
+        const std::size_t Capacity = BufferSize / sizeof(wchar_t);
+
+        while (Length)
+        {
+            std::size_t Available =
+                Capacity - this->m_Used / sizeof(wchar_t);
+            if (Available < 4)
+            {
+                if (!this->FlushBuffer())
+                {
+                    return false;
+                }
+                Available = Capacity;
+            }
+
+            // A UTF-8 byte never becomes more than one UTF-16 code unit.
+            std::size_t Chunk = Mile::GetUtf8ChunkLength(
+                std::string_view(Text, Length),
+                Available);
+            int Converted = ::MultiByteToWideChar(
+                CP_UTF8,
+                0,
+                Text,
+                static_cast<int>(Chunk),
+                this->m_Characters + this->m_Used / sizeof(wchar_t),
+                static_cast<int>(Available));
+            if (!Converted)
+            {
+                return false;
+            }
+
+            this->m_Used += Converted * sizeof(wchar_t);
+            Text += Chunk;
+            Length -= Chunk;
+        }
+
+        return true;
+    }
+#endif
+
+    if (this->m_PendingSurrogate)
+    {
+        this->m_PendingSurrogate = 0;
+        if (!this->AppendCodePoint(ReplacementCharacter))
+        {
+            return false;
+        }
+    }
+
+    if (this->m_Used + Length > BufferSize && !this->FlushBuffer())
+    {
+        return false;
+    }
+
+    if (Length >= BufferSize)
+    {
+        return this->WriteHandle(Text, Length);
+    }
+
+    std::memcpy(this->m_Bytes + this->m_Used, Text, Length);
+    this->m_Used += Length;
+    return true;
+}
+
+bool Mile::OutputSink::WriteWide(
+    const wchar_t* Text,
+    std::size_t Length) noexcept
+{
+#if defined(_WIN32)
+    if (this->m_IsConsole)
+    {
+        std::size_t Size = Length * sizeof(wchar_t);
+
+        if (this->m_Used + Size > BufferSize && !this->FlushBuffer())
+        {
+            return false;
+        }
+
+        if (Size >= BufferSize)
+        {
+            return this->WriteHandle(Text, Size);
+        }
+
+        std::memcpy(this->m_Bytes + this->m_Used, Text, Size);
+        this->m_Used += Size;
+        return true;
+    }
+#endif
+
+    for (std::size_t i = 0; i < Length; ++i)
+    {
+        std::uint32_t CodeUnit = static_cast<std::uint32_t>(Text[i]);
+
+        if (this->m_PendingSurrogate)
+        {
+            std::uint32_t HighSurrogate = this->m_PendingSurrogate;
+            this->m_PendingSurrogate = 0;
+
+            if (::IsLowSurrogate(CodeUnit))
+            {
+                if (!this->AppendCodePoint(
+                    0x10000 +
+                    ((HighSurrogate - 0xD800) << 10) +
+                    (CodeUnit - 0xDC00)))
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            if (!this->AppendCodePoint(ReplacementCharacter))
+            {
+                return false;
+            }
+        }
+
+        if (::IsHighSurrogate(CodeUnit))
+        {
+            this->m_PendingSurrogate = CodeUnit;
+            continue;
+        }
+
+        if (::IsLowSurrogate(CodeUnit) || CodeUnit > 0x10FFFF)
+        {
+            CodeUnit = ReplacementCharacter;
+        }
+
+        if (!this->AppendCodePoint(CodeUnit))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Mile::OutputSink::OutputSink(
+    OutputHandle Handle) noexcept :
+    m_Handle(Handle),
+    m_IsConsole(false),
+    m_PendingSurrogate(0),
+    m_Used(0)
+{
+#if defined(_WIN32)
+    DWORD Mode = 0;
+    this->m_IsConsole =
+        Handle &&
+        Handle != INVALID_HANDLE_VALUE &&
+        ::GetConsoleMode(reinterpret_cast<HANDLE>(Handle), &Mode);
+#elif defined(__linux__)
+    // The terminals take UTF-8, so they are written as the pipes.
+    this->m_IsConsole = ::isatty(Handle) == 1;
+#endif
+}
+
+Mile::OutputSink::~OutputSink() noexcept
+{
+    if (this->m_PendingSurrogate)
+    {
+        this->m_PendingSurrogate = 0;
+        this->AppendCodePoint(ReplacementCharacter);
+    }
+
+    this->FlushBuffer();
+}
+
+bool Mile::OutputSink::IsConsole() const noexcept
+{
+    return this->m_IsConsole;
+}
+
+bool Mile::OutputSink::Write(
+    const OutputSegment& Segment) noexcept
+{
+    return Segment.Utf8
+        ? this->WriteUtf8(Segment.Utf8, Segment.Length)
+        : this->WriteWide(Segment.Wide, Segment.Length);
+}
+
+bool Mile::OutputSink::Write(
+    std::initializer_list<OutputSegment> Segments) noexcept
+{
+    for (const OutputSegment& Segment : Segments)
+    {
+        if (!this->Write(Segment))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Mile::OutputSink::Flush() noexcept
+{
+    return this->FlushBuffer();
+}
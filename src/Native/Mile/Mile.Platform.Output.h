@@ -0,0 +1,173 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Output.h
+ * PURPOSE:   Buffered Output Sink Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_OUTPUT
+#define MILE_PLATFORM_OUTPUT
+
+#include "Mile.Platform.h"
+
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+namespace Mile
+{
+#if defined(_WIN32)
+    /**
+     * @brief The HANDLE of a console screen buffer, a pipe or a file.
+    */
+    typedef void* OutputHandle;
+#elif defined(__linux__)
+    /**
+     * @brief The file descriptor of a terminal, a pipe or a file.
+    */
+    typedef int OutputHandle;
+#endif
+
+    /**
+     * @brief A piece of text which is written by an output sink. It refers
+     *        to the text without copying it, so the text should live until
+     *        the segment is written.
+    */
+    struct OutputSegment
+    {
+        /**
+         * @brief The UTF-8 text, or nullptr if the text is wide.
+        */
+        const char* Utf8;
+
+        /**
+         * @brief The wide text, or nullptr if the text is UTF-8. It is UTF-16
+         *        on Windows and UTF-32 on Linux.
+        */
+        const wchar_t* Wide;
+
+        /**
+         * @brief The number of the code units of the text.
+        */
+        std::size_t Length;
+
+        OutputSegment(
+            std::string_view Text) noexcept;
+
+        OutputSegment(
+            std::wstring_view Text) noexcept;
+
+        OutputSegment(
+            const char* Text) noexcept;
+
+        OutputSegment(
+            const wchar_t* Text) noexcept;
+
+        OutputSegment(
+            const std::string& Text) noexcept;
+
+        OutputSegment(
+            const std::wstring& Text) noexcept;
+    };
+
+    /**
+     * @brief Writes text to a console, a pipe or a file through a fixed-size
+     *        buffer. The text is written as UTF-16 to a Windows console, and
+     *        it is transcoded to UTF-8 in chunks for the others.
+     * @remark The segments are gathered into the buffer without building the
+     *         whole text, and the segments which are larger than the buffer
+     *         are written directly when no transcoding is needed. An output
+     *         sink should be used by one thread at a time.
+    */
+    class OutputSink : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        static const std::size_t BufferSize = 4096;
+
+        OutputHandle m_Handle;
+        bool m_IsConsole;
+
+        /**
+         * @brief The high surrogate which waits for its low surrogate, or 0.
+        */
+        std::uint32_t m_PendingSurrogate;
+
+        std::size_t m_Used;
+
+        union
+        {
+            char m_Bytes[BufferSize];
+            wchar_t m_Characters[BufferSize / sizeof(wchar_t)];
+        };
+
+        bool WriteHandle(
+            const void* Data,
+            std::size_t Size) noexcept;
+
+        bool FlushBuffer() noexcept;
+
+        bool AppendCodePoint(
+            std::uint32_t CodePoint) noexcept;
+
+        bool WriteUtf8(
+            const char* Text,
+            std::size_t Length) noexcept;
+
+        bool WriteWide(
+            const wchar_t* Text,
+            std::size_t Length) noexcept;
+
+    public:
+
+        /**
+         * @brief Creates an output sink and detects the kind of the output.
+         * @param Handle The output, it is not closed by the output sink.
+        */
+        explicit OutputSink(
+            OutputHandle Handle) noexcept;
+
+        /**
+         * @brief Writes the buffered text. A high surrogate which is not
+         *        followed by a low surrogate is written as U+FFFD.
+        */
+        ~OutputSink() noexcept;
+
+        /**
+         * @brief Checks whether the output is a console or a terminal.
+         * @return true if the output is a console or a terminal.
+        */
+        bool IsConsole() const noexcept;
+
+        /**
+         * @brief Writes a segment.
+         * @param Segment The segment.
+         * @return true if the segment is buffered or written. If it is false,
+         *         an application can call GetLastError on Windows or read
+         *         errno on Linux for extended error information.
+        */
+        bool Write(
+            const OutputSegment& Segment) noexcept;
+
+        /**
+         * @brief Writes the segments in order, without concatenating them.
+         * @param Segments The segments.
+         * @return true if the segments are buffered or written.
+        */
+        bool Write(
+            std::initializer_list<OutputSegment> Segments) noexcept;
+
+        /**
+         * @brief Writes the buffered text. A high surrogate at the end of the
+         *        written text is kept for the next segment.
+         * @return true if the buffered text is written.
+        */
+        bool Flush() noexcept;
+    };
+}
+
+#endif // !MILE_PLATFORM_OUTPUT
@@ -0,0 +1,312 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Resource.cpp
+ * PURPOSE:   Resource View Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.Resource.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error "[Mile] The resource index is not implemented for the platform."
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    bool HasPrefix(
+        const unsigned char* Data,
+        std::size_t Size,
+        const char* Prefix,
+        std::size_t PrefixSize) noexcept
+    {
+        return Size >= PrefixSize && 0 == std::memcmp(Data, Prefix, PrefixSize);
+    }
+
+#if defined(_WIN32)
+    struct RawResource
+    {
+        std::uint32_t Identifier;
+        const void* Data;
+        std::size_t Size;
+    };
+
+    BOOL CALLBACK EnumerateResource(
+        HMODULE Module,
+        LPCWSTR Type,
+        LPWSTR Name,
+        LONG_PTR Parameter)
+    {
+        if (!IS_INTRESOURCE(Name))
+        {
+            return TRUE;
+        }
+
+        HRSRC ResourceFind = ::FindResourceExW(
+            Module,
+            Type,
+            Name,
+            MAKELANGID(LANG_NEUTRAL, SUBLANG_NEUTRAL));
+        if (!ResourceFind)
+        {
+            return TRUE;
+        }
+
+        HGLOBAL ResourceLoad = ::LoadResource(Module, ResourceFind);
+        if (!ResourceLoad)
+        {
+            return TRUE;
+        }
+
+        const void* Data = ::LockResource(ResourceLoad);
+        if (!Data)
+        {
+            return TRUE;
+        }
+
+        RawResource Resource;
+        Resource.Identifier =
+            static_cast<std::uint32_t>(reinterpret_cast<ULONG_PTR>(Name));
+        Resource.Data = Data;
+        Resource.Size = ::SizeofResource(Module, ResourceFind);
+
+        // The exceptions should not be thrown through EnumResourceNamesW.
+        try
+        {
+            reinterpret_cast<std::vector<RawResource>*>(
+                Parameter)->push_back(Resource);
+        }
+        catch (...)
+        {
+            ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+#endif
+}
+
+Mile::ResourceView Mile::MakeResourceView(
+    const void* Data,
+    std::size_t Size) noexcept
+{
+    const unsigned char* Bytes = reinterpret_cast<const unsigned char*>(Data);
+
+    ResourceView View;
+    View.Encoding = TextEncoding::Unknown;
+
+    std::size_t MarkSize = 0;
+    if (::HasPrefix(Bytes, Size, "\xEF\xBB\xBF", 3))
+    {
+        View.Encoding = TextEncoding::Utf8;
+        MarkSize = 3;
+    }
+    else if (::HasPrefix(Bytes, Size, "\xFF\xFE", 2))
+    {
+        View.Encoding = TextEncoding::Utf16LittleEndian;
+        MarkSize = 2;
+    }
+    else if (::HasPrefix(Bytes, Size, "\xFE\xFF", 2))
+    {
+        View.Encoding = TextEncoding::Utf16BigEndian;
+        MarkSize = 2;
+    }
+
+    View.Content = Size
+        ? std::string_view(
+            reinterpret_cast<const char*>(Bytes + MarkSize),
+            Size - MarkSize)
+        : std::string_view();
+
+    return View;
+}
+
+std::size_t Mile::GetUtf8ChunkLength(
+    std::string_view Text,
+    std::size_t MaximumLength) noexcept
+{
+    if (Text.size() <= MaximumLength)
+    {
+        return Text.size();
+    }
+
+    // A character has at most 3 continuation bytes, so the chunk is moved
+    // back to the lead byte of the character which crosses the limit.
+    std::size_t Length = MaximumLength;
+    for (std::size_t i = 0; i < 4 && Length; ++i, --Length)
+    {
+        if ((static_cast<unsigned char>(Text[Length]) & 0xC0) != 0x80)
+        {
+            return Length;
+        }
+    }
+
+    return MaximumLength;
+}
+
+void Mile::ResourceIndex::Insert(
+    std::uint32_t Identifier,
+    const void* Data,
+    std::size_t Size)
+{
+    auto Iterator = std::lower_bound(
+        this->m_Entries.begin(),
+        this->m_Entries.end(),
+        Identifier,
+        [](const Entry& Left, std::uint32_t Right)
+        {
+            return Left.Identifier < Right;
+        });
+    if (Iterator == this->m_Entries.end() ||
+        Iterator->Identifier != Identifier)
+    {
+        Iterator = this->m_Entries.insert(Iterator, Entry());
+    }
+
+    Iterator->Identifier = Identifier;
+    Iterator->View = Mile::MakeResourceView(Data, Size);
+}
+
+Mile::ResourceIndex::~ResourceIndex() noexcept
+{
+#if defined(__linux__)
+    for (const Mapping& Current : this->m_Mappings)
+    {
+        ::munmap(Current.Address, Current.Size);
+    }
+#endif
+}
+
+#if defined(_WIN32)
+
+bool Mile::ResourceIndex::Load(
+    void* Module,
+    const wchar_t* Type)
+{
+    HMODULE ModuleHandle = Module
+        ? reinterpret_cast<HMODULE>(Module)
+        : ::GetModuleHandleW(nullptr);
+
+    std::vector<RawResource> Resources;
+    if (!::EnumResourceNamesW(
+        ModuleHandle,
+        Type,
+        ::EnumerateResource,
+        reinterpret_cast<LONG_PTR>(&Resources)))
+    {
+        return false;
+    }
+
+    this->m_Entries.reserve(this->m_Entries.size() + Resources.size());
+    for (const RawResource& Current : Resources)
+    {
+        this->Insert(Current.Identifier, Current.Data, Current.Size);
+    }
+
+    return true;
+}
+
+#elif defined(__linux__)
+
+bool Mile::ResourceIndex::Load(
+    const char* Directory)
+{
+    DIR* DirectoryHandle = ::opendir(Directory);
+    if (!DirectoryHandle)
+    {
+        return false;
+    }
+
+    std::string Path;
+    while (const dirent* Current = ::readdir(DirectoryHandle))
+    {
+        char* End = nullptr;
+        unsigned long Identifier = std::strtoul(Current->d_name, &End, 10);
+        if (End == Current->d_name || *End || Identifier > UINT32_MAX)
+        {
+            continue;
+        }
+
+        Path = Directory;
+        Path += '/';
+        Path += Current->d_name;
+
+        int FileDescriptor = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (FileDescriptor == -1)
+        {
+            continue;
+        }
+
+        struct stat Status;
+        void* Address = MAP_FAILED;
+        if (::fstat(FileDescriptor, &Status) == 0 &&
+            S_ISREG(Status.st_mode) &&
+            Status.st_size > 0)
+        {
+            Address = ::mmap(
+                nullptr,
+                static_cast<std::size_t>(Status.st_size),
+                PROT_READ,
+                MAP_PRIVATE,
+                FileDescriptor,
+                0);
+        }
+        ::close(FileDescriptor);
+
+        if (Address == MAP_FAILED)
+        {
+            continue;
+        }
+
+        std::size_t Size = static_cast<std::size_t>(Status.st_size);
+        this->m_Mappings.push_back(Mapping{ Address, Size });
+        this->Insert(static_cast<std::uint32_t>(Identifier), Address, Size);
+    }
+
+    ::closedir(DirectoryHandle);
+
+    return true;
+}
+
+#endif
+
+const Mile::ResourceView* Mile::ResourceIndex::Find(
+    std::uint32_t Identifier) const noexcept
+{
+    auto Iterator = std::lower_bound(
+        this->m_Entries.begin(),
+        this->m_Entries.end(),
+        Identifier,
+        [](const Entry& Left, std::uint32_t Right)
+        {
+            return Left.Identifier < Right;
+        });
+    if (Iterator == this->m_Entries.end() ||
+        Iterator->Identifier != Identifier)
+    {
+        return nullptr;
+    }
+
+    return &Iterator->View;
+}
+
+std::size_t Mile::ResourceIndex::GetSize() const noexcept
+{
+    return this->m_Entries.size();
+}
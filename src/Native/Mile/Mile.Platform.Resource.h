@@ -0,0 +1,163 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Resource.h
+ * PURPOSE:   Resource View Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_RESOURCE
+#define MILE_PLATFORM_RESOURCE
+
+#include "Mile.Platform.h"
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace Mile
+{
+    /**
+     * @brief The encodings which are detected by the byte order marks.
+    */
+    enum class TextEncoding : std::uint32_t
+    {
+        /**
+         * @brief There is no byte order mark, the content is usually UTF-8.
+        */
+        Unknown,
+        Utf8,
+        Utf16LittleEndian,
+        Utf16BigEndian,
+    };
+
+    /**
+     * @brief A read-only view of the content of a resource, without the byte
+     *        order mark.
+    */
+    struct ResourceView
+    {
+        std::string_view Content;
+        TextEncoding Encoding;
+    };
+
+    /**
+     * @brief Creates a view of a block of memory and detects its byte order
+     *        mark.
+     * @param Data The block of memory, it can be nullptr if Size is 0.
+     * @param Size The number of the bytes of the block of memory.
+     * @return The view, it refers to the block without copying it.
+    */
+    ResourceView MakeResourceView(
+        const void* Data,
+        std::size_t Size) noexcept;
+
+    /**
+     * @brief Retrieves the length of the longest prefix of UTF-8 text which
+     *        is not longer than a limit and does not split a character.
+     * @param Text The UTF-8 text.
+     * @param MaximumLength The limit, in bytes.
+     * @return The length of the prefix, in bytes. It is only 0 if the text
+     *         or the limit is 0, the invalid sequences are split at the limit
+     *         so the callers always make progress.
+    */
+    std::size_t GetUtf8ChunkLength(
+        std::string_view Text,
+        std::size_t MaximumLength) noexcept;
+
+    /**
+     * @brief The resources of a type of a module, indexed by their integer
+     *        identifiers. The contents are not copied, so the views live as
+     *        long as the module and the index.
+     * @remark The index is built once and read without locks, so it can be
+     *         shared by the threads after it is built.
+    */
+    class ResourceIndex : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        struct Entry
+        {
+            std::uint32_t Identifier;
+            ResourceView View;
+        };
+
+        /**
+         * @brief The entries sorted by their identifiers.
+        */
+        std::vector<Entry> m_Entries;
+
+#if defined(__linux__)
+        struct Mapping
+        {
+            void* Address;
+            std::size_t Size;
+        };
+
+        /**
+         * @brief The files which are mapped by Load.
+        */
+        std::vector<Mapping> m_Mappings;
+#endif
+
+        void Insert(
+            std::uint32_t Identifier,
+            const void* Data,
+            std::size_t Size);
+
+    public:
+
+        /**
+         * @brief Creates an empty index.
+        */
+        ResourceIndex() = default;
+
+        /**
+         * @brief Releases the resources which are mapped by Load.
+        */
+        ~ResourceIndex() noexcept;
+
+#if defined(_WIN32)
+        /**
+         * @brief Indexes the language neutral resources of a type which have
+         *        integer identifiers.
+         * @param Module The HMODULE of the module, or nullptr for the module
+         *               used to create the current process.
+         * @param Type The type of the resources, it can be MAKEINTRESOURCE.
+         * @return true if the resources are enumerated. The resources which
+         *         cannot be loaded are skipped.
+        */
+        bool Load(
+            void* Module,
+            const wchar_t* Type);
+#elif defined(__linux__)
+        /**
+         * @brief Indexes the files of a directory whose names are decimal
+         *        identifiers, each file is mapped read-only as a resource.
+         * @param Directory The path of the directory.
+         * @return true if the directory is enumerated. The files which cannot
+         *         be mapped are skipped.
+        */
+        bool Load(
+            const char* Directory);
+#endif
+
+        /**
+         * @brief Finds a resource.
+         * @param Identifier The identifier of the resource.
+         * @return The view of the resource, or nullptr if it is not found.
+        */
+        const ResourceView* Find(
+            std::uint32_t Identifier) const noexcept;
+
+        /**
+         * @brief Retrieves the number of the resources.
+         * @return The number of the resources.
+        */
+        std::size_t GetSize() const noexcept;
+    };
+}
+
+#endif // !MILE_PLATFORM_RESOURCE
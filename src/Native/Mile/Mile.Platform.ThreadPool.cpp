@@ -0,0 +1,1127 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.ThreadPool.cpp
+ * PURPOSE:   Work Stealing Thread Pool Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.ThreadPool.h"
+
+#if defined(_WIN32)
+#include "Mile.Windows.h"
+#elif defined(__linux__)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#else
+#error "[Mile] The thread pool is not implemented for the platform."
+#endif
+
+namespace
+{
+    /**
+     * @brief The number of the rounds which an idle worker looks for tasks
+     *        before it waits.
+    */
+    const int IdleSpinCount = 64;
+
+    /**
+     * @brief The initial number of the slots of a deque.
+    */
+    const std::int64_t InitialDequeCapacity = 256;
+
+    /**
+     * @brief The bit of the pending count of a task group which is set when
+     *        threads may be waiting.
+    */
+    const std::uint32_t TaskGroupWaitingBit = 0x80000000;
+
+    /**
+     * @brief The processors which the workers of a NUMA node are bound to.
+    */
+    struct ProcessorNode
+    {
+        /**
+         * @brief The number of the NUMA node.
+        */
+        std::uint32_t Node;
+
+        /**
+         * @brief The number of the logical processors.
+        */
+        std::uint32_t ProcessorCount;
+
+        /**
+         * @brief Whether the workers should be bound to the processors.
+        */
+        bool HasAffinity;
+
+#if defined(_WIN32)
+        GROUP_AFFINITY Affinity;
+#elif defined(__linux__)
+        cpu_set_t Affinity;
+#endif
+    };
+
+#if defined(_WIN32)
+
+    typedef BOOL(WINAPI* GetLogicalProcessorInformationExType)(
+        LOGICAL_PROCESSOR_RELATIONSHIP RelationshipType,
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX Buffer,
+        PDWORD ReturnedLength);
+
+    typedef BOOL(WINAPI* SetThreadGroupAffinityType)(
+        HANDLE hThread,
+        CONST GROUP_AFFINITY* GroupAffinity,
+        PGROUP_AFFINITY PreviousGroupAffinity);
+
+    /**
+     * @brief The processor group functions, they are resolved at runtime
+     *        because they are not available before Windows 7.
+    */
+    struct ProcessorGroupFunctions
+    {
+        GetLogicalProcessorInformationExType GetLogicalProcessorInformationEx;
+        SetThreadGroupAffinityType SetThreadGroupAffinity;
+
+        ProcessorGroupFunctions() noexcept
+        {
+            HMODULE ModuleHandle = ::GetModuleHandleW(L"kernel32.dll");
+            if (ModuleHandle)
+            {
+                this->GetLogicalProcessorInformationEx =
+                    reinterpret_cast<GetLogicalProcessorInformationExType>(
+                        ::GetProcAddress(
+                            ModuleHandle,
+                            "GetLogicalProcessorInformationEx"));
+                this->SetThreadGroupAffinity =
+                    reinterpret_cast<SetThreadGroupAffinityType>(
+                        ::GetProcAddress(
+                            ModuleHandle,
+                            "SetThreadGroupAffinity"));
+            }
+
+            if (!this->GetLogicalProcessorInformationEx ||
+                !this->SetThreadGroupAffinity)
+            {
+                this->GetLogicalProcessorInformationEx = nullptr;
+                this->SetThreadGroupAffinity = nullptr;
+            }
+        }
+    };
+
+    const ProcessorGroupFunctions& GetProcessorGroupFunctions() noexcept
+    {
+        static const ProcessorGroupFunctions Functions;
+        return Functions;
+    }
+
+    std::uint32_t CountProcessors(
+        KAFFINITY Mask) noexcept
+    {
+        std::uint32_t Count = 0;
+        for (; Mask; Mask &= Mask - 1)
+        {
+            ++Count;
+        }
+        return Count;
+    }
+
+    /**
+     * @brief Enumerates the NUMA nodes with GetLogicalProcessorInformationEx,
+     *        a node which spans processor groups has an element per group.
+    */
+    ProcessorNode* QueryProcessorNodes(
+        std::uint32_t& NodeCount) noexcept
+    {
+        NodeCount = 0;
+
+        const ProcessorGroupFunctions& Functions =
+            GetProcessorGroupFunctions();
+        if (!Functions.GetLogicalProcessorInformationEx)
+        {
+            return nullptr;
+        }
+
+        DWORD Length = 0;
+        Functions.GetLogicalProcessorInformationEx(
+            RelationNumaNode,
+            nullptr,
+            &Length);
+        if (::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        {
+            return nullptr;
+        }
+
+        std::uint8_t* Buffer = new (std::nothrow) std::uint8_t[Length];
+        if (!Buffer)
+        {
+            return nullptr;
+        }
+
+        ProcessorNode* Nodes = nullptr;
+
+        if (Functions.GetLogicalProcessorInformationEx(
+            RelationNumaNode,
+            reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(Buffer),
+            &Length))
+        {
+            std::uint32_t Count = 0;
+            for (DWORD Offset = 0; Offset < Length;)
+            {
+                PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX Information =
+                    reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(
+                        &Buffer[Offset]);
+                ++Count;
+                Offset += Information->Size;
+            }
+
+            Nodes = new (std::nothrow) ProcessorNode[Count];
+            if (Nodes)
+            {
+                for (DWORD Offset = 0; Offset < Length;)
+                {
+                    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX Information =
+                        reinterpret_cast<
+                            PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(
+                                &Buffer[Offset]);
+                    Offset += Information->Size;
+
+                    const GROUP_AFFINITY& Affinity =
+                        Information->NumaNode.GroupMask;
+                    if (!Affinity.Mask)
+                    {
+                        continue;
+                    }
+
+                    ProcessorNode& Node = Nodes[NodeCount++];
+                    Node.Node = Information->NumaNode.NodeNumber;
+                    Node.ProcessorCount = CountProcessors(Affinity.Mask);
+                    Node.HasAffinity = true;
+                    Node.Affinity = Affinity;
+                }
+            }
+        }
+
+        delete[] Buffer;
+
+        return Nodes;
+    }
+
+    void ApplyProcessorNode(
+        const ProcessorNode& Node) noexcept
+    {
+        const ProcessorGroupFunctions& Functions =
+            GetProcessorGroupFunctions();
+        if (Node.HasAffinity && Functions.SetThreadGroupAffinity)
+        {
+            Functions.SetThreadGroupAffinity(
+                ::GetCurrentThread(),
+                &Node.Affinity,
+                nullptr);
+        }
+    }
+
+#elif defined(__linux__)
+
+    /**
+     * @brief Parses a CPU list of sysfs, for example, 0-3,8-11.
+    */
+    void ParseCpuList(
+        const char* List,
+        cpu_set_t& Set) noexcept
+    {
+        CPU_ZERO(&Set);
+
+        while (*List >= '0' && *List <= '9')
+        {
+            char* Next = nullptr;
+            unsigned long First = std::strtoul(List, &Next, 10);
+            unsigned long Last = First;
+            if (*Next == '-')
+            {
+                Last = std::strtoul(Next + 1, &Next, 10);
+            }
+
+            for (unsigned long i = First; i <= Last && i < CPU_SETSIZE; ++i)
+            {
+                CPU_SET(i, &Set);
+            }
+
+            List = (*Next == ',') ? Next + 1 : Next;
+        }
+    }
+
+    bool ReadNodeCpuList(
+        unsigned long Node,
+        cpu_set_t& Set) noexcept
+    {
+        char Path[64];
+        std::snprintf(
+            Path,
+            sizeof(Path),
+            "/sys/devices/system/node/node%lu/cpulist",
+            Node);
+
+        std::FILE* File = std::fopen(Path, "r");
+        if (!File)
+        {
+            return false;
+        }
+
+        char List[4096];
+        bool Result = std::fgets(List, sizeof(List), File) != nullptr;
+        std::fclose(File);
+
+        if (Result)
+        {
+            ParseCpuList(List, Set);
+        }
+
+        return Result;
+    }
+
+    bool ParseNodeName(
+        const char* Name,
+        unsigned long& Node) noexcept
+    {
+        if (std::strncmp(Name, "node", 4) ||
+            Name[4] < '0' ||
+            Name[4] > '9')
+        {
+            return false;
+        }
+
+        char* End = nullptr;
+        Node = std::strtoul(&Name[4], &End, 10);
+        return !*End;
+    }
+
+    /**
+     * @brief Enumerates the NUMA nodes from sysfs, only the processors in
+     *        the affinity of the process are used.
+    */
+    ProcessorNode* QueryProcessorNodes(
+        std::uint32_t& NodeCount) noexcept
+    {
+        NodeCount = 0;
+
+        cpu_set_t Allowed;
+        if (::sched_getaffinity(0, sizeof(Allowed), &Allowed))
+        {
+            return nullptr;
+        }
+
+        std::uint32_t Capacity = 0;
+        DIR* Directory = ::opendir("/sys/devices/system/node");
+        if (Directory)
+        {
+            unsigned long Node = 0;
+            while (dirent* Entry = ::readdir(Directory))
+            {
+                if (ParseNodeName(Entry->d_name, Node))
+                {
+                    ++Capacity;
+                }
+            }
+        }
+
+        ProcessorNode* Nodes = new (std::nothrow) ProcessorNode[
+            Capacity ? Capacity : 1];
+        if (!Nodes)
+        {
+            if (Directory)
+            {
+                ::closedir(Directory);
+            }
+            return nullptr;
+        }
+
+        if (Directory)
+        {
+            ::rewinddir(Directory);
+
+            unsigned long Node = 0;
+            while (dirent* Entry = ::readdir(Directory))
+            {
+                if (NodeCount >= Capacity ||
+                    !ParseNodeName(Entry->d_name, Node))
+                {
+                    continue;
+                }
+
+                ProcessorNode& Current = Nodes[NodeCount];
+                if (!ReadNodeCpuList(Node, Current.Affinity))
+                {
+                    continue;
+                }
+
+                CPU_AND(&Current.Affinity, &Current.Affinity, &Allowed);
+                Current.ProcessorCount = CPU_COUNT(&Current.Affinity);
+                if (!Current.ProcessorCount)
+                {
+                    continue;
+                }
+
+                Current.Node = static_cast<std::uint32_t>(Node);
+                Current.HasAffinity = true;
+                ++NodeCount;
+            }
+
+            ::closedir(Directory);
+        }
+
+        if (!NodeCount)
+        {
+            // The kernel is built without NUMA, so the affinity of the
+            // process is the only node and the workers are not bound.
+            Nodes[0].Node = 0;
+            Nodes[0].ProcessorCount = CPU_COUNT(&Allowed);
+            Nodes[0].HasAffinity = false;
+            Nodes[0].Affinity = Allowed;
+            NodeCount = 1;
+        }
+
+        return Nodes;
+    }
+
+    void ApplyProcessorNode(
+        const ProcessorNode& Node) noexcept
+    {
+        if (Node.HasAffinity)
+        {
+            ::pthread_setaffinity_np(
+                ::pthread_self(),
+                sizeof(Node.Affinity),
+                &Node.Affinity);
+        }
+    }
+
+#endif
+
+    /**
+     * @brief The Chase-Lev deque with the memory orders of "Correct and
+     *        Efficient Work-Stealing for Weak Memory Models" by Le et al,
+     *        except that the push publishes the bottom with a release store
+     *        instead of a release fence. The owner pushes and pops at the
+     *        bottom, and the thieves steal at the top.
+    */
+    class WorkStealingDeque
+    {
+    private:
+
+        struct Buffer
+        {
+            std::int64_t Mask;
+            std::atomic<Mile::ThreadPoolTask*>* Slots;
+            Buffer* Previous;
+        };
+
+        alignas(64) std::atomic<std::int64_t> m_Top;
+        alignas(64) std::atomic<std::int64_t> m_Bottom;
+        std::atomic<Buffer*> m_Buffer;
+
+        static Buffer* CreateBuffer(
+            std::int64_t Capacity,
+            Buffer* Previous) noexcept
+        {
+            Buffer* Result = new (std::nothrow) Buffer;
+            if (Result)
+            {
+                Result->Slots = new (std::nothrow)
+                    std::atomic<Mile::ThreadPoolTask*>[Capacity];
+                if (!Result->Slots)
+                {
+                    delete Result;
+                    return nullptr;
+                }
+
+                Result->Mask = Capacity - 1;
+                Result->Previous = Previous;
+            }
+            return Result;
+        }
+
+    public:
+
+        WorkStealingDeque() noexcept :
+            m_Top(0),
+            m_Bottom(0),
+            m_Buffer(nullptr)
+        {
+        }
+
+        ~WorkStealingDeque() noexcept
+        {
+            // The thieves may still read the old buffers after the owner
+            // grows the deque, so they are freed with the deque.
+            Buffer* Current = this->m_Buffer.load(std::memory_order_relaxed);
+            while (Current)
+            {
+                Buffer* Previous = Current->Previous;
+                delete[] Current->Slots;
+                delete Current;
+                Current = Previous;
+            }
+        }
+
+        bool Initialize() noexcept
+        {
+            Buffer* Initial = CreateBuffer(InitialDequeCapacity, nullptr);
+            this->m_Buffer.store(Initial, std::memory_order_relaxed);
+            return Initial != nullptr;
+        }
+
+        bool Push(
+            Mile::ThreadPoolTask* Task) noexcept
+        {
+            std::int64_t Bottom =
+                this->m_Bottom.load(std::memory_order_relaxed);
+            std::int64_t Top = this->m_Top.load(std::memory_order_acquire);
+            Buffer* Current = this->m_Buffer.load(std::memory_order_relaxed);
+
+            if (Bottom - Top > Current->Mask)
+            {
+                Buffer* Grown = CreateBuffer(
+                    (Current->Mask + 1) * 2,
+                    Current);
+                if (!Grown)
+                {
+                    return false;
+                }
+
+                for (std::int64_t i = Top; i < Bottom; ++i)
+                {
+                    Grown->Slots[i & Grown->Mask].store(
+                        Current->Slots[i & Current->Mask].load(
+                            std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+                }
+
+                this->m_Buffer.store(Grown, std::memory_order_release);
+                Current = Grown;
+            }
+
+            Current->Slots[Bottom & Current->Mask].store(
+                Task,
+                std::memory_order_relaxed);
+            this->m_Bottom.store(Bottom + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        Mile::ThreadPoolTask* Pop() noexcept
+        {
+            std::int64_t Bottom =
+                this->m_Bottom.load(std::memory_order_relaxed) - 1;
+            Buffer* Current = this->m_Buffer.load(std::memory_order_relaxed);
+            this->m_Bottom.store(Bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t Top = this->m_Top.load(std::memory_order_relaxed);
+
+            Mile::ThreadPoolTask* Task = nullptr;
+
+            if (Top <= Bottom)
+            {
+                Task = Current->Slots[Bottom & Current->Mask].load(
+                    std::memory_order_relaxed);
+                if (Top == Bottom)
+                {
+                    // The last task, race with the thieves for it.
+                    if (!this->m_Top.compare_exchange_strong(
+                        Top,
+                        Top + 1,
+                        std::memory_order_seq_cst,
+                        std::memory_order_relaxed))
+                    {
+                        Task = nullptr;
+                    }
+                    this->m_Bottom.store(
+                        Bottom + 1,
+                        std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                this->m_Bottom.store(Bottom + 1, std::memory_order_relaxed);
+            }
+
+            return Task;
+        }
+
+        Mile::ThreadPoolTask* Steal() noexcept
+        {
+            for (;;)
+            {
+                std::int64_t Top =
+                    this->m_Top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t Bottom =
+                    this->m_Bottom.load(std::memory_order_acquire);
+                if (Top >= Bottom)
+                {
+                    return nullptr;
+                }
+
+                Buffer* Current =
+                    this->m_Buffer.load(std::memory_order_acquire);
+                Mile::ThreadPoolTask* Task =
+                    Current->Slots[Top & Current->Mask].load(
+                        std::memory_order_relaxed);
+                if (this->m_Top.compare_exchange_strong(
+                    Top,
+                    Top + 1,
+                    std::memory_order_seq_cst,
+                    std::memory_order_relaxed))
+                {
+                    return Task;
+                }
+
+                // Another thread took the task, so the deque made progress
+                // and it is worth trying again.
+            }
+        }
+    };
+}
+
+struct alignas(64) Mile::ThreadPool::Worker
+{
+    /**
+     * @brief The worker of the calling thread, or nullptr if the calling
+     *        thread is not a worker.
+    */
+    static thread_local Worker* Current;
+
+    ThreadPool* Pool;
+    WorkStealingDeque Queue;
+    ProcessorNode Node;
+
+    /**
+     * @brief The workers on the same node are the elements in the range
+     *        [NodeBegin, NodeEnd) of the worker array.
+    */
+    std::uint32_t NodeBegin;
+    std::uint32_t NodeEnd;
+
+    /**
+     * @brief Rotates the first victim, so the thieves do not convoy.
+    */
+    std::uint32_t StealCursor;
+
+#if defined(_WIN32)
+    HANDLE ThreadHandle;
+
+    static DWORD WINAPI Start(
+        LPVOID lpThreadParameter) noexcept
+    {
+        Worker* Self = reinterpret_cast<Worker*>(lpThreadParameter);
+        Self->Pool->RunWorker(Self);
+        return 0;
+    }
+#elif defined(__linux__)
+    pthread_t Thread;
+
+    static void* Start(
+        void* Parameter) noexcept
+    {
+        Worker* Self = reinterpret_cast<Worker*>(Parameter);
+        Self->Pool->RunWorker(Self);
+        return nullptr;
+    }
+#endif
+};
+
+thread_local Mile::ThreadPool::Worker* Mile::ThreadPool::Worker::Current =
+    nullptr;
+
+Mile::ThreadPool::ThreadPool(
+    std::uint32_t WorkerCount) noexcept :
+    m_Workers(nullptr),
+    m_WorkerCount(0),
+    m_ThreadCount(0),
+    m_Signal(0),
+    m_SleeperCount(0),
+    m_Stopping(false),
+    m_InjectionCount(0),
+    m_InjectionHead(nullptr),
+    m_InjectionTail(nullptr)
+{
+    std::uint32_t NodeCount = 0;
+    ProcessorNode* Nodes = QueryProcessorNodes(NodeCount);
+
+    std::uint32_t ProcessorCount = 0;
+    for (std::uint32_t i = 0; i < NodeCount; ++i)
+    {
+        ProcessorCount += Nodes[i].ProcessorCount;
+    }
+
+    if (!ProcessorCount)
+    {
+        // The topology is not available, so the workers are not bound.
+        delete[] Nodes;
+        Nodes = new (std::nothrow) ProcessorNode[1];
+        if (!Nodes)
+        {
+            return;
+        }
+
+#if defined(_WIN32)
+        ProcessorCount = ::MileGetNumberOfHardwareThreads();
+#elif defined(__linux__)
+        long OnlineCount = ::sysconf(_SC_NPROCESSORS_ONLN);
+        ProcessorCount = OnlineCount > 0
+            ? static_cast<std::uint32_t>(OnlineCount)
+            : 1;
+#endif
+        Nodes[0].Node = 0;
+        Nodes[0].ProcessorCount = ProcessorCount;
+        Nodes[0].HasAffinity = false;
+        NodeCount = 1;
+    }
+
+    if (!WorkerCount)
+    {
+        WorkerCount = ProcessorCount;
+    }
+
+    this->m_Workers = new (std::nothrow) Worker[WorkerCount];
+    if (!this->m_Workers)
+    {
+        delete[] Nodes;
+        return;
+    }
+    this->m_WorkerCount = WorkerCount;
+
+    // Spreads the workers evenly over the processors, so the workers of a
+    // node are adjacent in the worker array.
+    std::uint32_t NodeIndex = 0;
+    std::uint64_t NodeEndSlot = Nodes[0].ProcessorCount;
+    for (std::uint32_t i = 0; i < WorkerCount; ++i)
+    {
+        std::uint64_t Slot =
+            static_cast<std::uint64_t>(i) * ProcessorCount / WorkerCount;
+        while (Slot >= NodeEndSlot)
+        {
+            NodeEndSlot += Nodes[++NodeIndex].ProcessorCount;
+        }
+
+        Worker& Current = this->m_Workers[i];
+        Current.Pool = this;
+        Current.Node = Nodes[NodeIndex];
+        Current.StealCursor = 0;
+        Current.NodeBegin = i;
+        if (i && this->m_Workers[i - 1].Node.Node == Current.Node.Node)
+        {
+            Current.NodeBegin = this->m_Workers[i - 1].NodeBegin;
+        }
+    }
+
+    delete[] Nodes;
+
+    for (std::uint32_t i = WorkerCount; i > 0; --i)
+    {
+        Worker& Current = this->m_Workers[i - 1];
+        Current.NodeEnd = i;
+        if (i < WorkerCount &&
+            this->m_Workers[i].NodeBegin == Current.NodeBegin)
+        {
+            Current.NodeEnd = this->m_Workers[i].NodeEnd;
+        }
+    }
+
+    for (std::uint32_t i = 0; i < WorkerCount; ++i)
+    {
+        if (!this->m_Workers[i].Queue.Initialize())
+        {
+            return;
+        }
+    }
+
+    for (std::uint32_t i = 0; i < WorkerCount; ++i)
+    {
+        Worker& Current = this->m_Workers[i];
+
+#if defined(_WIN32)
+        if (FAILED(::MileCreateThread(
+            nullptr,
+            0,
+            Worker::Start,
+            &Current,
+            0,
+            nullptr,
+            &Current.ThreadHandle)))
+        {
+            break;
+        }
+#elif defined(__linux__)
+        if (::pthread_create(
+            &Current.Thread,
+            nullptr,
+            Worker::Start,
+            &Current))
+        {
+            break;
+        }
+#endif
+
+        // The started workers may steal from the others before this, it
+        // only finds their deques empty.
+        this->m_ThreadCount.fetch_add(1, std::memory_order_release);
+    }
+}
+
+Mile::ThreadPool::~ThreadPool() noexcept
+{
+    this->m_Stopping.store(true, std::memory_order_seq_cst);
+    this->m_Signal.fetch_add(1, std::memory_order_seq_cst);
+    AddressWait::WakeAll(this->m_Signal);
+
+    std::uint32_t ThreadCount =
+        this->m_ThreadCount.load(std::memory_order_relaxed);
+    for (std::uint32_t i = 0; i < ThreadCount; ++i)
+    {
+        Worker& Current = this->m_Workers[i];
+
+#if defined(_WIN32)
+        ::WaitForSingleObject(Current.ThreadHandle, INFINITE);
+        ::CloseHandle(Current.ThreadHandle);
+#elif defined(__linux__)
+        ::pthread_join(Current.Thread, nullptr);
+#endif
+    }
+
+    // The pool without workers runs the tasks which nobody waited for.
+    while (this->RunPendingTask())
+    {
+    }
+
+    delete[] this->m_Workers;
+}
+
+std::uint32_t Mile::ThreadPool::GetWorkerCount() const noexcept
+{
+    return this->m_ThreadCount.load(std::memory_order_relaxed);
+}
+
+bool Mile::ThreadPool::Submit(
+    ThreadPoolTask* Task) noexcept
+{
+    Worker* Current = Worker::Current;
+    if (Current && Current->Pool == this)
+    {
+        if (!Current->Queue.Push(Task))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        AutoMutexLock Lock(this->m_InjectionLock);
+
+        if (this->m_InjectionTail)
+        {
+            this->m_InjectionTail->Next = Task;
+        }
+        else
+        {
+            this->m_InjectionHead = Task;
+        }
+        this->m_InjectionTail = Task;
+
+        this->m_InjectionCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The idle workers read the signal after they count themselves as
+    // sleepers, so either they see the new signal or the wake is sent.
+    this->m_Signal.fetch_add(1, std::memory_order_seq_cst);
+    if (this->m_SleeperCount.load(std::memory_order_seq_cst))
+    {
+        AddressWait::WakeOne(this->m_Signal);
+    }
+
+    return true;
+}
+
+Mile::ThreadPoolTask* Mile::ThreadPool::FindTask(
+    Worker* Self) noexcept
+{
+    if (Self)
+    {
+        if (ThreadPoolTask* Task = Self->Queue.Pop())
+        {
+            return Task;
+        }
+    }
+
+    if (this->m_InjectionCount.load(std::memory_order_relaxed))
+    {
+        AutoMutexLock Lock(this->m_InjectionLock);
+
+        ThreadPoolTask* Task = this->m_InjectionHead;
+        if (Task)
+        {
+            this->m_InjectionHead = Task->Next;
+            if (!this->m_InjectionHead)
+            {
+                this->m_InjectionTail = nullptr;
+            }
+
+            this->m_InjectionCount.fetch_sub(1, std::memory_order_relaxed);
+            return Task;
+        }
+    }
+
+    std::uint32_t Count = this->m_ThreadCount.load(std::memory_order_acquire);
+    if (!Count)
+    {
+        return nullptr;
+    }
+
+    if (Self)
+    {
+        std::uint32_t Index = static_cast<std::uint32_t>(
+            Self - this->m_Workers);
+        std::uint32_t Cursor = Self->StealCursor++;
+
+        // Steals from the workers on the same node first.
+        std::uint32_t NodeEnd =
+            Self->NodeEnd < Count ? Self->NodeEnd : Count;
+        std::uint32_t NodeCount = NodeEnd - Self->NodeBegin;
+        for (std::uint32_t i = 1; i < NodeCount; ++i)
+        {
+            std::uint32_t Victim = Self->NodeBegin +
+                (Index - Self->NodeBegin + Cursor + i) % NodeCount;
+            if (Victim == Index)
+            {
+                continue;
+            }
+
+            if (ThreadPoolTask* Task = this->m_Workers[Victim].Queue.Steal())
+            {
+                return Task;
+            }
+        }
+
+        for (std::uint32_t i = 1; i < Count; ++i)
+        {
+            std::uint32_t Victim = (Index + Cursor + i) % Count;
+            if (Victim >= Self->NodeBegin && Victim < NodeEnd)
+            {
+                continue;
+            }
+
+            if (ThreadPoolTask* Task = this->m_Workers[Victim].Queue.Steal())
+            {
+                return Task;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::uint32_t Start = this->m_Signal.load(std::memory_order_relaxed);
+    for (std::uint32_t i = 0; i < Count; ++i)
+    {
+        std::uint32_t Victim = (Start + i) % Count;
+        if (ThreadPoolTask* Task = this->m_Workers[Victim].Queue.Steal())
+        {
+            return Task;
+        }
+    }
+
+    return nullptr;
+}
+
+bool Mile::ThreadPool::RunPendingTask() noexcept
+{
+    Worker* Current = Worker::Current;
+    ThreadPoolTask* Task = this->FindTask(
+        (Current && Current->Pool == this) ? Current : nullptr);
+    if (!Task)
+    {
+        return false;
+    }
+
+    TaskGroup* Group = Task->Group;
+    Task->Invoke(Task);
+    Group->CompleteTask();
+
+    return true;
+}
+
+void Mile::ThreadPool::RunWorker(
+    Worker* Self) noexcept
+{
+    ApplyProcessorNode(Self->Node);
+    Worker::Current = Self;
+
+    int IdleCount = 0;
+    for (;;)
+    {
+        if (ThreadPoolTask* Task = this->FindTask(Self))
+        {
+            TaskGroup* Group = Task->Group;
+            Task->Invoke(Task);
+            Group->CompleteTask();
+            IdleCount = 0;
+            continue;
+        }
+
+        if (this->m_Stopping.load(std::memory_order_acquire))
+        {
+            break;
+        }
+
+        if (++IdleCount < IdleSpinCount)
+        {
+            AddressWait::Pause();
+            continue;
+        }
+
+        this->m_SleeperCount.fetch_add(1, std::memory_order_seq_cst);
+        std::uint32_t Signal = this->m_Signal.load(std::memory_order_seq_cst);
+
+        ThreadPoolTask* Task = this->FindTask(Self);
+        if (!Task && !this->m_Stopping.load(std::memory_order_acquire))
+        {
+            AddressWait::Wait(this->m_Signal, Signal);
+        }
+
+        this->m_SleeperCount.fetch_sub(1, std::memory_order_relaxed);
+
+        if (Task)
+        {
+            TaskGroup* Group = Task->Group;
+            Task->Invoke(Task);
+            Group->CompleteTask();
+        }
+
+        IdleCount = 0;
+    }
+
+    Worker::Current = nullptr;
+}
+
+Mile::TaskGroup::TaskGroup(
+    ThreadPool& Pool) noexcept :
+    m_Pool(Pool),
+    m_PendingCount(0)
+{
+}
+
+Mile::TaskGroup::~TaskGroup() noexcept
+{
+    this->Wait();
+}
+
+void Mile::TaskGroup::CompleteTask() noexcept
+{
+    std::uint32_t Pending = this->m_PendingCount.fetch_sub(
+        1,
+        std::memory_order_acq_rel);
+    if (Pending == (TaskGroupWaitingBit | 1))
+    {
+        AddressWait::WakeAll(this->m_PendingCount);
+    }
+}
+
+bool Mile::TaskGroup::WaitUntil(
+    bool RunTasks,
+    const std::chrono::steady_clock::time_point* Deadline) noexcept
+{
+    for (;;)
+    {
+        std::uint32_t Pending =
+            this->m_PendingCount.load(std::memory_order_acquire);
+        if (!(Pending & ~TaskGroupWaitingBit))
+        {
+            // Clears the waiting bit, so the group can be reused without
+            // the wakes.
+            if (Pending)
+            {
+                this->m_PendingCount.compare_exchange_strong(
+                    Pending,
+                    0,
+                    std::memory_order_relaxed,
+                    std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        // Helps to run the tasks instead of blocking, and the tasks of the
+        // other groups are run too because they may be needed by this one.
+        if (RunTasks && this->m_Pool.RunPendingTask())
+        {
+            continue;
+        }
+
+        std::uint32_t Milliseconds = 0;
+        if (Deadline)
+        {
+            std::chrono::steady_clock::time_point Now =
+                std::chrono::steady_clock::now();
+            if (Now >= *Deadline)
+            {
+                return false;
+            }
+
+            // Rounds up, so the wait does not spin in the last millisecond.
+            Milliseconds = static_cast<std::uint32_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    *Deadline - Now + std::chrono::microseconds(999)).count());
+        }
+
+        // Nothing is queued, so the remaining tasks are running on the other
+        // threads and the caller sleeps until the last one completes.
+        if (!(Pending & TaskGroupWaitingBit) &&
+            !this->m_PendingCount.compare_exchange_weak(
+                Pending,
+                Pending | TaskGroupWaitingBit,
+                std::memory_order_relaxed,
+                std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        if (Deadline)
+        {
+            AddressWait::Wait(
+                this->m_PendingCount,
+                Pending | TaskGroupWaitingBit,
+                Milliseconds);
+        }
+        else
+        {
+            AddressWait::Wait(
+                this->m_PendingCount,
+                Pending | TaskGroupWaitingBit);
+        }
+    }
+}
+
+void Mile::TaskGroup::Wait() noexcept
+{
+    this->WaitUntil(true, nullptr);
+}
+
+bool Mile::TaskGroup::WaitFor(
+    std::uint32_t Milliseconds) noexcept
+{
+    std::chrono::steady_clock::time_point Deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(Milliseconds);
+
+    ThreadPool::Worker* Current = ThreadPool::Worker::Current;
+    bool RunTasks =
+        (Current && Current->Pool == &this->m_Pool) ||
+        !this->m_Pool.GetWorkerCount();
+
+    return this->WaitUntil(RunTasks, &Deadline);
+}
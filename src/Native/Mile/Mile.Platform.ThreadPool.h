@@ -0,0 +1,375 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.ThreadPool.h
+ * PURPOSE:   Work Stealing Thread Pool Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_THREAD_POOL
+#define MILE_PLATFORM_THREAD_POOL
+
+#include "Mile.Platform.h"
+
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Mile
+{
+    class TaskGroup;
+
+    /**
+     * @brief The header of a task which is queued to a thread pool.
+    */
+    struct ThreadPoolTask
+    {
+        /**
+         * @brief Runs the task and frees it.
+        */
+        void (*Invoke)(ThreadPoolTask* Task) noexcept;
+
+        /**
+         * @brief The task group which the task belongs to.
+        */
+        TaskGroup* Group;
+
+        /**
+         * @brief The next task in the queue of the non-worker threads.
+        */
+        ThreadPoolTask* Next;
+    };
+
+    /**
+     * @brief A task which calls a function object.
+    */
+    template <typename FunctionType>
+    struct ThreadPoolFunctionTask : ThreadPoolTask
+    {
+        FunctionType Function;
+
+        template <typename ArgumentType>
+        ThreadPoolFunctionTask(
+            TaskGroup* Group,
+            ArgumentType&& Argument) :
+            Function(std::forward<ArgumentType>(Argument))
+        {
+            this->Invoke = ThreadPoolFunctionTask::InvokeTask;
+            this->Group = Group;
+            this->Next = nullptr;
+        }
+
+        static void InvokeTask(
+            ThreadPoolTask* Task) noexcept
+        {
+            ThreadPoolFunctionTask* Self =
+                static_cast<ThreadPoolFunctionTask*>(Task);
+            Self->Function();
+            delete Self;
+        }
+    };
+
+    /**
+     * @brief A pool of worker threads. Each worker has a Chase-Lev deque,
+     *        it runs its own tasks in LIFO order and steals the tasks of the
+     *        other workers in FIFO order when its deque is empty.
+     * @remark The workers are spread over the NUMA nodes and the processor
+     *         groups, and they steal from the workers on the same node
+     *         first. The functions can be called from any thread, including
+     *         the tasks themselves.
+    */
+    class ThreadPool : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        friend class TaskGroup;
+
+        struct Worker;
+
+        /**
+         * @brief The worker array.
+        */
+        Worker* m_Workers;
+
+        /**
+         * @brief The number of the elements in the worker array.
+        */
+        std::uint32_t m_WorkerCount;
+
+        /**
+         * @brief The number of the workers whose threads are started. They
+         *        are the first elements of the worker array.
+        */
+        std::atomic<std::uint32_t> m_ThreadCount;
+
+        /**
+         * @brief Changed when a task is queued, the idle workers wait on it.
+        */
+        std::atomic<std::uint32_t> m_Signal;
+
+        /**
+         * @brief The number of the idle workers which wait on m_Signal.
+        */
+        std::atomic<std::uint32_t> m_SleeperCount;
+
+        /**
+         * @brief Set when the pool is destroyed.
+        */
+        std::atomic<bool> m_Stopping;
+
+        /**
+         * @brief Protects the queue of the tasks from non-worker threads.
+        */
+        Mutex m_InjectionLock;
+
+        /**
+         * @brief The number of the tasks from non-worker threads.
+        */
+        std::atomic<std::uint32_t> m_InjectionCount;
+
+        /**
+         * @brief The first task from non-worker threads.
+        */
+        ThreadPoolTask* m_InjectionHead;
+
+        /**
+         * @brief The last task from non-worker threads.
+        */
+        ThreadPoolTask* m_InjectionTail;
+
+        /**
+         * @brief Queues a task. It is pushed to the deque of the calling
+         *        worker, or the shared queue for non-worker threads.
+         * @param Task The task to queue.
+         * @return If the task is queued, the return value is true.
+        */
+        bool Submit(
+            ThreadPoolTask* Task) noexcept;
+
+        /**
+         * @brief Finds a task for a worker, or for a non-worker thread if
+         *        Self is nullptr.
+        */
+        ThreadPoolTask* FindTask(
+            Worker* Self) noexcept;
+
+        /**
+         * @brief Runs one queued task on the calling thread.
+         * @return If a task is run, the return value is true.
+        */
+        bool RunPendingTask() noexcept;
+
+        /**
+         * @brief The main loop of a worker.
+        */
+        void RunWorker(
+            Worker* Self) noexcept;
+
+        template <typename FunctionType>
+        void ParallelForRange(
+            TaskGroup& Group,
+            std::size_t Begin,
+            std::size_t End,
+            std::size_t Grain,
+            FunctionType& Function) noexcept;
+
+    public:
+
+        /**
+         * @brief Creates the worker threads.
+         * @param WorkerCount The number of the workers. If it is 0, a worker
+         *                    is created for each logical processor in all
+         *                    processor groups.
+         * @remark If a worker thread cannot be created, the pool has fewer
+         *         workers. A pool without workers runs the tasks when the
+         *         task groups are waited.
+        */
+        explicit ThreadPool(
+            std::uint32_t WorkerCount = 0) noexcept;
+
+        /**
+         * @brief Stops and joins the worker threads. All task groups should
+         *        be waited before.
+        */
+        ~ThreadPool() noexcept;
+
+        /**
+         * @brief Retrieves the number of the workers.
+         * @return The number of the workers.
+        */
+        std::uint32_t GetWorkerCount() const noexcept;
+
+        /**
+         * @brief Calls a function over an index range in parallel, and waits
+         *        until all calls return.
+         * @param Begin The first index.
+         * @param End The index after the last index.
+         * @param Grain The maximum number of the indexes in a call, 0 is the
+         *              same as 1.
+         * @param Function The function, it is called with the first index
+         *                 and the index after the last index of a subrange.
+         * @remark The range is split in halves recursively, so the thieves
+         *         take the largest subranges.
+        */
+        template <typename FunctionType>
+        void ParallelFor(
+            std::size_t Begin,
+            std::size_t End,
+            std::size_t Grain,
+            FunctionType&& Function) noexcept;
+    };
+
+    /**
+     * @brief A group of tasks which run on a thread pool and can be waited
+     *        together.
+    */
+    class TaskGroup : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        friend class ThreadPool;
+
+        /**
+         * @brief The thread pool.
+        */
+        ThreadPool& m_Pool;
+
+        /**
+         * @brief The number of the tasks which have not completed, and the
+         *        highest bit is set if threads may be waiting.
+        */
+        std::atomic<std::uint32_t> m_PendingCount;
+
+        /**
+         * @brief Marks a task as completed and wakes the waiting threads if
+         *        it is the last one.
+        */
+        void CompleteTask() noexcept;
+
+        /**
+         * @brief Waits until all tasks of the group complete or the deadline
+         *        passes.
+         * @param RunTasks Whether the calling thread runs the queued tasks
+         *                 while it waits.
+         * @param Deadline The deadline, or nullptr to wait without timeout.
+         * @return If all tasks complete, the return value is true.
+        */
+        bool WaitUntil(
+            bool RunTasks,
+            const std::chrono::steady_clock::time_point* Deadline) noexcept;
+
+    public:
+
+        /**
+         * @brief Creates an empty task group.
+         * @param Pool The thread pool which runs the tasks.
+        */
+        explicit TaskGroup(
+            ThreadPool& Pool) noexcept;
+
+        /**
+         * @brief Waits for the tasks of the group.
+        */
+        ~TaskGroup() noexcept;
+
+        /**
+         * @brief Queues a function to the thread pool.
+         * @param Function The function, it should not throw exceptions. It
+         *                 runs on the calling thread if the task cannot be
+         *                 allocated.
+        */
+        template <typename FunctionType>
+        void Run(
+            FunctionType&& Function) noexcept
+        {
+            typedef ThreadPoolFunctionTask<
+                typename std::decay<FunctionType>::type> TaskType;
+
+            this->m_PendingCount.fetch_add(1, std::memory_order_relaxed);
+
+            TaskType* Task = new (std::nothrow) TaskType(
+                this,
+                std::forward<FunctionType>(Function));
+            if (!Task || !this->m_Pool.Submit(Task))
+            {
+                if (Task)
+                {
+                    Task->Invoke(Task);
+                }
+                else
+                {
+                    Function();
+                }
+                this->CompleteTask();
+            }
+        }
+
+        /**
+         * @brief Waits until all tasks of the group complete. The calling
+         *        thread runs the queued tasks while it waits.
+        */
+        void Wait() noexcept;
+
+        /**
+         * @brief Waits until all tasks of the group complete or the timeout
+         *        elapses, so the caller can do other work between the waits,
+         *        for example, report the progress.
+         * @param Milliseconds The timeout, in milliseconds.
+         * @return If all tasks complete, the return value is true.
+         * @remark The calling thread only runs the queued tasks if it is a
+         *         worker of the pool or the pool has no workers, because a
+         *         task may take longer than the timeout.
+        */
+        bool WaitFor(
+            std::uint32_t Milliseconds) noexcept;
+    };
+
+    template <typename FunctionType>
+    void ThreadPool::ParallelForRange(
+        TaskGroup& Group,
+        std::size_t Begin,
+        std::size_t End,
+        std::size_t Grain,
+        FunctionType& Function) noexcept
+    {
+        while (End - Begin > Grain)
+        {
+            std::size_t Middle = Begin + (End - Begin) / 2;
+            Group.Run([this, &Group, Middle, End, Grain, &Function]()
+            {
+                this->ParallelForRange(Group, Middle, End, Grain, Function);
+            });
+            End = Middle;
+        }
+
+        Function(Begin, End);
+    }
+
+    template <typename FunctionType>
+    void ThreadPool::ParallelFor(
+        std::size_t Begin,
+        std::size_t End,
+        std::size_t Grain,
+        FunctionType&& Function) noexcept
+    {
+        if (Begin >= End)
+        {
+            return;
+        }
+
+        TaskGroup Group(*this);
+        this->ParallelForRange(
+            Group,
+            Begin,
+            End,
+            Grain ? Grain : 1,
+            Function);
+        Group.Wait();
+    }
+}
+
+#endif // !MILE_PLATFORM_THREAD_POOL
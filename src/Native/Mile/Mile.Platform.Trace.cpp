@@ -0,0 +1,427 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Trace.cpp
+ * PURPOSE:   Lightweight Tracing Implementation
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "Mile.Platform.Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+namespace
+{
+    /**
+     * @brief The number of the events which a ring buffer keeps, it is a
+     *        power of two.
+    */
+    const std::uint64_t TraceBufferCapacity = 256;
+
+    /**
+     * @brief An event in a ring buffer. The fields are packed into atomic
+     *        words, so the readers can copy them while the owner overwrites
+     *        them and drop the torn copies.
+    */
+    struct TraceSlot
+    {
+        /**
+         * @brief 2 * Index + 1 while the event at Index is being written,
+         *        and 2 * Index + 2 after it is written.
+        */
+        std::atomic<std::uint64_t> Sequence;
+
+        std::atomic<std::uint64_t> Words[4];
+    };
+
+    /**
+     * @brief The ring buffer of a thread. It has a single writer, which is
+     *        the thread owning it, and any number of readers.
+    */
+    struct TraceBuffer
+    {
+        TraceSlot Slots[TraceBufferCapacity];
+
+        /**
+         * @brief The number of the events which have been written, it is
+         *        never reset so the sequences stay unique after reuse.
+        */
+        std::atomic<std::uint64_t> Head;
+
+        /**
+         * @brief Set while a thread owns the ring buffer.
+        */
+        std::atomic<bool> Owned;
+
+        /**
+         * @brief The next ring buffer in the list of all ring buffers.
+        */
+        TraceBuffer* Next;
+    };
+
+    /**
+     * @brief The list of all ring buffers. They are never freed, so the
+     *        readers can walk the list without locks.
+    */
+    std::atomic<TraceBuffer*> g_TraceBuffers(nullptr);
+
+    std::atomic<std::uint32_t> g_TraceActivity(0);
+
+    /**
+     * @brief Gives the ring buffer back when the owning thread exits.
+    */
+    struct TraceBufferOwner
+    {
+        TraceBuffer* Buffer = nullptr;
+
+        ~TraceBufferOwner()
+        {
+            if (this->Buffer)
+            {
+                this->Buffer->Owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    thread_local TraceBufferOwner g_TraceBufferOwner;
+
+    TraceBuffer* AcquireTraceBuffer() noexcept
+    {
+        TraceBuffer* Current = g_TraceBuffers.load(std::memory_order_acquire);
+        for (; Current; Current = Current->Next)
+        {
+            bool Owned = false;
+            if (!Current->Owned.load(std::memory_order_relaxed) &&
+                Current->Owned.compare_exchange_strong(
+                    Owned,
+                    true,
+                    std::memory_order_acquire,
+                    std::memory_order_relaxed))
+            {
+                return Current;
+            }
+        }
+
+        Current = new (std::nothrow) TraceBuffer();
+        if (!Current)
+        {
+            return nullptr;
+        }
+
+        Current->Head.store(0, std::memory_order_relaxed);
+        Current->Owned.store(true, std::memory_order_relaxed);
+        for (TraceSlot& Slot : Current->Slots)
+        {
+            Slot.Sequence.store(0, std::memory_order_relaxed);
+        }
+
+        Current->Next = g_TraceBuffers.load(std::memory_order_relaxed);
+        while (!g_TraceBuffers.compare_exchange_weak(
+            Current->Next,
+            Current,
+            std::memory_order_release,
+            std::memory_order_relaxed))
+        {
+        }
+
+        return Current;
+    }
+
+    bool IsEventEarlier(
+        const Mile::TraceEvent& Left,
+        const Mile::TraceEvent& Right) noexcept
+    {
+        return Left.StartTime < Right.StartTime;
+    }
+
+    /**
+     * @brief Writes text into a bounded buffer and counts the characters
+     *        which do not fit.
+    */
+    class TextWriter
+    {
+    private:
+
+        wchar_t* m_Buffer;
+        std::size_t m_BufferLength;
+        std::size_t m_Length;
+
+    public:
+
+        TextWriter(
+            wchar_t* Buffer,
+            std::size_t BufferLength) noexcept :
+            m_Buffer(Buffer),
+            m_BufferLength(BufferLength),
+            m_Length(0)
+        {
+        }
+
+        void Append(
+            wchar_t Character) noexcept
+        {
+            if (this->m_Length + 1 < this->m_BufferLength)
+            {
+                this->m_Buffer[this->m_Length] = Character;
+            }
+            ++this->m_Length;
+        }
+
+        void Append(
+            const wchar_t* String,
+            std::size_t Width = 0) noexcept
+        {
+            std::size_t Length = 0;
+            for (; String[Length]; ++Length)
+            {
+                this->Append(String[Length]);
+            }
+            for (; Length < Width; ++Length)
+            {
+                this->Append(L' ');
+            }
+        }
+
+        /**
+         * @brief Appends a number right-aligned in a field.
+        */
+        void AppendNumber(
+            std::uint64_t Value,
+            std::size_t Width,
+            std::uint32_t Radix = 10,
+            std::size_t MinimumDigits = 1) noexcept
+        {
+            wchar_t Digits[64];
+            std::size_t Count = 0;
+            while (Value || Count < MinimumDigits)
+            {
+                Digits[Count++] = L"0123456789ABCDEF"[Value % Radix];
+                Value /= Radix;
+            }
+
+            for (std::size_t i = Count; i < Width; ++i)
+            {
+                this->Append(L' ');
+            }
+            while (Count)
+            {
+                this->Append(Digits[--Count]);
+            }
+        }
+
+        /**
+         * @brief Appends nanoseconds as microseconds with 3 decimals,
+         *        right-aligned in a field.
+        */
+        void AppendMicroseconds(
+            std::uint64_t Nanoseconds,
+            std::size_t Width) noexcept
+        {
+            this->AppendNumber(Nanoseconds / 1000, Width > 4 ? Width - 4 : 0);
+            this->Append(L'.');
+            this->AppendNumber(Nanoseconds % 1000, 3, 10, 3);
+        }
+
+        std::size_t Finish() noexcept
+        {
+            if (this->m_BufferLength)
+            {
+                this->m_Buffer[
+                    this->m_Length < this->m_BufferLength
+                    ? this->m_Length
+                    : this->m_BufferLength - 1] = L'\0';
+            }
+            return this->m_Length;
+        }
+    };
+}
+
+std::uint64_t Mile::GetTraceTimestamp() noexcept
+{
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+std::uint32_t Mile::CreateTraceActivity() noexcept
+{
+    std::uint32_t Activity = 0;
+    while (!Activity)
+    {
+        Activity = g_TraceActivity.fetch_add(
+            1,
+            std::memory_order_relaxed) + 1;
+    }
+    return Activity;
+}
+
+void Mile::WriteTraceEvent(
+    const TraceEvent& Event) noexcept
+{
+    TraceBuffer* Buffer = g_TraceBufferOwner.Buffer;
+    if (!Buffer)
+    {
+        Buffer = ::AcquireTraceBuffer();
+        if (!Buffer)
+        {
+            return;
+        }
+        g_TraceBufferOwner.Buffer = Buffer;
+    }
+
+    std::uint64_t Index = Buffer->Head.load(std::memory_order_relaxed);
+    TraceSlot& Slot = Buffer->Slots[Index & (TraceBufferCapacity - 1)];
+
+    // Each slot is a sequence lock, the readers drop the events which change
+    // while they are copied instead of waiting.
+    Slot.Sequence.store(2 * Index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Slot.Words[0].store(Event.StartTime, std::memory_order_relaxed);
+    Slot.Words[1].store(Event.Duration, std::memory_order_relaxed);
+    Slot.Words[2].store(
+        (static_cast<std::uint64_t>(Event.Stage) << 32) | Event.Activity,
+        std::memory_order_relaxed);
+    Slot.Words[3].store(
+        (static_cast<std::uint64_t>(Event.HandleCount) << 32) |
+        static_cast<std::uint32_t>(Event.Result),
+        std::memory_order_relaxed);
+
+    Slot.Sequence.store(2 * Index + 2, std::memory_order_release);
+    Buffer->Head.store(Index + 1, std::memory_order_release);
+}
+
+std::size_t Mile::ReadTraceEvents(
+    std::uint32_t Activity,
+    TraceEvent* Events,
+    std::size_t Capacity) noexcept
+{
+    std::size_t Count = 0;
+
+    TraceBuffer* Buffer = g_TraceBuffers.load(std::memory_order_acquire);
+    for (; Buffer; Buffer = Buffer->Next)
+    {
+        std::uint64_t Head = Buffer->Head.load(std::memory_order_acquire);
+        std::uint64_t Index =
+            Head > TraceBufferCapacity ? Head - TraceBufferCapacity : 0;
+        for (; Index < Head; ++Index)
+        {
+            TraceSlot& Slot = Buffer->Slots[Index & (TraceBufferCapacity - 1)];
+
+            std::uint64_t Sequence =
+                Slot.Sequence.load(std::memory_order_acquire);
+            if (Sequence != 2 * Index + 2)
+            {
+                continue;
+            }
+
+            std::uint64_t Words[4];
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                Words[i] = Slot.Words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (Slot.Sequence.load(std::memory_order_relaxed) != Sequence)
+            {
+                continue;
+            }
+
+            TraceEvent Event;
+            Event.StartTime = Words[0];
+            Event.Duration = Words[1];
+            Event.Activity = static_cast<std::uint32_t>(Words[2]);
+            Event.Stage = static_cast<std::uint32_t>(Words[2] >> 32);
+            Event.Result = static_cast<std::int32_t>(
+                static_cast<std::uint32_t>(Words[3]));
+            Event.HandleCount = static_cast<std::uint32_t>(Words[3] >> 32);
+
+            if (Activity && Event.Activity != Activity)
+            {
+                continue;
+            }
+
+            if (Count < Capacity)
+            {
+                Events[Count] = Event;
+            }
+            ++Count;
+        }
+    }
+
+    std::sort(
+        Events,
+        Events + (Count < Capacity ? Count : Capacity),
+        IsEventEarlier);
+
+    return Count;
+}
+
+std::size_t Mile::FormatTraceEvents(
+    const TraceEvent* Events,
+    std::size_t Count,
+    const wchar_t* const* StageNames,
+    std::size_t StageNameCount,
+    wchar_t* Buffer,
+    std::size_t BufferLength) noexcept
+{
+    const std::size_t NameWidth = 28;
+    const std::size_t TimeWidth = 14;
+
+    TextWriter Writer(Buffer, BufferLength);
+
+    Writer.Append(L"Stage", NameWidth);
+    Writer.Append(L"    Start (us)");
+    Writer.Append(L" Duration (us)");
+    Writer.Append(L"  Result    ");
+    Writer.Append(L"    Handles\n");
+
+    std::uint64_t BaseTime = Count ? Events[0].StartTime : 0;
+    for (std::size_t i = 0; i < Count; ++i)
+    {
+        if (Events[i].StartTime < BaseTime)
+        {
+            BaseTime = Events[i].StartTime;
+        }
+    }
+
+    for (std::size_t i = 0; i < Count; ++i)
+    {
+        const TraceEvent& Event = Events[i];
+
+        const wchar_t* Name = nullptr;
+        if (StageNames && Event.Stage < StageNameCount)
+        {
+            Name = StageNames[Event.Stage];
+        }
+        if (Name)
+        {
+            Writer.Append(Name, NameWidth);
+        }
+        else
+        {
+            wchar_t Number[16] = L"Stage ";
+            TextWriter NumberWriter(Number + 6, 10);
+            NumberWriter.AppendNumber(Event.Stage, 0);
+            NumberWriter.Finish();
+            Writer.Append(Number, NameWidth);
+        }
+
+        Writer.AppendMicroseconds(Event.StartTime - BaseTime, TimeWidth);
+        Writer.AppendMicroseconds(Event.Duration, TimeWidth);
+        Writer.Append(L"  0x");
+        Writer.AppendNumber(
+            static_cast<std::uint32_t>(Event.Result),
+            8,
+            16,
+            8);
+        Writer.AppendNumber(Event.HandleCount, 11);
+        Writer.Append(L'\n');
+    }
+
+    return Writer.Finish();
+}
@@ -0,0 +1,120 @@
+﻿/*
+ * PROJECT:   Mouri Internal Library Essentials
+ * FILE:      Mile.Platform.Trace.h
+ * PURPOSE:   Lightweight Tracing Definition
+ *
+ * LICENSE:   Apache-2.0 License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef MILE_PLATFORM_TRACE
+#define MILE_PLATFORM_TRACE
+
+#include "Mile.Platform.h"
+
+#include <cstddef>
+
+namespace Mile
+{
+    /**
+     * @brief A completed stage of an activity.
+    */
+    struct TraceEvent
+    {
+        /**
+         * @brief The time when the stage started, from GetTraceTimestamp.
+        */
+        std::uint64_t StartTime;
+
+        /**
+         * @brief The duration of the stage, in nanoseconds.
+        */
+        std::uint64_t Duration;
+
+        /**
+         * @brief The activity which the stage belongs to.
+        */
+        std::uint32_t Activity;
+
+        /**
+         * @brief The stage, its meaning is defined by the caller.
+        */
+        std::uint32_t Stage;
+
+        /**
+         * @brief The result of the stage, for example, an HRESULT.
+        */
+        std::int32_t Result;
+
+        /**
+         * @brief The number of the handles or other resources which the
+         *        process has after the stage.
+        */
+        std::uint32_t HandleCount;
+    };
+
+    /**
+     * @brief Retrieves the current time of a monotonic clock.
+     * @return The time in nanoseconds, only the differences are meaningful.
+    */
+    std::uint64_t GetTraceTimestamp() noexcept;
+
+    /**
+     * @brief Creates an activity identifier which is unique in the process.
+     * @return The identifier, it is never 0.
+    */
+    std::uint32_t CreateTraceActivity() noexcept;
+
+    /**
+     * @brief Records an event into the ring buffer of the calling thread.
+     * @param Event The event.
+     * @remark Each thread has its own ring buffer, so the writers never wait
+     *         for each other. The ring buffer keeps the latest 256 events, and
+     *         the event is dropped if the ring buffer cannot be allocated.
+     *         The ring buffers of the exited threads are reused by the new
+     *         threads.
+    */
+    void WriteTraceEvent(
+        const TraceEvent& Event) noexcept;
+
+    /**
+     * @brief Reads the events of an activity from the ring buffers of all
+     *        threads, it can be called while other threads write events.
+     * @param Activity The activity, or 0 for all activities.
+     * @param Events The buffer which receives the events sorted by their
+     *               start times, it can be nullptr if Capacity is 0.
+     * @param Capacity The number of the elements of the buffer.
+     * @return The number of the events which are found. If it is greater
+     *         than Capacity, only Capacity events are written.
+    */
+    std::size_t ReadTraceEvents(
+        std::uint32_t Activity,
+        TraceEvent* Events,
+        std::size_t Capacity) noexcept;
+
+    /**
+     * @brief Formats events as a table, one line for each event. The start
+     *        times are relative to the first event.
+     * @param Events The events.
+     * @param Count The number of the events.
+     * @param StageNames The names of the stages, indexed by the stages. The
+     *                   stages without a name are formatted as numbers.
+     * @param StageNameCount The number of the names.
+     * @param Buffer The buffer which receives the NUL-terminated text, it can
+     *               be nullptr if BufferLength is 0.
+     * @param BufferLength The number of the characters of the buffer.
+     * @return The number of the characters of the whole text, without the
+     *         terminating NUL. If it is not less than BufferLength, the text
+     *         is truncated.
+    */
+    std::size_t FormatTraceEvents(
+        const TraceEvent* Events,
+        std::size_t Count,
+        const wchar_t* const* StageNames,
+        std::size_t StageNameCount,
+        wchar_t* Buffer,
+        std::size_t BufferLength) noexcept;
+}
+
+#endif // !MILE_PLATFORM_TRACE
@@ -18,6 +18,7 @@
 #endif
 
 #include "Mile.Platform.h"
+#include "Mile.Platform.Handle.h"
 
 #include <Windows.h>
 
@@ -373,6 +374,111 @@ namespace Mile
         */
         void UnlockShared() noexcept;
     };
+
+    /**
+     * @brief The traits of the kernel object handles which are closed by
+     *        CloseHandle. Both nullptr and INVALID_HANDLE_VALUE are treated
+     *        as empty, so the pseudo handles should not be wrapped.
+    */
+    template <HandleKind KernelObjectKind>
+    struct KernelObjectHandleTraits
+    {
+        typedef HANDLE ValueType;
+
+        static constexpr HandleKind Kind = KernelObjectKind;
+
+        static ValueType InvalidValue() noexcept
+        {
+            return nullptr;
+        }
+
+        static bool IsValid(
+            ValueType Value) noexcept
+        {
+            return Value && Value != INVALID_HANDLE_VALUE;
+        }
+
+        static void Close(
+            ValueType Value) noexcept
+        {
+            ::CloseHandle(Value);
+        }
+    };
+
+    /**
+     * @brief The traits of the handles of the service control manager and
+     *        the services.
+    */
+    struct ServiceHandleTraits
+    {
+        typedef SC_HANDLE ValueType;
+
+        static constexpr HandleKind Kind = HandleKind::Service;
+
+        static ValueType InvalidValue() noexcept
+        {
+            return nullptr;
+        }
+
+        static bool IsValid(
+            ValueType Value) noexcept
+        {
+            return Value != nullptr;
+        }
+
+        static void Close(
+            ValueType Value) noexcept
+        {
+            ::CloseServiceHandle(Value);
+        }
+    };
+
+    /**
+     * @brief The traits of the memory blocks which are allocated by the
+     *        HeapMemory class or the MileAllocMemory function.
+    */
+    struct HeapBlockTraits
+    {
+        typedef LPVOID ValueType;
+
+        static constexpr HandleKind Kind = HandleKind::HeapBlock;
+
+        static ValueType InvalidValue() noexcept
+        {
+            return nullptr;
+        }
+
+        static bool IsValid(
+            ValueType Value) noexcept
+        {
+            return Value != nullptr;
+        }
+
+        static void Close(
+            ValueType Value) noexcept
+        {
+            HeapMemory::Free(Value);
+        }
+    };
+
+    typedef UniqueHandle<KernelObjectHandleTraits<HandleKind::Token>>
+        UniqueTokenHandle;
+    typedef UniqueHandle<KernelObjectHandleTraits<HandleKind::Process>>
+        UniqueProcessHandle;
+    typedef UniqueHandle<KernelObjectHandleTraits<HandleKind::Thread>>
+        UniqueThreadHandle;
+    typedef UniqueHandle<KernelObjectHandleTraits<HandleKind::File>>
+        UniqueFileHandle;
+    typedef UniqueHandle<KernelObjectHandleTraits<HandleKind::Mapping>>
+        UniqueMappingHandle;
+    typedef UniqueHandle<ServiceHandleTraits> UniqueServiceHandle;
+    typedef UniqueHandle<HeapBlockTraits> UniqueHeapBlock;
+
+    static_assert(
+        sizeof(UniqueTokenHandle) == sizeof(HANDLE) &&
+        sizeof(UniqueServiceHandle) == sizeof(SC_HANDLE) &&
+        sizeof(UniqueHeapBlock) == sizeof(LPVOID),
+        "[Mile] The handle wrappers should be as large as the handles.");
 }
 
 #endif // !MILE_PLATFORM_WINDOWS
@@ -9,3 +9,640 @@
  */
 
 #include "Mile.Platform.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#error "[Mile] The address-based waits are not implemented for the platform."
+#endif
+
+namespace
+{
+    /**
+     * @brief The number of the spins before a thread waits.
+    */
+    const int SpinCount = 128;
+
+#if defined(_WIN32)
+
+    typedef BOOL(WINAPI* WaitOnAddressType)(
+        volatile VOID* Address,
+        PVOID CompareAddress,
+        SIZE_T AddressSize,
+        DWORD dwMilliseconds);
+
+    typedef VOID(WINAPI* WakeByAddressType)(
+        PVOID Address);
+
+    /**
+     * @brief The WaitOnAddress functions, they are resolved at runtime
+     *        because they are not available before Windows 8.
+    */
+    struct AddressWaitFunctions
+    {
+        WaitOnAddressType WaitOnAddress;
+        WakeByAddressType WakeByAddressSingle;
+        WakeByAddressType WakeByAddressAll;
+
+        AddressWaitFunctions() noexcept
+        {
+            HMODULE ModuleHandle = ::GetModuleHandleW(L"kernelbase.dll");
+            if (ModuleHandle)
+            {
+                this->WaitOnAddress = reinterpret_cast<WaitOnAddressType>(
+                    ::GetProcAddress(ModuleHandle, "WaitOnAddress"));
+                this->WakeByAddressSingle =
+                    reinterpret_cast<WakeByAddressType>(::GetProcAddress(
+                        ModuleHandle,
+                        "WakeByAddressSingle"));
+                this->WakeByAddressAll =
+                    reinterpret_cast<WakeByAddressType>(::GetProcAddress(
+                        ModuleHandle,
+                        "WakeByAddressAll"));
+            }
+
+            if (!this->WaitOnAddress ||
+                !this->WakeByAddressSingle ||
+                !this->WakeByAddressAll)
+            {
+                this->WaitOnAddress = nullptr;
+                this->WakeByAddressSingle = nullptr;
+                this->WakeByAddressAll = nullptr;
+            }
+        }
+    };
+
+    const AddressWaitFunctions& GetAddressWaitFunctions() noexcept
+    {
+        static const AddressWaitFunctions Functions;
+        return Functions;
+    }
+
+    /**
+     * @brief A bucket of the waits without WaitOnAddress. The addresses
+     *        which share a bucket are woken together.
+    */
+    struct WaitBucket
+    {
+        SRWLOCK Lock;
+        CONDITION_VARIABLE Condition;
+    };
+
+    const std::size_t WaitBucketCount = 64;
+
+    WaitBucket g_WaitBuckets[WaitBucketCount] = {};
+
+    WaitBucket& GetWaitBucket(
+        std::atomic<std::uint32_t>& Address) noexcept
+    {
+        std::uintptr_t Value = reinterpret_cast<std::uintptr_t>(&Address);
+        return g_WaitBuckets[(Value >> 2) % WaitBucketCount];
+    }
+
+    void WakeWaitBucket(
+        std::atomic<std::uint32_t>& Address) noexcept
+    {
+        // The waiters check the value and sleep while they hold the lock, so
+        // they either see the new value or they are sleeping now.
+        WaitBucket& Bucket = GetWaitBucket(Address);
+        ::AcquireSRWLockExclusive(&Bucket.Lock);
+        ::ReleaseSRWLockExclusive(&Bucket.Lock);
+        ::WakeAllConditionVariable(&Bucket.Condition);
+    }
+
+#elif defined(__linux__)
+
+    long Futex(
+        std::atomic<std::uint32_t>& Address,
+        int Operation,
+        std::uint32_t Value,
+        const timespec* Timeout = nullptr) noexcept
+    {
+        return ::syscall(
+            SYS_futex,
+            reinterpret_cast<std::uint32_t*>(&Address),
+            Operation,
+            Value,
+            Timeout,
+            nullptr,
+            0);
+    }
+
+#endif
+}
+
+void Mile::AddressWait::Wait(
+    std::atomic<std::uint32_t>& Address,
+    std::uint32_t ExpectedValue) noexcept
+{
+#if defined(_WIN32)
+    const AddressWaitFunctions& Functions = GetAddressWaitFunctions();
+    if (Functions.WaitOnAddress)
+    {
+        Functions.WaitOnAddress(
+            &Address,
+            &ExpectedValue,
+            sizeof(ExpectedValue),
+            INFINITE);
+        return;
+    }
+
+    WaitBucket& Bucket = GetWaitBucket(Address);
+    ::AcquireSRWLockExclusive(&Bucket.Lock);
+    if (Address.load(std::memory_order_relaxed) == ExpectedValue)
+    {
+        ::SleepConditionVariableSRW(
+            &Bucket.Condition,
+            &Bucket.Lock,
+            INFINITE,
+            0);
+    }
+    ::ReleaseSRWLockExclusive(&Bucket.Lock);
+#elif defined(__linux__)
+    Futex(Address, FUTEX_WAIT_PRIVATE, ExpectedValue);
+#endif
+}
+
+bool Mile::AddressWait::Wait(
+    std::atomic<std::uint32_t>& Address,
+    std::uint32_t ExpectedValue,
+    std::uint32_t Milliseconds) noexcept
+{
+#if defined(_WIN32)
+    // INFINITE is not a timeout, so the longest timeout is one less.
+    DWORD Timeout = Milliseconds < INFINITE ? Milliseconds : INFINITE - 1;
+
+    const AddressWaitFunctions& Functions = GetAddressWaitFunctions();
+    if (Functions.WaitOnAddress)
+    {
+        return Functions.WaitOnAddress(
+            &Address,
+            &ExpectedValue,
+            sizeof(ExpectedValue),
+            Timeout) || ::GetLastError() != ERROR_TIMEOUT;
+    }
+
+    bool Result = true;
+
+    WaitBucket& Bucket = GetWaitBucket(Address);
+    ::AcquireSRWLockExclusive(&Bucket.Lock);
+    if (Address.load(std::memory_order_relaxed) == ExpectedValue)
+    {
+        Result = ::SleepConditionVariableSRW(
+            &Bucket.Condition,
+            &Bucket.Lock,
+            Timeout,
+            0) || ::GetLastError() != ERROR_TIMEOUT;
+    }
+    ::ReleaseSRWLockExclusive(&Bucket.Lock);
+
+    return Result;
+#elif defined(__linux__)
+    timespec Timeout;
+    Timeout.tv_sec = Milliseconds / 1000;
+    Timeout.tv_nsec = (Milliseconds % 1000) * 1000000L;
+
+    return Futex(
+        Address,
+        FUTEX_WAIT_PRIVATE,
+        ExpectedValue,
+        &Timeout) == 0 || errno != ETIMEDOUT;
+#endif
+}
+
+void Mile::AddressWait::WakeOne(
+    std::atomic<std::uint32_t>& Address) noexcept
+{
+#if defined(_WIN32)
+    const AddressWaitFunctions& Functions = GetAddressWaitFunctions();
+    if (Functions.WakeByAddressSingle)
+    {
+        Functions.WakeByAddressSingle(&Address);
+        return;
+    }
+
+    WakeWaitBucket(Address);
+#elif defined(__linux__)
+    Futex(Address, FUTEX_WAKE_PRIVATE, 1);
+#endif
+}
+
+void Mile::AddressWait::WakeAll(
+    std::atomic<std::uint32_t>& Address) noexcept
+{
+#if defined(_WIN32)
+    const AddressWaitFunctions& Functions = GetAddressWaitFunctions();
+    if (Functions.WakeByAddressAll)
+    {
+        Functions.WakeByAddressAll(&Address);
+        return;
+    }
+
+    WakeWaitBucket(Address);
+#elif defined(__linux__)
+    Futex(Address, FUTEX_WAKE_PRIVATE, INT_MAX);
+#endif
+}
+
+void Mile::AddressWait::Pause() noexcept
+{
+#if defined(_WIN32)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+Mile::Mutex::Mutex() noexcept :
+    m_State(0)
+{
+}
+
+void Mile::Mutex::Lock() noexcept
+{
+    std::uint32_t State = 0;
+    if (this->m_State.compare_exchange_strong(
+        State,
+        1,
+        std::memory_order_acquire,
+        std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Spin while the owner runs, but stop when other threads are waiting
+    // because the owner is likely to hold the mutex for a long time.
+    for (int i = 0; i < SpinCount && State != 2; ++i)
+    {
+        AddressWait::Pause();
+
+        State = this->m_State.load(std::memory_order_relaxed);
+        if (State == 0 && this->m_State.compare_exchange_weak(
+            State,
+            1,
+            std::memory_order_acquire,
+            std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+
+    // Mark the mutex as contended, so the owner wakes a thread when it
+    // unlocks the mutex.
+    while (this->m_State.exchange(2, std::memory_order_acquire) != 0)
+    {
+        AddressWait::Wait(this->m_State, 2);
+    }
+}
+
+bool Mile::Mutex::TryLock() noexcept
+{
+    std::uint32_t State = 0;
+    return this->m_State.compare_exchange_strong(
+        State,
+        1,
+        std::memory_order_acquire,
+        std::memory_order_relaxed);
+}
+
+void Mile::Mutex::Unlock() noexcept
+{
+    if (this->m_State.exchange(0, std::memory_order_release) == 2)
+    {
+        AddressWait::WakeOne(this->m_State);
+    }
+}
+
+Mile::AutoMutexLock::AutoMutexLock(
+    Mutex& Object) noexcept :
+    m_Object(Object)
+{
+    this->m_Object.Lock();
+}
+
+Mile::AutoMutexLock::~AutoMutexLock() noexcept
+{
+    this->m_Object.Unlock();
+}
+
+Mile::AutoMutexTryLock::AutoMutexTryLock(
+    Mutex& Object) noexcept :
+    m_Object(Object)
+{
+    this->m_IsLocked = this->m_Object.TryLock();
+}
+
+Mile::AutoMutexTryLock::~AutoMutexTryLock() noexcept
+{
+    if (this->m_IsLocked)
+    {
+        this->m_Object.Unlock();
+    }
+}
+
+bool Mile::AutoMutexTryLock::IsLocked() const
+{
+    return this->m_IsLocked;
+}
+
+namespace
+{
+    const std::uint32_t ReaderWriterLockWriter = 0x1;
+    const std::uint32_t ReaderWriterLockWriterWaiting = 0x2;
+    const std::uint32_t ReaderWriterLockParked = 0x4;
+    const std::uint32_t ReaderWriterLockReader = 0x8;
+    const std::uint32_t ReaderWriterLockReaderMask =
+        ~(ReaderWriterLockReader - 1);
+}
+
+Mile::ReaderWriterLock::ReaderWriterLock() noexcept :
+    m_State(0)
+{
+}
+
+void Mile::ReaderWriterLock::LockExclusive() noexcept
+{
+    int Spins = 0;
+    std::uint32_t State = this->m_State.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if (!(State & (ReaderWriterLockWriter | ReaderWriterLockReaderMask)))
+        {
+            // The lock is free, and the writer waiting bit is cleared for the
+            // other writers to set it again.
+            std::uint32_t Desired =
+                (State | ReaderWriterLockWriter) &
+                ~ReaderWriterLockWriterWaiting;
+            if (this->m_State.compare_exchange_weak(
+                State,
+                Desired,
+                std::memory_order_acquire,
+                std::memory_order_relaxed))
+            {
+                return;
+            }
+            continue;
+        }
+
+        if (Spins < SpinCount && !(State & ReaderWriterLockParked))
+        {
+            ++Spins;
+            AddressWait::Pause();
+            State = this->m_State.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        std::uint32_t Desired =
+            State | ReaderWriterLockWriterWaiting | ReaderWriterLockParked;
+        if (State != Desired && !this->m_State.compare_exchange_weak(
+            State,
+            Desired,
+            std::memory_order_relaxed,
+            std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        AddressWait::Wait(this->m_State, Desired);
+        State = this->m_State.load(std::memory_order_relaxed);
+    }
+}
+
+bool Mile::ReaderWriterLock::TryLockExclusive() noexcept
+{
+    std::uint32_t State = this->m_State.load(std::memory_order_relaxed);
+    while (!(State & (ReaderWriterLockWriter | ReaderWriterLockReaderMask)))
+    {
+        if (this->m_State.compare_exchange_weak(
+            State,
+            State | ReaderWriterLockWriter,
+            std::memory_order_acquire,
+            std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Mile::ReaderWriterLock::UnlockExclusive() noexcept
+{
+    std::uint32_t State = this->m_State.fetch_and(
+        ~(ReaderWriterLockWriter | ReaderWriterLockParked),
+        std::memory_order_release);
+    if (State & ReaderWriterLockParked)
+    {
+        AddressWait::WakeAll(this->m_State);
+    }
+}
+
+void Mile::ReaderWriterLock::LockShared() noexcept
+{
+    int Spins = 0;
+    std::uint32_t State = this->m_State.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if (!(State &
+            (ReaderWriterLockWriter | ReaderWriterLockWriterWaiting)))
+        {
+            if (this->m_State.compare_exchange_weak(
+                State,
+                State + ReaderWriterLockReader,
+                std::memory_order_acquire,
+                std::memory_order_relaxed))
+            {
+                return;
+            }
+            continue;
+        }
+
+        if (Spins < SpinCount && !(State & ReaderWriterLockParked))
+        {
+            ++Spins;
+            AddressWait::Pause();
+            State = this->m_State.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        std::uint32_t Desired = State | ReaderWriterLockParked;
+        if (State != Desired && !this->m_State.compare_exchange_weak(
+            State,
+            Desired,
+            std::memory_order_relaxed,
+            std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        AddressWait::Wait(this->m_State, Desired);
+        State = this->m_State.load(std::memory_order_relaxed);
+    }
+}
+
+bool Mile::ReaderWriterLock::TryLockShared() noexcept
+{
+    std::uint32_t State = this->m_State.load(std::memory_order_relaxed);
+    while (!(State &
+        (ReaderWriterLockWriter | ReaderWriterLockWriterWaiting)))
+    {
+        if (this->m_State.compare_exchange_weak(
+            State,
+            State + ReaderWriterLockReader,
+            std::memory_order_acquire,
+            std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Mile::ReaderWriterLock::UnlockShared() noexcept
+{
+    std::uint32_t State = this->m_State.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        // The last reader wakes the waiting writers.
+        std::uint32_t Desired = State - ReaderWriterLockReader;
+        if (!(Desired & ReaderWriterLockReaderMask))
+        {
+            Desired &= ~ReaderWriterLockParked;
+        }
+
+        if (this->m_State.compare_exchange_weak(
+            State,
+            Desired,
+            std::memory_order_release,
+            std::memory_order_relaxed))
+        {
+            if ((State & ReaderWriterLockParked) &&
+                !(Desired & ReaderWriterLockParked))
+            {
+                AddressWait::WakeAll(this->m_State);
+            }
+            return;
+        }
+    }
+}
+
+Mile::AutoExclusiveLock::AutoExclusiveLock(
+    ReaderWriterLock& Object) noexcept :
+    m_Object(Object)
+{
+    this->m_Object.LockExclusive();
+}
+
+Mile::AutoExclusiveLock::~AutoExclusiveLock() noexcept
+{
+    this->m_Object.UnlockExclusive();
+}
+
+Mile::AutoSharedLock::AutoSharedLock(
+    ReaderWriterLock& Object) noexcept :
+    m_Object(Object)
+{
+    this->m_Object.LockShared();
+}
+
+Mile::AutoSharedLock::~AutoSharedLock() noexcept
+{
+    this->m_Object.UnlockShared();
+}
+
+Mile::Event::Event() noexcept :
+    m_State(0)
+{
+}
+
+void Mile::Event::Set() noexcept
+{
+    if (this->m_State.exchange(1, std::memory_order_release) == 2)
+    {
+        AddressWait::WakeAll(this->m_State);
+    }
+}
+
+bool Mile::Event::IsSet() const noexcept
+{
+    return this->m_State.load(std::memory_order_acquire) == 1;
+}
+
+void Mile::Event::Wait() noexcept
+{
+    std::uint32_t State = this->m_State.load(std::memory_order_acquire);
+    while (State != 1)
+    {
+        if (State == 0 && !this->m_State.compare_exchange_weak(
+            State,
+            2,
+            std::memory_order_acquire,
+            std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        AddressWait::Wait(this->m_State, 2);
+        State = this->m_State.load(std::memory_order_acquire);
+    }
+}
+
+Mile::OnceFlag::OnceFlag() noexcept :
+    m_State(0)
+{
+}
+
+bool Mile::OnceFlag::BeginCall() noexcept
+{
+    std::uint32_t State = this->m_State.load(std::memory_order_acquire);
+    for (;;)
+    {
+        if (State == 3)
+        {
+            return false;
+        }
+
+        if (State == 0)
+        {
+            if (this->m_State.compare_exchange_weak(
+                State,
+                1,
+                std::memory_order_acquire,
+                std::memory_order_acquire))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        if (State == 1 && !this->m_State.compare_exchange_weak(
+            State,
+            2,
+            std::memory_order_acquire,
+            std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        AddressWait::Wait(this->m_State, 2);
+        State = this->m_State.load(std::memory_order_acquire);
+    }
+}
+
+void Mile::OnceFlag::EndCall() noexcept
+{
+    if (this->m_State.exchange(3, std::memory_order_release) == 2)
+    {
+        AddressWait::WakeAll(this->m_State);
+    }
+}
@@ -17,6 +17,9 @@
 #error "[Mile] You should use a C++ compiler with the C++17 standard."
 #endif
 
+#include <atomic>
+#include <cstdint>
+
 namespace Mile
 {
     /**
@@ -50,6 +53,377 @@ namespace Mile
         DisableMoveConstruction& operator=(
             const DisableMoveConstruction&&) = delete;
     };
+
+    /**
+     * @brief Provides the address-based waits which the portable
+     *        synchronization primitives are built on. It uses the futex on
+     *        Linux, and WaitOnAddress on Windows 8 and later. The older
+     *        versions of Windows use a table of condition variables.
+    */
+    class AddressWait
+    {
+    public:
+
+        /**
+         * @brief Waits until the value at the address is not the expected
+         *        value, or the thread is woken. The wait can return
+         *        spuriously, so the caller should check the value again.
+         * @param Address The address to wait on.
+         * @param ExpectedValue The value which the caller waits to change.
+        */
+        static void Wait(
+            std::atomic<std::uint32_t>& Address,
+            std::uint32_t ExpectedValue) noexcept;
+
+        /**
+         * @brief Waits until the value at the address is not the expected
+         *        value, the thread is woken, or the timeout elapses. The wait
+         *        can return spuriously, so the caller should check the value
+         *        again.
+         * @param Address The address to wait on.
+         * @param ExpectedValue The value which the caller waits to change.
+         * @param Milliseconds The timeout, in milliseconds.
+         * @return If the timeout elapses, the return value is false.
+        */
+        static bool Wait(
+            std::atomic<std::uint32_t>& Address,
+            std::uint32_t ExpectedValue,
+            std::uint32_t Milliseconds) noexcept;
+
+        /**
+         * @brief Wakes one thread which waits on the address.
+         * @param Address The address to wake.
+        */
+        static void WakeOne(
+            std::atomic<std::uint32_t>& Address) noexcept;
+
+        /**
+         * @brief Wakes all threads which wait on the address.
+         * @param Address The address to wake.
+        */
+        static void WakeAll(
+            std::atomic<std::uint32_t>& Address) noexcept;
+
+        /**
+         * @brief Hints the processor that the caller is spinning.
+        */
+        static void Pause() noexcept;
+    };
+
+    /**
+     * @brief A word-sized mutex. It spins for a while before it waits, and
+     *        it stops spinning as soon as other threads are waiting.
+     * @remark The mutex is not recursive.
+    */
+    class Mutex : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief 0 if unlocked, 1 if locked, 2 if locked and other threads
+         *        may be waiting.
+        */
+        std::atomic<std::uint32_t> m_State;
+
+    public:
+
+        /**
+         * @brief Initializes the mutex in the unlocked state.
+        */
+        Mutex() noexcept;
+
+        /**
+         * @brief Waits for ownership of the mutex. The function returns when
+         *        the calling thread is granted ownership.
+        */
+        void Lock() noexcept;
+
+        /**
+         * @brief Attempts to lock the mutex without blocking.
+         * @return If the mutex is successfully locked, the return value is
+         *         true. If another thread already owns the mutex, the return
+         *         value is false.
+        */
+        bool TryLock() noexcept;
+
+        /**
+         * @brief Releases ownership of the mutex.
+        */
+        void Unlock() noexcept;
+    };
+
+    /**
+     * @brief Provides automatic locking and unlocking of a mutex.
+    */
+    class AutoMutexLock
+    {
+    private:
+
+        /**
+         * @brief The mutex object.
+        */
+        Mutex& m_Object;
+
+    public:
+
+        /**
+         * @brief Lock the mutex object.
+         * @param Object The mutex object.
+        */
+        explicit AutoMutexLock(
+            Mutex& Object) noexcept;
+
+        /**
+         * @brief Unlock the mutex object.
+        */
+        ~AutoMutexLock() noexcept;
+    };
+
+    /**
+     * @brief Provides automatic trying to lock and unlocking of a mutex.
+    */
+    class AutoMutexTryLock
+    {
+    private:
+
+        /**
+         * @brief The mutex object.
+        */
+        Mutex& m_Object;
+
+        /**
+         * @brief The lock status.
+        */
+        bool m_IsLocked;
+
+    public:
+
+        /**
+         * @brief Try to lock the mutex object.
+         * @param Object The mutex object.
+        */
+        explicit AutoMutexTryLock(
+            Mutex& Object) noexcept;
+
+        /**
+         * @brief Try to unlock the mutex object.
+        */
+        ~AutoMutexTryLock() noexcept;
+
+        /**
+         * @brief Check the lock status.
+         * @return The lock status.
+        */
+        bool IsLocked() const;
+    };
+
+    /**
+     * @brief A word-sized reader/writer lock. The new readers wait while a
+     *        writer is waiting, so the writers are not starved.
+     * @remark The lock is not recursive.
+    */
+    class ReaderWriterLock : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief The writer bit, the writer waiting bit, the parked bit and
+         *        the reader count.
+        */
+        std::atomic<std::uint32_t> m_State;
+
+    public:
+
+        /**
+         * @brief Initializes the reader/writer lock in the unlocked state.
+        */
+        ReaderWriterLock() noexcept;
+
+        /**
+         * @brief Acquires the reader/writer lock in exclusive mode.
+        */
+        void LockExclusive() noexcept;
+
+        /**
+         * @brief Attempts to acquire the reader/writer lock in exclusive mode
+         *        without blocking.
+         * @return If the lock is successfully acquired, the return value is
+         *         true. If the current thread could not acquire the lock, the
+         *         return value is false.
+        */
+        bool TryLockExclusive() noexcept;
+
+        /**
+         * @brief Releases the reader/writer lock that was acquired in
+         *        exclusive mode.
+        */
+        void UnlockExclusive() noexcept;
+
+        /**
+         * @brief Acquires the reader/writer lock in shared mode.
+        */
+        void LockShared() noexcept;
+
+        /**
+         * @brief Attempts to acquire the reader/writer lock in shared mode
+         *        without blocking.
+         * @return If the lock is successfully acquired, the return value is
+         *         true. If the current thread could not acquire the lock, the
+         *         return value is false.
+        */
+        bool TryLockShared() noexcept;
+
+        /**
+         * @brief Releases the reader/writer lock that was acquired in shared
+         *        mode.
+        */
+        void UnlockShared() noexcept;
+    };
+
+    /**
+     * @brief Provides automatic locking and unlocking of a reader/writer
+     *        lock in exclusive mode.
+    */
+    class AutoExclusiveLock
+    {
+    private:
+
+        /**
+         * @brief The reader/writer lock object.
+        */
+        ReaderWriterLock& m_Object;
+
+    public:
+
+        /**
+         * @brief Lock the reader/writer lock object in exclusive mode.
+         * @param Object The reader/writer lock object.
+        */
+        explicit AutoExclusiveLock(
+            ReaderWriterLock& Object) noexcept;
+
+        /**
+         * @brief Unlock the reader/writer lock object.
+        */
+        ~AutoExclusiveLock() noexcept;
+    };
+
+    /**
+     * @brief Provides automatic locking and unlocking of a reader/writer
+     *        lock in shared mode.
+    */
+    class AutoSharedLock
+    {
+    private:
+
+        /**
+         * @brief The reader/writer lock object.
+        */
+        ReaderWriterLock& m_Object;
+
+    public:
+
+        /**
+         * @brief Lock the reader/writer lock object in shared mode.
+         * @param Object The reader/writer lock object.
+        */
+        explicit AutoSharedLock(
+            ReaderWriterLock& Object) noexcept;
+
+        /**
+         * @brief Unlock the reader/writer lock object.
+        */
+        ~AutoSharedLock() noexcept;
+    };
+
+    /**
+     * @brief A one-shot event. Once it is set, it stays signaled.
+    */
+    class Event : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief 0 if not set, 1 if set, 2 if not set and other threads may
+         *        be waiting.
+        */
+        std::atomic<std::uint32_t> m_State;
+
+    public:
+
+        /**
+         * @brief Initializes the event in the nonsignaled state.
+        */
+        Event() noexcept;
+
+        /**
+         * @brief Sets the event and wakes all waiting threads.
+        */
+        void Set() noexcept;
+
+        /**
+         * @brief Checks whether the event is set.
+         * @return If the event is set, the return value is true.
+        */
+        bool IsSet() const noexcept;
+
+        /**
+         * @brief Waits until the event is set.
+        */
+        void Wait() noexcept;
+    };
+
+    /**
+     * @brief The state of a function which is called once by CallOnce.
+    */
+    class OnceFlag : DisableCopyConstruction, DisableMoveConstruction
+    {
+    private:
+
+        /**
+         * @brief 0 if not called, 1 if running, 2 if running and other
+         *        threads may be waiting, 3 if completed.
+        */
+        std::atomic<std::uint32_t> m_State;
+
+    public:
+
+        /**
+         * @brief Initializes the flag in the not called state.
+        */
+        OnceFlag() noexcept;
+
+        /**
+         * @brief Starts the call, or waits until the call of another thread
+         *        completes.
+         * @return If the calling thread should run the function, the return
+         *         value is true. It should call EndCall after that.
+        */
+        bool BeginCall() noexcept;
+
+        /**
+         * @brief Completes the call and wakes all waiting threads.
+        */
+        void EndCall() noexcept;
+    };
+
+    /**
+     * @brief Calls a function exactly once, the other callers wait until the
+     *        call completes.
+     * @param Flag The state of the call.
+     * @param Function The function, it should not throw exceptions.
+    */
+    template <typename FunctionType>
+    void CallOnce(
+        OnceFlag& Flag,
+        FunctionType&& Function) noexcept
+    {
+        if (Flag.BeginCall())
+        {
+            Function();
+            Flag.EndCall();
+        }
+    }
 }
 
 #endif // !MILE_PLATFORM
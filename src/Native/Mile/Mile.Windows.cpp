@@ -15,6 +15,7 @@
 #include "Mile.Windows.h"
 
 #include "Mile.Platform.Windows.h"
+#include "Mile.Platform.Environment.h"
 
 #if WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP | WINAPI_PARTITION_SYSTEM)
 #include <WtsApi32.h>
@@ -31,6 +32,9 @@
 
 #include <strsafe.h>
 
+#include <cstring>
+#include <new>
+
 /**
  * @remark You can read the definition for this function in "Mile.Windows.h".
  */
@@ -424,19 +428,19 @@ EXTERN_C HRESULT WINAPI MileStartServiceSimple(
     {
         hr = S_OK;
 
-        ::memset(ServiceStatus, 0, sizeof(LPSERVICE_STATUS_PROCESS));
+        ::memset(ServiceStatus, 0, sizeof(SERVICE_STATUS_PROCESS));
 
-        SC_HANDLE hSCM = nullptr;
+        Mile::UniqueServiceHandle hSCM;
         hr = ::MileOpenSCManager(
-            nullptr, nullptr, SC_MANAGER_CONNECT, &hSCM);
+            nullptr, nullptr, SC_MANAGER_CONNECT, hSCM.Put());
         if (hr == S_OK)
         {
-            SC_HANDLE hService = nullptr;
+            Mile::UniqueServiceHandle hService;
             hr = ::MileOpenService(
-                hSCM,
+                hSCM.Get(),
                 ServiceName,
                 SERVICE_QUERY_STATUS | SERVICE_START,
-                &hService);
+                hService.Put());
             if (hr == S_OK)
             {
                 DWORD nBytesNeeded = 0;
@@ -445,7 +449,7 @@ EXTERN_C HRESULT WINAPI MileStartServiceSimple(
                 bool bStartServiceWCalled = false;
 
                 while (::MileQueryServiceStatus(
-                    hService,
+                    hService.Get(),
                     SC_STATUS_PROCESS_INFO,
                     reinterpret_cast<LPBYTE>(ServiceStatus),
                     sizeof(SERVICE_STATUS_PROCESS),
@@ -460,7 +464,10 @@ EXTERN_C HRESULT WINAPI MileStartServiceSimple(
                             break;
                         }
 
-                        hr = ::MileStartService(hService, 0, nullptr);
+                        hr = ::MileStartService(
+                            hService.Get(),
+                            0,
+                            nullptr);
                         if (hr != S_OK)
                         {
                             break;
@@ -509,11 +516,7 @@ EXTERN_C HRESULT WINAPI MileStartServiceSimple(
                         break;
                     }
                 }
-
-                ::MileCloseServiceHandle(hService);
             }
-
-            ::MileCloseServiceHandle(hSCM);
         }
     }
 
@@ -950,11 +953,12 @@ EXTERN_C HRESULT WINAPI MileCreateLUAToken(
 {
     HRESULT hr = E_INVALIDARG;
 
-    PTOKEN_USER pTokenUser = nullptr;
+    Mile::UniqueTokenHandle Token;
+    Mile::UniqueHeapBlock TokenUserBlock;
     TOKEN_OWNER Owner = { 0 };
-    PTOKEN_DEFAULT_DACL pTokenDacl = nullptr;
+    Mile::UniqueHeapBlock TokenDaclBlock;
     DWORD Length = 0;
-    PACL NewDefaultDacl = nullptr;
+    Mile::UniqueHeapBlock NewDefaultDaclBlock;
     TOKEN_DEFAULT_DACL NewTokenDacl = { 0 };
     PACCESS_ALLOWED_ACE pTempAce = nullptr;
     BOOL EnableTokenVirtualization = TRUE;
@@ -966,58 +970,64 @@ EXTERN_C HRESULT WINAPI MileCreateLUAToken(
             break;
         }
 
+        *TokenHandle = INVALID_HANDLE_VALUE;
+
         hr = ::MileCreateRestrictedToken(
             ExistingTokenHandle, LUA_TOKEN,
-            0, nullptr, 0, nullptr, 0, nullptr, TokenHandle);
+            0, nullptr, 0, nullptr, 0, nullptr, Token.Put());
         if (hr != S_OK)
         {
             break;
         }
 
         hr = ::MileSetTokenMandatoryLabel(
-            *TokenHandle, SECURITY_MANDATORY_MEDIUM_RID);
+            Token.Get(), SECURITY_MANDATORY_MEDIUM_RID);
         if (hr != S_OK)
         {
             break;
         }
 
         hr = ::MileGetTokenInformationWithMemory(
-            *TokenHandle,
+            Token.Get(),
             TokenUser,
-            reinterpret_cast<PVOID*>(&pTokenUser));
+            TokenUserBlock.Put());
         if (hr != S_OK)
         {
             break;
         }
+        PTOKEN_USER pTokenUser =
+            reinterpret_cast<PTOKEN_USER>(TokenUserBlock.Get());
 
         Owner.Owner = pTokenUser->User.Sid;
         hr = ::MileSetTokenInformation(
-            *TokenHandle, TokenOwner, &Owner, sizeof(TOKEN_OWNER));
+            Token.Get(), TokenOwner, &Owner, sizeof(TOKEN_OWNER));
         if (hr != S_OK)
         {
             break;
         }
 
         hr = ::MileGetTokenInformationWithMemory(
-            *TokenHandle,
+            Token.Get(),
             TokenDefaultDacl,
-            reinterpret_cast<PVOID*>(&pTokenDacl));
+            TokenDaclBlock.Put());
         if (hr != S_OK)
         {
             break;
         }
+        PTOKEN_DEFAULT_DACL pTokenDacl =
+            reinterpret_cast<PTOKEN_DEFAULT_DACL>(TokenDaclBlock.Get());
 
         Length = pTokenDacl->DefaultDacl->AclSize;
         Length += ::MileGetLengthSid(pTokenUser->User.Sid);
         Length += sizeof(ACCESS_ALLOWED_ACE);
 
-        hr = ::MileAllocMemory(
-            Length, reinterpret_cast<PVOID*>(&NewDefaultDacl));
+        hr = ::MileAllocMemory(Length, NewDefaultDaclBlock.Put());
         if (hr != S_OK)
         {
             break;
         }
-        NewTokenDacl.DefaultDacl = NewDefaultDacl;
+        NewTokenDacl.DefaultDacl =
+            reinterpret_cast<PACL>(NewDefaultDaclBlock.Get());
 
         hr = ::MileInitializeAcl(
             NewTokenDacl.DefaultDacl,
@@ -1057,14 +1067,14 @@ EXTERN_C HRESULT WINAPI MileCreateLUAToken(
 
         Length += sizeof(TOKEN_DEFAULT_DACL);
         hr = ::MileSetTokenInformation(
-            *TokenHandle, TokenDefaultDacl, &NewTokenDacl, Length);
+            Token.Get(), TokenDefaultDacl, &NewTokenDacl, Length);
         if (hr != S_OK)
         {
             break;
         }
 
         hr = ::MileSetTokenInformation(
-            *TokenHandle,
+            Token.Get(),
             TokenVirtualizationEnabled,
             &EnableTokenVirtualization,
             sizeof(BOOL));
@@ -1073,28 +1083,9 @@ EXTERN_C HRESULT WINAPI MileCreateLUAToken(
             break;
         }
 
-    } while (false);
-
-    if (NewDefaultDacl)
-    {
-        ::MileFreeMemory(NewDefaultDacl);
-    }
-
-    if (pTokenDacl)
-    {
-        ::MileFreeMemory(pTokenDacl);
-    }
-
-    if (pTokenUser)
-    {
-        ::MileFreeMemory(pTokenUser);
-    }
+        *TokenHandle = Token.Detach();
 
-    if (hr != S_OK)
-    {
-        ::MileCloseHandle(TokenHandle);
-        *TokenHandle = INVALID_HANDLE_VALUE;
-    }
+    } while (false);
 
     return hr;
 }
@@ -1173,15 +1164,14 @@ EXTERN_C HRESULT WINAPI MileOpenProcessTokenByProcessId(
     _In_ DWORD DesiredAccess,
     _Out_ PHANDLE TokenHandle)
 {
-    HANDLE ProcessHandle = INVALID_HANDLE_VALUE;
+    Mile::UniqueProcessHandle ProcessHandle;
 
     HRESULT hr = ::MileOpenProcess(
-        MAXIMUM_ALLOWED, FALSE, ProcessId, &ProcessHandle);
+        MAXIMUM_ALLOWED, FALSE, ProcessId, ProcessHandle.Put());
     if (hr == S_OK)
     {
-        hr = ::MileOpenProcessToken(ProcessHandle, DesiredAccess, TokenHandle);
-
-        ::MileCloseHandle(ProcessHandle);
+        hr = ::MileOpenProcessToken(
+            ProcessHandle.Get(), DesiredAccess, TokenHandle);
     }
 
     return hr;
@@ -1197,16 +1187,14 @@ EXTERN_C HRESULT WINAPI MileOpenServiceProcessToken(
     _In_ DWORD DesiredAccess,
     _Out_ PHANDLE TokenHandle)
 {
-    HANDLE ProcessHandle = INVALID_HANDLE_VALUE;
+    Mile::UniqueProcessHandle ProcessHandle;
 
     HRESULT hr = ::MileOpenServiceProcess(
-        MAXIMUM_ALLOWED, FALSE, ServiceName, &ProcessHandle);
+        MAXIMUM_ALLOWED, FALSE, ServiceName, ProcessHandle.Put());
     if (hr == S_OK)
     {
         hr = ::MileOpenProcessToken(
-            ProcessHandle, DesiredAccess, TokenHandle);
-
-        ::MileCloseHandle(ProcessHandle);
+            ProcessHandle.Get(), DesiredAccess, TokenHandle);
     }
 
     return hr;
@@ -1223,16 +1211,14 @@ EXTERN_C HRESULT WINAPI MileOpenLsassProcessToken(
     _In_ DWORD DesiredAccess,
     _Out_ PHANDLE TokenHandle)
 {
-    HANDLE ProcessHandle = INVALID_HANDLE_VALUE;
+    Mile::UniqueProcessHandle ProcessHandle;
 
     HRESULT hr = ::MileOpenLsassProcess(
-        MAXIMUM_ALLOWED, FALSE, &ProcessHandle);
+        MAXIMUM_ALLOWED, FALSE, ProcessHandle.Put());
     if (hr == S_OK)
     {
         hr = ::MileOpenProcessToken(
-            ProcessHandle, DesiredAccess, TokenHandle);
-
-        ::MileCloseHandle(ProcessHandle);
+            ProcessHandle.Get(), DesiredAccess, TokenHandle);
     }
 
     return hr;
@@ -1261,16 +1247,14 @@ EXTERN_C HRESULT WINAPI MileOpenThreadTokenByThreadId(
     _In_ BOOL OpenAsSelf,
     _Out_ PHANDLE TokenHandle)
 {
-    HANDLE ThreadHandle = INVALID_HANDLE_VALUE;
+    Mile::UniqueThreadHandle ThreadHandle;
 
     HRESULT hr = ::MileOpenThread(
-        MAXIMUM_ALLOWED, FALSE, ThreadId, &ThreadHandle);
+        MAXIMUM_ALLOWED, FALSE, ThreadId, ThreadHandle.Put());
     if (hr == S_OK)
     {
         hr = ::MileOpenThreadToken(
-            ThreadHandle, DesiredAccess, OpenAsSelf, TokenHandle);
-
-        ::MileCloseHandle(ThreadHandle);
+            ThreadHandle.Get(), DesiredAccess, OpenAsSelf, TokenHandle);
     }
 
     return hr;
@@ -1302,45 +1286,52 @@ EXTERN_C HRESULT WINAPI MileExpandEnvironmentStringsWithMemory(
     _In_ LPCWSTR Source,
     _Out_ LPWSTR* Destination)
 {
-    DWORD AllocatedLength = 0;
-    DWORD ActualLength = 0;
+    if (!Source || !Destination)
+    {
+        return E_INVALIDARG;
+    }
 
-    HRESULT hr = E_INVALIDARG;
+    *Destination = nullptr;
 
-    if (Destination)
+    // The environment is captured once and expanded in one pass, so it
+    // cannot change between sizing and filling the result.
+    LPWCH Environment = ::GetEnvironmentStringsW();
+    if (!Environment)
     {
-        hr = ::MileExpandEnvironmentStrings(
+        return ::MileGetLastErrorAsHResult();
+    }
+
+    HRESULT hr = S_OK;
+
+    try
+    {
+        Mile::EnvironmentSnapshot Snapshot;
+        Snapshot.Assign(Environment);
+
+        Mile::EnvironmentExpansionBuffer Expanded;
+        Snapshot.Expand(
             Source,
-            nullptr,
-            0,
-            &AllocatedLength);
-        if (hr == S_OK)
-        {
-            hr = ::MileAllocMemory(
-                AllocatedLength * sizeof(wchar_t),
-                reinterpret_cast<PVOID*>(Destination));
-            if (hr == S_OK)
-            {
-                hr = ::MileExpandEnvironmentStrings(
-                    Source,
-                    *Destination,
-                    AllocatedLength,
-                    &ActualLength);
-                if (hr == S_OK)
-                {
-                    if (AllocatedLength != ActualLength)
-                    {
-                        hr = E_UNEXPECTED;
-                    }
-                }
-            }
-        }
+            ::wcslen(Source),
+            Expanded,
+            nullptr);
 
-        if (hr != S_OK)
+        hr = ::MileAllocMemory(
+            (Expanded.GetSize() + 1) * sizeof(wchar_t),
+            reinterpret_cast<PVOID*>(Destination));
+        if (hr == S_OK)
         {
-            ::MileFreeMemory(*Destination);
+            std::memcpy(
+                *Destination,
+                Expanded.GetData(),
+                (Expanded.GetSize() + 1) * sizeof(wchar_t));
         }
     }
+    catch (std::bad_alloc const&)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    ::FreeEnvironmentStringsW(Environment);
 
     return hr;
 }
@@ -1510,6 +1501,27 @@ EXTERN_C HRESULT WINAPI MileCreateThread(
  */
 EXTERN_C DWORD WINAPI MileGetNumberOfHardwareThreads()
 {
+    typedef DWORD(WINAPI* GetActiveProcessorCountType)(
+        WORD GroupNumber);
+
+    // GetActiveProcessorCount is not available before Windows 7.
+    HMODULE ModuleHandle = ::GetModuleHandleW(L"kernel32.dll");
+    if (ModuleHandle)
+    {
+        GetActiveProcessorCountType pGetActiveProcessorCount =
+            reinterpret_cast<GetActiveProcessorCountType>(::GetProcAddress(
+                ModuleHandle,
+                "GetActiveProcessorCount"));
+        if (pGetActiveProcessorCount)
+        {
+            DWORD Count = pGetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+            if (Count)
+            {
+                return Count;
+            }
+        }
+    }
+
     SYSTEM_INFO SystemInfo = { 0 };
     ::GetNativeSystemInfo(&SystemInfo);
     return SystemInfo.dwNumberOfProcessors;
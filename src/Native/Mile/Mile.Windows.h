@@ -1203,6 +1203,11 @@ EXTERN_C HRESULT WINAPI MileExpandEnvironmentStrings(
  *                    information, free it by calling the MileFreeMemory
  *                    function. You should also set the pointer to nullptr.
  * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @remark The environment block of the current process is captured once and
+ *         the string is expanded against it in one pass, so the result is
+ *         consistent even if other threads change the environment. The
+ *         references to undefined variables are kept as they are, the same
+ *         as ExpandEnvironmentStringsW.
  */
 EXTERN_C HRESULT WINAPI MileExpandEnvironmentStringsWithMemory(
     _In_ LPCWSTR Source,
@@ -1371,9 +1376,13 @@ EXTERN_C HRESULT WINAPI MileCreateThread(
     _Out_opt_ PHANDLE lpThreadHandle);
 
 /**
- * Retrieves the number of logical processors in the current group.
+ * Retrieves the number of active logical processors in all processor groups.
  *
- * @return The number of logical processors in the current group.
+ * @return The number of active logical processors in all processor groups.
+ * @remark The number is limited to the current group before Windows 7. The
+ *         threads of a process only run in one group by default before
+ *         Windows 11, so the callers which create a thread per processor
+ *         should set the group affinity of the threads.
  */
 EXTERN_C DWORD WINAPI MileGetNumberOfHardwareThreads();
 
@@ -14,488 +14,801 @@
 
 #include "detours.h"
 
-namespace FunctionType
+#include "NSudoDevilModeHook.h"
+#include "NSudoDevilModePathFilter.h"
+#include "NSudoDevilModePrivilegedContext.h"
+#include "NSudoDevilModeProfile.h"
+
+namespace
 {
-    enum
+    HANDLE g_PrivilegedToken;
+
+    NSUDO_DEVIL_MODE_THREAD_STATE_TABLE g_ThreadStates;
+
+    volatile LONG64 g_NativeOpenKeyCount;
+    volatile LONG64 g_EmulatedOpenKeyCount;
+
+    /**
+     * The number of the rows of the hook counters in the profile, the
+     * threads are spread across the rows by their identifiers.
+     */
+    const uint32_t ProfileStripeCount = 64;
+
+    HANDLE g_ProfileSection;
+    PNSUDO_DEVIL_MODE_PROFILE volatile g_Profile;
+
+    /**
+     * The prefixes of the paths which are opened in the privileged context.
+     * All paths are opened in the privileged context if it has no node.
+     */
+    NSUDO_DEVIL_MODE_PATH_FILTER g_PathFilter;
+
+    /**
+     * The maximum number of the characters of a root directory path which
+     * the path filter resolves.
+     */
+    const size_t MaxRootPathLength = 512;
+
+    /**
+     * Checks whether an open should run in the privileged context.
+     *
+     * @param ResolveRoot Whether to query the name of the root directory. If
+     *                    it is false, the opens relative to a root directory
+     *                    always match.
+     * @param ObjectAttributes The object attributes of the open.
+     * @return If the path filter is not configured or the path matches it,
+     *         it returns true.
+     */
+    bool MatchPathFilter(
+        _In_ bool ResolveRoot,
+        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes)
     {
-        NtCreateKey,
-        NtCreateKeyTransacted,
-        NtOpenKey,
-        NtOpenKeyTransacted,
-        NtCreateFile,
-        NtOpenFile,
+        if (!g_PathFilter.NodeCount || !ObjectAttributes)
+        {
+            return true;
+        }
 
-        NtOpenKeyEx,
-        NtOpenKeyTransactedEx,
+        const uint16_t* Name = nullptr;
+        size_t NameLength = 0;
 
-        MaxFunctionType
-    };
-}
+        PUNICODE_STRING ObjectName = ObjectAttributes->ObjectName;
+        if (ObjectName && ObjectName->Buffer)
+        {
+            Name = reinterpret_cast<const uint16_t*>(ObjectName->Buffer);
+            NameLength = ObjectName->Length / sizeof(wchar_t);
+        }
 
-namespace
-{
-    HANDLE g_PrivilegedToken;
+        if (!ObjectAttributes->RootDirectory)
+        {
+            return ::NSudoDevilModeMatchPathFilter(
+                &g_PathFilter,
+                nullptr,
+                0,
+                Name,
+                NameLength);
+        }
 
-    PVOID g_OriginalAddress[FunctionType::MaxFunctionType];
-    PVOID g_DetouredAddress[FunctionType::MaxFunctionType];
-}
+        if (!ResolveRoot)
+        {
+            return true;
+        }
 
+        union
+        {
+            OBJECT_NAME_INFORMATION Information;
+            uint8_t Buffer[
+                sizeof(OBJECT_NAME_INFORMATION) +
+                MaxRootPathLength * sizeof(wchar_t)];
+        } RootName;
+
+        if (!NT_SUCCESS(::NtQueryObject(
+            ObjectAttributes->RootDirectory,
+            ObjectNameInformation,
+            &RootName,
+            sizeof(RootName),
+            nullptr)))
+        {
+            return true;
+        }
 
-NTSTATUS NSudoDevilModeEnterPrivilegedContext(
-    _Out_ PHANDLE OriginalTokenHandle)
-{
-    if (g_PrivilegedToken == INVALID_HANDLE_VALUE)
-    {
-        return STATUS_NOT_SUPPORTED;
+        return ::NSudoDevilModeMatchPathFilter(
+            &g_PathFilter,
+            reinterpret_cast<const uint16_t*>(
+                RootName.Information.Name.Buffer),
+            RootName.Information.Name.Length / sizeof(wchar_t),
+            Name,
+            NameLength);
     }
 
-    if (!NT_SUCCESS(::NtOpenThreadToken(
-        NtCurrentThread(),
-        MAXIMUM_ALLOWED,
-        TRUE,
-        OriginalTokenHandle)))
+    uint64_t QueryProfileTicks()
     {
-        *OriginalTokenHandle = nullptr;
+        LARGE_INTEGER Counter;
+        ::RtlQueryPerformanceCounter(&Counter);
+        return static_cast<uint64_t>(Counter.QuadPart);
     }
 
-    return ::NtSetInformationThread(
-        NtCurrentThread(),
-        ThreadImpersonationToken,
-        &g_PrivilegedToken,
-        sizeof(HANDLE));
-}
-
-NTSTATUS NSudoDevilModeLeavePrivilegedContext(
-    _Out_ HANDLE OriginalTokenHandle)
-{
-    NTSTATUS Status = ::NtSetInformationThread(
-        NtCurrentThread(),
-        ThreadImpersonationToken,
-        &OriginalTokenHandle,
-        sizeof(HANDLE));
-
-    if (OriginalTokenHandle != nullptr &&
-        OriginalTokenHandle != INVALID_HANDLE_VALUE)
+    /**
+     * Records a call of a hook in the profile.
+     */
+    void RecordHookCall(
+        _In_ size_t HookIndex,
+        _In_ uint64_t StartTicks,
+        _In_ bool ContextFailed)
     {
-        ::NtClose(OriginalTokenHandle);
-    }
+        PNSUDO_DEVIL_MODE_PROFILE Profile = g_Profile;
+        if (!Profile)
+        {
+            return;
+        }
 
-    return Status;
-}
+        ::NSudoDevilModeRecordHookCall(
+            Profile,
+            static_cast<uint32_t>(HookIndex),
+            ::HandleToULong(NtCurrentTeb()->ClientId.UniqueThread),
+            QueryProfileTicks() - StartTicks,
+            ContextFailed);
+    }
 
+    bool SyscallIsImpersonating(
+        void* Context)
+    {
+        UNREFERENCED_PARAMETER(Context);
 
-NTSTATUS NTAPI OriginalNtCreateKey(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Reserved_ ULONG TitleIndex,
-    _In_opt_ PUNICODE_STRING Class,
-    _In_ ULONG CreateOptions,
-    _Out_opt_ PULONG Disposition)
-{
-    return reinterpret_cast<decltype(NtCreateKey)*>(
-        g_OriginalAddress[FunctionType::NtCreateKey])(
-            KeyHandle,
-            DesiredAccess,
-            ObjectAttributes,
-            TitleIndex,
-            Class,
-            CreateOptions,
-            Disposition);
-}
+        return NtCurrentTeb()->IsImpersonating != 0;
+    }
 
-NTSTATUS NTAPI DetouredNtCreateKey(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Reserved_ ULONG TitleIndex,
-    _In_opt_ PUNICODE_STRING Class,
-    _In_ ULONG CreateOptions,
-    _Out_opt_ PULONG Disposition)
-{
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
+    int32_t SyscallOpenThreadToken(
+        void* Context,
+        void** TokenHandle)
     {
-        CreateOptions |= REG_OPTION_BACKUP_RESTORE;
+        UNREFERENCED_PARAMETER(Context);
+
+        return ::NtOpenThreadToken(
+            NtCurrentThread(),
+            MAXIMUM_ALLOWED,
+            TRUE,
+            reinterpret_cast<PHANDLE>(TokenHandle));
     }
 
-    NTSTATUS Status = OriginalNtCreateKey(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        TitleIndex,
-        Class,
-        CreateOptions,
-        Disposition);
+    int32_t SyscallSetThreadToken(
+        void* Context,
+        void* TokenHandle)
+    {
+        UNREFERENCED_PARAMETER(Context);
+
+        return ::NtSetInformationThread(
+            NtCurrentThread(),
+            ThreadImpersonationToken,
+            &TokenHandle,
+            sizeof(HANDLE));
+    }
 
-    if (NT_SUCCESS(ContextStatus))
+    int32_t SyscallCloseHandle(
+        void* Context,
+        void* Handle)
     {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
+        UNREFERENCED_PARAMETER(Context);
+
+        return ::NtClose(Handle);
     }
 
-    return Status;
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE g_Syscalls =
+    {
+        nullptr,
+        SyscallIsImpersonating,
+        SyscallOpenThreadToken,
+        SyscallSetThreadToken,
+        SyscallCloseHandle
+    };
 }
 
-
-NTSTATUS NTAPI OriginalNtCreateKeyTransacted(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Reserved_ ULONG TitleIndex,
-    _In_opt_ PUNICODE_STRING Class,
-    _In_ ULONG CreateOptions,
-    _In_ HANDLE TransactionHandle,
-    _Out_opt_ PULONG Disposition)
+/**
+ * Retrieves the counters of the privileged context.
+ *
+ * @param Counters A pointer to a NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS
+ *                 structure that receives the counters.
+ * @remark The counters of the hooks which are running are not included.
+ */
+EXTERN_C VOID WINAPI NSudoDevilModeQueryPrivilegedContextCounters(
+    _Out_ PNSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters)
 {
-    return reinterpret_cast<decltype(NtCreateKeyTransacted)*>(
-        g_OriginalAddress[FunctionType::NtCreateKeyTransacted])(
-            KeyHandle,
-            DesiredAccess,
-            ObjectAttributes,
-            TitleIndex,
-            Class,
-            CreateOptions,
-            TransactionHandle,
-            Disposition);
+    ::NSudoDevilModeGetPrivilegedContextCounters(&g_ThreadStates, Counters);
 }
 
-NTSTATUS NTAPI DetouredNtCreateKeyTransacted(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Reserved_ ULONG TitleIndex,
-    _In_opt_ PUNICODE_STRING Class,
-    _In_ ULONG CreateOptions,
-    _In_ HANDLE TransactionHandle,
-    _Out_opt_ PULONG Disposition)
+/**
+ * Retrieves the counters of the NtOpenKey and NtOpenKeyTransacted hooks.
+ *
+ * @param NativeCount A pointer to a variable that receives the number of the
+ *                    successful opens forwarded to NtOpenKeyEx or
+ *                    NtOpenKeyTransactedEx with REG_OPTION_BACKUP_RESTORE in
+ *                    the privileged context. The opens of the paths outside
+ *                    the path filter are not counted.
+ * @param EmulatedCount A pointer to a variable that receives the number of
+ *                      the opens emulated by creating the key and deleting
+ *                      it if it is new, it is only used when the Ex
+ *                      functions are not available. The emulated opens are
+ *                      also recorded in the NtOpenKey.Emulated and
+ *                      NtOpenKeyTransacted.Emulated rows of the profile.
+ */
+EXTERN_C VOID WINAPI NSudoDevilModeQueryOpenKeyCounters(
+    _Out_ PULONG64 NativeCount,
+    _Out_ PULONG64 EmulatedCount)
 {
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
-    {
-        CreateOptions |= REG_OPTION_BACKUP_RESTORE;
-    }
+    *NativeCount = static_cast<ULONG64>(
+        ::InterlockedCompareExchange64(&g_NativeOpenKeyCount, 0, 0));
+    *EmulatedCount = static_cast<ULONG64>(
+        ::InterlockedCompareExchange64(&g_EmulatedOpenKeyCount, 0, 0));
+}
 
-    NTSTATUS Status = OriginalNtCreateKeyTransacted(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        TitleIndex,
-        Class,
-        CreateOptions,
-        TransactionHandle,
-        Disposition);
-
-    if (NT_SUCCESS(ContextStatus))
-    {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
-    }
+/**
+ * Retrieves the counters of a hook, summed across all threads.
+ *
+ * @param HookIndex The index of the hook. The rows after the hooks record the
+ *                  emulated opens of NtOpenKey and NtOpenKeyTransacted, the
+ *                  names of all rows are in the HookNames member of the
+ *                  profile.
+ * @param Counters A pointer to a NSUDO_DEVIL_MODE_HOOK_COUNTERS structure
+ *                 that receives the counters.
+ * @return If the profile is available and the hook index is valid, it
+ *         returns TRUE.
+ * @remark The profile is also exported as a section named
+ *         NSudoDevilModeProfile.<Process ID> in the named object directory of
+ *         the session, for example, Local\NSudoDevilModeProfile.1234, so
+ *         another process can map it and sample the counters with the
+ *         NSudoDevilModeAggregateHookCounters function.
+ */
+EXTERN_C BOOL WINAPI NSudoDevilModeQueryHookCounters(
+    _In_ ULONG HookIndex,
+    _Out_ PNSUDO_DEVIL_MODE_HOOK_COUNTERS Counters)
+{
+    return ::NSudoDevilModeAggregateHookCounters(
+        g_Profile,
+        HookIndex,
+        Counters) ? TRUE : FALSE;
+}
 
-    return Status;
+/**
+ * Retrieves the time spent in each phase of the last hook transaction.
+ *
+ * @param Timings A pointer to a DETOUR_TRANSACTION_TIMINGS structure that
+ *                receives the timings.
+ */
+EXTERN_C VOID WINAPI NSudoDevilModeQueryTransactionTimings(
+    _Out_ PDETOUR_TRANSACTION_TIMINGS Timings)
+{
+    ::DetourGetTransactionTimings(Timings);
 }
 
 
-NTSTATUS NTAPI OriginalNtOpenKey(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes)
+/**
+ * The hooks of NSudo Devil Mode in the order of their indices in the profile.
+ * Each row generates the index and the entry in the hook list. The Privileged
+ * rows also declare a NSUDO_DEVIL_MODE_PRIVILEGED_HOOK with the option
+ * parameter index and flag, and the Custom rows name the hooks which are
+ * written by hand below.
+ */
+#define NSUDO_DEVIL_MODE_HOOKS(Privileged, Custom) \
+    Privileged(NtCreateKey, 5, REG_OPTION_BACKUP_RESTORE) \
+    Privileged(NtCreateKeyTransacted, 5, REG_OPTION_BACKUP_RESTORE) \
+    Custom(NtOpenKey) \
+    Custom(NtOpenKeyTransacted) \
+    Privileged(NtCreateFile, 8, FILE_OPEN_FOR_BACKUP_INTENT) \
+    Privileged(NtOpenFile, 5, FILE_OPEN_FOR_BACKUP_INTENT) \
+    Privileged(NtOpenKeyEx, 3, REG_OPTION_BACKUP_RESTORE) \
+    Privileged(NtOpenKeyTransactedEx, 3, REG_OPTION_BACKUP_RESTORE)
+
+#define NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_INDEX(Name, OptionIndex, OptionFlag) \
+    Name,
+#define NSUDO_DEVIL_MODE_CUSTOM_HOOK_INDEX(Name) Name,
+
+/**
+ * The indices of the hooks in the profile.
+ */
+enum class HookIndex : size_t
 {
-    return reinterpret_cast<decltype(NtOpenKey)*>(
-        g_OriginalAddress[FunctionType::NtOpenKey])(
-            KeyHandle,
-            DesiredAccess,
-            ObjectAttributes);
-}
+    NSUDO_DEVIL_MODE_HOOKS(
+        NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_INDEX,
+        NSUDO_DEVIL_MODE_CUSTOM_HOOK_INDEX)
+    Count
+};
+
+#undef NSUDO_DEVIL_MODE_CUSTOM_HOOK_INDEX
+#undef NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_INDEX
 
-NTSTATUS NTAPI DetouredNtOpenKey(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes)
+/**
+ * The rows of the profile after the rows of the hooks. They record the opens
+ * of NtOpenKey and NtOpenKeyTransacted which are emulated by creating the key
+ * and deleting it if it is new, because the Ex functions are not available.
+ */
+enum class ProfileRow : size_t
 {
-    ULONG Disposition = 0;
+    NtOpenKeyEmulated = static_cast<size_t>(HookIndex::Count),
+    NtOpenKeyTransactedEmulated,
+    Count
+};
 
-    NTSTATUS Status = DetouredNtCreateKey(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        0,
-        nullptr,
-        0,
-        &Disposition);
+/**
+ * The privileged context policy of the hooks, it also records the calls in
+ * the profile.
+ */
+struct PrivilegedContextPolicy
+{
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context;
+    size_t ProfileIndex;
+    uint64_t StartTicks;
 
-    if (REG_CREATED_NEW_KEY == Disposition)
+    bool Enter(
+        _In_ size_t Index)
     {
-        ::NtDeleteKey(*KeyHandle);
+        ProfileIndex = Index;
+        StartTicks = g_Profile ? QueryProfileTicks() : 0;
+
+        if (g_PrivilegedToken == INVALID_HANDLE_VALUE ||
+            !NT_SUCCESS(::NSudoDevilModeEnterPrivilegedContext(
+                &g_ThreadStates,
+                &Context,
+                reinterpret_cast<uintptr_t>(
+                    NtCurrentTeb()->ClientId.UniqueThread),
+                &g_Syscalls,
+                g_PrivilegedToken)))
+        {
+            RecordHookCall(ProfileIndex, StartTicks, true);
+            return false;
+        }
+
+        return true;
+    }
 
-        ::NtClose(*KeyHandle);
-        *KeyHandle = nullptr;
+    void Leave()
+    {
+        ::NSudoDevilModeLeavePrivilegedContext(
+            &g_ThreadStates,
+            &Context,
+            &g_Syscalls);
 
-        Status = STATUS_OBJECT_NAME_NOT_FOUND;
+        RecordHookCall(ProfileIndex, StartTicks, false);
     }
 
-    return Status;
-}
+    static bool Filter(
+        _In_ size_t Index,
+        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes)
+    {
+        // Querying the name of a file handle may block, so only the names of
+        // the registry keys are resolved.
+        bool ResolveRoot =
+            Index != static_cast<size_t>(HookIndex::NtCreateFile) &&
+            Index != static_cast<size_t>(HookIndex::NtOpenFile);
 
+        return MatchPathFilter(ResolveRoot, ObjectAttributes);
+    }
+};
 
-NTSTATUS NTAPI OriginalNtOpenKeyTransacted(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ HANDLE TransactionHandle)
-{
-    return reinterpret_cast<decltype(NtOpenKeyTransacted)*>(
-        g_OriginalAddress[FunctionType::NtOpenKeyTransacted])(
-            KeyHandle,
-            DesiredAccess,
-            ObjectAttributes,
-            TransactionHandle);
-}
+/**
+ * Declares a hook which runs the original function in the privileged context
+ * and ORs a flag into its option parameter, if the path of the object matches
+ * the path filter.
+ *
+ * @param Name The name of the hooked export in ntdll.dll.
+ * @param OptionIndex The index of the option parameter, or
+ *                    NSudoDevilMode::NoOption.
+ * @param OptionFlag The flag ORed into the option parameter.
+ * @remark The object attributes are the third parameter of all hooked
+ *         exports.
+ */
+#define NSUDO_DEVIL_MODE_PRIVILEGED_HOOK(Name, OptionIndex, OptionFlag) \
+    struct Name##Hook : public NSudoDevilMode::PrivilegedHook< \
+        Name##Hook, \
+        decltype(::Name), \
+        PrivilegedContextPolicy, \
+        OptionIndex, \
+        OptionFlag> \
+    { \
+        static constexpr const char* FunctionName = #Name; \
+        static constexpr size_t Index = \
+            static_cast<size_t>(HookIndex::Name); \
+        static constexpr size_t FilterIndex = 2; \
+    }
 
-NTSTATUS NTAPI DetouredNtOpenKeyTransacted(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ HANDLE TransactionHandle)
-{
-    ULONG Disposition = 0;
+#define NSUDO_DEVIL_MODE_DECLARE_PRIVILEGED_HOOK(Name, Index, Flag) \
+    NSUDO_DEVIL_MODE_PRIVILEGED_HOOK(Name, Index, Flag);
+#define NSUDO_DEVIL_MODE_DECLARE_CUSTOM_HOOK(Name)
 
-    NTSTATUS Status = DetouredNtCreateKeyTransacted(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        0,
-        nullptr,
-        0,
-        TransactionHandle,
-        &Disposition);
+NSUDO_DEVIL_MODE_HOOKS(
+    NSUDO_DEVIL_MODE_DECLARE_PRIVILEGED_HOOK,
+    NSUDO_DEVIL_MODE_DECLARE_CUSTOM_HOOK)
+
+#undef NSUDO_DEVIL_MODE_DECLARE_CUSTOM_HOOK
+#undef NSUDO_DEVIL_MODE_DECLARE_PRIVILEGED_HOOK
 
-    if (REG_CREATED_NEW_KEY == Disposition)
+struct NtOpenKeyHook : public NSudoDevilMode::PrivilegedHook<
+    NtOpenKeyHook,
+    decltype(::NtOpenKey),
+    PrivilegedContextPolicy>
+{
+    static constexpr const char* FunctionName = "NtOpenKey";
+    static constexpr size_t Index = static_cast<size_t>(HookIndex::NtOpenKey);
+
+    static NTSTATUS NTAPI Detoured(
+        _Out_ PHANDLE KeyHandle,
+        _In_ ACCESS_MASK DesiredAccess,
+        _In_ POBJECT_ATTRIBUTES ObjectAttributes)
     {
-        ::NtDeleteKey(*KeyHandle);
+        if (!PrivilegedContextPolicy::Filter(Index, ObjectAttributes))
+        {
+            return Original(KeyHandle, DesiredAccess, ObjectAttributes);
+        }
+
+        if (NtOpenKeyExHook::OriginalAddress)
+        {
+            // Open the key directly instead of creating and deleting it. The
+            // call is recorded under the index of this hook only, because the
+            // original function of NtOpenKeyEx is called instead of its hook.
+            PrivilegedContextPolicy Context;
+            if (!Context.Enter(Index))
+            {
+                return NtOpenKeyExHook::Original(
+                    KeyHandle,
+                    DesiredAccess,
+                    ObjectAttributes,
+                    0);
+            }
 
-        ::NtClose(*KeyHandle);
-        *KeyHandle = nullptr;
+            NTSTATUS Status = NtOpenKeyExHook::Original(
+                KeyHandle,
+                DesiredAccess,
+                ObjectAttributes,
+                REG_OPTION_BACKUP_RESTORE);
 
-        Status = STATUS_OBJECT_NAME_NOT_FOUND;
-    }
+            Context.Leave();
 
-    return Status;
-}
+            if (NT_SUCCESS(Status))
+            {
+                ::InterlockedIncrement64(&g_NativeOpenKeyCount);
+            }
+
+            return Status;
+        }
 
+        ::InterlockedIncrement64(&g_EmulatedOpenKeyCount);
 
-NTSTATUS NTAPI OriginalNtOpenKeyEx(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ ULONG OpenOptions)
-{
-    return reinterpret_cast<decltype(NtOpenKeyEx)*>(
-        g_OriginalAddress[FunctionType::NtOpenKeyEx])(
+        // The nested hook and the cleanup share the privileged context, and
+        // the emulation has its own row in the profile.
+        PrivilegedContextPolicy Context;
+        bool Entered = Context.Enter(
+            static_cast<size_t>(ProfileRow::NtOpenKeyEmulated));
+
+        ULONG Disposition = 0;
+
+        NTSTATUS Status = NtCreateKeyHook::Detoured(
             KeyHandle,
             DesiredAccess,
             ObjectAttributes,
-            OpenOptions);
-}
+            0,
+            nullptr,
+            0,
+            &Disposition);
+
+        if (REG_CREATED_NEW_KEY == Disposition)
+        {
+            ::NtDeleteKey(*KeyHandle);
+
+            ::NtClose(*KeyHandle);
+            *KeyHandle = nullptr;
+
+            Status = STATUS_OBJECT_NAME_NOT_FOUND;
+        }
 
-NTSTATUS NTAPI DetouredNtOpenKeyEx(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ ULONG OpenOptions)
+        if (Entered)
+        {
+            Context.Leave();
+        }
+
+        return Status;
+    }
+};
+
+struct NtOpenKeyTransactedHook : public NSudoDevilMode::PrivilegedHook<
+    NtOpenKeyTransactedHook,
+    decltype(::NtOpenKeyTransacted),
+    PrivilegedContextPolicy>
 {
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
+    static constexpr const char* FunctionName = "NtOpenKeyTransacted";
+    static constexpr size_t Index =
+        static_cast<size_t>(HookIndex::NtOpenKeyTransacted);
+
+    static NTSTATUS NTAPI Detoured(
+        _Out_ PHANDLE KeyHandle,
+        _In_ ACCESS_MASK DesiredAccess,
+        _In_ POBJECT_ATTRIBUTES ObjectAttributes,
+        _In_ HANDLE TransactionHandle)
     {
-        OpenOptions |= REG_OPTION_BACKUP_RESTORE;
-    }
+        if (!PrivilegedContextPolicy::Filter(Index, ObjectAttributes))
+        {
+            return Original(
+                KeyHandle,
+                DesiredAccess,
+                ObjectAttributes,
+                TransactionHandle);
+        }
+
+        if (NtOpenKeyTransactedExHook::OriginalAddress)
+        {
+            // Open the key directly instead of creating and deleting it.
+            PrivilegedContextPolicy Context;
+            if (!Context.Enter(Index))
+            {
+                return NtOpenKeyTransactedExHook::Original(
+                    KeyHandle,
+                    DesiredAccess,
+                    ObjectAttributes,
+                    0,
+                    TransactionHandle);
+            }
 
-    NTSTATUS Status = OriginalNtOpenKeyEx(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        OpenOptions);
+            NTSTATUS Status = NtOpenKeyTransactedExHook::Original(
+                KeyHandle,
+                DesiredAccess,
+                ObjectAttributes,
+                REG_OPTION_BACKUP_RESTORE,
+                TransactionHandle);
 
-    if (NT_SUCCESS(ContextStatus))
-    {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
-    }
+            Context.Leave();
 
-    return Status;
-}
+            if (NT_SUCCESS(Status))
+            {
+                ::InterlockedIncrement64(&g_NativeOpenKeyCount);
+            }
 
+            return Status;
+        }
 
-NTSTATUS NTAPI OriginalNtOpenKeyTransactedEx(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ ULONG OpenOptions,
-    _In_ HANDLE TransactionHandle)
-{
-    return reinterpret_cast<decltype(NtOpenKeyTransactedEx)*>(
-        g_OriginalAddress[FunctionType::NtOpenKeyTransactedEx])(
+        ::InterlockedIncrement64(&g_EmulatedOpenKeyCount);
+
+        // The nested hook and the cleanup share the privileged context, and
+        // the emulation has its own row in the profile.
+        PrivilegedContextPolicy Context;
+        bool Entered = Context.Enter(
+            static_cast<size_t>(ProfileRow::NtOpenKeyTransactedEmulated));
+
+        ULONG Disposition = 0;
+
+        NTSTATUS Status = NtCreateKeyTransactedHook::Detoured(
             KeyHandle,
             DesiredAccess,
             ObjectAttributes,
-            OpenOptions,
-            TransactionHandle);
-}
+            0,
+            nullptr,
+            0,
+            TransactionHandle,
+            &Disposition);
 
-NTSTATUS NTAPI DetouredNtOpenKeyTransactedEx(
-    _Out_ PHANDLE KeyHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _In_ ULONG OpenOptions,
-    _In_ HANDLE TransactionHandle)
-{
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
-    {
-        OpenOptions |= REG_OPTION_BACKUP_RESTORE;
-    }
+        if (REG_CREATED_NEW_KEY == Disposition)
+        {
+            ::NtDeleteKey(*KeyHandle);
 
-    NTSTATUS Status = OriginalNtOpenKeyTransactedEx(
-        KeyHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        OpenOptions,
-        TransactionHandle);
+            ::NtClose(*KeyHandle);
+            *KeyHandle = nullptr;
 
-    if (NT_SUCCESS(ContextStatus))
-    {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
+            Status = STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+
+        if (Entered)
+        {
+            Context.Leave();
+        }
+
+        return Status;
     }
+};
 
-    return Status;
-}
+/**
+ * Maps the index of a hook to the hook type.
+ */
+template <size_t Index>
+struct HookAt;
+
+#define NSUDO_DEVIL_MODE_CUSTOM_HOOK_AT(Name) \
+    template <> \
+    struct HookAt<static_cast<size_t>(HookIndex::Name)> \
+    { \
+        using Type = Name##Hook; \
+    };
+#define NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_AT(Name, OptionIndex, OptionFlag) \
+    NSUDO_DEVIL_MODE_CUSTOM_HOOK_AT(Name)
 
+NSUDO_DEVIL_MODE_HOOKS(
+    NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_AT,
+    NSUDO_DEVIL_MODE_CUSTOM_HOOK_AT)
 
-NTSTATUS NTAPI OriginalNtCreateFile(
-    _Out_ PHANDLE FileHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Out_ PIO_STATUS_BLOCK IoStatusBlock,
-    _In_opt_ PLARGE_INTEGER AllocationSize,
-    _In_ ULONG FileAttributes,
-    _In_ ULONG ShareAccess,
-    _In_ ULONG CreateDisposition,
-    _In_ ULONG CreateOptions,
-    _In_reads_bytes_opt_(EaLength) PVOID EaBuffer,
-    _In_ ULONG EaLength)
-{
-    return reinterpret_cast<decltype(NtCreateFile)*>(
-        g_OriginalAddress[FunctionType::NtCreateFile])(
-            FileHandle,
-            DesiredAccess,
-            ObjectAttributes,
-            IoStatusBlock,
-            AllocationSize,
-            FileAttributes,
-            ShareAccess,
-            CreateDisposition,
-            CreateOptions,
-            EaBuffer,
-            EaLength);
-}
+#undef NSUDO_DEVIL_MODE_PRIVILEGED_HOOK_AT
+#undef NSUDO_DEVIL_MODE_CUSTOM_HOOK_AT
 
+/**
+ * The hooks of NSudo Devil Mode.
+ */
+using Hooks = NSudoDevilMode::MakeHookList<
+    HookAt,
+    static_cast<size_t>(HookIndex::Count)>;
 
-NTSTATUS NTAPI DetouredNtCreateFile(
-    _Out_ PHANDLE FileHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Out_ PIO_STATUS_BLOCK IoStatusBlock,
-    _In_opt_ PLARGE_INTEGER AllocationSize,
-    _In_ ULONG FileAttributes,
-    _In_ ULONG ShareAccess,
-    _In_ ULONG CreateDisposition,
-    _In_ ULONG CreateOptions,
-    _In_reads_bytes_opt_(EaLength) PVOID EaBuffer,
-    _In_ ULONG EaLength)
+static_assert(
+    static_cast<size_t>(ProfileRow::Count) <=
+    NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS,
+    "The profile is too small for the hooks.");
+
+/**
+ * Creates the profile of the hooks in a named section, so another process can
+ * sample the counters.
+ */
+void NSudoDevilModeCreateProfile()
 {
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
+    wchar_t NameBuffer[96];
+    UNICODE_STRING Name;
+    Name.Buffer = NameBuffer;
+    Name.Length = 0;
+    Name.MaximumLength = sizeof(NameBuffer);
+
+    auto AppendNumber = [&Name](ULONG Value)
+    {
+        wchar_t NumberBuffer[16];
+        UNICODE_STRING Number;
+        Number.Buffer = NumberBuffer;
+        Number.Length = 0;
+        Number.MaximumLength = sizeof(NumberBuffer);
+        ::RtlIntegerToUnicodeString(Value, 10, &Number);
+        ::RtlAppendUnicodeStringToString(&Name, &Number);
+    };
+
+    ULONG SessionId = NtCurrentPeb()->SessionId;
+    if (SessionId)
+    {
+        ::RtlAppendUnicodeToString(&Name, L"\\Sessions\\");
+        AppendNumber(SessionId);
+    }
+    ::RtlAppendUnicodeToString(
+        &Name,
+        L"\\BaseNamedObjects\\NSudoDevilModeProfile.");
+    AppendNumber(::HandleToULong(NtCurrentTeb()->ClientId.UniqueProcess));
+
+    OBJECT_ATTRIBUTES OA;
+    InitializeObjectAttributes(&OA, &Name, 0, nullptr, nullptr);
+
+    size_t ProfileSize = ::NSudoDevilModeGetProfileSize(
+        static_cast<uint32_t>(ProfileRow::Count),
+        ProfileStripeCount);
+
+    LARGE_INTEGER MaximumSize;
+    MaximumSize.QuadPart = static_cast<LONGLONG>(ProfileSize);
+
+    if (!NT_SUCCESS(::NtCreateSection(
+        &g_ProfileSection,
+        SECTION_QUERY | SECTION_MAP_READ | SECTION_MAP_WRITE,
+        &OA,
+        &MaximumSize,
+        PAGE_READWRITE,
+        SEC_COMMIT,
+        nullptr)))
     {
-        CreateOptions |= FILE_OPEN_FOR_BACKUP_INTENT;
+        g_ProfileSection = nullptr;
+        return;
     }
 
-    NTSTATUS Status = OriginalNtCreateFile(
-        FileHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        IoStatusBlock,
-        AllocationSize,
-        FileAttributes,
-        ShareAccess,
-        CreateDisposition,
-        CreateOptions,
-        EaBuffer,
-        EaLength);
-
-    if (NT_SUCCESS(ContextStatus))
+    // The view is page aligned and filled with zeros.
+    PVOID BaseAddress = nullptr;
+    SIZE_T ViewSize = 0;
+    if (!NT_SUCCESS(::NtMapViewOfSection(
+        g_ProfileSection,
+        NtCurrentProcess(),
+        &BaseAddress,
+        0,
+        0,
+        nullptr,
+        &ViewSize,
+        ViewUnmap,
+        0,
+        PAGE_READWRITE)))
     {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
+        ::NtClose(g_ProfileSection);
+        g_ProfileSection = nullptr;
+        return;
     }
 
-    return Status;
-}
+    PNSUDO_DEVIL_MODE_PROFILE Profile =
+        reinterpret_cast<PNSUDO_DEVIL_MODE_PROFILE>(BaseAddress);
 
+    LARGE_INTEGER Frequency;
+    ::RtlQueryPerformanceFrequency(&Frequency);
 
-NTSTATUS NTAPI OriginalNtOpenFile(
-    _Out_ PHANDLE FileHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Out_ PIO_STATUS_BLOCK IoStatusBlock,
-    _In_ ULONG ShareAccess,
-    _In_ ULONG OpenOptions)
-{
-    return reinterpret_cast<decltype(NtOpenFile)*>(
-        g_OriginalAddress[FunctionType::NtOpenFile])(
-            FileHandle,
-            DesiredAccess,
-            ObjectAttributes,
-            IoStatusBlock,
-            ShareAccess,
-            OpenOptions);
+    Hooks::ForEachName([Profile](size_t Index, const char* FunctionName)
+    {
+        ::NSudoDevilModeSetProfileHookName(
+            Profile,
+            static_cast<uint32_t>(Index),
+            FunctionName);
+    });
+    ::NSudoDevilModeSetProfileHookName(
+        Profile,
+        static_cast<uint32_t>(ProfileRow::NtOpenKeyEmulated),
+        "NtOpenKey.Emulated");
+    ::NSudoDevilModeSetProfileHookName(
+        Profile,
+        static_cast<uint32_t>(ProfileRow::NtOpenKeyTransactedEmulated),
+        "NtOpenKeyTransacted.Emulated");
+
+    ::NSudoDevilModeInitializeProfile(
+        Profile,
+        static_cast<uint32_t>(ProfileRow::Count),
+        ProfileStripeCount,
+        static_cast<uint64_t>(Frequency.QuadPart));
+
+    g_Profile = Profile;
 }
 
-NTSTATUS NTAPI DetouredNtOpenFile(
-    _Out_ PHANDLE FileHandle,
-    _In_ ACCESS_MASK DesiredAccess,
-    _In_ POBJECT_ATTRIBUTES ObjectAttributes,
-    _Out_ PIO_STATUS_BLOCK IoStatusBlock,
-    _In_ ULONG ShareAccess,
-    _In_ ULONG OpenOptions)
+/**
+ * Loads the path filter from the NSUDO_DEVIL_MODE_PATH_FILTER environment
+ * variable, which is a list of the NT path prefixes separated by semicolons,
+ * for example, \REGISTRY\MACHINE\SOFTWARE;\??\C:\Windows. If it is not
+ * defined, all opens run in the privileged context.
+ */
+void NSudoDevilModeLoadPathFilter()
 {
-    HANDLE OriginalTokenHandle = INVALID_HANDLE_VALUE;
-    NTSTATUS ContextStatus = NSudoDevilModeEnterPrivilegedContext(
-        &OriginalTokenHandle);
-    if (NT_SUCCESS(ContextStatus))
+    UNICODE_STRING Name;
+    ::RtlInitUnicodeString(
+        &Name,
+        const_cast<PWSTR>(L"NSUDO_DEVIL_MODE_PATH_FILTER"));
+
+    UNICODE_STRING Value;
+    Value.Buffer = nullptr;
+    Value.Length = 0;
+    Value.MaximumLength = 0;
+    if (STATUS_BUFFER_TOO_SMALL != ::RtlQueryEnvironmentVariable_U(
+        nullptr,
+        &Name,
+        &Value) || Value.Length > UNICODE_STRING_MAX_BYTES - sizeof(wchar_t))
     {
-        OpenOptions |= FILE_OPEN_FOR_BACKUP_INTENT;
+        return;
     }
 
-    NTSTATUS Status = OriginalNtOpenFile(
-        FileHandle,
-        DesiredAccess,
-        ObjectAttributes,
-        IoStatusBlock,
-        ShareAccess,
-        OpenOptions);
+    Value.MaximumLength = static_cast<USHORT>(Value.Length + sizeof(wchar_t));
+    Value.Buffer = reinterpret_cast<PWSTR>(::RtlAllocateHeap(
+        RtlProcessHeap(),
+        0,
+        Value.MaximumLength));
+    if (!Value.Buffer)
+    {
+        return;
+    }
 
-    if (NT_SUCCESS(ContextStatus))
+    if (NT_SUCCESS(::RtlQueryEnvironmentVariable_U(nullptr, &Name, &Value)))
     {
-        NSudoDevilModeLeavePrivilegedContext(OriginalTokenHandle);
+        // The trie needs at most one node per character and the root.
+        uint32_t NodeCapacity =
+            static_cast<uint32_t>(Value.Length / sizeof(wchar_t)) + 1;
+        PNSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes =
+            reinterpret_cast<PNSUDO_DEVIL_MODE_PATH_FILTER_NODE>(
+                ::RtlAllocateHeap(
+                    RtlProcessHeap(),
+                    0,
+                    NodeCapacity * sizeof(NSUDO_DEVIL_MODE_PATH_FILTER_NODE)));
+
+        NSUDO_DEVIL_MODE_PATH_FILTER Filter;
+        if (::NSudoDevilModeInitializePathFilter(
+            &Filter,
+            Nodes,
+            NodeCapacity) &&
+            ::NSudoDevilModeAddPathFilterPrefixes(
+                &Filter,
+                reinterpret_cast<const uint16_t*>(Value.Buffer),
+                Value.Length / sizeof(wchar_t)))
+        {
+            g_PathFilter = Filter;
+        }
+        else if (Nodes)
+        {
+            ::RtlFreeHeap(RtlProcessHeap(), 0, Nodes);
+        }
     }
 
-    return Status;
+    ::RtlFreeHeap(RtlProcessHeap(), 0, Value.Buffer);
 }
 
 /**
@@ -571,36 +884,6 @@ void NSudoDevilModeInitialize()
         g_PrivilegedToken = INVALID_HANDLE_VALUE;
     }
 
-    g_OriginalAddress[FunctionType::NtCreateKey] =
-        ::NtCreateKey;
-    g_DetouredAddress[FunctionType::NtCreateKey] =
-        ::DetouredNtCreateKey;
-
-    g_OriginalAddress[FunctionType::NtCreateKeyTransacted] =
-        ::NtCreateKeyTransacted;
-    g_DetouredAddress[FunctionType::NtCreateKeyTransacted] =
-        ::DetouredNtCreateKeyTransacted;
-
-    g_OriginalAddress[FunctionType::NtOpenKey] =
-        ::NtOpenKey;
-    g_DetouredAddress[FunctionType::NtOpenKey] =
-        ::DetouredNtOpenKey;
-
-    g_OriginalAddress[FunctionType::NtOpenKeyTransacted] =
-        ::NtOpenKeyTransacted;
-    g_DetouredAddress[FunctionType::NtOpenKeyTransacted] =
-        ::DetouredNtOpenKeyTransacted;
-
-    g_OriginalAddress[FunctionType::NtCreateFile] =
-        ::NtCreateFile;
-    g_DetouredAddress[FunctionType::NtCreateFile] =
-        ::DetouredNtCreateFile;
-
-    g_OriginalAddress[FunctionType::NtOpenFile] =
-        ::NtOpenFile;
-    g_DetouredAddress[FunctionType::NtOpenFile] =
-        ::DetouredNtOpenFile;
-
     UNICODE_STRING NtdllName;
     ::RtlInitUnicodeString(
         &NtdllName,
@@ -614,31 +897,26 @@ void NSudoDevilModeInitialize()
         &NtdllModuleHandle);
     if (NtdllModuleHandle)
     {
-        ANSI_STRING FunctionName;
-
-        ::RtlInitAnsiString(
-            &FunctionName,
-            const_cast<PSTR>("NtOpenKeyEx"));
-        ::LdrGetProcedureAddress(
-            NtdllModuleHandle,
-            &FunctionName,
-            0,
-            &g_OriginalAddress[FunctionType::NtOpenKeyEx]);
-        g_DetouredAddress[FunctionType::NtOpenKeyEx] =
-            ::DetouredNtOpenKeyEx;
-
-        ::RtlInitAnsiString(
-            &FunctionName,
-            const_cast<PSTR>("NtOpenKeyTransactedEx"));
-        ::LdrGetProcedureAddress(
-            NtdllModuleHandle,
-            &FunctionName,
-            0,
-            &g_OriginalAddress[FunctionType::NtOpenKeyTransactedEx]);
-        g_DetouredAddress[FunctionType::NtOpenKeyTransactedEx] =
-            ::DetouredNtOpenKeyTransactedEx;
-
+        Hooks::Resolve([NtdllModuleHandle](
+            const char* FunctionName,
+            PVOID* OriginalAddress)
+        {
+            ANSI_STRING Name;
+            ::RtlInitAnsiString(&Name, const_cast<PSTR>(FunctionName));
+            if (!NT_SUCCESS(::LdrGetProcedureAddress(
+                NtdllModuleHandle,
+                &Name,
+                0,
+                OriginalAddress)))
+            {
+                *OriginalAddress = nullptr;
+            }
+        });
     }
+
+    NSudoDevilModeLoadPathFilter();
+
+    NSudoDevilModeCreateProfile();
 }
 
 /**
@@ -650,6 +928,22 @@ void NSudoDevilModeUninitialize()
     {
         ::NtClose(g_PrivilegedToken);
     }
+
+    // The view of the profile is not unmapped, because the hooks which were
+    // called before the detach may still be recording their calls. It is
+    // released when the process exits. The section handle can be closed,
+    // because the view keeps the section alive.
+    if (g_ProfileSection)
+    {
+        ::NtClose(g_ProfileSection);
+        g_ProfileSection = nullptr;
+    }
+
+    if (g_PathFilter.Nodes)
+    {
+        ::RtlFreeHeap(RtlProcessHeap(), 0, g_PathFilter.Nodes);
+        g_PathFilter = NSUDO_DEVIL_MODE_PATH_FILTER{};
+    }
 }
 
 BOOL APIENTRY DllMain(
@@ -660,7 +954,16 @@ BOOL APIENTRY DllMain(
     UNREFERENCED_PARAMETER(Module);
     UNREFERENCED_PARAMETER(Reserved);
 
-    if (DLL_PROCESS_ATTACH == Reason || DLL_PROCESS_DETACH == Reason)
+    if (DLL_THREAD_DETACH == Reason)
+    {
+        // A thread which exits in a hook never leaves its privileged
+        // context, so its slot is released here.
+        ::NSudoDevilModeDetachThreadState(
+            &g_ThreadStates,
+            reinterpret_cast<uintptr_t>(NtCurrentTeb()->ClientId.UniqueThread),
+            &g_Syscalls);
+    }
+    else if (DLL_PROCESS_ATTACH == Reason || DLL_PROCESS_DETACH == Reason)
     {
         if (DLL_PROCESS_ATTACH == Reason)
         {
@@ -668,26 +971,28 @@ BOOL APIENTRY DllMain(
         }
 
         DetourTransactionBegin();
-        DetourUpdateThread(NtCurrentThread());
 
-        for (size_t i = 0; i < FunctionType::MaxFunctionType; ++i)
+        Hooks::ForEach([Reason](
+            PVOID* OriginalAddress,
+            PVOID DetouredAddress)
         {
-            if (g_OriginalAddress[i])
+            if (*OriginalAddress)
             {
                 if (DLL_PROCESS_ATTACH == Reason)
                 {
-                    DetourAttach(
-                        &g_OriginalAddress[i],
-                        g_DetouredAddress[i]);
+                    DetourAttach(OriginalAddress, DetouredAddress);
                 }
                 else if (DLL_PROCESS_DETACH == Reason)
                 {
-                    DetourDetach(
-                        &g_OriginalAddress[i],
-                        g_DetouredAddress[i]);
+                    DetourDetach(OriginalAddress, DetouredAddress);
                 }
             }
-        }
+        });
+
+        // The other threads are suspended after the operations are queued,
+        // so the commit doesn't touch the process heap until they resume. A
+        // suspended thread which owns the heap lock can't deadlock DllMain.
+        DetourUpdateAllThreads();
 
         DetourTransactionCommit();
 
@@ -0,0 +1,140 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeCodeRange.cpp
+ * PURPOSE:   Implementation for the Code Range Table of the Thread Fixups
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeCodeRange.h"
+
+namespace
+{
+    void SwapCodeRanges(
+        PNSUDO_DEVIL_MODE_CODE_RANGE Left,
+        PNSUDO_DEVIL_MODE_CODE_RANGE Right)
+    {
+        NSUDO_DEVIL_MODE_CODE_RANGE Temporary = *Left;
+        *Left = *Right;
+        *Right = Temporary;
+    }
+
+    /**
+     * Moves the root of a subtree down until the subtree is a max heap.
+     */
+    void SiftDown(
+        PNSUDO_DEVIL_MODE_CODE_RANGE Ranges,
+        size_t Root,
+        size_t Count)
+    {
+        for (;;)
+        {
+            size_t Largest = Root;
+            size_t Left = 2 * Root + 1;
+            size_t Right = Left + 1;
+
+            if (Left < Count && Ranges[Left].Start > Ranges[Largest].Start)
+            {
+                Largest = Left;
+            }
+
+            if (Right < Count && Ranges[Right].Start > Ranges[Largest].Start)
+            {
+                Largest = Right;
+            }
+
+            if (Largest == Root)
+            {
+                return;
+            }
+
+            SwapCodeRanges(&Ranges[Root], &Ranges[Largest]);
+            Root = Largest;
+        }
+    }
+}
+
+void NSudoDevilModeSortCodeRanges(
+    PNSUDO_DEVIL_MODE_CODE_RANGE Ranges,
+    size_t Count)
+{
+    for (size_t i = Count / 2; i > 0; --i)
+    {
+        SiftDown(Ranges, i - 1, Count);
+    }
+
+    for (size_t i = Count; i > 1; --i)
+    {
+        SwapCodeRanges(&Ranges[0], &Ranges[i - 1]);
+        SiftDown(Ranges, 0, i - 1);
+    }
+}
+
+const NSUDO_DEVIL_MODE_CODE_RANGE* NSudoDevilModeFindCodeRange(
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Ranges,
+    size_t Count,
+    uintptr_t Address)
+{
+    // Finds the first range which starts after the address, the range before
+    // it is the only one which can contain the address.
+    size_t Lower = 0;
+    size_t Upper = Count;
+    while (Lower < Upper)
+    {
+        size_t Middle = Lower + (Upper - Lower) / 2;
+        if (Ranges[Middle].Start <= Address)
+        {
+            Lower = Middle + 1;
+        }
+        else
+        {
+            Upper = Middle;
+        }
+    }
+
+    if (!Lower)
+    {
+        return nullptr;
+    }
+
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Range = &Ranges[Lower - 1];
+    if (Address - Range->Start >= Range->Size)
+    {
+        return nullptr;
+    }
+
+    return Range;
+}
+
+bool NSudoDevilModeFixupInstructionPointer(
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Ranges,
+    size_t Count,
+    uintptr_t* InstructionPointer)
+{
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Range = NSudoDevilModeFindCodeRange(
+        Ranges,
+        Count,
+        *InstructionPointer);
+    if (!Range)
+    {
+        return false;
+    }
+
+    uintptr_t Offset = *InstructionPointer - Range->Start;
+    uintptr_t DestinationOffset = 0;
+
+    for (uint8_t i = 0; i < Range->OffsetCount; ++i)
+    {
+        if (Range->SourceOffsets[i] == Offset)
+        {
+            DestinationOffset = Range->DestinationOffsets[i];
+            break;
+        }
+    }
+
+    *InstructionPointer = Range->Destination + DestinationOffset;
+
+    return true;
+}
@@ -0,0 +1,108 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeCodeRange.h
+ * PURPOSE:   Definition for the Code Range Table of the Thread Fixups
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_CODE_RANGE_TABLE
+#define NSUDO_DEVIL_MODE_CODE_RANGE_TABLE
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The maximum number of the instruction boundaries in a code range, it is
+ * the same as the number of the alignment entries in a Detours trampoline.
+ */
+#define NSUDO_DEVIL_MODE_MAXIMUM_CODE_RANGE_OFFSETS 8
+
+/**
+ * A code range which is moved by a transaction, for example, the patched
+ * instructions of a target function or the code of a removed trampoline.
+ */
+typedef struct _NSUDO_DEVIL_MODE_CODE_RANGE
+{
+    /**
+     * The address of the first byte of the range.
+     */
+    uintptr_t Start;
+
+    /**
+     * The size of the range, in bytes.
+     */
+    uintptr_t Size;
+
+    /**
+     * The address where the instructions of the range are moved to.
+     */
+    uintptr_t Destination;
+
+    /**
+     * The offsets of the instruction boundaries in the range.
+     */
+    uint8_t SourceOffsets[NSUDO_DEVIL_MODE_MAXIMUM_CODE_RANGE_OFFSETS];
+
+    /**
+     * The offsets of the same instruction boundaries at the destination.
+     */
+    uint8_t DestinationOffsets[NSUDO_DEVIL_MODE_MAXIMUM_CODE_RANGE_OFFSETS];
+
+    /**
+     * The number of the elements in the offset arrays.
+     */
+    uint8_t OffsetCount;
+
+} NSUDO_DEVIL_MODE_CODE_RANGE, *PNSUDO_DEVIL_MODE_CODE_RANGE;
+
+/**
+ * Sorts the code ranges by the start address.
+ *
+ * @param Ranges The code ranges, they should not overlap.
+ * @param Count The number of the code ranges.
+ * @remark The function uses heap sort, so it costs O(n log n) time and no
+ *         extra memory.
+ */
+void NSudoDevilModeSortCodeRanges(
+    PNSUDO_DEVIL_MODE_CODE_RANGE Ranges,
+    size_t Count);
+
+/**
+ * Finds the code range which contains an address.
+ *
+ * @param Ranges The code ranges sorted by the NSudoDevilModeSortCodeRanges
+ *               function.
+ * @param Count The number of the code ranges.
+ * @param Address The address.
+ * @return The code range, or nullptr if no range contains the address.
+ */
+const NSUDO_DEVIL_MODE_CODE_RANGE* NSudoDevilModeFindCodeRange(
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Ranges,
+    size_t Count,
+    uintptr_t Address);
+
+/**
+ * Moves an instruction pointer which is in one of the code ranges to the
+ * same instruction at the destination.
+ *
+ * @param Ranges The code ranges sorted by the NSudoDevilModeSortCodeRanges
+ *               function.
+ * @param Count The number of the code ranges.
+ * @param InstructionPointer The instruction pointer.
+ * @return If the instruction pointer is moved, it returns true.
+ * @remark If the instruction pointer is not at an instruction boundary, it is
+ *         moved to the start of the destination, the same as Detours.
+ */
+bool NSudoDevilModeFixupInstructionPointer(
+    const NSUDO_DEVIL_MODE_CODE_RANGE* Ranges,
+    size_t Count,
+    uintptr_t* InstructionPointer);
+
+#endif // !NSUDO_DEVIL_MODE_CODE_RANGE_TABLE
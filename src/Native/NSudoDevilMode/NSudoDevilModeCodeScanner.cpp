@@ -0,0 +1,435 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeCodeScanner.cpp
+ * PURPOSE:   Implementation for the Hook Site Scanner of the Code Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeCodeScanner.h"
+
+namespace
+{
+    /**
+     * Checks whether an instruction ends a function, the same as the
+     * detour_does_code_end_function function of Detours.
+     */
+    bool IsFunctionEnd(
+        const uint8_t* Code,
+        size_t Length)
+    {
+        switch (Code[0])
+        {
+        case 0xEB: // jmp +imm8
+        case 0xE9: // jmp +imm32
+        case 0xE0: // jmp eax
+        case 0xC2: // ret +imm8
+        case 0xC3: // ret
+        case 0xCC: // brk
+            return true;
+        case 0xF3: // rep ret
+            return Length >= 2 && Code[1] == 0xC3;
+        case 0xFF: // jmp [+imm32]
+            return Length >= 2 && Code[1] == 0x25;
+        case 0x26: // jmp es:
+        case 0x2E: // jmp cs:
+        case 0x36: // jmp ss:
+        case 0x3E: // jmp ds:
+        case 0x64: // jmp fs:
+        case 0x65: // jmp gs:
+            return Length >= 3 && Code[1] == 0xFF && Code[2] == 0x25;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * Checks whether an instruction is padding. It covers the NOPs of all
+     * lengths and INT 3, so it is a superset of the detour_is_code_filler
+     * function of Detours.
+     */
+    bool IsPadding(
+        const uint8_t* Code,
+        const NSUDO_DEVIL_MODE_INSTRUCTION& Instruction,
+        bool Is64Bit)
+    {
+        const uint8_t* Opcode = &Code[Instruction.OpcodeOffset];
+
+        if (Opcode[0] == 0xCC)
+        {
+            return true;
+        }
+
+        if (Opcode[0] == 0x90)
+        {
+            // 41 90 is xchg eax, r8d.
+            return !(Is64Bit &&
+                Instruction.OpcodeOffset &&
+                (Opcode[-1] & 0xF1) == 0x41);
+        }
+
+        return Instruction.OpcodeOffset &&
+            Opcode[-1] == 0x0F &&
+            Opcode[0] == 0x1F;
+    }
+
+    int32_t ReadTarget(
+        const uint8_t* Code,
+        const NSUDO_DEVIL_MODE_INSTRUCTION& Instruction)
+    {
+        const uint8_t* Target = &Code[Instruction.TargetOffset];
+
+        switch (Instruction.TargetSize)
+        {
+        case 1:
+            return static_cast<int8_t>(Target[0]);
+        case 2:
+            return static_cast<int16_t>(Target[0] | (Target[1] << 8));
+        case 4:
+            return static_cast<int32_t>(
+                static_cast<uint32_t>(Target[0]) |
+                (static_cast<uint32_t>(Target[1]) << 8) |
+                (static_cast<uint32_t>(Target[2]) << 16) |
+                (static_cast<uint32_t>(Target[3]) << 24));
+        default:
+            return 0;
+        }
+    }
+
+    uint32_t GetKey(
+        uint32_t Value)
+    {
+        return Value;
+    }
+
+    uint32_t GetKey(
+        const NSUDO_DEVIL_MODE_HOOK_SITE& Site)
+    {
+        return Site.Offset;
+    }
+
+    template <typename Type>
+    void SiftDown(
+        Type* Elements,
+        size_t Root,
+        size_t Count)
+    {
+        for (;;)
+        {
+            size_t Largest = Root;
+            size_t Left = 2 * Root + 1;
+            size_t Right = Left + 1;
+
+            if (Left < Count &&
+                GetKey(Elements[Left]) > GetKey(Elements[Largest]))
+            {
+                Largest = Left;
+            }
+
+            if (Right < Count &&
+                GetKey(Elements[Right]) > GetKey(Elements[Largest]))
+            {
+                Largest = Right;
+            }
+
+            if (Largest == Root)
+            {
+                return;
+            }
+
+            Type Temporary = Elements[Root];
+            Elements[Root] = Elements[Largest];
+            Elements[Largest] = Temporary;
+            Root = Largest;
+        }
+    }
+
+    /**
+     * Sorts the elements by their offsets with heap sort.
+     */
+    template <typename Type>
+    void Sort(
+        Type* Elements,
+        size_t Count)
+    {
+        for (size_t i = Count / 2; i > 0; --i)
+        {
+            SiftDown(Elements, i - 1, Count);
+        }
+
+        for (size_t i = Count; i > 1; --i)
+        {
+            Type Temporary = Elements[0];
+            Elements[0] = Elements[i - 1];
+            Elements[i - 1] = Temporary;
+            SiftDown(Elements, 0, i - 1);
+        }
+    }
+
+    /**
+     * Finds the first element whose offset is not less than the key in the
+     * sorted elements.
+     */
+    template <typename Type>
+    size_t LowerBound(
+        const Type* Elements,
+        size_t Count,
+        uint64_t Key)
+    {
+        size_t Lower = 0;
+        size_t Upper = Count;
+        while (Lower < Upper)
+        {
+            size_t Middle = Lower + (Upper - Lower) / 2;
+            if (GetKey(Elements[Middle]) < Key)
+            {
+                Lower = Middle + 1;
+            }
+            else
+            {
+                Upper = Middle;
+            }
+        }
+        return Lower;
+    }
+
+    size_t RemoveDuplicateTargets(
+        uint32_t* Targets,
+        size_t Count)
+    {
+        size_t Result = 0;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (!Result || Targets[Result - 1] != Targets[i])
+            {
+                Targets[Result++] = Targets[i];
+            }
+        }
+        return Result;
+    }
+
+    size_t MergeDuplicateSites(
+        PNSUDO_DEVIL_MODE_HOOK_SITE Sites,
+        size_t Count)
+    {
+        size_t Result = 0;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (Result && Sites[Result - 1].Offset == Sites[i].Offset)
+            {
+                Sites[Result - 1].Flags |= Sites[i].Flags;
+            }
+            else
+            {
+                Sites[Result++] = Sites[i];
+            }
+        }
+        return Result;
+    }
+
+    bool AddSite(
+        PNSUDO_DEVIL_MODE_CODE_SCAN Scan,
+        size_t Offset,
+        uint8_t Flags)
+    {
+        if (Scan->SiteCount >= Scan->SiteCapacity)
+        {
+            return false;
+        }
+
+        NSUDO_DEVIL_MODE_HOOK_SITE& Site = Scan->Sites[Scan->SiteCount++];
+        Site = NSUDO_DEVIL_MODE_HOOK_SITE{};
+        Site.Offset = static_cast<uint32_t>(Offset);
+        Site.Flags = Flags;
+        Site.Status = NSudoDevilModeRelocationInvalidInstruction;
+
+        return true;
+    }
+}
+
+bool NSudoDevilModeFindHookSites(
+    PNSUDO_DEVIL_MODE_CODE_SCAN Scan)
+{
+    const uint8_t* Code = Scan->Code;
+    size_t CodeSize = Scan->CodeSize;
+    bool Completed = true;
+
+    Scan->BranchTargetCount = 0;
+    Scan->SiteCount = 0;
+
+    // The start of the window is treated as the end of a previous function.
+    bool AfterEnd = true;
+
+    size_t Offset = 0;
+    while (Offset < CodeSize && Completed)
+    {
+        NSUDO_DEVIL_MODE_INSTRUCTION Instruction;
+        size_t Length = ::NSudoDevilModeDecodeLength(
+            &Code[Offset],
+            CodeSize - Offset,
+            Scan->Is64Bit,
+            &Instruction);
+        if (!Length)
+        {
+            // Data in the code window, resynchronize at the next byte.
+            AfterEnd = false;
+            ++Offset;
+            continue;
+        }
+
+        const uint8_t* Current = &Code[Offset];
+
+        if (IsPadding(Current, Instruction, Scan->Is64Bit))
+        {
+            AfterEnd = AfterEnd || Current[Instruction.OpcodeOffset] == 0xCC;
+            Offset += Length;
+            continue;
+        }
+
+        if (AfterEnd)
+        {
+            Completed = AddSite(
+                Scan,
+                Offset,
+                NSUDO_DEVIL_MODE_HOOK_SITE_AFTER_PADDING);
+            AfterEnd = false;
+        }
+
+        if (Instruction.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE)
+        {
+            int64_t Target = static_cast<int64_t>(Offset + Length) +
+                ReadTarget(Current, Instruction);
+            if (Target >= 0 && static_cast<uint64_t>(Target) < CodeSize)
+            {
+                if (Scan->BranchTargetCount < Scan->BranchTargetCapacity)
+                {
+                    Scan->BranchTargets[Scan->BranchTargetCount++] =
+                        static_cast<uint32_t>(Target);
+                }
+                else
+                {
+                    Completed = false;
+                }
+
+                // call +imm32
+                if (Current[Instruction.OpcodeOffset] == 0xE8 && Completed)
+                {
+                    Completed = AddSite(
+                        Scan,
+                        static_cast<size_t>(Target),
+                        NSUDO_DEVIL_MODE_HOOK_SITE_CALL_TARGET);
+                }
+            }
+        }
+
+        if (IsFunctionEnd(Current, Length))
+        {
+            AfterEnd = true;
+        }
+
+        Offset += Length;
+    }
+
+    Sort(Scan->BranchTargets, Scan->BranchTargetCount);
+    Scan->BranchTargetCount = RemoveDuplicateTargets(
+        Scan->BranchTargets,
+        Scan->BranchTargetCount);
+
+    Sort(Scan->Sites, Scan->SiteCount);
+    Scan->SiteCount = MergeDuplicateSites(Scan->Sites, Scan->SiteCount);
+
+    return Completed;
+}
+
+bool NSudoDevilModeEvaluateHookSite(
+    const NSUDO_DEVIL_MODE_CODE_SCAN* Scan,
+    PNSUDO_DEVIL_MODE_HOOK_SITE Site)
+{
+    Site->Flags &= ~(NSUDO_DEVIL_MODE_HOOK_SITE_BRANCH_INTO_PATCH |
+        NSUDO_DEVIL_MODE_HOOK_SITE_SAFE);
+    Site->PatchSize = 0;
+    Site->InstructionCount = 0;
+    Site->TrampolineSize = 0;
+    Site->Status = NSudoDevilModeRelocationInvalidInstruction;
+
+    if (Site->Offset >= Scan->CodeSize)
+    {
+        return false;
+    }
+
+    size_t WindowSize = Scan->CodeSize - Site->Offset;
+    if (WindowSize > NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_WINDOW)
+    {
+        WindowSize = NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_WINDOW;
+    }
+
+    // The trampoline is not allocated yet, so the relocation is planned in
+    // place to get the sizes.
+    uint64_t Address = Scan->BaseAddress + Site->Offset;
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+    Site->Status = ::NSudoDevilModePlanRelocation(
+        &Scan->Code[Site->Offset],
+        WindowSize,
+        Address,
+        Address,
+        NSUDO_DEVIL_MODE_HOOK_SITE_JUMP_SIZE,
+        Scan->Is64Bit,
+        &Relocation);
+    if (Site->Status != NSudoDevilModeRelocationSuccess)
+    {
+        return false;
+    }
+
+    Site->PatchSize = static_cast<uint8_t>(Relocation.SourceSize);
+    Site->InstructionCount = static_cast<uint8_t>(Relocation.InstructionCount);
+    Site->TrampolineSize = static_cast<uint8_t>(Relocation.DestinationSize);
+
+    // Finds the first branch target after the hook site, the patch is only
+    // safe if it is not in the patched bytes.
+    size_t Lower = LowerBound(
+        Scan->BranchTargets,
+        Scan->BranchTargetCount,
+        static_cast<uint64_t>(Site->Offset) + 1);
+
+    if (Lower < Scan->BranchTargetCount &&
+        Scan->BranchTargets[Lower] < Site->Offset + Site->PatchSize)
+    {
+        Site->Flags |= NSUDO_DEVIL_MODE_HOOK_SITE_BRANCH_INTO_PATCH;
+        return false;
+    }
+
+    Site->Flags |= NSUDO_DEVIL_MODE_HOOK_SITE_SAFE;
+    return true;
+}
+
+size_t NSudoDevilModeEvaluateHookSiteRange(
+    const NSUDO_DEVIL_MODE_CODE_SCAN* Scan,
+    size_t Begin,
+    size_t End)
+{
+    size_t SafeCount = 0;
+
+    for (size_t i = LowerBound(Scan->Sites, Scan->SiteCount, Begin);
+        i < Scan->SiteCount && Scan->Sites[i].Offset < End;
+        ++i)
+    {
+        if (::NSudoDevilModeEvaluateHookSite(Scan, &Scan->Sites[i]))
+        {
+            ++SafeCount;
+        }
+    }
+
+    return SafeCount;
+}
+
+bool NSudoDevilModeScanHookSites(
+    PNSUDO_DEVIL_MODE_CODE_SCAN Scan)
+{
+    bool Completed = ::NSudoDevilModeFindHookSites(Scan);
+
+    ::NSudoDevilModeEvaluateHookSiteRange(Scan, 0, Scan->CodeSize);
+
+    return Completed;
+}
@@ -0,0 +1,198 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeCodeScanner.h
+ * PURPOSE:   Definition for the Hook Site Scanner of the Code Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_CODE_SCANNER_ENGINE
+#define NSUDO_DEVIL_MODE_CODE_SCANNER_ENGINE
+
+#include "NSudoDevilModeRelocation.h"
+
+/**
+ * The size of the jump which patches a hook site, in bytes.
+ */
+#define NSUDO_DEVIL_MODE_HOOK_SITE_JUMP_SIZE 5
+
+/**
+ * The hook site is the target of a direct call in the code window.
+ */
+#define NSUDO_DEVIL_MODE_HOOK_SITE_CALL_TARGET 0x01
+
+/**
+ * The hook site is at the start of the code window, or it follows the end of
+ * a function and the padding after it.
+ */
+#define NSUDO_DEVIL_MODE_HOOK_SITE_AFTER_PADDING 0x02
+
+/**
+ * A branch in the code window targets the middle of the patched bytes, so
+ * the hook site is not safe even if the instructions can be relocated.
+ */
+#define NSUDO_DEVIL_MODE_HOOK_SITE_BRANCH_INTO_PATCH 0x04
+
+/**
+ * The hook site can be patched safely.
+ */
+#define NSUDO_DEVIL_MODE_HOOK_SITE_SAFE 0x08
+
+/**
+ * A candidate function entry which can be hooked.
+ */
+typedef struct _NSUDO_DEVIL_MODE_HOOK_SITE
+{
+    /**
+     * The offset of the hook site in the code window.
+     */
+    uint32_t Offset;
+
+    /**
+     * The combination of the NSUDO_DEVIL_MODE_HOOK_SITE_* flags.
+     */
+    uint8_t Flags;
+
+    /**
+     * The number of the bytes overwritten by the patch, including the
+     * padding which is consumed but not relocated.
+     */
+    uint8_t PatchSize;
+
+    /**
+     * The number of the relocated instructions.
+     */
+    uint8_t InstructionCount;
+
+    /**
+     * The predicted size of the relocated instructions in the trampoline.
+     */
+    uint8_t TrampolineSize;
+
+    /**
+     * The status of the relocation plan of the hook site.
+     */
+    NSUDO_DEVIL_MODE_RELOCATION_STATUS Status;
+
+} NSUDO_DEVIL_MODE_HOOK_SITE, *PNSUDO_DEVIL_MODE_HOOK_SITE;
+
+/**
+ * The state of a scan over a code window. The caller provides the arrays.
+ */
+typedef struct _NSUDO_DEVIL_MODE_CODE_SCAN
+{
+    /**
+     * A pointer to the first byte of the code window.
+     */
+    const uint8_t* Code;
+
+    /**
+     * The size of the code window, in bytes.
+     */
+    size_t CodeSize;
+
+    /**
+     * The address of the code window when it is executed.
+     */
+    uint64_t BaseAddress;
+
+    /**
+     * Scans the window as x64 code if it is true. Otherwise, scans it as x86
+     * code.
+     */
+    bool Is64Bit;
+
+    /**
+     * The sorted offsets of the relative branch targets in the window.
+     */
+    uint32_t* BranchTargets;
+
+    /**
+     * The number of the used elements in the BranchTargets array.
+     */
+    size_t BranchTargetCount;
+
+    /**
+     * The number of the elements in the BranchTargets array.
+     */
+    size_t BranchTargetCapacity;
+
+    /**
+     * The hook sites sorted by their offsets.
+     */
+    PNSUDO_DEVIL_MODE_HOOK_SITE Sites;
+
+    /**
+     * The number of the used elements in the Sites array.
+     */
+    size_t SiteCount;
+
+    /**
+     * The number of the elements in the Sites array.
+     */
+    size_t SiteCapacity;
+
+} NSUDO_DEVIL_MODE_CODE_SCAN, *PNSUDO_DEVIL_MODE_CODE_SCAN;
+
+/**
+ * Decodes a code window in one linear pass, collects the relative branch
+ * targets and the candidate hook sites.
+ *
+ * @param Scan The scan. The Code, CodeSize, BaseAddress, Is64Bit and the
+ *             array members should be set, and the count members are set by
+ *             the function.
+ * @return If the arrays are large enough, it returns true. Otherwise, the
+ *         arrays hold the elements found before they are full.
+ * @remark The function entries are recognized with the same heuristics as
+ *         Detours uses for the function ends and the padding, and the bytes
+ *         which cannot be decoded are skipped one by one. The candidates are
+ *         not evaluated, call NSudoDevilModeEvaluateHookSite for each of
+ *         them.
+ */
+bool NSudoDevilModeFindHookSites(
+    PNSUDO_DEVIL_MODE_CODE_SCAN Scan);
+
+/**
+ * Evaluates a candidate hook site.
+ *
+ * @param Scan The scan which is filled by NSudoDevilModeFindHookSites.
+ * @param Site The hook site to evaluate.
+ * @return If the hook site can be patched safely, it returns true.
+ * @remark The function only reads the scan, so the hook sites can be
+ *         evaluated in parallel. The trampoline address is not known yet,
+ *         so the relocated targets are not checked for their range.
+ */
+bool NSudoDevilModeEvaluateHookSite(
+    const NSUDO_DEVIL_MODE_CODE_SCAN* Scan,
+    PNSUDO_DEVIL_MODE_HOOK_SITE Site);
+
+/**
+ * Evaluates the candidate hook sites which start in a range of a code window.
+ *
+ * @param Scan The scan which is filled by NSudoDevilModeFindHookSites.
+ * @param Begin The offset of the first byte of the range.
+ * @param End The offset after the last byte of the range.
+ * @return The number of the hook sites in the range which can be patched
+ *         safely.
+ * @remark A hook site belongs to the range it starts in, and its patched
+ *         bytes may continue in the next range. The ranges don't share any
+ *         hook site, so a window can be split into the chunks of a parallel
+ *         pass and each chunk is evaluated by a worker.
+ */
+size_t NSudoDevilModeEvaluateHookSiteRange(
+    const NSUDO_DEVIL_MODE_CODE_SCAN* Scan,
+    size_t Begin,
+    size_t End);
+
+/**
+ * Finds and evaluates all hook sites of a code window.
+ *
+ * @param Scan The scan, the same as NSudoDevilModeFindHookSites.
+ * @return If the arrays are large enough, it returns true.
+ */
+bool NSudoDevilModeScanHookSites(
+    PNSUDO_DEVIL_MODE_CODE_SCAN Scan);
+
+#endif // !NSUDO_DEVIL_MODE_CODE_SCANNER_ENGINE
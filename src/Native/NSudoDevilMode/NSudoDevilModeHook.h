@@ -0,0 +1,292 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeHook.h
+ * PURPOSE:   Definition for the Table-Driven Hook Framework
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_HOOK
+#define NSUDO_DEVIL_MODE_HOOK
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+
+/**
+ * The calling convention of the hooked functions, the same as NTAPI.
+ */
+#ifdef _WIN32
+#define NSUDO_DEVIL_MODE_HOOK_API __stdcall
+#else
+#define NSUDO_DEVIL_MODE_HOOK_API
+#endif
+
+namespace NSudoDevilMode
+{
+    /**
+     * A compile-time sequence of the parameter indices.
+     */
+    template <size_t... Indices>
+    struct IndexSequence
+    {
+    };
+
+    template <size_t Count, size_t... Indices>
+    struct MakeIndexSequence
+        : MakeIndexSequence<Count - 1, Count - 1, Indices...>
+    {
+    };
+
+    template <size_t... Indices>
+    struct MakeIndexSequence<0, Indices...>
+    {
+        using Type = IndexSequence<Indices...>;
+    };
+
+    /**
+     * The option parameter index of the hooks which only run the original
+     * function in the privileged context.
+     */
+    constexpr size_t NoOption = ~static_cast<size_t>(0);
+
+    /**
+     * The filter parameter index of the hooks which run every call in the
+     * privileged context.
+     */
+    constexpr size_t NoFilter = ~static_cast<size_t>(0);
+
+    /**
+     * Gets a parameter from a parameter pack.
+     */
+    template <size_t Index, typename First, typename... Rest>
+    auto GetParameter(
+        First Value,
+        Rest... Others)
+    {
+        if constexpr (Index == 0)
+        {
+            return Value;
+        }
+        else
+        {
+            return GetParameter<Index - 1>(Others...);
+        }
+    }
+
+    /**
+     * A hook which runs the original function in the privileged context and
+     * ORs a flag into one of its parameters when the context is entered.
+     *
+     * @tparam Derived The hook type, it should have a static FunctionName
+     *                 member which is the name of the hooked export, a static
+     *                 Index member which identifies the hook in the profile,
+     *                 and a static FilterIndex member which is the index of
+     *                 the parameter checked by the filter, or NoFilter.
+     * @tparam Function The function type of the hooked export.
+     * @tparam Policy The privileged context type. It should be default
+     *                constructible, and have a bool Enter(size_t HookIndex)
+     *                member and a void Leave() member. Leave is only called
+     *                if Enter returns true. If the hook has a filter, it
+     *                should also have a static bool Filter(size_t HookIndex,
+     *                Type Parameter) member, and the calls it rejects run the
+     *                original function directly.
+     * @tparam OptionIndex The index of the option parameter, or NoOption.
+     * @tparam OptionFlag The flag ORed into the option parameter.
+     * @remark The derived type can hide Detoured to customize the hook, and
+     *         call Original to run the original function.
+     */
+    template <
+        typename Derived,
+        typename Function,
+        typename Policy,
+        size_t OptionIndex = NoOption,
+        unsigned long OptionFlag = 0>
+    struct PrivilegedHook;
+
+    template <
+        typename Derived,
+        typename Policy,
+        size_t OptionIndex,
+        unsigned long OptionFlag,
+        typename Return,
+        typename... Arguments>
+    struct PrivilegedHook<
+        Derived,
+        Return NSUDO_DEVIL_MODE_HOOK_API(Arguments...),
+        Policy,
+        OptionIndex,
+        OptionFlag>
+    {
+        static_assert(
+            OptionIndex == NoOption || OptionIndex < sizeof...(Arguments),
+            "The option parameter index is out of range.");
+
+        using FunctionType = Return NSUDO_DEVIL_MODE_HOOK_API(Arguments...);
+
+        /**
+         * The address of the original function. It is resolved before the
+         * hook is attached and it points to the trampoline after that.
+         */
+        static inline void* OriginalAddress = nullptr;
+
+        /**
+         * Calls the original function.
+         */
+        static Return NSUDO_DEVIL_MODE_HOOK_API Original(
+            Arguments... Parameters)
+        {
+            return reinterpret_cast<FunctionType*>(OriginalAddress)(
+                Parameters...);
+        }
+
+        /**
+         * Calls the original function in the privileged context.
+         */
+        static Return NSUDO_DEVIL_MODE_HOOK_API Detoured(
+            Arguments... Parameters)
+        {
+            if constexpr (Derived::FilterIndex != NoFilter)
+            {
+                static_assert(
+                    Derived::FilterIndex < sizeof...(Arguments),
+                    "The filter parameter index is out of range.");
+
+                if (!Policy::Filter(
+                    Derived::Index,
+                    GetParameter<Derived::FilterIndex>(Parameters...)))
+                {
+                    return Original(Parameters...);
+                }
+            }
+
+            Policy Context;
+            if (!Context.Enter(Derived::Index))
+            {
+                return Original(Parameters...);
+            }
+
+            Return Result = Invoke(
+                typename MakeIndexSequence<sizeof...(Arguments)>::Type(),
+                Parameters...);
+
+            Context.Leave();
+
+            return Result;
+        }
+
+    private:
+
+        template <size_t Index, typename Type>
+        static Type ApplyOption(
+            Type Value)
+        {
+            if constexpr (Index == OptionIndex)
+            {
+                return static_cast<Type>(Value | OptionFlag);
+            }
+            else
+            {
+                return Value;
+            }
+        }
+
+        template <size_t... Indices>
+        static Return Invoke(
+            IndexSequence<Indices...>,
+            Arguments... Parameters)
+        {
+            return Original(ApplyOption<Indices>(Parameters)...);
+        }
+    };
+
+    /**
+     * The compile-time table of the hooks.
+     */
+    template <typename... Hooks>
+    struct HookList
+    {
+        /**
+         * The number of the hooks.
+         */
+        static constexpr size_t Count = sizeof...(Hooks);
+
+        /**
+         * Resolves the original functions.
+         *
+         * @param Resolver A callable which is invoked with the name of the
+         *                 hooked export and a pointer to the original address
+         *                 of each hook.
+         */
+        template <typename ResolverType>
+        static void Resolve(
+            ResolverType&& Resolver)
+        {
+            (Resolver(Hooks::FunctionName, &Hooks::OriginalAddress), ...);
+        }
+
+        /**
+         * Enumerates the names of the hooks.
+         *
+         * @param Callback A callable which is invoked with the index and the
+         *                 name of the hooked export of each hook.
+         */
+        template <typename CallbackType>
+        static void ForEachName(
+            CallbackType&& Callback)
+        {
+            (Callback(Hooks::Index, Hooks::FunctionName), ...);
+        }
+
+        /**
+         * Enumerates the hooks.
+         *
+         * @param Callback A callable which is invoked with a pointer to the
+         *                 original address and the detoured function of each
+         *                 hook, for example, to attach or detach the hooks.
+         */
+        template <typename CallbackType>
+        static void ForEach(
+            CallbackType&& Callback)
+        {
+            (Callback(
+                &Hooks::OriginalAddress,
+                reinterpret_cast<void*>(&Hooks::Detoured)), ...);
+        }
+    };
+
+    /**
+     * Builds the HookList of the hooks at the indices of a sequence.
+     */
+    template <template <size_t> class HookAt, typename Sequence>
+    struct IndexedHookList;
+
+    template <template <size_t> class HookAt, size_t... Indices>
+    struct IndexedHookList<HookAt, IndexSequence<Indices...>>
+    {
+        static_assert(
+            ((HookAt<Indices>::Type::Index == Indices) && ...),
+            "Each hook should have the index of its position in the list.");
+
+        using Type = HookList<typename HookAt<Indices>::Type...>;
+    };
+
+    /**
+     * The compile-time table of the hooks with the indices from 0 to Count
+     * - 1, the position of each hook in the table is its index.
+     *
+     * @tparam HookAt A template which maps an index to the hook type by its
+     *                Type member. A missing mapping fails the compilation.
+     * @tparam Count The number of the hooks.
+     */
+    template <template <size_t> class HookAt, size_t Count>
+    using MakeHookList = typename IndexedHookList<
+        HookAt,
+        typename MakeIndexSequence<Count>::Type>::Type;
+}
+
+#endif // !NSUDO_DEVIL_MODE_HOOK
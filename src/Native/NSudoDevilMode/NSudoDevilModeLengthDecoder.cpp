@@ -0,0 +1,792 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeLengthDecoder.cpp
+ * PURPOSE:   Implementation for the x86 and x64 Instruction Length Decoder
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeLengthDecoder.h"
+
+namespace
+{
+    /**
+     * The kind of an opcode. The kinds before PrefixKindStart are described
+     * by the InstructionAttributes tables, the others need to look at more
+     * bytes or the decoder state.
+     */
+    enum InstructionKind : uint8_t
+    {
+        Bytes1,
+        Bytes1Address,
+        Bytes1Dynamic,
+        Bytes2,
+        Bytes2CantJump,
+        Bytes2Dynamic,
+        Bytes3,
+        Bytes3Dynamic,
+        Bytes3Or5,
+        Bytes3Or5Dynamic,
+        Bytes3Or5Rax,
+        Bytes3Or5Target,
+        Bytes4,
+        Bytes5Or7Dynamic,
+        Bytes2Mod,
+        Bytes2ModDynamic,
+        Bytes2Mod1,
+        Bytes2ModOperand,
+        Bytes3Mod,
+        Bytes3Mod1,
+        BytesXop,
+        BytesXop1,
+        BytesXop4,
+
+        FixedKindCount,
+
+        // Prefixes.
+        Prefix = FixedKindCount,
+        Segment,
+        Rex,
+        OperandSize,
+        AddressSize,
+        RepNe,
+        Rep,
+
+        // Opcodes which need more bytes or the decoder state.
+        Escape0F,
+        Escape0F00,
+        Escape0F78,
+        Escape0FB8,
+        GroupF6,
+        GroupF7,
+        GroupFF,
+        Vex2,
+        Vex3,
+        Evex,
+        Xop,
+        Bytes2Jump,
+        Invalid,
+
+        // Opcodes which are only valid for x86.
+        Legacy1,
+        Legacy1Dynamic,
+        Legacy2,
+        Legacy2Mod,
+        Legacy2Mod1,
+        Legacy5Or7Dynamic,
+    };
+
+    /**
+     * The attribute flags of an opcode kind.
+     */
+    enum AttributeFlags : uint8_t
+    {
+        // The target cannot be determined statically.
+        DynamicFlag = 0x1,
+        // The immediate is an address, its size follows the address size.
+        AddressFlag = 0x2,
+        // The relative target cannot be enlarged.
+        NoEnlargeFlag = 0x4,
+        // The immediate is extended to 64 bits by REX.W.
+        RaxFlag = 0x8,
+    };
+
+    /**
+     * The attributes of an opcode kind.
+     */
+    struct InstructionAttributes
+    {
+        // The size from the opcode byte without the ModR/M extra bytes.
+        uint8_t FixedSize;
+        // The size when the operand or the address size is overridden.
+        uint8_t FixedSize16;
+        // The offset of the ModR/M byte from the opcode byte, or 0 if none.
+        uint8_t ModRmOffset;
+        // The offset of the relative target from the opcode byte, or 0.
+        uint8_t RelativeOffset;
+        uint8_t Flags;
+    };
+
+    /**
+     * The attributes of the opcode kinds for x86.
+     */
+    constexpr InstructionAttributes X86Attributes[FixedKindCount] =
+    {
+        { 1, 1, 0, 0, 0 },                                  // Bytes1
+        { 5, 3, 0, 0, AddressFlag },                        // Bytes1Address
+        { 1, 1, 0, 0, DynamicFlag },                        // Bytes1Dynamic
+        { 2, 2, 0, 0, 0 },                                  // Bytes2
+        { 2, 2, 0, 1, NoEnlargeFlag },                      // Bytes2CantJump
+        { 2, 2, 0, 0, DynamicFlag },                        // Bytes2Dynamic
+        { 3, 3, 0, 0, 0 },                                  // Bytes3
+        { 3, 3, 0, 0, DynamicFlag },                        // Bytes3Dynamic
+        { 5, 3, 0, 0, 0 },                                  // Bytes3Or5
+        { 5, 3, 0, 0, DynamicFlag },                        // Bytes3Or5Dynamic
+        { 5, 3, 0, 0, 0 },                                  // Bytes3Or5Rax
+        { 5, 3, 0, 1, 0 },                                  // Bytes3Or5Target
+        { 4, 4, 0, 0, 0 },                                  // Bytes4
+        { 7, 5, 0, 0, DynamicFlag },                        // Bytes5Or7Dynamic
+        { 2, 2, 1, 0, 0 },                                  // Bytes2Mod
+        { 2, 2, 1, 0, DynamicFlag },                        // Bytes2ModDynamic
+        { 3, 3, 1, 0, 0 },                                  // Bytes2Mod1
+        { 6, 4, 1, 0, 0 },                                  // Bytes2ModOperand
+        { 3, 3, 2, 0, 0 },                                  // Bytes3Mod
+        { 4, 4, 2, 0, 0 },                                  // Bytes3Mod1
+        { 5, 5, 4, 0, 0 },                                  // BytesXop
+        { 6, 6, 4, 0, 0 },                                  // BytesXop1
+        { 9, 9, 4, 0, 0 },                                  // BytesXop4
+    };
+
+    /**
+     * The attributes of the opcode kinds for x64.
+     */
+    constexpr InstructionAttributes X64Attributes[FixedKindCount] =
+    {
+        { 1, 1, 0, 0, 0 },                                  // Bytes1
+        { 9, 5, 0, 0, AddressFlag },                        // Bytes1Address
+        { 1, 1, 0, 0, DynamicFlag },                        // Bytes1Dynamic
+        { 2, 2, 0, 0, 0 },                                  // Bytes2
+        { 2, 2, 0, 1, NoEnlargeFlag },                      // Bytes2CantJump
+        { 2, 2, 0, 0, DynamicFlag },                        // Bytes2Dynamic
+        { 3, 3, 0, 0, 0 },                                  // Bytes3
+        { 3, 3, 0, 0, DynamicFlag },                        // Bytes3Dynamic
+        { 5, 3, 0, 0, 0 },                                  // Bytes3Or5
+        { 5, 3, 0, 0, DynamicFlag },                        // Bytes3Or5Dynamic
+        { 5, 3, 0, 0, RaxFlag },                            // Bytes3Or5Rax
+        { 5, 5, 0, 1, 0 },                                  // Bytes3Or5Target
+        { 4, 4, 0, 0, 0 },                                  // Bytes4
+        { 7, 5, 0, 0, DynamicFlag },                        // Bytes5Or7Dynamic
+        { 2, 2, 1, 0, 0 },                                  // Bytes2Mod
+        { 2, 2, 1, 0, DynamicFlag },                        // Bytes2ModDynamic
+        { 3, 3, 1, 0, 0 },                                  // Bytes2Mod1
+        { 6, 4, 1, 0, 0 },                                  // Bytes2ModOperand
+        { 3, 3, 2, 0, 0 },                                  // Bytes3Mod
+        { 4, 4, 2, 0, 0 },                                  // Bytes3Mod1
+        { 5, 5, 4, 0, 0 },                                  // BytesXop
+        { 6, 6, 4, 0, 0 },                                  // BytesXop1
+        { 9, 9, 4, 0, 0 },                                  // BytesXop4
+    };
+
+    /**
+     * The kinds used by the x86-only opcodes when they are decoded for x86.
+     */
+    constexpr uint8_t LegacyKinds[] =
+    {
+        Bytes1,                                             // Legacy1
+        Bytes1Dynamic,                                      // Legacy1Dynamic
+        Bytes2,                                             // Legacy2
+        Bytes2Mod,                                          // Legacy2Mod
+        Bytes2Mod1,                                         // Legacy2Mod1
+        Bytes5Or7Dynamic,                                   // Legacy5Or7Dynamic
+    };
+
+    /**
+     * The kinds of the one-byte opcodes.
+     */
+    constexpr uint8_t OneByteKinds[256] =
+    {
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 00
+        Bytes2, Bytes3Or5, Legacy1, Legacy1,        // 04
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 08
+        Bytes2, Bytes3Or5, Legacy1, Escape0F,       // 0C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 10
+        Bytes2, Bytes3Or5, Legacy1, Legacy1,        // 14
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 18
+        Bytes2, Bytes3Or5, Legacy1, Legacy1,        // 1C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 20
+        Bytes2, Bytes3Or5, Segment, Legacy1,        // 24
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 28
+        Bytes2, Bytes3Or5, Segment, Legacy1,        // 2C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 30
+        Bytes2, Bytes3Or5, Segment, Legacy1,        // 34
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 38
+        Bytes2, Bytes3Or5, Segment, Legacy1,        // 3C
+        Rex, Rex, Rex, Rex,                         // 40
+        Rex, Rex, Rex, Rex,                         // 44
+        Rex, Rex, Rex, Rex,                         // 48
+        Rex, Rex, Rex, Rex,                         // 4C
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 50
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 54
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 58
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 5C
+        Legacy1, Legacy1, Evex, Bytes2Mod,          // 60
+        Segment, Segment, OperandSize, AddressSize, // 64
+        Bytes3Or5, Bytes2ModOperand, Bytes2, Bytes2Mod1, // 68
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 6C
+        Bytes2Jump, Bytes2Jump, Bytes2Jump, Bytes2Jump, // 70
+        Bytes2Jump, Bytes2Jump, Bytes2Jump, Bytes2Jump, // 74
+        Bytes2Jump, Bytes2Jump, Bytes2Jump, Bytes2Jump, // 78
+        Bytes2Jump, Bytes2Jump, Bytes2Jump, Bytes2Jump, // 7C
+        Bytes2Mod1, Bytes2ModOperand, Legacy2Mod1, Bytes2Mod1, // 80
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 84
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 88
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Xop,       // 8C
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 90
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 94
+        Bytes1, Bytes1, Legacy5Or7Dynamic, Bytes1,  // 98
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 9C
+        Bytes1Address, Bytes1Address, Bytes1Address, Bytes1Address, // A0
+        Bytes1, Bytes1, Bytes1, Bytes1,             // A4
+        Bytes2, Bytes3Or5, Bytes1, Bytes1,          // A8
+        Bytes1, Bytes1, Bytes1, Bytes1,             // AC
+        Bytes2, Bytes2, Bytes2, Bytes2,             // B0
+        Bytes2, Bytes2, Bytes2, Bytes2,             // B4
+        Bytes3Or5Rax, Bytes3Or5Rax, Bytes3Or5Rax, Bytes3Or5Rax, // B8
+        Bytes3Or5Rax, Bytes3Or5Rax, Bytes3Or5Rax, Bytes3Or5Rax, // BC
+        Bytes2Mod1, Bytes2Mod1, Bytes3, Bytes1,     // C0
+        Vex3, Vex2, Bytes2Mod1, Bytes2ModOperand,   // C4
+        Bytes4, Bytes1, Bytes3Dynamic, Bytes1Dynamic, // C8
+        Bytes1Dynamic, Bytes2Dynamic, Legacy1Dynamic, Bytes1Dynamic, // CC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // D0
+        Legacy2, Legacy2, Invalid, Bytes1,          // D4
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // D8
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // DC
+        Bytes2CantJump, Bytes2CantJump, Bytes2CantJump, Bytes2CantJump, // E0
+        Bytes2, Bytes2, Bytes2, Bytes2,             // E4
+        Bytes3Or5Target, Bytes3Or5Target, Legacy5Or7Dynamic, Bytes2Jump, // E8
+        Bytes1, Bytes1, Bytes1, Bytes1,             // EC
+        Prefix, Bytes1Dynamic, RepNe, Rep,          // F0
+        Bytes1, Bytes1, GroupF6, GroupF7,           // F4
+        Bytes1, Bytes1, Bytes1, Bytes1,             // F8
+        Bytes1, Bytes1, Bytes2Mod, GroupFF,         // FC
+    };
+
+    /**
+     * The kinds of the two-byte opcodes (0F xx).
+     */
+    constexpr uint8_t TwoByteKinds[256] =
+    {
+        Escape0F00, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 00
+        Invalid, Bytes1, Bytes1, Bytes1,            // 04
+        Bytes1, Bytes1, Invalid, Bytes1,            // 08
+        Invalid, Bytes2Mod, Bytes1, Bytes2Mod1,     // 0C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 10
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 14
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 18
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 1C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 20
+        Legacy2Mod, Invalid, Legacy2Mod, Invalid,   // 24
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 28
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 2C
+        Bytes1, Bytes1, Bytes1, Bytes1,             // 30
+        Bytes1, Bytes1, Invalid, Bytes1,            // 34
+        Bytes3Mod, Invalid, Bytes3Mod1, Invalid,    // 38
+        Invalid, Invalid, Invalid, Invalid,         // 3C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 40
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 44
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 48
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 4C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 50
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 54
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 58
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 5C
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 60
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 64
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 68
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 6C
+        Bytes2Mod1, Bytes2Mod1, Bytes2Mod1, Bytes2Mod1, // 70
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes1,    // 74
+        Escape0F78, Bytes2Mod, Invalid, Invalid,    // 78
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 7C
+        Bytes3Or5Target, Bytes3Or5Target,           // 80
+        Bytes3Or5Target, Bytes3Or5Target,           // 82
+        Bytes3Or5Target, Bytes3Or5Target,           // 84
+        Bytes3Or5Target, Bytes3Or5Target,           // 86
+        Bytes3Or5Target, Bytes3Or5Target,           // 88
+        Bytes3Or5Target, Bytes3Or5Target,           // 8A
+        Bytes3Or5Target, Bytes3Or5Target,           // 8C
+        Bytes3Or5Target, Bytes3Or5Target,           // 8E
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 90
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 94
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 98
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // 9C
+        Bytes1, Bytes1, Bytes1, Bytes2Mod,          // A0
+        Bytes2Mod1, Bytes2Mod, Bytes2Mod, Bytes2Mod, // A4
+        Bytes1, Bytes1, Bytes1, Bytes2Mod,          // A8
+        Bytes2Mod1, Bytes2Mod, Bytes2Mod, Bytes2Mod, // AC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // B0
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // B4
+        Escape0FB8, Invalid, Bytes2Mod1, Bytes2Mod, // B8
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // BC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod1, Bytes2Mod, // C0
+        Bytes2Mod1, Bytes2Mod1, Bytes2Mod1, Bytes2Mod, // C4
+        Bytes1, Bytes1, Bytes1, Bytes1,             // C8
+        Bytes1, Bytes1, Bytes1, Bytes1,             // CC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // D0
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // D4
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // D8
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // DC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // E0
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // E4
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // E8
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // EC
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // F0
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // F4
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Bytes2Mod, // F8
+        Bytes2Mod, Bytes2Mod, Bytes2Mod, Invalid,   // FC
+    };
+
+    /**
+     * The ModR/M byte needs a SIB byte.
+     */
+    constexpr uint8_t ModRmSib = 0x10;
+
+    /**
+     * The ModR/M byte is a RIP-relative operand on x64, or an absolute
+     * address on x86.
+     */
+    constexpr uint8_t ModRmRip = 0x20;
+
+    /**
+     * The mask of the number of the bytes after the ModR/M byte.
+     */
+    constexpr uint8_t ModRmSizeMask = 0x0F;
+
+    /**
+     * The attributes of the ModR/M bytes.
+     */
+    constexpr uint8_t ModRmAttributes[256] =
+    {
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 00
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 08
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 10
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 18
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 20
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 28
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 30
+        0, 0, 0, 0, ModRmSib | 1, ModRmRip | 4, 0, 0,       // 38
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 40
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 48
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 50
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 58
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 60
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 68
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 70
+        1, 1, 1, 1, 2, 1, 1, 1,                             // 78
+        4, 4, 4, 4, 5, 4, 4, 4,                             // 80
+        4, 4, 4, 4, 5, 4, 4, 4,                             // 88
+        4, 4, 4, 4, 5, 4, 4, 4,                             // 90
+        4, 4, 4, 4, 5, 4, 4, 4,                             // 98
+        4, 4, 4, 4, 5, 4, 4, 4,                             // A0
+        4, 4, 4, 4, 5, 4, 4, 4,                             // A8
+        4, 4, 4, 4, 5, 4, 4, 4,                             // B0
+        4, 4, 4, 4, 5, 4, 4, 4,                             // B8
+        0, 0, 0, 0, 0, 0, 0, 0,                             // C0
+        0, 0, 0, 0, 0, 0, 0, 0,                             // C8
+        0, 0, 0, 0, 0, 0, 0, 0,                             // D0
+        0, 0, 0, 0, 0, 0, 0, 0,                             // D8
+        0, 0, 0, 0, 0, 0, 0, 0,                             // E0
+        0, 0, 0, 0, 0, 0, 0, 0,                             // E8
+        0, 0, 0, 0, 0, 0, 0, 0,                             // F0
+        0, 0, 0, 0, 0, 0, 0, 0,                             // F8
+    };
+
+    /**
+     * The prefixes seen by the decoder.
+     */
+    struct DecoderState
+    {
+        bool OperandSizeOverride;
+        bool AddressSizeOverride;
+        bool RexW;
+        bool RepNe;
+        bool Rep;
+        uint8_t Segment;
+    };
+}
+
+size_t NSudoDevilModeDecodeLength(
+    const uint8_t* Code,
+    size_t CodeSize,
+    bool Is64Bit,
+    PNSUDO_DEVIL_MODE_INSTRUCTION Instruction)
+{
+    if (!Code)
+    {
+        return 0;
+    }
+
+    if (CodeSize > NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH)
+    {
+        CodeSize = NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH;
+    }
+
+    DecoderState State = {};
+    NSUDO_DEVIL_MODE_INSTRUCTION Result = {};
+
+    const uint8_t* Kinds = OneByteKinds;
+    size_t Offset = 0;
+    uint8_t Kind = Invalid;
+    bool IsGroupFF = false;
+
+    // Consume the prefixes and the escape bytes iteratively until the kind
+    // of the opcode is described by the attribute tables.
+    for (;;)
+    {
+        if (Offset >= CodeSize)
+        {
+            return 0;
+        }
+
+        const uint8_t Byte = Code[Offset];
+
+        Kind = Kinds[Byte];
+        if (Kind >= Legacy1)
+        {
+            Kind = Is64Bit
+                ? static_cast<uint8_t>(Invalid)
+                : LegacyKinds[Kind - Legacy1];
+        }
+
+        if (Kind < FixedKindCount)
+        {
+            break;
+        }
+
+        // The byte after the opcode byte, it is the ModR/M byte or the
+        // payload of the VEX, EVEX and XOP prefixes.
+        const uint8_t Next = (Offset + 1 < CodeSize) ? Code[Offset + 1] : 0;
+        const bool HasNext = (Offset + 1 < CodeSize);
+
+        uint8_t Map = 0;
+        uint8_t ImpliedPrefix = 0;
+
+        switch (Kind)
+        {
+        case Prefix:
+            ++Offset;
+            continue;
+        case Segment:
+            State.Segment = Byte;
+            ++Offset;
+            continue;
+        case Rex:
+            if (!Is64Bit)
+            {
+                Kind = Bytes1;
+                break;
+            }
+            State.RexW = State.RexW || (Byte & 0x08);
+            ++Offset;
+            continue;
+        case OperandSize:
+            State.OperandSizeOverride = true;
+            ++Offset;
+            continue;
+        case AddressSize:
+            State.AddressSizeOverride = true;
+            ++Offset;
+            continue;
+        case RepNe:
+            State.RepNe = true;
+            ++Offset;
+            continue;
+        case Rep:
+            State.Rep = true;
+            ++Offset;
+            continue;
+        case Escape0F:
+            Kinds = TwoByteKinds;
+            ++Offset;
+            continue;
+        case Escape0F00:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            // JMPE (0F 00 /6) is an x86 only dynamic branch.
+            Kind = (!Is64Bit && (Next & 0x38) == 0x30)
+                ? Bytes2ModDynamic
+                : Bytes2Mod;
+            break;
+        case Escape0F78:
+            // EXTRQ and INSERTQ have two immediate bytes, VMREAD has none.
+            Kind = (State.RepNe || State.OperandSizeOverride)
+                ? Bytes4
+                : Bytes2Mod;
+            break;
+        case Escape0FB8:
+            // JMPE (0F B8) is an x86 only dynamic branch.
+            Kind = (Is64Bit || State.Rep) ? Bytes2Mod : Bytes3Or5Dynamic;
+            break;
+        case GroupF6:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            // TEST (F6 /0) has an immediate byte.
+            Kind = ((Next & 0x38) == 0x00) ? Bytes2Mod1 : Bytes2Mod;
+            break;
+        case GroupF7:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            // TEST (F7 /0) has an immediate word or double word.
+            Kind = ((Next & 0x38) == 0x00) ? Bytes2ModOperand : Bytes2Mod;
+            break;
+        case GroupFF:
+            IsGroupFF = true;
+            Kind = Bytes2Mod;
+            break;
+        case Vex3:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            if (!Is64Bit && (Next & 0xC0) != 0xC0)
+            {
+                // LES on x86.
+                Kind = Bytes2Mod;
+                break;
+            }
+            if (Offset + 2 >= CodeSize)
+            {
+                return 0;
+            }
+            if (Is64Bit && (Code[Offset + 2] & 0x80))
+            {
+                State.RexW = true;
+            }
+            Map = Next & 0x1F;
+            ImpliedPrefix = Code[Offset + 2] & 0x03;
+            Offset += 3;
+            break;
+        case Vex2:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            if (!Is64Bit && (Next & 0xC0) != 0xC0)
+            {
+                // LDS on x86.
+                Kind = Bytes2Mod;
+                break;
+            }
+            Map = 1;
+            ImpliedPrefix = Next & 0x03;
+            Offset += 2;
+            break;
+        case Evex:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            if (!Is64Bit && (Next & 0xC0) != 0xC0)
+            {
+                // BOUND on x86.
+                Kind = Bytes2Mod;
+                break;
+            }
+            if ((Next & 0x0C) != 0 ||
+                Offset + 3 >= CodeSize ||
+                (Code[Offset + 2] & 0x04) != 0x04)
+            {
+                return 0;
+            }
+            if (Is64Bit && (Code[Offset + 2] & 0x80))
+            {
+                State.RexW = true;
+            }
+            Map = Next & 0x03;
+            ImpliedPrefix = Code[Offset + 2] & 0x03;
+            Offset += 4;
+            break;
+        case Xop:
+            if (!HasNext)
+            {
+                return 0;
+            }
+            switch (Next & 0x1F)
+            {
+            case 8:
+                Kind = BytesXop1;
+                break;
+            case 9:
+                Kind = BytesXop;
+                break;
+            case 10:
+                Kind = BytesXop4;
+                break;
+            default:
+                // POP (8F /0).
+                Kind = Bytes2Mod;
+                break;
+            }
+            break;
+        case Bytes2Jump:
+            Result.Flags =
+                NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE |
+                NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP;
+            Result.OpcodeOffset = static_cast<uint8_t>(Offset);
+            Result.TargetOffset = static_cast<uint8_t>(Offset + 1);
+            Result.TargetSize = 1;
+            Offset += 2;
+            if (Offset > CodeSize)
+            {
+                return 0;
+            }
+            Result.Length = static_cast<uint8_t>(Offset);
+            if (Instruction)
+            {
+                *Instruction = Result;
+            }
+            return Offset;
+        default:
+            return 0;
+        }
+
+        if (Kind == Vex3 || Kind == Vex2 || Kind == Evex)
+        {
+            // The VEX and EVEX prefixes imply the legacy prefixes and the
+            // escape bytes.
+            switch (ImpliedPrefix)
+            {
+            case 1:
+                State.OperandSizeOverride = true;
+                break;
+            case 2:
+                State.Rep = true;
+                break;
+            case 3:
+                State.RepNe = true;
+                break;
+            default:
+                break;
+            }
+
+            if (Map == 1)
+            {
+                Kinds = TwoByteKinds;
+                continue;
+            }
+            else if (Map == 2)
+            {
+                Kind = Bytes2Mod;
+            }
+            else if (Map == 3)
+            {
+                Kind = Bytes2Mod1;
+            }
+            else
+            {
+                return 0;
+            }
+        }
+
+        break;
+    }
+
+    const InstructionAttributes& Attributes =
+        Is64Bit ? X64Attributes[Kind] : X86Attributes[Kind];
+
+    size_t Size = 0;
+    if (Attributes.Flags & AddressFlag)
+    {
+        Size = State.AddressSizeOverride
+            ? Attributes.FixedSize16
+            : Attributes.FixedSize;
+    }
+    else if (Is64Bit && State.RexW)
+    {
+        // REX.W takes precedence over the operand size override prefix.
+        Size = Attributes.FixedSize + ((Attributes.Flags & RaxFlag) ? 4 : 0);
+    }
+    else
+    {
+        Size = State.OperandSizeOverride
+            ? Attributes.FixedSize16
+            : Attributes.FixedSize;
+    }
+
+    if (Attributes.RelativeOffset)
+    {
+        Result.Flags |= NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE;
+        Result.TargetOffset =
+            static_cast<uint8_t>(Offset + Attributes.RelativeOffset);
+        Result.TargetSize =
+            static_cast<uint8_t>(Size - Attributes.RelativeOffset);
+    }
+
+    if (Attributes.ModRmOffset)
+    {
+        const size_t ModRmOffset = Offset + Attributes.ModRmOffset;
+        if (ModRmOffset >= CodeSize)
+        {
+            return 0;
+        }
+
+        const uint8_t ModRm = Code[ModRmOffset];
+        const uint8_t ModRmAttribute = ModRmAttributes[ModRm];
+
+        Size += ModRmAttribute & ModRmSizeMask;
+
+        if (ModRmAttribute & ModRmSib)
+        {
+            if (ModRmOffset + 1 >= CodeSize)
+            {
+                return 0;
+            }
+
+            // The SIB byte without a base register has a 32-bit displacement.
+            if ((Code[ModRmOffset + 1] & 0x07) == 0x05)
+            {
+                Size += 4;
+            }
+        }
+        else if (Is64Bit && (ModRmAttribute & ModRmRip))
+        {
+            Result.Flags |= NSUDO_DEVIL_MODE_INSTRUCTION_RIP_RELATIVE;
+            Result.TargetOffset = static_cast<uint8_t>(ModRmOffset + 1);
+            Result.TargetSize = 4;
+        }
+
+        if (IsGroupFF)
+        {
+            if (ModRm == 0x15 || ModRm == 0x25)
+            {
+                // CALL and JMP through the memory. All segments but FS and
+                // GS are equivalent on x64.
+                bool DefaultSegment = Is64Bit
+                    ? (State.Segment != 0x64 && State.Segment != 0x65)
+                    : (State.Segment == 0x00 || State.Segment == 0x2E);
+                Result.Flags |= DefaultSegment
+                    ? NSUDO_DEVIL_MODE_INSTRUCTION_INDIRECT
+                    : NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC;
+            }
+            else if ((ModRm & 0x30) == 0x10 || (ModRm & 0x30) == 0x20)
+            {
+                // CALL (FF /2, FF /3) and JMP (FF /4, FF /5).
+                Result.Flags |= NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC;
+            }
+        }
+    }
+
+    if (Attributes.Flags & NoEnlargeFlag)
+    {
+        Result.Flags |= NSUDO_DEVIL_MODE_INSTRUCTION_NO_ENLARGE;
+    }
+
+    if (Attributes.Flags & DynamicFlag)
+    {
+        Result.Flags |= NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC;
+    }
+
+    Offset += Size;
+    if (Offset > CodeSize)
+    {
+        return 0;
+    }
+
+    Result.Length = static_cast<uint8_t>(Offset);
+    Result.OpcodeOffset = static_cast<uint8_t>(Offset - Size);
+
+    if (Instruction)
+    {
+        *Instruction = Result;
+    }
+
+    return Offset;
+}
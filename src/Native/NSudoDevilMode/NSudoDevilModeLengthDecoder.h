@@ -0,0 +1,122 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeLengthDecoder.h
+ * PURPOSE:   Definition for the x86 and x64 Instruction Length Decoder
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_LENGTH_DECODER
+#define NSUDO_DEVIL_MODE_LENGTH_DECODER
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The maximum length of an x86 or x64 instruction, in bytes.
+ */
+#define NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH 15
+
+/**
+ * The target of the instruction cannot be determined statically, for
+ * example, the return instructions and the indirect branches.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC 0x01
+
+/**
+ * The instruction has a relative branch target which is described by the
+ * TargetOffset and TargetSize members.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE 0x02
+
+/**
+ * The instruction is a short jump (EB or 70-7F) which can be enlarged to a
+ * near jump when it is relocated.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP 0x04
+
+/**
+ * The relative branch target of the instruction cannot be enlarged when it is
+ * out of range after the relocation, for example, LOOP and JCXZ.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_NO_ENLARGE 0x08
+
+/**
+ * The instruction has a RIP-relative memory operand whose 32-bit displacement
+ * is described by the TargetOffset and TargetSize members. It is only set for
+ * the x64 instructions.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_RIP_RELATIVE 0x10
+
+/**
+ * The instruction is an indirect CALL or JMP through a memory operand without
+ * the register (FF 15 or FF 25), the target is stored in the memory.
+ */
+#define NSUDO_DEVIL_MODE_INSTRUCTION_INDIRECT 0x20
+
+/**
+ * The decoded information of an x86 or x64 instruction.
+ */
+typedef struct _NSUDO_DEVIL_MODE_INSTRUCTION
+{
+    /**
+     * The length of the instruction, in bytes.
+     */
+    uint8_t Length;
+
+    /**
+     * The combination of the NSUDO_DEVIL_MODE_INSTRUCTION_* flags.
+     */
+    uint8_t Flags;
+
+    /**
+     * The offset of the primary opcode byte, the prefixes and the escape
+     * bytes are before it.
+     */
+    uint8_t OpcodeOffset;
+
+    /**
+     * The offset of the relative branch target or the RIP-relative
+     * displacement, or 0 if the instruction has none of them.
+     */
+    uint8_t TargetOffset;
+
+    /**
+     * The size of the relative branch target or the RIP-relative
+     * displacement, in bytes.
+     */
+    uint8_t TargetSize;
+
+} NSUDO_DEVIL_MODE_INSTRUCTION, *PNSUDO_DEVIL_MODE_INSTRUCTION;
+
+/**
+ * Decodes the length of an x86 or x64 instruction without copying it.
+ *
+ * @param Code A pointer to the first byte of the instruction.
+ * @param CodeSize The number of the readable bytes from the Code parameter.
+ * @param Is64Bit Decodes the instruction as an x64 instruction if this
+ *                parameter is true. Otherwise, decodes it as an x86
+ *                instruction.
+ * @param Instruction A pointer to a NSUDO_DEVIL_MODE_INSTRUCTION structure
+ *                    that receives the decoded information. This parameter
+ *                    can be nullptr.
+ * @return The length of the instruction, in bytes. If the instruction is
+ *         invalid, or it is longer than CodeSize or the architectural
+ *         limit, the return value is 0.
+ * @remark The decoder is platform neutral and only reads the Code buffer. It
+ *         follows the instruction coverage of the Detours disassembler, so
+ *         the lengths match DetourCopyInstruction for the valid instructions.
+ */
+size_t NSudoDevilModeDecodeLength(
+    const uint8_t* Code,
+    size_t CodeSize,
+    bool Is64Bit,
+    PNSUDO_DEVIL_MODE_INSTRUCTION Instruction);
+
+#endif // !NSUDO_DEVIL_MODE_LENGTH_DECODER
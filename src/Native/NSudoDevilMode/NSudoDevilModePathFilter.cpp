@@ -0,0 +1,223 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModePathFilter.cpp
+ * PURPOSE:   Implementation for the Path Prefix Filter
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModePathFilter.h"
+
+namespace
+{
+    const uint16_t PathSeparator = L'\\';
+    const uint16_t ListSeparator = L';';
+
+    uint16_t FoldCharacter(
+        uint16_t Character)
+    {
+        if (Character >= L'a' && Character <= L'z')
+        {
+            return static_cast<uint16_t>(Character - (L'a' - L'A'));
+        }
+
+        return Character;
+    }
+
+    /**
+     * The path of a root directory and a relative name, joined by a virtual
+     * backslash.
+     */
+    struct JoinedPath
+    {
+        const uint16_t* Root;
+        size_t RootLength;
+        size_t SeparatorLength;
+        const uint16_t* Name;
+        size_t NameLength;
+
+        size_t Length() const
+        {
+            return RootLength + SeparatorLength + NameLength;
+        }
+
+        uint16_t At(
+            size_t Index) const
+        {
+            if (Index < RootLength)
+            {
+                return Root[Index];
+            }
+
+            Index -= RootLength;
+            if (Index < SeparatorLength)
+            {
+                return PathSeparator;
+            }
+
+            return Name[Index - SeparatorLength];
+        }
+    };
+}
+
+bool NSudoDevilModeInitializePathFilter(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    PNSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes,
+    uint32_t NodeCapacity)
+{
+    Filter->Nodes = Nodes;
+    Filter->NodeCount = 0;
+    Filter->NodeCapacity = NodeCapacity;
+
+    if (!Nodes || !NodeCapacity)
+    {
+        return false;
+    }
+
+    Nodes[0] = NSUDO_DEVIL_MODE_PATH_FILTER_NODE{};
+    Filter->NodeCount = 1;
+
+    return true;
+}
+
+bool NSudoDevilModeAddPathFilterPrefix(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    const uint16_t* Prefix,
+    size_t Length)
+{
+    if (!Filter->NodeCount)
+    {
+        return false;
+    }
+
+    while (Length && Prefix[Length - 1] == PathSeparator)
+    {
+        --Length;
+    }
+
+    PNSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes = Filter->Nodes;
+    uint32_t Current = 0;
+
+    for (size_t i = 0; i < Length; ++i)
+    {
+        uint16_t Character = FoldCharacter(Prefix[i]);
+
+        // Finds the child, or the link which the new child is inserted at to
+        // keep the children sorted.
+        uint32_t* Link = &Nodes[Current].FirstChild;
+        while (*Link && Nodes[*Link].Character < Character)
+        {
+            Link = &Nodes[*Link].NextSibling;
+        }
+
+        if (!*Link || Nodes[*Link].Character != Character)
+        {
+            if (Filter->NodeCount >= Filter->NodeCapacity)
+            {
+                return false;
+            }
+
+            uint32_t Child = Filter->NodeCount++;
+            Nodes[Child].FirstChild = 0;
+            Nodes[Child].NextSibling = *Link;
+            Nodes[Child].Character = Character;
+            Nodes[Child].Terminal = 0;
+            *Link = Child;
+        }
+
+        Current = *Link;
+    }
+
+    Nodes[Current].Terminal = 1;
+
+    return true;
+}
+
+bool NSudoDevilModeAddPathFilterPrefixes(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    const uint16_t* List,
+    size_t Length)
+{
+    size_t Start = 0;
+    for (size_t i = 0; i <= Length; ++i)
+    {
+        if (i != Length && List[i] != ListSeparator)
+        {
+            continue;
+        }
+
+        if (i != Start && !::NSudoDevilModeAddPathFilterPrefix(
+            Filter,
+            &List[Start],
+            i - Start))
+        {
+            return false;
+        }
+
+        Start = i + 1;
+    }
+
+    return true;
+}
+
+bool NSudoDevilModeMatchPathFilter(
+    const NSUDO_DEVIL_MODE_PATH_FILTER* Filter,
+    const uint16_t* Root,
+    size_t RootLength,
+    const uint16_t* Name,
+    size_t NameLength)
+{
+    if (!Filter->NodeCount)
+    {
+        return false;
+    }
+
+    const NSUDO_DEVIL_MODE_PATH_FILTER_NODE* Nodes = Filter->Nodes;
+    if (Nodes[0].Terminal)
+    {
+        return true;
+    }
+
+    JoinedPath Path;
+    Path.Root = Root;
+    Path.RootLength = Root ? RootLength : 0;
+    Path.SeparatorLength =
+        (Path.RootLength &&
+            NameLength &&
+            Root[Path.RootLength - 1] != PathSeparator)
+        ? 1
+        : 0;
+    Path.Name = Name;
+    Path.NameLength = NameLength;
+
+    size_t Length = Path.Length();
+    uint32_t Current = 0;
+
+    for (size_t i = 0; i < Length; ++i)
+    {
+        uint16_t Character = FoldCharacter(Path.At(i));
+
+        uint32_t Child = Nodes[Current].FirstChild;
+        while (Child && Nodes[Child].Character < Character)
+        {
+            Child = Nodes[Child].NextSibling;
+        }
+
+        if (!Child || Nodes[Child].Character != Character)
+        {
+            return false;
+        }
+
+        Current = Child;
+
+        if (Nodes[Current].Terminal &&
+            (i + 1 == Length || Path.At(i + 1) == PathSeparator))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,139 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModePathFilter.h
+ * PURPOSE:   Definition for the Path Prefix Filter
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_PATH_PREFIX_FILTER
+#define NSUDO_DEVIL_MODE_PATH_PREFIX_FILTER
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A node of the prefix trie. The children of a node are linked in ascending
+ * order of their characters.
+ */
+typedef struct _NSUDO_DEVIL_MODE_PATH_FILTER_NODE
+{
+    /**
+     * The index of the first child, or 0 if the node has no child.
+     */
+    uint32_t FirstChild;
+
+    /**
+     * The index of the next sibling, or 0 if the node is the last child.
+     */
+    uint32_t NextSibling;
+
+    /**
+     * The upper-cased character of the node.
+     */
+    uint16_t Character;
+
+    /**
+     * Whether a prefix ends at the node.
+     */
+    uint16_t Terminal;
+
+} NSUDO_DEVIL_MODE_PATH_FILTER_NODE, *PNSUDO_DEVIL_MODE_PATH_FILTER_NODE;
+
+/**
+ * A prefix trie over the NT object paths. Node 0 is the root.
+ */
+typedef struct _NSUDO_DEVIL_MODE_PATH_FILTER
+{
+    /**
+     * The nodes of the trie.
+     */
+    PNSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes;
+
+    /**
+     * The number of the used nodes.
+     */
+    uint32_t NodeCount;
+
+    /**
+     * The number of the elements in the node array.
+     */
+    uint32_t NodeCapacity;
+
+} NSUDO_DEVIL_MODE_PATH_FILTER, *PNSUDO_DEVIL_MODE_PATH_FILTER;
+
+/**
+ * Initializes an empty path filter, which matches no path.
+ *
+ * @param Filter The path filter.
+ * @param Nodes The node array, it should live as long as the filter.
+ * @param NodeCapacity The number of the elements in the node array. The
+ *                     filter needs at most one node per character of the
+ *                     prefixes plus one node for the root.
+ * @return If the node array is not empty, it returns true.
+ */
+bool NSudoDevilModeInitializePathFilter(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    PNSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes,
+    uint32_t NodeCapacity);
+
+/**
+ * Adds a prefix to a path filter.
+ *
+ * @param Filter The path filter.
+ * @param Prefix The UTF-16 prefix, for example, \REGISTRY\MACHINE\SOFTWARE.
+ *               The trailing backslashes are ignored, so the prefix \ matches
+ *               all paths.
+ * @param Length The number of the characters of the prefix.
+ * @return If the node array is large enough, it returns true.
+ * @remark A prefix only matches whole path components, so \??\C:\Windows
+ *         matches \??\C:\Windows\System32 but not \??\C:\Windows2. The
+ *         characters are compared case-insensitively for ASCII only.
+ */
+bool NSudoDevilModeAddPathFilterPrefix(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    const uint16_t* Prefix,
+    size_t Length);
+
+/**
+ * Adds a list of prefixes to a path filter.
+ *
+ * @param Filter The path filter.
+ * @param List The UTF-16 prefixes separated by semicolons. The empty items
+ *             are ignored.
+ * @param Length The number of the characters of the list.
+ * @return If the node array is large enough, it returns true.
+ */
+bool NSudoDevilModeAddPathFilterPrefixes(
+    PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+    const uint16_t* List,
+    size_t Length);
+
+/**
+ * Checks whether a path starts with one of the prefixes of a path filter.
+ *
+ * @param Filter The path filter.
+ * @param Root The UTF-16 path of the root directory, or nullptr if the name
+ *             is absolute.
+ * @param RootLength The number of the characters of the root path.
+ * @param Name The UTF-16 name relative to the root directory.
+ * @param NameLength The number of the characters of the name.
+ * @return If the path matches, it returns true.
+ * @remark The root path and the name are joined by a backslash without
+ *         copying them, the same as the object manager does for the
+ *         OBJECT_ATTRIBUTES structure.
+ */
+bool NSudoDevilModeMatchPathFilter(
+    const NSUDO_DEVIL_MODE_PATH_FILTER* Filter,
+    const uint16_t* Root,
+    size_t RootLength,
+    const uint16_t* Name,
+    size_t NameLength);
+
+#endif // !NSUDO_DEVIL_MODE_PATH_PREFIX_FILTER
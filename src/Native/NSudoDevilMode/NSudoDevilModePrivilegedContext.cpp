@@ -0,0 +1,330 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModePrivilegedContext.cpp
+ * PURPOSE:   Implementation for the Privileged Context State Machine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModePrivilegedContext.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+namespace
+{
+    /**
+     * Claims a free slot for a thread.
+     *
+     * @return If the slot was free and it is claimed, the return value is
+     *         true.
+     */
+    bool ClaimSlot(
+        uintptr_t* SlotThreadId,
+        uintptr_t ThreadId)
+    {
+#ifdef _MSC_VER
+        return nullptr == ::_InterlockedCompareExchangePointer(
+            reinterpret_cast<void* volatile*>(SlotThreadId),
+            reinterpret_cast<void*>(ThreadId),
+            nullptr);
+#else
+        uintptr_t Expected = 0;
+        return __atomic_compare_exchange_n(
+            SlotThreadId,
+            &Expected,
+            ThreadId,
+            false,
+            __ATOMIC_ACQUIRE,
+            __ATOMIC_RELAXED);
+#endif // _MSC_VER
+    }
+
+    /**
+     * Frees a slot after the state of the slot is reset.
+     */
+    void FreeSlot(
+        uintptr_t* SlotThreadId)
+    {
+#ifdef _MSC_VER
+        ::_InterlockedExchangePointer(
+            reinterpret_cast<void* volatile*>(SlotThreadId),
+            nullptr);
+#else
+        __atomic_store_n(SlotThreadId, 0, __ATOMIC_RELEASE);
+#endif // _MSC_VER
+    }
+
+    uintptr_t LoadSlotOwner(
+        const uintptr_t* SlotThreadId)
+    {
+#ifdef _MSC_VER
+        return *reinterpret_cast<const volatile uintptr_t*>(SlotThreadId);
+#else
+        return __atomic_load_n(SlotThreadId, __ATOMIC_ACQUIRE);
+#endif // _MSC_VER
+    }
+
+    void AtomicAdd(
+        uint64_t* Target,
+        uint64_t Value)
+    {
+#ifdef _MSC_VER
+        ::_InterlockedExchangeAdd64(
+            reinterpret_cast<volatile long long*>(Target),
+            static_cast<long long>(Value));
+#else
+        __atomic_fetch_add(Target, Value, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+    }
+
+    uint64_t AtomicLoad(
+        const uint64_t* Source)
+    {
+#ifdef _MSC_VER
+        return static_cast<uint64_t>(::_InterlockedCompareExchange64(
+            const_cast<volatile long long*>(
+                reinterpret_cast<const volatile long long*>(Source)),
+            0,
+            0));
+#else
+        return __atomic_load_n(Source, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+    }
+
+    PNSUDO_DEVIL_MODE_THREAD_STATE GetThreadState(
+        PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context)
+    {
+        return Context->Slot
+            ? &Context->Slot->State
+            : &Context->FallbackState;
+    }
+
+    /**
+     * Publishes the counters and releases the thread state when the thread
+     * leaves the outermost privileged context.
+     */
+    void ReleaseThreadState(
+        PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+        PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context)
+    {
+        PNSUDO_DEVIL_MODE_THREAD_STATE State = GetThreadState(Context);
+        if (State->Depth)
+        {
+            return;
+        }
+
+        AtomicAdd(&Table->EnterCount, State->EnterCount);
+        AtomicAdd(&Table->SyscallCount, State->SyscallCount);
+        State->EnterCount = 0;
+        State->SyscallCount = 0;
+
+        if (Context->Slot)
+        {
+            FreeSlot(&Context->Slot->ThreadId);
+            Context->Slot = nullptr;
+        }
+    }
+}
+
+int32_t NSudoDevilModeEnterThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE State,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls,
+    void* PrivilegedToken)
+{
+    bool IsImpersonating = Syscalls->IsImpersonating(Syscalls->Context);
+
+    if (State->Depth)
+    {
+        if (IsImpersonating)
+        {
+            // The thread already runs under the privileged token.
+            ++State->Depth;
+            ++State->EnterCount;
+            return 0;
+        }
+
+        // The state is stale, for example, it belongs to a terminated thread
+        // whose identifier is reused.
+        if (State->OriginalToken)
+        {
+            ++State->SyscallCount;
+            Syscalls->CloseHandle(Syscalls->Context, State->OriginalToken);
+        }
+
+        State->Depth = 0;
+        State->OriginalToken = nullptr;
+    }
+
+    void* OriginalToken = nullptr;
+
+    // NtOpenThreadToken fails with STATUS_NO_TOKEN when the thread is not
+    // impersonating, so only ask for the token when there is one.
+    if (IsImpersonating)
+    {
+        ++State->SyscallCount;
+        if (Syscalls->OpenThreadToken(Syscalls->Context, &OriginalToken) < 0)
+        {
+            OriginalToken = nullptr;
+        }
+    }
+
+    ++State->SyscallCount;
+    int32_t Status = Syscalls->SetThreadToken(
+        Syscalls->Context,
+        PrivilegedToken);
+    if (Status < 0)
+    {
+        if (OriginalToken)
+        {
+            ++State->SyscallCount;
+            Syscalls->CloseHandle(Syscalls->Context, OriginalToken);
+        }
+
+        return Status;
+    }
+
+    State->Depth = 1;
+    State->OriginalToken = OriginalToken;
+    ++State->EnterCount;
+
+    return Status;
+}
+
+int32_t NSudoDevilModeLeaveThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE State,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls)
+{
+    if (!State->Depth)
+    {
+        return 0;
+    }
+
+    if (--State->Depth)
+    {
+        return 0;
+    }
+
+    ++State->SyscallCount;
+    int32_t Status = Syscalls->SetThreadToken(
+        Syscalls->Context,
+        State->OriginalToken);
+
+    if (State->OriginalToken)
+    {
+        ++State->SyscallCount;
+        Syscalls->CloseHandle(Syscalls->Context, State->OriginalToken);
+        State->OriginalToken = nullptr;
+    }
+
+    return Status;
+}
+
+int32_t NSudoDevilModeEnterPrivilegedContext(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context,
+    uintptr_t ThreadId,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls,
+    void* PrivilegedToken)
+{
+    Context->Slot = nullptr;
+    Context->FallbackState = NSUDO_DEVIL_MODE_THREAD_STATE();
+
+    // Reuse the state of the outer hook of the current thread, or claim a
+    // free slot. Only the current thread stores its identifier, so the first
+    // scan cannot race with itself.
+
+    for (NSUDO_DEVIL_MODE_THREAD_STATE_SLOT& Slot : Table->Slots)
+    {
+        if (LoadSlotOwner(&Slot.ThreadId) == ThreadId)
+        {
+            Context->Slot = &Slot;
+            break;
+        }
+    }
+
+    if (!Context->Slot)
+    {
+        for (NSUDO_DEVIL_MODE_THREAD_STATE_SLOT& Slot : Table->Slots)
+        {
+            if (!LoadSlotOwner(&Slot.ThreadId) &&
+                ClaimSlot(&Slot.ThreadId, ThreadId))
+            {
+                Context->Slot = &Slot;
+                break;
+            }
+        }
+    }
+
+    int32_t Status = ::NSudoDevilModeEnterThreadState(
+        GetThreadState(Context),
+        Syscalls,
+        PrivilegedToken);
+    if (Status < 0)
+    {
+        ReleaseThreadState(Table, Context);
+    }
+
+    return Status;
+}
+
+int32_t NSudoDevilModeLeavePrivilegedContext(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls)
+{
+    int32_t Status = ::NSudoDevilModeLeaveThreadState(
+        GetThreadState(Context),
+        Syscalls);
+
+    ReleaseThreadState(Table, Context);
+
+    return Status;
+}
+
+void NSudoDevilModeDetachThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    uintptr_t ThreadId,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls)
+{
+    for (NSUDO_DEVIL_MODE_THREAD_STATE_SLOT& Slot : Table->Slots)
+    {
+        if (LoadSlotOwner(&Slot.ThreadId) != ThreadId)
+        {
+            continue;
+        }
+
+        PNSUDO_DEVIL_MODE_THREAD_STATE State = &Slot.State;
+
+        if (State->OriginalToken)
+        {
+            ++State->SyscallCount;
+            Syscalls->CloseHandle(Syscalls->Context, State->OriginalToken);
+            State->OriginalToken = nullptr;
+        }
+        State->Depth = 0;
+
+        NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context;
+        Context.Slot = &Slot;
+        ReleaseThreadState(Table, &Context);
+        break;
+    }
+}
+
+void NSudoDevilModeGetPrivilegedContextCounters(
+    const NSUDO_DEVIL_MODE_THREAD_STATE_TABLE* Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters)
+{
+    Counters->EnterCount = AtomicLoad(&Table->EnterCount);
+    Counters->SyscallCount = AtomicLoad(&Table->SyscallCount);
+
+    uint64_t BaselineSyscallCount = Counters->EnterCount *
+        NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_BASELINE_SYSCALLS;
+    Counters->AvoidedSyscallCount =
+        BaselineSyscallCount > Counters->SyscallCount
+        ? BaselineSyscallCount - Counters->SyscallCount
+        : 0;
+}
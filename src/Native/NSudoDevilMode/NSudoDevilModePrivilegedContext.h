@@ -0,0 +1,289 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModePrivilegedContext.h
+ * PURPOSE:   Definition for the Privileged Context State Machine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT
+#define NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of the system calls issued by an enter and leave pair without
+ * the thread state: NtOpenThreadToken, NtSetInformationThread twice and
+ * NtClose.
+ */
+#define NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_BASELINE_SYSCALLS 4
+
+/**
+ * The system calls used by the privileged context state machine. The status
+ * values follow the NTSTATUS convention, negative values are failures.
+ */
+typedef struct _NSUDO_DEVIL_MODE_SYSCALL_TABLE
+{
+    /**
+     * User defined custom data passed to the system calls.
+     */
+    void* Context;
+
+    /**
+     * Checks whether the current thread is impersonating. It should not issue
+     * a system call, for example, it reads the thread environment block.
+     */
+    bool (*IsImpersonating)(
+        void* Context);
+
+    /**
+     * Opens the impersonation token of the current thread.
+     */
+    int32_t (*OpenThreadToken)(
+        void* Context,
+        void** TokenHandle);
+
+    /**
+     * Sets the impersonation token of the current thread, nullptr reverts
+     * the impersonation.
+     */
+    int32_t (*SetThreadToken)(
+        void* Context,
+        void* TokenHandle);
+
+    /**
+     * Closes a handle.
+     */
+    int32_t (*CloseHandle)(
+        void* Context,
+        void* Handle);
+
+} NSUDO_DEVIL_MODE_SYSCALL_TABLE, *PNSUDO_DEVIL_MODE_SYSCALL_TABLE;
+
+/**
+ * The privileged context state of a thread.
+ */
+typedef struct _NSUDO_DEVIL_MODE_THREAD_STATE
+{
+    /**
+     * The number of the active enters, the thread impersonates the
+     * privileged token when it is not 0.
+     */
+    uint32_t Depth;
+
+    /**
+     * The impersonation token before the outermost enter, or nullptr if the
+     * thread was not impersonating.
+     */
+    void* OriginalToken;
+
+    /**
+     * The number of the successful enters, including the nested enters.
+     */
+    uint32_t EnterCount;
+
+    /**
+     * The number of the system calls issued by the enters and leaves.
+     */
+    uint32_t SyscallCount;
+
+} NSUDO_DEVIL_MODE_THREAD_STATE, *PNSUDO_DEVIL_MODE_THREAD_STATE;
+
+/**
+ * The counters of the privileged context.
+ */
+typedef struct _NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS
+{
+    /**
+     * The number of the successful enters, including the nested enters.
+     */
+    uint64_t EnterCount;
+
+    /**
+     * The number of the system calls issued by the enters and leaves.
+     */
+    uint64_t SyscallCount;
+
+    /**
+     * The number of the system calls avoided by the thread state, compared
+     * with issuing NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_BASELINE_SYSCALLS
+     * system calls for every enter and leave pair.
+     */
+    uint64_t AvoidedSyscallCount;
+
+} NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS,
+  *PNSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS;
+
+/**
+ * The number of the threads which keep their privileged context state in a
+ * thread state table at the same time. The other threads fall back to a
+ * state which lives in their privileged context.
+ */
+#define NSUDO_DEVIL_MODE_THREAD_STATE_SLOT_COUNT 64
+
+/**
+ * The privileged context state of a thread in a thread state table.
+ */
+typedef struct _NSUDO_DEVIL_MODE_THREAD_STATE_SLOT
+{
+    /**
+     * The identifier of the thread which owns the slot, or 0 if the slot is
+     * free. It is updated atomically.
+     */
+    uintptr_t ThreadId;
+
+    /**
+     * The privileged context state of the thread.
+     */
+    NSUDO_DEVIL_MODE_THREAD_STATE State;
+
+} NSUDO_DEVIL_MODE_THREAD_STATE_SLOT, *PNSUDO_DEVIL_MODE_THREAD_STATE_SLOT;
+
+/**
+ * The thread states of the threads which run in the privileged context. A
+ * zero-initialized table is empty.
+ */
+typedef struct _NSUDO_DEVIL_MODE_THREAD_STATE_TABLE
+{
+    /**
+     * The slots, a thread only owns a slot while its depth is not 0.
+     */
+    NSUDO_DEVIL_MODE_THREAD_STATE_SLOT Slots[
+        NSUDO_DEVIL_MODE_THREAD_STATE_SLOT_COUNT];
+
+    /**
+     * The number of the successful enters published by the threads which
+     * left the outermost privileged context. It is updated atomically.
+     */
+    uint64_t EnterCount;
+
+    /**
+     * The number of the system calls published by the threads which left the
+     * outermost privileged context. It is updated atomically.
+     */
+    uint64_t SyscallCount;
+
+} NSUDO_DEVIL_MODE_THREAD_STATE_TABLE, *PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE;
+
+/**
+ * The privileged context frame of a hook call.
+ */
+typedef struct _NSUDO_DEVIL_MODE_PRIVILEGED_FRAME
+{
+    /**
+     * The slot of the current thread, or nullptr if the table was full.
+     */
+    PNSUDO_DEVIL_MODE_THREAD_STATE_SLOT Slot;
+
+    /**
+     * The state of the current thread when the table was full.
+     */
+    NSUDO_DEVIL_MODE_THREAD_STATE FallbackState;
+
+} NSUDO_DEVIL_MODE_PRIVILEGED_FRAME, *PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME;
+
+/**
+ * Enters the privileged context for the current thread.
+ *
+ * @param State The privileged context state of the current thread.
+ * @param Syscalls The system calls used by the function.
+ * @param PrivilegedToken The privileged impersonation token.
+ * @return The status of the function. If it fails, you should not call the
+ *         NSudoDevilModeLeaveThreadState function for this enter.
+ * @remark The nested enters only increase the depth. The outermost enter
+ *         only saves the original token if the thread is impersonating. If
+ *         the state has a depth but the thread is not impersonating, the
+ *         state is stale and it is reset.
+ */
+int32_t NSudoDevilModeEnterThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE State,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls,
+    void* PrivilegedToken);
+
+/**
+ * Leaves the privileged context for the current thread.
+ *
+ * @param State The privileged context state of the current thread.
+ * @param Syscalls The system calls used by the function.
+ * @return The status of the function.
+ * @remark The outermost leave restores the original token.
+ */
+int32_t NSudoDevilModeLeaveThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE State,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls);
+
+/**
+ * Enters the privileged context for the current thread with the state in a
+ * thread state table.
+ *
+ * @param Table The thread state table.
+ * @param Context A pointer to a NSUDO_DEVIL_MODE_PRIVILEGED_FRAME structure
+ *                that receives the privileged context of the call.
+ * @param ThreadId The identifier of the current thread, it should not be 0.
+ * @param Syscalls The system calls used by the function.
+ * @param PrivilegedToken The privileged impersonation token.
+ * @return The status of the function. If it fails, the thread keeps its
+ *         previous token and you should not call the
+ *         NSudoDevilModeLeavePrivilegedContext function for this enter.
+ * @remark The nested enters of a thread reuse the slot of the outermost
+ *         enter. If all slots are owned, the state lives in the Context
+ *         parameter, so the nested enters of the thread are not merged.
+ */
+int32_t NSudoDevilModeEnterPrivilegedContext(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context,
+    uintptr_t ThreadId,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls,
+    void* PrivilegedToken);
+
+/**
+ * Leaves the privileged context for the current thread.
+ *
+ * @param Table The thread state table.
+ * @param Context The privileged context of the call.
+ * @param Syscalls The system calls used by the function.
+ * @return The status of the function.
+ * @remark The outermost leave restores the original token, publishes the
+ *         counters of the thread to the table and frees the slot.
+ */
+int32_t NSudoDevilModeLeavePrivilegedContext(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls);
+
+/**
+ * Releases the slot of an exiting thread which did not leave the privileged
+ * context, for example, it exited in a hook.
+ *
+ * @param Table The thread state table.
+ * @param ThreadId The identifier of the exiting thread.
+ * @param Syscalls The system calls used by the function.
+ * @remark The token of the exiting thread is not restored, only the original
+ *         token is closed.
+ */
+void NSudoDevilModeDetachThreadState(
+    PNSUDO_DEVIL_MODE_THREAD_STATE_TABLE Table,
+    uintptr_t ThreadId,
+    const NSUDO_DEVIL_MODE_SYSCALL_TABLE* Syscalls);
+
+/**
+ * Retrieves the counters of a thread state table.
+ *
+ * @param Table The thread state table.
+ * @param Counters A pointer to a NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS
+ *                 structure that receives the counters.
+ * @remark The counters of the threads which are in the privileged context
+ *         are not included.
+ */
+void NSudoDevilModeGetPrivilegedContextCounters(
+    const NSUDO_DEVIL_MODE_THREAD_STATE_TABLE* Table,
+    PNSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters);
+
+#endif // !NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT
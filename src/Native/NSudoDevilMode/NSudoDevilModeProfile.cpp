@@ -0,0 +1,236 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeProfile.cpp
+ * PURPOSE:   Implementation for the Hook Call Profile
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeProfile.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+static_assert(
+    sizeof(NSUDO_DEVIL_MODE_HOOK_COUNTERS) %
+    NSUDO_DEVIL_MODE_PROFILE_CACHE_LINE_SIZE == 0,
+    "The counters should fill whole cache lines.");
+
+namespace
+{
+    void AtomicAdd(uint64_t* Target, uint64_t Value)
+    {
+#ifdef _MSC_VER
+        ::_InterlockedExchangeAdd64(
+            reinterpret_cast<volatile long long*>(Target),
+            static_cast<long long>(Value));
+#else
+        __atomic_fetch_add(Target, Value, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+    }
+
+    void AtomicIncrement(uint32_t* Target)
+    {
+#ifdef _MSC_VER
+        ::_InterlockedIncrement(reinterpret_cast<volatile long*>(Target));
+#else
+        __atomic_fetch_add(Target, 1u, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+    }
+
+    /**
+     * Reads a counter without writing to it, so it works with read-only views.
+     */
+    uint64_t LoadCounter(const uint64_t* Source)
+    {
+#if !defined(_MSC_VER)
+        return __atomic_load_n(Source, __ATOMIC_RELAXED);
+#elif defined(_M_X64) || defined(_M_ARM64)
+        return *reinterpret_cast<const volatile uint64_t*>(Source);
+#else
+        // The counters only increase, so the low part is consistent with the
+        // high part if the high part is not changed while reading it.
+        const volatile uint32_t* Parts =
+            reinterpret_cast<const volatile uint32_t*>(Source);
+        for (;;)
+        {
+            uint32_t High = Parts[1];
+            uint32_t Low = Parts[0];
+            if (Parts[1] == High)
+            {
+                return (static_cast<uint64_t>(High) << 32) | Low;
+            }
+        }
+#endif
+    }
+
+    uint32_t LoadCounter(const uint32_t* Source)
+    {
+        return *reinterpret_cast<const volatile uint32_t*>(Source);
+    }
+
+    /**
+     * Gets the number of the significant bits of a value.
+     */
+    uint32_t GetBitWidth(uint64_t Value)
+    {
+#if !defined(_MSC_VER)
+        return Value ? 64 - static_cast<uint32_t>(__builtin_clzll(Value)) : 0;
+#elif defined(_M_X64) || defined(_M_ARM64)
+        unsigned long Index = 0;
+        return ::_BitScanReverse64(&Index, Value) ? Index + 1 : 0;
+#else
+        unsigned long Index = 0;
+        if (::_BitScanReverse(&Index, static_cast<unsigned long>(Value >> 32)))
+        {
+            return Index + 33;
+        }
+        return ::_BitScanReverse(&Index, static_cast<unsigned long>(Value))
+            ? Index + 1
+            : 0;
+#endif
+    }
+
+    NSUDO_DEVIL_MODE_HOOK_COUNTERS* GetCounters(
+        const NSUDO_DEVIL_MODE_PROFILE* Profile,
+        uint32_t Stripe,
+        uint32_t HookIndex)
+    {
+        NSUDO_DEVIL_MODE_HOOK_COUNTERS* Counters =
+            reinterpret_cast<NSUDO_DEVIL_MODE_HOOK_COUNTERS*>(
+                const_cast<NSUDO_DEVIL_MODE_PROFILE*>(Profile) + 1);
+        return &Counters[Stripe * Profile->HookCount + HookIndex];
+    }
+}
+
+size_t NSudoDevilModeGetProfileSize(
+    uint32_t HookCount,
+    uint32_t StripeCount)
+{
+    return sizeof(NSUDO_DEVIL_MODE_PROFILE) +
+        sizeof(NSUDO_DEVIL_MODE_HOOK_COUNTERS) * HookCount * StripeCount;
+}
+
+bool NSudoDevilModeInitializeProfile(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookCount,
+    uint32_t StripeCount,
+    uint64_t Frequency)
+{
+    if (!Profile ||
+        HookCount > NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS ||
+        !StripeCount ||
+        (StripeCount & (StripeCount - 1)))
+    {
+        return false;
+    }
+
+    Profile->Version = NSUDO_DEVIL_MODE_PROFILE_VERSION;
+    Profile->HookCount = HookCount;
+    Profile->StripeCount = StripeCount;
+    Profile->Frequency = Frequency;
+
+    // Publishes the profile after the other members are visible to readers.
+#ifdef _MSC_VER
+    ::_InterlockedExchange(
+        reinterpret_cast<volatile long*>(&Profile->Signature),
+        NSUDO_DEVIL_MODE_PROFILE_SIGNATURE);
+#else
+    __atomic_store_n(
+        &Profile->Signature,
+        NSUDO_DEVIL_MODE_PROFILE_SIGNATURE,
+        __ATOMIC_RELEASE);
+#endif // _MSC_VER
+
+    return true;
+}
+
+void NSudoDevilModeSetProfileHookName(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookIndex,
+    const char* Name)
+{
+    if (!Profile ||
+        !Name ||
+        HookIndex >= NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS)
+    {
+        return;
+    }
+
+    char* Target = Profile->HookNames[HookIndex];
+    size_t i = 0;
+    for (; i < NSUDO_DEVIL_MODE_PROFILE_HOOK_NAME_SIZE - 1 && Name[i]; ++i)
+    {
+        Target[i] = Name[i];
+    }
+    Target[i] = '\0';
+}
+
+void NSudoDevilModeRecordHookCall(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookIndex,
+    uint32_t ThreadId,
+    uint64_t Ticks,
+    bool ContextFailed)
+{
+    if (HookIndex >= Profile->HookCount)
+    {
+        return;
+    }
+
+    // The identifiers of the threads on Windows are multiples of 4.
+    uint32_t Stripe = (ThreadId >> 2) & (Profile->StripeCount - 1);
+    NSUDO_DEVIL_MODE_HOOK_COUNTERS* Counters =
+        GetCounters(Profile, Stripe, HookIndex);
+
+    uint32_t Bucket = GetBitWidth(Ticks);
+    if (Bucket >= NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS)
+    {
+        Bucket = NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS - 1;
+    }
+
+    AtomicAdd(&Counters->CallCount, 1);
+    if (ContextFailed)
+    {
+        AtomicAdd(&Counters->ContextFailureCount, 1);
+    }
+    AtomicAdd(&Counters->TotalTicks, Ticks);
+    AtomicIncrement(&Counters->Histogram[Bucket]);
+}
+
+bool NSudoDevilModeAggregateHookCounters(
+    const NSUDO_DEVIL_MODE_PROFILE* Profile,
+    uint32_t HookIndex,
+    PNSUDO_DEVIL_MODE_HOOK_COUNTERS Counters)
+{
+    if (!Profile ||
+        !Counters ||
+        Profile->Signature != NSUDO_DEVIL_MODE_PROFILE_SIGNATURE ||
+        Profile->Version != NSUDO_DEVIL_MODE_PROFILE_VERSION ||
+        HookIndex >= Profile->HookCount)
+    {
+        return false;
+    }
+
+    *Counters = NSUDO_DEVIL_MODE_HOOK_COUNTERS{};
+
+    for (uint32_t Stripe = 0; Stripe < Profile->StripeCount; ++Stripe)
+    {
+        const NSUDO_DEVIL_MODE_HOOK_COUNTERS* Source =
+            GetCounters(Profile, Stripe, HookIndex);
+
+        Counters->CallCount += LoadCounter(&Source->CallCount);
+        Counters->ContextFailureCount +=
+            LoadCounter(&Source->ContextFailureCount);
+        Counters->TotalTicks += LoadCounter(&Source->TotalTicks);
+        for (size_t i = 0; i < NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS; ++i)
+        {
+            Counters->Histogram[i] += LoadCounter(&Source->Histogram[i]);
+        }
+    }
+
+    return true;
+}
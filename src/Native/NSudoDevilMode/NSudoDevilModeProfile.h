@@ -0,0 +1,207 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeProfile.h
+ * PURPOSE:   Definition for the Hook Call Profile
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_HOOK_CALL_PROFILE
+#define NSUDO_DEVIL_MODE_HOOK_CALL_PROFILE
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The signature of the profile, "NDMP" in little endian.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_SIGNATURE 0x504D444E
+
+/**
+ * The version of the profile layout.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_VERSION 1
+
+/**
+ * The maximum number of the hooks in the profile.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS 16
+
+/**
+ * The size of a hook name in the profile, including the terminating null
+ * character.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_HOOK_NAME_SIZE 32
+
+/**
+ * The number of the buckets in a latency histogram. Bucket 0 counts the
+ * calls which take no tick, bucket N counts the calls which take from
+ * 2^(N-1) to 2^N - 1 ticks, and the last bucket also counts the longer
+ * calls.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS 24
+
+/**
+ * The size of a cache line, the counters of different threads are kept in
+ * different cache lines.
+ */
+#define NSUDO_DEVIL_MODE_PROFILE_CACHE_LINE_SIZE 64
+
+/**
+ * The counters of a hook.
+ */
+typedef struct alignas(NSUDO_DEVIL_MODE_PROFILE_CACHE_LINE_SIZE)
+_NSUDO_DEVIL_MODE_HOOK_COUNTERS
+{
+    /**
+     * The number of the calls.
+     */
+    uint64_t CallCount;
+
+    /**
+     * The number of the calls which failed to enter the privileged context,
+     * for example, when the privileged token is not available.
+     */
+    uint64_t ContextFailureCount;
+
+    /**
+     * The ticks spent in the calls, from entering the privileged context to
+     * leaving it.
+     */
+    uint64_t TotalTicks;
+
+    /**
+     * The histogram of the ticks spent in each call.
+     */
+    uint32_t Histogram[NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS];
+
+} NSUDO_DEVIL_MODE_HOOK_COUNTERS, *PNSUDO_DEVIL_MODE_HOOK_COUNTERS;
+
+/**
+ * The header of a profile. It is followed by StripeCount rows of HookCount
+ * NSUDO_DEVIL_MODE_HOOK_COUNTERS structures, and the row of a thread is
+ * selected by its identifier.
+ */
+typedef struct alignas(NSUDO_DEVIL_MODE_PROFILE_CACHE_LINE_SIZE)
+_NSUDO_DEVIL_MODE_PROFILE
+{
+    /**
+     * NSUDO_DEVIL_MODE_PROFILE_SIGNATURE, it is set after the other members
+     * are initialized.
+     */
+    uint32_t Signature;
+
+    /**
+     * NSUDO_DEVIL_MODE_PROFILE_VERSION.
+     */
+    uint32_t Version;
+
+    /**
+     * The number of the hooks.
+     */
+    uint32_t HookCount;
+
+    /**
+     * The number of the rows of the counters, it is a power of two.
+     */
+    uint32_t StripeCount;
+
+    /**
+     * The number of the ticks per second.
+     */
+    uint64_t Frequency;
+
+    /**
+     * The null-terminated names of the hooks.
+     */
+    char HookNames[NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS][
+        NSUDO_DEVIL_MODE_PROFILE_HOOK_NAME_SIZE];
+
+} NSUDO_DEVIL_MODE_PROFILE, *PNSUDO_DEVIL_MODE_PROFILE;
+
+/**
+ * Gets the size of a profile.
+ *
+ * @param HookCount The number of the hooks.
+ * @param StripeCount The number of the rows of the counters.
+ * @return The size of the profile, in bytes.
+ */
+size_t NSudoDevilModeGetProfileSize(
+    uint32_t HookCount,
+    uint32_t StripeCount);
+
+/**
+ * Initializes a profile.
+ *
+ * @param Profile The profile, its memory should be filled with zeros and it
+ *                should be aligned to the cache line size.
+ * @param HookCount The number of the hooks, it should not be greater than
+ *                  NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS.
+ * @param StripeCount The number of the rows of the counters, it should be a
+ *                    power of two.
+ * @param Frequency The number of the ticks per second.
+ * @return If the parameters are valid, it returns true.
+ */
+bool NSudoDevilModeInitializeProfile(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookCount,
+    uint32_t StripeCount,
+    uint64_t Frequency);
+
+/**
+ * Sets the name of a hook in a profile.
+ *
+ * @param Profile The profile.
+ * @param HookIndex The index of the hook.
+ * @param Name The name of the hook. It is truncated if it is too long.
+ * @remark The names should be set before the profile is initialized, so the
+ *         readers see them when they see the signature.
+ */
+void NSudoDevilModeSetProfileHookName(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookIndex,
+    const char* Name);
+
+/**
+ * Records a call of a hook.
+ *
+ * @param Profile The profile.
+ * @param HookIndex The index of the hook.
+ * @param ThreadId The identifier of the current thread.
+ * @param Ticks The ticks spent in the call.
+ * @param ContextFailed Whether the hook failed to enter the privileged
+ *                      context.
+ * @remark The threads which share a row of the counters are rare, but they
+ *         are safe because the counters are updated with atomic additions,
+ *         which do not contend across the rows.
+ */
+void NSudoDevilModeRecordHookCall(
+    PNSUDO_DEVIL_MODE_PROFILE Profile,
+    uint32_t HookIndex,
+    uint32_t ThreadId,
+    uint64_t Ticks,
+    bool ContextFailed);
+
+/**
+ * Sums the counters of a hook in all rows.
+ *
+ * @param Profile The profile, it can be a read-only view of a profile which
+ *                is updated by another process.
+ * @param HookIndex The index of the hook.
+ * @param Counters A pointer to a NSUDO_DEVIL_MODE_HOOK_COUNTERS structure
+ *                 that receives the sums.
+ * @return If the profile is initialized and the hook index is valid, it
+ *         returns true.
+ */
+bool NSudoDevilModeAggregateHookCounters(
+    const NSUDO_DEVIL_MODE_PROFILE* Profile,
+    uint32_t HookIndex,
+    PNSUDO_DEVIL_MODE_HOOK_COUNTERS Counters);
+
+#endif // !NSUDO_DEVIL_MODE_HOOK_CALL_PROFILE
@@ -0,0 +1,481 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeRelocation.cpp
+ * PURPOSE:   Implementation for the x86 and x64 Instruction Relocation Engine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeRelocation.h"
+
+namespace
+{
+    /**
+     * The padding which can be consumed without being copied.
+     */
+    struct FillerPattern
+    {
+        uint8_t Length;
+        uint8_t Bytes[11];
+    };
+
+    /**
+     * The 1-byte through 11-byte NOPs and INT 3, the same as the padding
+     * recognized by Detours.
+     */
+    constexpr FillerPattern FillerPatterns[] =
+    {
+        { 1, { 0x90 } },
+        { 2, { 0x66, 0x90 } },
+        { 3, { 0x0F, 0x1F, 0x00 } },
+        { 4, { 0x0F, 0x1F, 0x40, 0x00 } },
+        { 5, { 0x0F, 0x1F, 0x44, 0x00, 0x00 } },
+        { 6, { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 } },
+        { 7, { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 } },
+        { 8, { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+        { 9, { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+        {
+            10,
+            { 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+        },
+        {
+            11,
+            {
+                0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84,
+                0x00, 0x00, 0x00, 0x00, 0x00
+            }
+        },
+        { 1, { 0xCC } },
+    };
+
+    /**
+     * Gets the length of the padding at the specified position.
+     *
+     * @param Code A pointer to the padding.
+     * @param CodeSize The number of the readable bytes from the Code
+     *                 parameter.
+     * @return The length of the padding, or 0 if it is not padding.
+     */
+    size_t GetFillerLength(
+        const uint8_t* Code,
+        size_t CodeSize)
+    {
+        for (const FillerPattern& Pattern : FillerPatterns)
+        {
+            if (Pattern.Length > CodeSize)
+            {
+                continue;
+            }
+
+            size_t Index = 0;
+            while (Index < Pattern.Length &&
+                Code[Index] == Pattern.Bytes[Index])
+            {
+                ++Index;
+            }
+
+            if (Index == Pattern.Length)
+            {
+                return Pattern.Length;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Checks whether the instruction ends the function, the same as the
+     * terminators recognized by Detours.
+     *
+     * @param Code A pointer to the instruction.
+     * @param Length The length of the instruction.
+     * @return Returns true if the instruction ends the function.
+     */
+    bool IsFunctionTerminator(
+        const uint8_t* Code,
+        size_t Length)
+    {
+        switch (Code[0])
+        {
+        case 0xEB: // JMP rel8
+        case 0xE9: // JMP rel32
+        case 0xE0: // LOOPNE rel8, treated as a jump by Detours
+        case 0xC2: // RET imm16
+        case 0xC3: // RET
+        case 0xCC: // INT 3
+            return true;
+        case 0xF3: // REP RET
+            return Length >= 2 && Code[1] == 0xC3;
+        case 0xFF: // JMP [disp32]
+            return Length >= 2 && Code[1] == 0x25;
+        case 0x26:
+        case 0x2E:
+        case 0x36:
+        case 0x3E:
+        case 0x64:
+        case 0x65: // JMP seg:[disp32]
+            return Length >= 3 && Code[1] == 0xFF && Code[2] == 0x25;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * Checks whether the prefixes of an instruction contain the operand-size
+     * prefix.
+     *
+     * @param Code A pointer to the instruction.
+     * @param OpcodeOffset The offset of the primary opcode byte.
+     * @return Returns true if the instruction has the 0x66 prefix.
+     */
+    bool HasOperandSizePrefix(
+        const uint8_t* Code,
+        size_t OpcodeOffset)
+    {
+        for (size_t Index = 0; Index < OpcodeOffset; ++Index)
+        {
+            if (Code[Index] == 0x66)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Reads a little-endian signed integer.
+     *
+     * @param Source A pointer to the integer.
+     * @param Size The size of the integer, it should be 1, 2 or 4.
+     * @return The sign-extended integer.
+     */
+    int64_t ReadSigned(
+        const uint8_t* Source,
+        size_t Size)
+    {
+        uint32_t Value = 0;
+        for (size_t Index = 0; Index < Size; ++Index)
+        {
+            Value |= static_cast<uint32_t>(Source[Index]) << (Index * 8);
+        }
+
+        switch (Size)
+        {
+        case 1:
+            return static_cast<int8_t>(Value);
+        case 2:
+            return static_cast<int16_t>(Value);
+        default:
+            return static_cast<int32_t>(Value);
+        }
+    }
+
+    /**
+     * Writes a little-endian integer.
+     *
+     * @param Destination A pointer to the integer.
+     * @param Size The size of the integer, it should be 1, 2 or 4.
+     * @param Value The integer.
+     */
+    void WriteSigned(
+        uint8_t* Destination,
+        size_t Size,
+        int32_t Value)
+    {
+        uint32_t Bits = static_cast<uint32_t>(Value);
+        for (size_t Index = 0; Index < Size; ++Index)
+        {
+            Destination[Index] = static_cast<uint8_t>(Bits >> (Index * 8));
+        }
+    }
+
+    /**
+     * Computes a displacement for the relocated instruction.
+     *
+     * @param Target The target address.
+     * @param Next The address of the next relocated instruction.
+     * @param Size The size of the displacement, it should be 1 or 4.
+     * @param Is64Bit Set to true for x64 code.
+     * @param Displacement A pointer to a variable that receives the
+     *                     displacement.
+     * @return Returns true if the displacement can be encoded.
+     */
+    bool ComputeDisplacement(
+        uint64_t Target,
+        uint64_t Next,
+        size_t Size,
+        bool Is64Bit,
+        int32_t* Displacement)
+    {
+        int64_t Value = static_cast<int64_t>(Target - Next);
+        if (!Is64Bit)
+        {
+            // The x86 addresses wrap around at 4 GiB.
+            Value = static_cast<int32_t>(static_cast<uint32_t>(Value));
+        }
+
+        const int64_t Limit = (Size == 1) ? 0x80 : 0x80000000LL;
+        if (Value < -Limit || Value >= Limit)
+        {
+            return false;
+        }
+
+        *Displacement = static_cast<int32_t>(Value);
+        return true;
+    }
+}
+
+NSUDO_DEVIL_MODE_RELOCATION_STATUS NSudoDevilModePlanRelocation(
+    const uint8_t* Code,
+    size_t CodeSize,
+    uint64_t SourceAddress,
+    uint64_t DestinationAddress,
+    size_t MinimumSize,
+    bool Is64Bit,
+    PNSUDO_DEVIL_MODE_RELOCATION Relocation)
+{
+    if (!Code || !Relocation)
+    {
+        return NSudoDevilModeRelocationInvalidInstruction;
+    }
+
+    *Relocation = {};
+
+    const uint64_t AddressMask = Is64Bit ? ~0ULL : 0xFFFFFFFFULL;
+
+    // Decode the window once and lay out the relocated instructions.
+
+    size_t SourceOffset = 0;
+    size_t DestinationOffset = 0;
+
+    while (SourceOffset < MinimumSize &&
+        Relocation->InstructionCount <
+        NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_INSTRUCTIONS)
+    {
+        NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION& Current =
+            Relocation->Instructions[Relocation->InstructionCount];
+
+        if (!::NSudoDevilModeDecodeLength(
+            Code + SourceOffset,
+            CodeSize - SourceOffset,
+            Is64Bit,
+            &Current.Instruction))
+        {
+            return NSudoDevilModeRelocationInvalidInstruction;
+        }
+
+        const NSUDO_DEVIL_MODE_INSTRUCTION& Instruction = Current.Instruction;
+
+        Current.SourceOffset = static_cast<uint8_t>(SourceOffset);
+        Current.DestinationOffset = static_cast<uint8_t>(DestinationOffset);
+        Current.DestinationLength = Instruction.Length;
+
+        if (Instruction.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP)
+        {
+            // JMP rel8 becomes JMP rel32 and Jcc rel8 becomes 0F 8x rel32,
+            // the prefixes are kept. The operand-size prefix is rejected
+            // below.
+            const bool IsJump =
+                Code[SourceOffset + Instruction.OpcodeOffset] == 0xEB;
+            Current.DestinationTargetOffset = static_cast<uint8_t>(
+                Instruction.OpcodeOffset + (IsJump ? 1 : 2));
+            Current.DestinationTargetSize = 4;
+            Current.DestinationLength = static_cast<uint8_t>(
+                Current.DestinationTargetOffset + 4);
+        }
+        else if (Instruction.Flags & (
+            NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE |
+            NSUDO_DEVIL_MODE_INSTRUCTION_RIP_RELATIVE))
+        {
+            Current.DestinationTargetOffset = Instruction.TargetOffset;
+            Current.DestinationTargetSize = Instruction.TargetSize;
+        }
+
+        SourceOffset += Instruction.Length;
+        DestinationOffset += Current.DestinationLength;
+        ++Relocation->InstructionCount;
+
+        if (IsFunctionTerminator(Code + Current.SourceOffset,
+            Instruction.Length))
+        {
+            break;
+        }
+    }
+
+    const size_t CopiedSize = SourceOffset;
+
+    Relocation->DestinationSize = DestinationOffset;
+
+    // Consume, but don't duplicate the padding.
+
+    while (SourceOffset < MinimumSize)
+    {
+        size_t FillerLength = GetFillerLength(
+            Code + SourceOffset,
+            CodeSize - SourceOffset);
+        if (!FillerLength)
+        {
+            break;
+        }
+
+        SourceOffset += FillerLength;
+    }
+
+    Relocation->SourceSize = SourceOffset;
+
+    if (SourceOffset < MinimumSize)
+    {
+        return NSudoDevilModeRelocationTooSmall;
+    }
+
+    // Compute the relocated targets now that the layout is known.
+
+    for (size_t Index = 0; Index < Relocation->InstructionCount; ++Index)
+    {
+        NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION& Current =
+            Relocation->Instructions[Index];
+        const NSUDO_DEVIL_MODE_INSTRUCTION& Instruction = Current.Instruction;
+
+        if (!Current.DestinationTargetSize)
+        {
+            continue;
+        }
+
+        const uint64_t SourceNext =
+            SourceAddress + Current.SourceOffset + Instruction.Length;
+        const uint64_t DestinationNext =
+            DestinationAddress +
+            Current.DestinationOffset +
+            Current.DestinationLength;
+
+        if (Instruction.TargetSize == 2)
+        {
+            // The 16-bit targets truncate the instruction pointer.
+            return NSudoDevilModeRelocationInvalidBranch;
+        }
+
+        if ((Instruction.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP) &&
+            HasOperandSizePrefix(
+                Code + Current.SourceOffset,
+                Instruction.OpcodeOffset))
+        {
+            // With the operand-size prefix the enlarged branch would be a
+            // rel16 branch, which truncates the instruction pointer and only
+            // reads 2 bytes of the 4-byte target.
+            return NSudoDevilModeRelocationInvalidBranch;
+        }
+
+        uint64_t Target = (SourceNext + static_cast<uint64_t>(ReadSigned(
+            Code + Current.SourceOffset + Instruction.TargetOffset,
+            Instruction.TargetSize))) & AddressMask;
+
+        if (!(Instruction.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_RIP_RELATIVE))
+        {
+            // Redirect the branches into the moved instructions to the
+            // relocated instructions.
+            const uint64_t Offset = (Target - SourceAddress) & AddressMask;
+            if (Offset < CopiedSize)
+            {
+                size_t Match = 0;
+                while (Match < Relocation->InstructionCount &&
+                    Relocation->Instructions[Match].SourceOffset != Offset)
+                {
+                    ++Match;
+                }
+
+                if (Match == Relocation->InstructionCount)
+                {
+                    return NSudoDevilModeRelocationInvalidBranch;
+                }
+
+                Target = DestinationAddress +
+                    Relocation->Instructions[Match].DestinationOffset;
+            }
+            else if (Offset < Relocation->SourceSize)
+            {
+                // The consumed padding is replaced by the jump back to the
+                // remaining code.
+                Target = DestinationAddress + Relocation->DestinationSize;
+            }
+        }
+
+        if (!ComputeDisplacement(
+            Target,
+            DestinationNext,
+            Current.DestinationTargetSize,
+            Is64Bit,
+            &Current.DestinationTarget))
+        {
+            return NSudoDevilModeRelocationOutOfRange;
+        }
+    }
+
+    return NSudoDevilModeRelocationSuccess;
+}
+
+NSUDO_DEVIL_MODE_RELOCATION_STATUS NSudoDevilModeEmitRelocation(
+    const NSUDO_DEVIL_MODE_RELOCATION* Relocation,
+    const uint8_t* Code,
+    uint8_t* Destination,
+    size_t DestinationSize)
+{
+    if (!Relocation || !Code || !Destination)
+    {
+        return NSudoDevilModeRelocationInvalidInstruction;
+    }
+
+    if (Relocation->DestinationSize > DestinationSize)
+    {
+        return NSudoDevilModeRelocationBufferTooSmall;
+    }
+
+    for (size_t Index = 0; Index < Relocation->InstructionCount; ++Index)
+    {
+        const NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION& Current =
+            Relocation->Instructions[Index];
+        const NSUDO_DEVIL_MODE_INSTRUCTION& Instruction = Current.Instruction;
+
+        const uint8_t* Source = Code + Current.SourceOffset;
+        uint8_t* Target = Destination + Current.DestinationOffset;
+
+        if (Instruction.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP)
+        {
+            for (size_t Byte = 0; Byte < Instruction.OpcodeOffset; ++Byte)
+            {
+                Target[Byte] = Source[Byte];
+            }
+
+            const uint8_t Opcode = Source[Instruction.OpcodeOffset];
+            if (Opcode == 0xEB)
+            {
+                Target[Instruction.OpcodeOffset] = 0xE9;
+            }
+            else
+            {
+                Target[Instruction.OpcodeOffset] = 0x0F;
+                Target[Instruction.OpcodeOffset + 1] =
+                    static_cast<uint8_t>(0x80 | (Opcode & 0x0F));
+            }
+        }
+        else
+        {
+            for (size_t Byte = 0; Byte < Instruction.Length; ++Byte)
+            {
+                Target[Byte] = Source[Byte];
+            }
+        }
+
+        if (Current.DestinationTargetSize)
+        {
+            WriteSigned(
+                Target + Current.DestinationTargetOffset,
+                Current.DestinationTargetSize,
+                Current.DestinationTarget);
+        }
+    }
+
+    return NSudoDevilModeRelocationSuccess;
+}
@@ -0,0 +1,198 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeRelocation.h
+ * PURPOSE:   Definition for the x86 and x64 Instruction Relocation Engine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_RELOCATION_ENGINE
+#define NSUDO_DEVIL_MODE_RELOCATION_ENGINE
+
+#include "NSudoDevilModeLengthDecoder.h"
+
+/**
+ * The maximum number of the instructions in a relocation window, it is the
+ * same as the number of the alignment entries in a Detours trampoline.
+ */
+#define NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_INSTRUCTIONS 8
+
+/**
+ * The maximum number of the bytes read from a relocation window.
+ */
+#define NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_WINDOW \
+    (NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_INSTRUCTIONS * \
+    NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH)
+
+/**
+ * The status of the relocation functions.
+ */
+typedef enum _NSUDO_DEVIL_MODE_RELOCATION_STATUS
+{
+    /**
+     * The function succeeds.
+     */
+    NSudoDevilModeRelocationSuccess,
+
+    /**
+     * The window contains an invalid or a truncated instruction.
+     */
+    NSudoDevilModeRelocationInvalidInstruction,
+
+    /**
+     * The window ends with a function terminator, or it has too many
+     * instructions, before the minimum size is reached.
+     */
+    NSudoDevilModeRelocationTooSmall,
+
+    /**
+     * A branch cannot be relocated, for example, it targets the middle of a
+     * relocated instruction or it has a 16-bit target. The short jumps with
+     * the operand-size prefix are rejected too, because they would become
+     * 16-bit branches when they are enlarged.
+     */
+    NSudoDevilModeRelocationInvalidBranch,
+
+    /**
+     * A relative target or a RIP-relative displacement cannot be encoded at
+     * the destination address.
+     */
+    NSudoDevilModeRelocationOutOfRange,
+
+    /**
+     * The destination buffer is smaller than the predicted size.
+     */
+    NSudoDevilModeRelocationBufferTooSmall,
+
+} NSUDO_DEVIL_MODE_RELOCATION_STATUS;
+
+/**
+ * The relocation of an instruction.
+ */
+typedef struct _NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION
+{
+    /**
+     * The decoded information of the source instruction.
+     */
+    NSUDO_DEVIL_MODE_INSTRUCTION Instruction;
+
+    /**
+     * The offset of the source instruction in the window.
+     */
+    uint8_t SourceOffset;
+
+    /**
+     * The offset of the relocated instruction in the destination.
+     */
+    uint8_t DestinationOffset;
+
+    /**
+     * The length of the relocated instruction. It is longer than the source
+     * instruction if a short jump is enlarged.
+     */
+    uint8_t DestinationLength;
+
+    /**
+     * The offset of the relocated target or displacement in the relocated
+     * instruction, or 0 if the instruction is copied without changes.
+     */
+    uint8_t DestinationTargetOffset;
+
+    /**
+     * The size of the relocated target or displacement, in bytes.
+     */
+    uint8_t DestinationTargetSize;
+
+    /**
+     * The relocated target or displacement.
+     */
+    int32_t DestinationTarget;
+
+} NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION,
+  *PNSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION;
+
+/**
+ * The relocation plan of a code window.
+ */
+typedef struct _NSUDO_DEVIL_MODE_RELOCATION
+{
+    /**
+     * The number of the bytes moved from the window, including the padding
+     * which is consumed but not copied.
+     */
+    size_t SourceSize;
+
+    /**
+     * The predicted size of the relocated code, in bytes.
+     */
+    size_t DestinationSize;
+
+    /**
+     * The number of the elements in the Instructions array.
+     */
+    size_t InstructionCount;
+
+    /**
+     * The relocations of the instructions.
+     */
+    NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION Instructions[
+        NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_INSTRUCTIONS];
+
+} NSUDO_DEVIL_MODE_RELOCATION, *PNSUDO_DEVIL_MODE_RELOCATION;
+
+/**
+ * Decodes a code window once and computes the relocations which are needed
+ * to move its leading instructions to another address.
+ *
+ * @param Code A pointer to the first byte of the window.
+ * @param CodeSize The number of the readable bytes from the Code parameter.
+ *                 The function only reads the bytes it needs.
+ * @param SourceAddress The address of the window when it is executed.
+ * @param DestinationAddress The address of the relocated code when it is
+ *                           executed.
+ * @param MinimumSize The minimum number of the bytes to move, for example,
+ *                    the size of the jump which will overwrite the window.
+ * @param Is64Bit Decodes the window as x64 code if this parameter is true.
+ *                Otherwise, decodes it as x86 code.
+ * @param Relocation A pointer to a NSUDO_DEVIL_MODE_RELOCATION structure that
+ *                   receives the relocation plan.
+ * @return The status of the function. If the return value is
+ *         NSudoDevilModeRelocationTooSmall, the relocation plan describes the
+ *         instructions before the terminator.
+ * @remark The short jumps are always enlarged to near jumps, and the branches
+ *         into the moved instructions are redirected to the relocated
+ *         instructions, so the size of the relocated code is known before it
+ *         is emitted. The RIP-relative data references are adjusted to keep
+ *         their targets. The function is pure computation and platform
+ *         neutral.
+ */
+NSUDO_DEVIL_MODE_RELOCATION_STATUS NSudoDevilModePlanRelocation(
+    const uint8_t* Code,
+    size_t CodeSize,
+    uint64_t SourceAddress,
+    uint64_t DestinationAddress,
+    size_t MinimumSize,
+    bool Is64Bit,
+    PNSUDO_DEVIL_MODE_RELOCATION Relocation);
+
+/**
+ * Emits the relocated code of a relocation plan in one pass.
+ *
+ * @param Relocation The relocation plan returned by the
+ *                   NSudoDevilModePlanRelocation function.
+ * @param Code A pointer to the first byte of the window passed to the
+ *             NSudoDevilModePlanRelocation function.
+ * @param Destination A pointer to the buffer that receives the relocated
+ *                    code.
+ * @param DestinationSize The size of the Destination buffer, in bytes.
+ * @return The status of the function.
+ */
+NSUDO_DEVIL_MODE_RELOCATION_STATUS NSudoDevilModeEmitRelocation(
+    const NSUDO_DEVIL_MODE_RELOCATION* Relocation,
+    const uint8_t* Code,
+    uint8_t* Destination,
+    size_t DestinationSize);
+
+#endif // !NSUDO_DEVIL_MODE_RELOCATION_ENGINE
@@ -0,0 +1,513 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeTrampolineAllocator.cpp
+ * PURPOSE:   Implementation for the Trampoline Region Allocator
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoDevilModeTrampolineAllocator.h"
+
+namespace
+{
+    /**
+     * The region has free slots and it is in the available list.
+     */
+    const uint32_t RegionAvailable = 0x1;
+
+    /**
+     * The region is writable and it is in the changed list.
+     */
+    const uint32_t RegionChanged = 0x2;
+
+    uintptr_t GetWindowNumber(
+        uintptr_t Address)
+    {
+        return Address >> NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW_SHIFT;
+    }
+
+    /**
+     * Finds the window entry, or nullptr if it is not found and the Create
+     * parameter is false or the table is full.
+     */
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW FindWindow(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        uintptr_t WindowNumber,
+        bool Create)
+    {
+        const size_t Mask = NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS - 1;
+
+        uintptr_t Key = WindowNumber + 1;
+        size_t Index = static_cast<size_t>(
+            (static_cast<uint64_t>(Key) * 0x9E3779B97F4A7C15ull) >> 32) & Mask;
+
+        for (size_t i = 0; i < NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS; ++i)
+        {
+            PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Window =
+                &Allocator->Windows[(Index + i) & Mask];
+
+            if (Window->Key == Key)
+            {
+                return Window;
+            }
+
+            // The entries are never removed, so an unused entry ends the
+            // probe sequence.
+            if (!Window->Key)
+            {
+                if (!Create)
+                {
+                    return nullptr;
+                }
+
+                Window->Key = Key;
+                return Window;
+            }
+        }
+
+        return nullptr;
+    }
+
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW FindRegionWindow(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region)
+    {
+        return FindWindow(
+            Allocator,
+            GetWindowNumber(reinterpret_cast<uintptr_t>(Region)),
+            false);
+    }
+
+    /**
+     * Makes the region writable once in the current batch.
+     */
+    bool ChangeRegion(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region)
+    {
+        if (!Region || (Region->Flags & RegionChanged))
+        {
+            return true;
+        }
+
+        if (!Allocator->Callbacks->MakeWritable(
+            Allocator->Callbacks->Context,
+            Region,
+            Allocator->RegionSize))
+        {
+            return false;
+        }
+
+        Region->Flags |= RegionChanged;
+        Region->NextChanged = Allocator->Changed;
+        Allocator->Changed = Region;
+
+        return true;
+    }
+
+    /**
+     * Inserts the region to the available list of its window in address
+     * order. A region is only inserted when it is created or when it becomes
+     * not full, so the cost is amortized by the allocations from it.
+     *
+     * The links are stored in the region headers, so the neighbors are made
+     * writable before they are changed. The region should be writable.
+     */
+    bool InsertAvailableRegion(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Window,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region)
+    {
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Next = Window->FirstAvailable;
+        while (Next && Next < Region)
+        {
+            Next = Next->NextAvailable;
+        }
+
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Previous =
+            Next ? Next->PreviousAvailable : Window->LastAvailable;
+
+        if (!ChangeRegion(Allocator, Previous) ||
+            !ChangeRegion(Allocator, Next))
+        {
+            return false;
+        }
+
+        Region->PreviousAvailable = Previous;
+        Region->NextAvailable = Next;
+
+        if (Previous)
+        {
+            Previous->NextAvailable = Region;
+        }
+        else
+        {
+            Window->FirstAvailable = Region;
+        }
+
+        if (Next)
+        {
+            Next->PreviousAvailable = Region;
+        }
+        else
+        {
+            Window->LastAvailable = Region;
+        }
+
+        Region->Flags |= RegionAvailable;
+
+        return true;
+    }
+
+    /**
+     * Removes the region from the available list of its window. The region
+     * should be writable.
+     */
+    bool RemoveAvailableRegion(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Window,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region)
+    {
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Previous =
+            Region->PreviousAvailable;
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Next = Region->NextAvailable;
+
+        if (!ChangeRegion(Allocator, Previous) ||
+            !ChangeRegion(Allocator, Next))
+        {
+            return false;
+        }
+
+        if (Previous)
+        {
+            Previous->NextAvailable = Next;
+        }
+        else
+        {
+            Window->FirstAvailable = Next;
+        }
+
+        if (Next)
+        {
+            Next->PreviousAvailable = Previous;
+        }
+        else
+        {
+            Window->LastAvailable = Previous;
+        }
+
+        Region->PreviousAvailable = nullptr;
+        Region->NextAvailable = nullptr;
+        Region->Flags &= ~RegionAvailable;
+
+        return true;
+    }
+
+    bool IsRegionInRange(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region,
+        uintptr_t Lower,
+        uintptr_t Upper)
+    {
+        uintptr_t Address = reinterpret_cast<uintptr_t>(Region);
+        return (
+            Address >= Lower &&
+            Upper >= Allocator->RegionSize &&
+            Address <= Upper - Allocator->RegionSize);
+    }
+
+    /**
+     * Finds a region in the range from the available list of a window. The
+     * list is ordered by address, so if the window starts in the range, only
+     * the first region can be checked. Otherwise, the regions are checked
+     * from the last one and the search ends at the first region below the
+     * range, which is also the last one checked unless the window contains
+     * both ends of the range.
+     */
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION FindAvailableRegion(
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+        uintptr_t WindowNumber,
+        uintptr_t Lower,
+        uintptr_t Upper)
+    {
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Window = FindWindow(
+            Allocator,
+            WindowNumber,
+            false);
+        if (!Window)
+        {
+            return nullptr;
+        }
+
+        uintptr_t WindowStart =
+            WindowNumber << NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW_SHIFT;
+
+        if (WindowStart >= Lower)
+        {
+            PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region =
+                Window->FirstAvailable;
+            if (Region && IsRegionInRange(Allocator, Region, Lower, Upper))
+            {
+                return Region;
+            }
+
+            return nullptr;
+        }
+
+        for (PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region =
+            Window->LastAvailable;
+            Region && reinterpret_cast<uintptr_t>(Region) >= Lower;
+            Region = Region->PreviousAvailable)
+        {
+            if (IsRegionInRange(Allocator, Region, Lower, Upper))
+            {
+                return Region;
+            }
+        }
+
+        return nullptr;
+    }
+}
+
+void NSudoDevilModeInitializeTrampolineAllocator(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    size_t RegionSize,
+    size_t SlotSize,
+    const NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS* Callbacks)
+{
+    Allocator->RegionSize = RegionSize;
+    Allocator->SlotSize = SlotSize;
+    Allocator->SlotCount = static_cast<uint32_t>(RegionSize / SlotSize - 1);
+    Allocator->RegionCount = 0;
+    Allocator->Callbacks = Callbacks;
+    Allocator->Changed = nullptr;
+
+    for (size_t i = 0; i < NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS; ++i)
+    {
+        Allocator->Windows[i].Key = 0;
+        Allocator->Windows[i].FirstAvailable = nullptr;
+        Allocator->Windows[i].LastAvailable = nullptr;
+    }
+}
+
+bool NSudoDevilModeInsertTrampolineRegion(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Region)
+{
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Header =
+        reinterpret_cast<PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION>(Region);
+
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Window = FindWindow(
+        Allocator,
+        GetWindowNumber(reinterpret_cast<uintptr_t>(Region)),
+        true);
+    if (!Window)
+    {
+        return false;
+    }
+
+    // The slots are handed out in order before the freed slots are reused,
+    // so the new region does not need to build a free list.
+    Header->PreviousAvailable = nullptr;
+    Header->NextAvailable = nullptr;
+    Header->FreeList = nullptr;
+    Header->UsedCount = 0;
+    Header->UnusedIndex = 0;
+    Header->Flags = 0;
+
+    if (!InsertAvailableRegion(Allocator, Window, Header))
+    {
+        return false;
+    }
+
+    // The new region is already writable.
+    Header->Flags |= RegionChanged;
+    Header->NextChanged = Allocator->Changed;
+    Allocator->Changed = Header;
+
+    ++Allocator->RegionCount;
+
+    return true;
+}
+
+void* NSudoDevilModeAllocateTrampoline(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    uintptr_t Lower,
+    uintptr_t Upper,
+    uintptr_t Hint)
+{
+    uintptr_t HintWindow = GetWindowNumber(Hint);
+
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region = FindAvailableRegion(
+        Allocator,
+        HintWindow,
+        Lower,
+        Upper);
+
+    // The range is smaller than 4 GB, so it overlaps at most three windows.
+    for (uintptr_t WindowNumber = GetWindowNumber(Lower);
+        !Region && WindowNumber <= GetWindowNumber(Upper);
+        ++WindowNumber)
+    {
+        if (WindowNumber != HintWindow)
+        {
+            Region = FindAvailableRegion(
+                Allocator,
+                WindowNumber,
+                Lower,
+                Upper);
+        }
+    }
+
+    if (!Region)
+    {
+        return nullptr;
+    }
+
+    return NSudoDevilModeAllocateTrampolineFromRegion(Allocator, Region);
+}
+
+void* NSudoDevilModeAllocateTrampolineFromRegion(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Region)
+{
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Header =
+        reinterpret_cast<PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION>(Region);
+
+    if (!(Header->Flags & RegionAvailable))
+    {
+        return nullptr;
+    }
+
+    if (!ChangeRegion(Allocator, Header))
+    {
+        return nullptr;
+    }
+
+    if (Header->UsedCount + 1 == Allocator->SlotCount)
+    {
+        if (!RemoveAvailableRegion(
+            Allocator,
+            FindRegionWindow(Allocator, Header),
+            Header))
+        {
+            return nullptr;
+        }
+    }
+
+    void* Slot = Header->FreeList;
+    if (Slot)
+    {
+        Header->FreeList = *reinterpret_cast<void**>(Slot);
+    }
+    else
+    {
+        Slot = reinterpret_cast<uint8_t*>(Region)
+            + Allocator->SlotSize * (++Header->UnusedIndex);
+    }
+
+    ++Header->UsedCount;
+
+    return Slot;
+}
+
+bool NSudoDevilModeFreeTrampoline(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Trampoline)
+{
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Header =
+        reinterpret_cast<PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION>(
+            reinterpret_cast<uintptr_t>(Trampoline)
+            & ~(static_cast<uintptr_t>(Allocator->RegionSize) - 1));
+
+    if (!ChangeRegion(Allocator, Header))
+    {
+        return false;
+    }
+
+    if (!(Header->Flags & RegionAvailable))
+    {
+        if (!InsertAvailableRegion(
+            Allocator,
+            FindRegionWindow(Allocator, Header),
+            Header))
+        {
+            return false;
+        }
+    }
+
+    uint8_t* Bytes = reinterpret_cast<uint8_t*>(Trampoline);
+    for (size_t i = 0; i < Allocator->SlotSize; ++i)
+    {
+        Bytes[i] = 0;
+    }
+
+    *reinterpret_cast<void**>(Trampoline) = Header->FreeList;
+    Header->FreeList = Trampoline;
+
+    --Header->UsedCount;
+
+    return true;
+}
+
+void NSudoDevilModeCommitTrampolineRegions(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    bool ReleaseEmptyRegions)
+{
+    if (ReleaseEmptyRegions)
+    {
+        // Unlinking a region from its window changes its neighbors, so they
+        // may be added to the head of the changed list during the walk.
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION* Link = &Allocator->Changed;
+        while (*Link)
+        {
+            PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region = *Link;
+            if (Region->UsedCount)
+            {
+                Link = &Region->NextChanged;
+                continue;
+            }
+
+            *Link = Region->NextChanged;
+
+            if (!RemoveAvailableRegion(
+                Allocator,
+                FindRegionWindow(Allocator, Region),
+                Region))
+            {
+                // Keep the region if its neighbors cannot be changed.
+                Region->NextChanged = *Link;
+                *Link = Region;
+                Link = &Region->NextChanged;
+                continue;
+            }
+
+            --Allocator->RegionCount;
+
+            Allocator->Callbacks->Release(
+                Allocator->Callbacks->Context,
+                Region,
+                Allocator->RegionSize);
+        }
+    }
+
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Region = Allocator->Changed;
+    Allocator->Changed = nullptr;
+
+    while (Region)
+    {
+        PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Next = Region->NextChanged;
+
+        Region->NextChanged = nullptr;
+        Region->Flags &= ~RegionChanged;
+
+        Allocator->Callbacks->MakeExecutable(
+            Allocator->Callbacks->Context,
+            Region,
+            Allocator->RegionSize);
+
+        Region = Next;
+    }
+}
@@ -0,0 +1,272 @@
+﻿/*
+ * PROJECT:   NSudo Devil Mode
+ * FILE:      NSudoDevilModeTrampolineAllocator.h
+ * PURPOSE:   Definition for the Trampoline Region Allocator
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_ALLOCATOR
+#define NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_ALLOCATOR
+
+#ifndef __cplusplus
+#error "[NSudoDevilMode] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The regions are indexed by 2 GB windows, so the regions which can be
+ * reached by a relative jump are in the window of the target or in one of
+ * its neighbors.
+ */
+#define NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW_SHIFT 31
+
+/**
+ * The maximum number of the windows which contain the regions. It should be
+ * a power of two.
+ */
+#define NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS 64
+
+/**
+ * The header of a trampoline region. It is stored in the first slot of the
+ * region.
+ */
+typedef struct _NSUDO_DEVIL_MODE_TRAMPOLINE_REGION
+{
+    /**
+     * The previous region with free slots in the same window, the regions
+     * are ordered by address.
+     */
+    struct _NSUDO_DEVIL_MODE_TRAMPOLINE_REGION* PreviousAvailable;
+
+    /**
+     * The next region with free slots in the same window.
+     */
+    struct _NSUDO_DEVIL_MODE_TRAMPOLINE_REGION* NextAvailable;
+
+    /**
+     * The next region changed in the current batch.
+     */
+    struct _NSUDO_DEVIL_MODE_TRAMPOLINE_REGION* NextChanged;
+
+    /**
+     * The list of the freed slots.
+     */
+    void* FreeList;
+
+    /**
+     * The number of the allocated slots.
+     */
+    uint32_t UsedCount;
+
+    /**
+     * The index of the first slot which has never been allocated.
+     */
+    uint32_t UnusedIndex;
+
+    /**
+     * The state flags of the region.
+     */
+    uint32_t Flags;
+
+} NSUDO_DEVIL_MODE_TRAMPOLINE_REGION, *PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION;
+
+/**
+ * The memory operations used by the trampoline region allocator.
+ */
+typedef struct _NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS
+{
+    /**
+     * User defined custom data passed to the callbacks.
+     */
+    void* Context;
+
+    /**
+     * Makes a region writable. It is called once for each region changed in
+     * a batch.
+     */
+    bool (*MakeWritable)(
+        void* Context,
+        void* Region,
+        size_t RegionSize);
+
+    /**
+     * Makes a region executable and flushes its instruction cache.
+     */
+    void (*MakeExecutable)(
+        void* Context,
+        void* Region,
+        size_t RegionSize);
+
+    /**
+     * Releases an empty region.
+     */
+    void (*Release)(
+        void* Context,
+        void* Region,
+        size_t RegionSize);
+
+} NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS,
+  *PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS;
+
+/**
+ * The regions of a 2 GB window.
+ */
+typedef struct _NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW
+{
+    /**
+     * The window number plus one, or 0 if the entry is not used.
+     */
+    uintptr_t Key;
+
+    /**
+     * The region with free slots which has the lowest address.
+     */
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION FirstAvailable;
+
+    /**
+     * The region with free slots which has the highest address.
+     */
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION LastAvailable;
+
+} NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW, *PNSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW;
+
+/**
+ * The trampoline region allocator.
+ */
+typedef struct _NSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR
+{
+    /**
+     * The size of a region, in bytes. It should be a power of two and the
+     * regions should be aligned to it.
+     */
+    size_t RegionSize;
+
+    /**
+     * The size of a slot, in bytes.
+     */
+    size_t SlotSize;
+
+    /**
+     * The number of the slots in a region, excluding the header slot.
+     */
+    uint32_t SlotCount;
+
+    /**
+     * The number of the regions in the allocator.
+     */
+    size_t RegionCount;
+
+    /**
+     * The memory operations used by the allocator.
+     */
+    const NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS* Callbacks;
+
+    /**
+     * The regions changed in the current batch.
+     */
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_REGION Changed;
+
+    /**
+     * The hash table of the windows, it uses linear probing.
+     */
+    NSUDO_DEVIL_MODE_TRAMPOLINE_WINDOW Windows[
+        NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS];
+
+} NSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR,
+  *PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR;
+
+/**
+ * Initializes a trampoline region allocator.
+ *
+ * @param Allocator The allocator.
+ * @param RegionSize The size of a region, in bytes. It should be a power of
+ *                   two.
+ * @param SlotSize The size of a slot, in bytes. It should be at least the
+ *                 size of the NSUDO_DEVIL_MODE_TRAMPOLINE_REGION structure.
+ * @param Callbacks The memory operations used by the allocator. It should be
+ *                  valid during the lifetime of the allocator.
+ */
+void NSudoDevilModeInitializeTrampolineAllocator(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    size_t RegionSize,
+    size_t SlotSize,
+    const NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS* Callbacks);
+
+/**
+ * Adds a newly allocated region to the allocator.
+ *
+ * @param Allocator The allocator.
+ * @param Region The region, it should be writable and aligned to the region
+ *               size.
+ * @return If the function succeeds, it returns true. If the window table is
+ *         full, it returns false and you should release the region.
+ * @remark The region is changed in the current batch.
+ */
+bool NSudoDevilModeInsertTrampolineRegion(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Region);
+
+/**
+ * Allocates a slot whose region is in an address range.
+ *
+ * @param Allocator The allocator.
+ * @param Lower The lowest address of the range.
+ * @param Upper The highest address of the range.
+ * @param Hint The preferred address, for example, the address of the target
+ *             function. The window of it is searched first.
+ * @return The slot, or nullptr if no region in the range has a free slot or
+ *         the region cannot be made writable.
+ * @remark Each window keeps the regions with free slots in address order, so
+ *         only the regions at the ends of the windows are checked, and the
+ *         function costs O(1) time.
+ */
+void* NSudoDevilModeAllocateTrampoline(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    uintptr_t Lower,
+    uintptr_t Upper,
+    uintptr_t Hint);
+
+/**
+ * Allocates a slot from a region.
+ *
+ * @param Allocator The allocator.
+ * @param Region The region.
+ * @return The slot, or nullptr if the region is full or it cannot be made
+ *         writable.
+ */
+void* NSudoDevilModeAllocateTrampolineFromRegion(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Region);
+
+/**
+ * Frees a slot and fills it with zeros.
+ *
+ * @param Allocator The allocator.
+ * @param Trampoline The slot.
+ * @return If the function succeeds, it returns true. If the region cannot
+ *         be made writable, it returns false and the slot is not freed.
+ */
+bool NSudoDevilModeFreeTrampoline(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    void* Trampoline);
+
+/**
+ * Ends the current batch. The regions changed in the batch are made
+ * executable, or released if they are empty.
+ *
+ * @param Allocator The allocator.
+ * @param ReleaseEmptyRegions Releases the empty regions changed in the batch
+ *                            if this parameter is true.
+ * @remark Only the regions changed in the batch are visited, and each of them
+ *         is made writable and executable once.
+ */
+void NSudoDevilModeCommitTrampolineRegions(
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator,
+    bool ReleaseEmptyRegions);
+
+#endif // !NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_ALLOCATOR
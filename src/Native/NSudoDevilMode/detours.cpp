@@ -12,6 +12,10 @@
 #define DETOURS_INTERNAL
 #include "detours.h"
 
+#include "NSudoDevilModeCodeRange.h"
+#include "NSudoDevilModeRelocation.h"
+#include "NSudoDevilModeTrampolineAllocator.h"
+
 #if DETOURS_VERSION != 0x4c0c1   // 0xMAJORcMINORcPATCH
 #error detours.h version mismatch
 #endif
@@ -1095,54 +1099,75 @@ inline ULONG detour_is_code_filler(PBYTE pbCode)
 
 //////////////////////////////////////////////// Trampoline Memory Management.
 //
-struct DETOUR_REGION
+const ULONG DETOUR_REGION_SIZE = 0x10000;
+
+C_ASSERT(sizeof(NSUDO_DEVIL_MODE_TRAMPOLINE_REGION)
+    <= sizeof(DETOUR_TRAMPOLINE));
+
+static bool detour_writable_trampoline_region(PVOID pContext,
+    PVOID pRegion,
+    SIZE_T cbRegion)
 {
-    ULONG               dwSignature;
-    DETOUR_REGION* pNext;  // Next region in list of regions.
-    DETOUR_TRAMPOLINE* pFree;  // List of free trampolines in this region.
-};
-typedef DETOUR_REGION* PDETOUR_REGION;
+    UNREFERENCED_PARAMETER(pContext);
 
-const ULONG DETOUR_REGION_SIGNATURE = 'Rrtd';
-const ULONG DETOUR_REGION_SIZE = 0x10000;
-const ULONG DETOUR_TRAMPOLINES_PER_REGION = (DETOUR_REGION_SIZE
-    / sizeof(DETOUR_TRAMPOLINE)) - 1;
-static PDETOUR_REGION s_pRegions = NULL;            // List of all regions.
-static PDETOUR_REGION s_pRegion = NULL;             // Default region.
+    DWORD dwOld;
+    return NT_SUCCESS(DetourVirtualProtect(
+        pRegion,
+        cbRegion,
+        PAGE_EXECUTE_READWRITE,
+        &dwOld));
+}
 
-static DWORD detour_writable_trampoline_regions()
+static void detour_runnable_trampoline_region(PVOID pContext,
+    PVOID pRegion,
+    SIZE_T cbRegion)
 {
-    // Mark all of the regions as writable.
-    for (PDETOUR_REGION pRegion = s_pRegions; pRegion != NULL; pRegion = pRegion->pNext) {
-        DWORD dwOld;
-        NTSTATUS Status = DetourVirtualProtect(
-            pRegion,
-            DETOUR_REGION_SIZE,
-            PAGE_EXECUTE_READWRITE,
-            &dwOld);
-        if (!NT_SUCCESS(Status))
-        {
-            return RtlNtStatusToDosError(Status);
-        }
-    }
-    return NO_ERROR;
+    UNREFERENCED_PARAMETER(pContext);
+
+    DWORD dwOld;
+    DetourVirtualProtect(
+        pRegion,
+        cbRegion,
+        PAGE_EXECUTE_READ,
+        &dwOld);
+    NtFlushInstructionCache(
+        NtCurrentProcess(),
+        pRegion,
+        cbRegion);
 }
 
-static void detour_runnable_trampoline_regions()
+static void detour_release_trampoline_region(PVOID pContext,
+    PVOID pRegion,
+    SIZE_T cbRegion)
 {
-    // Mark all of the regions as executable.
-    for (PDETOUR_REGION pRegion = s_pRegions; pRegion != NULL; pRegion = pRegion->pNext) {
-        DWORD dwOld;
-        DetourVirtualProtect(
-            pRegion,
+    UNREFERENCED_PARAMETER(pContext);
+    UNREFERENCED_PARAMETER(cbRegion);
+
+    DetourVirtualFree(pRegion, 0, MEM_RELEASE);
+}
+
+static const NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS s_RegionCallbacks =
+{
+    NULL,
+    detour_writable_trampoline_region,
+    detour_runnable_trampoline_region,
+    detour_release_trampoline_region,
+};
+
+// The regions are indexed by 2GB windows. Only the regions changed in a
+// transaction are made writable, and only once per transaction.
+static NSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR s_RegionAllocator;
+
+static PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR detour_trampoline_allocator()
+{
+    if (s_RegionAllocator.RegionSize == 0) {
+        NSudoDevilModeInitializeTrampolineAllocator(
+            &s_RegionAllocator,
             DETOUR_REGION_SIZE,
-            PAGE_EXECUTE_READ,
-            &dwOld);
-        NtFlushInstructionCache(
-            NtCurrentProcess(),
-            pRegion,
-            DETOUR_REGION_SIZE);
+            sizeof(DETOUR_TRAMPOLINE),
+            &s_RegionCallbacks);
     }
+    return &s_RegionAllocator;
 }
 
 static PBYTE detour_alloc_round_down_to_region(PBYTE pbTry)
@@ -1311,36 +1336,21 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
 
     detour_find_jmp_bounds(pbTarget, &pLo, &pHi);
 
-    PDETOUR_TRAMPOLINE pTrampoline = NULL;
-
-    // Insure that there is a default region.
-    if (s_pRegion == NULL && s_pRegions != NULL) {
-        s_pRegion = s_pRegions;
-    }
-
-    // First check the default region for an valid free block.
-    if (s_pRegion != NULL && s_pRegion->pFree != NULL &&
-        s_pRegion->pFree >= pLo && s_pRegion->pFree <= pHi) {
-
-    found_region:
-        pTrampoline = s_pRegion->pFree;
-        // do a last sanity check on region.
-        if (pTrampoline < pLo || pTrampoline > pHi) {
-            return NULL;
-        }
-        s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pTrampoline->pbRemain;
+    PNSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR pAllocator =
+        detour_trampoline_allocator();
+
+    // First check the existing regions for a valid free block.
+    PDETOUR_TRAMPOLINE pTrampoline = (PDETOUR_TRAMPOLINE)
+        NSudoDevilModeAllocateTrampoline(
+            pAllocator,
+            (ULONG_PTR)pLo,
+            (ULONG_PTR)pHi,
+            (ULONG_PTR)pbTarget);
+    if (pTrampoline != NULL) {
         memset(pTrampoline, 0xcc, sizeof(*pTrampoline));
         return pTrampoline;
     }
 
-    // Then check the existing regions for a valid free block.
-    for (s_pRegion = s_pRegions; s_pRegion != NULL; s_pRegion = s_pRegion->pNext) {
-        if (s_pRegion != NULL && s_pRegion->pFree != NULL &&
-            s_pRegion->pFree >= pLo && s_pRegion->pFree <= pHi) {
-            goto found_region;
-        }
-    }
-
     // We need to allocate a new region.
 
     // Round pbTarget down to 64KB block.
@@ -1348,89 +1358,54 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
 
     PVOID pbNewlyAllocated =
         detour_alloc_trampoline_allocate_new(pbTarget, pLo, pHi);
-    if (pbNewlyAllocated != NULL) {
-        s_pRegion = (DETOUR_REGION*)pbNewlyAllocated;
-        s_pRegion->dwSignature = DETOUR_REGION_SIGNATURE;
-        s_pRegion->pFree = NULL;
-        s_pRegion->pNext = s_pRegions;
-        s_pRegions = s_pRegion;
-        DETOUR_TRACE(("  Allocated region %p..%p\n\n",
-            s_pRegion, ((PBYTE)s_pRegion) + DETOUR_REGION_SIZE - 1));
-
-        // Put everything but the first trampoline on the free list.
-        PBYTE pFree = NULL;
-        pTrampoline = ((PDETOUR_TRAMPOLINE)s_pRegion) + 1;
-        for (int i = DETOUR_TRAMPOLINES_PER_REGION - 1; i > 1; i--) {
-            pTrampoline[i].pbRemain = pFree;
-            pFree = (PBYTE)&pTrampoline[i];
-        }
-        s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pFree;
-        goto found_region;
-    }
-
-    DETOUR_TRACE(("Couldn't find available memory region!\n"));
-    return NULL;
-}
-
-static void detour_free_trampoline(PDETOUR_TRAMPOLINE pTrampoline)
-{
-    PDETOUR_REGION pRegion = (PDETOUR_REGION)
-        ((ULONG_PTR)pTrampoline & ~(ULONG_PTR)0xffff);
-
-    memset(pTrampoline, 0, sizeof(*pTrampoline));
-    pTrampoline->pbRemain = (PBYTE)pRegion->pFree;
-    pRegion->pFree = pTrampoline;
-}
+    if (pbNewlyAllocated == NULL) {
+        DETOUR_TRACE(("Couldn't find available memory region!\n"));
+        return NULL;
+    }
 
-static BOOL detour_is_region_empty(PDETOUR_REGION pRegion)
-{
-    // Stop if the region isn't a region (this would be bad).
-    if (pRegion->dwSignature != DETOUR_REGION_SIGNATURE) {
-        return FALSE;
+    if (!NSudoDevilModeInsertTrampolineRegion(pAllocator, pbNewlyAllocated)) {
+        DETOUR_TRACE(("Couldn't index the memory region!\n"));
+        DetourVirtualFree(pbNewlyAllocated, 0, MEM_RELEASE);
+        return NULL;
     }
 
-    PBYTE pbRegionBeg = (PBYTE)pRegion;
-    PBYTE pbRegionLim = pbRegionBeg + DETOUR_REGION_SIZE;
+    DETOUR_TRACE(("  Allocated region %p..%p\n\n",
+        pbNewlyAllocated,
+        ((PBYTE)pbNewlyAllocated) + DETOUR_REGION_SIZE - 1));
 
-    // Stop if any of the trampolines aren't free.
-    PDETOUR_TRAMPOLINE pTrampoline = ((PDETOUR_TRAMPOLINE)pRegion) + 1;
-    for (int i = 0; i < DETOUR_TRAMPOLINES_PER_REGION; i++) {
-        if (pTrampoline[i].pbRemain != NULL &&
-            (pTrampoline[i].pbRemain < pbRegionBeg ||
-                pTrampoline[i].pbRemain >= pbRegionLim)) {
-            return FALSE;
-        }
-    }
+    pTrampoline = (PDETOUR_TRAMPOLINE)
+        NSudoDevilModeAllocateTrampolineFromRegion(
+            pAllocator,
+            pbNewlyAllocated);
 
-    // OK, the region is empty.
-    return TRUE;
+    // do a last sanity check on region.
+    if (pTrampoline == NULL || pTrampoline < pLo || pTrampoline > pHi) {
+        return NULL;
+    }
+    memset(pTrampoline, 0xcc, sizeof(*pTrampoline));
+    return pTrampoline;
 }
 
-static void detour_free_unused_trampoline_regions()
+static void detour_free_trampoline(PDETOUR_TRAMPOLINE pTrampoline)
 {
-    PDETOUR_REGION* ppRegionBase = &s_pRegions;
-    PDETOUR_REGION pRegion = s_pRegions;
-
-    while (pRegion != NULL) {
-        if (detour_is_region_empty(pRegion)) {
-            *ppRegionBase = pRegion->pNext;
+    // The trampoline is leaked if its region can't be made writable.
+    NSudoDevilModeFreeTrampoline(detour_trampoline_allocator(), pTrampoline);
+}
 
-            DetourVirtualFree(pRegion, 0, MEM_RELEASE);
-            s_pRegion = NULL;
-        }
-        else {
-            ppRegionBase = &pRegion->pNext;
-        }
-        pRegion = *ppRegionBase;
-    }
+static void detour_commit_trampoline_regions(BOOL fReleaseEmpty)
+{
+    // Make the changed regions executable, or free them if they are unused.
+    NSudoDevilModeCommitTrampolineRegions(
+        detour_trampoline_allocator(),
+        fReleaseEmpty ? true : false);
 }
 
 ///////////////////////////////////////////////////////// Transaction Structs.
 //
 struct DetourThread
 {
-    DetourThread* pNext;
     HANDLE hThread;
+    BOOL fCloseHandle;  // The handle is opened by DetourUpdateAllThreads.
 };
 
 struct DetourOperation
@@ -1449,8 +1424,165 @@ static BOOL s_fRetainRegions = FALSE;
 static LONG s_nPendingThreadId = 0; // Thread owning pending transaction.
 static LONG s_nPendingError = NO_ERROR;
 static PVOID* s_ppPendingError = NULL;
-static DetourThread* s_pPendingThreads = NULL;
+static DetourThread* s_pPendingThreads = NULL;    // Suspended threads.
+static ULONG s_nPendingThreads = 0;
+static ULONG s_nPendingThreadsMax = 0;
 static DetourOperation* s_pPendingOperations = NULL;
+static SIZE_T s_nPendingOperations = 0;
+static PNSUDO_DEVIL_MODE_CODE_RANGE s_pPendingRanges = NULL; // Fixup table.
+static SIZE_T s_nPendingRangesMax = 0;
+static DETOUR_TRANSACTION_TIMINGS s_Timings;
+
+static ULONG64 detour_query_counter()
+{
+    LARGE_INTEGER Counter;
+    NtQueryPerformanceCounter(&Counter, NULL);
+    return (ULONG64)Counter.QuadPart;
+}
+
+static BOOL detour_reserve_pending_threads(ULONG nThreads)
+{
+    // The suspended threads are kept in an array which grows geometrically,
+    // so the threads don't need a heap allocation each.
+    if (nThreads <= s_nPendingThreadsMax) {
+        return TRUE;
+    }
+    ULONG nMax = s_nPendingThreadsMax ? s_nPendingThreadsMax : 64;
+    while (nMax < nThreads) {
+        nMax *= 2;
+    }
+    PVOID pNew = (s_pPendingThreads == NULL)
+        ? RtlAllocateHeap(
+            RtlProcessHeap(), 0, nMax * sizeof(DetourThread))
+        : RtlReAllocateHeap(
+            RtlProcessHeap(), 0, s_pPendingThreads,
+            nMax * sizeof(DetourThread));
+    if (pNew == NULL) {
+        return FALSE;
+    }
+    s_pPendingThreads = reinterpret_cast<DetourThread*>(pNew);
+    s_nPendingThreadsMax = nMax;
+    return TRUE;
+}
+
+static BOOL detour_reserve_pending_ranges(SIZE_T nRanges)
+{
+    // The fixup table has a range for each operation. It is reserved when
+    // the operation is queued, so the commit doesn't allocate while the
+    // threads are suspended.
+    if (nRanges <= s_nPendingRangesMax) {
+        return TRUE;
+    }
+    SIZE_T nMax = s_nPendingRangesMax ? s_nPendingRangesMax : 16;
+    while (nMax < nRanges) {
+        nMax *= 2;
+    }
+    PVOID pNew = (s_pPendingRanges == NULL)
+        ? RtlAllocateHeap(
+            RtlProcessHeap(), 0, nMax * sizeof(NSUDO_DEVIL_MODE_CODE_RANGE))
+        : RtlReAllocateHeap(
+            RtlProcessHeap(), 0, s_pPendingRanges,
+            nMax * sizeof(NSUDO_DEVIL_MODE_CODE_RANGE));
+    if (pNew == NULL) {
+        return FALSE;
+    }
+    s_pPendingRanges = reinterpret_cast<PNSUDO_DEVIL_MODE_CODE_RANGE>(pNew);
+    s_nPendingRangesMax = nMax;
+    return TRUE;
+}
+
+static NTSTATUS detour_suspend_pending_thread(HANDLE hThread,
+    BOOL fCloseHandle)
+{
+    // The array is reserved before the threads are suspended, because a
+    // suspended thread may own the heap lock.
+    if (s_nPendingThreads == s_nPendingThreadsMax) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    NTSTATUS Status = NtSuspendThread(hThread, nullptr);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    s_pPendingThreads[s_nPendingThreads].hThread = hThread;
+    s_pPendingThreads[s_nPendingThreads].fCloseHandle = fCloseHandle;
+    s_nPendingThreads++;
+
+    return STATUS_SUCCESS;
+}
+
+static void detour_resume_pending_threads_from(ULONG nFirst)
+{
+    for (ULONG n = nFirst; n < s_nPendingThreads; n++) {
+        // There is nothing we can do if this fails.
+        NtResumeThread(s_pPendingThreads[n].hThread, nullptr);
+
+        if (s_pPendingThreads[n].fCloseHandle) {
+            NtClose(s_pPendingThreads[n].hThread);
+        }
+    }
+    s_nPendingThreads = nFirst;
+}
+
+static void detour_resume_pending_threads(DetourOperation* pOperations)
+{
+    ULONG64 nStart = detour_query_counter();
+
+    detour_resume_pending_threads_from(0);
+
+    // The heap is only used again after all of the threads are resumed.
+    while (pOperations != NULL) {
+        DetourOperation* n = pOperations->pNext;
+        RtlFreeHeap(RtlProcessHeap(), 0, pOperations);
+        pOperations = n;
+    }
+    if (s_pPendingThreads != NULL) {
+        RtlFreeHeap(RtlProcessHeap(), 0, s_pPendingThreads);
+    }
+    s_pPendingThreads = NULL;
+    s_nPendingThreadsMax = 0;
+    if (s_pPendingRanges != NULL) {
+        RtlFreeHeap(RtlProcessHeap(), 0, s_pPendingRanges);
+    }
+    s_pPendingRanges = NULL;
+    s_nPendingRangesMax = 0;
+
+    s_Timings.Resume += detour_query_counter() - nStart;
+}
+
+static void detour_fill_code_range(PNSUDO_DEVIL_MODE_CODE_RANGE pRange,
+    DetourOperation* o)
+{
+    PDETOUR_TRAMPOLINE pTrampoline = o->pTrampoline;
+
+    C_ASSERT(ARRAYSIZE(pTrampoline->rAlign)
+        == NSUDO_DEVIL_MODE_MAXIMUM_CODE_RANGE_OFFSETS);
+
+    // The unused alignment entries map 0 to 0, the same as the default.
+    pRange->OffsetCount = ARRAYSIZE(pTrampoline->rAlign);
+
+    if (o->fIsRemove) {
+        // A thread in the trampoline continues in the restored target.
+        pRange->Start = (ULONG_PTR)pTrampoline->rbCode;
+        pRange->Size = sizeof(pTrampoline->rbCode);
+        pRange->Destination = (ULONG_PTR)o->pbTarget;
+        for (ULONG n = 0; n < ARRAYSIZE(pTrampoline->rAlign); n++) {
+            pRange->SourceOffsets[n] = pTrampoline->rAlign[n].obTrampoline;
+            pRange->DestinationOffsets[n] = pTrampoline->rAlign[n].obTarget;
+        }
+    }
+    else {
+        // A thread in the patched target continues in the trampoline.
+        pRange->Start = (ULONG_PTR)o->pbTarget;
+        pRange->Size = pTrampoline->cbRestore;
+        pRange->Destination = (ULONG_PTR)pTrampoline->rbCode;
+        for (ULONG n = 0; n < ARRAYSIZE(pTrampoline->rAlign); n++) {
+            pRange->SourceOffsets[n] = pTrampoline->rAlign[n].obTarget;
+            pRange->DestinationOffsets[n] = pTrampoline->rAlign[n].obTrampoline;
+        }
+    }
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1477,11 +1609,22 @@ LONG WINAPI DetourTransactionBegin()
         }
 
     s_pPendingOperations = NULL;
+    s_nPendingOperations = 0;
     s_pPendingThreads = NULL;
+    s_nPendingThreads = 0;
+    s_nPendingThreadsMax = 0;
+    s_pPendingRanges = NULL;
+    s_nPendingRangesMax = 0;
     s_ppPendingError = NULL;
 
-    // Make sure the trampoline pages are writable.
-    s_nPendingError = detour_writable_trampoline_regions();
+    ZeroMemory(&s_Timings, sizeof(s_Timings));
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Counter;
+    NtQueryPerformanceCounter(&Counter, &Frequency);
+    s_Timings.Frequency = (ULONG64)Frequency.QuadPart;
+
+    // The trampoline regions are made writable when they are first changed.
+    s_nPendingError = NO_ERROR;
 
     return s_nPendingError;
 }
@@ -1493,7 +1636,7 @@ LONG WINAPI DetourTransactionAbort()
     }
 
     // Restore all of the page permissions.
-    for (DetourOperation* o = s_pPendingOperations; o != NULL;) {
+    for (DetourOperation* o = s_pPendingOperations; o != NULL; o = o->pNext) {
         // We don't care if this fails, because the code is still accessible.
         DWORD dwOld;
         DetourVirtualProtect(
@@ -1508,26 +1651,15 @@ LONG WINAPI DetourTransactionAbort()
                 o->pTrampoline = NULL;
             }
         }
-
-        DetourOperation* n = o->pNext;
-        RtlFreeHeap(RtlProcessHeap(), 0, o);
-        o = n;
     }
-    s_pPendingOperations = NULL;
 
     // Make sure the trampoline pages are no longer writable.
-    detour_runnable_trampoline_regions();
+    detour_commit_trampoline_regions(FALSE);
 
-    // Resume any suspended threads.
-    for (DetourThread* t = s_pPendingThreads; t != NULL;) {
-        // There is nothing we can do if this fails.
-        NtResumeThread(t->hThread, nullptr);
-
-        DetourThread* n = t->pNext;
-        RtlFreeHeap(RtlProcessHeap(), 0, t);
-        t = n;
-    }
-    s_pPendingThreads = NULL;
+    // Resume any suspended threads, then free the operations.
+    detour_resume_pending_threads(s_pPendingOperations);
+    s_pPendingOperations = NULL;
+    s_nPendingOperations = 0;
     s_nPendingThreadId = 0;
 
     return NO_ERROR;
@@ -1538,26 +1670,6 @@ LONG WINAPI DetourTransactionCommit()
     return DetourTransactionCommitEx(NULL);
 }
 
-static BYTE detour_align_from_trampoline(PDETOUR_TRAMPOLINE pTrampoline, BYTE obTrampoline)
-{
-    for (LONG n = 0; n < ARRAYSIZE(pTrampoline->rAlign); n++) {
-        if (pTrampoline->rAlign[n].obTrampoline == obTrampoline) {
-            return pTrampoline->rAlign[n].obTarget;
-        }
-    }
-    return 0;
-}
-
-static LONG detour_align_from_target(PDETOUR_TRAMPOLINE pTrampoline, LONG obTarget)
-{
-    for (LONG n = 0; n < ARRAYSIZE(pTrampoline->rAlign); n++) {
-        if (pTrampoline->rAlign[n].obTarget == obTarget) {
-            return pTrampoline->rAlign[n].obTrampoline;
-        }
-    }
-    return 0;
-}
-
 LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID** pppFailedPointer)
 {
     if (pppFailedPointer != NULL) {
@@ -1577,8 +1689,25 @@ LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID** pppFailedPointer)
 
     // Common variables.
     DetourOperation* o;
-    DetourThread* t;
     BOOL freed = FALSE;
+    ULONG64 nStart = detour_query_counter();
+
+    // Build the code range table of the thread fixups, it is sorted once so
+    // each thread only needs a binary search. The table is reserved by the
+    // DetourAttach and DetourDetach calls.
+    PNSUDO_DEVIL_MODE_CODE_RANGE pRanges = s_pPendingRanges;
+    SIZE_T cRanges = s_nPendingOperations;
+    if (s_nPendingThreads != 0 && cRanges != 0) {
+        SIZE_T nRange = 0;
+        for (o = s_pPendingOperations; o != NULL; o = o->pNext) {
+            detour_fill_code_range(&pRanges[nRange++], o);
+        }
+        NSudoDevilModeSortCodeRanges(pRanges, cRanges);
+    }
+    s_Timings.OperationCount = (ULONG)cRanges;
+    s_Timings.ThreadCount = s_nPendingThreads;
+    s_Timings.Fixup += detour_query_counter() - nStart;
+    nStart = detour_query_counter();
 
     // Insert or remove each of the detours.
     for (o = s_pPendingOperations; o != NULL; o = o->pNext) {
@@ -1670,8 +1799,11 @@ LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID** pppFailedPointer)
         }
     }
 
+    s_Timings.Patch += detour_query_counter() - nStart;
+    nStart = detour_query_counter();
+
     // Update any suspended threads.
-    for (t = s_pPendingThreads; t != NULL; t = t->pNext) {
+    for (ULONG n = 0; n < s_nPendingThreads; n++) {
         CONTEXT cxt;
         cxt.ContextFlags = CONTEXT_CONTROL;
 
@@ -1693,49 +1825,22 @@ LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID** pppFailedPointer)
 #define DETOURS_EIP         Pc
 #endif // DETOURS_ARM64
 
-        typedef ULONG_PTR DETOURS_EIP_TYPE;
-
-        if (NT_SUCCESS(NtGetContextThread(t->hThread, &cxt))) {
-            for (o = s_pPendingOperations; o != NULL; o = o->pNext) {
-                if (o->fIsRemove) {
-                    if (cxt.DETOURS_EIP >= (DETOURS_EIP_TYPE)(ULONG_PTR)o->pTrampoline &&
-                        cxt.DETOURS_EIP < (DETOURS_EIP_TYPE)((ULONG_PTR)o->pTrampoline
-                            + sizeof(o->pTrampoline))
-                        ) {
-
-                        cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)
-                            ((ULONG_PTR)o->pbTarget
-                                + detour_align_from_trampoline(o->pTrampoline,
-                                (BYTE)(cxt.DETOURS_EIP
-                                    - (DETOURS_EIP_TYPE)(ULONG_PTR)
-                                    o->pTrampoline)));
-
-                        NtSetContextThread(t->hThread, &cxt);
-                    }
-                }
-                else {
-                    if (cxt.DETOURS_EIP >= (DETOURS_EIP_TYPE)(ULONG_PTR)o->pbTarget &&
-                        cxt.DETOURS_EIP < (DETOURS_EIP_TYPE)((ULONG_PTR)o->pbTarget
-                            + o->pTrampoline->cbRestore)
-                        ) {
-
-                        cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)
-                            ((ULONG_PTR)o->pTrampoline
-                                + detour_align_from_target(o->pTrampoline,
-                                (BYTE)(cxt.DETOURS_EIP
-                                    - (DETOURS_EIP_TYPE)(ULONG_PTR)
-                                    o->pbTarget)));
-
-                        NtSetContextThread(t->hThread, &cxt);
-                    }
-                }
+        HANDLE hThread = s_pPendingThreads[n].hThread;
+        if (NT_SUCCESS(NtGetContextThread(hThread, &cxt))) {
+            uintptr_t pc = (uintptr_t)cxt.DETOURS_EIP;
+            if (NSudoDevilModeFixupInstructionPointer(pRanges, cRanges, &pc)) {
+                cxt.DETOURS_EIP = pc;
+                NtSetContextThread(hThread, &cxt);
             }
         }
 #undef DETOURS_EIP
     }
 
+    s_Timings.Fixup += detour_query_counter() - nStart;
+    nStart = detour_query_counter();
+
     // Restore all of the page permissions and flush the icache.
-    for (o = s_pPendingOperations; o != NULL;) {
+    for (o = s_pPendingOperations; o != NULL; o = o->pNext) {
         // We don't care if this fails, because the code is still accessible.
         DWORD dwOld;
         DetourVirtualProtect(
@@ -1753,31 +1858,17 @@ LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID** pppFailedPointer)
             o->pTrampoline = NULL;
             freed = true;
         }
-
-        DetourOperation* n = o->pNext;
-        RtlFreeHeap(RtlProcessHeap(), 0, o);
-        o = n;
-    }
-    s_pPendingOperations = NULL;
-
-    // Free any trampoline regions that are now unused.
-    if (freed && !s_fRetainRegions) {
-        detour_free_unused_trampoline_regions();
     }
 
-    // Make sure the trampoline pages are no longer writable.
-    detour_runnable_trampoline_regions();
+    // Free any trampoline regions that are now unused, and make sure the
+    // trampoline pages are no longer writable.
+    detour_commit_trampoline_regions(freed && !s_fRetainRegions);
+    s_Timings.Protect += detour_query_counter() - nStart;
 
-    // Resume any suspended threads.
-    for (t = s_pPendingThreads; t != NULL;) {
-        // There is nothing we can do if this fails.
-        NtResumeThread(t->hThread, nullptr);
-
-        DetourThread* n = t->pNext;
-        RtlFreeHeap(RtlProcessHeap(), 0, t);
-        t = n;
-    }
-    s_pPendingThreads = NULL;
+    // Resume any suspended threads, then free the operations.
+    detour_resume_pending_threads(s_pPendingOperations);
+    s_pPendingOperations = NULL;
+    s_nPendingOperations = 0;
     s_nPendingThreadId = 0;
 
     if (pppFailedPointer != NULL) {
@@ -1801,33 +1892,149 @@ LONG WINAPI DetourUpdateThread(_In_ HANDLE hThread)
         return NO_ERROR;
     }
 
-    DetourThread* t = reinterpret_cast<DetourThread*>(RtlAllocateHeap(
-        RtlProcessHeap(), 0, sizeof(DetourThread)));
-    if (t == NULL) {
-        error = ERROR_NOT_ENOUGH_MEMORY;
-    fail:
-        if (t != NULL) {
-            RtlFreeHeap(RtlProcessHeap(), 0, t);
-            t = NULL;
-        }
+    // The array may grow while the threads passed by the previous calls are
+    // suspended, DetourUpdateAllThreads reserves it before the first one.
+    ULONG64 nStart = detour_query_counter();
+    NTSTATUS Status = STATUS_NO_MEMORY;
+    if (detour_reserve_pending_threads(s_nPendingThreads + 1)) {
+        Status = detour_suspend_pending_thread(hThread, FALSE);
+    }
+    s_Timings.Suspend += detour_query_counter() - nStart;
+    if (!NT_SUCCESS(Status)) {
+        error = RtlNtStatusToDosError(Status);
         s_nPendingError = error;
         s_ppPendingError = NULL;
         DETOUR_BREAK();
         return error;
     }
 
-    NTSTATUS Status = NtSuspendThread(hThread, nullptr);
+    return NO_ERROR;
+}
+
+static NTSTATUS detour_enumerate_threads(BOOL fSuspend, ULONG* pcThreads)
+{
+    NTSTATUS Result = STATUS_SUCCESS;
+    ULONG cThreads = 0;
+
+    // The previous handle is the cursor of the enumeration, so it is closed
+    // after the next thread is opened unless it is kept by the transaction.
+    HANDLE hThread = NULL;
+    HANDLE hUnused = NULL;
+    for (;;) {
+        NTSTATUS Status = NtGetNextThread(
+            NtCurrentProcess(),
+            hThread,
+            THREAD_QUERY_LIMITED_INFORMATION | THREAD_SUSPEND_RESUME |
+            THREAD_GET_CONTEXT | THREAD_SET_CONTEXT,
+            0,
+            0,
+            &hThread);
+        if (hUnused != NULL) {
+            NtClose(hUnused);
+            hUnused = NULL;
+        }
+        if (!NT_SUCCESS(Status)) {
+            if (Status != STATUS_NO_MORE_ENTRIES) {
+                Result = Status;
+            }
+            break;
+        }
+
+        // Skip our own thread, and the threads which can't be identified.
+        THREAD_BASIC_INFORMATION tbi;
+        Status = NtQueryInformationThread(
+            hThread,
+            ThreadBasicInformation,
+            &tbi,
+            sizeof(tbi),
+            NULL);
+        if (!NT_SUCCESS(Status) ||
+            tbi.ClientId.UniqueThread == NtCurrentThreadId()) {
+            hUnused = hThread;
+            continue;
+        }
+
+        cThreads++;
+        if (!fSuspend) {
+            hUnused = hThread;
+            continue;
+        }
+
+        Status = detour_suspend_pending_thread(hThread, TRUE);
+        if (!NT_SUCCESS(Status)) {
+            hUnused = hThread;
+
+            // The threads which are terminating are skipped.
+            if (Status == STATUS_BUFFER_TOO_SMALL) {
+                Result = Status;
+                break;
+            }
+        }
+    }
+    if (hUnused != NULL) {
+        NtClose(hUnused);
+    }
+
+    *pcThreads = cThreads;
+    return Result;
+}
+
+// Suspends all threads of the process except the calling thread. The threads
+// are counted first and the array is reserved with some slack before any of
+// them is suspended. If more threads are created in between, the threads of
+// the pass are resumed and the enumeration is retried with a larger array.
+// Call it after the DetourAttach and DetourDetach calls of the transaction,
+// so the commit doesn't touch the process heap until the threads resume.
+LONG WINAPI DetourUpdateAllThreads()
+{
+    LONG error = NO_ERROR;
+
+    // If any of the pending operations failed, then we don't need to do this.
+    if (s_nPendingError != NO_ERROR) {
+        return s_nPendingError;
+    }
+
+    ULONG64 nStart = detour_query_counter();
+
+    ULONG nFirst = s_nPendingThreads;
+    ULONG cThreads = 0;
+    NTSTATUS Status = detour_enumerate_threads(FALSE, &cThreads);
+    while (NT_SUCCESS(Status)) {
+        ULONG cReserve = cThreads + cThreads / 4 + 16;
+        if (!detour_reserve_pending_threads(nFirst + cReserve)) {
+            Status = STATUS_NO_MEMORY;
+            break;
+        }
+
+        Status = detour_enumerate_threads(TRUE, &cThreads);
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        // The enumeration stopped at the full array, so the next snapshot
+        // must be larger than this one.
+        detour_resume_pending_threads_from(nFirst);
+        cThreads = cReserve + 1;
+        Status = STATUS_SUCCESS;
+    }
     if (!NT_SUCCESS(Status)) {
         error = RtlNtStatusToDosError(Status);
-        DETOUR_BREAK();
-        goto fail;
     }
 
-    t->hThread = hThread;
-    t->pNext = s_pPendingThreads;
-    s_pPendingThreads = t;
+    s_Timings.Suspend += detour_query_counter() - nStart;
 
-    return NO_ERROR;
+    if (error != NO_ERROR) {
+        s_nPendingError = error;
+        s_ppPendingError = NULL;
+        DETOUR_BREAK();
+    }
+    return error;
+}
+
+VOID WINAPI DetourGetTransactionTimings(
+    _Out_ PDETOUR_TRANSACTION_TIMINGS pTimings)
+{
+    *pTimings = s_Timings;
 }
 
 ///////////////////////////////////////////////////////////// Transacted APIs.
@@ -1912,7 +2119,7 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID* ppPointer,
 
     o = reinterpret_cast<DetourOperation*>(RtlAllocateHeap(
         RtlProcessHeap(), 0, sizeof(DetourOperation)));
-    if (o == NULL) {
+    if (o == NULL || !detour_reserve_pending_ranges(s_nPendingOperations + 1)) {
         error = ERROR_NOT_ENOUGH_MEMORY;
     fail:
         s_nPendingError = error;
@@ -1986,6 +2193,49 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID* ppPointer,
     }
 #endif
 
+#if defined(DETOURS_X86) || defined(DETOURS_X64)
+    // Decode the target once and relocate all of the moved instructions.
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+    NSUDO_DEVIL_MODE_RELOCATION_STATUS Status = NSudoDevilModePlanRelocation(
+        pbSrc,
+        NSUDO_DEVIL_MODE_MAXIMUM_RELOCATION_WINDOW,
+        (ULONG_PTR)pbSrc,
+        (ULONG_PTR)pbTrampoline,
+        cbJump,
+#ifdef DETOURS_X64
+        true,
+#else
+        false,
+#endif
+        &Relocation);
+    if (Status == NSudoDevilModeRelocationSuccess) {
+        Status = NSudoDevilModeEmitRelocation(
+            &Relocation,
+            pbSrc,
+            pbTrampoline,
+            sizeof(pTrampoline->rbCode));
+    }
+    if (Status != NSudoDevilModeRelocationSuccess &&
+        Status != NSudoDevilModeRelocationTooSmall) {
+        DETOUR_TRACE((" NSudoDevilModePlanRelocation() = %d\n", Status));
+        error = ERROR_INVALID_BLOCK;
+        DETOUR_BREAK();
+        goto fail;
+    }
+
+    for (nAlign = 0; nAlign < Relocation.InstructionCount; nAlign++) {
+        const NSUDO_DEVIL_MODE_RELOCATED_INSTRUCTION& Instruction =
+            Relocation.Instructions[nAlign];
+        pTrampoline->rAlign[nAlign].obTarget =
+            Instruction.SourceOffset + Instruction.Instruction.Length;
+        pTrampoline->rAlign[nAlign].obTrampoline =
+            Instruction.DestinationOffset + Instruction.DestinationLength;
+    }
+
+    pbSrc += Relocation.SourceSize;
+    pbTrampoline += Relocation.DestinationSize;
+    cbTarget = (ULONG)Relocation.SourceSize;
+#else
     while (cbTarget < cbJump) {
         PBYTE pbOp = pbSrc;
         LONG lExtra = 0;
@@ -2021,6 +2271,7 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID* ppPointer,
         pbSrc += cFiller;
         cbTarget = (LONG)(pbSrc - pbTarget);
     }
+#endif // DETOURS_X86 || DETOURS_X64
 
 #if DETOUR_DEBUG
     {
@@ -2134,6 +2385,7 @@ LONG WINAPI DetourAttachEx(_Inout_ PVOID* ppPointer,
     o->dwPerm = dwOld;
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
+    s_nPendingOperations++;
 
     return NO_ERROR;
 }
@@ -2168,7 +2420,7 @@ LONG WINAPI DetourDetach(_Inout_ PVOID* ppPointer,
 
     DetourOperation* o = reinterpret_cast<DetourOperation*>(RtlAllocateHeap(
         RtlProcessHeap(), 0, sizeof(DetourOperation)));
-    if (o == NULL) {
+    if (o == NULL || !detour_reserve_pending_ranges(s_nPendingOperations + 1)) {
         error = ERROR_NOT_ENOUGH_MEMORY;
     fail:
         s_nPendingError = error;
@@ -2232,6 +2484,7 @@ LONG WINAPI DetourDetach(_Inout_ PVOID* ppPointer,
     o->dwPerm = dwOld;
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
+    s_nPendingOperations++;
 
     return NO_ERROR;
 }
@@ -350,6 +350,20 @@ extern const GUID DETOUR_EXE_HELPER_GUID;
 #define DETOUR_TRAMPOLINE_SIGNATURE             0x21727444  // Dtr!
 typedef struct _DETOUR_TRAMPOLINE DETOUR_TRAMPOLINE, *PDETOUR_TRAMPOLINE;
 
+// Time spent in each phase of the last transaction, in performance counter
+// ticks.
+typedef struct _DETOUR_TRANSACTION_TIMINGS
+{
+    ULONG64 Frequency;          // Performance counter ticks per second.
+    ULONG64 Suspend;            // Suspending the threads.
+    ULONG64 Patch;              // Writing the jumps and the original code.
+    ULONG64 Fixup;              // Moving the instruction pointers.
+    ULONG64 Protect;            // Restoring the page permissions.
+    ULONG64 Resume;             // Resuming the threads.
+    ULONG   ThreadCount;        // Number of the suspended threads.
+    ULONG   OperationCount;     // Number of the attaches and detaches.
+} DETOUR_TRANSACTION_TIMINGS, *PDETOUR_TRANSACTION_TIMINGS;
+
 //////////////////////////////////////////////////////////// Transaction APIs.
 //
 LONG WINAPI DetourTransactionBegin(VOID);
@@ -358,6 +372,9 @@ LONG WINAPI DetourTransactionCommit(VOID);
 LONG WINAPI DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer);
 
 LONG WINAPI DetourUpdateThread(_In_ HANDLE hThread);
+LONG WINAPI DetourUpdateAllThreads(VOID);
+VOID WINAPI DetourGetTransactionTimings(
+    _Out_ PDETOUR_TRANSACTION_TIMINGS pTimings);
 
 LONG WINAPI DetourAttach(_Inout_ PVOID *ppPointer,
                          _In_ PVOID pDetour);
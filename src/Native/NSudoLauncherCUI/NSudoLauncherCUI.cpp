@@ -21,6 +21,9 @@
 
 #include "NSudoAPI.h"
 #include <Mile.Windows.h>
+#include <Mile.Platform.Windows.h>
+#include <Mile.Platform.Output.h>
+#include <Mile.Platform.Resource.h>
 
 #include "M2WindowsHelpers.h"
 
@@ -49,60 +52,6 @@
 #pragma warning(disable:4505) // 未引用的本地函数已移除(等级 4)
 #endif
 
-/**
- * The resource info struct.
- */
-typedef struct _M2_RESOURCE_INFO
-{
-    DWORD Size;
-    LPVOID Pointer;
-} M2_RESOURCE_INFO, * PM2_RESOURCE_INFO;
-
-/**
- * Obtain the best matching resource with the specified type and name in the
- * specified module.
- *
- * @param lpResourceInfo The resource info which contains the pointer and size.
- * @param hModule A handle to the module whose portable executable file or an
- *                accompanying MUI file contains the resource. If this
- *                parameter is NULL, the function searches the module used to
- *                create the current process.
- * @param lpType The resource type. Alternately, rather than a pointer, this
- *               parameter can be MAKEINTRESOURCE(ID), where ID is the integer
- *               identifier of the given resource type.
- * @param lpName The name of the resource. Alternately, rather than a pointer,
- *               this parameter can be MAKEINTRESOURCE(ID), where ID is the
- *               integer identifier of the resource.
- * @return HRESULT. If the function succeeds, the return value is S_OK.
- */
-HRESULT M2LoadResource(
-    _Out_ PM2_RESOURCE_INFO lpResourceInfo,
-    _In_opt_ HMODULE hModule,
-    _In_ LPCWSTR lpType,
-    _In_ LPCWSTR lpName)
-{
-    if (!lpResourceInfo)
-        return E_INVALIDARG;
-
-    lpResourceInfo->Size = 0;
-    lpResourceInfo->Pointer = nullptr;
-
-    HRSRC ResourceFind = FindResourceExW(
-        hModule, lpType, lpName, MAKELANGID(LANG_NEUTRAL, SUBLANG_NEUTRAL));
-    if (!ResourceFind)
-        return ::HRESULT_FROM_WIN32(::GetLastError());
-
-    lpResourceInfo->Size = SizeofResource(hModule, ResourceFind);
-
-    HGLOBAL ResourceLoad = LoadResource(hModule, ResourceFind);
-    if (!ResourceLoad)
-        return ::HRESULT_FROM_WIN32(::GetLastError());
-
-    lpResourceInfo->Pointer = LockResource(ResourceLoad);
-
-    return S_OK;
-}
-
 std::wstring GetMessageByID(DWORD MessageID)
 {
     std::wstring MessageString;
@@ -125,88 +74,7 @@ std::wstring GetMessageByID(DWORD MessageID)
     return MessageString;
 }
 
-#include "jsmn.h"
-
-bool JsmnParseJson(
-    _Out_ jsmntok_t** JsonTokens,
-    _Out_ std::int32_t* JsonTokensCount,
-    _In_ const char* JsonString,
-    _In_ std::size_t JsonStringLength)
-{
-    if (!(JsonTokens && JsonTokensCount && JsonString && JsonStringLength))
-    {
-        return false;
-    }
-
-    *JsonTokens = nullptr;
-    *JsonTokensCount = 0;
-
-    jsmn_parser Parser;
-
-    ::jsmn_init(&Parser);
-    std::int32_t TokenCount = ::jsmn_parse(
-        &Parser, JsonString, JsonStringLength, nullptr, 0);
-
-    jsmntok_t* Tokens = reinterpret_cast<jsmntok_t*>(::malloc(
-        TokenCount * sizeof(jsmntok_t)));
-    if (Tokens)
-    {
-        ::jsmn_init(&Parser);
-        std::int32_t TokensCount = ::jsmn_parse(
-            &Parser, JsonString, JsonStringLength, Tokens, TokenCount);
-        if (TokensCount > 0)
-        {
-            *JsonTokens = Tokens;
-            *JsonTokensCount = TokensCount;
-        }
-        else
-        {
-            ::free(Tokens);
-        }
-    }
-
-    return Tokens;
-}
-
-typedef struct _JSON_TOKEN_INFO
-{
-    jsmntype_t Type;
-    const char* Name;
-    std::size_t NameLength;
-    int Size;
-} JSON_TOKEN_INFO, * PJSON_TOKEN_INFO;
-
-void JsmnGetTokenInfo(
-    _Out_ PJSON_TOKEN_INFO JsonTokenInfo,
-    _In_ const char* JsonString,
-    _In_ jsmntok_t* JsonToken)
-{
-    JsonTokenInfo->Type = JsonToken->type;
-    JsonTokenInfo->Name = JsonString + JsonToken->start;
-    JsonTokenInfo->NameLength = JsonToken->end - JsonToken->start;
-    JsonTokenInfo->Size = JsonToken->size;
-}
-
-bool JsmnJsonEqual(
-    _In_ const char* JsonString,
-    _In_ jsmntok_t* JsonToken,
-    _In_ const char* String)
-{
-    if (JsonToken->type == JSMN_STRING)
-    {
-        const char* CurrentToken = JsonString + JsonToken->start;
-        std::size_t CurrentTokenLength = JsonToken->end - JsonToken->start;
-        if (::strlen(String) == CurrentTokenLength)
-        {
-            if (::strncmp(CurrentToken, String, CurrentTokenLength) == 0)
-            {
-                return true;
-            }
-        }
-    }
-
-    return false;
-}
+#include <NSudoLauncherJson.h>
 
 #if _MSC_VER >= 1200
 #pragma warning(pop)
@@ -252,23 +120,23 @@ const char* NSudoMessageTranslationID[] =
 class CNSudoTranslationAdapter
 {
 private:
-    static std::wstring GetUTF8WithBOMStringResources(
-        _In_ UINT uID)
+    static const Mile::ResourceIndex& GetStringResources()
     {
-        M2_RESOURCE_INFO ResourceInfo = { 0 };
-        if (SUCCEEDED(M2LoadResource(
-            &ResourceInfo,
-            GetModuleHandleW(nullptr),
-            L"String",
-            MAKEINTRESOURCEW(uID))))
-        {
-            // Raw string without the UTF-8 BOM. (0xEF,0xBB,0xBF)	
-            return M2MakeUTF16String(std::string(
-                reinterpret_cast<const char*>(ResourceInfo.Pointer) + 3,
-                ResourceInfo.Size - 3));
-        }
+        // The index is built at the first use, the views of the resources
+        // refer to the locked resources without copying them.
+        static Mile::ResourceIndex Resources;
+        static const bool IsLoaded = Resources.Load(nullptr, L"String");
+        UNREFERENCED_PARAMETER(IsLoaded);
+        return Resources;
+    }
 
-        return L"";
+public:
+    static std::string_view GetUTF8StringResource(
+        _In_ UINT uID)
+    {
+        const Mile::ResourceView* View =
+            CNSudoTranslationAdapter::GetStringResources().Find(uID);
+        return View ? View->Content : std::string_view();
     }
 
 public:
@@ -287,27 +155,13 @@ public:
             L"© M2-Team. All rights reserved.\r\n"
             L"\r\n"));
 
-        StringTranslations.emplace(std::make_pair(
-            "NSudo.String.Links",
-            CNSudoTranslationAdapter::GetUTF8WithBOMStringResources(
-                IDR_STRING_LINKS)));
-
-        StringTranslations.emplace(std::make_pair(
-            "NSudo.String.CommandLineHelp",
-            CNSudoTranslationAdapter::GetUTF8WithBOMStringResources(
-                IDR_STRING_COMMAND_LINE_HELP)));
-
-        M2_RESOURCE_INFO ResourceInfo = { 0 };
-        if (SUCCEEDED(M2LoadResource(
-            &ResourceInfo,
-            GetModuleHandleW(nullptr),
-            L"String",
-            MAKEINTRESOURCEW(IDR_STRING_TRANSLATIONS))))
+        std::string_view Translations =
+            CNSudoTranslationAdapter::GetUTF8StringResource(
+                IDR_STRING_TRANSLATIONS);
+        if (!Translations.empty())
         {
-            const char* JsonString =
-                reinterpret_cast<const char*>(ResourceInfo.Pointer) + 3;
-            std::size_t JsonStringLength =
-                ResourceInfo.Size - 3;
+            const char* JsonString = Translations.data();
+            std::size_t JsonStringLength = Translations.size();
 
             jsmntok_t* JsonTokens = nullptr;
             std::int32_t JsonTokensCount = 0;
@@ -317,40 +171,21 @@ public:
                 JsonString,
                 JsonStringLength))
             {
-                for (size_t i = 0; i < static_cast<size_t>(JsonTokensCount); ++i)
-                {
-                    if (JsmnJsonEqual(
-                        JsonString,
-                        &JsonTokens[i],
-                        "Translations"))
+                JsmnEnumerateStringMembers(
+                    JsonString,
+                    JsonTokens,
+                    JsonTokensCount,
+                    "Translations",
+                    [&](const jsmntok_t& Key, const jsmntok_t& Value)
                     {
-                        if (JsonTokens[i + 1].type != JSMN_OBJECT)
-                        {
-                            continue;
-                        }
-
-                        for (size_t j = 0; j < static_cast<size_t>(JsonTokens[i + 1].size); ++j)
-                        {
-                            jsmntok_t& Key = JsonTokens[i + (j * 2) + 2];
-                            jsmntok_t& Value = JsonTokens[i + (j * 2) + 3];
-
-                            if (Key.type != JSMN_STRING ||
-                                Value.type != JSMN_STRING)
-                            {
-                                continue;
-                            }
-
-                            StringTranslations.emplace(std::make_pair(
-                                std::string(
-                                    JsonString + Key.start,
-                                    Key.end - Key.start),
-                                M2MakeUTF16String(std::string(
-                                    JsonString + Value.start,
-                                    Value.end - Value.start))));
-                        }
-                        i += JsonTokens[i + 1].size + 1;
-                    }
-                }
+                        StringTranslations.emplace(std::make_pair(
+                            std::string(
+                                JsonString + Key.start,
+                                Key.end - Key.start),
+                            M2MakeUTF16String(
+                                JsonString + Value.start,
+                                Value.end - Value.start)));
+                    });
 
                 ::free(JsonTokens);
             }
@@ -402,8 +237,12 @@ public:
                         nullptr);
                     if (hr == S_OK)
                     {
-                        const char* JsonString = FileContent + 3;
-                        std::size_t JsonStringLength = NumberOfBytesRead - 3;
+                        // The file usually starts with a UTF-8 BOM.
+                        Mile::ResourceView Content = Mile::MakeResourceView(
+                            FileContent,
+                            NumberOfBytesRead);
+                        const char* JsonString = Content.Content.data();
+                        std::size_t JsonStringLength = Content.Content.size();
 
                         jsmntok_t* JsonTokens = nullptr;
                         std::int32_t JsonTokensCount = 0;
@@ -413,40 +252,23 @@ public:
                             JsonString,
                             JsonStringLength))
                         {
-                            for (size_t i = 0; i < static_cast<size_t>(JsonTokensCount); ++i)
-                            {
-                                if (JsmnJsonEqual(
-                                    JsonString,
-                                    &JsonTokens[i],
-                                    "ShortCutList_V2"))
+                            JsmnEnumerateStringMembers(
+                                JsonString,
+                                JsonTokens,
+                                JsonTokensCount,
+                                "ShortCutList_V2",
+                                [&](
+                                    const jsmntok_t& Key,
+                                    const jsmntok_t& Value)
                                 {
-                                    if (JsonTokens[i + 1].type != JSMN_OBJECT)
-                                    {
-                                        continue;
-                                    }
-
-                                    for (size_t j = 0; j < static_cast<size_t>(JsonTokens[i + 1].size); ++j)
-                                    {
-                                        jsmntok_t& Key = JsonTokens[i + (j * 2) + 2];
-                                        jsmntok_t& Value = JsonTokens[i + (j * 2) + 3];
-
-                                        if (Key.type != JSMN_STRING ||
-                                            Value.type != JSMN_STRING)
-                                        {
-                                            continue;
-                                        }
-
-                                        ShortCutList.emplace(std::make_pair(
-                                            M2MakeUTF16String(std::string(
-                                                JsonString + Key.start,
-                                                Key.end - Key.start)),
-                                            M2MakeUTF16String(std::string(
-                                                JsonString + Value.start,
-                                                Value.end - Value.start))));
-                                    }
-                                    i += JsonTokens[i + 1].size + 1;
-                                }
-                            }
+                                    ShortCutList.emplace(std::make_pair(
+                                        M2MakeUTF16String(
+                                            JsonString + Key.start,
+                                            Key.end - Key.start),
+                                        M2MakeUTF16String(
+                                            JsonString + Value.start,
+                                            Value.end - Value.start)));
+                                });
 
                             ::free(JsonTokens);
                         }
@@ -542,6 +364,18 @@ public:
         return this->m_StringTranslations[Key];
     }
 
+    std::wstring_view GetTranslationView(
+        _In_ const std::string& Key) const
+    {
+        auto Iterator = this->m_StringTranslations.find(Key);
+        if (Iterator == this->m_StringTranslations.end())
+        {
+            return std::wstring_view();
+        }
+
+        return Iterator->second;
+    }
+
     std::wstring GetMessageString(
         _In_ NSUDO_MESSAGE MessageID)
     {
@@ -551,6 +385,46 @@ public:
 
 CNSudoResourceManagement g_ResourceManagement;
 
+/**
+ * Prints the stages of the last launch to the console.
+ */
+void NSudoPrintLaunchTrace()
+{
+    DWORD Count = 0;
+    std::vector<NSUDO_LAUNCH_TRACE_EVENT> Events;
+    HRESULT hr = ::HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    while (hr == ::HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER))
+    {
+        Events.resize(Count);
+        hr = NSudoGetLaunchTrace(Events.data(), Count, &Count);
+    }
+    if (hr != S_OK)
+    {
+        return;
+    }
+
+    DWORD Length = 0;
+    std::wstring Trace;
+    hr = ::HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    while (hr == ::HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER))
+    {
+        Trace.resize(Length);
+        hr = NSudoFormatLaunchTrace(
+            Events.data(),
+            Count,
+            Length ? &Trace[0] : nullptr,
+            Length,
+            &Length);
+    }
+    if (hr != S_OK)
+    {
+        return;
+    }
+
+    Mile::OutputSink Output(GetStdHandle(STD_OUTPUT_HANDLE));
+    Output.Write(std::wstring_view(Trace.c_str(), Length - 1));
+}
+
 // 解析命令行
 NSUDO_MESSAGE NSudoCommandLineParser(
     _In_ std::wstring& ApplicationName,
@@ -588,6 +462,7 @@ NSUDO_MESSAGE NSudoCommandLineParser(
     DWORD WaitInterval = 0;
     std::wstring CurrentDirectory = g_ResourceManagement.AppPath;
     BOOL CreateNewConsole = TRUE;
+    bool PrintTrace = false;
 
     NSUDO_USER_MODE_TYPE UserModeType =
         NSUDO_USER_MODE_TYPE::DEFAULT;
@@ -742,6 +617,10 @@ NSUDO_MESSAGE NSudoCommandLineParser(
         {
             CreateNewConsole = FALSE;
         }
+        else if (0 == _wcsicmp(OptionAndParameter.first.c_str(), L"Trace"))
+        {
+            PrintTrace = true;
+        }
         else
         {
             bArgErr = true;
@@ -754,7 +633,7 @@ NSUDO_MESSAGE NSudoCommandLineParser(
         return NSUDO_MESSAGE::INVALID_COMMAND_PARAMETER;
     }
 
-    if (NSudoCreateProcess(
+    HRESULT hr = NSudoCreateProcess(
         UserModeType,
         PrivilegesModeType,
         MandatoryLabelType,
@@ -763,7 +642,14 @@ NSUDO_MESSAGE NSudoCommandLineParser(
         WaitInterval,
         CreateNewConsole,
         UnresolvedCommandLine.c_str(),
-        CurrentDirectory.c_str()) != S_OK)
+        CurrentDirectory.c_str());
+
+    if (PrintTrace)
+    {
+        NSudoPrintLaunchTrace();
+    }
+
+    if (hr != S_OK)
     {
         return NSUDO_MESSAGE::CREATE_PROCESS_FAILED;
     }
@@ -776,44 +662,35 @@ void NSudoPrintMsg(
     _In_opt_ HWND hWnd,
     _In_ LPCWSTR lpContent)
 {
-    std::wstring DialogContent =
-        g_ResourceManagement.GetTranslation("NSudo.LogoText") +
-        lpContent +
-        g_ResourceManagement.GetTranslation("NSudo.String.Links");
-
     UNREFERENCED_PARAMETER(hInstance);
     UNREFERENCED_PARAMETER(hWnd);
 
-    DWORD NumberOfCharsWritten = 0;
-    WriteConsoleW(
-        GetStdHandle(STD_OUTPUT_HANDLE),
-        DialogContent.c_str(),
-        (DWORD)DialogContent.size(),
-        &NumberOfCharsWritten,
-        nullptr);
+    Mile::OutputSink Output(GetStdHandle(STD_OUTPUT_HANDLE));
+    Output.Write({
+        g_ResourceManagement.GetTranslationView("NSudo.LogoText"),
+        lpContent,
+        CNSudoTranslationAdapter::GetUTF8StringResource(IDR_STRING_LINKS) });
 }
 
 HRESULT NSudoShowAboutDialog(
     _In_ HWND hwndParent)
 {
-    std::wstring DialogContent =
-        g_ResourceManagement.GetTranslation("NSudo.LogoText") +
-        g_ResourceManagement.GetTranslation("NSudo.String.CommandLineHelp") +
-        g_ResourceManagement.GetTranslation("NSudo.String.Links");
-
-    SetLastError(ERROR_SUCCESS);
-
     UNREFERENCED_PARAMETER(hwndParent);
 
-    DWORD NumberOfCharsWritten = 0;
-    WriteConsoleW(
-        GetStdHandle(STD_OUTPUT_HANDLE),
-        DialogContent.c_str(),
-        (DWORD)DialogContent.size(),
-        &NumberOfCharsWritten,
-        nullptr);
+    // The help text is written from the UTF-8 resources without copying,
+    // and it is transcoded if the output is redirected.
+    Mile::OutputSink Output(GetStdHandle(STD_OUTPUT_HANDLE));
+    if (!Output.Write({
+        g_ResourceManagement.GetTranslationView("NSudo.LogoText"),
+        CNSudoTranslationAdapter::GetUTF8StringResource(
+            IDR_STRING_COMMAND_LINE_HELP),
+        CNSudoTranslationAdapter::GetUTF8StringResource(IDR_STRING_LINKS) }) ||
+        !Output.Flush())
+    {
+        return ::HRESULT_FROM_WIN32(::GetLastError());
+    }
 
-    return ::HRESULT_FROM_WIN32(::GetLastError());
+    return S_OK;
 }
 
 int main()
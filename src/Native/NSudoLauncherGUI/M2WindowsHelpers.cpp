@@ -10,6 +10,8 @@
 
 #include "M2WindowsHelpers.h"
 
+#include <NSudoLauncherCommandLine.h>
+
 #include <Mile.Windows.h>
 
 #ifdef _M2_WINDOWS_HELPERS_
@@ -102,10 +104,14 @@ HRESULT M2ThrownPlatformExceptionToHResult()
 /**
  * Converts from the UTF-8 string to the UTF-16 string.
  *
- * @param UTF8String The UTF-8 string you want to convert.
+ * @param UTF8String The UTF-8 string you want to convert, it does not need
+ *                   to be terminated by NUL.
+ * @param UTF8StringLength The number of the bytes of the UTF-8 string.
  * @return A converted UTF-16 string.
  */
-std::wstring M2MakeUTF16String(const std::string& UTF8String)
+std::wstring M2MakeUTF16String(
+    const char* UTF8String,
+    std::size_t UTF8StringLength)
 {
     std::wstring UTF16String;
 
@@ -114,8 +120,8 @@ std::wstring M2MakeUTF16String(const std::string& UTF8String)
     HRESULT hr = ::MileMultiByteToWideChar(
         CP_UTF8,
         0,
-        UTF8String.data(),
-        static_cast<int>(UTF8String.size()),
+        UTF8String,
+        static_cast<int>(UTF8StringLength),
         nullptr,
         0,
         &UTF16StringLength);
@@ -125,8 +131,8 @@ std::wstring M2MakeUTF16String(const std::string& UTF8String)
         ::MileMultiByteToWideChar(
             CP_UTF8,
             0,
-            UTF8String.data(),
-            static_cast<int>(UTF8String.size()),
+            UTF8String,
+            static_cast<int>(UTF8StringLength),
             &UTF16String[0],
             UTF16StringLength,
             nullptr);
@@ -135,6 +141,17 @@ std::wstring M2MakeUTF16String(const std::string& UTF8String)
     return UTF16String;
 }
 
+/**
+ * Converts from the UTF-8 string to the UTF-16 string.
+ *
+ * @param UTF8String The UTF-8 string you want to convert.
+ * @return A converted UTF-16 string.
+ */
+std::wstring M2MakeUTF16String(const std::string& UTF8String)
+{
+    return M2MakeUTF16String(UTF8String.data(), UTF8String.size());
+}
+
 /**
  * Converts from the UTF-16 string to the UTF-8 string.
  *
@@ -219,149 +236,6 @@ std::wstring M2FormatString(
     return L"N/A";
 }
 
-/**
- * Parses a command line string and returns an array of the command line
- * arguments, along with a count of such arguments, in a way that is similar to
- * the standard C run-time.
- *
- * @param CommandLine A string that contains the full command line. If this
- *                    parameter is an empty string the function returns an
- *                    array with only one empty string.
- * @return An array of the command line arguments, along with a count of such
- *         arguments.
- */
-std::vector<std::wstring> M2SpiltCommandLine(
-    const std::wstring& CommandLine)
-{
-    // Initialize the SplitArguments.
-    std::vector<std::wstring> SplitArguments;
-
-    wchar_t c = L'\0';
-    int copy_character;                   /* 1 = copy char to *args */
-    unsigned numslash;              /* num of backslashes seen */
-
-    std::wstring Buffer;
-    Buffer.reserve(CommandLine.size());
-
-    /* first scan the program name, copy it, and count the bytes */
-    wchar_t* p = const_cast<wchar_t*>(CommandLine.c_str());
-
-    // A quoted program name is handled here. The handling is much simpler than
-    // for other arguments. Basically, whatever lies between the leading
-    // double-quote and next one, or a terminal null character is simply
-    // accepted. Fancier handling is not required because the program name must
-    // be a legal NTFS/HPFS file name. Note that the double-quote characters are
-    // not copied, nor do they contribute to character_count.
-    bool InQuotes = false;
-    do
-    {
-        if (*p == '"')
-        {
-            InQuotes = !InQuotes;
-            c = *p++;
-            continue;
-        }
-
-        // Copy character into argument:
-        Buffer.push_back(*p);
-
-        c = *p++;
-    } while (c != '\0' && (InQuotes || (c != ' ' && c != '\t')));
-
-    if (c == '\0')
-    {
-        p--;
-    }
-    else
-    {
-        Buffer.resize(Buffer.size() - 1);
-    }
-
-    // Save te argument.
-    SplitArguments.push_back(Buffer);
-
-    InQuotes = false;
-
-    // Loop on each argument
-    for (;;)
-    {
-        if (*p)
-        {
-            while (*p == ' ' || *p == '\t')
-                ++p;
-        }
-
-        // End of arguments
-        if (*p == '\0')
-            break;
-
-        // Initialize the argument buffer.
-        Buffer.clear();
-
-        // Loop through scanning one argument:
-        for (;;)
-        {
-            copy_character = 1;
-
-            // Rules: 2N backslashes + " ==> N backslashes and begin/end quote
-            // 2N + 1 backslashes + " ==> N backslashes + literal " N
-            // backslashes ==> N backslashes
-            numslash = 0;
-
-            while (*p == '\\')
-            {
-                // Count number of backslashes for use below
-                ++p;
-                ++numslash;
-            }
-
-            if (*p == '"')
-            {
-                // if 2N backslashes before, start/end quote, otherwise copy
-                // literally:
-                if (numslash % 2 == 0)
-                {
-                    if (InQuotes && p[1] == '"')
-                    {
-                        p++; // Double quote inside quoted string
-                    }
-                    else
-                    {
-                        // Skip first quote char and copy second:
-                        copy_character = 0; // Don't copy quote
-                        InQuotes = !InQuotes;
-                    }
-                }
-
-                numslash /= 2;
-            }
-
-            // Copy slashes:
-            while (numslash--)
-            {
-                Buffer.push_back(L'\\');
-            }
-
-            // If at end of arg, break loop:
-            if (*p == '\0' || (!InQuotes && (*p == ' ' || *p == '\t')))
-                break;
-
-            // Copy character into argument:
-            if (copy_character)
-            {
-                Buffer.push_back(*p);
-            }
-
-            ++p;
-        }
-
-        // Save te argument.
-        SplitArguments.push_back(Buffer);
-    }
-
-    return SplitArguments;
-}
-
 /**
  * Parses a command line string and get more friendly result.
  *
@@ -458,12 +332,12 @@ void M2SpiltCommandLineEx(
                     const_cast<wchar_t*>(CommandLine.c_str()) + (arg_size - 1);
 
                 // Get the unresolved command line. Search for the beginning of
-                // the first parameter delimiter called space and exclude the
-                // first space by adding 1 to the result.
-                wchar_t* command = wcsstr(search_start, L" ") + 1;
+                // the first parameter delimiter, which is a space or a tab as
+                // M2SpiltCommandLine treats them, and exclude it.
+                wchar_t* command = wcspbrk(search_start, L" \t");
 
-                // Omit the space. (Thanks to wzzw.)
-                while (command && *command == L' ')
+                // Omit the delimiters. (Thanks to wzzw.)
+                while (command && (*command == L' ' || *command == L'\t'))
                 {
                     ++command;
                 }
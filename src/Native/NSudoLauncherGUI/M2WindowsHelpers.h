@@ -616,6 +616,18 @@ HRESULT M2ThrownPlatformExceptionToHResult();
 
 #pragma region String
 
+/**
+ * Converts from the UTF-8 string to the UTF-16 string.
+ *
+ * @param UTF8String The UTF-8 string you want to convert, it does not need
+ *                   to be terminated by NUL.
+ * @param UTF8StringLength The number of the bytes of the UTF-8 string.
+ * @return A converted UTF-16 string.
+ */
+std::wstring M2MakeUTF16String(
+    const char* UTF8String,
+    std::size_t UTF8StringLength);
+
 /**
  * Converts from the UTF-8 string to the UTF-16 string.
  *
@@ -643,20 +655,6 @@ std::wstring M2FormatString(
     _In_z_ _Printf_format_string_ wchar_t const* const Format,
     ...);
 
-/**
- * Parses a command line string and returns an array of the command line
- * arguments, along with a count of such arguments, in a way that is similar to
- * the standard C run-time.
- *
- * @param CommandLine A string that contains the full command line. If this
- *                    parameter is an empty string the function returns an
- *                    array with only one empty string.
- * @return An array of the command line arguments, along with a count of such
- *         arguments.
- */
-std::vector<std::wstring> M2SpiltCommandLine(
-    const std::wstring& CommandLine);
-
 /**
  * Parses a command line string and get more friendly result.
  *
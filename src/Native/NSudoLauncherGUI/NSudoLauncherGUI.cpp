@@ -21,6 +21,9 @@
 
 #include "NSudoAPI.h"
 #include <Mile.Windows.h>
+#include <Mile.Platform.Windows.h>
+#include <Mile.Platform.Output.h>
+#include <Mile.Platform.Resource.h>
 
 #include "M2WindowsHelpers.h"
 #include "M2Win32GUIHelpers.h"
@@ -62,60 +65,6 @@
 #pragma warning(disable:4505) // 未引用的本地函数已移除(等级 4)
 #endif
 
-/**
- * The resource info struct.
- */
-typedef struct _M2_RESOURCE_INFO
-{
-    DWORD Size;
-    LPVOID Pointer;
-} M2_RESOURCE_INFO, * PM2_RESOURCE_INFO;
-
-/**
- * Obtain the best matching resource with the specified type and name in the
- * specified module.
- *
- * @param lpResourceInfo The resource info which contains the pointer and size.
- * @param hModule A handle to the module whose portable executable file or an
- *                accompanying MUI file contains the resource. If this
- *                parameter is NULL, the function searches the module used to
- *                create the current process.
- * @param lpType The resource type. Alternately, rather than a pointer, this
- *               parameter can be MAKEINTRESOURCE(ID), where ID is the integer
- *               identifier of the given resource type.
- * @param lpName The name of the resource. Alternately, rather than a pointer,
- *               this parameter can be MAKEINTRESOURCE(ID), where ID is the
- *               integer identifier of the resource.
- * @return HRESULT. If the function succeeds, the return value is S_OK.
- */
-HRESULT M2LoadResource(
-    _Out_ PM2_RESOURCE_INFO lpResourceInfo,
-    _In_opt_ HMODULE hModule,
-    _In_ LPCWSTR lpType,
-    _In_ LPCWSTR lpName)
-{
-    if (!lpResourceInfo)
-        return E_INVALIDARG;
-
-    lpResourceInfo->Size = 0;
-    lpResourceInfo->Pointer = nullptr;
-
-    HRSRC ResourceFind = FindResourceExW(
-        hModule, lpType, lpName, MAKELANGID(LANG_NEUTRAL, SUBLANG_NEUTRAL));
-    if (!ResourceFind)
-        return ::HRESULT_FROM_WIN32(::GetLastError());
-
-    lpResourceInfo->Size = SizeofResource(hModule, ResourceFind);
-
-    HGLOBAL ResourceLoad = LoadResource(hModule, ResourceFind);
-    if (!ResourceLoad)
-        return ::HRESULT_FROM_WIN32(::GetLastError());
-
-    lpResourceInfo->Pointer = LockResource(ResourceLoad);
-
-    return S_OK;
-}
-
 std::wstring GetMessageByID(DWORD MessageID)
 {
     std::wstring MessageString;
@@ -138,88 +87,7 @@ std::wstring GetMessageByID(DWORD MessageID)
     return MessageString;
 }
 
-#include "jsmn.h"
-
-bool JsmnParseJson(
-    _Out_ jsmntok_t** JsonTokens,
-    _Out_ std::int32_t* JsonTokensCount,
-    _In_ const char* JsonString,
-    _In_ std::size_t JsonStringLength)
-{
-    if (!(JsonTokens && JsonTokensCount && JsonString && JsonStringLength))
-    {
-        return false;
-    }
-
-    *JsonTokens = nullptr;
-    *JsonTokensCount = 0;
-
-    jsmn_parser Parser;
-
-    ::jsmn_init(&Parser);
-    std::int32_t TokenCount = ::jsmn_parse(
-        &Parser, JsonString, JsonStringLength, nullptr, 0);
-
-    jsmntok_t* Tokens = reinterpret_cast<jsmntok_t*>(::malloc(
-        TokenCount * sizeof(jsmntok_t)));
-    if (Tokens)
-    {
-        ::jsmn_init(&Parser);
-        std::int32_t TokensCount = ::jsmn_parse(
-            &Parser, JsonString, JsonStringLength, Tokens, TokenCount);
-        if (TokensCount > 0)
-        {
-            *JsonTokens = Tokens;
-            *JsonTokensCount = TokensCount;
-        }
-        else
-        {
-            ::free(Tokens);
-        }
-    }
-
-    return Tokens;
-}
-
-typedef struct _JSON_TOKEN_INFO
-{
-    jsmntype_t Type;
-    const char* Name;
-    std::size_t NameLength;
-    int Size;
-} JSON_TOKEN_INFO, * PJSON_TOKEN_INFO;
-
-void JsmnGetTokenInfo(
-    _Out_ PJSON_TOKEN_INFO JsonTokenInfo,
-    _In_ const char* JsonString,
-    _In_ jsmntok_t* JsonToken)
-{
-    JsonTokenInfo->Type = JsonToken->type;
-    JsonTokenInfo->Name = JsonString + JsonToken->start;
-    JsonTokenInfo->NameLength = JsonToken->end - JsonToken->start;
-    JsonTokenInfo->Size = JsonToken->size;
-}
-
-bool JsmnJsonEqual(
-    _In_ const char* JsonString,
-    _In_ jsmntok_t* JsonToken,
-    _In_ const char* String)
-{
-    if (JsonToken->type == JSMN_STRING)
-    {
-        const char* CurrentToken = JsonString + JsonToken->start;
-        std::size_t CurrentTokenLength = JsonToken->end - JsonToken->start;
-        if (::strlen(String) == CurrentTokenLength)
-        {
-            if (::strncmp(CurrentToken, String, CurrentTokenLength) == 0)
-            {
-                return true;
-            }
-        }
-    }
-
-    return false;
-}
+#include <NSudoLauncherJson.h>
 
 #if _MSC_VER >= 1200
 #pragma warning(pop)
@@ -265,23 +133,23 @@ const char* NSudoMessageTranslationID[] =
 class CNSudoTranslationAdapter
 {
 private:
-    static std::wstring GetUTF8WithBOMStringResources(
-        _In_ UINT uID)
+    static const Mile::ResourceIndex& GetStringResources()
     {
-        M2_RESOURCE_INFO ResourceInfo = { 0 };
-        if (SUCCEEDED(M2LoadResource(
-            &ResourceInfo,
-            GetModuleHandleW(nullptr),
-            L"String",
-            MAKEINTRESOURCEW(uID))))
-        {
-            // Raw string without the UTF-8 BOM. (0xEF,0xBB,0xBF)	
-            return M2MakeUTF16String(std::string(
-                reinterpret_cast<const char*>(ResourceInfo.Pointer) + 3,
-                ResourceInfo.Size - 3));
-        }
+        // The index is built at the first use, the views of the resources
+        // refer to the locked resources without copying them.
+        static Mile::ResourceIndex Resources;
+        static const bool IsLoaded = Resources.Load(nullptr, L"String");
+        UNREFERENCED_PARAMETER(IsLoaded);
+        return Resources;
+    }
 
-        return L"";
+public:
+    static std::string_view GetUTF8StringResource(
+        _In_ UINT uID)
+    {
+        const Mile::ResourceView* View =
+            CNSudoTranslationAdapter::GetStringResources().Find(uID);
+        return View ? View->Content : std::string_view();
     }
 
 public:
@@ -300,27 +168,13 @@ public:
             L"© M2-Team. All rights reserved.\r\n"
             L"\r\n"));
 
-        StringTranslations.emplace(std::make_pair(
-            "NSudo.String.Links",
-            CNSudoTranslationAdapter::GetUTF8WithBOMStringResources(
-                IDR_STRING_LINKS)));
-
-        StringTranslations.emplace(std::make_pair(
-            "NSudo.String.CommandLineHelp",
-            CNSudoTranslationAdapter::GetUTF8WithBOMStringResources(
-                IDR_STRING_COMMAND_LINE_HELP)));
-
-        M2_RESOURCE_INFO ResourceInfo = { 0 };
-        if (SUCCEEDED(M2LoadResource(
-            &ResourceInfo,
-            GetModuleHandleW(nullptr),
-            L"String",
-            MAKEINTRESOURCEW(IDR_STRING_TRANSLATIONS))))
+        std::string_view Translations =
+            CNSudoTranslationAdapter::GetUTF8StringResource(
+                IDR_STRING_TRANSLATIONS);
+        if (!Translations.empty())
         {
-            const char* JsonString =
-                reinterpret_cast<const char*>(ResourceInfo.Pointer) + 3;
-            std::size_t JsonStringLength =
-                ResourceInfo.Size - 3;
+            const char* JsonString = Translations.data();
+            std::size_t JsonStringLength = Translations.size();
 
             jsmntok_t* JsonTokens = nullptr;
             std::int32_t JsonTokensCount = 0;
@@ -330,40 +184,21 @@ public:
                 JsonString,
                 JsonStringLength))
             {
-                for (size_t i = 0; i < static_cast<size_t>(JsonTokensCount); ++i)
-                {
-                    if (JsmnJsonEqual(
-                        JsonString,
-                        &JsonTokens[i],
-                        "Translations"))
+                JsmnEnumerateStringMembers(
+                    JsonString,
+                    JsonTokens,
+                    JsonTokensCount,
+                    "Translations",
+                    [&](const jsmntok_t& Key, const jsmntok_t& Value)
                     {
-                        if (JsonTokens[i + 1].type != JSMN_OBJECT)
-                        {
-                            continue;
-                        }
-
-                        for (size_t j = 0; j < static_cast<size_t>(JsonTokens[i + 1].size); ++j)
-                        {
-                            jsmntok_t& Key = JsonTokens[i + (j * 2) + 2];
-                            jsmntok_t& Value = JsonTokens[i + (j * 2) + 3];
-
-                            if (Key.type != JSMN_STRING ||
-                                Value.type != JSMN_STRING)
-                            {
-                                continue;
-                            }
-
-                            StringTranslations.emplace(std::make_pair(
-                                std::string(
-                                    JsonString + Key.start,
-                                    Key.end - Key.start),
-                                M2MakeUTF16String(std::string(
-                                    JsonString + Value.start,
-                                    Value.end - Value.start))));
-                        }
-                        i += JsonTokens[i + 1].size + 1;
-                    }
-                }
+                        StringTranslations.emplace(std::make_pair(
+                            std::string(
+                                JsonString + Key.start,
+                                Key.end - Key.start),
+                            M2MakeUTF16String(
+                                JsonString + Value.start,
+                                Value.end - Value.start)));
+                    });
 
                 ::free(JsonTokens);
             }
@@ -415,8 +250,12 @@ public:
                         nullptr);
                     if (hr == S_OK)
                     {
-                        const char* JsonString = FileContent + 3;
-                        std::size_t JsonStringLength = NumberOfBytesRead - 3;
+                        // The file usually starts with a UTF-8 BOM.
+                        Mile::ResourceView Content = Mile::MakeResourceView(
+                            FileContent,
+                            NumberOfBytesRead);
+                        const char* JsonString = Content.Content.data();
+                        std::size_t JsonStringLength = Content.Content.size();
 
                         jsmntok_t* JsonTokens = nullptr;
                         std::int32_t JsonTokensCount = 0;
@@ -426,40 +265,23 @@ public:
                             JsonString,
                             JsonStringLength))
                         {
-                            for (size_t i = 0; i < static_cast<size_t>(JsonTokensCount); ++i)
-                            {
-                                if (JsmnJsonEqual(
-                                    JsonString,
-                                    &JsonTokens[i],
-                                    "ShortCutList_V2"))
+                            JsmnEnumerateStringMembers(
+                                JsonString,
+                                JsonTokens,
+                                JsonTokensCount,
+                                "ShortCutList_V2",
+                                [&](
+                                    const jsmntok_t& Key,
+                                    const jsmntok_t& Value)
                                 {
-                                    if (JsonTokens[i + 1].type != JSMN_OBJECT)
-                                    {
-                                        continue;
-                                    }
-
-                                    for (size_t j = 0; j < static_cast<size_t>(JsonTokens[i + 1].size); ++j)
-                                    {
-                                        jsmntok_t& Key = JsonTokens[i + (j * 2) + 2];
-                                        jsmntok_t& Value = JsonTokens[i + (j * 2) + 3];
-
-                                        if (Key.type != JSMN_STRING ||
-                                            Value.type != JSMN_STRING)
-                                        {
-                                            continue;
-                                        }
-
-                                        ShortCutList.emplace(std::make_pair(
-                                            M2MakeUTF16String(std::string(
-                                                JsonString + Key.start,
-                                                Key.end - Key.start)),
-                                            M2MakeUTF16String(std::string(
-                                                JsonString + Value.start,
-                                                Value.end - Value.start))));
-                                    }
-                                    i += JsonTokens[i + 1].size + 1;
-                                }
-                            }
+                                    ShortCutList.emplace(std::make_pair(
+                                        M2MakeUTF16String(
+                                            JsonString + Key.start,
+                                            Key.end - Key.start),
+                                        M2MakeUTF16String(
+                                            JsonString + Value.start,
+                                            Value.end - Value.start)));
+                                });
 
                             ::free(JsonTokens);
                         }
@@ -555,6 +377,18 @@ public:
         return this->m_StringTranslations[Key];
     }
 
+    std::wstring_view GetTranslationView(
+        _In_ const std::string& Key) const
+    {
+        auto Iterator = this->m_StringTranslations.find(Key);
+        if (Iterator == this->m_StringTranslations.end())
+        {
+            return std::wstring_view();
+        }
+
+        return Iterator->second;
+    }
+
     std::wstring GetMessageString(
         _In_ NSUDO_MESSAGE MessageID)
     {
@@ -784,15 +618,63 @@ NSUDO_MESSAGE NSudoCommandLineParser(
     return NSUDO_MESSAGE::SUCCESS;
 }
 
+/**
+ * Builds the content of a message dialog from the translations and the views
+ * of the UTF-8 resources. The dialog needs a null-terminated UTF-16 string,
+ * so the content is sized first and the resources are transcoded into it
+ * directly.
+ */
+std::wstring NSudoMakeDialogContent(
+    _In_ std::initializer_list<Mile::OutputSegment> Segments)
+{
+    std::size_t Length = 0;
+    for (const Mile::OutputSegment& Segment : Segments)
+    {
+        Length += Segment.Utf8
+            ? ::MultiByteToWideChar(
+                CP_UTF8,
+                0,
+                Segment.Utf8,
+                static_cast<int>(Segment.Length),
+                nullptr,
+                0)
+            : Segment.Length;
+    }
+
+    std::wstring Content(Length, L'\0');
+    std::size_t Offset = 0;
+    for (const Mile::OutputSegment& Segment : Segments)
+    {
+        if (Segment.Utf8)
+        {
+            Offset += ::MultiByteToWideChar(
+                CP_UTF8,
+                0,
+                Segment.Utf8,
+                static_cast<int>(Segment.Length),
+                &Content[Offset],
+                static_cast<int>(Length - Offset));
+        }
+        else
+        {
+            std::wmemcpy(&Content[Offset], Segment.Wide, Segment.Length);
+            Offset += Segment.Length;
+        }
+    }
+    Content.resize(Offset);
+
+    return Content;
+}
+
 void NSudoPrintMsg(
     _In_opt_ HINSTANCE hInstance,
     _In_opt_ HWND hWnd,
     _In_ LPCWSTR lpContent)
 {
-    std::wstring DialogContent =
-        g_ResourceManagement.GetTranslation("NSudo.LogoText") +
-        lpContent +
-        g_ResourceManagement.GetTranslation("NSudo.String.Links");
+    std::wstring DialogContent = ::NSudoMakeDialogContent({
+        g_ResourceManagement.GetTranslationView("NSudo.LogoText"),
+        lpContent,
+        CNSudoTranslationAdapter::GetUTF8StringResource(IDR_STRING_LINKS) });
 
     M2MessageDialog(
         hInstance,
@@ -805,10 +687,11 @@ void NSudoPrintMsg(
 HRESULT NSudoShowAboutDialog(
     _In_ HWND hwndParent)
 {
-    std::wstring DialogContent =
-        g_ResourceManagement.GetTranslation("NSudo.LogoText") +
-        g_ResourceManagement.GetTranslation("NSudo.String.CommandLineHelp") +
-        g_ResourceManagement.GetTranslation("NSudo.String.Links");
+    std::wstring DialogContent = ::NSudoMakeDialogContent({
+        g_ResourceManagement.GetTranslationView("NSudo.LogoText"),
+        CNSudoTranslationAdapter::GetUTF8StringResource(
+            IDR_STRING_COMMAND_LINE_HELP),
+        CNSudoTranslationAdapter::GetUTF8StringResource(IDR_STRING_LINKS) });
 
     SetLastError(ERROR_SUCCESS);
 
@@ -0,0 +1,178 @@
+﻿/*
+ * PROJECT:   NSudo Launcher
+ * FILE:      NSudoLauncherJson.h
+ * PURPOSE:   Definition for the JSON helpers shared by the NSudo Launchers
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#pragma once
+
+#ifndef NSUDO_LAUNCHER_JSON
+#define NSUDO_LAUNCHER_JSON
+
+#include "jsmn.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _In_
+#define _In_
+#endif
+
+#ifndef _Out_
+#define _Out_
+#endif
+
+inline bool JsmnParseJson(
+    _Out_ jsmntok_t** JsonTokens,
+    _Out_ std::int32_t* JsonTokensCount,
+    _In_ const char* JsonString,
+    _In_ std::size_t JsonStringLength)
+{
+    if (!(JsonTokens && JsonTokensCount && JsonString && JsonStringLength))
+    {
+        return false;
+    }
+
+    *JsonTokens = nullptr;
+    *JsonTokensCount = 0;
+
+    jsmn_parser Parser;
+
+    ::jsmn_init(&Parser);
+    std::int32_t TokenCount = ::jsmn_parse(
+        &Parser, JsonString, JsonStringLength, nullptr, 0);
+    if (TokenCount <= 0)
+    {
+        // The string is not valid JSON or has no tokens.
+        return false;
+    }
+
+    jsmntok_t* Tokens = reinterpret_cast<jsmntok_t*>(::malloc(
+        TokenCount * sizeof(jsmntok_t)));
+    if (Tokens)
+    {
+        ::jsmn_init(&Parser);
+        std::int32_t TokensCount = ::jsmn_parse(
+            &Parser, JsonString, JsonStringLength, Tokens, TokenCount);
+        if (TokensCount > 0)
+        {
+            *JsonTokens = Tokens;
+            *JsonTokensCount = TokensCount;
+        }
+        else
+        {
+            ::free(Tokens);
+        }
+    }
+
+    return *JsonTokens != nullptr;
+}
+
+typedef struct _JSON_TOKEN_INFO
+{
+    jsmntype_t Type;
+    const char* Name;
+    std::size_t NameLength;
+    int Size;
+} JSON_TOKEN_INFO, * PJSON_TOKEN_INFO;
+
+inline void JsmnGetTokenInfo(
+    _Out_ PJSON_TOKEN_INFO JsonTokenInfo,
+    _In_ const char* JsonString,
+    _In_ jsmntok_t* JsonToken)
+{
+    JsonTokenInfo->Type = JsonToken->type;
+    JsonTokenInfo->Name = JsonString + JsonToken->start;
+    JsonTokenInfo->NameLength = JsonToken->end - JsonToken->start;
+    JsonTokenInfo->Size = JsonToken->size;
+}
+
+inline bool JsmnJsonEqual(
+    _In_ const char* JsonString,
+    _In_ jsmntok_t* JsonToken,
+    _In_ const char* String)
+{
+    if (JsonToken->type == JSMN_STRING)
+    {
+        const char* CurrentToken = JsonString + JsonToken->start;
+        std::size_t CurrentTokenLength = JsonToken->end - JsonToken->start;
+        if (::strlen(String) == CurrentTokenLength)
+        {
+            if (::strncmp(CurrentToken, String, CurrentTokenLength) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Gets the index of the token which follows a token and all its children.
+ */
+inline std::size_t JsmnSkipToken(
+    _In_ const jsmntok_t* JsonTokens,
+    _In_ std::size_t JsonTokensCount,
+    _In_ std::size_t Index)
+{
+    std::size_t Next = Index + 1;
+    while (Next < JsonTokensCount &&
+        JsonTokens[Next].start < JsonTokens[Index].end)
+    {
+        ++Next;
+    }
+
+    return Next;
+}
+
+/**
+ * Enumerates the members with string values of the objects which are the
+ * values of the keys with the specified name. The nested values are skipped
+ * as a whole, and the tokens are never read past the end.
+ */
+template <typename MemberHandlerType>
+void JsmnEnumerateStringMembers(
+    _In_ const char* JsonString,
+    _In_ jsmntok_t* JsonTokens,
+    _In_ std::int32_t JsonTokensCount,
+    _In_ const char* ObjectName,
+    _In_ MemberHandlerType&& MemberHandler)
+{
+    std::size_t Count = static_cast<std::size_t>(JsonTokensCount);
+
+    for (std::size_t i = 0; i + 1 < Count; ++i)
+    {
+        if (!JsmnJsonEqual(JsonString, &JsonTokens[i], ObjectName) ||
+            JsonTokens[i + 1].type != JSMN_OBJECT)
+        {
+            continue;
+        }
+
+        std::size_t End = JsmnSkipToken(JsonTokens, Count, i + 1);
+
+        std::size_t Key = i + 2;
+        while (Key + 1 < End)
+        {
+            std::size_t Value = Key + 1;
+
+            if (JsonTokens[Key].type == JSMN_STRING &&
+                JsonTokens[Value].type == JSMN_STRING)
+            {
+                MemberHandler(JsonTokens[Key], JsonTokens[Value]);
+            }
+
+            Key = JsmnSkipToken(JsonTokens, Count, Value);
+        }
+
+        i = End - 1;
+    }
+}
+
+#endif // !NSUDO_LAUNCHER_JSON
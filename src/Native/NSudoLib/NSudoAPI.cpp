@@ -16,11 +16,18 @@
 
 #include "M2.Base.h"
 
+#include <Mile.Platform.Environment.h>
+#include <Mile.Platform.Trace.h>
+
+#include <cstdint>
 #include <cstdio>
 #include <cwchar>
 
+#include <new>
+#include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace Mile
 {
@@ -75,20 +82,286 @@ DWORD WINAPI TemporarilyGetActiveSessionID()
         &pSessionInfo,
         &Count))
     {
+        DWORD SessionId = static_cast<DWORD>(-1);
+
         for (DWORD i = 0; i < Count; ++i)
         {
             if (pSessionInfo[i].State == WTS_CONNECTSTATE_CLASS::WTSActive)
             {
-                return pSessionInfo[i].SessionId;
+                SessionId = pSessionInfo[i].SessionId;
+                break;
             }
         }
 
         ::WTSFreeMemory(pSessionInfo);
+
+        return SessionId;
     }
 
     return static_cast<DWORD>(-1);
 }
 
+namespace
+{
+    /**
+     * The trace activity of the current launch of each thread, it is kept
+     * after the launch for NSudoGetLaunchTrace.
+     */
+    thread_local std::uint32_t g_LaunchActivity = 0;
+
+    /**
+     * The names of the launch stages, indexed by NSUDO_LAUNCH_STAGE.
+     */
+    const wchar_t* const g_LaunchStageNames[] =
+    {
+        L"Launch",
+        L"OpenCurrentProcessToken",
+        L"EnableDebugPrivilege",
+        L"GetActiveSessionId",
+        L"GetLsassProcessId",
+        L"OpenLsassProcessToken",
+        L"ImpersonateSystem",
+        L"StartTrustedInstaller",
+        L"OpenUserToken",
+        L"PrepareUserToken",
+        L"CreateEnvironmentBlock",
+        L"PrepareEnvironment",
+        L"CreateProcess",
+        L"SetPriorityClass",
+        L"ResumeThread",
+        L"WaitProcess",
+    };
+
+    /**
+     * The number of the launch stages. Each stage is recorded once in a
+     * launch, so a launch has at most this number of events.
+     */
+    const std::size_t LaunchStageCount =
+        sizeof(g_LaunchStageNames) / sizeof(*g_LaunchStageNames);
+
+    /**
+     * Records a stage of the current launch when it goes out of scope, with
+     * the value of the result variable at that time.
+     */
+    class LaunchStage :
+        Mile::DisableCopyConstruction,
+        Mile::DisableMoveConstruction
+    {
+    private:
+        NSUDO_LAUNCH_STAGE m_Stage;
+        const HRESULT& m_Result;
+        std::uint64_t m_StartTime;
+
+    public:
+
+        LaunchStage(
+            NSUDO_LAUNCH_STAGE Stage,
+            const HRESULT& Result) noexcept :
+            m_Stage(Stage),
+            m_Result(Result),
+            m_StartTime(Mile::GetTraceTimestamp())
+        {
+
+        }
+
+        ~LaunchStage() noexcept
+        {
+            Mile::TraceEvent Event;
+            Event.StartTime = this->m_StartTime;
+            Event.Duration = Mile::GetTraceTimestamp() - this->m_StartTime;
+            Event.Activity = g_LaunchActivity;
+            Event.Stage = static_cast<std::uint32_t>(this->m_Stage);
+            Event.Result = this->m_Result;
+
+            DWORD HandleCount = 0;
+            if (!::GetProcessHandleCount(
+                ::MileGetCurrentProcess(),
+                &HandleCount))
+            {
+                HandleCount = 0;
+            }
+            Event.HandleCount = HandleCount;
+
+            Mile::WriteTraceEvent(Event);
+        }
+    };
+
+    /**
+     * The time after which a cached environment block is created again, so
+     * the changes of the user profiles are picked up, in milliseconds.
+     */
+    const ULONGLONG EnvironmentCacheLifetime = 5000;
+
+    /**
+     * The number of the cached environment blocks.
+     */
+    const std::size_t EnvironmentCacheSize = 8;
+
+    /**
+     * The environment block of a user in a session, which is created by
+     * CreateEnvironmentBlock.
+     */
+    struct EnvironmentCacheEntry
+    {
+        std::vector<BYTE> UserSid;
+        DWORD SessionId;
+        ULONGLONG CreationTime;
+        LPVOID Block;
+        Mile::EnvironmentBlock Index;
+    };
+
+    Mile::Mutex g_EnvironmentCacheLock;
+    EnvironmentCacheEntry g_EnvironmentCache[EnvironmentCacheSize];
+
+    EnvironmentCacheEntry* FindEnvironmentCacheEntry(
+        const std::vector<BYTE>& UserSid,
+        DWORD SessionId,
+        ULONGLONG CurrentTime)
+    {
+        for (EnvironmentCacheEntry& Entry : g_EnvironmentCache)
+        {
+            if (Entry.Block &&
+                Entry.SessionId == SessionId &&
+                Entry.UserSid == UserSid &&
+                CurrentTime - Entry.CreationTime < EnvironmentCacheLifetime)
+            {
+                return &Entry;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Creates the environment block and the command line of a launch. The
+     * environment block of the user of the token is cached, the overrides
+     * are merged with it and the command line is expanded with the result.
+     */
+    HRESULT PrepareEnvironment(
+        _In_ HANDLE TokenHandle,
+        _In_ DWORD SessionId,
+        _In_ LPCWSTR CommandLine,
+        _In_opt_ LPCWSTR EnvironmentOverrides,
+        _Out_ std::vector<wchar_t>& Environment,
+        _Out_ std::wstring& ExpandedCommandLine)
+    {
+        Mile::UniqueHeapBlock UserInformation;
+        HRESULT hr = ::MileGetTokenInformationWithMemory(
+            TokenHandle,
+            TokenUser,
+            UserInformation.Put());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        PBYTE Sid = reinterpret_cast<PBYTE>(
+            reinterpret_cast<PTOKEN_USER>(UserInformation.Get())->User.Sid);
+        std::vector<BYTE> UserSid(Sid, Sid + ::MileGetLengthSid(Sid));
+        UserInformation.Reset();
+
+        Mile::EnvironmentOverlay Overlay;
+        Overlay.Parse(EnvironmentOverrides);
+
+        {
+            Mile::AutoMutexLock Lock(g_EnvironmentCacheLock);
+
+            EnvironmentCacheEntry* Entry = FindEnvironmentCacheEntry(
+                UserSid,
+                SessionId,
+                ::GetTickCount64());
+            if (Entry)
+            {
+                Mile::SerializeEnvironmentBlock(
+                    Entry->Index,
+                    &Overlay,
+                    Environment);
+                Mile::ExpandEnvironmentReferences(
+                    Entry->Index,
+                    &Overlay,
+                    CommandLine,
+                    ExpandedCommandLine);
+                return S_OK;
+            }
+        }
+
+        // CreateEnvironmentBlock loads the data of the user profile, so it is
+        // called without holding the lock.
+        LPVOID Block = nullptr;
+        {
+            LaunchStage Stage(NSUDO_LAUNCH_STAGE::CREATE_ENVIRONMENT_BLOCK, hr);
+
+            hr = ::MileCreateEnvironmentBlock(&Block, TokenHandle, TRUE);
+            if (hr != S_OK)
+            {
+                return hr;
+            }
+        }
+
+        ULONGLONG CurrentTime = ::GetTickCount64();
+
+        Mile::AutoMutexLock Lock(g_EnvironmentCacheLock);
+
+        EnvironmentCacheEntry* Entry = FindEnvironmentCacheEntry(
+            UserSid,
+            SessionId,
+            CurrentTime);
+        if (Entry)
+        {
+            // Another launch cached the block first.
+            ::MileDestroyEnvironmentBlock(Block);
+        }
+        else
+        {
+            // Reuses the expired entry of the same user and session, or the
+            // oldest entry.
+            Entry = &g_EnvironmentCache[0];
+            for (EnvironmentCacheEntry& Current : g_EnvironmentCache)
+            {
+                if (Current.SessionId == SessionId &&
+                    Current.UserSid == UserSid)
+                {
+                    Entry = &Current;
+                    break;
+                }
+
+                if (!Current.Block)
+                {
+                    Entry = &Current;
+                }
+                else if (Entry->Block &&
+                    Current.CreationTime < Entry->CreationTime)
+                {
+                    Entry = &Current;
+                }
+            }
+
+            if (Entry->Block)
+            {
+                ::MileDestroyEnvironmentBlock(Entry->Block);
+            }
+
+            Entry->UserSid = UserSid;
+            Entry->SessionId = SessionId;
+            Entry->CreationTime = CurrentTime;
+            Entry->Block = Block;
+            Entry->Index.Parse(reinterpret_cast<const wchar_t*>(Block));
+        }
+
+        Mile::SerializeEnvironmentBlock(
+            Entry->Index,
+            &Overlay,
+            Environment);
+        Mile::ExpandEnvironmentReferences(
+            Entry->Index,
+            &Overlay,
+            CommandLine,
+            ExpandedCommandLine);
+
+        return S_OK;
+    }
+}
+
 /**
  * @remark You can read the definition for this function in "NSudoAPI.h".
  */
@@ -102,6 +375,35 @@ EXTERN_C HRESULT WINAPI NSudoCreateProcess(
     _In_ BOOL CreateNewConsole,
     _In_ LPCWSTR CommandLine,
     _In_opt_ LPCWSTR CurrentDirectory)
+{
+    return ::NSudoCreateProcessWithEnvironment(
+        UserModeType,
+        PrivilegesModeType,
+        MandatoryLabelType,
+        ProcessPriorityClassType,
+        ShowWindowModeType,
+        WaitInterval,
+        CreateNewConsole,
+        CommandLine,
+        CurrentDirectory,
+        nullptr);
+}
+
+/**
+ * The launch pipeline of NSudoCreateProcessWithEnvironment, each stage is
+ * recorded into the trace of the calling thread.
+ */
+static HRESULT NSudoLaunchProcess(
+    _In_ NSUDO_USER_MODE_TYPE UserModeType,
+    _In_ NSUDO_PRIVILEGES_MODE_TYPE PrivilegesModeType,
+    _In_ NSUDO_MANDATORY_LABEL_TYPE MandatoryLabelType,
+    _In_ NSUDO_PROCESS_PRIORITY_CLASS_TYPE ProcessPriorityClassType,
+    _In_ NSUDO_SHOW_WINDOW_MODE_TYPE ShowWindowModeType,
+    _In_ DWORD WaitInterval,
+    _In_ BOOL CreateNewConsole,
+    _In_ LPCWSTR CommandLine,
+    _In_opt_ LPCWSTR CurrentDirectory,
+    _In_opt_ LPCWSTR EnvironmentOverrides)
 {
     DWORD MandatoryLabelRid;
     switch (MandatoryLabelType)
@@ -182,101 +484,82 @@ EXTERN_C HRESULT WINAPI NSudoCreateProcess(
 
     DWORD SessionID = static_cast<DWORD>(-1);
 
-    HANDLE CurrentProcessToken = INVALID_HANDLE_VALUE;
-    HANDLE DuplicatedCurrentProcessToken = INVALID_HANDLE_VALUE;
-    
-    HANDLE OriginalLsassProcessToken = INVALID_HANDLE_VALUE;
-    HANDLE SystemToken = INVALID_HANDLE_VALUE;
+    Mile::UniqueTokenHandle CurrentProcessToken;
+    Mile::UniqueTokenHandle DuplicatedCurrentProcessToken;
+
+    Mile::UniqueTokenHandle OriginalLsassProcessToken;
+    Mile::UniqueTokenHandle SystemToken;
 
-    HANDLE hToken = INVALID_HANDLE_VALUE;
-    HANDLE OriginalToken = INVALID_HANDLE_VALUE;
+    Mile::UniqueTokenHandle hToken;
+    Mile::UniqueTokenHandle OriginalToken;
 
+    // The tokens are closed after the impersonation is reverted, because
+    // they are destroyed in the reverse order of their declarations.
     auto Handler = Mile::ScopeExitEventHandler([&]()
         {
-            if (CurrentProcessToken !=INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(CurrentProcessToken);
-            }
-
-            if (DuplicatedCurrentProcessToken != INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(DuplicatedCurrentProcessToken);
-            }
-
-            if (OriginalLsassProcessToken != INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(OriginalLsassProcessToken);
-            }
-
-            if (SystemToken != INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(SystemToken);
-            }
-
-            if (hToken != INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(hToken);
-            }
-
-            if (OriginalToken != INVALID_HANDLE_VALUE)
-            {
-                ::MileCloseHandle(OriginalToken);
-            }
-
             ::MileSetCurrentThreadToken(nullptr);
         });
 
     //DWORD ReturnLength = 0;
 
-    hr = ::MileOpenCurrentProcessToken(
-        MAXIMUM_ALLOWED, &CurrentProcessToken);
-    if (hr != S_OK)
     {
-        return hr;
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::OPEN_CURRENT_PROCESS_TOKEN, hr);
+
+        hr = ::MileOpenCurrentProcessToken(
+            MAXIMUM_ALLOWED, CurrentProcessToken.Put());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        hr = ::MileDuplicateToken(
+            CurrentProcessToken.Get(),
+            MAXIMUM_ALLOWED,
+            nullptr,
+            SecurityImpersonation,
+            TokenImpersonation,
+            DuplicatedCurrentProcessToken.Put());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
     }
 
-    hr = ::MileDuplicateToken(
-        CurrentProcessToken,
-        MAXIMUM_ALLOWED,
-        nullptr,
-        SecurityImpersonation,
-        TokenImpersonation,
-        &DuplicatedCurrentProcessToken);
-    if (hr != S_OK)
     {
-        return hr;
-    }
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::ENABLE_DEBUG_PRIVILEGE, hr);
 
-    LUID_AND_ATTRIBUTES RawPrivilege;
+        LUID_AND_ATTRIBUTES RawPrivilege;
 
-    hr = ::MileGetPrivilegeValue(SE_DEBUG_NAME, &RawPrivilege.Luid);
-    if (hr != S_OK)
-    {
-        return hr;
-    }
+        hr = ::MileGetPrivilegeValue(SE_DEBUG_NAME, &RawPrivilege.Luid);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
 
-    RawPrivilege.Attributes = SE_PRIVILEGE_ENABLED;
+        RawPrivilege.Attributes = SE_PRIVILEGE_ENABLED;
 
-    hr = ::MileAdjustTokenPrivilegesSimple(
-        DuplicatedCurrentProcessToken,
-        &RawPrivilege,
-        1);
-    if (hr != S_OK)
-    {
-        return hr;
-    }
+        hr = ::MileAdjustTokenPrivilegesSimple(
+            DuplicatedCurrentProcessToken.Get(),
+            &RawPrivilege,
+            1);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
 
-    hr = ::MileSetCurrentThreadToken(DuplicatedCurrentProcessToken);
-    if (hr != S_OK)
-    {
-        return hr;
-    }
+        hr = ::MileSetCurrentThreadToken(
+            DuplicatedCurrentProcessToken.Get());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
 
-    hr = ::MileOpenCurrentThreadToken(
-        MAXIMUM_ALLOWED, FALSE, &CurrentProcessToken);
-    if (hr != S_OK)
-    {
-        return hr;
+        hr = ::MileOpenCurrentThreadToken(
+            MAXIMUM_ALLOWED, FALSE, CurrentProcessToken.Put());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
     }
 
     /*hr = ::MileGetTokenInformation(
@@ -289,249 +572,474 @@ EXTERN_C HRESULT WINAPI NSudoCreateProcess(
     {
         return hr;
     }*/
-    SessionID = TemporarilyGetActiveSessionID();
-    if (SessionID == static_cast<DWORD>(-1))
     {
-        return ::MileHResultFromWin32(ERROR_NO_TOKEN);
-    }
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::GET_ACTIVE_SESSION_ID, hr);
 
-    hr = ::MileOpenLsassProcessToken(
-        MAXIMUM_ALLOWED,
-        &OriginalLsassProcessToken);
-    if (hr != S_OK)
-    {
-        return hr;
+        SessionID = TemporarilyGetActiveSessionID();
+        if (SessionID == static_cast<DWORD>(-1))
+        {
+            hr = ::MileHResultFromWin32(ERROR_NO_TOKEN);
+            return hr;
+        }
     }
 
-    hr = ::MileDuplicateToken(
-        OriginalLsassProcessToken,
-        MAXIMUM_ALLOWED,
-        nullptr,
-        SecurityImpersonation,
-        TokenImpersonation,
-        &SystemToken);
-    if (hr != S_OK)
-    {
-        return hr;
-    }
+    DWORD LsassProcessId = static_cast<DWORD>(-1);
 
-    hr = ::MileAdjustTokenAllPrivileges(
-        SystemToken,
-        SE_PRIVILEGE_ENABLED);
-    if (hr != S_OK)
     {
-        return hr;
-    }
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::GET_LSASS_PROCESS_ID, hr);
 
-    hr = ::MileSetCurrentThreadToken(SystemToken);
-    if (hr != S_OK)
-    {
-        return hr;
+        hr = ::MileGetLsassProcessId(&LsassProcessId);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
     }
 
-    if (NSUDO_USER_MODE_TYPE::TRUSTED_INSTALLER == UserModeType)
     {
-        hr = ::MileOpenServiceProcessToken(
-            L"TrustedInstaller",
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::OPEN_LSASS_PROCESS_TOKEN, hr);
+
+        hr = ::MileOpenProcessTokenByProcessId(
+            LsassProcessId,
             MAXIMUM_ALLOWED,
-            &OriginalToken);
+            OriginalLsassProcessToken.Put());
         if (hr != S_OK)
         {
             return hr;
         }
     }
-    else if (NSUDO_USER_MODE_TYPE::SYSTEM == UserModeType)
+
     {
-        hr = ::MileOpenLsassProcessToken(MAXIMUM_ALLOWED, &OriginalToken);
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::IMPERSONATE_SYSTEM, hr);
+
+        hr = ::MileDuplicateToken(
+            OriginalLsassProcessToken.Get(),
+            MAXIMUM_ALLOWED,
+            nullptr,
+            SecurityImpersonation,
+            TokenImpersonation,
+            SystemToken.Put());
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        hr = ::MileAdjustTokenAllPrivileges(
+            SystemToken.Get(),
+            SE_PRIVILEGE_ENABLED);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        hr = ::MileSetCurrentThreadToken(SystemToken.Get());
         if (hr != S_OK)
         {
             return hr;
         }
     }
-    else if (NSUDO_USER_MODE_TYPE::CURRENT_USER == UserModeType)
+
+    DWORD TrustedInstallerProcessId = static_cast<DWORD>(-1);
+
+    if (NSUDO_USER_MODE_TYPE::TRUSTED_INSTALLER == UserModeType)
     {
-        hr = ::MileCreateSessionToken(SessionID, &OriginalToken);
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::START_TRUSTED_INSTALLER, hr);
+
+        SERVICE_STATUS_PROCESS ServiceStatus;
+        hr = ::MileStartServiceSimple(L"TrustedInstaller", &ServiceStatus);
         if (hr != S_OK)
         {
             return hr;
         }
+
+        TrustedInstallerProcessId = ServiceStatus.dwProcessId;
     }
-    else if (NSUDO_USER_MODE_TYPE::CURRENT_PROCESS == UserModeType)
+
     {
-        hr = ::MileOpenCurrentProcessToken(MAXIMUM_ALLOWED, &OriginalToken);
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::OPEN_USER_TOKEN, hr);
+
+        if (NSUDO_USER_MODE_TYPE::TRUSTED_INSTALLER == UserModeType)
+        {
+            hr = ::MileOpenProcessTokenByProcessId(
+                TrustedInstallerProcessId,
+                MAXIMUM_ALLOWED,
+                OriginalToken.Put());
+        }
+        else if (NSUDO_USER_MODE_TYPE::SYSTEM == UserModeType)
+        {
+            hr = ::MileOpenProcessTokenByProcessId(
+                LsassProcessId,
+                MAXIMUM_ALLOWED,
+                OriginalToken.Put());
+        }
+        else if (NSUDO_USER_MODE_TYPE::CURRENT_USER == UserModeType)
+        {
+            hr = ::MileCreateSessionToken(SessionID, OriginalToken.Put());
+        }
+        else if (NSUDO_USER_MODE_TYPE::CURRENT_PROCESS == UserModeType)
+        {
+            hr = ::MileOpenCurrentProcessToken(
+                MAXIMUM_ALLOWED,
+                OriginalToken.Put());
+        }
+        else if (
+            NSUDO_USER_MODE_TYPE::CURRENT_PROCESS_DROP_RIGHT == UserModeType)
+        {
+            Mile::UniqueTokenHandle hCurrentProcessToken;
+            hr = ::MileOpenCurrentProcessToken(
+                MAXIMUM_ALLOWED,
+                hCurrentProcessToken.Put());
+            if (hr == S_OK)
+            {
+                hr = ::MileCreateLUAToken(
+                    hCurrentProcessToken.Get(),
+                    OriginalToken.Put());
+            }
+        }
+        else if (NSUDO_USER_MODE_TYPE::CURRENT_USER_ELEVATED == UserModeType)
+        {
+            Mile::UniqueTokenHandle hCurrentProcessToken;
+            hr = ::MileCreateSessionToken(
+                SessionID,
+                hCurrentProcessToken.Put());
+            if (hr == S_OK)
+            {
+                TOKEN_LINKED_TOKEN LinkedToken = { 0 };
+                DWORD ReturnLength = 0;
+
+                hr = ::MileGetTokenInformation(
+                    hCurrentProcessToken.Get(),
+                    TokenLinkedToken,
+                    &LinkedToken,
+                    sizeof(TOKEN_LINKED_TOKEN),
+                    &ReturnLength);
+                if (hr == S_OK)
+                {
+                    Mile::UniqueTokenHandle LinkedTokenHandle(
+                        LinkedToken.LinkedToken);
+
+                    hr = ::MileDuplicateToken(
+                        LinkedTokenHandle.Get(),
+                        MAXIMUM_ALLOWED,
+                        nullptr,
+                        SecurityIdentification,
+                        TokenPrimary,
+                        OriginalToken.Put());
+                }
+            }
+        }
+        else
+        {
+            hr = E_INVALIDARG;
+        }
+
         if (hr != S_OK)
         {
             return hr;
         }
     }
-    else if (NSUDO_USER_MODE_TYPE::CURRENT_PROCESS_DROP_RIGHT == UserModeType)
+
     {
-        HANDLE hCurrentProcessToken = nullptr;
-        hr = ::MileOpenCurrentProcessToken(
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::PREPARE_USER_TOKEN, hr);
+
+        hr = ::MileDuplicateToken(
+            OriginalToken.Get(),
             MAXIMUM_ALLOWED,
-            &hCurrentProcessToken);
-        if (hr == S_OK)
+            nullptr,
+            SecurityIdentification,
+            TokenPrimary,
+            hToken.Put());
+        if (hr != S_OK)
         {
-            hr = ::MileCreateLUAToken(hCurrentProcessToken, &OriginalToken);
-
-            ::MileCloseHandle(hCurrentProcessToken);
+            return hr;
         }
 
+        hr = ::MileSetTokenInformation(
+            hToken.Get(),
+            TokenSessionId,
+            (PVOID)&SessionID,
+            sizeof(DWORD));
         if (hr != S_OK)
         {
             return hr;
         }
-    }
-    else if (NSUDO_USER_MODE_TYPE::CURRENT_USER_ELEVATED == UserModeType)
-    {
-        HANDLE hCurrentProcessToken = nullptr;
-        hr = ::MileCreateSessionToken(SessionID, &hCurrentProcessToken);
-        if (hr == S_OK)
+
+        switch (PrivilegesModeType)
         {
-            TOKEN_LINKED_TOKEN LinkedToken = { 0 };
-            DWORD ReturnLength = 0;
+        case NSUDO_PRIVILEGES_MODE_TYPE::ENABLE_ALL_PRIVILEGES:
 
-            hr = ::MileGetTokenInformation(
-                hCurrentProcessToken,
-                TokenLinkedToken,
-                &LinkedToken,
-                sizeof(TOKEN_LINKED_TOKEN),
-                &ReturnLength);
-            if (hr == S_OK)
+            hr = ::MileAdjustTokenAllPrivileges(
+                hToken.Get(),
+                SE_PRIVILEGE_ENABLED);
+            if (hr != S_OK)
+            {
+                return hr;
+            }
+
+            break;
+        case NSUDO_PRIVILEGES_MODE_TYPE::DISABLE_ALL_PRIVILEGES:
+
+            hr = ::MileAdjustTokenAllPrivileges(hToken.Get(), 0);
+            if (hr != S_OK)
             {
-                hr = ::MileDuplicateToken(
-                    LinkedToken.LinkedToken,
-                    MAXIMUM_ALLOWED,
-                    nullptr,
-                    SecurityIdentification,
-                    TokenPrimary,
-                    &OriginalToken);
-
-                ::MileCloseHandle(LinkedToken.LinkedToken);
+                return hr;
             }
 
-            ::MileCloseHandle(hCurrentProcessToken);
+            break;
+        default:
+            break;
         }
-    }
-    else
-    {
-        return E_INVALIDARG;
-    }
 
-    hr = ::MileDuplicateToken(
-        OriginalToken,
-        MAXIMUM_ALLOWED,
-        nullptr,
-        SecurityIdentification,
-        TokenPrimary,
-        &hToken);
-    if (hr != S_OK)
-    {
-        return hr;
+        if (NSUDO_MANDATORY_LABEL_TYPE::UNTRUSTED != MandatoryLabelType)
+        {
+            hr = ::MileSetTokenMandatoryLabel(
+                hToken.Get(),
+                MandatoryLabelRid);
+            if (hr != S_OK)
+            {
+                return hr;
+            }
+        }
     }
 
-    hr = ::MileSetTokenInformation(
-        hToken,
-        TokenSessionId,
-        (PVOID)&SessionID,
-        sizeof(DWORD));
-    if (hr != S_OK)
+    DWORD dwCreationFlags = CREATE_SUSPENDED | CREATE_UNICODE_ENVIRONMENT;
+
+    if (CreateNewConsole)
     {
-        return hr;
+        dwCreationFlags |= CREATE_NEW_CONSOLE;
     }
 
-    switch (PrivilegesModeType)
+    STARTUPINFOW StartupInfo = { 0 };
+    PROCESS_INFORMATION ProcessInfo = { 0 };
+
+    StartupInfo.cb = sizeof(STARTUPINFOW);
+
+    StartupInfo.lpDesktop = const_cast<LPWSTR>(L"WinSta0\\Default");
+
+    StartupInfo.dwFlags |= STARTF_USESHOWWINDOW;
+    StartupInfo.wShowWindow = static_cast<WORD>(ShowWindowMode);
+
+    std::vector<wchar_t> Environment;
+    std::wstring ExpandedString;
+
     {
-    case NSUDO_PRIVILEGES_MODE_TYPE::ENABLE_ALL_PRIVILEGES:
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::PREPARE_ENVIRONMENT, hr);
 
-        hr = ::MileAdjustTokenAllPrivileges(hToken, SE_PRIVILEGE_ENABLED);
+        hr = PrepareEnvironment(
+            hToken.Get(),
+            SessionID,
+            CommandLine,
+            EnvironmentOverrides,
+            Environment,
+            ExpandedString);
         if (hr != S_OK)
         {
             return hr;
         }
+    }
 
-        break;
-    case NSUDO_PRIVILEGES_MODE_TYPE::DISABLE_ALL_PRIVILEGES:
+    {
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::CREATE_PROCESS, hr);
 
-        hr = ::MileAdjustTokenAllPrivileges(hToken, 0);
+        hr = ::MileCreateProcessAsUser(
+            hToken.Get(),
+            nullptr,
+            &ExpandedString[0],
+            nullptr,
+            nullptr,
+            FALSE,
+            dwCreationFlags,
+            &Environment[0],
+            CurrentDirectory,
+            &StartupInfo,
+            &ProcessInfo);
         if (hr != S_OK)
         {
             return hr;
         }
+    }
 
-        break;
-    default:
-        break;
+    Mile::UniqueProcessHandle ProcessHandle(ProcessInfo.hProcess);
+    Mile::UniqueThreadHandle ThreadHandle(ProcessInfo.hThread);
+
+    {
+        // The process is still started with the default priority class if
+        // it cannot be set, the failure is only recorded in the trace.
+        HRESULT PriorityResult = S_OK;
+        LaunchStage Stage(
+            NSUDO_LAUNCH_STAGE::SET_PRIORITY_CLASS,
+            PriorityResult);
+
+        PriorityResult = ::MileSetPriorityClass(
+            ProcessHandle.Get(),
+            ProcessPriority);
     }
 
-    if (NSUDO_MANDATORY_LABEL_TYPE::UNTRUSTED != MandatoryLabelType)
     {
-        hr = ::MileSetTokenMandatoryLabel(hToken, MandatoryLabelRid);
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::RESUME_THREAD, hr);
+
+        hr = ::MileResumeThread(ThreadHandle.Get(), nullptr);
         if (hr != S_OK)
         {
+            // Do not leave a suspended process behind.
+            ::TerminateProcess(ProcessHandle.Get(), static_cast<UINT>(hr));
             return hr;
         }
     }
 
-    DWORD dwCreationFlags = CREATE_SUSPENDED | CREATE_UNICODE_ENVIRONMENT;
+    {
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::WAIT_PROCESS, hr);
+
+        hr = ::MileWaitForSingleObject(
+            ProcessHandle.Get(),
+            WaitInterval,
+            FALSE,
+            nullptr);
+    }
+
+    return hr;
+}
+
+/**
+ * @remark You can read the definition for this function in "NSudoAPI.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoCreateProcessWithEnvironment(
+    _In_ NSUDO_USER_MODE_TYPE UserModeType,
+    _In_ NSUDO_PRIVILEGES_MODE_TYPE PrivilegesModeType,
+    _In_ NSUDO_MANDATORY_LABEL_TYPE MandatoryLabelType,
+    _In_ NSUDO_PROCESS_PRIORITY_CLASS_TYPE ProcessPriorityClassType,
+    _In_ NSUDO_SHOW_WINDOW_MODE_TYPE ShowWindowModeType,
+    _In_ DWORD WaitInterval,
+    _In_ BOOL CreateNewConsole,
+    _In_ LPCWSTR CommandLine,
+    _In_opt_ LPCWSTR CurrentDirectory,
+    _In_opt_ LPCWSTR EnvironmentOverrides)
+{
+    g_LaunchActivity = Mile::CreateTraceActivity();
+
+    HRESULT hr = S_OK;
 
-    if (CreateNewConsole)
     {
-        dwCreationFlags |= CREATE_NEW_CONSOLE;
+        // The whole launch is recorded after the handles of the pipeline are
+        // closed, so the handle count shows the leaks.
+        LaunchStage Stage(NSUDO_LAUNCH_STAGE::LAUNCH, hr);
+
+        hr = ::NSudoLaunchProcess(
+            UserModeType,
+            PrivilegesModeType,
+            MandatoryLabelType,
+            ProcessPriorityClassType,
+            ShowWindowModeType,
+            WaitInterval,
+            CreateNewConsole,
+            CommandLine,
+            CurrentDirectory,
+            EnvironmentOverrides);
     }
 
-    STARTUPINFOW StartupInfo = { 0 };
-    PROCESS_INFORMATION ProcessInfo = { 0 };
+    return hr;
+}
 
-    StartupInfo.cb = sizeof(STARTUPINFOW);
+/**
+ * @remark You can read the definition for this function in "NSudoAPI.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoGetLaunchTrace(
+    _Out_writes_opt_(Capacity) PNSUDO_LAUNCH_TRACE_EVENT Events,
+    _In_ DWORD Capacity,
+    _Out_ PDWORD ReturnCount)
+{
+    if ((!Events && Capacity) || !ReturnCount)
+    {
+        return E_INVALIDARG;
+    }
 
-    StartupInfo.lpDesktop = const_cast<LPWSTR>(L"WinSta0\\Default");
+    *ReturnCount = 0;
 
-    StartupInfo.dwFlags |= STARTF_USESHOWWINDOW;
-    StartupInfo.wShowWindow = static_cast<WORD>(ShowWindowMode);
+    if (!g_LaunchActivity)
+    {
+        return S_OK;
+    }
 
-    LPVOID lpEnvironment = nullptr;
+    Mile::TraceEvent TraceEvents[LaunchStageCount];
+    std::size_t Count = Mile::ReadTraceEvents(
+        g_LaunchActivity,
+        TraceEvents,
+        LaunchStageCount);
+    if (Count > LaunchStageCount)
+    {
+        // Only the stages which fit are read, and they are the earliest.
+        Count = LaunchStageCount;
+    }
 
-    LPWSTR ExpandedString = nullptr;
+    *ReturnCount = static_cast<DWORD>(Count);
 
-    hr = ::MileCreateEnvironmentBlock(&lpEnvironment, hToken, TRUE);
-    if (hr == S_OK)
+    if (Count > Capacity)
     {
-        hr = ::MileExpandEnvironmentStringsWithMemory(
-            CommandLine,
-            &ExpandedString);
-        if (hr == S_OK)
-        {
-            hr = ::MileCreateProcessAsUser(
-                hToken,
-                nullptr,
-                ExpandedString,
-                nullptr,
-                nullptr,
-                FALSE,
-                dwCreationFlags,
-                lpEnvironment,
-                CurrentDirectory,
-                &StartupInfo,
-                &ProcessInfo);
-            if (hr == S_OK)
-            {
-                ::MileSetPriorityClass(
-                    ProcessInfo.hProcess, ProcessPriority);
+        return ::MileHResultFromWin32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    for (std::size_t i = 0; i < Count; ++i)
+    {
+        Events[i].StartTime = TraceEvents[i].StartTime;
+        Events[i].Duration = TraceEvents[i].Duration;
+        Events[i].Stage = static_cast<NSUDO_LAUNCH_STAGE>(
+            TraceEvents[i].Stage);
+        Events[i].Result = TraceEvents[i].Result;
+        Events[i].HandleCount = TraceEvents[i].HandleCount;
+    }
 
-                ::MileResumeThread(ProcessInfo.hThread, nullptr);
+    return S_OK;
+}
 
-                ::MileWaitForSingleObject(
-                    ProcessInfo.hProcess, WaitInterval, FALSE, nullptr);
+/**
+ * @remark You can read the definition for this function in "NSudoAPI.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoFormatLaunchTrace(
+    _In_reads_(Count) const NSUDO_LAUNCH_TRACE_EVENT* Events,
+    _In_ DWORD Count,
+    _Out_writes_opt_(BufferLength) LPWSTR Buffer,
+    _In_ DWORD BufferLength,
+    _Out_ PDWORD ReturnLength)
+{
+    if ((!Events && Count) || (!Buffer && BufferLength) || !ReturnLength)
+    {
+        return E_INVALIDARG;
+    }
 
-                ::MileCloseHandle(ProcessInfo.hProcess);
-                ::MileCloseHandle(ProcessInfo.hThread);
-            }
+    *ReturnLength = 0;
 
-            ::MileFreeMemory(ExpandedString);
-        }
+    std::vector<Mile::TraceEvent> TraceEvents;
+    try
+    {
+        TraceEvents.resize(Count);
+    }
+    catch (std::bad_alloc const&)
+    {
+        return E_OUTOFMEMORY;
+    }
 
-        ::MileDestroyEnvironmentBlock(lpEnvironment);
+    for (DWORD i = 0; i < Count; ++i)
+    {
+        TraceEvents[i].StartTime = Events[i].StartTime;
+        TraceEvents[i].Duration = Events[i].Duration;
+        TraceEvents[i].Activity = 0;
+        TraceEvents[i].Stage = static_cast<std::uint32_t>(Events[i].Stage);
+        TraceEvents[i].Result = Events[i].Result;
+        TraceEvents[i].HandleCount = Events[i].HandleCount;
+    }
+
+    std::size_t Length = Mile::FormatTraceEvents(
+        TraceEvents.data(),
+        TraceEvents.size(),
+        g_LaunchStageNames,
+        LaunchStageCount,
+        Buffer,
+        BufferLength);
+
+    *ReturnLength = static_cast<DWORD>(Length + 1);
+
+    if (Length >= BufferLength)
+    {
+        return ::MileHResultFromWin32(ERROR_INSUFFICIENT_BUFFER);
     }
 
     return S_OK;
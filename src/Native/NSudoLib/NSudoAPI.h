@@ -80,6 +80,61 @@ typedef enum class _NSUDO_SHOW_WINDOW_MODE_TYPE
     MINIMIZE,
 } NSUDO_SHOW_WINDOW_MODE_TYPE, *PNSUDO_SHOW_WINDOW_MODE_TYPE;
 
+/**
+ * Contains values that specify the stages of a launch.
+ */
+typedef enum class _NSUDO_LAUNCH_STAGE
+{
+    LAUNCH, // The whole launch.
+    OPEN_CURRENT_PROCESS_TOKEN,
+    ENABLE_DEBUG_PRIVILEGE,
+    GET_ACTIVE_SESSION_ID,
+    GET_LSASS_PROCESS_ID,
+    OPEN_LSASS_PROCESS_TOKEN,
+    IMPERSONATE_SYSTEM,
+    START_TRUSTED_INSTALLER,
+    OPEN_USER_TOKEN,
+    PREPARE_USER_TOKEN,
+    CREATE_ENVIRONMENT_BLOCK,
+    PREPARE_ENVIRONMENT,
+    CREATE_PROCESS,
+    SET_PRIORITY_CLASS,
+    RESUME_THREAD,
+    WAIT_PROCESS,
+} NSUDO_LAUNCH_STAGE, *PNSUDO_LAUNCH_STAGE;
+
+/**
+ * Contains the information of a completed stage of a launch.
+ */
+typedef struct _NSUDO_LAUNCH_TRACE_EVENT
+{
+    /**
+     * The start time of the stage, in nanoseconds. Only the differences
+     * between the start times are meaningful.
+     */
+    ULONGLONG StartTime;
+
+    /**
+     * The duration of the stage, in nanoseconds.
+     */
+    ULONGLONG Duration;
+
+    /**
+     * The stage.
+     */
+    NSUDO_LAUNCH_STAGE Stage;
+
+    /**
+     * The result of the stage.
+     */
+    HRESULT Result;
+
+    /**
+     * The number of the handles of the calling process after the stage.
+     */
+    DWORD HandleCount;
+} NSUDO_LAUNCH_TRACE_EVENT, *PNSUDO_LAUNCH_TRACE_EVENT;
+
 /**
  * Creates a new process and its primary thread.
  *
@@ -126,4 +181,82 @@ EXTERN_C HRESULT WINAPI NSudoCreateProcess(
     _In_ LPCWSTR CommandLine,
     _In_opt_ LPCWSTR CurrentDirectory);
 
+/**
+ * Creates a new process and its primary thread with the overridden
+ * environment variables.
+ *
+ * @param UserModeType The same as NSudoCreateProcess.
+ * @param PrivilegesModeType The same as NSudoCreateProcess.
+ * @param MandatoryLabelType The same as NSudoCreateProcess.
+ * @param ProcessPriorityClassType The same as NSudoCreateProcess.
+ * @param ShowWindowModeType The same as NSudoCreateProcess.
+ * @param WaitInterval The same as NSudoCreateProcess.
+ * @param CreateNewConsole The same as NSudoCreateProcess.
+ * @param CommandLine The command line to be executed. The %NAME% references
+ *                    are expanded with the environment of the new process.
+ * @param CurrentDirectory The same as NSudoCreateProcess.
+ * @param EnvironmentOverrides The NUL-terminated strings followed by an empty
+ *                             string, the same as an environment block. The
+ *                             NAME=VALUE strings set the variables and the
+ *                             NAME strings without = remove them. If this
+ *                             parameter is nullptr, the new process uses the
+ *                             environment of the user.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @remark The environment block of the user is cached for a few seconds per
+ *         user and session, so the launches in a row only create it once.
+ */
+EXTERN_C HRESULT WINAPI NSudoCreateProcessWithEnvironment(
+    _In_ NSUDO_USER_MODE_TYPE UserModeType,
+    _In_ NSUDO_PRIVILEGES_MODE_TYPE PrivilegesModeType,
+    _In_ NSUDO_MANDATORY_LABEL_TYPE MandatoryLabelType,
+    _In_ NSUDO_PROCESS_PRIORITY_CLASS_TYPE ProcessPriorityClassType,
+    _In_ NSUDO_SHOW_WINDOW_MODE_TYPE ShowWindowModeType,
+    _In_ DWORD WaitInterval,
+    _In_ BOOL CreateNewConsole,
+    _In_ LPCWSTR CommandLine,
+    _In_opt_ LPCWSTR CurrentDirectory,
+    _In_opt_ LPCWSTR EnvironmentOverrides);
+
+/**
+ * Retrieves the stages of the last launch of the calling thread.
+ *
+ * @param Events The buffer which receives the stages sorted by their start
+ *               times. It can be nullptr if Capacity is 0.
+ * @param Capacity The number of the elements of the buffer.
+ * @param ReturnCount The number of the stages. If the buffer is too small,
+ *                    it receives the number of the elements needed.
+ * @return HRESULT. If the function succeeds, the return value is S_OK. If the
+ *         buffer is too small, the return value is
+ *         HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER).
+ * @remark The stages are recorded for every launch without locks. Each
+ *         thread keeps the latest 256 stages, so the trace should be
+ *         retrieved right after the launch.
+ */
+EXTERN_C HRESULT WINAPI NSudoGetLaunchTrace(
+    _Out_writes_opt_(Capacity) PNSUDO_LAUNCH_TRACE_EVENT Events,
+    _In_ DWORD Capacity,
+    _Out_ PDWORD ReturnCount);
+
+/**
+ * Formats the stages of a launch as a table.
+ *
+ * @param Events The stages from NSudoGetLaunchTrace.
+ * @param Count The number of the stages.
+ * @param Buffer The buffer which receives the NUL-terminated text. It can be
+ *               nullptr if BufferLength is 0.
+ * @param BufferLength The number of the characters of the buffer.
+ * @param ReturnLength The number of the characters of the text, including
+ *                     the terminating NUL. If the buffer is too small, it
+ *                     receives the number of the characters needed.
+ * @return HRESULT. If the function succeeds, the return value is S_OK. If the
+ *         buffer is too small, the return value is
+ *         HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER).
+ */
+EXTERN_C HRESULT WINAPI NSudoFormatLaunchTrace(
+    _In_reads_(Count) const NSUDO_LAUNCH_TRACE_EVENT* Events,
+    _In_ DWORD Count,
+    _Out_writes_opt_(BufferLength) LPWSTR Buffer,
+    _In_ DWORD BufferLength,
+    _Out_ PDWORD ReturnLength);
+
 #endif
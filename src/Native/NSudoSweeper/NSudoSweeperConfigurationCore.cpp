@@ -0,0 +1,220 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperConfigurationCore.cpp
+ * PURPOSE:   Implementation for the Cleanup Handler Configuration Lookup
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperConfigurationCore.h"
+
+#include <cwchar>
+
+namespace
+{
+    bool IsBlank(
+        wchar_t Character)
+    {
+        return Character == L' ' || Character == L'\t';
+    }
+
+    bool IsLineEnd(
+        wchar_t Character)
+    {
+        return Character == L'\0' || Character == L'\r' || Character == L'\n';
+    }
+
+    const wchar_t* SkipBlanks(
+        const wchar_t* Current)
+    {
+        while (IsBlank(*Current))
+        {
+            ++Current;
+        }
+        return Current;
+    }
+
+    /**
+     * Checks whether the rest of a line only contains blanks or a comment.
+     */
+    bool IsLineTail(
+        const wchar_t* Current)
+    {
+        Current = SkipBlanks(Current);
+        return IsLineEnd(*Current) || *Current == L'#';
+    }
+
+    /**
+     * Parses a single-line value.
+     *
+     * @param Current The first character of the value.
+     * @param Value The parsed value.
+     * @param IsString Receives whether the value is a string.
+     * @return If the value is valid, it returns true.
+     */
+    bool ParseValue(
+        const wchar_t* Current,
+        std::wstring& Value,
+        bool& IsString)
+    {
+        Value.clear();
+        IsString = (*Current == L'\'' || *Current == L'"');
+
+        if (*Current == L'\'')
+        {
+            for (++Current; *Current != L'\''; ++Current)
+            {
+                if (IsLineEnd(*Current))
+                {
+                    return false;
+                }
+                Value += *Current;
+            }
+            return IsLineTail(Current + 1);
+        }
+
+        if (*Current == L'"')
+        {
+            for (++Current; *Current != L'"'; ++Current)
+            {
+                if (IsLineEnd(*Current))
+                {
+                    return false;
+                }
+
+                if (*Current != L'\\')
+                {
+                    Value += *Current;
+                    continue;
+                }
+
+                switch (*++Current)
+                {
+                case L'\\':
+                    Value += L'\\';
+                    break;
+                case L'"':
+                    Value += L'"';
+                    break;
+                case L't':
+                    Value += L'\t';
+                    break;
+                case L'n':
+                    Value += L'\n';
+                    break;
+                case L'r':
+                    Value += L'\r';
+                    break;
+                default:
+                    return false;
+                }
+            }
+            return IsLineTail(Current + 1);
+        }
+
+        // The arrays and the inline tables are not supported.
+        if (*Current == L'[' || *Current == L'{')
+        {
+            return false;
+        }
+
+        while (!IsLineEnd(*Current) && !IsBlank(*Current) &&
+            *Current != L'#')
+        {
+            Value += *Current++;
+        }
+
+        return !Value.empty() && IsLineTail(Current);
+    }
+
+    /**
+     * Finds the first "Key = Value" line of a key and parses its value.
+     *
+     * @param Configuration The TOML configuration string.
+     * @param Key The name of the key.
+     * @param Value The parsed value, it is empty if the function fails.
+     * @param IsString Receives whether the value is a string.
+     * @return If the key is found and its value is valid, it returns true.
+     */
+    bool FindValue(
+        const wchar_t* Configuration,
+        const wchar_t* Key,
+        std::wstring& Value,
+        bool& IsString)
+    {
+        Value.clear();
+        IsString = false;
+
+        if (!Configuration || !Key)
+        {
+            return false;
+        }
+
+        const size_t KeyLength = std::wcslen(Key);
+
+        for (const wchar_t* Line = Configuration; *Line;)
+        {
+            const wchar_t* Current = SkipBlanks(Line);
+
+            if (std::wcsncmp(Current, Key, KeyLength) == 0)
+            {
+                Current = SkipBlanks(Current + KeyLength);
+                if (*Current == L'=')
+                {
+                    if (ParseValue(SkipBlanks(Current + 1), Value, IsString))
+                    {
+                        return true;
+                    }
+
+                    Value.clear();
+                    return false;
+                }
+            }
+
+            while (*Line && *Line != L'\n')
+            {
+                ++Line;
+            }
+            if (*Line)
+            {
+                ++Line;
+            }
+        }
+
+        return false;
+    }
+}
+
+bool NSudoSweeperGetConfigurationValue(
+    const wchar_t* Configuration,
+    const wchar_t* Key,
+    std::wstring& Value)
+{
+    bool IsString = false;
+    return FindValue(Configuration, Key, Value, IsString);
+}
+
+bool NSudoSweeperGetConfigurationBoolean(
+    const wchar_t* Configuration,
+    const wchar_t* Key,
+    bool DefaultValue)
+{
+    std::wstring Value;
+    bool IsString = false;
+    if (FindValue(Configuration, Key, Value, IsString) && !IsString)
+    {
+        if (Value == L"true")
+        {
+            return true;
+        }
+
+        if (Value == L"false")
+        {
+            return false;
+        }
+    }
+
+    return DefaultValue;
+}
@@ -0,0 +1,57 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperConfigurationCore.h
+ * PURPOSE:   Definition for the Cleanup Handler Configuration Lookup
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_CONFIGURATION_CORE
+#define NSUDO_SWEEPER_CONFIGURATION_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <string>
+
+/**
+ * Gets the value of a key in the TOML configuration string of a cleanup
+ * handler.
+ *
+ * @param Configuration The TOML configuration string.
+ * @param Key The name of the key, it is case-sensitive.
+ * @param Value The value of the key. The basic strings are unescaped, the
+ *              literal strings are kept as is, and the other values, such as
+ *              the booleans, are returned as their text.
+ * @return If the key is found and its value is a single-line value, it
+ *         returns true.
+ * @remark Only the "Key = Value" lines are recognized, the first one wins and
+ *         the table headers are ignored. The multi-line strings and the
+ *         values which span several lines, such as the arrays, are not
+ *         supported.
+ */
+bool NSudoSweeperGetConfigurationValue(
+    const wchar_t* Configuration,
+    const wchar_t* Key,
+    std::wstring& Value);
+
+/**
+ * Gets the boolean value of a key in the TOML configuration string of a
+ * cleanup handler.
+ *
+ * @param Configuration The TOML configuration string.
+ * @param Key The name of the key, it is case-sensitive.
+ * @param DefaultValue The value returned if the key is not found or its value
+ *                     is neither a bare true nor a bare false. The quoted
+ *                     strings are not treated as booleans.
+ * @return The boolean value of the key.
+ */
+bool NSudoSweeperGetConfigurationBoolean(
+    const wchar_t* Configuration,
+    const wchar_t* Key,
+    bool DefaultValue);
+
+#endif // !NSUDO_SWEEPER_CONFIGURATION_CORE
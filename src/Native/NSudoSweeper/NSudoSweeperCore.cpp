@@ -13,9 +13,105 @@
 #endif // !__cplusplus
 
 #include "NSudoSweeperCore.h"
+#include "NSudoSweeperConfigurationCore.h"
+#include "NSudoSweeperDeletion.h"
+#include "NSudoSweeperPath.h"
+#include "NSudoSweeperPathCore.h"
+#include "NSudoSweeperSnapshot.h"
+
+#include <Mile.Windows.h>
 
 #include <wchar.h>
 
+#include <string>
+#include <vector>
+
+namespace
+{
+    /**
+     * The path of the snapshot file used by the Temporary Folder cleanup
+     * handler.
+     */
+    const wchar_t TemporaryFolderSnapshotPath[] =
+        L"%LOCALAPPDATA%\\NSudoSweeper.TemporaryFolder.snapshot";
+
+    /**
+     * The default path of the temporary folder of an offline image, it can
+     * be replaced by the OfflinePath key of the configuration.
+     */
+    const wchar_t OfflineTemporaryFolderPath[] = L"%SystemRoot%\\Temp";
+
+    /**
+     * Collects the files in a directory tree. The reparse points are not
+     * followed.
+     *
+     * @param Path The path of the directory, it will be restored when the
+     *             function returns.
+     * @param FileNames The collected file names.
+     */
+    void CollectFiles(
+        _Inout_ std::wstring& Path,
+        _Inout_ std::vector<std::wstring>& FileNames)
+    {
+        const std::size_t PathLength = Path.size();
+
+        Path += L"\\*";
+
+        WIN32_FIND_DATAW FindData;
+        HANDLE FindHandle = ::FindFirstFileExW(
+            Path.c_str(),
+            FINDEX_INFO_LEVELS::FindExInfoBasic,
+            &FindData,
+            FINDEX_SEARCH_OPS::FindExSearchNameMatch,
+            nullptr,
+            FIND_FIRST_EX_LARGE_FETCH);
+
+        Path.resize(PathLength);
+
+        if (FindHandle == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        do
+        {
+            if (::wcscmp(FindData.cFileName, L".") == 0 ||
+                ::wcscmp(FindData.cFileName, L"..") == 0)
+            {
+                continue;
+            }
+
+            Path += L'\\';
+            Path += FindData.cFileName;
+
+            if (!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                FileNames.push_back(Path);
+            }
+            else if (!(FindData.dwFileAttributes
+                & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+                CollectFiles(Path, FileNames);
+            }
+
+            Path.resize(PathLength);
+
+        } while (::FindNextFileW(FindHandle, &FindData));
+
+        ::FindClose(FindHandle);
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperCore.h".
+ */
+Mile::ThreadPool& NSudoSweeperGetThreadPool()
+{
+    static Mile::ThreadPool Pool;
+    return Pool;
+}
+
 /**
  * @remark You can read the definition for this function in
  *         "NSudoSweeperCore.h".
@@ -23,9 +119,7 @@
 BOOL WINAPI NSudoSweeperIsOnlineImage(
     _In_ LPCWSTR SessionRootPath)
 {
-    UNREFERENCED_PARAMETER(SessionRootPath);
-
-    if (SessionRootPath)
+    if (!SessionRootPath)
     {
         return TRUE;
     }
@@ -35,9 +129,7 @@ BOOL WINAPI NSudoSweeperIsOnlineImage(
 
     if (::GetSystemDirectoryW(Buffer, BufferSize))
     {
-        ::wcschr(Buffer, '\\')[1] = '\0';
-
-        return (::_wcsicmp(SessionRootPath, Buffer) == 0);
+        return ::NSudoSweeperIsOnlineImageRoot(SessionRootPath, Buffer);
     }
 
     return FALSE;
@@ -83,5 +175,129 @@ EXTERN_C HRESULT WINAPI NSudoSweeperSystemRestorePointCleanupHandler(
     return S_OK;
 }
 
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperCore.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperTemporaryFolderCleanupHandler(
+    _In_ LPCWSTR Configuration,
+    _In_opt_ LPCWSTR SessionRootPath,
+    _Out_opt_ PUINT64 EstimatedFreedSize,
+    _In_opt_ NSudoSweeperCallback Callback,
+    _In_opt_ LPVOID UserData)
+{
+    if (!Configuration)
+    {
+        return E_INVALIDARG;
+    }
+
+    const bool IsOnlineImage =
+        !!::NSudoSweeperIsOnlineImage(SessionRootPath);
+
+    if (!IsOnlineImage && !::NSudoSweeperGetConfigurationBoolean(
+        Configuration,
+        L"OfflineImageSupport",
+        true))
+    {
+        return E_NOTIMPL;
+    }
+
+    std::wstring TemporaryPath;
+
+    if (IsOnlineImage)
+    {
+        wchar_t Buffer[MAX_PATH + 1];
+        DWORD Length = ::GetTempPathW(MAX_PATH + 1, Buffer);
+        if (!Length || Length > MAX_PATH)
+        {
+            return ::MileGetLastErrorWithWin32BoolAsHResult(FALSE);
+        }
+
+        // Remove the trailing backslash.
+        TemporaryPath.assign(Buffer, Length - 1);
+    }
+    else
+    {
+        // The temporary folders of the users cannot be located without
+        // loading the registry hives of the offline image, so only the
+        // temporary folder of the system is cleaned.
+        std::wstring OfflinePath;
+        if (!::NSudoSweeperGetConfigurationValue(
+            Configuration,
+            L"OfflinePath",
+            OfflinePath))
+        {
+            OfflinePath = OfflineTemporaryFolderPath;
+        }
+
+        LPWSTR ResolvedPath = nullptr;
+        HRESULT hr = ::NSudoSweeperResolvePath(
+            SessionRootPath,
+            OfflinePath.c_str(),
+            &ResolvedPath);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        TemporaryPath = ResolvedPath;
+        ::MileFreeMemory(ResolvedPath);
+    }
+
+    HRESULT hr = S_OK;
+
+    if (EstimatedFreedSize)
+    {
+        // The snapshot is only persisted for the online image, because an
+        // offline image is usually mounted at a different path every time.
+        LPWSTR SnapshotPath = nullptr;
+        if (!IsOnlineImage || S_OK != ::MileExpandEnvironmentStringsWithMemory(
+            TemporaryFolderSnapshotPath,
+            &SnapshotPath))
+        {
+            SnapshotPath = nullptr;
+        }
+
+        hr = ::NSudoSweeperEstimateDirectorySize(
+            TemporaryPath.c_str(),
+            SnapshotPath,
+            EstimatedFreedSize,
+            nullptr);
+
+        if (SnapshotPath)
+        {
+            ::MileFreeMemory(SnapshotPath);
+        }
+    }
+    else
+    {
+        std::wstring Path = TemporaryPath;
+        std::vector<std::wstring> FileNames;
+        CollectFiles(Path, FileNames);
+
+        std::vector<LPCWSTR> FileNamePointers;
+        FileNamePointers.reserve(FileNames.size());
+        for (const std::wstring& FileName : FileNames)
+        {
+            FileNamePointers.push_back(FileName.c_str());
+        }
+
+        hr = ::NSudoSweeperDeleteFiles(
+            FileNamePointers.data(),
+            FileNamePointers.size(),
+            0,
+            nullptr,
+            Callback,
+            UserData);
+        if (hr == S_FALSE)
+        {
+            // The files in use are expected in the temporary folder.
+            hr = S_OK;
+        }
+    }
+
+    return hr;
+}
+
 
 // NSudoSweeperStandardCleanupHandler
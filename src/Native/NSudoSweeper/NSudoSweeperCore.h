@@ -9,9 +9,14 @@
  */
 
 #ifndef NSUDO_SWEEPER_CORE
+#define NSUDO_SWEEPER_CORE
 
 #include <Windows.h>
 
+#ifdef __cplusplus
+#include <Mile.Platform.ThreadPool.h>
+#endif // __cplusplus
+
 /**
  * The message used to report the progress.
  *
@@ -20,6 +25,14 @@
  */
 #define NSUDO_SWEEPER_PROGRESS_MESSAGE 0x00000001
 
+/**
+ * The message used to report the size freed by the cleanup handler.
+ *
+ * @param A pointer to a UINT64 type variable that receives the total size
+ *        freed so far, in bytes.
+ */
+#define NSUDO_SWEEPER_FREED_SIZE_MESSAGE 0x00000002
+
 /**
  * A user-defined function that NSudo Sweeper API uses to report something.
  *
@@ -28,7 +41,9 @@
  *                  contents of this parameter depend on the value of the
  *                  Message parameter.
  * @param UserData User defined custom data.
- * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @return HRESULT. If the function succeeds, the return value is S_OK. If
+ *         the return value is not S_OK, the cleanup handler should stop as
+ *         soon as possible and return E_ABORT.
  */
 typedef HRESULT(WINAPI* NSudoSweeperCallback)(
     _In_ DWORD Message,
@@ -100,4 +115,54 @@ EXTERN_C HRESULT WINAPI NSudoSweeperSystemRestorePointCleanupHandler(
     _In_opt_ NSudoSweeperCallback Callback,
     _In_opt_ LPVOID UserData);
 
+/**
+ * The NSudo Sweeper Temporary Folder cleanup handler.
+ *
+ * @param Configuration A TOML configuration string that holds the information
+ *                      about the cleanup handler.
+ * @param SessionRootPath An absolute path with end of the backslash to the
+ *                        root directory of a Windows image which you want to
+ *                        operate. You can only use backslashes in this name.
+ *                        For example, you can use "C:\\" and "C:\\Image\\". If
+ *                        the pointer is NULL, the function will operate the
+ *                        online Windows image.
+ * @param EstimatedFreedSize A pointer to a variable that receives the size the
+ *                           cleanup handler can free. If the pointer is NULL,
+ *                           the cleanup handler will start cleaning.
+ * @param Callback A pointer to a user-defined NSudoSweeperCallback.
+ * @param UserData User defined custom data used by the Callback parameter.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @remark The estimation reuses a directory snapshot persisted in the local
+ *         application data folder, so only the changed directories are
+ *         enumerated again.
+ *
+ *         The configuration supports the following keys:
+ *         - OfflineImageSupport: If it is false, the offline images are not
+ *           supported and the function returns E_NOTIMPL for them. The
+ *           default value is true.
+ *         - OfflinePath: The rule path of the temporary folder of an offline
+ *           image, it is resolved by NSudoSweeperResolvePath. The default
+ *           value is "%SystemRoot%\Temp".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperTemporaryFolderCleanupHandler(
+    _In_ LPCWSTR Configuration,
+    _In_opt_ LPCWSTR SessionRootPath,
+    _Out_opt_ PUINT64 EstimatedFreedSize,
+    _In_opt_ NSudoSweeperCallback Callback,
+    _In_opt_ LPVOID UserData);
+
+#ifdef __cplusplus
+
+/**
+ * Gets the thread pool shared by the workers of NSudo Sweeper.
+ *
+ * @return The thread pool, it has a worker for each logical processor.
+ * @remark The pool is created on the first call. The deletion, the size
+ *         accounting and the plugin host run their lanes on it, so a cleanup
+ *         handler which deletes files does not create more threads.
+ */
+Mile::ThreadPool& NSudoSweeperGetThreadPool();
+
+#endif // __cplusplus
+
 #endif // !NSUDO_SWEEPER_CORE
@@ -0,0 +1,267 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperDeletion.cpp
+ * PURPOSE:   NSudo Sweeper Batched Deletion Pipeline Implementation for
+ *            Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include "NSudoSweeperDeletion.h"
+#include "NSudoSweeperDeletionCore.h"
+
+#include <Mile.Windows.h>
+#include <Mile.Platform.Windows.h>
+
+namespace
+{
+    /**
+     * The maximum number of the retry lane passes.
+     */
+    const DWORD RetryPassCount = 3;
+
+    /**
+     * The interval of the progress reporting, in milliseconds.
+     */
+    const DWORD ReportInterval = 100;
+
+    /**
+     * The user-defined callback of a NSudoSweeperDeleteFiles call.
+     */
+    struct DeletionCallback
+    {
+        NSudoSweeperCallback Callback;
+        LPVOID UserData;
+    };
+
+    /**
+     * Checks whether the failure is worth to be retried in the retry lane.
+     *
+     * @param hr The HRESULT of the failed deletion.
+     * @return Returns true if the failure may be caused by the readonly
+     *         attribute or another process which is using the file.
+     */
+    bool IsRetryableFailure(
+        _In_ HRESULT hr)
+    {
+        return (
+            hr == ::MileHResultFromWin32(ERROR_ACCESS_DENIED) ||
+            hr == ::MileHResultFromWin32(ERROR_SHARING_VIOLATION) ||
+            hr == ::MileHResultFromWin32(ERROR_LOCK_VIOLATION) ||
+            hr == ::MileHResultFromWin32(ERROR_USER_MAPPED_FILE));
+    }
+
+    /**
+     * Deletes a single file.
+     *
+     * @param FileName The path of the file.
+     * @param IgnoreReadonlyAttribute Removes the readonly attribute before the
+     *                                deletion if this parameter is true.
+     * @param FreedSize A pointer to a variable that receives the size freed by
+     *                  the deletion, in bytes.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     * @remark The main pass only issues one disposition request per file, the
+     *         attribute round-trips of MileDeleteFileIgnoreReadonlyAttribute
+     *         are only paid in the retry lane.
+     */
+    HRESULT DeleteSingleFile(
+        _In_ LPCWSTR FileName,
+        _In_ bool IgnoreReadonlyAttribute,
+        _Out_ PUINT64 FreedSize)
+    {
+        *FreedSize = 0;
+
+        HANDLE FileHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            FileName,
+            SYNCHRONIZE | DELETE | FILE_READ_ATTRIBUTES
+            | FILE_WRITE_ATTRIBUTES,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+            nullptr,
+            &FileHandle);
+        if (hr == S_OK)
+        {
+            FILE_STANDARD_INFO StandardInfo = { 0 };
+            if (S_OK != ::MileGetFileInformation(
+                FileHandle,
+                FILE_INFO_BY_HANDLE_CLASS::FileStandardInfo,
+                &StandardInfo,
+                sizeof(FILE_STANDARD_INFO)))
+            {
+                StandardInfo.NumberOfLinks = 0;
+            }
+
+            hr = IgnoreReadonlyAttribute
+                ? ::MileDeleteFileIgnoreReadonlyAttribute(FileHandle)
+                : ::MileDeleteFile(FileHandle);
+            if (hr == S_OK && StandardInfo.NumberOfLinks == 1)
+            {
+                // The space is only freed when the last link is deleted.
+                *FreedSize = static_cast<UINT64>(
+                    StandardInfo.AllocationSize.QuadPart);
+            }
+
+            ::MileCloseHandle(FileHandle);
+        }
+
+        return hr;
+    }
+
+    /**
+     * The RemoveFile operation of the deletion scheduler.
+     */
+    NSUDO_SWEEPER_DELETION_RESULT DeleteFileByHandle(
+        void* Context,
+        const wchar_t* FileName,
+        bool RetryPass,
+        uint64_t* FreedSize)
+    {
+        UNREFERENCED_PARAMETER(Context);
+
+        UINT64 Size = 0;
+        HRESULT hr = DeleteSingleFile(FileName, RetryPass, &Size);
+        *FreedSize = Size;
+
+        if (hr == S_OK)
+        {
+            return NSudoSweeperDeletionDeleted;
+        }
+
+        return IsRetryableFailure(hr)
+            ? NSudoSweeperDeletionRetryable
+            : NSudoSweeperDeletionFailed;
+    }
+
+    /**
+     * Reports the progress of the deletion.
+     *
+     * @param Callback The user-defined NSudoSweeperCallback.
+     * @param UserData User defined custom data used by the Callback parameter.
+     * @param ProcessedFileCount The number of the processed files.
+     * @param FileCount The number of all files.
+     * @param FreedSize The size freed so far, in bytes.
+     * @return HRESULT. If the Callback wants to continue, the return value is
+     *         S_OK.
+     */
+    HRESULT ReportDeletionProgressToCallback(
+        _In_opt_ NSudoSweeperCallback Callback,
+        _In_opt_ LPVOID UserData,
+        _In_ UINT64 ProcessedFileCount,
+        _In_ UINT64 FileCount,
+        _In_ UINT64 FreedSize)
+    {
+        if (!Callback)
+        {
+            return S_OK;
+        }
+
+        DWORD Progress = FileCount
+            ? static_cast<DWORD>(ProcessedFileCount * 100 / FileCount)
+            : 100;
+
+        HRESULT hr = Callback(
+            NSUDO_SWEEPER_PROGRESS_MESSAGE,
+            &Progress,
+            UserData);
+        if (hr == S_OK)
+        {
+            hr = Callback(
+                NSUDO_SWEEPER_FREED_SIZE_MESSAGE,
+                &FreedSize,
+                UserData);
+        }
+
+        return hr;
+    }
+
+    /**
+     * The ReportProgress operation of the deletion scheduler.
+     */
+    bool ReportDeletionProgress(
+        void* Context,
+        uint64_t ProcessedFileCount,
+        uint64_t FileCount,
+        uint64_t FreedSize)
+    {
+        DeletionCallback* Callback = static_cast<DeletionCallback*>(Context);
+
+        return S_OK == ReportDeletionProgressToCallback(
+            Callback->Callback,
+            Callback->UserData,
+            ProcessedFileCount,
+            FileCount,
+            FreedSize);
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperDeletion.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperDeleteFiles(
+    _In_ LPCWSTR* FileNames,
+    _In_ SIZE_T FileCount,
+    _In_ DWORD MaximumWorkerCount,
+    _Out_opt_ PNSUDO_SWEEPER_DELETION_STATISTICS Statistics,
+    _In_opt_ NSudoSweeperCallback Callback,
+    _In_opt_ LPVOID UserData)
+{
+    if (!FileNames && FileCount)
+    {
+        return E_INVALIDARG;
+    }
+
+    ULONGLONG StartTime = ::MileGetTickCount();
+
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = { 0 };
+    Options.LaneCount = MaximumWorkerCount;
+    Options.BatchSize = NSUDO_SWEEPER_DELETION_DEFAULT_BATCH_SIZE;
+    Options.RetryPassCount = RetryPassCount;
+    Options.RetryDelay = ReportInterval;
+    Options.ReportInterval = ReportInterval;
+
+    DeletionCallback CallbackContext = { Callback, UserData };
+
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = { 0 };
+    Backend.Context = &CallbackContext;
+    Backend.RemoveFile = DeleteFileByHandle;
+    Backend.ReportProgress = ReportDeletionProgress;
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = { 0 };
+
+    NSUDO_SWEEPER_DELETION_STATUS Status = ::NSudoSweeperRunDeletion(
+        FileNames,
+        FileCount,
+        ::NSudoSweeperGetThreadPool(),
+        &Options,
+        &Backend,
+        &Counters);
+
+    if (Statistics)
+    {
+        Statistics->FreedSize = Counters.FreedSize;
+        Statistics->DeletedFileCount = Counters.DeletedFileCount;
+        Statistics->RetriedFileCount = Counters.RetriedFileCount;
+        Statistics->FailedFileCount = Counters.FailedFileCount;
+        Statistics->ElapsedTime = ::MileGetTickCount() - StartTime;
+    }
+
+    switch (Status)
+    {
+    case NSudoSweeperDeletionCompleted:
+        return S_OK;
+    case NSudoSweeperDeletionPartiallyCompleted:
+        return S_FALSE;
+    default:
+        return E_ABORT;
+    }
+}
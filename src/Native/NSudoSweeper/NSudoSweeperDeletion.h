@@ -0,0 +1,89 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperDeletion.h
+ * PURPOSE:   NSudo Sweeper Batched Deletion Pipeline Definition for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_DELETION
+#define NSUDO_SWEEPER_DELETION
+
+#include "NSudoSweeperCore.h"
+
+/**
+ * The statistics of a NSudoSweeperDeleteFiles call.
+ */
+typedef struct _NSUDO_SWEEPER_DELETION_STATISTICS
+{
+    /**
+     * The total size freed by the deletion, in bytes. The files still
+     * referenced by other hard links are not counted.
+     */
+    UINT64 FreedSize;
+
+    /**
+     * The number of the deleted files.
+     */
+    UINT64 DeletedFileCount;
+
+    /**
+     * The number of the files which went through the retry lane because they
+     * were readonly or in use.
+     */
+    UINT64 RetriedFileCount;
+
+    /**
+     * The number of the files which cannot be deleted.
+     */
+    UINT64 FailedFileCount;
+
+    /**
+     * The elapsed time of the deletion, in milliseconds. The throughput in
+     * files per second is DeletedFileCount * 1000 / ElapsedTime.
+     */
+    ULONGLONG ElapsedTime;
+
+} NSUDO_SWEEPER_DELETION_STATISTICS, *PNSUDO_SWEEPER_DELETION_STATISTICS;
+
+/**
+ * Deletes a batch of files on the shared thread pool.
+ *
+ * @param FileNames An array of the absolute paths of the files to be deleted.
+ *                  You can only use backslashes in these names.
+ * @param FileCount The number of elements in the FileNames array.
+ * @param MaximumWorkerCount The maximum number of the batches deleted at the
+ *                           same time. If this parameter is 0, the number of
+ *                           the workers of the shared thread pool will be
+ *                           used.
+ * @param Statistics A pointer to a NSUDO_SWEEPER_DELETION_STATISTICS
+ *                   structure that receives the statistics of the deletion.
+ *                   This parameter can be NULL.
+ * @param Callback A pointer to a user-defined NSudoSweeperCallback. It will
+ *                 receive the NSUDO_SWEEPER_PROGRESS_MESSAGE and the
+ *                 NSUDO_SWEEPER_FREED_SIZE_MESSAGE messages periodically, and
+ *                 it is always called from the calling thread.
+ * @param UserData User defined custom data used by the Callback parameter.
+ * @return HRESULT. If the function succeeds, the return value is S_OK. If
+ *         some of the files cannot be deleted, the return value is S_FALSE.
+ *         If the Callback returns a value other than S_OK, the deletion is
+ *         cancelled and the return value is E_ABORT.
+ * @remark The files are grouped by their parent directories and each batch of
+ *         a directory is deleted by a single worker, so the workers do not
+ *         contend for the same directory. The readonly files and the files in
+ *         use are moved to a retry lane which is processed after the main
+ *         pass. The scheduling is done by NSudoSweeperRunDeletion, this
+ *         function deletes the files through the disposition requests of
+ *         their handles.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperDeleteFiles(
+    _In_ LPCWSTR* FileNames,
+    _In_ SIZE_T FileCount,
+    _In_ DWORD MaximumWorkerCount,
+    _Out_opt_ PNSUDO_SWEEPER_DELETION_STATISTICS Statistics,
+    _In_opt_ NSudoSweeperCallback Callback,
+    _In_opt_ LPVOID UserData);
+
+#endif // !NSUDO_SWEEPER_DELETION
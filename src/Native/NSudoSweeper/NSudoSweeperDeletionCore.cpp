@@ -0,0 +1,411 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperDeletionCore.cpp
+ * PURPOSE:   Implementation for the Batched Deletion Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperDeletionCore.h"
+
+#include <Mile.Platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+    wchar_t FoldCharacter(
+        wchar_t Character)
+    {
+        if (Character >= L'a' && Character <= L'z')
+        {
+            return static_cast<wchar_t>(Character - (L'a' - L'A'));
+        }
+
+        return Character;
+    }
+
+    /**
+     * Compares the first characters of two paths case-insensitively.
+     *
+     * @return The same as wcsncmp.
+     */
+    int ComparePaths(
+        const wchar_t* Left,
+        const wchar_t* Right,
+        size_t Length)
+    {
+        for (size_t i = 0; i < Length; ++i)
+        {
+            wchar_t LeftCharacter = FoldCharacter(Left[i]);
+            wchar_t RightCharacter = FoldCharacter(Right[i]);
+            if (LeftCharacter != RightCharacter)
+            {
+                return LeftCharacter < RightCharacter ? -1 : 1;
+            }
+
+            if (!LeftCharacter)
+            {
+                break;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * An item with the length of the parent directory of its path.
+     */
+    struct SortKey
+    {
+        size_t Item;
+        size_t ParentLength;
+    };
+
+    bool IsOrderedByDirectory(
+        const wchar_t* Left,
+        size_t LeftLength,
+        const wchar_t* Right,
+        size_t RightLength)
+    {
+        int Result = ComparePaths(
+            Left,
+            Right,
+            LeftLength < RightLength ? LeftLength : RightLength);
+        if (Result != 0)
+        {
+            return Result < 0;
+        }
+
+        if (LeftLength != RightLength)
+        {
+            return LeftLength < RightLength;
+        }
+
+        return ComparePaths(Left, Right, static_cast<size_t>(-1)) < 0;
+    }
+
+    /**
+     * The shared state of a NSudoSweeperRunDeletion pass.
+     */
+    struct DeletionContext
+    {
+        const wchar_t* const* FileNames;
+        const NSUDO_SWEEPER_DELETION_BACKEND* Backend;
+
+        bool RetryPass;
+
+        const std::vector<size_t>* Items;
+        std::vector<NSUDO_SWEEPER_DELETION_BATCH> Batches;
+
+        std::atomic<size_t> NextBatch;
+        std::atomic<bool> Cancelled;
+
+        std::atomic<uint64_t> FreedSize;
+        std::atomic<uint64_t> DeletedFileCount;
+        std::atomic<uint64_t> ProcessedFileCount;
+        std::atomic<uint64_t> FailedFileCount;
+
+        Mile::Mutex RetryItemsLock;
+        std::vector<size_t> RetryItems;
+    };
+
+    /**
+     * The lane of a NSudoSweeperRunDeletion pass, it deletes the batches
+     * until all batches are taken or the pass is cancelled.
+     *
+     * @param Context The shared state of the pass.
+     */
+    void RunDeletionLane(
+        DeletionContext* Context)
+    {
+        const size_t BatchCount = Context->Batches.size();
+
+        for (;;)
+        {
+            size_t Current = Context->NextBatch.fetch_add(1);
+            if (Current >= BatchCount || Context->Cancelled)
+            {
+                break;
+            }
+
+            const NSUDO_SWEEPER_DELETION_BATCH& Batch =
+                Context->Batches[Current];
+
+            for (size_t i = Batch.Begin; i < Batch.End; ++i)
+            {
+                if (Context->Cancelled)
+                {
+                    break;
+                }
+
+                size_t Item = (*Context->Items)[i];
+
+                uint64_t FreedSize = 0;
+                NSUDO_SWEEPER_DELETION_RESULT Result =
+                    Context->Backend->RemoveFile(
+                        Context->Backend->Context,
+                        Context->FileNames[Item],
+                        Context->RetryPass,
+                        &FreedSize);
+                if (Result == NSudoSweeperDeletionDeleted)
+                {
+                    Context->FreedSize += FreedSize;
+                    ++Context->DeletedFileCount;
+                }
+                else if (Result == NSudoSweeperDeletionRetryable)
+                {
+                    Mile::AutoMutexLock Lock(Context->RetryItemsLock);
+                    Context->RetryItems.push_back(Item);
+                }
+                else
+                {
+                    ++Context->FailedFileCount;
+                }
+
+                ++Context->ProcessedFileCount;
+            }
+        }
+    }
+
+    bool ReportDeletionProgress(
+        const NSUDO_SWEEPER_DELETION_BACKEND* Backend,
+        const DeletionContext& Context,
+        size_t FileCount)
+    {
+        if (!Backend->ReportProgress)
+        {
+            return true;
+        }
+
+        return Backend->ReportProgress(
+            Backend->Context,
+            Context.ProcessedFileCount,
+            FileCount,
+            Context.FreedSize);
+    }
+}
+
+size_t NSudoSweeperGetParentDirectoryLength(
+    const wchar_t* FileName)
+{
+    size_t Length = 0;
+    for (size_t i = 0; FileName[i]; ++i)
+    {
+        if (FileName[i] == L'\\' || FileName[i] == L'/')
+        {
+            Length = i;
+        }
+    }
+
+    return Length;
+}
+
+bool NSudoSweeperIsOrderedByDirectory(
+    const wchar_t* Left,
+    const wchar_t* Right)
+{
+    return IsOrderedByDirectory(
+        Left,
+        ::NSudoSweeperGetParentDirectoryLength(Left),
+        Right,
+        ::NSudoSweeperGetParentDirectoryLength(Right));
+}
+
+void NSudoSweeperSortDeletionItems(
+    const wchar_t* const* FileNames,
+    std::vector<size_t>& Items)
+{
+    // The lengths of the parent directories are computed once per item
+    // instead of once per comparison.
+    std::vector<SortKey> Keys(Items.size());
+    for (size_t i = 0; i < Items.size(); ++i)
+    {
+        Keys[i].Item = Items[i];
+        Keys[i].ParentLength =
+            ::NSudoSweeperGetParentDirectoryLength(FileNames[Items[i]]);
+    }
+
+    std::sort(
+        Keys.begin(),
+        Keys.end(),
+        [FileNames](const SortKey& Left, const SortKey& Right) -> bool
+        {
+            return IsOrderedByDirectory(
+                FileNames[Left.Item],
+                Left.ParentLength,
+                FileNames[Right.Item],
+                Right.ParentLength);
+        });
+
+    for (size_t i = 0; i < Items.size(); ++i)
+    {
+        Items[i] = Keys[i].Item;
+    }
+}
+
+void NSudoSweeperBuildDeletionBatches(
+    const wchar_t* const* FileNames,
+    const std::vector<size_t>& Items,
+    size_t BatchSize,
+    std::vector<NSUDO_SWEEPER_DELETION_BATCH>& Batches)
+{
+    if (!BatchSize)
+    {
+        BatchSize = NSUDO_SWEEPER_DELETION_DEFAULT_BATCH_SIZE;
+    }
+
+    Batches.clear();
+
+    size_t Begin = 0;
+    while (Begin < Items.size())
+    {
+        const wchar_t* First = FileNames[Items[Begin]];
+        size_t FirstLength = ::NSudoSweeperGetParentDirectoryLength(First);
+
+        size_t End = Begin + 1;
+        while (End < Items.size() && End - Begin < BatchSize)
+        {
+            const wchar_t* Current = FileNames[Items[End]];
+            if (::NSudoSweeperGetParentDirectoryLength(
+                Current) != FirstLength ||
+                ComparePaths(First, Current, FirstLength) != 0)
+            {
+                break;
+            }
+
+            ++End;
+        }
+
+        Batches.push_back(NSUDO_SWEEPER_DELETION_BATCH{ Begin, End });
+
+        Begin = End;
+    }
+}
+
+NSUDO_SWEEPER_DELETION_STATUS NSudoSweeperRunDeletion(
+    const wchar_t* const* FileNames,
+    size_t FileCount,
+    Mile::ThreadPool& Pool,
+    const NSUDO_SWEEPER_DELETION_OPTIONS* Options,
+    const NSUDO_SWEEPER_DELETION_BACKEND* Backend,
+    PNSUDO_SWEEPER_DELETION_COUNTERS Counters)
+{
+    uint32_t LaneCount = Options->LaneCount;
+    if (!LaneCount)
+    {
+        // A pool without workers runs the lanes when they are waited.
+        LaneCount = std::max<uint32_t>(Pool.GetWorkerCount(), 1);
+    }
+
+    std::vector<size_t> Items(FileCount);
+    for (size_t i = 0; i < FileCount; ++i)
+    {
+        Items[i] = i;
+    }
+
+    ::NSudoSweeperSortDeletionItems(FileNames, Items);
+
+    DeletionContext Context;
+    Context.FileNames = FileNames;
+    Context.Backend = Backend;
+    Context.Cancelled = false;
+    Context.FreedSize = 0;
+    Context.DeletedFileCount = 0;
+    Context.ProcessedFileCount = 0;
+    Context.FailedFileCount = 0;
+
+    uint64_t RetriedFileCount = 0;
+
+    NSUDO_SWEEPER_DELETION_STATUS Status = NSudoSweeperDeletionCompleted;
+
+    for (uint32_t Pass = 0;
+        Pass <= Options->RetryPassCount && !Items.empty();
+        ++Pass)
+    {
+        if (Pass)
+        {
+            // Give the other processes a chance to release the files.
+            std::this_thread::sleep_for(std::chrono::milliseconds(
+                static_cast<uint64_t>(Options->RetryDelay) * Pass));
+
+            if (Pass == 1)
+            {
+                RetriedFileCount = Items.size();
+            }
+
+            // The retried items are processed again, so they are not counted
+            // twice in the progress.
+            Context.ProcessedFileCount -= Items.size();
+        }
+
+        Context.RetryPass = (Pass != 0);
+        Context.Items = &Items;
+        Context.NextBatch = 0;
+        Context.RetryItems.clear();
+        ::NSudoSweeperBuildDeletionBatches(
+            FileNames,
+            Items,
+            Options->BatchSize,
+            Context.Batches);
+
+        size_t Lanes = std::min<size_t>(LaneCount, Context.Batches.size());
+
+        Mile::TaskGroup Group(Pool);
+
+        for (size_t i = 0; i < Lanes; ++i)
+        {
+            Group.Run([&Context]()
+            {
+                RunDeletionLane(&Context);
+            });
+        }
+
+        while (!Group.WaitFor(Options->ReportInterval))
+        {
+            if (!ReportDeletionProgress(Backend, Context, FileCount))
+            {
+                // The lanes stop at the next file.
+                Context.Cancelled = true;
+            }
+        }
+
+        ::NSudoSweeperSortDeletionItems(FileNames, Context.RetryItems);
+
+        Items.swap(Context.RetryItems);
+
+        if (Context.Cancelled)
+        {
+            Status = NSudoSweeperDeletionCancelled;
+            break;
+        }
+    }
+
+    if (Status != NSudoSweeperDeletionCancelled)
+    {
+        // The items left in the retry lane are failed.
+        Context.FailedFileCount += Items.size();
+
+        ReportDeletionProgress(Backend, Context, FileCount);
+
+        if (Context.FailedFileCount)
+        {
+            Status = NSudoSweeperDeletionPartiallyCompleted;
+        }
+    }
+
+    if (Counters)
+    {
+        Counters->FreedSize = Context.FreedSize;
+        Counters->DeletedFileCount = Context.DeletedFileCount;
+        Counters->RetriedFileCount = RetriedFileCount;
+        Counters->FailedFileCount = Context.FailedFileCount;
+    }
+
+    return Status;
+}
@@ -0,0 +1,270 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperDeletionCore.h
+ * PURPOSE:   Definition for the Batched Deletion Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_DELETION_CORE
+#define NSUDO_SWEEPER_DELETION_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * The default maximum number of the files in a batch.
+ */
+#define NSUDO_SWEEPER_DELETION_DEFAULT_BATCH_SIZE 1024
+
+/**
+ * The result of the deletion of a single file.
+ */
+typedef enum _NSUDO_SWEEPER_DELETION_RESULT
+{
+    /**
+     * The file is deleted.
+     */
+    NSudoSweeperDeletionDeleted,
+
+    /**
+     * The file cannot be deleted now, for example, it is readonly or in use.
+     * It is moved to the retry lane.
+     */
+    NSudoSweeperDeletionRetryable,
+
+    /**
+     * The file cannot be deleted.
+     */
+    NSudoSweeperDeletionFailed,
+
+} NSUDO_SWEEPER_DELETION_RESULT;
+
+/**
+ * The status of a deletion.
+ */
+typedef enum _NSUDO_SWEEPER_DELETION_STATUS
+{
+    /**
+     * All files are deleted.
+     */
+    NSudoSweeperDeletionCompleted,
+
+    /**
+     * Some of the files cannot be deleted.
+     */
+    NSudoSweeperDeletionPartiallyCompleted,
+
+    /**
+     * The progress callback cancelled the deletion.
+     */
+    NSudoSweeperDeletionCancelled,
+
+} NSUDO_SWEEPER_DELETION_STATUS;
+
+/**
+ * A batch of the files in the same directory, it is the range of the sorted
+ * items deleted by a single lane.
+ */
+typedef struct _NSUDO_SWEEPER_DELETION_BATCH
+{
+    size_t Begin;
+    size_t End;
+
+} NSUDO_SWEEPER_DELETION_BATCH, *PNSUDO_SWEEPER_DELETION_BATCH;
+
+/**
+ * The operations used by the deletion scheduler.
+ */
+typedef struct _NSUDO_SWEEPER_DELETION_BACKEND
+{
+    /**
+     * User defined custom data passed to the operations.
+     */
+    void* Context;
+
+    /**
+     * Deletes a single file, it is called from the lanes concurrently.
+     *
+     * @param Context The Context member.
+     * @param FileName The path of the file.
+     * @param RetryPass Whether it is called from the retry lane, the backend
+     *                  should remove the readonly attribute in this case.
+     * @param FreedSize A pointer to a variable that receives the size freed
+     *                  by the deletion, in bytes.
+     */
+    NSUDO_SWEEPER_DELETION_RESULT (*RemoveFile)(
+        void* Context,
+        const wchar_t* FileName,
+        bool RetryPass,
+        uint64_t* FreedSize);
+
+    /**
+     * Reports the progress, it is always called from the calling thread of
+     * NSudoSweeperRunDeletion. This member can be nullptr.
+     *
+     * @param Context The Context member.
+     * @param ProcessedFileCount The number of the processed files.
+     * @param FileCount The number of all files.
+     * @param FreedSize The size freed so far, in bytes.
+     * @return If it returns false, the deletion is cancelled.
+     */
+    bool (*ReportProgress)(
+        void* Context,
+        uint64_t ProcessedFileCount,
+        uint64_t FileCount,
+        uint64_t FreedSize);
+
+} NSUDO_SWEEPER_DELETION_BACKEND, *PNSUDO_SWEEPER_DELETION_BACKEND;
+
+/**
+ * The options of the deletion scheduler.
+ */
+typedef struct _NSUDO_SWEEPER_DELETION_OPTIONS
+{
+    /**
+     * The maximum number of the batches deleted at the same time. If it is
+     * 0, the number of the workers of the thread pool is used.
+     */
+    uint32_t LaneCount;
+
+    /**
+     * The maximum number of the files in a batch. If it is 0,
+     * NSUDO_SWEEPER_DELETION_DEFAULT_BATCH_SIZE is used.
+     */
+    size_t BatchSize;
+
+    /**
+     * The maximum number of the retry lane passes.
+     */
+    uint32_t RetryPassCount;
+
+    /**
+     * The delay before the first retry lane pass, in milliseconds. The
+     * delay grows linearly with the passes.
+     */
+    uint32_t RetryDelay;
+
+    /**
+     * The interval of the progress reporting, in milliseconds.
+     */
+    uint32_t ReportInterval;
+
+} NSUDO_SWEEPER_DELETION_OPTIONS, *PNSUDO_SWEEPER_DELETION_OPTIONS;
+
+/**
+ * The statistics of a deletion.
+ */
+typedef struct _NSUDO_SWEEPER_DELETION_COUNTERS
+{
+    /**
+     * The total size freed by the deletion, in bytes.
+     */
+    uint64_t FreedSize;
+
+    /**
+     * The number of the deleted files.
+     */
+    uint64_t DeletedFileCount;
+
+    /**
+     * The number of the files which went through the retry lane.
+     */
+    uint64_t RetriedFileCount;
+
+    /**
+     * The number of the files which cannot be deleted.
+     */
+    uint64_t FailedFileCount;
+
+} NSUDO_SWEEPER_DELETION_COUNTERS, *PNSUDO_SWEEPER_DELETION_COUNTERS;
+
+/**
+ * Gets the length of the parent directory part of a path.
+ *
+ * @param FileName The path, both backslashes and slashes are separators.
+ * @return The length of the parent directory part, in characters.
+ */
+size_t NSudoSweeperGetParentDirectoryLength(
+    const wchar_t* FileName);
+
+/**
+ * Compares two paths by their parent directories first, so the files in the
+ * same directory are adjacent after sorting.
+ *
+ * @param Left The first path.
+ * @param Right The second path.
+ * @return Returns true if the Left path should be ordered before the Right
+ *         path.
+ * @remark The characters are compared case-insensitively for ASCII only. The
+ *         directories whose names only differ in the case of the other
+ *         characters are put into different batches, which only costs
+ *         contention between the lanes.
+ */
+bool NSudoSweeperIsOrderedByDirectory(
+    const wchar_t* Left,
+    const wchar_t* Right);
+
+/**
+ * Sorts the indexes of the paths by their parent directories.
+ *
+ * @param FileNames The array of the paths.
+ * @param Items The indexes of the paths.
+ */
+void NSudoSweeperSortDeletionItems(
+    const wchar_t* const* FileNames,
+    std::vector<size_t>& Items);
+
+/**
+ * Splits the sorted items into the batches of the same directory.
+ *
+ * @param FileNames The array of the paths.
+ * @param Items The indexes of the paths, sorted by the directory.
+ * @param BatchSize The maximum number of the files in a batch, 0 is the same
+ *                  as NSUDO_SWEEPER_DELETION_DEFAULT_BATCH_SIZE.
+ * @param Batches The batches of the items.
+ * @remark A directory with more files than the batch size is split into
+ *         several batches, so it does not serialize the whole deletion on a
+ *         single lane.
+ */
+void NSudoSweeperBuildDeletionBatches(
+    const wchar_t* const* FileNames,
+    const std::vector<size_t>& Items,
+    size_t BatchSize,
+    std::vector<NSUDO_SWEEPER_DELETION_BATCH>& Batches);
+
+/**
+ * Deletes the files in batches on a thread pool.
+ *
+ * @param FileNames An array of the paths of the files to be deleted.
+ * @param FileCount The number of elements in the FileNames array.
+ * @param Pool The thread pool which runs the lanes.
+ * @param Options The options of the deletion.
+ * @param Backend The operations used by the deletion.
+ * @param Counters A pointer to a variable that receives the statistics of the
+ *                 deletion. This parameter can be nullptr.
+ * @return The status of the deletion.
+ * @remark The files which are retryable are deleted again in the retry lane
+ *         after the main pass, the files left after the last retry pass are
+ *         failed. If the deletion is cancelled, the lanes stop at the next
+ *         file and the retry lane is skipped.
+ */
+NSUDO_SWEEPER_DELETION_STATUS NSudoSweeperRunDeletion(
+    const wchar_t* const* FileNames,
+    size_t FileCount,
+    Mile::ThreadPool& Pool,
+    const NSUDO_SWEEPER_DELETION_OPTIONS* Options,
+    const NSUDO_SWEEPER_DELETION_BACKEND* Backend,
+    PNSUDO_SWEEPER_DELETION_COUNTERS Counters);
+
+#endif // !NSUDO_SWEEPER_DELETION_CORE
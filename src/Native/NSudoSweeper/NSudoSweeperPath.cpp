@@ -0,0 +1,80 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPath.cpp
+ * PURPOSE:   NSudo Sweeper Path Resolution Implementation for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include "NSudoSweeperPath.h"
+#include "NSudoSweeperPathCore.h"
+
+#include <Mile.Windows.h>
+
+#include <wchar.h>
+
+#include <string>
+
+namespace
+{
+    /**
+     * Copies a string to a buffer allocated by the MileAllocMemory function.
+     *
+     * @param Source The string.
+     * @param Destination A pointer to a variable that receives the buffer.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT DuplicateString(
+        _In_ const std::wstring& Source,
+        _Out_ LPWSTR* Destination)
+    {
+        HRESULT hr = ::MileAllocMemory(
+            (Source.size() + 1) * sizeof(wchar_t),
+            reinterpret_cast<LPVOID*>(Destination));
+        if (hr == S_OK)
+        {
+            ::wcscpy_s(*Destination, Source.size() + 1, Source.c_str());
+        }
+
+        return hr;
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperPath.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperResolvePath(
+    _In_opt_ LPCWSTR SessionRootPath,
+    _In_ LPCWSTR Path,
+    _Out_ LPWSTR* ResolvedPath)
+{
+    if (!Path || !ResolvedPath)
+    {
+        return E_INVALIDARG;
+    }
+
+    *ResolvedPath = nullptr;
+
+    if (::NSudoSweeperIsOnlineImage(SessionRootPath))
+    {
+        return ::MileExpandEnvironmentStringsWithMemory(Path, ResolvedPath);
+    }
+
+    std::wstring Result;
+    switch (::NSudoSweeperResolveOfflinePath(SessionRootPath, Path, Result))
+    {
+    case NSudoSweeperPathResolved:
+        return DuplicateString(Result, ResolvedPath);
+    case NSudoSweeperPathVariableNotFound:
+        return ::MileHResultFromWin32(ERROR_ENVVAR_NOT_FOUND);
+    default:
+        return E_INVALIDARG;
+    }
+}
@@ -0,0 +1,49 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPath.h
+ * PURPOSE:   NSudo Sweeper Path Resolution Definition for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_PATH
+#define NSUDO_SWEEPER_PATH
+
+#include "NSudoSweeperCore.h"
+
+/**
+ * Resolves a rule path for a Windows image.
+ *
+ * @param SessionRootPath An absolute path with end of the backslash to the
+ *                        root directory of a Windows image which you want to
+ *                        operate. You can only use backslashes in this name.
+ *                        For example, you can use "C:\\" and "C:\\Image\\". If
+ *                        the pointer is NULL, the function will operate the
+ *                        online Windows image.
+ * @param Path The rule path. It should be an absolute path with the drive
+ *             letter of the image or start with an environment variable, for
+ *             example, "C:\\Windows\\Temp" or "%SystemRoot%\\Temp".
+ * @param ResolvedPath A pointer to a variable that receives the resolved
+ *                     path. You should free it by calling the MileFreeMemory
+ *                     function.
+ * @return HRESULT. If the function succeeds, the return value is S_OK. If
+ *         the path contains an environment variable which is not available
+ *         for an offline image, the return value is
+ *         HRESULT_FROM_WIN32(ERROR_ENVVAR_NOT_FOUND).
+ * @remark For the online image, the environment variables are expanded with
+ *         the environment of the current process. For an offline image, the
+ *         path is resolved by NSudoSweeperResolveOfflinePath, only the
+ *         system-wide environment variables are supported and they are
+ *         mapped to their default locations, then the drive part of the path
+ *         is replaced with the session root path. The paths which contain a
+ *         ".." component are rejected for an offline image, so the resolved
+ *         path never leaves the session root path.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperResolvePath(
+    _In_opt_ LPCWSTR SessionRootPath,
+    _In_ LPCWSTR Path,
+    _Out_ LPWSTR* ResolvedPath);
+
+#endif // !NSUDO_SWEEPER_PATH
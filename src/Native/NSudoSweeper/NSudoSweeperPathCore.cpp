@@ -0,0 +1,239 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPathCore.cpp
+ * PURPOSE:   Implementation for the Offline Image Path Resolution
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperPathCore.h"
+
+#include <cwchar>
+
+namespace
+{
+    /**
+     * The system-wide environment variable of an offline image.
+     */
+    struct OfflineVariable
+    {
+        const wchar_t* Name;
+        const wchar_t* Value;
+    };
+
+    /**
+     * The default locations of the system-wide environment variables,
+     * relative to the root directory of the image.
+     */
+    const OfflineVariable OfflineVariables[] =
+    {
+        { L"SystemDrive", L"" },
+        { L"SystemRoot", L"\\Windows" },
+        { L"windir", L"\\Windows" },
+        { L"ProgramData", L"\\ProgramData" },
+        { L"ALLUSERSPROFILE", L"\\ProgramData" },
+        { L"ProgramFiles", L"\\Program Files" },
+        { L"ProgramW6432", L"\\Program Files" },
+        { L"ProgramFiles(x86)", L"\\Program Files (x86)" },
+        { L"CommonProgramFiles", L"\\Program Files\\Common Files" },
+        { L"CommonProgramW6432", L"\\Program Files\\Common Files" },
+        {
+            L"CommonProgramFiles(x86)",
+            L"\\Program Files (x86)\\Common Files"
+        },
+        { L"PUBLIC", L"\\Users\\Public" },
+    };
+
+    wchar_t FoldCharacter(
+        wchar_t Character)
+    {
+        if (Character >= L'a' && Character <= L'z')
+        {
+            return static_cast<wchar_t>(Character - (L'a' - L'A'));
+        }
+
+        return Character;
+    }
+
+    bool IsSeparator(
+        wchar_t Character)
+    {
+        return Character == L'\\' || Character == L'/';
+    }
+
+    /**
+     * Checks whether the path contains a ".." component.
+     *
+     * @param Path The path.
+     * @return Returns true if the path contains a ".." component.
+     */
+    bool HasParentDirectoryComponent(
+        const std::wstring& Path)
+    {
+        size_t Begin = 0;
+        while (Begin <= Path.size())
+        {
+            size_t End = Begin;
+            while (End < Path.size() && !IsSeparator(Path[End]))
+            {
+                ++End;
+            }
+
+            if (End - Begin == 2 && Path[Begin] == L'.' &&
+                Path[Begin + 1] == L'.')
+            {
+                return true;
+            }
+
+            Begin = End + 1;
+        }
+
+        return false;
+    }
+}
+
+bool NSudoSweeperIsOnlineImageRoot(
+    const wchar_t* SessionRootPath,
+    const wchar_t* SystemDirectory)
+{
+    if (!SessionRootPath)
+    {
+        return true;
+    }
+
+    if (!SystemDirectory)
+    {
+        return false;
+    }
+
+    const wchar_t* Separator = std::wcschr(SystemDirectory, L'\\');
+    if (!Separator)
+    {
+        return false;
+    }
+
+    const size_t RootLength =
+        static_cast<size_t>(Separator - SystemDirectory) + 1;
+    if (std::wcslen(SessionRootPath) != RootLength)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < RootLength; ++i)
+    {
+        if (FoldCharacter(SessionRootPath[i]) !=
+            FoldCharacter(SystemDirectory[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const wchar_t* NSudoSweeperFindOfflineVariable(
+    const wchar_t* Name,
+    size_t NameLength)
+{
+    for (const OfflineVariable& Variable : OfflineVariables)
+    {
+        if (std::wcslen(Variable.Name) != NameLength)
+        {
+            continue;
+        }
+
+        size_t i = 0;
+        while (i < NameLength &&
+            FoldCharacter(Variable.Name[i]) == FoldCharacter(Name[i]))
+        {
+            ++i;
+        }
+
+        if (i == NameLength)
+        {
+            return Variable.Value;
+        }
+    }
+
+    return nullptr;
+}
+
+NSUDO_SWEEPER_PATH_STATUS NSudoSweeperResolveOfflinePath(
+    const wchar_t* SessionRootPath,
+    const wchar_t* Path,
+    std::wstring& ResolvedPath)
+{
+    ResolvedPath.clear();
+
+    // Expand the environment variables in a single pass, the expanded path
+    // is relative to the root directory of the image if it starts with a
+    // variable.
+
+    std::wstring Expanded;
+    Expanded.reserve(260);
+
+    for (const wchar_t* Current = Path; *Current;)
+    {
+        const wchar_t* End = nullptr;
+        if (*Current == L'%')
+        {
+            End = std::wcschr(Current + 1, L'%');
+        }
+
+        if (!End)
+        {
+            Expanded += *Current++;
+            continue;
+        }
+
+        const wchar_t* Value = ::NSudoSweeperFindOfflineVariable(
+            Current + 1,
+            static_cast<size_t>(End - Current - 1));
+        if (!Value)
+        {
+            return NSudoSweeperPathVariableNotFound;
+        }
+
+        Expanded += Value;
+        Current = End + 1;
+    }
+
+    // Remove the drive part of the path.
+
+    size_t Offset = 0;
+    if (Expanded.size() >= 2 && Expanded[1] == L':')
+    {
+        Offset = 2;
+    }
+
+    if (Offset < Expanded.size() && !IsSeparator(Expanded[Offset]))
+    {
+        // Relative paths cannot be rebased.
+        return NSudoSweeperPathInvalid;
+    }
+
+    if (Offset < Expanded.size())
+    {
+        ++Offset;
+    }
+
+    Expanded.erase(0, Offset);
+
+    // The UNC paths and the device paths start with an empty component.
+    if (!Expanded.empty() && IsSeparator(Expanded[0]))
+    {
+        return NSudoSweeperPathInvalid;
+    }
+
+    if (HasParentDirectoryComponent(Expanded))
+    {
+        return NSudoSweeperPathInvalid;
+    }
+
+    ResolvedPath = SessionRootPath;
+    ResolvedPath += Expanded;
+
+    return NSudoSweeperPathResolved;
+}
@@ -0,0 +1,104 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPathCore.h
+ * PURPOSE:   Definition for the Offline Image Path Resolution
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_PATH_CORE
+#define NSUDO_SWEEPER_PATH_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+
+#include <string>
+
+/**
+ * The status of an offline path resolution.
+ */
+typedef enum _NSUDO_SWEEPER_PATH_STATUS
+{
+    /**
+     * The path is resolved.
+     */
+    NSudoSweeperPathResolved,
+
+    /**
+     * The path contains an environment variable which is not available for
+     * an offline image.
+     */
+    NSudoSweeperPathVariableNotFound,
+
+    /**
+     * The path is relative, contains a ".." component or an empty leading
+     * component, so it cannot be rebased under the session root path.
+     */
+    NSudoSweeperPathInvalid,
+
+} NSUDO_SWEEPER_PATH_STATUS;
+
+/**
+ * Checks whether a session root path is the root directory of the running
+ * Windows image.
+ *
+ * @param SessionRootPath An absolute path with end of the backslash to the
+ *                        root directory of a Windows image, for example,
+ *                        "C:\\". If the pointer is nullptr, the session is
+ *                        the online Windows image.
+ * @param SystemDirectory The system directory of the running Windows image,
+ *                        for example, "C:\\Windows\\system32". The root
+ *                        directory is the part before the first backslash,
+ *                        including the backslash.
+ * @return Returns true if the session root path is nullptr, or it equals the
+ *         root directory case-insensitively. Returns false if the system
+ *         directory is nullptr or contains no backslash.
+ */
+bool NSudoSweeperIsOnlineImageRoot(
+    const wchar_t* SessionRootPath,
+    const wchar_t* SystemDirectory);
+
+/**
+ * Looks up a system-wide environment variable of an offline image.
+ *
+ * @param Name The name of the environment variable, it is not required to be
+ *             null-terminated. The name is case-insensitive.
+ * @param NameLength The length of the name, in characters.
+ * @return The default location of the environment variable relative to the
+ *         root directory of the image, or nullptr if not found. For example,
+ *         "\\Windows" for "SystemRoot" and an empty string for
+ *         "SystemDrive".
+ */
+const wchar_t* NSudoSweeperFindOfflineVariable(
+    const wchar_t* Name,
+    size_t NameLength);
+
+/**
+ * Resolves a rule path for an offline Windows image.
+ *
+ * @param SessionRootPath An absolute path with end of the backslash to the
+ *                        root directory of the image, for example,
+ *                        "C:\\Image\\".
+ * @param Path The rule path. It should be an absolute path with the drive
+ *             letter of the image or start with an environment variable, for
+ *             example, "C:\\Windows\\Temp" or "%SystemRoot%\\Temp".
+ * @param ResolvedPath The resolved path.
+ * @return The status of the resolution.
+ * @remark The environment variables are expanded in a single pass, so the
+ *         expanded values are never expanded again, and a "%" without the
+ *         closing "%" is kept as is. Then the drive part of the path is
+ *         replaced with the session root path. Both backslashes and slashes
+ *         are treated as separators when the ".." components are checked,
+ *         so the resolved path never leaves the session root path.
+ */
+NSUDO_SWEEPER_PATH_STATUS NSudoSweeperResolveOfflinePath(
+    const wchar_t* SessionRootPath,
+    const wchar_t* Path,
+    std::wstring& ResolvedPath);
+
+#endif // !NSUDO_SWEEPER_PATH_CORE
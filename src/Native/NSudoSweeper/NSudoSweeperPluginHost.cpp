@@ -0,0 +1,427 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPluginHost.cpp
+ * PURPOSE:   NSudo Sweeper Plugin Host Implementation for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include "NSudoSweeperPluginHost.h"
+#include "NSudoSweeperSchedulerCore.h"
+
+#include <Mile.Windows.h>
+#include <Mile.Platform.Windows.h>
+
+#include <string.h>
+#include <wchar.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+static_assert(
+    NSUDO_SWEEPER_TASK_ABORTED == E_ABORT,
+    "The scheduler should report the cancellation as E_ABORT.");
+
+namespace
+{
+    /**
+     * The cleanup handler compiled into NSudo Sweeper.
+     */
+    struct BuiltInHandler
+    {
+        const char* Name;
+        NSudoSweeperCleanupHandler Handler;
+    };
+
+    /**
+     * The cleanup handlers of the built-in plugin.
+     */
+    const BuiltInHandler BuiltInHandlers[] =
+    {
+        {
+            "NSudoSweeperSystemRestorePointCleanupHandler",
+            ::NSudoSweeperSystemRestorePointCleanupHandler
+        },
+        {
+            "NSudoSweeperTemporaryFolderCleanupHandler",
+            ::NSudoSweeperTemporaryFolderCleanupHandler
+        },
+    };
+
+    /**
+     * The plugin loaded by a plugin host.
+     */
+    struct PluginModule
+    {
+        std::wstring Name;
+        HMODULE Module;
+    };
+
+    /**
+     * The cleanup handler resolved by a plugin host.
+     */
+    struct ResolvedHandler
+    {
+        std::wstring PluginName;
+        std::string HandlerName;
+        NSudoSweeperCleanupHandler Handler;
+    };
+
+    /**
+     * The object behind a plugin host handle.
+     */
+    struct PluginHostObject
+    {
+        Mile::CriticalSection Lock;
+        std::vector<PluginModule> Modules;
+        std::vector<ResolvedHandler> Handlers;
+    };
+
+    /**
+     * The cleanup handler bound to a scheduled task.
+     */
+    struct HandlerBinding
+    {
+        PNSUDO_SWEEPER_HANDLER_TASK Task;
+        NSudoSweeperCleanupHandler Handler;
+    };
+
+    /**
+     * The shared state of a NSudoSweeperRunHandlers call.
+     */
+    struct RunContext
+    {
+        LPCWSTR SessionRootPath;
+        BOOL Estimate;
+        NSudoSweeperCallback Callback;
+    };
+
+    /**
+     * Checks whether the plugin name is a bare file name.
+     *
+     * @param PluginName The plugin name.
+     * @return Returns true if the plugin name contains no path.
+     */
+    bool IsBarePluginName(
+        _In_ LPCWSTR PluginName)
+    {
+        return *PluginName && !::wcspbrk(PluginName, L"\\/:");
+    }
+
+    /**
+     * Resolves a cleanup handler, the plugin is loaded on the first use.
+     *
+     * @param Host The plugin host.
+     * @param PluginName The file name of the plugin.
+     * @param HandlerName The name of the cleanup handler export.
+     * @param Handler A pointer to a variable that receives the cleanup handler.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT ResolveHandler(
+        _In_ PluginHostObject* Host,
+        _In_ LPCWSTR PluginName,
+        _In_ LPCSTR HandlerName,
+        _Out_ NSudoSweeperCleanupHandler* Handler)
+    {
+        *Handler = nullptr;
+
+        if (!PluginName || !HandlerName || !IsBarePluginName(PluginName))
+        {
+            return E_INVALIDARG;
+        }
+
+        Mile::AutoCriticalSectionLock Lock(Host->Lock);
+
+        for (const ResolvedHandler& Item : Host->Handlers)
+        {
+            if (::_wcsicmp(Item.PluginName.c_str(), PluginName) == 0 &&
+                Item.HandlerName == HandlerName)
+            {
+                *Handler = Item.Handler;
+                return S_OK;
+            }
+        }
+
+        HRESULT hr = S_OK;
+
+        if (::_wcsicmp(PluginName, NSUDO_SWEEPER_BUILT_IN_PLUGIN) == 0)
+        {
+            hr = ::MileHResultFromWin32(ERROR_PROC_NOT_FOUND);
+
+            for (const BuiltInHandler& Item : BuiltInHandlers)
+            {
+                if (::strcmp(Item.Name, HandlerName) == 0)
+                {
+                    *Handler = Item.Handler;
+                    hr = S_OK;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            HMODULE Module = nullptr;
+
+            for (const PluginModule& Item : Host->Modules)
+            {
+                if (::_wcsicmp(Item.Name.c_str(), PluginName) == 0)
+                {
+                    Module = Item.Module;
+                    break;
+                }
+            }
+
+            if (!Module)
+            {
+                // Only the trusted locations are searched, so a plugin cannot
+                // be planted in the current directory or the PATH.
+                hr = ::MileLoadLibrary(
+                    PluginName,
+                    nullptr,
+                    LOAD_LIBRARY_SEARCH_APPLICATION_DIR
+                    | LOAD_LIBRARY_SEARCH_SYSTEM32,
+                    &Module);
+                if (hr == S_OK)
+                {
+                    Host->Modules.push_back(PluginModule{ PluginName, Module });
+                }
+            }
+
+            if (hr == S_OK)
+            {
+                hr = ::MileGetProcAddress(
+                    Module,
+                    HandlerName,
+                    reinterpret_cast<FARPROC*>(Handler));
+            }
+        }
+
+        if (hr == S_OK)
+        {
+            Host->Handlers.push_back(
+                ResolvedHandler{ PluginName, HandlerName, *Handler });
+        }
+
+        return hr;
+    }
+
+    /**
+     * The NSudoSweeperCallback passed to the cleanup handlers. The scheduler
+     * enforces the time budget and forwards the messages.
+     *
+     * @param Message The message.
+     * @param Parameter A pointer to the additional message information.
+     * @param UserData The state of the running task.
+     * @return HRESULT. If the task should continue, the return value is S_OK.
+     */
+    HRESULT WINAPI TaskCallback(
+        _In_ DWORD Message,
+        _In_opt_ LPVOID Parameter,
+        _In_opt_ LPVOID UserData)
+    {
+        return ::NSudoSweeperReportTaskProgress(
+            reinterpret_cast<PNSUDO_SWEEPER_TASK_RUN>(UserData),
+            Message,
+            Parameter);
+    }
+
+    /**
+     * The RunTask operation of the scheduler, it calls the cleanup handler.
+     */
+    int32_t RunTask(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        PNSUDO_SWEEPER_TASK_RUN Run,
+        uint64_t* EstimatedFreedSize)
+    {
+        RunContext* Information = reinterpret_cast<RunContext*>(Context);
+        HandlerBinding* Binding =
+            reinterpret_cast<HandlerBinding*>(Task->UserData);
+
+        return Binding->Handler(
+            Binding->Task->Configuration,
+            Information->SessionRootPath,
+            Information->Estimate ? EstimatedFreedSize : nullptr,
+            TaskCallback,
+            Run);
+    }
+
+    /**
+     * The ForwardMessage operation of the scheduler, it calls the
+     * user-defined callback with the UserData of the cleanup handler task.
+     */
+    bool ForwardMessage(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        uint32_t Message,
+        void* Parameter)
+    {
+        RunContext* Information = reinterpret_cast<RunContext*>(Context);
+        HandlerBinding* Binding =
+            reinterpret_cast<HandlerBinding*>(Task->UserData);
+
+        return !Information->Callback || S_OK == Information->Callback(
+            Message,
+            Parameter,
+            Binding->Task->UserData);
+    }
+
+    /**
+     * The GetTickCount operation of the scheduler.
+     */
+    uint64_t QueryTickCount(
+        void* Context)
+    {
+        UNREFERENCED_PARAMETER(Context);
+
+        return ::MileGetTickCount();
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperPluginHost.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperCreatePluginHost(
+    _Out_ PHANDLE PluginHost)
+{
+    if (!PluginHost)
+    {
+        return E_INVALIDARG;
+    }
+
+    PluginHostObject* Host = new (std::nothrow) PluginHostObject();
+    if (!Host)
+    {
+        *PluginHost = nullptr;
+        return E_OUTOFMEMORY;
+    }
+
+    *PluginHost = reinterpret_cast<HANDLE>(Host);
+
+    return S_OK;
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperPluginHost.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperClosePluginHost(
+    _In_ HANDLE PluginHost)
+{
+    if (!PluginHost)
+    {
+        return E_INVALIDARG;
+    }
+
+    PluginHostObject* Host = reinterpret_cast<PluginHostObject*>(PluginHost);
+
+    for (const PluginModule& Item : Host->Modules)
+    {
+        ::MileFreeLibrary(Item.Module);
+    }
+
+    delete Host;
+
+    return S_OK;
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperPluginHost.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperRunHandlers(
+    _In_ HANDLE PluginHost,
+    _Inout_ PNSUDO_SWEEPER_HANDLER_TASK Tasks,
+    _In_ SIZE_T TaskCount,
+    _In_opt_ LPCWSTR SessionRootPath,
+    _In_ BOOL Estimate,
+    _In_ DWORD MaximumConcurrency,
+    _In_opt_ NSudoSweeperCallback Callback)
+{
+    if (!PluginHost || (!Tasks && TaskCount))
+    {
+        return E_INVALIDARG;
+    }
+
+    PluginHostObject* Host = reinterpret_cast<PluginHostObject*>(PluginHost);
+
+    RunContext Context;
+    Context.SessionRootPath = SessionRootPath;
+    Context.Estimate = Estimate;
+    Context.Callback = Callback;
+
+    std::vector<HandlerBinding> Bindings;
+    Bindings.reserve(TaskCount);
+
+    bool Failed = false;
+
+    // Resolve the cleanup handlers on the calling thread, so the plugins are
+    // loaded once and outside the workers.
+    for (SIZE_T i = 0; i < TaskCount; ++i)
+    {
+        PNSUDO_SWEEPER_HANDLER_TASK Task = &Tasks[i];
+
+        Task->EstimatedFreedSize = 0;
+        Task->ElapsedTime = 0;
+
+        HandlerBinding Binding;
+        Binding.Task = Task;
+
+        Task->Result = ResolveHandler(
+            Host,
+            Task->PluginName,
+            Task->HandlerName,
+            &Binding.Handler);
+        if (Task->Result == S_OK)
+        {
+            Bindings.push_back(Binding);
+        }
+        else
+        {
+            Failed = true;
+        }
+    }
+
+    std::vector<NSUDO_SWEEPER_SCHEDULED_TASK> ScheduledTasks(Bindings.size());
+    for (size_t i = 0; i < Bindings.size(); ++i)
+    {
+        ScheduledTasks[i].Priority = Bindings[i].Task->Priority;
+        ScheduledTasks[i].TimeBudget = Bindings[i].Task->TimeBudget;
+        ScheduledTasks[i].UserData = &Bindings[i];
+    }
+
+    NSUDO_SWEEPER_SCHEDULER_BACKEND Backend;
+    Backend.Context = &Context;
+    Backend.RunTask = RunTask;
+    Backend.ForwardMessage = ForwardMessage;
+    Backend.GetTickCount = QueryTickCount;
+
+    if (!::NSudoSweeperRunScheduledTasks(
+        ScheduledTasks.data(),
+        ScheduledTasks.size(),
+        ::NSudoSweeperGetThreadPool(),
+        MaximumConcurrency,
+        &Backend))
+    {
+        Failed = true;
+    }
+
+    for (size_t i = 0; i < Bindings.size(); ++i)
+    {
+        PNSUDO_SWEEPER_HANDLER_TASK Task = Bindings[i].Task;
+
+        Task->Result = ScheduledTasks[i].Result;
+        Task->EstimatedFreedSize = ScheduledTasks[i].EstimatedFreedSize;
+        Task->ElapsedTime = ScheduledTasks[i].ElapsedTime;
+    }
+
+    return Failed ? S_FALSE : S_OK;
+}
@@ -0,0 +1,139 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperPluginHost.h
+ * PURPOSE:   NSudo Sweeper Plugin Host Definition for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_PLUGIN_HOST
+#define NSUDO_SWEEPER_PLUGIN_HOST
+
+#include "NSudoSweeperCore.h"
+
+/**
+ * The name of the plugin which contains the built-in cleanup handlers.
+ */
+#define NSUDO_SWEEPER_BUILT_IN_PLUGIN L"NSudoSweeperCore.dll"
+
+/**
+ * The cleanup handler task of a NSudoSweeperRunHandlers call.
+ */
+typedef struct _NSUDO_SWEEPER_HANDLER_TASK
+{
+    /**
+     * The file name of the plugin, the "Plugin" value of the handler
+     * configuration. It should not contain a path.
+     */
+    LPCWSTR PluginName;
+
+    /**
+     * The name of the cleanup handler export, the "Handler" value of the
+     * handler configuration.
+     */
+    LPCSTR HandlerName;
+
+    /**
+     * The TOML configuration string of the cleanup handler.
+     */
+    LPCWSTR Configuration;
+
+    /**
+     * The priority of the task. The tasks with higher priority are started
+     * first.
+     */
+    LONG Priority;
+
+    /**
+     * The time budget of the task, in milliseconds. When the budget is
+     * exhausted, the task is cancelled at the next callback. If this member
+     * is 0, the task has no budget.
+     */
+    DWORD TimeBudget;
+
+    /**
+     * User defined custom data passed to the callback for this task.
+     */
+    LPVOID UserData;
+
+    /**
+     * Receives the result of the cleanup handler.
+     */
+    HRESULT Result;
+
+    /**
+     * Receives the size the cleanup handler can free, in bytes. It is only
+     * set when the handlers are run for the estimation.
+     */
+    UINT64 EstimatedFreedSize;
+
+    /**
+     * Receives the elapsed time of the task, in milliseconds.
+     */
+    ULONGLONG ElapsedTime;
+
+} NSUDO_SWEEPER_HANDLER_TASK, *PNSUDO_SWEEPER_HANDLER_TASK;
+
+/**
+ * Creates a NSudo Sweeper plugin host.
+ *
+ * @param PluginHost A pointer to a variable that receives the plugin host
+ *                   handle. You should close it by calling the
+ *                   NSudoSweeperClosePluginHost function.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperCreatePluginHost(
+    _Out_ PHANDLE PluginHost);
+
+/**
+ * Closes a NSudo Sweeper plugin host and unloads the plugins loaded by it.
+ *
+ * @param PluginHost The plugin host handle.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperClosePluginHost(
+    _In_ HANDLE PluginHost);
+
+/**
+ * Runs the cleanup handlers concurrently.
+ *
+ * @param PluginHost The plugin host handle.
+ * @param Tasks An array of the cleanup handler tasks.
+ * @param TaskCount The number of elements in the Tasks array.
+ * @param SessionRootPath An absolute path with end of the backslash to the
+ *                        root directory of a Windows image which you want to
+ *                        operate. You can only use backslashes in this name.
+ *                        For example, you can use "C:\\" and "C:\\Image\\". If
+ *                        the pointer is NULL, the function will operate the
+ *                        online Windows image.
+ * @param Estimate If this parameter is TRUE, the cleanup handlers estimate the
+ *                 size they can free. Otherwise, they start cleaning.
+ * @param MaximumConcurrency The maximum number of the cleanup handlers which
+ *                           run at the same time. If this parameter is 0, the
+ *                           number of the workers of the shared thread pool
+ *                           will be used.
+ * @param Callback A pointer to a user-defined NSudoSweeperCallback. It
+ *                 receives the messages of all tasks with the UserData of
+ *                 each task, and the calls are serialized. If it returns a
+ *                 value other than S_OK, the task is cancelled.
+ * @return HRESULT. If all tasks succeed, the return value is S_OK. If some of
+ *         the tasks fail or are cancelled, the return value is S_FALSE.
+ * @remark Every plugin is loaded once per plugin host from the application
+ *         directory or the system directory only, and every cleanup handler
+ *         export is resolved once. The cancellation is cooperative, a
+ *         cancelled cleanup handler stops when it sees the failure returned
+ *         by its callback. The tasks are run by the portable scheduler in
+ *         "NSudoSweeperSchedulerCore.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperRunHandlers(
+    _In_ HANDLE PluginHost,
+    _Inout_ PNSUDO_SWEEPER_HANDLER_TASK Tasks,
+    _In_ SIZE_T TaskCount,
+    _In_opt_ LPCWSTR SessionRootPath,
+    _In_ BOOL Estimate,
+    _In_ DWORD MaximumConcurrency,
+    _In_opt_ NSudoSweeperCallback Callback);
+
+#endif // !NSUDO_SWEEPER_PLUGIN_HOST
@@ -0,0 +1,201 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSchedulerCore.cpp
+ * PURPOSE:   Implementation for the Budgeted Cleanup Handler Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperSchedulerCore.h"
+
+#include <Mile.Platform.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+struct _NSUDO_SWEEPER_TASK_RUN
+{
+    struct SchedulerContext* Context;
+    PNSUDO_SWEEPER_SCHEDULED_TASK Task;
+    uint64_t StartTime;
+    std::atomic<bool> Cancelled;
+};
+
+/**
+ * The shared state of a NSudoSweeperRunScheduledTasks call.
+ */
+struct SchedulerContext
+{
+    const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend;
+
+    std::vector<PNSUDO_SWEEPER_TASK_RUN> Runs;
+    std::atomic<size_t> NextRun;
+
+    Mile::Mutex ForwardLock;
+};
+
+namespace
+{
+    uint64_t QueryCurrentTime(
+        const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend)
+    {
+        if (Backend->GetTickCount)
+        {
+            return Backend->GetTickCount(Backend->Context);
+        }
+
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * The lane of a NSudoSweeperRunScheduledTasks call, it runs the tasks
+     * until all tasks are taken.
+     *
+     * @param Context The shared state of the call.
+     */
+    void RunTaskLane(
+        SchedulerContext* Context)
+    {
+        const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend = Context->Backend;
+
+        for (;;)
+        {
+            const size_t Current = Context->NextRun.fetch_add(1);
+            if (Current >= Context->Runs.size())
+            {
+                break;
+            }
+
+            PNSUDO_SWEEPER_TASK_RUN Run = Context->Runs[Current];
+            PNSUDO_SWEEPER_SCHEDULED_TASK Task = Run->Task;
+
+            Run->StartTime = QueryCurrentTime(Backend);
+
+            uint64_t EstimatedFreedSize = 0;
+            Task->Result = Backend->RunTask(
+                Backend->Context,
+                Task,
+                Run,
+                &EstimatedFreedSize);
+            if (Run->Cancelled && Task->Result == NSUDO_SWEEPER_TASK_SUCCEEDED)
+            {
+                Task->Result = NSUDO_SWEEPER_TASK_ABORTED;
+            }
+
+            Task->EstimatedFreedSize = EstimatedFreedSize;
+            Task->ElapsedTime = QueryCurrentTime(Backend) - Run->StartTime;
+        }
+    }
+}
+
+int32_t NSudoSweeperReportTaskProgress(
+    PNSUDO_SWEEPER_TASK_RUN Run,
+    uint32_t Message,
+    void* Parameter)
+{
+    SchedulerContext* Context = Run->Context;
+    const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend = Context->Backend;
+    PNSUDO_SWEEPER_SCHEDULED_TASK Task = Run->Task;
+
+    if (!Run->Cancelled && Task->TimeBudget &&
+        QueryCurrentTime(Backend) - Run->StartTime > Task->TimeBudget)
+    {
+        Run->Cancelled = true;
+    }
+
+    if (!Run->Cancelled && Backend->ForwardMessage)
+    {
+        Mile::AutoMutexLock Lock(Context->ForwardLock);
+
+        if (!Backend->ForwardMessage(
+            Backend->Context,
+            Task,
+            Message,
+            Parameter))
+        {
+            Run->Cancelled = true;
+        }
+    }
+
+    return Run->Cancelled
+        ? NSUDO_SWEEPER_TASK_ABORTED
+        : NSUDO_SWEEPER_TASK_SUCCEEDED;
+}
+
+bool NSudoSweeperRunScheduledTasks(
+    PNSUDO_SWEEPER_SCHEDULED_TASK Tasks,
+    size_t TaskCount,
+    Mile::ThreadPool& Pool,
+    uint32_t MaximumConcurrency,
+    const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend)
+{
+    if (!MaximumConcurrency)
+    {
+        // A pool without workers runs the lanes when they are waited.
+        MaximumConcurrency = static_cast<uint32_t>(
+            std::max<size_t>(Pool.GetWorkerCount(), 1));
+    }
+
+    std::vector<NSUDO_SWEEPER_TASK_RUN> Runs(TaskCount);
+
+    SchedulerContext Context;
+    Context.Backend = Backend;
+    Context.NextRun = 0;
+    Context.Runs.reserve(TaskCount);
+
+    for (size_t i = 0; i < TaskCount; ++i)
+    {
+        Tasks[i].Result = NSUDO_SWEEPER_TASK_SUCCEEDED;
+        Tasks[i].EstimatedFreedSize = 0;
+        Tasks[i].ElapsedTime = 0;
+
+        Runs[i].Context = &Context;
+        Runs[i].Task = &Tasks[i];
+        Runs[i].StartTime = 0;
+        Runs[i].Cancelled = false;
+
+        Context.Runs.push_back(&Runs[i]);
+    }
+
+    std::stable_sort(
+        Context.Runs.begin(),
+        Context.Runs.end(),
+        [](PNSUDO_SWEEPER_TASK_RUN Left, PNSUDO_SWEEPER_TASK_RUN Right)
+        {
+            return Left->Task->Priority > Right->Task->Priority;
+        });
+
+    const size_t LaneCount = std::min<size_t>(MaximumConcurrency, TaskCount);
+
+    {
+        // The tasks may delete files on the same pool, the waiting lanes run
+        // those work items instead of blocking the workers.
+        Mile::TaskGroup Lanes(Pool);
+
+        for (size_t i = 0; i < LaneCount; ++i)
+        {
+            Lanes.Run([&Context]()
+            {
+                RunTaskLane(&Context);
+            });
+        }
+
+        Lanes.Wait();
+    }
+
+    for (size_t i = 0; i < TaskCount; ++i)
+    {
+        if (Tasks[i].Result != NSUDO_SWEEPER_TASK_SUCCEEDED)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
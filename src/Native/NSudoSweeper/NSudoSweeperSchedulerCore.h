@@ -0,0 +1,175 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSchedulerCore.h
+ * PURPOSE:   Definition for the Budgeted Cleanup Handler Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_SCHEDULER_CORE
+#define NSUDO_SWEEPER_SCHEDULER_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The result of a succeeded task, it has the same value as S_OK.
+ */
+#define NSUDO_SWEEPER_TASK_SUCCEEDED static_cast<int32_t>(0x00000000)
+
+/**
+ * The result of a cancelled task, it has the same value as E_ABORT.
+ */
+#define NSUDO_SWEEPER_TASK_ABORTED static_cast<int32_t>(0x80004004)
+
+/**
+ * The state of a running task. The scheduler passes it to the RunTask
+ * operation, and the task reports its progress with it.
+ */
+typedef struct _NSUDO_SWEEPER_TASK_RUN NSUDO_SWEEPER_TASK_RUN;
+typedef NSUDO_SWEEPER_TASK_RUN* PNSUDO_SWEEPER_TASK_RUN;
+
+/**
+ * A task of the cleanup handler scheduler.
+ */
+typedef struct _NSUDO_SWEEPER_SCHEDULED_TASK
+{
+    /**
+     * The priority of the task. The tasks with higher priority are started
+     * first, and the tasks with the same priority keep their order.
+     */
+    int32_t Priority;
+
+    /**
+     * The time budget of the task, in milliseconds. When the budget is
+     * exhausted, the task is cancelled at the next progress report. If this
+     * member is 0, the task has no budget.
+     */
+    uint32_t TimeBudget;
+
+    /**
+     * User defined custom data of the task.
+     */
+    void* UserData;
+
+    /**
+     * Receives the result of the task. If the task is cancelled and returns
+     * NSUDO_SWEEPER_TASK_SUCCEEDED, it is NSUDO_SWEEPER_TASK_ABORTED.
+     */
+    int32_t Result;
+
+    /**
+     * Receives the size the task can free, in bytes.
+     */
+    uint64_t EstimatedFreedSize;
+
+    /**
+     * Receives the elapsed time of the task, in milliseconds.
+     */
+    uint64_t ElapsedTime;
+
+} NSUDO_SWEEPER_SCHEDULED_TASK, *PNSUDO_SWEEPER_SCHEDULED_TASK;
+
+/**
+ * The operations used by the cleanup handler scheduler.
+ */
+typedef struct _NSUDO_SWEEPER_SCHEDULER_BACKEND
+{
+    /**
+     * User defined custom data passed to the operations.
+     */
+    void* Context;
+
+    /**
+     * Runs a task, it is called from the lanes concurrently. The task should
+     * call NSudoSweeperReportTaskProgress with the Run parameter and stop as
+     * soon as possible when it fails.
+     *
+     * @param Context The Context member.
+     * @param Task The task.
+     * @param Run The state of the running task.
+     * @param EstimatedFreedSize A pointer to a variable that receives the
+     *                           size the task can free, in bytes.
+     * @return The result of the task.
+     */
+    int32_t (*RunTask)(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        PNSUDO_SWEEPER_TASK_RUN Run,
+        uint64_t* EstimatedFreedSize);
+
+    /**
+     * Forwards a progress message to the caller, the calls are serialized.
+     * This member can be nullptr.
+     *
+     * @param Context The Context member.
+     * @param Task The task which reports the message.
+     * @param Message The message.
+     * @param Parameter A pointer to the additional message information.
+     * @return If it returns false, the task is cancelled.
+     */
+    bool (*ForwardMessage)(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        uint32_t Message,
+        void* Parameter);
+
+    /**
+     * Gets the current time, in milliseconds. This member can be nullptr, a
+     * monotonic clock is used in this case.
+     *
+     * @param Context The Context member.
+     * @return The current time, in milliseconds.
+     */
+    uint64_t (*GetTickCount)(
+        void* Context);
+
+} NSUDO_SWEEPER_SCHEDULER_BACKEND, *PNSUDO_SWEEPER_SCHEDULER_BACKEND;
+
+/**
+ * Reports the progress of a running task. It enforces the time budget and
+ * forwards the message.
+ *
+ * @param Run The state of the running task.
+ * @param Message The message.
+ * @param Parameter A pointer to the additional message information.
+ * @return If the task should continue, the return value is
+ *         NSUDO_SWEEPER_TASK_SUCCEEDED. Otherwise, the return value is
+ *         NSUDO_SWEEPER_TASK_ABORTED, and the later reports of the task are
+ *         not forwarded.
+ */
+int32_t NSudoSweeperReportTaskProgress(
+    PNSUDO_SWEEPER_TASK_RUN Run,
+    uint32_t Message,
+    void* Parameter);
+
+/**
+ * Runs the tasks concurrently.
+ *
+ * @param Tasks An array of the tasks.
+ * @param TaskCount The number of elements in the Tasks array.
+ * @param Pool The thread pool which runs the lanes.
+ * @param MaximumConcurrency The maximum number of the tasks which run at the
+ *                           same time. If this parameter is 0, the number of
+ *                           the workers of the thread pool is used.
+ * @param Backend The operations used by the scheduler.
+ * @return If all tasks succeed, it returns true.
+ * @remark The cancellation is cooperative. A failed or cancelled task only
+ *         affects its own result.
+ */
+bool NSudoSweeperRunScheduledTasks(
+    PNSUDO_SWEEPER_SCHEDULED_TASK Tasks,
+    size_t TaskCount,
+    Mile::ThreadPool& Pool,
+    uint32_t MaximumConcurrency,
+    const NSUDO_SWEEPER_SCHEDULER_BACKEND* Backend);
+
+#endif // !NSUDO_SWEEPER_SCHEDULER_CORE
@@ -0,0 +1,470 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSizeAccounting.cpp
+ * PURPOSE:   NSudo Sweeper Size Accounting Engine Implementation for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include "NSudoSweeperSizeAccounting.h"
+
+#include <Mile.Windows.h>
+#include <Mile.Platform.Windows.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /**
+     * The size of the buffer used for the directory enumeration, in bytes.
+     */
+    const DWORD EnumerationBufferSize = 64 * 1024;
+
+    /**
+     * The interval of the idle worker polling, in milliseconds.
+     */
+    const DWORD IdleInterval = 1;
+
+    /**
+     * A directory waiting to be scanned.
+     */
+    struct PendingDirectory
+    {
+        std::wstring Path;
+        UINT32 RootIndex;
+    };
+
+    struct AccountingContext;
+
+    /**
+     * The private state of a worker. Only the owner worker touches it until
+     * all workers exit.
+     */
+    struct AccountingWorker
+    {
+        AccountingContext* Context;
+
+        std::vector<NSUDO_SWEEPER_SIZE_RECORD> Records;
+
+        std::vector<BYTE> Buffer;
+        std::wstring FileName;
+    };
+
+    /**
+     * The shared state of a NSudoSweeperQuerySizeInformation call.
+     */
+    struct AccountingContext
+    {
+        std::vector<UINT32> VolumeSerialNumbers;
+        std::vector<UINT32> ClusterSizes;
+
+        Mile::CriticalSection PendingLock;
+        std::vector<PendingDirectory> Pending;
+        SIZE_T BusyWorkerCount;
+    };
+
+    /**
+     * Queries the serial number and the cluster size of the volume which
+     * contains a directory.
+     *
+     * @param Path The path of the directory.
+     * @param VolumeSerialNumber A pointer to a variable that receives the
+     *                           serial number of the volume.
+     * @param ClusterSize A pointer to a variable that receives the cluster
+     *                    size of the volume, in bytes. It is 0 if the cluster
+     *                    size cannot be queried.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT QueryVolumeInformation(
+        _In_ LPCWSTR Path,
+        _Out_ PUINT32 VolumeSerialNumber,
+        _Out_ PUINT32 ClusterSize)
+    {
+        *ClusterSize = 0;
+
+        wchar_t VolumePath[MAX_PATH];
+        DWORD SectorsPerCluster = 0;
+        DWORD BytesPerSector = 0;
+        DWORD NumberOfFreeClusters = 0;
+        DWORD TotalNumberOfClusters = 0;
+        if (::GetVolumePathNameW(Path, VolumePath, MAX_PATH) &&
+            ::GetDiskFreeSpaceW(
+                VolumePath,
+                &SectorsPerCluster,
+                &BytesPerSector,
+                &NumberOfFreeClusters,
+                &TotalNumberOfClusters))
+        {
+            *ClusterSize = SectorsPerCluster * BytesPerSector;
+        }
+
+        HANDLE DirectoryHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            Path,
+            FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS,
+            nullptr,
+            &DirectoryHandle);
+        if (hr == S_OK)
+        {
+            BY_HANDLE_FILE_INFORMATION Information;
+            hr = ::MileGetLastErrorWithWin32BoolAsHResult(
+                ::GetFileInformationByHandle(DirectoryHandle, &Information));
+            if (hr == S_OK)
+            {
+                *VolumeSerialNumber = Information.dwVolumeSerialNumber;
+            }
+
+            ::MileCloseHandle(DirectoryHandle);
+        }
+
+        return hr;
+    }
+
+    /**
+     * Checks whether the directory entry needs to be opened to get the
+     * compressed size.
+     *
+     * @param Information The directory entry.
+     * @return Returns true if the file is compressed, sparse or backed by the
+     *         Windows Overlay Filter.
+     */
+    bool IsCompressedSizeRequired(
+        _In_ PFILE_ID_BOTH_DIR_INFO Information)
+    {
+        if (Information->FileAttributes
+            & (FILE_ATTRIBUTE_COMPRESSED | FILE_ATTRIBUTE_SPARSE_FILE))
+        {
+            return true;
+        }
+
+        // The EaSize field holds the reparse tag for the reparse points.
+        return (Information->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            && Information->EaSize == IO_REPARSE_TAG_WOF;
+    }
+
+    /**
+     * Accounts the files directly under a directory.
+     *
+     * @param Worker The worker state.
+     * @param Directory The directory.
+     * @param Children The child directories, the reparse points are excluded.
+     */
+    void AccountDirectory(
+        _Inout_ AccountingWorker& Worker,
+        _In_ const PendingDirectory& Directory,
+        _Out_ std::vector<PendingDirectory>& Children)
+    {
+        Children.clear();
+
+        HANDLE DirectoryHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            Directory.Path.c_str(),
+            FILE_LIST_DIRECTORY | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+            nullptr,
+            &DirectoryHandle);
+        if (hr != S_OK)
+        {
+            return;
+        }
+
+        const UINT32 VolumeSerialNumber =
+            Worker.Context->VolumeSerialNumbers[Directory.RootIndex];
+        const UINT32 ClusterSize =
+            Worker.Context->ClusterSizes[Directory.RootIndex];
+
+        Worker.Buffer.resize(EnumerationBufferSize);
+
+        FILE_INFO_BY_HANDLE_CLASS InformationClass =
+            FILE_INFO_BY_HANDLE_CLASS::FileIdBothDirectoryRestartInfo;
+
+        while (S_OK == ::MileGetFileInformation(
+            DirectoryHandle,
+            InformationClass,
+            &Worker.Buffer[0],
+            static_cast<DWORD>(Worker.Buffer.size())))
+        {
+            InformationClass =
+                FILE_INFO_BY_HANDLE_CLASS::FileIdBothDirectoryInfo;
+
+            PFILE_ID_BOTH_DIR_INFO Information =
+                reinterpret_cast<PFILE_ID_BOTH_DIR_INFO>(&Worker.Buffer[0]);
+
+            for (;;)
+            {
+                DWORD NameLength = Information->FileNameLength
+                    / sizeof(wchar_t);
+                const wchar_t* Name = Information->FileName;
+
+                bool IsDots = (NameLength == 1 && Name[0] == L'.') ||
+                    (NameLength == 2 && Name[0] == L'.' && Name[1] == L'.');
+
+                if (IsDots)
+                {
+                    // Skip the current and parent directory markers.
+                }
+                else if (Information->FileAttributes
+                    & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    if (!(Information->FileAttributes
+                        & FILE_ATTRIBUTE_REPARSE_POINT))
+                    {
+                        PendingDirectory Child;
+                        Child.Path.reserve(
+                            Directory.Path.size() + 1 + NameLength);
+                        Child.Path = Directory.Path;
+                        Child.Path += L'\\';
+                        Child.Path.append(Name, NameLength);
+                        Child.RootIndex = Directory.RootIndex;
+                        Children.push_back(std::move(Child));
+                    }
+                }
+                else
+                {
+                    NSUDO_SWEEPER_SIZE_RECORD Record;
+                    ::NSudoSweeperInitializeSizeRecord(
+                        &Record,
+                        static_cast<UINT64>(Information->FileId.QuadPart),
+                        static_cast<UINT64>(Information->EndOfFile.QuadPart),
+                        static_cast<UINT64>(
+                            Information->AllocationSize.QuadPart),
+                        VolumeSerialNumber,
+                        Directory.RootIndex);
+
+                    if (IsCompressedSizeRequired(Information))
+                    {
+                        Worker.FileName = Directory.Path;
+                        Worker.FileName += L'\\';
+                        Worker.FileName.append(Name, NameLength);
+
+                        HANDLE FileHandle = INVALID_HANDLE_VALUE;
+                        if (S_OK == ::MileCreateFile(
+                            Worker.FileName.c_str(),
+                            FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE
+                            | FILE_SHARE_DELETE,
+                            nullptr,
+                            OPEN_EXISTING,
+                            FILE_FLAG_BACKUP_SEMANTICS,
+                            nullptr,
+                            &FileHandle))
+                        {
+                            // The Windows Overlay Filter stores the data
+                            // in a named stream which is not reported by
+                            // the directory entry.
+                            ULONGLONG CompressedSize = 0;
+                            if (S_OK == ::MileGetCompressedFileSize(
+                                FileHandle,
+                                &CompressedSize))
+                            {
+                                ::NSudoSweeperSetStoredSize(
+                                    &Record,
+                                    CompressedSize,
+                                    ClusterSize,
+                                    0 != (Information->FileAttributes
+                                        & FILE_ATTRIBUTE_REPARSE_POINT));
+                            }
+
+                            ::MileCloseHandle(FileHandle);
+                        }
+                    }
+
+                    Worker.Records.push_back(Record);
+                }
+
+                if (!Information->NextEntryOffset)
+                {
+                    break;
+                }
+
+                Information = reinterpret_cast<PFILE_ID_BOTH_DIR_INFO>(
+                    reinterpret_cast<PBYTE>(Information) +
+                    Information->NextEntryOffset);
+            }
+        }
+
+        ::MileCloseHandle(DirectoryHandle);
+    }
+
+    /**
+     * The lane of a NSudoSweeperQuerySizeInformation call, it enumerates the
+     * pending directories until no directory is left.
+     *
+     * @param Worker The counters of the lane.
+     */
+    void RunAccountingLane(
+        _Inout_ AccountingWorker* Worker)
+    {
+        AccountingContext* Context = Worker->Context;
+
+        PendingDirectory Directory;
+        std::vector<PendingDirectory> Children;
+
+        for (;;)
+        {
+            bool Found = false;
+            bool Finished = false;
+
+            {
+                Mile::AutoCriticalSectionLock Lock(Context->PendingLock);
+
+                if (!Context->Pending.empty())
+                {
+                    Directory = std::move(Context->Pending.back());
+                    Context->Pending.pop_back();
+                    ++Context->BusyWorkerCount;
+                    Found = true;
+                }
+                else if (!Context->BusyWorkerCount)
+                {
+                    // No directory is waiting and no worker can add one.
+                    Finished = true;
+                }
+            }
+
+            if (Finished)
+            {
+                break;
+            }
+
+            if (!Found)
+            {
+                ::MileSleep(IdleInterval, FALSE);
+                continue;
+            }
+
+            AccountDirectory(*Worker, Directory, Children);
+
+            {
+                Mile::AutoCriticalSectionLock Lock(Context->PendingLock);
+
+                for (PendingDirectory& Child : Children)
+                {
+                    Context->Pending.push_back(std::move(Child));
+                }
+
+                --Context->BusyWorkerCount;
+            }
+        }
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperSizeAccounting.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperQuerySizeInformation(
+    _In_ LPCWSTR* RootPaths,
+    _In_ SIZE_T RootCount,
+    _In_ DWORD MaximumWorkerCount,
+    _Out_ PNSUDO_SWEEPER_SIZE_INFORMATION SizeInformation,
+    _Out_opt_ PNSUDO_SWEEPER_SIZE_INFORMATION TotalSizeInformation)
+{
+    if (!RootPaths || !RootCount || !SizeInformation)
+    {
+        return E_INVALIDARG;
+    }
+
+    for (SIZE_T i = 0; i < RootCount; ++i)
+    {
+        ZeroMemory(&SizeInformation[i], sizeof(*SizeInformation));
+    }
+
+    if (TotalSizeInformation)
+    {
+        ZeroMemory(TotalSizeInformation, sizeof(*TotalSizeInformation));
+    }
+
+    Mile::ThreadPool& Pool = ::NSudoSweeperGetThreadPool();
+
+    if (!MaximumWorkerCount)
+    {
+        // A pool without workers runs the lanes when they are waited.
+        MaximumWorkerCount = std::max<DWORD>(Pool.GetWorkerCount(), 1);
+    }
+
+    AccountingContext Context;
+    Context.BusyWorkerCount = 0;
+    Context.VolumeSerialNumbers.resize(RootCount);
+    Context.ClusterSizes.resize(RootCount);
+
+    HRESULT hr = S_OK;
+
+    for (SIZE_T i = 0; i < RootCount; ++i)
+    {
+        hr = QueryVolumeInformation(
+            RootPaths[i],
+            &Context.VolumeSerialNumbers[i],
+            &Context.ClusterSizes[i]);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        PendingDirectory Root;
+        Root.Path = RootPaths[i];
+        Root.RootIndex = static_cast<UINT32>(i);
+        Context.Pending.push_back(std::move(Root));
+    }
+
+    std::vector<AccountingWorker> Workers(MaximumWorkerCount);
+
+    {
+        Mile::TaskGroup Lanes(Pool);
+
+        for (AccountingWorker& Worker : Workers)
+        {
+            Worker.Context = &Context;
+
+            Lanes.Run([&Worker]()
+            {
+                RunAccountingLane(&Worker);
+            });
+        }
+
+        Lanes.Wait();
+    }
+
+    // Reduce the records of the workers.
+
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD> Records;
+
+    SIZE_T RecordCount = 0;
+    for (const AccountingWorker& Worker : Workers)
+    {
+        RecordCount += Worker.Records.size();
+    }
+    Records.reserve(RecordCount);
+
+    for (AccountingWorker& Worker : Workers)
+    {
+        Records.insert(
+            Records.end(),
+            Worker.Records.begin(),
+            Worker.Records.end());
+        std::vector<NSUDO_SWEEPER_SIZE_RECORD>().swap(Worker.Records);
+    }
+
+    ::NSudoSweeperReduceSizeRecords(
+        Records,
+        RootCount,
+        SizeInformation,
+        TotalSizeInformation);
+
+    return hr;
+}
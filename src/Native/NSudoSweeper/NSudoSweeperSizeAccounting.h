@@ -0,0 +1,50 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSizeAccounting.h
+ * PURPOSE:   NSudo Sweeper Size Accounting Engine Definition for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_SIZE_ACCOUNTING
+#define NSUDO_SWEEPER_SIZE_ACCOUNTING
+
+#include "NSudoSweeperCore.h"
+#include "NSudoSweeperSizeAccountingCore.h"
+
+/**
+ * Queries the size information of the directory trees.
+ *
+ * @param RootPaths An array of the absolute paths to the root directories of
+ *                  the trees. You can only use backslashes in these names, and
+ *                  the paths should not end with a backslash.
+ * @param RootCount The number of elements in the RootPaths array.
+ * @param MaximumWorkerCount The maximum number of the directories enumerated
+ *                           at the same time. If this parameter is 0, the
+ *                           number of the workers of the shared thread pool
+ *                           will be used.
+ * @param SizeInformation An array of RootCount NSUDO_SWEEPER_SIZE_INFORMATION
+ *                        structures that receives the size information of
+ *                        each tree.
+ * @param TotalSizeInformation A pointer to a NSUDO_SWEEPER_SIZE_INFORMATION
+ *                             structure that receives the size information
+ *                             of all trees, the files shared by several trees
+ *                             are counted once in the unique totals. This
+ *                             parameter can be NULL.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @remark The hard links are deduplicated by the volume serial number and the
+ *         file ID. Each worker collects the size records of its own files,
+ *         and the records are reduced by NSudoSweeperReduceSizeRecords after
+ *         all workers exit. The reparse points are not followed, and the
+ *         directories which cannot be opened are skipped.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperQuerySizeInformation(
+    _In_ LPCWSTR* RootPaths,
+    _In_ SIZE_T RootCount,
+    _In_ DWORD MaximumWorkerCount,
+    _Out_ PNSUDO_SWEEPER_SIZE_INFORMATION SizeInformation,
+    _Out_opt_ PNSUDO_SWEEPER_SIZE_INFORMATION TotalSizeInformation);
+
+#endif // !NSUDO_SWEEPER_SIZE_ACCOUNTING
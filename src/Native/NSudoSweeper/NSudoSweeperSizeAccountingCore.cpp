@@ -0,0 +1,176 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSizeAccountingCore.cpp
+ * PURPOSE:   Implementation for the Size Accounting Reduction
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperSizeAccountingCore.h"
+
+#include <algorithm>
+
+namespace
+{
+    /**
+     * Adds a size record to the totals of every hard link.
+     *
+     * @param Information The size information.
+     * @param Record The size record.
+     */
+    void AddRecord(
+        NSUDO_SWEEPER_SIZE_INFORMATION& Information,
+        const NSUDO_SWEEPER_SIZE_RECORD& Record)
+    {
+        ++Information.FileCount;
+        Information.LogicalSize += Record.LogicalSize;
+        Information.AllocatedSize += Record.AllocatedSize;
+        Information.CompressedSize += Record.CompressedSize;
+    }
+
+    /**
+     * Adds a size record to the unique totals.
+     *
+     * @param Information The size information.
+     * @param Record The size record.
+     */
+    void AddUniqueRecord(
+        NSUDO_SWEEPER_SIZE_INFORMATION& Information,
+        const NSUDO_SWEEPER_SIZE_RECORD& Record)
+    {
+        ++Information.UniqueFileCount;
+        Information.UniqueLogicalSize += Record.LogicalSize;
+        Information.UniqueAllocatedSize += Record.AllocatedSize;
+        Information.UniqueCompressedSize += Record.CompressedSize;
+    }
+}
+
+uint64_t NSudoSweeperRoundToClusterSize(
+    uint64_t Size,
+    uint32_t ClusterSize)
+{
+    if (!ClusterSize)
+    {
+        return Size;
+    }
+
+    const uint64_t Remainder = Size % ClusterSize;
+    if (!Remainder)
+    {
+        return Size;
+    }
+
+    const uint64_t Padding = ClusterSize - Remainder;
+    if (Size > UINT64_MAX - Padding)
+    {
+        return UINT64_MAX;
+    }
+
+    return Size + Padding;
+}
+
+void NSudoSweeperInitializeSizeRecord(
+    PNSUDO_SWEEPER_SIZE_RECORD Record,
+    uint64_t FileId,
+    uint64_t LogicalSize,
+    uint64_t AllocatedSize,
+    uint32_t VolumeSerialNumber,
+    uint32_t RootIndex)
+{
+    Record->FileId = FileId;
+    Record->LogicalSize = LogicalSize;
+    Record->AllocatedSize = AllocatedSize;
+    Record->CompressedSize = LogicalSize;
+    Record->VolumeSerialNumber = VolumeSerialNumber;
+    Record->RootIndex = RootIndex;
+}
+
+void NSudoSweeperSetStoredSize(
+    PNSUDO_SWEEPER_SIZE_RECORD Record,
+    uint64_t StoredSize,
+    uint32_t ClusterSize,
+    bool IsExternallyBacked)
+{
+    Record->CompressedSize = StoredSize;
+
+    if (IsExternallyBacked)
+    {
+        const uint64_t AllocatedSize =
+            ::NSudoSweeperRoundToClusterSize(StoredSize, ClusterSize);
+        if (Record->AllocatedSize < AllocatedSize)
+        {
+            Record->AllocatedSize = AllocatedSize;
+        }
+    }
+}
+
+void NSudoSweeperReduceSizeRecords(
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD>& Records,
+    size_t RootCount,
+    PNSUDO_SWEEPER_SIZE_INFORMATION SizeInformation,
+    PNSUDO_SWEEPER_SIZE_INFORMATION TotalSizeInformation)
+{
+    for (size_t i = 0; i < RootCount; ++i)
+    {
+        SizeInformation[i] = NSUDO_SWEEPER_SIZE_INFORMATION();
+    }
+
+    if (TotalSizeInformation)
+    {
+        *TotalSizeInformation = NSUDO_SWEEPER_SIZE_INFORMATION();
+    }
+
+    std::sort(
+        Records.begin(),
+        Records.end(),
+        [](
+            const NSUDO_SWEEPER_SIZE_RECORD& Left,
+            const NSUDO_SWEEPER_SIZE_RECORD& Right) -> bool
+        {
+            if (Left.VolumeSerialNumber != Right.VolumeSerialNumber)
+            {
+                return Left.VolumeSerialNumber < Right.VolumeSerialNumber;
+            }
+
+            if (Left.FileId != Right.FileId)
+            {
+                return Left.FileId < Right.FileId;
+            }
+
+            return Left.RootIndex < Right.RootIndex;
+        });
+
+    for (size_t i = 0; i < Records.size(); ++i)
+    {
+        const NSUDO_SWEEPER_SIZE_RECORD& Current = Records[i];
+        if (Current.RootIndex >= RootCount)
+        {
+            continue;
+        }
+
+        AddRecord(SizeInformation[Current.RootIndex], Current);
+        if (TotalSizeInformation)
+        {
+            AddRecord(*TotalSizeInformation, Current);
+        }
+
+        bool IsSameFile = i && Records[i - 1].FileId == Current.FileId &&
+            Records[i - 1].VolumeSerialNumber == Current.VolumeSerialNumber;
+
+        if (!IsSameFile)
+        {
+            if (TotalSizeInformation)
+            {
+                AddUniqueRecord(*TotalSizeInformation, Current);
+            }
+
+            AddUniqueRecord(SizeInformation[Current.RootIndex], Current);
+        }
+        else if (Records[i - 1].RootIndex != Current.RootIndex)
+        {
+            AddUniqueRecord(SizeInformation[Current.RootIndex], Current);
+        }
+    }
+}
@@ -0,0 +1,184 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSizeAccountingCore.h
+ * PURPOSE:   Definition for the Size Accounting Reduction
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_SIZE_ACCOUNTING_CORE
+#define NSUDO_SWEEPER_SIZE_ACCOUNTING_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * The size information of a directory tree.
+ */
+typedef struct _NSUDO_SWEEPER_SIZE_INFORMATION
+{
+    /**
+     * The number of the files, every hard link is counted.
+     */
+    uint64_t FileCount;
+
+    /**
+     * The total logical size of the files, in bytes.
+     */
+    uint64_t LogicalSize;
+
+    /**
+     * The total size allocated for the files, in bytes.
+     */
+    uint64_t AllocatedSize;
+
+    /**
+     * The total compressed size of the files, in bytes. It is equal to the
+     * logical size for the files which are neither compressed nor sparse.
+     */
+    uint64_t CompressedSize;
+
+    /**
+     * The number of the unique files, the hard links to the same file are
+     * counted once.
+     */
+    uint64_t UniqueFileCount;
+
+    /**
+     * The total logical size of the unique files, in bytes.
+     */
+    uint64_t UniqueLogicalSize;
+
+    /**
+     * The total size allocated for the unique files, in bytes. This is the
+     * size which can be freed by deleting the whole tree.
+     */
+    uint64_t UniqueAllocatedSize;
+
+    /**
+     * The total compressed size of the unique files, in bytes.
+     */
+    uint64_t UniqueCompressedSize;
+
+} NSUDO_SWEEPER_SIZE_INFORMATION, *PNSUDO_SWEEPER_SIZE_INFORMATION;
+
+/**
+ * The size record of a file, used for the hard link deduplication.
+ */
+typedef struct _NSUDO_SWEEPER_SIZE_RECORD
+{
+    /**
+     * The file ID of the file, it is unique in the volume.
+     */
+    uint64_t FileId;
+
+    /**
+     * The logical size of the file, in bytes.
+     */
+    uint64_t LogicalSize;
+
+    /**
+     * The size allocated for the file, in bytes.
+     */
+    uint64_t AllocatedSize;
+
+    /**
+     * The compressed size of the file, in bytes.
+     */
+    uint64_t CompressedSize;
+
+    /**
+     * The serial number of the volume which contains the file.
+     */
+    uint32_t VolumeSerialNumber;
+
+    /**
+     * The index of the tree which contains the file.
+     */
+    uint32_t RootIndex;
+
+} NSUDO_SWEEPER_SIZE_RECORD, *PNSUDO_SWEEPER_SIZE_RECORD;
+
+/**
+ * Rounds a size up to a multiple of the cluster size.
+ *
+ * @param Size The size, in bytes.
+ * @param ClusterSize The cluster size of the volume, in bytes. If this
+ *                    parameter is 0, the size is returned unchanged.
+ * @return The rounded size, in bytes. It saturates at UINT64_MAX.
+ */
+uint64_t NSudoSweeperRoundToClusterSize(
+    uint64_t Size,
+    uint32_t ClusterSize);
+
+/**
+ * Initializes the size record of a file from its directory entry. The
+ * compressed size is the logical size until NSudoSweeperSetStoredSize is
+ * called.
+ *
+ * @param Record The size record.
+ * @param FileId The file ID of the file.
+ * @param LogicalSize The logical size of the file, in bytes.
+ * @param AllocatedSize The size allocated for the file, in bytes.
+ * @param VolumeSerialNumber The serial number of the volume.
+ * @param RootIndex The index of the tree which contains the file.
+ */
+void NSudoSweeperInitializeSizeRecord(
+    PNSUDO_SWEEPER_SIZE_RECORD Record,
+    uint64_t FileId,
+    uint64_t LogicalSize,
+    uint64_t AllocatedSize,
+    uint32_t VolumeSerialNumber,
+    uint32_t RootIndex);
+
+/**
+ * Sets the number of the bytes stored for a compressed or sparse file.
+ *
+ * @param Record The size record.
+ * @param StoredSize The number of the bytes stored for the file, it becomes
+ *                   the compressed size.
+ * @param ClusterSize The cluster size of the volume, in bytes.
+ * @param IsExternallyBacked Set to true if the data is stored in a place the
+ *                           allocated size does not include, such as the
+ *                           named stream of the Windows Overlay Filter. The
+ *                           allocated size grows to the stored size rounded
+ *                           up to the cluster size.
+ */
+void NSudoSweeperSetStoredSize(
+    PNSUDO_SWEEPER_SIZE_RECORD Record,
+    uint64_t StoredSize,
+    uint32_t ClusterSize,
+    bool IsExternallyBacked);
+
+/**
+ * Reduces the size records of the directory trees.
+ *
+ * @param Records The size records of all files in the trees. They are sorted
+ *                by the volume serial number, the file ID and the tree.
+ * @param RootCount The number of the trees.
+ * @param SizeInformation An array of RootCount NSUDO_SWEEPER_SIZE_INFORMATION
+ *                        structures that receives the size information of
+ *                        each tree.
+ * @param TotalSizeInformation A pointer to a NSUDO_SWEEPER_SIZE_INFORMATION
+ *                             structure that receives the size information
+ *                             of all trees. This parameter can be nullptr.
+ * @remark The hard links are deduplicated by the volume serial number and the
+ *         file ID. A file linked from several trees is counted once in the
+ *         unique totals of each of them and once in the unique totals of all
+ *         trees.
+ */
+void NSudoSweeperReduceSizeRecords(
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD>& Records,
+    size_t RootCount,
+    PNSUDO_SWEEPER_SIZE_INFORMATION SizeInformation,
+    PNSUDO_SWEEPER_SIZE_INFORMATION TotalSizeInformation);
+
+#endif // !NSUDO_SWEEPER_SIZE_ACCOUNTING_CORE
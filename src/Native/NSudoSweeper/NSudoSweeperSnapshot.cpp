@@ -0,0 +1,495 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSnapshot.cpp
+ * PURPOSE:   NSudo Sweeper Directory Snapshot Implementation for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include "NSudoSweeperSnapshot.h"
+
+#include <Mile.Windows.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+    /**
+     * The size of the buffer used for the directory enumeration, in bytes.
+     */
+    const DWORD EnumerationBufferSize = 64 * 1024;
+
+    /**
+     * The mapped view of a persisted directory snapshot.
+     */
+    struct SnapshotView
+    {
+        HANDLE FileHandle = INVALID_HANDLE_VALUE;
+        HANDLE MappingHandle = nullptr;
+        LPVOID BaseAddress = nullptr;
+
+        NSUDO_SWEEPER_SNAPSHOT_VIEW View = {};
+    };
+
+    /**
+     * Closes a mapped view of a persisted directory snapshot.
+     *
+     * @param Snapshot The mapped view.
+     */
+    void CloseSnapshot(
+        _Inout_ SnapshotView& Snapshot)
+    {
+        Snapshot.View.Header = nullptr;
+        Snapshot.View.Entries = nullptr;
+        Snapshot.View.Names = nullptr;
+        Snapshot.View.FileIdIndex.clear();
+
+        if (Snapshot.BaseAddress)
+        {
+            ::MileUnmapViewOfFile(Snapshot.BaseAddress);
+            Snapshot.BaseAddress = nullptr;
+        }
+
+        if (Snapshot.MappingHandle)
+        {
+            ::MileCloseHandle(Snapshot.MappingHandle);
+            Snapshot.MappingHandle = nullptr;
+        }
+
+        if (Snapshot.FileHandle != INVALID_HANDLE_VALUE)
+        {
+            ::MileCloseHandle(Snapshot.FileHandle);
+            Snapshot.FileHandle = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    /**
+     * Maps a persisted directory snapshot and validates it.
+     *
+     * @param SnapshotPath The path of the snapshot file.
+     * @param Snapshot The mapped view.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT OpenSnapshot(
+        _In_ LPCWSTR SnapshotPath,
+        _Out_ SnapshotView& Snapshot)
+    {
+        HRESULT hr = ::MileCreateFile(
+            SnapshotPath,
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr,
+            &Snapshot.FileHandle);
+        if (hr == S_OK)
+        {
+            UINT64 FileSize = 0;
+            hr = ::MileGetFileSize(Snapshot.FileHandle, &FileSize);
+            if (hr == S_OK && FileSize < sizeof(NSUDO_SWEEPER_SNAPSHOT_HEADER))
+            {
+                hr = ::MileHResultFromWin32(ERROR_INVALID_DATA);
+            }
+
+            if (hr == S_OK)
+            {
+                hr = ::MileCreateFileMapping(
+                    Snapshot.FileHandle,
+                    nullptr,
+                    PAGE_READONLY,
+                    0,
+                    0,
+                    nullptr,
+                    &Snapshot.MappingHandle);
+            }
+
+            if (hr == S_OK)
+            {
+                hr = ::MileMapViewOfFile(
+                    Snapshot.MappingHandle,
+                    FILE_MAP_READ,
+                    0,
+                    0,
+                    0,
+                    &Snapshot.BaseAddress);
+            }
+
+            if (hr == S_OK && !::NSudoSweeperOpenSnapshotView(
+                Snapshot.BaseAddress,
+                static_cast<SIZE_T>(FileSize),
+                &Snapshot.View))
+            {
+                hr = ::MileHResultFromWin32(ERROR_INVALID_DATA);
+            }
+        }
+
+        if (hr != S_OK)
+        {
+            CloseSnapshot(Snapshot);
+        }
+
+        return hr;
+    }
+
+    /**
+     * Queries the identity of a directory.
+     *
+     * @param Path The path of the directory.
+     * @param FileId A pointer to a variable that receives the file ID.
+     * @param LastWriteTime A pointer to a variable that receives the last
+     *                      write time.
+     * @param VolumeSerialNumber A pointer to a variable that receives the
+     *                           serial number of the volume.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT QueryDirectoryIdentity(
+        _In_ LPCWSTR Path,
+        _Out_ PUINT64 FileId,
+        _Out_ PUINT64 LastWriteTime,
+        _Out_opt_ PUINT32 VolumeSerialNumber)
+    {
+        HANDLE DirectoryHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            Path,
+            FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+            nullptr,
+            &DirectoryHandle);
+        if (hr == S_OK)
+        {
+            BY_HANDLE_FILE_INFORMATION Information;
+            hr = ::MileGetLastErrorWithWin32BoolAsHResult(
+                ::GetFileInformationByHandle(DirectoryHandle, &Information));
+            if (hr == S_OK)
+            {
+                *FileId =
+                    (static_cast<UINT64>(Information.nFileIndexHigh) << 32) |
+                    Information.nFileIndexLow;
+                *LastWriteTime =
+                    (static_cast<UINT64>(
+                        Information.ftLastWriteTime.dwHighDateTime) << 32) |
+                    Information.ftLastWriteTime.dwLowDateTime;
+                if (VolumeSerialNumber)
+                {
+                    *VolumeSerialNumber = Information.dwVolumeSerialNumber;
+                }
+            }
+
+            ::MileCloseHandle(DirectoryHandle);
+        }
+
+        return hr;
+    }
+
+    /**
+     * Enumerates the direct children of a directory.
+     *
+     * @param Path The path of the directory.
+     * @param Buffer The buffer used for the enumeration.
+     * @param FileSize A pointer to a variable that receives the size allocated
+     *                 for the files directly under the directory.
+     * @param FileCount A pointer to a variable that receives the number of
+     *                  the files directly under the directory.
+     * @param Children The child directories, the reparse points are excluded.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT EnumerateDirectory(
+        _In_ LPCWSTR Path,
+        _Inout_ std::vector<BYTE>& Buffer,
+        _Out_ PUINT64 FileSize,
+        _Out_ PUINT32 FileCount,
+        _Out_ std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD>& Children)
+    {
+        *FileSize = 0;
+        *FileCount = 0;
+        Children.clear();
+
+        HANDLE DirectoryHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            Path,
+            FILE_LIST_DIRECTORY | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT,
+            nullptr,
+            &DirectoryHandle);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        Buffer.resize(EnumerationBufferSize);
+
+        FILE_INFO_BY_HANDLE_CLASS InformationClass =
+            FILE_INFO_BY_HANDLE_CLASS::FileIdBothDirectoryRestartInfo;
+
+        for (;;)
+        {
+            hr = ::MileGetFileInformation(
+                DirectoryHandle,
+                InformationClass,
+                &Buffer[0],
+                static_cast<DWORD>(Buffer.size()));
+            if (hr != S_OK)
+            {
+                if (hr == ::MileHResultFromWin32(ERROR_NO_MORE_FILES))
+                {
+                    hr = S_OK;
+                }
+
+                break;
+            }
+
+            InformationClass =
+                FILE_INFO_BY_HANDLE_CLASS::FileIdBothDirectoryInfo;
+
+            PFILE_ID_BOTH_DIR_INFO Information =
+                reinterpret_cast<PFILE_ID_BOTH_DIR_INFO>(&Buffer[0]);
+
+            for (;;)
+            {
+                DWORD NameLength = Information->FileNameLength
+                    / sizeof(wchar_t);
+                const wchar_t* Name = Information->FileName;
+
+                bool IsDots = (NameLength == 1 && Name[0] == L'.') ||
+                    (NameLength == 2 && Name[0] == L'.' && Name[1] == L'.');
+
+                if (IsDots)
+                {
+                    // Skip the current and parent directory markers.
+                }
+                else if (Information->FileAttributes
+                    & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    if (!(Information->FileAttributes
+                        & FILE_ATTRIBUTE_REPARSE_POINT))
+                    {
+                        NSUDO_SWEEPER_SNAPSHOT_CHILD Child;
+                        Child.FileId = static_cast<UINT64>(
+                            Information->FileId.QuadPart);
+                        Child.LastWriteTime = static_cast<UINT64>(
+                            Information->LastWriteTime.QuadPart);
+                        Child.Name.assign(
+                            reinterpret_cast<const char16_t*>(Name),
+                            NameLength);
+                        Children.push_back(std::move(Child));
+                    }
+                }
+                else
+                {
+                    *FileSize += static_cast<UINT64>(
+                        Information->AllocationSize.QuadPart);
+                    ++*FileCount;
+                }
+
+                if (!Information->NextEntryOffset)
+                {
+                    break;
+                }
+
+                Information = reinterpret_cast<PFILE_ID_BOTH_DIR_INFO>(
+                    reinterpret_cast<PBYTE>(Information) +
+                    Information->NextEntryOffset);
+            }
+        }
+
+        ::MileCloseHandle(DirectoryHandle);
+
+        return hr;
+    }
+
+    bool QueryWindowsDirectory(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileId,
+        uint64_t* LastWriteTime)
+    {
+        UNREFERENCED_PARAMETER(Context);
+
+        return S_OK == QueryDirectoryIdentity(
+            reinterpret_cast<LPCWSTR>(Path),
+            FileId,
+            LastWriteTime,
+            nullptr);
+    }
+
+    bool EnumerateWindowsDirectory(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileSize,
+        uint32_t* FileCount,
+        std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD>* Children)
+    {
+        return S_OK == EnumerateDirectory(
+            reinterpret_cast<LPCWSTR>(Path),
+            *reinterpret_cast<std::vector<BYTE>*>(Context),
+            FileSize,
+            FileCount,
+            *Children);
+    }
+
+    /**
+     * Persists a directory snapshot. The snapshot is written to a temporary
+     * file first, and then replaces the previous one.
+     *
+     * @param SnapshotPath The path of the snapshot file.
+     * @param Content The serialized snapshot.
+     * @return HRESULT. If the function succeeds, the return value is S_OK.
+     */
+    HRESULT SaveSnapshot(
+        _In_ LPCWSTR SnapshotPath,
+        _In_ const std::vector<uint8_t>& Content)
+    {
+        std::wstring TemporaryPath = SnapshotPath;
+        TemporaryPath += L".tmp";
+
+        HANDLE FileHandle = INVALID_HANDLE_VALUE;
+        HRESULT hr = ::MileCreateFile(
+            TemporaryPath.c_str(),
+            GENERIC_WRITE,
+            0,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            nullptr,
+            &FileHandle);
+        if (hr != S_OK)
+        {
+            return hr;
+        }
+
+        DWORD NumberOfBytesWritten = 0;
+
+        hr = ::MileWriteFile(
+            FileHandle,
+            Content.data(),
+            static_cast<DWORD>(Content.size()),
+            &NumberOfBytesWritten,
+            nullptr);
+
+        ::MileCloseHandle(FileHandle);
+
+        if (hr == S_OK)
+        {
+            hr = ::MileGetLastErrorWithWin32BoolAsHResult(::MoveFileExW(
+                TemporaryPath.c_str(),
+                SnapshotPath,
+                MOVEFILE_REPLACE_EXISTING));
+        }
+
+        if (hr != S_OK)
+        {
+            ::DeleteFileW(TemporaryPath.c_str());
+        }
+
+        return hr;
+    }
+}
+
+/**
+ * @remark You can read the definition for this function in
+ *         "NSudoSweeperSnapshot.h".
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperEstimateDirectorySize(
+    _In_ LPCWSTR RootPath,
+    _In_opt_ LPCWSTR SnapshotPath,
+    _Out_ PUINT64 EstimatedSize,
+    _Out_opt_ PNSUDO_SWEEPER_SCAN_STATISTICS Statistics)
+{
+    if (!RootPath || !EstimatedSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    *EstimatedSize = 0;
+
+    ULONGLONG StartTime = ::MileGetTickCount();
+
+    UINT64 FileId = 0;
+    UINT64 LastWriteTime = 0;
+    UINT32 VolumeSerialNumber = 0;
+
+    HRESULT hr = QueryDirectoryIdentity(
+        RootPath,
+        &FileId,
+        &LastWriteTime,
+        &VolumeSerialNumber);
+    if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    std::u16string Root(reinterpret_cast<const char16_t*>(RootPath));
+
+    SnapshotView Snapshot;
+    if (SnapshotPath && S_OK == OpenSnapshot(SnapshotPath, Snapshot))
+    {
+        // Only reuse the snapshot of the same tree.
+        if (!::NSudoSweeperIsSnapshotOfTree(
+            &Snapshot.View,
+            VolumeSerialNumber,
+            Root.c_str(),
+            Root.size()))
+        {
+            CloseSnapshot(Snapshot);
+        }
+    }
+
+    std::vector<BYTE> Buffer;
+
+    NSUDO_SWEEPER_SCAN_BACKEND Backend;
+    Backend.Context = &Buffer;
+    Backend.Separator = u'\\';
+    Backend.QueryDirectory = QueryWindowsDirectory;
+    Backend.EnumerateDirectory = EnumerateWindowsDirectory;
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    if (!::NSudoSweeperScanDirectoryTree(
+        &Snapshot.View,
+        Root,
+        &Backend,
+        &Scan))
+    {
+        hr = ::MileHResultFromWin32(ERROR_PATH_NOT_FOUND);
+    }
+
+    CloseSnapshot(Snapshot);
+
+    if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    *EstimatedSize = Scan.Entries[0].TotalSize;
+
+    if (SnapshotPath)
+    {
+        // The estimation is still valid if the snapshot cannot be persisted.
+        std::vector<uint8_t> Content;
+        ::NSudoSweeperSerializeSnapshot(VolumeSerialNumber, &Scan, Content);
+        SaveSnapshot(SnapshotPath, Content);
+    }
+
+    if (Statistics)
+    {
+        Statistics->DirectoryCount = Scan.Entries.size();
+        Statistics->EnumeratedDirectoryCount = Scan.EnumeratedDirectoryCount;
+        Statistics->ReusedDirectoryCount = Scan.ReusedDirectoryCount;
+        Statistics->ElapsedTime = ::MileGetTickCount() - StartTime;
+    }
+
+    return hr;
+}
@@ -0,0 +1,78 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSnapshot.h
+ * PURPOSE:   NSudo Sweeper Directory Snapshot Definition for Windows
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_SNAPSHOT
+#define NSUDO_SWEEPER_SNAPSHOT
+
+#include "NSudoSweeperCore.h"
+#include "NSudoSweeperSnapshotCore.h"
+
+/**
+ * The statistics of a NSudoSweeperEstimateDirectorySize call.
+ */
+typedef struct _NSUDO_SWEEPER_SCAN_STATISTICS
+{
+    /**
+     * The number of the directories in the tree.
+     */
+    UINT64 DirectoryCount;
+
+    /**
+     * The number of the directories which were enumerated.
+     */
+    UINT64 EnumeratedDirectoryCount;
+
+    /**
+     * The number of the directories whose records were reused from the
+     * snapshot.
+     */
+    UINT64 ReusedDirectoryCount;
+
+    /**
+     * The elapsed time of the scan, in milliseconds.
+     */
+    ULONGLONG ElapsedTime;
+
+} NSUDO_SWEEPER_SCAN_STATISTICS, *PNSUDO_SWEEPER_SCAN_STATISTICS;
+
+/**
+ * Estimates the size allocated for all files in a directory tree with the
+ * help of a persisted directory snapshot.
+ *
+ * @param RootPath An absolute path to the root directory of the tree. You can
+ *                 only use backslashes in this name, and the path should not
+ *                 end with a backslash.
+ * @param SnapshotPath An absolute path to the snapshot file. If the file
+ *                     exists and matches the root directory, the records of
+ *                     the unchanged directories will be reused. The file will
+ *                     be replaced by the result of this scan. If the pointer
+ *                     is NULL, the whole tree will be enumerated.
+ * @param EstimatedSize A pointer to a variable that receives the size
+ *                      allocated for all files in the tree, in bytes.
+ * @param Statistics A pointer to a NSUDO_SWEEPER_SCAN_STATISTICS structure
+ *                   that receives the statistics of the scan. This parameter
+ *                   can be NULL.
+ * @return HRESULT. If the function succeeds, the return value is S_OK.
+ * @remark A directory is only enumerated again if its file ID or last write
+ *         time is changed. The last write time of a directory only changes
+ *         when its entries are added, removed or renamed, so the size changes
+ *         of the existing files in an unchanged directory are not detected
+ *         until the directory itself is modified. The reparse points are not
+ *         followed. The snapshot format and the scanner are defined in
+ *         "NSudoSweeperSnapshotCore.h", this function only provides the
+ *         Windows backend.
+ */
+EXTERN_C HRESULT WINAPI NSudoSweeperEstimateDirectorySize(
+    _In_ LPCWSTR RootPath,
+    _In_opt_ LPCWSTR SnapshotPath,
+    _Out_ PUINT64 EstimatedSize,
+    _Out_opt_ PNSUDO_SWEEPER_SCAN_STATISTICS Statistics);
+
+#endif // !NSUDO_SWEEPER_SNAPSHOT
@@ -0,0 +1,632 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSnapshotCore.cpp
+ * PURPOSE:   Implementation for the Directory Snapshot Format and Scanner
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoSweeperSnapshotCore.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    char16_t FoldCharacter(
+        char16_t Character)
+    {
+        if (Character >= u'a' && Character <= u'z')
+        {
+            return static_cast<char16_t>(Character - (u'a' - u'A'));
+        }
+
+        return Character;
+    }
+
+    /**
+     * Checks whether the name of a child directory can be joined to the path
+     * of its parent directory without leaving it.
+     */
+    bool IsValidChildName(
+        const char16_t* Name,
+        size_t Length)
+    {
+        if (!Length)
+        {
+            return false;
+        }
+
+        if ((Length == 1 && Name[0] == u'.') ||
+            (Length == 2 && Name[0] == u'.' && Name[1] == u'.'))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < Length; ++i)
+        {
+            if (Name[i] == u'\\' || Name[i] == u'/' || Name[i] == u'\0')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * The state of a NSudoSweeperScanDirectoryTree call.
+     */
+    struct ScanContext
+    {
+        const NSUDO_SWEEPER_SNAPSHOT_VIEW* Previous;
+        const NSUDO_SWEEPER_SCAN_BACKEND* Backend;
+        PNSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+
+        std::u16string Path;
+    };
+
+    /**
+     * Scans a directory tree. The record of the directory must have been
+     * added with its file ID and last write time, and Context.Path must be
+     * the path of the directory.
+     *
+     * @param Context The scan context.
+     * @param EntryIndex The index of the record of the directory.
+     */
+    void ScanDirectory(
+        ScanContext& Context,
+        size_t EntryIndex)
+    {
+        const NSUDO_SWEEPER_SCAN_BACKEND* Backend = Context.Backend;
+        PNSUDO_SWEEPER_SNAPSHOT_SCAN Scan = Context.Scan;
+
+        const NSUDO_SWEEPER_SNAPSHOT_ENTRY* Previous =
+            ::NSudoSweeperFindSnapshotEntry(
+                Context.Previous,
+                Scan->Entries[EntryIndex].FileId);
+
+        uint64_t FileSize = 0;
+        uint32_t FileCount = 0;
+        std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD> Children;
+
+        if (Previous &&
+            Previous->LastWriteTime == Scan->Entries[EntryIndex].LastWriteTime)
+        {
+            // The entries of the directory are not changed, reuse the record
+            // and only check the child directories.
+            ++Scan->ReusedDirectoryCount;
+
+            FileSize = Previous->FileSize;
+            FileCount = Previous->FileCount;
+
+            const size_t PathLength = Context.Path.size();
+
+            for (uint32_t i = 0; i < Previous->ChildCount; ++i)
+            {
+                const NSUDO_SWEEPER_SNAPSHOT_ENTRY& PreviousChild =
+                    Context.Previous->Entries[Previous->FirstChild + i];
+
+                NSUDO_SWEEPER_SNAPSHOT_CHILD Child;
+                Child.Name.assign(
+                    Context.Previous->Names + PreviousChild.NameOffset,
+                    PreviousChild.NameLength);
+
+                Context.Path += Backend->Separator;
+                Context.Path += Child.Name;
+
+                if (Backend->QueryDirectory(
+                    Backend->Context,
+                    Context.Path.c_str(),
+                    &Child.FileId,
+                    &Child.LastWriteTime))
+                {
+                    Children.push_back(std::move(Child));
+                }
+
+                Context.Path.resize(PathLength);
+            }
+        }
+        else
+        {
+            ++Scan->EnumeratedDirectoryCount;
+
+            if (!Backend->EnumerateDirectory(
+                Backend->Context,
+                Context.Path.c_str(),
+                &FileSize,
+                &FileCount,
+                &Children))
+            {
+                FileSize = 0;
+                FileCount = 0;
+                Children.clear();
+            }
+        }
+
+        const size_t FirstChild = Scan->Entries.size();
+
+        for (const NSUDO_SWEEPER_SNAPSHOT_CHILD& Child : Children)
+        {
+            NSUDO_SWEEPER_SNAPSHOT_ENTRY Entry = {};
+            Entry.FileId = Child.FileId;
+            Entry.LastWriteTime = Child.LastWriteTime;
+            Entry.NameOffset = static_cast<uint32_t>(Scan->Names.size());
+            Entry.NameLength = static_cast<uint32_t>(Child.Name.size());
+            Scan->Names += Child.Name;
+            Scan->Entries.push_back(Entry);
+        }
+
+        uint64_t TotalSize = FileSize;
+
+        const size_t PathLength = Context.Path.size();
+
+        for (size_t i = 0; i < Children.size(); ++i)
+        {
+            Context.Path += Backend->Separator;
+            Context.Path += Children[i].Name;
+
+            ScanDirectory(Context, FirstChild + i);
+
+            Context.Path.resize(PathLength);
+
+            TotalSize += Scan->Entries[FirstChild + i].TotalSize;
+        }
+
+        NSUDO_SWEEPER_SNAPSHOT_ENTRY& Entry = Scan->Entries[EntryIndex];
+        Entry.FileSize = FileSize;
+        Entry.TotalSize = TotalSize;
+        Entry.FileCount = FileCount;
+        Entry.FirstChild = static_cast<uint32_t>(FirstChild);
+        Entry.ChildCount = static_cast<uint32_t>(Children.size());
+    }
+}
+
+bool NSudoSweeperOpenSnapshotView(
+    const void* Base,
+    size_t Size,
+    PNSUDO_SWEEPER_SNAPSHOT_VIEW View)
+{
+    View->Header = nullptr;
+    View->Entries = nullptr;
+    View->Names = nullptr;
+    View->FileIdIndex.clear();
+
+    if (!Base || Size < sizeof(NSUDO_SWEEPER_SNAPSHOT_HEADER))
+    {
+        return false;
+    }
+
+    const uint8_t* Content = static_cast<const uint8_t*>(Base);
+
+    const NSUDO_SWEEPER_SNAPSHOT_HEADER* Header =
+        reinterpret_cast<const NSUDO_SWEEPER_SNAPSHOT_HEADER*>(Content);
+
+    uint64_t ExpectedSize =
+        sizeof(NSUDO_SWEEPER_SNAPSHOT_HEADER) +
+        sizeof(NSUDO_SWEEPER_SNAPSHOT_ENTRY) *
+        static_cast<uint64_t>(Header->EntryCount) +
+        sizeof(char16_t) * static_cast<uint64_t>(Header->NameLength);
+
+    if (Header->Signature != NSUDO_SWEEPER_SNAPSHOT_SIGNATURE ||
+        Header->Version != NSUDO_SWEEPER_SNAPSHOT_VERSION ||
+        Header->EntryCount == 0 ||
+        ExpectedSize != Size)
+    {
+        return false;
+    }
+
+    const NSUDO_SWEEPER_SNAPSHOT_ENTRY* Entries =
+        reinterpret_cast<const NSUDO_SWEEPER_SNAPSHOT_ENTRY*>(
+            Content + sizeof(NSUDO_SWEEPER_SNAPSHOT_HEADER));
+    const char16_t* Names =
+        reinterpret_cast<const char16_t*>(Entries + Header->EntryCount);
+
+    const uint32_t EntryCount = Header->EntryCount;
+
+    for (uint32_t i = 0; i < EntryCount; ++i)
+    {
+        const NSUDO_SWEEPER_SNAPSHOT_ENTRY& Entry = Entries[i];
+
+        if (static_cast<uint64_t>(Entry.NameOffset) + Entry.NameLength >
+            Header->NameLength)
+        {
+            return false;
+        }
+
+        // The children are always stored after their parent, so the records
+        // cannot form a cycle.
+        if (Entry.ChildCount &&
+            (Entry.FirstChild <= i ||
+            static_cast<uint64_t>(Entry.FirstChild) + Entry.ChildCount >
+            EntryCount))
+        {
+            return false;
+        }
+
+        if (i && !IsValidChildName(
+            Names + Entry.NameOffset,
+            Entry.NameLength))
+        {
+            return false;
+        }
+    }
+
+    View->Header = Header;
+    View->Entries = Entries;
+    View->Names = Names;
+
+    View->FileIdIndex.resize(EntryCount);
+    for (uint32_t i = 0; i < EntryCount; ++i)
+    {
+        View->FileIdIndex[i] = i;
+    }
+
+    std::sort(
+        View->FileIdIndex.begin(),
+        View->FileIdIndex.end(),
+        [Entries](uint32_t Left, uint32_t Right) -> bool
+        {
+            return Entries[Left].FileId < Entries[Right].FileId;
+        });
+
+    return true;
+}
+
+bool NSudoSweeperIsSnapshotOfTree(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* View,
+    uint32_t VolumeSerialNumber,
+    const char16_t* RootPath,
+    size_t RootPathLength)
+{
+    if (!View->Header ||
+        View->Header->VolumeSerialNumber != VolumeSerialNumber)
+    {
+        return false;
+    }
+
+    const NSUDO_SWEEPER_SNAPSHOT_ENTRY& Root = View->Entries[0];
+    if (Root.NameLength != RootPathLength)
+    {
+        return false;
+    }
+
+    const char16_t* Name = View->Names + Root.NameOffset;
+    for (size_t i = 0; i < RootPathLength; ++i)
+    {
+        if (FoldCharacter(Name[i]) != FoldCharacter(RootPath[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const NSUDO_SWEEPER_SNAPSHOT_ENTRY* NSudoSweeperFindSnapshotEntry(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* View,
+    uint64_t FileId)
+{
+    if (!View || !View->Header)
+    {
+        return nullptr;
+    }
+
+    const NSUDO_SWEEPER_SNAPSHOT_ENTRY* Entries = View->Entries;
+
+    auto Iterator = std::lower_bound(
+        View->FileIdIndex.begin(),
+        View->FileIdIndex.end(),
+        FileId,
+        [Entries](uint32_t Index, uint64_t Value) -> bool
+        {
+            return Entries[Index].FileId < Value;
+        });
+    if (Iterator == View->FileIdIndex.end() ||
+        Entries[*Iterator].FileId != FileId)
+    {
+        return nullptr;
+    }
+
+    return &Entries[*Iterator];
+}
+
+bool NSudoSweeperScanDirectoryTree(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* Previous,
+    const std::u16string& RootPath,
+    const NSUDO_SWEEPER_SCAN_BACKEND* Backend,
+    PNSUDO_SWEEPER_SNAPSHOT_SCAN Scan)
+{
+    Scan->Entries.clear();
+    Scan->Names.clear();
+    Scan->EnumeratedDirectoryCount = 0;
+    Scan->ReusedDirectoryCount = 0;
+
+    NSUDO_SWEEPER_SNAPSHOT_ENTRY Root = {};
+    if (!Backend->QueryDirectory(
+        Backend->Context,
+        RootPath.c_str(),
+        &Root.FileId,
+        &Root.LastWriteTime))
+    {
+        return false;
+    }
+
+    Root.NameOffset = 0;
+    Root.NameLength = static_cast<uint32_t>(RootPath.size());
+    Scan->Names = RootPath;
+    Scan->Entries.push_back(Root);
+
+    ScanContext Context;
+    Context.Previous = Previous;
+    Context.Backend = Backend;
+    Context.Scan = Scan;
+    Context.Path = RootPath;
+
+    ScanDirectory(Context, 0);
+
+    return true;
+}
+
+void NSudoSweeperSerializeSnapshot(
+    uint32_t VolumeSerialNumber,
+    const NSUDO_SWEEPER_SNAPSHOT_SCAN* Scan,
+    std::vector<uint8_t>& Content)
+{
+    NSUDO_SWEEPER_SNAPSHOT_HEADER Header = {};
+    Header.Signature = NSUDO_SWEEPER_SNAPSHOT_SIGNATURE;
+    Header.Version = NSUDO_SWEEPER_SNAPSHOT_VERSION;
+    Header.VolumeSerialNumber = VolumeSerialNumber;
+    Header.EntryCount = static_cast<uint32_t>(Scan->Entries.size());
+    Header.NameLength = static_cast<uint32_t>(Scan->Names.size());
+
+    const size_t EntriesSize =
+        Scan->Entries.size() * sizeof(NSUDO_SWEEPER_SNAPSHOT_ENTRY);
+    const size_t NamesSize = Scan->Names.size() * sizeof(char16_t);
+
+    Content.resize(sizeof(Header) + EntriesSize + NamesSize);
+
+    uint8_t* Current = Content.data();
+    std::memcpy(Current, &Header, sizeof(Header));
+    Current += sizeof(Header);
+    if (EntriesSize)
+    {
+        std::memcpy(Current, Scan->Entries.data(), EntriesSize);
+        Current += EntriesSize;
+    }
+    if (NamesSize)
+    {
+        std::memcpy(Current, Scan->Names.data(), NamesSize);
+    }
+}
+
+#if defined(__linux__)
+
+namespace
+{
+    /**
+     * Converts a UTF-16 path to UTF-8, the unpaired surrogates are replaced
+     * with U+FFFD.
+     */
+    std::string MakeUtf8Path(
+        const char16_t* Path)
+    {
+        std::string Result;
+        for (size_t i = 0; Path[i]; ++i)
+        {
+            uint32_t CodePoint = Path[i];
+            if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF &&
+                Path[i + 1] >= 0xDC00 && Path[i + 1] <= 0xDFFF)
+            {
+                CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) +
+                    (Path[i + 1] - 0xDC00);
+                ++i;
+            }
+            else if (CodePoint >= 0xD800 && CodePoint <= 0xDFFF)
+            {
+                CodePoint = 0xFFFD;
+            }
+
+            if (CodePoint < 0x80)
+            {
+                Result.push_back(static_cast<char>(CodePoint));
+            }
+            else if (CodePoint < 0x800)
+            {
+                Result.push_back(static_cast<char>(0xC0 | (CodePoint >> 6)));
+                Result.push_back(static_cast<char>(
+                    0x80 | (CodePoint & 0x3F)));
+            }
+            else if (CodePoint < 0x10000)
+            {
+                Result.push_back(static_cast<char>(0xE0 | (CodePoint >> 12)));
+                Result.push_back(static_cast<char>(
+                    0x80 | ((CodePoint >> 6) & 0x3F)));
+                Result.push_back(static_cast<char>(
+                    0x80 | (CodePoint & 0x3F)));
+            }
+            else
+            {
+                Result.push_back(static_cast<char>(0xF0 | (CodePoint >> 18)));
+                Result.push_back(static_cast<char>(
+                    0x80 | ((CodePoint >> 12) & 0x3F)));
+                Result.push_back(static_cast<char>(
+                    0x80 | ((CodePoint >> 6) & 0x3F)));
+                Result.push_back(static_cast<char>(
+                    0x80 | (CodePoint & 0x3F)));
+            }
+        }
+        return Result;
+    }
+
+    /**
+     * Converts a UTF-8 name to UTF-16, the invalid sequences are replaced
+     * with U+FFFD.
+     */
+    std::u16string MakeUtf16Name(
+        const char* Name)
+    {
+        std::u16string Result;
+        const uint8_t* Current = reinterpret_cast<const uint8_t*>(Name);
+        while (*Current)
+        {
+            uint32_t CodePoint = *Current;
+            size_t Length = 1;
+            if (CodePoint >= 0xF0 && CodePoint < 0xF8)
+            {
+                CodePoint &= 0x07;
+                Length = 4;
+            }
+            else if (CodePoint >= 0xE0)
+            {
+                CodePoint &= 0x0F;
+                Length = 3;
+            }
+            else if (CodePoint >= 0xC0)
+            {
+                CodePoint &= 0x1F;
+                Length = 2;
+            }
+            else if (CodePoint >= 0x80)
+            {
+                CodePoint = 0xFFFD;
+            }
+
+            size_t i = 1;
+            for (; i < Length; ++i)
+            {
+                if ((Current[i] & 0xC0) != 0x80)
+                {
+                    break;
+                }
+                CodePoint = (CodePoint << 6) | (Current[i] & 0x3F);
+            }
+            if (i != Length || CodePoint > 0x10FFFF)
+            {
+                CodePoint = 0xFFFD;
+            }
+            Current += i;
+
+            if (CodePoint >= 0x10000)
+            {
+                CodePoint -= 0x10000;
+                Result.push_back(
+                    static_cast<char16_t>(0xD800 + (CodePoint >> 10)));
+                Result.push_back(
+                    static_cast<char16_t>(0xDC00 + (CodePoint & 0x3FF)));
+            }
+            else
+            {
+                Result.push_back(static_cast<char16_t>(CodePoint));
+            }
+        }
+        return Result;
+    }
+
+    uint64_t GetModificationTime(
+        const struct stat& Status)
+    {
+        return static_cast<uint64_t>(Status.st_mtim.tv_sec) * 1000000000 +
+            static_cast<uint64_t>(Status.st_mtim.tv_nsec);
+    }
+
+    bool QueryPosixDirectory(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileId,
+        uint64_t* LastWriteTime)
+    {
+        (void)Context;
+
+        struct stat Status;
+        if (::lstat(MakeUtf8Path(Path).c_str(), &Status) ||
+            !S_ISDIR(Status.st_mode))
+        {
+            return false;
+        }
+
+        *FileId = static_cast<uint64_t>(Status.st_ino);
+        *LastWriteTime = GetModificationTime(Status);
+        return true;
+    }
+
+    bool EnumeratePosixDirectory(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileSize,
+        uint32_t* FileCount,
+        std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD>* Children)
+    {
+        (void)Context;
+
+        *FileSize = 0;
+        *FileCount = 0;
+        Children->clear();
+
+        DIR* Directory = ::opendir(MakeUtf8Path(Path).c_str());
+        if (!Directory)
+        {
+            return false;
+        }
+
+        const int Descriptor = ::dirfd(Directory);
+
+        while (const struct dirent* Entry = ::readdir(Directory))
+        {
+            const char* Name = Entry->d_name;
+            if ((Name[0] == '.' && Name[1] == '\0') ||
+                (Name[0] == '.' && Name[1] == '.' && Name[2] == '\0'))
+            {
+                continue;
+            }
+
+            struct stat Status;
+            if (::fstatat(Descriptor, Name, &Status, AT_SYMLINK_NOFOLLOW))
+            {
+                continue;
+            }
+
+            if (S_ISDIR(Status.st_mode))
+            {
+                NSUDO_SWEEPER_SNAPSHOT_CHILD Child;
+                Child.FileId = static_cast<uint64_t>(Status.st_ino);
+                Child.LastWriteTime = GetModificationTime(Status);
+                Child.Name = MakeUtf16Name(Name);
+                Children->push_back(std::move(Child));
+            }
+            else
+            {
+                *FileSize += static_cast<uint64_t>(Status.st_blocks) * 512;
+                ++*FileCount;
+            }
+        }
+
+        ::closedir(Directory);
+
+        return true;
+    }
+
+    const NSUDO_SWEEPER_SCAN_BACKEND g_PosixScanBackend =
+    {
+        nullptr,
+        u'/',
+        QueryPosixDirectory,
+        EnumeratePosixDirectory,
+    };
+}
+
+const NSUDO_SWEEPER_SCAN_BACKEND* NSudoSweeperGetPosixScanBackend()
+{
+    return &g_PosixScanBackend;
+}
+
+#endif // defined(__linux__)
@@ -0,0 +1,296 @@
+﻿/*
+ * PROJECT:   NSudo Sweeper
+ * FILE:      NSudoSweeperSnapshotCore.h
+ * PURPOSE:   Definition for the Directory Snapshot Format and Scanner
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_SWEEPER_SNAPSHOT_CORE
+#define NSUDO_SWEEPER_SNAPSHOT_CORE
+
+#ifndef __cplusplus
+#error "[NSudoSweeper] You should use a C++ compiler."
+#endif // !__cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * The signature of the NSudo Sweeper directory snapshot file. ("NSSS")
+ */
+#define NSUDO_SWEEPER_SNAPSHOT_SIGNATURE 0x5353534E
+
+/**
+ * The version of the NSudo Sweeper directory snapshot file format.
+ */
+#define NSUDO_SWEEPER_SNAPSHOT_VERSION 1
+
+/**
+ * The header of the NSudo Sweeper directory snapshot file. It is followed by
+ * EntryCount NSUDO_SWEEPER_SNAPSHOT_ENTRY structures and NameLength UTF-16
+ * characters of the name pool.
+ */
+typedef struct _NSUDO_SWEEPER_SNAPSHOT_HEADER
+{
+    uint32_t Signature;
+    uint32_t Version;
+    uint32_t VolumeSerialNumber;
+    uint32_t EntryCount;
+    uint32_t NameLength;
+    uint32_t Reserved;
+} NSUDO_SWEEPER_SNAPSHOT_HEADER, *PNSUDO_SWEEPER_SNAPSHOT_HEADER;
+
+/**
+ * The directory record of the NSudo Sweeper directory snapshot file. The
+ * first entry is the root directory and its name is the root path. The child
+ * directories of a directory are stored contiguously.
+ */
+typedef struct _NSUDO_SWEEPER_SNAPSHOT_ENTRY
+{
+    /**
+     * The file ID of the directory.
+     */
+    uint64_t FileId;
+
+    /**
+     * The last write time of the directory.
+     */
+    uint64_t LastWriteTime;
+
+    /**
+     * The size allocated for the files directly under the directory, in
+     * bytes.
+     */
+    uint64_t FileSize;
+
+    /**
+     * The size allocated for all files in the directory tree, in bytes.
+     */
+    uint64_t TotalSize;
+
+    /**
+     * The number of the files directly under the directory.
+     */
+    uint32_t FileCount;
+
+    /**
+     * The index of the first child directory.
+     */
+    uint32_t FirstChild;
+
+    /**
+     * The number of the child directories.
+     */
+    uint32_t ChildCount;
+
+    /**
+     * The offset of the directory name in the name pool, in characters.
+     */
+    uint32_t NameOffset;
+
+    /**
+     * The length of the directory name, in characters.
+     */
+    uint32_t NameLength;
+
+    uint32_t Reserved;
+
+} NSUDO_SWEEPER_SNAPSHOT_ENTRY, *PNSUDO_SWEEPER_SNAPSHOT_ENTRY;
+
+/**
+ * A validated view of a persisted directory snapshot.
+ */
+typedef struct _NSUDO_SWEEPER_SNAPSHOT_VIEW
+{
+    const NSUDO_SWEEPER_SNAPSHOT_HEADER* Header;
+    const NSUDO_SWEEPER_SNAPSHOT_ENTRY* Entries;
+    const char16_t* Names;
+
+    /**
+     * The entry indexes sorted by the file ID.
+     */
+    std::vector<uint32_t> FileIdIndex;
+
+} NSUDO_SWEEPER_SNAPSHOT_VIEW, *PNSUDO_SWEEPER_SNAPSHOT_VIEW;
+
+/**
+ * The identity of a child directory reported by a scan backend.
+ */
+typedef struct _NSUDO_SWEEPER_SNAPSHOT_CHILD
+{
+    uint64_t FileId;
+    uint64_t LastWriteTime;
+    std::u16string Name;
+
+} NSUDO_SWEEPER_SNAPSHOT_CHILD, *PNSUDO_SWEEPER_SNAPSHOT_CHILD;
+
+/**
+ * The file system operations used by the directory scanner.
+ */
+typedef struct _NSUDO_SWEEPER_SCAN_BACKEND
+{
+    /**
+     * User defined custom data passed to the operations.
+     */
+    void* Context;
+
+    /**
+     * The separator used to join the directory names.
+     */
+    char16_t Separator;
+
+    /**
+     * Queries the file ID and the last write time of a directory.
+     *
+     * @return If it fails, the directory is skipped.
+     */
+    bool (*QueryDirectory)(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileId,
+        uint64_t* LastWriteTime);
+
+    /**
+     * Enumerates the direct children of a directory. The reparse points and
+     * the symbolic links should not be reported as child directories.
+     *
+     * @return If it fails, the directory is recorded as an empty directory.
+     */
+    bool (*EnumerateDirectory)(
+        void* Context,
+        const char16_t* Path,
+        uint64_t* FileSize,
+        uint32_t* FileCount,
+        std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD>* Children);
+
+} NSUDO_SWEEPER_SCAN_BACKEND, *PNSUDO_SWEEPER_SCAN_BACKEND;
+
+/**
+ * The result of a directory scan.
+ */
+typedef struct _NSUDO_SWEEPER_SNAPSHOT_SCAN
+{
+    /**
+     * The directory records, the first one is the root directory.
+     */
+    std::vector<NSUDO_SWEEPER_SNAPSHOT_ENTRY> Entries;
+
+    /**
+     * The name pool, it starts with the root path.
+     */
+    std::u16string Names;
+
+    /**
+     * The number of the directories which were enumerated.
+     */
+    uint64_t EnumeratedDirectoryCount;
+
+    /**
+     * The number of the directories whose records were reused from the
+     * previous snapshot.
+     */
+    uint64_t ReusedDirectoryCount;
+
+} NSUDO_SWEEPER_SNAPSHOT_SCAN, *PNSUDO_SWEEPER_SNAPSHOT_SCAN;
+
+/**
+ * Validates a persisted directory snapshot and opens a view of it.
+ *
+ * @param Base The content of the snapshot file, it should be aligned to 8
+ *             bytes and live as long as the view.
+ * @param Size The size of the content, in bytes.
+ * @param View The view of the snapshot.
+ * @return If the snapshot is valid, it returns true.
+ * @remark A snapshot is rejected if it is truncated or has trailing bytes, if
+ *         a record refers to the names or the records out of the snapshot,
+ *         or if the name of a child directory is empty, a dot name or
+ *         contains a separator, so a stale or corrupted snapshot cannot make
+ *         the scanner leave the tree.
+ */
+bool NSudoSweeperOpenSnapshotView(
+    const void* Base,
+    size_t Size,
+    PNSUDO_SWEEPER_SNAPSHOT_VIEW View);
+
+/**
+ * Checks whether a snapshot is taken from the same tree.
+ *
+ * @param View The view of the snapshot.
+ * @param VolumeSerialNumber The serial number of the volume of the tree.
+ * @param RootPath The path of the root directory of the tree.
+ * @param RootPathLength The number of the characters of the root path.
+ * @return If the snapshot matches, it returns true.
+ * @remark The root paths are compared case-insensitively for ASCII only.
+ */
+bool NSudoSweeperIsSnapshotOfTree(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* View,
+    uint32_t VolumeSerialNumber,
+    const char16_t* RootPath,
+    size_t RootPathLength);
+
+/**
+ * Looks up a directory record by the file ID.
+ *
+ * @param View The view of the snapshot, or nullptr if there is none.
+ * @param FileId The file ID of the directory.
+ * @return The directory record, or nullptr if not found.
+ */
+const NSUDO_SWEEPER_SNAPSHOT_ENTRY* NSudoSweeperFindSnapshotEntry(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* View,
+    uint64_t FileId);
+
+/**
+ * Scans a directory tree, and reuses the records of the unchanged
+ * directories of a previous snapshot.
+ *
+ * @param Previous The view of the previous snapshot, or nullptr if the whole
+ *                 tree should be enumerated.
+ * @param RootPath The path of the root directory, it should not end with a
+ *                 separator.
+ * @param Backend The file system operations.
+ * @param Scan The result of the scan.
+ * @return If the root directory cannot be queried, it returns false.
+ * @remark A directory is only enumerated again if its file ID or last write
+ *         time is changed. The unchanged directories reuse the size and the
+ *         number of their files, and only their child directories are
+ *         queried.
+ */
+bool NSudoSweeperScanDirectoryTree(
+    const NSUDO_SWEEPER_SNAPSHOT_VIEW* Previous,
+    const std::u16string& RootPath,
+    const NSUDO_SWEEPER_SCAN_BACKEND* Backend,
+    PNSUDO_SWEEPER_SNAPSHOT_SCAN Scan);
+
+/**
+ * Serializes the result of a directory scan to the snapshot file format.
+ *
+ * @param VolumeSerialNumber The serial number of the volume of the tree.
+ * @param Scan The result of the scan.
+ * @param Content The content of the snapshot file.
+ */
+void NSudoSweeperSerializeSnapshot(
+    uint32_t VolumeSerialNumber,
+    const NSUDO_SWEEPER_SNAPSHOT_SCAN* Scan,
+    std::vector<uint8_t>& Content);
+
+#if defined(__linux__)
+
+/**
+ * Gets the scan backend based on readdir and fstatat, it is used to test and
+ * benchmark the scanner on Linux.
+ *
+ * @return The scan backend. The file ID is the inode number, the last write
+ *         time is the modification time in nanoseconds and the sizes are the
+ *         allocated blocks. The paths are converted from UTF-16 to UTF-8.
+ */
+const NSUDO_SWEEPER_SCAN_BACKEND* NSudoSweeperGetPosixScanBackend();
+
+#endif // defined(__linux__)
+
+#endif // !NSUDO_SWEEPER_SNAPSHOT_CORE
@@ -0,0 +1,241 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Environment.Tests.cpp
+ * PURPOSE:   Tests for the Environment Block and Snapshot
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.Environment.h>
+
+#include <cwchar>
+#include <string>
+#include <thread>
+
+namespace
+{
+    /**
+     * The environment block used by the test cases. The entry without = is
+     * skipped and the second Path is a duplicate.
+     */
+    const wchar_t TestBlock[] =
+        L"=C:=C:\\x\0"
+        L"Path=C:\\Windows\0"
+        L"ALLUSERSPROFILE=C:\\ProgramData\0"
+        L"windir=C:\\Windows\0"
+        L"USERNAME=bob\0"
+        L"bogus\0"
+        L"path=dup\0"
+        L"EMPTY=\0";
+
+    /**
+     * Converts a block to a string, the NULs are replaced by |.
+     */
+    std::wstring Dump(
+        const std::vector<wchar_t>& Block)
+    {
+        std::wstring Result;
+        for (wchar_t Character : Block)
+        {
+            Result.push_back(Character ? Character : L'|');
+        }
+        return Result;
+    }
+
+    std::wstring Expand(
+        const Mile::EnvironmentSnapshot& Snapshot,
+        const wchar_t* Source,
+        std::size_t* UnresolvedCount = nullptr)
+    {
+        Mile::EnvironmentExpansionBuffer Buffer;
+        std::vector<Mile::EnvironmentReference> Unresolved;
+        bool Resolved = Snapshot.Expand(
+            Source,
+            std::wcslen(Source),
+            Buffer,
+            &Unresolved);
+        NSUDO_TEST_CHECK(Resolved == Unresolved.empty());
+        if (UnresolvedCount)
+        {
+            *UnresolvedCount = Unresolved.size();
+        }
+        return Buffer.GetData();
+    }
+}
+
+NSUDO_TEST_CASE(Environment, CompareNames)
+{
+    NSUDO_TEST_CHECK(Mile::CompareEnvironmentNames(L"Path", 4, L"PATH", 4)
+        == 0);
+    NSUDO_TEST_CHECK(Mile::CompareEnvironmentNames(L"A", 1, L"b", 1) < 0);
+    NSUDO_TEST_CHECK(Mile::CompareEnvironmentNames(L"AB", 2, L"A", 1) > 0);
+    NSUDO_TEST_CHECK(Mile::CompareEnvironmentNames(L"=C:", 3, L"A", 1) < 0);
+}
+
+NSUDO_TEST_CASE(Environment, SerializeBlock)
+{
+    Mile::EnvironmentBlock Block;
+    Block.Parse(TestBlock);
+
+    std::vector<wchar_t> Result;
+    Mile::SerializeEnvironmentBlock(Block, nullptr, Result);
+    NSUDO_TEST_CHECK(Dump(Result) ==
+        L"=C:=C:\\x|ALLUSERSPROFILE=C:\\ProgramData|EMPTY=|"
+        L"Path=C:\\Windows|USERNAME=bob|windir=C:\\Windows||");
+
+    const Mile::EnvironmentVariable* Variable = Block.Find(L"PATH", 4);
+    NSUDO_TEST_REQUIRE(Variable);
+    NSUDO_TEST_CHECK(
+        std::wstring(Variable->Value, Variable->ValueLength) ==
+        L"C:\\Windows");
+    NSUDO_TEST_CHECK(!Block.Find(L"bogus", 5));
+
+    Mile::EnvironmentBlock Empty;
+    Empty.Parse(nullptr);
+    Mile::SerializeEnvironmentBlock(Empty, nullptr, Result);
+    NSUDO_TEST_CHECK(Result.size() == 2 && !Result[0] && !Result[1]);
+}
+
+NSUDO_TEST_CASE(Environment, Overlay)
+{
+    Mile::EnvironmentBlock Block;
+    Block.Parse(TestBlock);
+
+    Mile::EnvironmentOverlay Overlay;
+    Overlay.Parse(L"FOO=bar\0USERNAME\0path=P2\0Zed=\0");
+
+    std::vector<wchar_t> Result;
+    Mile::SerializeEnvironmentBlock(Block, &Overlay, Result);
+    NSUDO_TEST_CHECK(Dump(Result) ==
+        L"=C:=C:\\x|ALLUSERSPROFILE=C:\\ProgramData|EMPTY=|FOO=bar|"
+        L"path=P2|windir=C:\\Windows|Zed=||");
+
+    NSUDO_TEST_CHECK(!Mile::FindEnvironmentVariable(
+        Block, &Overlay, L"username", 8));
+    NSUDO_TEST_CHECK(Mile::FindEnvironmentVariable(
+        Block, nullptr, L"username", 8));
+
+    const Mile::EnvironmentVariable* Removed = Overlay.Find(L"USERNAME", 8);
+    NSUDO_TEST_REQUIRE(Removed);
+    NSUDO_TEST_CHECK(!Removed->Value);
+
+    std::wstring Expanded;
+    Mile::ExpandEnvironmentReferences(
+        Block,
+        &Overlay,
+        L"%windir%\\system32\\cmd.exe /c %FOO% %USERNAME% %%path%%",
+        Expanded);
+    NSUDO_TEST_CHECK(Expanded ==
+        L"C:\\Windows\\system32\\cmd.exe /c bar %USERNAME% %P2%");
+}
+
+NSUDO_TEST_CASE(Environment, SnapshotExpand)
+{
+    Mile::EnvironmentSnapshot Snapshot;
+    Snapshot.Assign(TestBlock);
+
+    std::size_t Unresolved = 0;
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%windir%\\cmd.exe", &Unresolved) ==
+        L"C:\\Windows\\cmd.exe");
+    NSUDO_TEST_CHECK(Unresolved == 0);
+
+    // The % which ends an undefined reference starts the next one.
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%NOPE%PATH%x", &Unresolved) ==
+        L"%NOPEC:\\Windowsx");
+    NSUDO_TEST_CHECK(Unresolved == 1);
+
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"100%%") == L"100%%");
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"a%b") == L"a%b");
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%%path%%") == L"%C:\\Windows%");
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%empty%!") == L"!");
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%=C:%") == L"C:\\x");
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"%A%%B%", &Unresolved) == L"%A%%B%");
+    NSUDO_TEST_CHECK(Unresolved == 2);
+    NSUDO_TEST_CHECK(Expand(Snapshot, L"") == L"");
+
+    Mile::EnvironmentExpansionBuffer Buffer;
+    std::vector<Mile::EnvironmentReference> References;
+    Snapshot.Expand(L"x%AB%y", 6, Buffer, &References);
+    NSUDO_TEST_REQUIRE(References.size() == 1);
+    NSUDO_TEST_CHECK(References[0].Offset == 2);
+    NSUDO_TEST_CHECK(References[0].Length == 2);
+
+    // The buffer grows past the characters stored in itself.
+    std::wstring Long(1000, L'x');
+    Long += L"%windir%";
+    Snapshot.Expand(Long.c_str(), Long.size(), Buffer, nullptr);
+    NSUDO_TEST_CHECK(Buffer.GetSize() == 1010);
+    NSUDO_TEST_CHECK(std::wcslen(Buffer.GetData()) == 1010);
+}
+
+NSUDO_TEST_CASE(Environment, SnapshotOverlay)
+{
+    Mile::EnvironmentBlock Block;
+    Block.Parse(TestBlock);
+
+    Mile::EnvironmentOverlay Overlay;
+    Overlay.Parse(L"USERNAME\0FOO=bar\0");
+
+    Mile::EnvironmentSnapshot Snapshot;
+    Snapshot.Assign(Block, &Overlay);
+
+    NSUDO_TEST_CHECK(!Snapshot.Find(L"username", 8));
+    NSUDO_TEST_CHECK(Snapshot.Find(L"foo", 3));
+
+    const Mile::EnvironmentVariable* Path = Snapshot.Find(L"PATH", 4);
+    NSUDO_TEST_REQUIRE(Path);
+    NSUDO_TEST_CHECK(
+        std::wstring(Path->Value, Path->ValueLength) == L"C:\\Windows");
+}
+
+NSUDO_TEST_CASE(Environment, SnapshotConcurrentExpand)
+{
+    std::wstring Block;
+    for (int i = 0; i < 200; ++i)
+    {
+        Block += L"VARIABLE_" + std::to_wstring(i) + L"=" +
+            std::to_wstring(i * 7);
+        Block.push_back(L'\0');
+    }
+    Block.push_back(L'\0');
+
+    Mile::EnvironmentSnapshot Snapshot;
+    Snapshot.Assign(Block.c_str());
+
+    std::wstring Source;
+    std::wstring Expected;
+    for (int i = 0; i < 1000; ++i)
+    {
+        int Index = i * 37 % 200;
+        Source += L"%VARIABLE_" + std::to_wstring(Index) + L"%;";
+        Expected += std::to_wstring(Index * 7) + L";";
+    }
+
+    // The snapshot is read-only after it is built.
+    std::vector<std::thread> Threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        Threads.emplace_back([&]()
+        {
+            Mile::EnvironmentExpansionBuffer Buffer;
+            for (int j = 0; j < 50; ++j)
+            {
+                bool Resolved = Snapshot.Expand(
+                    Source.c_str(),
+                    Source.size(),
+                    Buffer,
+                    nullptr);
+                NSUDO_TEST_CHECK(Resolved);
+                NSUDO_TEST_CHECK(Expected == Buffer.GetData());
+            }
+        });
+    }
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+}
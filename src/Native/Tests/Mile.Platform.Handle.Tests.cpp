@@ -0,0 +1,194 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Handle.Tests.cpp
+ * PURPOSE:   Tests for the Handle Wrappers and the Handle Accounting
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.Handle.h>
+
+#include <cstdlib>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    std::size_t g_ClosedCount = 0;
+
+    /**
+     * The handles are integers, closing them only counts the calls.
+     */
+    struct CountingTraits
+    {
+        typedef int ValueType;
+
+        static constexpr Mile::HandleKind Kind = Mile::HandleKind::Token;
+
+        static int InvalidValue() noexcept
+        {
+            return -1;
+        }
+
+        static bool IsValid(
+            int Value) noexcept
+        {
+            return Value >= 0;
+        }
+
+        static void Close(
+            int) noexcept
+        {
+            ++g_ClosedCount;
+        }
+    };
+
+    struct HeapBlockTraits
+    {
+        typedef void* ValueType;
+
+        static constexpr Mile::HandleKind Kind = Mile::HandleKind::HeapBlock;
+
+        static void* InvalidValue() noexcept
+        {
+            return nullptr;
+        }
+
+        static bool IsValid(
+            void* Value) noexcept
+        {
+            return Value != nullptr;
+        }
+
+        static void Close(
+            void* Value) noexcept
+        {
+            std::free(Value);
+        }
+    };
+
+    typedef Mile::UniqueHandle<CountingTraits> CountingHandle;
+    typedef Mile::UniqueHandle<HeapBlockTraits> HeapBlockHandle;
+
+    bool OpenCountingHandle(
+        int Value,
+        int* Handle)
+    {
+        *Handle = Value;
+        return true;
+    }
+
+    std::intptr_t GetLiveCount(
+        Mile::HandleKind Kind)
+    {
+        return Mile::QueryHandleStatistics(Kind).LiveCount;
+    }
+}
+
+NSUDO_TEST_CASE(Handle, Layout)
+{
+    // The wrappers are as small as the handles and can only be moved.
+    NSUDO_TEST_CHECK(sizeof(CountingHandle) == sizeof(int));
+    NSUDO_TEST_CHECK(sizeof(HeapBlockHandle) == sizeof(void*));
+    NSUDO_TEST_CHECK(!std::is_copy_constructible<CountingHandle>::value);
+    NSUDO_TEST_CHECK(!std::is_copy_assignable<CountingHandle>::value);
+    NSUDO_TEST_CHECK(
+        std::is_nothrow_move_constructible<CountingHandle>::value);
+    NSUDO_TEST_CHECK(std::is_nothrow_move_assignable<CountingHandle>::value);
+}
+
+NSUDO_TEST_CASE(Handle, Ownership)
+{
+    const Mile::HandleKind Kind = CountingTraits::Kind;
+
+    g_ClosedCount = 0;
+    std::uint64_t OpenedCount = Mile::QueryHandleStatistics(Kind).OpenedCount;
+
+    {
+        CountingHandle First(3);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+
+        CountingHandle Second(std::move(First));
+        NSUDO_TEST_CHECK(!First);
+        NSUDO_TEST_CHECK(Second && Second.Get() == 3);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+
+        CountingHandle Third;
+        NSUDO_TEST_CHECK(!Third);
+        Third = std::move(Second);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+        NSUDO_TEST_CHECK(g_ClosedCount == 0);
+
+        Third.Reset(4);
+        NSUDO_TEST_CHECK(g_ClosedCount == 1);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+
+        int Value = Third.Detach();
+        NSUDO_TEST_CHECK(Value == 4 && !Third);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 0);
+
+        CountingHandle Fourth(Value);
+
+        // The previous handle is closed before the new one is received.
+        NSUDO_TEST_CHECK(OpenCountingHandle(7, Fourth.Put()));
+        NSUDO_TEST_CHECK(g_ClosedCount == 2);
+        NSUDO_TEST_CHECK(Fourth.Get() == 7);
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+
+        // Nothing is counted if nothing is received.
+        CountingHandle Fifth;
+        Fifth.Put();
+        NSUDO_TEST_CHECK(GetLiveCount(Kind) == 1);
+
+        CountingHandle& Self = Fourth;
+        Fourth = std::move(Self);
+        NSUDO_TEST_CHECK(Fourth.Get() == 7);
+    }
+
+    NSUDO_TEST_CHECK(g_ClosedCount == 3);
+    NSUDO_TEST_CHECK(GetLiveCount(Kind) == 0);
+    NSUDO_TEST_CHECK(
+        Mile::QueryHandleStatistics(Kind).OpenedCount == OpenedCount + 4);
+}
+
+NSUDO_TEST_CASE(Handle, ConcurrentAccounting)
+{
+    const Mile::HandleKind Kind = HeapBlockTraits::Kind;
+    const std::size_t ThreadCount = 8;
+    const std::size_t BlockCount = 100000;
+
+    std::uint64_t OpenedCount = Mile::QueryHandleStatistics(Kind).OpenedCount;
+
+    std::vector<std::thread> Threads;
+    for (std::size_t i = 0; i < ThreadCount; ++i)
+    {
+        Threads.emplace_back([]()
+        {
+            for (std::size_t j = 0; j < BlockCount; ++j)
+            {
+                HeapBlockHandle Block(std::malloc(8));
+                HeapBlockHandle Moved(std::move(Block));
+            }
+        });
+    }
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+
+    NSUDO_TEST_CHECK(GetLiveCount(Kind) == 0);
+    NSUDO_TEST_CHECK(
+        Mile::QueryHandleStatistics(Kind).OpenedCount ==
+        OpenedCount + ThreadCount * BlockCount);
+
+    // The kinds out of range have no counters.
+    Mile::HandleStatistics Statistics =
+        Mile::QueryHandleStatistics(Mile::HandleKind::MaximumValue);
+    NSUDO_TEST_CHECK(!Statistics.LiveCount && !Statistics.OpenedCount);
+}
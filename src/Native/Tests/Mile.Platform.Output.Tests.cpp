@@ -0,0 +1,206 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Output.Tests.cpp
+ * PURPOSE:   Tests for the Buffered Output Sink
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.Output.h>
+
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+
+#include <csignal>
+#include <unistd.h>
+
+namespace
+{
+    /**
+     * Runs a function with the write end of a pipe and collects the bytes
+     * written to it.
+     */
+    template <typename FunctionType>
+    std::string Capture(
+        FunctionType&& Function)
+    {
+        std::string Result;
+
+        int Pipe[2];
+        if (::pipe(Pipe) != 0)
+        {
+            NSUDO_TEST_CHECK(!"pipe failed");
+            return Result;
+        }
+
+        std::thread Reader([&]()
+        {
+            char Buffer[1000];
+            ssize_t Size = 0;
+            while ((Size = ::read(Pipe[0], Buffer, sizeof(Buffer))) > 0)
+            {
+                Result.append(Buffer, static_cast<std::size_t>(Size));
+            }
+        });
+
+        Function(Pipe[1]);
+        ::close(Pipe[1]);
+        Reader.join();
+        ::close(Pipe[0]);
+
+        return Result;
+    }
+
+    /**
+     * The UTF-8 form of the wide text "é\U0001F600z".
+     */
+    const char WideUnitsUtf8[] = "\xC3\xA9\xF0\x9F\x98\x80z";
+}
+
+NSUDO_TEST_CASE(Output, Segments)
+{
+    std::string Result = Capture([](int Handle)
+    {
+        Mile::OutputSink Sink(Handle);
+        NSUDO_TEST_CHECK(!Sink.IsConsole());
+
+        std::wstring Logo = L"Logo\r\n";
+        NSUDO_TEST_CHECK(Sink.Write(
+        {
+            Logo,
+            L"中文 ",
+            std::string_view("links\xF0\x9F\x98\x80"),
+            "!"
+        }));
+    });
+
+    NSUDO_TEST_CHECK(Result ==
+        "Logo\r\n\xE4\xB8\xAD\xE6\x96\x87 links\xF0\x9F\x98\x80!");
+}
+
+NSUDO_TEST_CASE(Output, Surrogates)
+{
+    std::string Result = Capture([](int Handle)
+    {
+        const wchar_t High[] = { static_cast<wchar_t>(0xD83D), 0 };
+        const wchar_t Low[] = { static_cast<wchar_t>(0xDE00), 0 };
+
+        Mile::OutputSink Sink(Handle);
+
+        // A pair which is split across the segments and a flush.
+        Sink.Write(High);
+        Sink.Flush();
+        Sink.Write(Low);
+
+        // A lone low surrogate, and a lone high surrogate before UTF-8.
+        Sink.Write(Low);
+        Sink.Write(High);
+        Sink.Write("x");
+
+        // A high surrogate which is left when the sink is destroyed.
+        Sink.Write(High);
+    });
+
+    NSUDO_TEST_CHECK(Result ==
+        "\xF0\x9F\x98\x80"
+        "\xEF\xBF\xBD"
+        "\xEF\xBF\xBD"
+        "x"
+        "\xEF\xBF\xBD");
+}
+
+NSUDO_TEST_CASE(Output, LargeSegments)
+{
+    std::string Utf8;
+    std::wstring Wide;
+    std::string WideAsUtf8;
+    for (int i = 0; i < 20000; ++i)
+    {
+        Utf8 += "ab\xC3\xA9";
+        Wide += L"é\U0001F600z";
+        WideAsUtf8 += WideUnitsUtf8;
+    }
+
+    std::string Result = Capture([&](int Handle)
+    {
+        Mile::OutputSink Sink(Handle);
+        NSUDO_TEST_CHECK(Sink.Write(Utf8));
+        NSUDO_TEST_CHECK(Sink.Write(Wide));
+        NSUDO_TEST_CHECK(Sink.Write("end"));
+    });
+    NSUDO_TEST_CHECK(Result == Utf8 + WideAsUtf8 + "end");
+
+    // The segments of random sizes cross the buffer boundaries.
+    std::mt19937 Random(1);
+    std::vector<std::pair<bool, std::size_t>> Operations;
+    for (int Round = 0; Round < 200; ++Round)
+    {
+        Operations.clear();
+        std::string Expected;
+        for (int i = 0; i < 20; ++i)
+        {
+            bool IsWide = Random() & 1;
+            std::size_t Count = Random() % 9000;
+            Operations.emplace_back(IsWide, Count);
+
+            for (std::size_t j = 0; IsWide && j < Count; ++j)
+            {
+                Expected += WideUnitsUtf8;
+            }
+            if (!IsWide)
+            {
+                Expected += Utf8.substr(0, Count * 4);
+            }
+        }
+
+        Result = Capture([&](int Handle)
+        {
+            Mile::OutputSink Sink(Handle);
+            for (const std::pair<bool, std::size_t>& Operation : Operations)
+            {
+                if (Operation.first)
+                {
+                    Sink.Write(std::wstring_view(Wide).substr(
+                        0,
+                        Operation.second * (Wide.size() / 20000)));
+                }
+                else
+                {
+                    Sink.Write(std::string_view(Utf8).substr(
+                        0,
+                        Operation.second * 4));
+                }
+            }
+        });
+        NSUDO_TEST_CHECK(Result == Expected);
+    }
+}
+
+NSUDO_TEST_CASE(Output, ClosedPipe)
+{
+    // The write fails with EPIPE instead of raising SIGPIPE.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int Pipe[2];
+    NSUDO_TEST_REQUIRE(::pipe(Pipe) == 0);
+    ::close(Pipe[0]);
+
+    std::string Text(100000, 'x');
+    {
+        Mile::OutputSink Sink(Pipe[1]);
+        NSUDO_TEST_CHECK(!Sink.Write(Text));
+    }
+
+    ::close(Pipe[1]);
+}
+
+#endif
@@ -0,0 +1,163 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Resource.Tests.cpp
+ * PURPOSE:   Tests for the Resource Views and the Resource Index
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.Resource.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /**
+     * The text "a", U+4E2D, "b" and U+1F600 in UTF-8, whose characters are
+     * 1, 3, 1 and 4 bytes long.
+     */
+    const std::string MixedText = "a\xE4\xB8\xAD" "b\xF0\x9F\x98\x80";
+
+#if defined(__linux__)
+    void WriteFile(
+        const std::filesystem::path& Path,
+        const std::string& Content)
+    {
+        std::ofstream File(Path, std::ios::binary);
+        File.write(Content.data(), Content.size());
+    }
+#endif
+}
+
+NSUDO_TEST_CASE(Resource, ByteOrderMarks)
+{
+    Mile::ResourceView View = Mile::MakeResourceView(nullptr, 0);
+    NSUDO_TEST_CHECK(View.Content.empty());
+    NSUDO_TEST_CHECK(View.Encoding == Mile::TextEncoding::Unknown);
+
+    View = Mile::MakeResourceView("\xEF\xBB\xBFhello", 8);
+    NSUDO_TEST_CHECK(View.Content == "hello");
+    NSUDO_TEST_CHECK(View.Encoding == Mile::TextEncoding::Utf8);
+
+    View = Mile::MakeResourceView("\xFF\xFE" "A\0", 4);
+    NSUDO_TEST_CHECK(View.Content.size() == 2);
+    NSUDO_TEST_CHECK(View.Encoding == Mile::TextEncoding::Utf16LittleEndian);
+
+    View = Mile::MakeResourceView("\xFE\xFF\0A", 4);
+    NSUDO_TEST_CHECK(View.Content.size() == 2);
+    NSUDO_TEST_CHECK(View.Encoding == Mile::TextEncoding::Utf16BigEndian);
+
+    // A partial byte order mark is a part of the content.
+    View = Mile::MakeResourceView("\xEF\xBB", 2);
+    NSUDO_TEST_CHECK(View.Content.size() == 2);
+    NSUDO_TEST_CHECK(View.Encoding == Mile::TextEncoding::Unknown);
+}
+
+NSUDO_TEST_CASE(Resource, Utf8ChunkLength)
+{
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 100) == 9);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 1) == 1);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 2) == 1);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 3) == 1);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 4) == 4);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 6) == 5);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength(MixedText, 8) == 5);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength("", 0) == 0);
+
+    // The invalid sequences are split at the limit.
+    NSUDO_TEST_CHECK(
+        Mile::GetUtf8ChunkLength("\x80\x80\x80\x80\x80\x80", 5) == 5);
+    NSUDO_TEST_CHECK(Mile::GetUtf8ChunkLength("\xF0\x9F\x98\x80", 2) == 2);
+
+    std::string Text;
+    for (int i = 0; i < 1000; ++i)
+    {
+        Text += MixedText;
+    }
+
+    for (std::size_t Limit = 1; Limit < 20; ++Limit)
+    {
+        std::string_view Remaining = Text;
+        std::string Result;
+        bool Valid = true;
+        while (!Remaining.empty() && Valid)
+        {
+            std::size_t Length = Mile::GetUtf8ChunkLength(Remaining, Limit);
+            Valid = Length && Length <= Limit;
+
+            // A chunk only splits a character if the limit is shorter.
+            if (Limit >= 4 && Length < Remaining.size())
+            {
+                Valid = Valid &&
+                    (static_cast<unsigned char>(Remaining[Length]) & 0xC0)
+                    != 0x80;
+            }
+
+            Result.append(Remaining.substr(0, Length));
+            Remaining.remove_prefix(Length);
+        }
+        NSUDO_TEST_CHECK(Valid);
+        NSUDO_TEST_CHECK(Result == Text);
+    }
+}
+
+#if defined(__linux__)
+
+NSUDO_TEST_CASE(Resource, IndexDirectory)
+{
+    std::filesystem::path Directory =
+        std::filesystem::temp_directory_path() /
+        ("NSudoTests.Resource." + std::to_string(::getpid()));
+    std::filesystem::create_directories(Directory);
+
+    WriteFile(Directory / "2002", "\xEF\xBB\xBFhello");
+    WriteFile(Directory / "2003", "plain");
+    WriteFile(Directory / "7", std::string("\xFF\xFE" "A\0", 4));
+
+    // The empty files and the names which are not identifiers are skipped.
+    WriteFile(Directory / "9", "");
+    WriteFile(Directory / "abc", "xx");
+    WriteFile(Directory / "4294967296", "xx");
+
+    {
+        Mile::ResourceIndex Index;
+        NSUDO_TEST_CHECK(Index.Load(Directory.c_str()));
+        NSUDO_TEST_CHECK(Index.GetSize() == 3);
+
+        const Mile::ResourceView* View = Index.Find(2002);
+        NSUDO_TEST_CHECK(View && View->Content == "hello");
+        NSUDO_TEST_CHECK(View && View->Encoding == Mile::TextEncoding::Utf8);
+
+        View = Index.Find(2003);
+        NSUDO_TEST_CHECK(View && View->Content == "plain");
+        NSUDO_TEST_CHECK(
+            View && View->Encoding == Mile::TextEncoding::Unknown);
+
+        View = Index.Find(7);
+        NSUDO_TEST_CHECK(View && View->Content.size() == 2);
+        NSUDO_TEST_CHECK(
+            View &&
+            View->Encoding == Mile::TextEncoding::Utf16LittleEndian);
+
+        NSUDO_TEST_CHECK(!Index.Find(9));
+        NSUDO_TEST_CHECK(!Index.Find(1));
+    }
+
+    std::filesystem::remove_all(Directory);
+
+    Mile::ResourceIndex Missing;
+    NSUDO_TEST_CHECK(!Missing.Load(Directory.c_str()));
+    NSUDO_TEST_CHECK(Missing.GetSize() == 0);
+}
+
+#endif
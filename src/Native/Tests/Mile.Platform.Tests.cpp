@@ -0,0 +1,197 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Tests.cpp
+ * PURPOSE:   Tests for the Portable Synchronization Primitives
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * Runs a function on several threads and waits for all of them.
+     */
+    template <typename FunctionType>
+    void RunThreads(
+        std::size_t ThreadCount,
+        FunctionType Function)
+    {
+        std::vector<std::thread> Threads;
+        for (std::size_t i = 0; i < ThreadCount; ++i)
+        {
+            Threads.emplace_back(Function, i);
+        }
+
+        for (std::thread& Thread : Threads)
+        {
+            Thread.join();
+        }
+    }
+}
+
+NSUDO_TEST_CASE(SyncPrimitives, AddressWait)
+{
+    std::atomic<std::uint32_t> Value(0);
+
+    // The wait returns at once if the value is not the expected value.
+    Mile::AddressWait::Wait(Value, 1);
+
+    std::thread Waker([&Value]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        Value.store(1);
+        Mile::AddressWait::WakeAll(Value);
+    });
+
+    while (Value.load() == 0)
+    {
+        Mile::AddressWait::Wait(Value, 0);
+    }
+
+    Waker.join();
+    NSUDO_TEST_CHECK(Value.load() == 1);
+}
+
+NSUDO_TEST_CASE(SyncPrimitives, Mutex)
+{
+    const std::size_t ThreadCount = 8;
+    const std::size_t Iterations = 50000;
+
+    Mile::Mutex Lock;
+    std::size_t Counter = 0;
+
+    RunThreads(ThreadCount, [&](std::size_t)
+    {
+        for (std::size_t i = 0; i < Iterations; ++i)
+        {
+            Mile::AutoMutexLock Guard(Lock);
+            ++Counter;
+        }
+    });
+
+    NSUDO_TEST_CHECK(Counter == ThreadCount * Iterations);
+
+    NSUDO_TEST_CHECK(Lock.TryLock());
+    {
+        Mile::AutoMutexTryLock Guard(Lock);
+        NSUDO_TEST_CHECK(!Guard.IsLocked());
+    }
+    Lock.Unlock();
+    {
+        Mile::AutoMutexTryLock Guard(Lock);
+        NSUDO_TEST_CHECK(Guard.IsLocked());
+    }
+}
+
+NSUDO_TEST_CASE(SyncPrimitives, ReaderWriterLock)
+{
+    const std::size_t ThreadCount = 8;
+    const std::size_t Iterations = 20000;
+
+    Mile::ReaderWriterLock Lock;
+    std::size_t Writes = 0;
+    std::atomic<std::size_t> Readers(0);
+    std::atomic<std::size_t> Violations(0);
+
+    RunThreads(ThreadCount, [&](std::size_t Index)
+    {
+        for (std::size_t i = 0; i < Iterations; ++i)
+        {
+            if ((i + Index) % 8 == 0)
+            {
+                Mile::AutoExclusiveLock Guard(Lock);
+                if (Readers.load())
+                {
+                    ++Violations;
+                }
+                ++Writes;
+            }
+            else
+            {
+                Mile::AutoSharedLock Guard(Lock);
+                ++Readers;
+                volatile std::size_t Snapshot = Writes;
+                (void)Snapshot;
+                --Readers;
+            }
+        }
+    });
+
+    NSUDO_TEST_CHECK(Violations.load() == 0);
+    NSUDO_TEST_CHECK(Writes == ThreadCount * Iterations / 8);
+
+    // The shared owners exclude the exclusive owner but not each other.
+    NSUDO_TEST_REQUIRE(Lock.TryLockShared());
+    NSUDO_TEST_CHECK(Lock.TryLockShared());
+    NSUDO_TEST_CHECK(!Lock.TryLockExclusive());
+    Lock.UnlockShared();
+    Lock.UnlockShared();
+
+    NSUDO_TEST_REQUIRE(Lock.TryLockExclusive());
+    NSUDO_TEST_CHECK(!Lock.TryLockShared());
+    NSUDO_TEST_CHECK(!Lock.TryLockExclusive());
+    Lock.UnlockExclusive();
+}
+
+NSUDO_TEST_CASE(SyncPrimitives, Event)
+{
+    Mile::Event Event;
+    std::atomic<std::size_t> Released(0);
+
+    NSUDO_TEST_CHECK(!Event.IsSet());
+
+    std::thread Setter([&]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        NSUDO_TEST_CHECK(Released.load() == 0);
+        Event.Set();
+    });
+
+    RunThreads(4, [&](std::size_t)
+    {
+        Event.Wait();
+        ++Released;
+    });
+
+    Setter.join();
+    NSUDO_TEST_CHECK(Released.load() == 4);
+    NSUDO_TEST_CHECK(Event.IsSet());
+
+    // The event stays set.
+    Event.Wait();
+}
+
+NSUDO_TEST_CASE(SyncPrimitives, CallOnce)
+{
+    Mile::OnceFlag Flag;
+    std::atomic<std::size_t> Calls(0);
+    std::atomic<std::size_t> Completed(0);
+
+    RunThreads(8, [&](std::size_t)
+    {
+        Mile::CallOnce(Flag, [&]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ++Calls;
+        });
+
+        // The callers return after the call is complete.
+        if (Calls.load() == 1)
+        {
+            ++Completed;
+        }
+    });
+
+    NSUDO_TEST_CHECK(Calls.load() == 1);
+    NSUDO_TEST_CHECK(Completed.load() == 8);
+}
@@ -0,0 +1,162 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.ThreadPool.Tests.cpp
+ * PURPOSE:   Tests for the Work-Stealing Thread Pool
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+NSUDO_TEST_CASE(ThreadPool, ParallelFor)
+{
+    const std::size_t Count = 100000;
+
+    Mile::ThreadPool Pool(4);
+    NSUDO_TEST_CHECK(Pool.GetWorkerCount() == 4);
+
+    std::unique_ptr<std::atomic<std::uint32_t>[]> Visits(
+        new std::atomic<std::uint32_t>[Count]);
+    for (std::size_t i = 0; i < Count; ++i)
+    {
+        Visits[i].store(0);
+    }
+
+    Pool.ParallelFor(0, Count, 64, [&](std::size_t Begin, std::size_t End)
+    {
+        NSUDO_TEST_CHECK(End - Begin <= 64);
+        for (std::size_t i = Begin; i < End; ++i)
+        {
+            ++Visits[i];
+        }
+    });
+
+    bool VisitedOnce = true;
+    for (std::size_t i = 0; i < Count; ++i)
+    {
+        VisitedOnce = VisitedOnce && Visits[i].load() == 1;
+    }
+    NSUDO_TEST_CHECK(VisitedOnce);
+
+    // The empty ranges do not call the function.
+    bool Called = false;
+    Pool.ParallelFor(5, 5, 1, [&](std::size_t, std::size_t)
+    {
+        Called = true;
+    });
+    NSUDO_TEST_CHECK(!Called);
+}
+
+NSUDO_TEST_CASE(ThreadPool, NestedTasks)
+{
+    // A single worker has to run the nested tasks while its task waits.
+    Mile::ThreadPool Pool(1);
+    std::atomic<std::size_t> Completed(0);
+
+    Mile::TaskGroup Outer(Pool);
+    for (std::size_t i = 0; i < 8; ++i)
+    {
+        Outer.Run([&Pool, &Completed]()
+        {
+            Mile::TaskGroup Inner(Pool);
+            for (std::size_t j = 0; j < 16; ++j)
+            {
+                Inner.Run([&Completed]()
+                {
+                    ++Completed;
+                });
+            }
+            Inner.Wait();
+
+            Pool.ParallelFor(0, 64, 1, [&](std::size_t, std::size_t)
+            {
+                ++Completed;
+            });
+        });
+    }
+    Outer.Wait();
+
+    NSUDO_TEST_CHECK(Completed.load() == 8 * (16 + 64));
+
+    // The group can be reused after it is waited.
+    Outer.Run([&Completed]()
+    {
+        ++Completed;
+    });
+    Outer.Wait();
+    NSUDO_TEST_CHECK(Completed.load() == 8 * (16 + 64) + 1);
+}
+
+NSUDO_TEST_CASE(ThreadPool, WaitFor)
+{
+    Mile::ThreadPool Pool(2);
+    Mile::TaskGroup Group(Pool);
+
+    NSUDO_TEST_CHECK(Group.WaitFor(0));
+
+    std::atomic<std::uint32_t> Release(0);
+    Group.Run([&Release]()
+    {
+        while (!Release.load())
+        {
+            Mile::AddressWait::Wait(Release, 0);
+        }
+    });
+
+    // The caller is not a worker, so it does not run the blocked task.
+    std::chrono::steady_clock::time_point Start =
+        std::chrono::steady_clock::now();
+    NSUDO_TEST_CHECK(!Group.WaitFor(20));
+    NSUDO_TEST_CHECK(
+        std::chrono::steady_clock::now() - Start >=
+        std::chrono::milliseconds(20));
+
+    Release.store(1);
+    Mile::AddressWait::WakeAll(Release);
+
+    std::size_t Rounds = 0;
+    while (!Group.WaitFor(10))
+    {
+        ++Rounds;
+    }
+    NSUDO_TEST_CHECK(Rounds < 1000);
+}
+
+NSUDO_TEST_CASE(ThreadPool, WaitForOnWorkers)
+{
+    Mile::ThreadPool Pool(1);
+    std::atomic<bool> Completed(false);
+
+    // The only worker waits for the nested tasks, so it has to run them.
+    Mile::TaskGroup Outer(Pool);
+    Outer.Run([&Pool, &Completed]()
+    {
+        Mile::TaskGroup Inner(Pool);
+        std::atomic<std::size_t> Count(0);
+        for (std::size_t i = 0; i < 32; ++i)
+        {
+            Inner.Run([&Count]()
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                ++Count;
+            });
+        }
+
+        while (!Inner.WaitFor(1))
+        {
+        }
+
+        Completed = Count.load() == 32;
+    });
+    Outer.Wait();
+
+    NSUDO_TEST_CHECK(Completed.load());
+}
@@ -0,0 +1,207 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      Mile.Platform.Trace.Tests.cpp
+ * PURPOSE:   Tests for the Per-Thread Trace Ring Buffers
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <Mile.Platform.Trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cwchar>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * Creates an event whose fields are derived from its start time, so a
+     * torn copy can be detected.
+     */
+    Mile::TraceEvent MakeEvent(
+        std::uint32_t Activity,
+        std::uint64_t StartTime)
+    {
+        Mile::TraceEvent Event;
+        Event.StartTime = StartTime;
+        Event.Duration = StartTime * 3;
+        Event.Activity = Activity;
+        Event.Stage = static_cast<std::uint32_t>(StartTime % 13);
+        Event.Result = -static_cast<std::int32_t>(StartTime % 1000);
+        Event.HandleCount = static_cast<std::uint32_t>(StartTime & 0xFFFF);
+        return Event;
+    }
+
+    bool IsConsistent(
+        const Mile::TraceEvent& Event)
+    {
+        Mile::TraceEvent Expected = MakeEvent(Event.Activity, Event.StartTime);
+        return Event.Duration == Expected.Duration &&
+            Event.Stage == Expected.Stage &&
+            Event.Result == Expected.Result &&
+            Event.HandleCount == Expected.HandleCount;
+    }
+}
+
+NSUDO_TEST_CASE(Trace, Activities)
+{
+    std::uint32_t First = Mile::CreateTraceActivity();
+    std::uint32_t Second = Mile::CreateTraceActivity();
+    NSUDO_TEST_CHECK(First && Second && First != Second);
+
+    NSUDO_TEST_CHECK(
+        Mile::GetTraceTimestamp() <= Mile::GetTraceTimestamp());
+
+    Mile::WriteTraceEvent(MakeEvent(First, 20));
+    Mile::WriteTraceEvent(MakeEvent(Second, 15));
+    Mile::WriteTraceEvent(MakeEvent(First, 10));
+
+    Mile::TraceEvent Events[4];
+    NSUDO_TEST_REQUIRE(Mile::ReadTraceEvents(First, Events, 4) == 2);
+    NSUDO_TEST_CHECK(Events[0].StartTime == 10);
+    NSUDO_TEST_CHECK(Events[1].StartTime == 20);
+    NSUDO_TEST_CHECK(IsConsistent(Events[0]) && IsConsistent(Events[1]));
+
+    // The number of the events is returned even if the buffer is too small.
+    NSUDO_TEST_CHECK(Mile::ReadTraceEvents(First, nullptr, 0) == 2);
+    NSUDO_TEST_CHECK(Mile::ReadTraceEvents(Second, Events, 1) == 1);
+    NSUDO_TEST_CHECK(Events[0].StartTime == 15);
+}
+
+NSUDO_TEST_CASE(Trace, RingCapacity)
+{
+    std::uint32_t Activity = Mile::CreateTraceActivity();
+
+    for (std::uint64_t i = 1; i <= 1000; ++i)
+    {
+        Mile::WriteTraceEvent(MakeEvent(Activity, i));
+    }
+
+    // Only the latest 256 events are kept.
+    std::vector<Mile::TraceEvent> Events(300);
+    NSUDO_TEST_REQUIRE(
+        Mile::ReadTraceEvents(Activity, Events.data(), Events.size()) == 256);
+    NSUDO_TEST_CHECK(Events[0].StartTime == 1000 - 255);
+    NSUDO_TEST_CHECK(Events[255].StartTime == 1000);
+}
+
+NSUDO_TEST_CASE(Trace, ConcurrentWriters)
+{
+    const std::size_t WriterCount = 8;
+    const std::uint64_t EventCount = 20000;
+
+    std::vector<std::uint32_t> Activities(WriterCount);
+    for (std::uint32_t& Activity : Activities)
+    {
+        Activity = Mile::CreateTraceActivity();
+    }
+
+    std::atomic<bool> Done(false);
+    std::atomic<std::size_t> Finished(0);
+
+    // The reader copies the ring buffers while the writers overwrite them,
+    // the torn copies should be dropped.
+    std::thread Reader([&]()
+    {
+        std::vector<Mile::TraceEvent> Events(WriterCount * 256);
+        while (!Done.load())
+        {
+            std::size_t Count = std::min(
+                Mile::ReadTraceEvents(0, Events.data(), Events.size()),
+                Events.size());
+            for (std::size_t i = 0; i < Count; ++i)
+            {
+                if (std::find(
+                    Activities.begin(),
+                    Activities.end(),
+                    Events[i].Activity) != Activities.end())
+                {
+                    NSUDO_TEST_CHECK(IsConsistent(Events[i]));
+                }
+                if (i)
+                {
+                    NSUDO_TEST_CHECK(
+                        Events[i - 1].StartTime <= Events[i].StartTime);
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> Writers;
+    for (std::size_t i = 0; i < WriterCount; ++i)
+    {
+        Writers.emplace_back([&, i]()
+        {
+            for (std::uint64_t j = 1; j <= EventCount; ++j)
+            {
+                Mile::WriteTraceEvent(
+                    MakeEvent(Activities[i], i * 1000000 + j));
+            }
+
+            // The ring buffers are reused after the threads exit, so all
+            // writers keep theirs until the last one is done.
+            ++Finished;
+            while (Finished.load() < WriterCount)
+            {
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (std::thread& Writer : Writers)
+    {
+        Writer.join();
+    }
+
+    Done = true;
+    Reader.join();
+
+    for (std::size_t i = 0; i < WriterCount; ++i)
+    {
+        Mile::TraceEvent Events[300];
+        std::size_t Count = Mile::ReadTraceEvents(Activities[i], Events, 300);
+        NSUDO_TEST_REQUIRE(Count == 256);
+        NSUDO_TEST_CHECK(Events[255].StartTime == i * 1000000 + EventCount);
+        NSUDO_TEST_CHECK(IsConsistent(Events[0]));
+    }
+
+    // The ring buffer of an exited thread is given to a new thread.
+    std::uint32_t Activity = Mile::CreateTraceActivity();
+    std::thread([Activity]()
+    {
+        Mile::WriteTraceEvent(MakeEvent(Activity, 1));
+    }).join();
+    Mile::TraceEvent Event;
+    NSUDO_TEST_CHECK(Mile::ReadTraceEvents(Activity, &Event, 1) == 1);
+}
+
+NSUDO_TEST_CASE(Trace, Format)
+{
+    Mile::TraceEvent Events[3] =
+    {
+        { 1000, 5, 7, 0, 0, 3 },
+        { 2500, 123456, 7, 1, static_cast<std::int32_t>(0x80070005), 4 },
+        { 3000, 1, 7, 9, 0, 5 },
+    };
+    const wchar_t* const StageNames[] = { L"Launch", L"OpenToken", nullptr };
+
+    wchar_t Buffer[1024];
+    std::size_t Length = Mile::FormatTraceEvents(
+        Events, 3, StageNames, 3, Buffer, 1024);
+    NSUDO_TEST_CHECK(Length == std::wcslen(Buffer));
+    NSUDO_TEST_CHECK(std::wcsstr(Buffer, L"OpenToken"));
+    NSUDO_TEST_CHECK(std::wcsstr(Buffer, L"80070005"));
+
+    // The text is truncated but the whole length is returned.
+    wchar_t Small[10];
+    NSUDO_TEST_CHECK(Mile::FormatTraceEvents(
+        Events, 3, StageNames, 3, Small, 10) == Length);
+    NSUDO_TEST_CHECK(std::wcslen(Small) == 9);
+    NSUDO_TEST_CHECK(Mile::FormatTraceEvents(
+        Events, 3, StageNames, 3, nullptr, 0) == Length);
+}
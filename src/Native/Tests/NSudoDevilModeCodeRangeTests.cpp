@@ -0,0 +1,178 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeCodeRangeTests.cpp
+ * PURPOSE:   Tests for the Code Range Table
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeCodeRange.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+    NSUDO_DEVIL_MODE_CODE_RANGE MakeRange(
+        uintptr_t Start,
+        uintptr_t Size,
+        uintptr_t Destination)
+    {
+        NSUDO_DEVIL_MODE_CODE_RANGE Range = {};
+        Range.Start = Start;
+        Range.Size = Size;
+        Range.Destination = Destination;
+        return Range;
+    }
+
+    /**
+     * Finds the code range which contains an address with a linear scan.
+     */
+    const NSUDO_DEVIL_MODE_CODE_RANGE* FindCodeRangeLinear(
+        const std::vector<NSUDO_DEVIL_MODE_CODE_RANGE>& Ranges,
+        uintptr_t Address)
+    {
+        for (const NSUDO_DEVIL_MODE_CODE_RANGE& Range : Ranges)
+        {
+            if (Address >= Range.Start && Address - Range.Start < Range.Size)
+            {
+                return &Range;
+            }
+        }
+
+        return nullptr;
+    }
+}
+
+NSUDO_TEST_CASE(CodeRange, SortsAndFinds)
+{
+    std::vector<NSUDO_DEVIL_MODE_CODE_RANGE> Ranges;
+    Ranges.push_back(MakeRange(0x3000, 0x10, 0x9000));
+    Ranges.push_back(MakeRange(0x1000, 0x05, 0x8000));
+    Ranges.push_back(MakeRange(0x2000, 0x0E, 0xA000));
+
+    ::NSudoDevilModeSortCodeRanges(Ranges.data(), Ranges.size());
+    NSUDO_TEST_CHECK(Ranges[0].Start == 0x1000);
+    NSUDO_TEST_CHECK(Ranges[1].Start == 0x2000);
+    NSUDO_TEST_CHECK(Ranges[2].Start == 0x3000);
+
+    NSUDO_TEST_CHECK(&Ranges[0] == ::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x1000));
+    NSUDO_TEST_CHECK(&Ranges[0] == ::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x1004));
+    NSUDO_TEST_CHECK(&Ranges[2] == ::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x300F));
+
+    // The end of a range is not in it.
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x1005));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x0FFF));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        Ranges.size(),
+        0x3010));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindCodeRange(
+        Ranges.data(),
+        0,
+        0x1000));
+}
+
+NSUDO_TEST_CASE(CodeRange, FixesUpInstructionPointers)
+{
+    // push rbp ; mov rbp, rsp ; sub rsp, 0x20 moved to a trampoline, the
+    // second instruction is enlarged by 2 bytes.
+    NSUDO_DEVIL_MODE_CODE_RANGE Range = MakeRange(0x1000, 8, 0x5000);
+    const uint8_t SourceOffsets[] = { 0, 1, 4, 8 };
+    const uint8_t DestinationOffsets[] = { 0, 1, 6, 10 };
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        Range.SourceOffsets[i] = SourceOffsets[i];
+        Range.DestinationOffsets[i] = DestinationOffsets[i];
+    }
+    Range.OffsetCount = 4;
+
+    uintptr_t InstructionPointer = 0x1004;
+    NSUDO_TEST_CHECK(::NSudoDevilModeFixupInstructionPointer(
+        &Range,
+        1,
+        &InstructionPointer));
+    NSUDO_TEST_CHECK(InstructionPointer == 0x5006);
+
+    InstructionPointer = 0x1001;
+    NSUDO_TEST_CHECK(::NSudoDevilModeFixupInstructionPointer(
+        &Range,
+        1,
+        &InstructionPointer));
+    NSUDO_TEST_CHECK(InstructionPointer == 0x5001);
+
+    // The middle of an instruction is moved to the start of the destination.
+    InstructionPointer = 0x1002;
+    NSUDO_TEST_CHECK(::NSudoDevilModeFixupInstructionPointer(
+        &Range,
+        1,
+        &InstructionPointer));
+    NSUDO_TEST_CHECK(InstructionPointer == 0x5000);
+
+    InstructionPointer = 0x1008;
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFixupInstructionPointer(
+        &Range,
+        1,
+        &InstructionPointer));
+    NSUDO_TEST_CHECK(InstructionPointer == 0x1008);
+}
+
+NSUDO_TEST_CASE(CodeRange, MatchesLinearScan)
+{
+    std::mt19937 Random(20201);
+
+    for (size_t Count = 1; Count <= 64; ++Count)
+    {
+        // The ranges are disjoint, with random gaps between them.
+        std::vector<NSUDO_DEVIL_MODE_CODE_RANGE> Ranges;
+        uintptr_t Start = 0x10000;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            Start += Random() % 32;
+            uintptr_t Size = 1 + Random() % 24;
+            Ranges.push_back(MakeRange(Start, Size, 0x100000 + i * 0x40));
+            Start += Size;
+        }
+
+        std::shuffle(Ranges.begin(), Ranges.end(), Random);
+        ::NSudoDevilModeSortCodeRanges(Ranges.data(), Ranges.size());
+
+        bool Sorted = true;
+        for (size_t i = 1; i < Ranges.size(); ++i)
+        {
+            Sorted = Sorted && Ranges[i - 1].Start < Ranges[i].Start;
+        }
+        NSUDO_TEST_CHECK(Sorted);
+
+        bool Matched = true;
+        for (uintptr_t Address = 0x10000; Address <= Start; ++Address)
+        {
+            Matched = Matched && FindCodeRangeLinear(Ranges, Address) ==
+                ::NSudoDevilModeFindCodeRange(
+                    Ranges.data(),
+                    Ranges.size(),
+                    Address);
+        }
+        NSUDO_TEST_CHECK(Matched);
+    }
+}
@@ -0,0 +1,225 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeCodeScannerTests.cpp
+ * PURPOSE:   Tests for the Code Scanner Engine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeCodeScanner.h>
+
+#include <Mile.Platform.ThreadPool.h>
+
+#include <atomic>
+#include <vector>
+
+namespace
+{
+    /**
+     * Three x64 functions, the first one calls the second one and the second
+     * one loops back into its own prologue.
+     */
+    const std::vector<uint8_t> SampleCode =
+    {
+        // 0x00: The first function.
+        0x55,                               // push rbp
+        0x48, 0x89, 0xE5,                   // mov rbp, rsp
+        0xE8, 0x0B, 0x00, 0x00, 0x00,       // call 0x14
+        0x5D,                               // pop rbp
+        0xC3,                               // ret
+        0xCC, 0xCC, 0xCC, 0xCC, 0xCC,       // int 3
+        0xCC, 0xCC, 0xCC, 0xCC,             // int 3
+
+        // 0x14: The second function.
+        0x31, 0xC0,                         // xor eax, eax
+        0xFF, 0xC0,                         // inc eax
+        0x83, 0xF8, 0x0A,                   // cmp eax, 10
+        0x75, 0xF9,                         // jne 0x16
+        0xC3,                               // ret
+        0x90, 0x90,                         // nop
+
+        // 0x20: The third function.
+        0x48, 0x89, 0x5C, 0x24, 0x08,       // mov [rsp+8], rbx
+        0x48, 0x8B, 0xC1,                   // mov rax, rcx
+        0xC3,                               // ret
+    };
+
+    struct ScanBuffer
+    {
+        NSUDO_DEVIL_MODE_CODE_SCAN Scan = {};
+        std::vector<uint32_t> BranchTargets;
+        std::vector<NSUDO_DEVIL_MODE_HOOK_SITE> Sites;
+
+        ScanBuffer(
+            const std::vector<uint8_t>& Code,
+            size_t BranchTargetCapacity,
+            size_t SiteCapacity)
+            : BranchTargets(BranchTargetCapacity)
+            , Sites(SiteCapacity)
+        {
+            Scan.Code = Code.data();
+            Scan.CodeSize = Code.size();
+            Scan.BaseAddress = 0x140001000;
+            Scan.Is64Bit = true;
+            Scan.BranchTargets = BranchTargets.data();
+            Scan.BranchTargetCapacity = BranchTargets.size();
+            Scan.Sites = Sites.data();
+            Scan.SiteCapacity = Sites.size();
+        }
+    };
+}
+
+NSUDO_TEST_CASE(CodeScanner, FindsFunctionEntries)
+{
+    ScanBuffer Buffer(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFindHookSites(&Buffer.Scan));
+
+    NSUDO_TEST_REQUIRE(Buffer.Scan.BranchTargetCount == 2);
+    NSUDO_TEST_CHECK(Buffer.BranchTargets[0] == 0x14);
+    NSUDO_TEST_CHECK(Buffer.BranchTargets[1] == 0x16);
+
+    NSUDO_TEST_REQUIRE(Buffer.Scan.SiteCount == 3);
+    NSUDO_TEST_CHECK(Buffer.Sites[0].Offset == 0x00);
+    NSUDO_TEST_CHECK(
+        Buffer.Sites[0].Flags == NSUDO_DEVIL_MODE_HOOK_SITE_AFTER_PADDING);
+
+    // The call target is also found after the padding, so the flags are
+    // merged.
+    NSUDO_TEST_CHECK(Buffer.Sites[1].Offset == 0x14);
+    NSUDO_TEST_CHECK(Buffer.Sites[1].Flags == (
+        NSUDO_DEVIL_MODE_HOOK_SITE_CALL_TARGET |
+        NSUDO_DEVIL_MODE_HOOK_SITE_AFTER_PADDING));
+
+    NSUDO_TEST_CHECK(Buffer.Sites[2].Offset == 0x20);
+    NSUDO_TEST_CHECK(
+        Buffer.Sites[2].Flags == NSUDO_DEVIL_MODE_HOOK_SITE_AFTER_PADDING);
+}
+
+NSUDO_TEST_CASE(CodeScanner, EvaluatesHookSites)
+{
+    ScanBuffer Buffer(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeScanHookSites(&Buffer.Scan));
+    NSUDO_TEST_REQUIRE(Buffer.Scan.SiteCount == 3);
+
+    const NSUDO_DEVIL_MODE_HOOK_SITE& First = Buffer.Sites[0];
+    NSUDO_TEST_CHECK(First.Flags & NSUDO_DEVIL_MODE_HOOK_SITE_SAFE);
+    NSUDO_TEST_CHECK(First.Status == NSudoDevilModeRelocationSuccess);
+    NSUDO_TEST_CHECK(First.PatchSize == 9);
+    NSUDO_TEST_CHECK(First.InstructionCount == 3);
+    NSUDO_TEST_CHECK(First.TrampolineSize == 9);
+
+    // The loop branches into the patched bytes of the second function.
+    const NSUDO_DEVIL_MODE_HOOK_SITE& Second = Buffer.Sites[1];
+    NSUDO_TEST_CHECK(!(Second.Flags & NSUDO_DEVIL_MODE_HOOK_SITE_SAFE));
+    NSUDO_TEST_CHECK(
+        Second.Flags & NSUDO_DEVIL_MODE_HOOK_SITE_BRANCH_INTO_PATCH);
+    NSUDO_TEST_CHECK(Second.Status == NSudoDevilModeRelocationSuccess);
+    NSUDO_TEST_CHECK(Second.PatchSize == 7);
+
+    const NSUDO_DEVIL_MODE_HOOK_SITE& Third = Buffer.Sites[2];
+    NSUDO_TEST_CHECK(Third.Flags & NSUDO_DEVIL_MODE_HOOK_SITE_SAFE);
+    NSUDO_TEST_CHECK(Third.PatchSize == 5);
+    NSUDO_TEST_CHECK(Third.InstructionCount == 1);
+
+    // A hook site outside the window is rejected.
+    NSUDO_DEVIL_MODE_HOOK_SITE Outside = {};
+    Outside.Offset = static_cast<uint32_t>(SampleCode.size());
+    NSUDO_TEST_CHECK(!::NSudoDevilModeEvaluateHookSite(
+        &Buffer.Scan,
+        &Outside));
+    NSUDO_TEST_CHECK(
+        Outside.Status == NSudoDevilModeRelocationInvalidInstruction);
+}
+
+NSUDO_TEST_CASE(CodeScanner, SmallArrays)
+{
+    ScanBuffer Sites(SampleCode, 16, 1);
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindHookSites(&Sites.Scan));
+    NSUDO_TEST_CHECK(Sites.Scan.SiteCount == 1);
+    NSUDO_TEST_CHECK(Sites.Sites[0].Offset == 0x00);
+
+    ScanBuffer BranchTargets(SampleCode, 1, 16);
+    NSUDO_TEST_CHECK(!::NSudoDevilModeFindHookSites(&BranchTargets.Scan));
+    NSUDO_TEST_CHECK(BranchTargets.Scan.BranchTargetCount == 1);
+}
+
+NSUDO_TEST_CASE(CodeScanner, ChunkBoundary)
+{
+    ScanBuffer Whole(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeScanHookSites(&Whole.Scan));
+
+    // Every split point is tried, so the patched bytes of each hook site and
+    // the loop which branches into the second one straddle a boundary.
+    for (size_t Boundary = 1; Boundary < SampleCode.size(); ++Boundary)
+    {
+        ScanBuffer Split(SampleCode, 16, 16);
+        NSUDO_TEST_REQUIRE(::NSudoDevilModeFindHookSites(&Split.Scan));
+
+        size_t SafeCount = ::NSudoDevilModeEvaluateHookSiteRange(
+            &Split.Scan,
+            0,
+            Boundary);
+        SafeCount += ::NSudoDevilModeEvaluateHookSiteRange(
+            &Split.Scan,
+            Boundary,
+            SampleCode.size());
+        NSUDO_TEST_CHECK(SafeCount == 2);
+
+        NSUDO_TEST_REQUIRE(Split.Scan.SiteCount == Whole.Scan.SiteCount);
+        for (size_t i = 0; i < Split.Scan.SiteCount; ++i)
+        {
+            NSUDO_TEST_CHECK(Split.Sites[i].Flags == Whole.Sites[i].Flags);
+            NSUDO_TEST_CHECK(
+                Split.Sites[i].PatchSize == Whole.Sites[i].PatchSize);
+        }
+    }
+
+    // The hook site at 0x20 starts before the boundary, so it belongs to
+    // the first range only.
+    ScanBuffer Straddle(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFindHookSites(&Straddle.Scan));
+    NSUDO_TEST_CHECK(::NSudoDevilModeEvaluateHookSiteRange(
+        &Straddle.Scan,
+        0x1E,
+        0x22) == 1);
+    NSUDO_TEST_CHECK(::NSudoDevilModeEvaluateHookSiteRange(
+        &Straddle.Scan,
+        0x22,
+        SampleCode.size()) == 0);
+    NSUDO_TEST_CHECK(Straddle.Sites[2].PatchSize == 5);
+}
+
+NSUDO_TEST_CASE(CodeScanner, ParallelChunks)
+{
+    ScanBuffer Whole(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeScanHookSites(&Whole.Scan));
+
+    ScanBuffer Parallel(SampleCode, 16, 16);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFindHookSites(&Parallel.Scan));
+
+    // The grain is smaller than a patch, so the chunks split the hook sites.
+    Mile::ThreadPool Pool(4);
+    std::atomic<size_t> SafeCount(0);
+    Pool.ParallelFor(
+        0,
+        SampleCode.size(),
+        3,
+        [&](size_t Begin, size_t End)
+    {
+        SafeCount += ::NSudoDevilModeEvaluateHookSiteRange(
+            &Parallel.Scan,
+            Begin,
+            End);
+    });
+    NSUDO_TEST_CHECK(SafeCount.load() == 2);
+
+    for (size_t i = 0; i < Parallel.Scan.SiteCount; ++i)
+    {
+        NSUDO_TEST_CHECK(Parallel.Sites[i].Flags == Whole.Sites[i].Flags);
+        NSUDO_TEST_CHECK(Parallel.Sites[i].Status == Whole.Sites[i].Status);
+    }
+}
@@ -0,0 +1,14 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeDetoursX64.cpp
+ * PURPOSE:   Detours x64 Disassembler Built as an Offline Library
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+// It exports DetourCopyInstructionX64 for the differential tests of the length
+// decoder, like the disolx64.cpp of the Detours package.
+#define DETOURS_X64_OFFLINE_LIBRARY
+#include "../NSudoDevilMode/disasm.cpp"
@@ -0,0 +1,14 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeDetoursX86.cpp
+ * PURPOSE:   Detours x86 Disassembler Built as an Offline Library
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+// It exports DetourCopyInstructionX86 for the differential tests of the length
+// decoder, like the disolx86.cpp of the Detours package.
+#define DETOURS_X86_OFFLINE_LIBRARY
+#include "../NSudoDevilMode/disasm.cpp"
@@ -0,0 +1,255 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeHookTests.cpp
+ * PURPOSE:   Tests for the Table-Driven Hook Framework
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeHook.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const unsigned long BackupFlag = 0x8;
+
+    /**
+     * The arguments of the last call of a fake export.
+     */
+    struct FakeCall
+    {
+        int Path;
+        unsigned long Options;
+        size_t Count;
+    };
+
+    FakeCall g_CreateCall;
+    FakeCall g_OpenCall;
+    FakeCall g_QueryCall;
+
+    int NSUDO_DEVIL_MODE_HOOK_API FakeCreate(
+        int Path,
+        int Access,
+        unsigned long Options)
+    {
+        static_cast<void>(Access);
+        g_CreateCall = { Path, Options, g_CreateCall.Count + 1 };
+        return 100 + Path;
+    }
+
+    int NSUDO_DEVIL_MODE_HOOK_API FakeOpen(
+        unsigned long Options,
+        int Path)
+    {
+        g_OpenCall = { Path, Options, g_OpenCall.Count + 1 };
+        return 200 + Path;
+    }
+
+    int NSUDO_DEVIL_MODE_HOOK_API FakeQuery(
+        int Path)
+    {
+        g_QueryCall = { Path, 0, g_QueryCall.Count + 1 };
+        return 300 + Path;
+    }
+
+    /**
+     * A privileged context which records the enters and leaves.
+     */
+    struct FakePolicy
+    {
+        static inline bool EnterSucceeds = true;
+        static inline std::vector<size_t> Enters;
+        static inline size_t LeaveCount = 0;
+
+        bool Enter(
+            size_t Index)
+        {
+            Enters.push_back(Index);
+            return EnterSucceeds;
+        }
+
+        void Leave()
+        {
+            ++LeaveCount;
+        }
+
+        static bool Filter(
+            size_t Index,
+            int Path)
+        {
+            static_cast<void>(Index);
+            return Path != 0;
+        }
+
+        static void Reset()
+        {
+            EnterSucceeds = true;
+            Enters.clear();
+            LeaveCount = 0;
+            g_CreateCall = {};
+            g_OpenCall = {};
+            g_QueryCall = {};
+        }
+    };
+
+    /**
+     * The hooks of the tests, in the same shape as the table in
+     * NSudoDevilMode.cpp: Name, option parameter index, option flag and
+     * filter parameter index.
+     */
+#define NSUDO_TEST_HOOKS(Hook) \
+    Hook(FakeCreate, 2, BackupFlag, 0) \
+    Hook(FakeOpen, 0, BackupFlag, 1) \
+    Hook(FakeQuery, \
+        NSudoDevilMode::NoOption, 0, NSudoDevilMode::NoFilter)
+
+#define NSUDO_TEST_HOOK_INDEX(Name, OptionIndex, OptionFlag, FilterIndex) \
+    Name,
+
+    enum class HookIndex : size_t
+    {
+        NSUDO_TEST_HOOKS(NSUDO_TEST_HOOK_INDEX)
+        Count
+    };
+
+#undef NSUDO_TEST_HOOK_INDEX
+
+#define NSUDO_TEST_HOOK(Name, OptionIndex, OptionFlag, Filter) \
+    struct Name##Hook : public NSudoDevilMode::PrivilegedHook< \
+        Name##Hook, \
+        decltype(Name), \
+        FakePolicy, \
+        OptionIndex, \
+        OptionFlag> \
+    { \
+        static constexpr const char* FunctionName = #Name; \
+        static constexpr size_t Index = \
+            static_cast<size_t>(HookIndex::Name); \
+        static constexpr size_t FilterIndex = Filter; \
+    };
+
+    NSUDO_TEST_HOOKS(NSUDO_TEST_HOOK)
+
+#undef NSUDO_TEST_HOOK
+
+    template <size_t Index>
+    struct HookAt;
+
+#define NSUDO_TEST_HOOK_AT(Name, OptionIndex, OptionFlag, FilterIndex) \
+    template <> \
+    struct HookAt<static_cast<size_t>(HookIndex::Name)> \
+    { \
+        using Type = Name##Hook; \
+    };
+
+    NSUDO_TEST_HOOKS(NSUDO_TEST_HOOK_AT)
+
+#undef NSUDO_TEST_HOOK_AT
+
+    using Hooks = NSudoDevilMode::MakeHookList<
+        HookAt,
+        static_cast<size_t>(HookIndex::Count)>;
+
+    static_assert(Hooks::Count == 3, "Each row should generate a hook.");
+
+    void ResolveFakeHooks()
+    {
+        Hooks::Resolve([](const char* FunctionName, void** OriginalAddress)
+        {
+            if (std::strcmp(FunctionName, "FakeCreate") == 0)
+            {
+                *OriginalAddress = reinterpret_cast<void*>(&FakeCreate);
+            }
+            else if (std::strcmp(FunctionName, "FakeOpen") == 0)
+            {
+                *OriginalAddress = reinterpret_cast<void*>(&FakeOpen);
+            }
+            else if (std::strcmp(FunctionName, "FakeQuery") == 0)
+            {
+                *OriginalAddress = reinterpret_cast<void*>(&FakeQuery);
+            }
+        });
+    }
+}
+
+NSUDO_TEST_CASE(Hook, AppliesOptionInPrivilegedContext)
+{
+    ResolveFakeHooks();
+    FakePolicy::Reset();
+
+    NSUDO_TEST_CHECK(FakeCreateHook::Detoured(5, 1, 0x1) == 105);
+    NSUDO_TEST_CHECK(g_CreateCall.Count == 1);
+    NSUDO_TEST_CHECK(g_CreateCall.Options == (0x1 | BackupFlag));
+
+    // The option is the first parameter and the filter is the second one.
+    NSUDO_TEST_CHECK(FakeOpenHook::Detoured(0x2, 7) == 207);
+    NSUDO_TEST_CHECK(g_OpenCall.Options == (0x2 | BackupFlag));
+    NSUDO_TEST_CHECK(g_OpenCall.Path == 7);
+
+    const std::vector<size_t> ExpectedEnters = { 0, 1 };
+    NSUDO_TEST_CHECK(FakePolicy::Enters == ExpectedEnters);
+    NSUDO_TEST_CHECK(FakePolicy::LeaveCount == 2);
+
+    // A hook without a filter runs every call in the privileged context.
+    NSUDO_TEST_CHECK(FakeQueryHook::Detoured(0) == 300);
+    NSUDO_TEST_CHECK(FakePolicy::Enters.back() == 2);
+    NSUDO_TEST_CHECK(FakePolicy::LeaveCount == 3);
+}
+
+NSUDO_TEST_CASE(Hook, CallsOriginalOutsideContext)
+{
+    ResolveFakeHooks();
+    FakePolicy::Reset();
+
+    // The filter rejects the call, the context is not entered.
+    NSUDO_TEST_CHECK(FakeCreateHook::Detoured(0, 1, 0x1) == 100);
+    NSUDO_TEST_CHECK(g_CreateCall.Options == 0x1);
+    NSUDO_TEST_CHECK(FakePolicy::Enters.empty());
+
+    // The context cannot be entered, the original function still runs but
+    // without the option and without a leave.
+    FakePolicy::EnterSucceeds = false;
+    NSUDO_TEST_CHECK(FakeOpenHook::Detoured(0x2, 7) == 207);
+    NSUDO_TEST_CHECK(g_OpenCall.Options == 0x2);
+    NSUDO_TEST_CHECK(FakePolicy::Enters.size() == 1);
+    NSUDO_TEST_CHECK(FakePolicy::LeaveCount == 0);
+
+    NSUDO_TEST_CHECK(FakeCreateHook::Original(3, 1, 0x4) == 103);
+    NSUDO_TEST_CHECK(g_CreateCall.Options == 0x4);
+}
+
+NSUDO_TEST_CASE(Hook, ListFollowsTableOrder)
+{
+    ResolveFakeHooks();
+
+    std::vector<std::string> Names;
+    Hooks::ForEachName([&](size_t Index, const char* FunctionName)
+    {
+        NSUDO_TEST_CHECK(Index == Names.size());
+        Names.push_back(FunctionName);
+    });
+    const std::vector<std::string> ExpectedNames =
+    {
+        "FakeCreate", "FakeOpen", "FakeQuery"
+    };
+    NSUDO_TEST_CHECK(Names == ExpectedNames);
+
+    std::vector<void*> Detoured;
+    Hooks::ForEach([&](void** OriginalAddress, void* DetouredAddress)
+    {
+        NSUDO_TEST_CHECK(*OriginalAddress != nullptr);
+        Detoured.push_back(DetouredAddress);
+    });
+    NSUDO_TEST_REQUIRE(Detoured.size() == 3);
+    NSUDO_TEST_CHECK(
+        Detoured[0] == reinterpret_cast<void*>(&FakeCreateHook::Detoured));
+    NSUDO_TEST_CHECK(
+        Detoured[2] == reinterpret_cast<void*>(&FakeQueryHook::Detoured));
+}
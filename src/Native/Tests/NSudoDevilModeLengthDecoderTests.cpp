@@ -0,0 +1,519 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeLengthDecoderTests.cpp
+ * PURPOSE:   Tests for the x86 and x64 Instruction Length Decoder
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeLengthDecoder.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(NSUDO_TESTS_DETOURS_DISASSEMBLER)
+/**
+ * The x64 and x86 Detours disassemblers built as offline libraries, see
+ * NSudoDevilModeDetoursX64.cpp and NSudoDevilModeDetoursX86.cpp.
+ */
+extern "C" void* __stdcall DetourCopyInstructionX64(
+    void* pDst,
+    void** ppDstPool,
+    void* pSrc,
+    void** ppTarget,
+    long* plExtra);
+extern "C" void* __stdcall DetourCopyInstructionX86(
+    void* pDst,
+    void** ppDstPool,
+    void* pSrc,
+    void** ppTarget,
+    long* plExtra);
+#endif // defined(NSUDO_TESTS_DETOURS_DISASSEMBLER)
+
+namespace
+{
+    /**
+     * An instruction with its length, as disassembled by objdump from the
+     * .text sections of an x64 and an x86 build of the GNU C Library.
+     */
+    struct KnownInstruction
+    {
+        const char* Bytes;
+        const char* Mnemonic;
+    };
+
+    const KnownInstruction KnownX64Instructions[] =
+    {
+        { "8354243C00", "adcl" },
+        { "8044243401", "addb" },
+        { "48830101", "addq" },
+        { "F30F58C0", "addss" },
+        { "0F55C3", "andnps" },
+        { "6681620C07E2", "andw" },
+        { "0FBCD2", "bsf" },
+        { "490F47C6", "cmova" },
+        { "410F4FC1", "cmovg" },
+        { "0F48D0", "cmovs" },
+        { "81BC24880000000000FFFF", "cmpl" },
+        { "F30F5AC0", "cvtss2sd" },
+        { "F30F2CC0", "cvttss2si" },
+        { "98", "cwtl" },
+        { "49F7F4", "div" },
+        { "F30F1EFA", "endbr64" },
+        { "DEC1", "faddp" },
+        { "DB2D9AB30E00", "fldt" },
+        { "D97C2426", "fnstcw" },
+        { "D97424D8", "fnstenv" },
+        { "DD5C24F0", "fstpl" },
+        { "DEE9", "fsubrp" },
+        { "746E", "je" },
+        { "EBD5", "jmp" },
+        { "0FAE92C0010000", "ldmxcsr" },
+        { "F00FBAAF0803000005", "lock btsl" },
+        { "F0410FB108", "lock cmpxchg" },
+        { "F083880803000010", "lock orl" },
+        { "F04883A88804000001", "lock subq" },
+        { "0F12FA", "movhlps" },
+        { "660FE74F10", "movntdq" },
+        { "480FBEC9", "movsbq" },
+        { "48A5", "movsq" },
+        { "410FB74500", "movzwl" },
+        { "F30F590DBA571600", "mulss" },
+        { "660F560DE85A1600", "orpd" },
+        { "66814C24681004", "orw" },
+        { "660FFEC1", "paddd" },
+        { "660F64FD", "pcmpgtb" },
+        { "660F3A6304161A", "pcmpistri" },
+        { "660FC5C801", "pextrw" },
+        { "660FDED8", "pmaxub" },
+        { "415C", "pop" },
+        { "0F189100FEFFFF", "prefetcht1" },
+        { "660F70C0E1", "pshufd" },
+        { "660FFBC1", "psubq" },
+        { "F3A4", "rep movsb" },
+        { "C1C804", "ror" },
+        { "0F97C0", "seta" },
+        { "0F96C0", "setbe" },
+        { "0FAE5C242C", "stmxcsr" },
+        { "4429CE", "sub" },
+        { "48836C247840", "subq" },
+        { "F20F5C05302D1600", "subsd" },
+        { "0F2EE1", "ucomiss" },
+        { "62F27D4818D0", "vbroadcastss" },
+        { "C5FD6F6740", "vmovdqa" },
+        { "C4A17A6F040F", "vmovdqu" },
+        { "62E17E2A6F16", "vmovdqu32" },
+        { "62E17D48E76740", "vmovntdq" },
+        { "C4417DFCC2", "vpaddb" },
+        { "C5D5DBEC", "vpand" },
+        { "C58576D0", "vpcmpeqd" },
+        { "62B355201FE104", "vpcmpneqd" },
+        { "62F375203E0F04", "vpcmpnequb" },
+        { "C5E5DA6761", "vpminub" },
+        { "C4E2653BD9", "vpminud" },
+        { "62B2752027D1", "vptestmd" },
+        { "C5FC77", "vzeroall" },
+        { "4531C9", "xor" },
+    };
+
+    const KnownInstruction KnownX86Instructions[] =
+    {
+        { "F30F58C0", "addss" },
+        { "660F55C3", "andnpd" },
+        { "63F0", "arpl" },
+        { "0FBDD5", "bsr" },
+        { "99", "cltd" },
+        { "0F42C6", "cmovb" },
+        { "0F4FD0", "cmovg" },
+        { "0F4DC3", "cmovge" },
+        { "0F45F8", "cmovne" },
+        { "D9E0", "fchs" },
+        { "D9E8", "fld1" },
+        { "DFE0", "fnstsw" },
+        { "6448", "fs" },
+        { "F4", "hlt" },
+        { "CC", "int3" },
+        { "0F83B8010000", "jae" },
+        { "E338", "jecxz" },
+        { "0F8DBE000000", "jge" },
+        { "7C16", "jl" },
+        { "0F8028130000", "jo" },
+        { "0F8838100000", "js" },
+        { "C9", "leave" },
+        { "89F1", "mov" },
+        { "0F6EDE", "movd" },
+        { "0F50C0", "movmskps" },
+        { "F20F100D36B81500", "movsd" },
+        { "0FBFD2", "movswl" },
+        { "90", "nop" },
+        { "09F1", "or" },
+        { "0F56C2", "orps" },
+        { "660FDBC2", "pand" },
+        { "660FD7C0", "pmovmskb" },
+        { "F34F", "repz dec" },
+        { "83DA00", "sbb" },
+        { "0F97C1", "seta" },
+        { "D1E9", "shr" },
+        { "0FADD8", "shrd" },
+        { "F30F5CC8", "subss" },
+        { "0F05", "syscall" },
+        { "660F570587C11500", "xorpd" },
+    };
+
+    std::vector<uint8_t> ParseBytes(
+        const char* Bytes)
+    {
+        std::vector<uint8_t> Result;
+        const char* Current = Bytes;
+        for (; Current[0] && Current[1]; Current += 2)
+        {
+            auto Nibble = [](char Character) -> uint8_t
+            {
+                return static_cast<uint8_t>(Character <= '9'
+                    ? Character - '0'
+                    : Character - 'A' + 10);
+            };
+            Result.push_back(static_cast<uint8_t>(
+                (Nibble(Current[0]) << 4) | Nibble(Current[1])));
+        }
+        return Result;
+    }
+
+    NSUDO_DEVIL_MODE_INSTRUCTION Decode(
+        std::vector<uint8_t> Code,
+        bool Is64Bit,
+        size_t* Length)
+    {
+        NSUDO_DEVIL_MODE_INSTRUCTION Instruction;
+        std::memset(&Instruction, 0xCC, sizeof(Instruction));
+        *Length = ::NSudoDevilModeDecodeLength(
+            Code.data(),
+            Code.size(),
+            Is64Bit,
+            &Instruction);
+        return Instruction;
+    }
+
+    void CheckKnownInstructions(
+        const KnownInstruction* Instructions,
+        size_t Count,
+        bool Is64Bit)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            std::vector<uint8_t> Code = ParseBytes(Instructions[i].Bytes);
+
+            // Trailing bytes must not change the length.
+            std::vector<uint8_t> Padded = Code;
+            Padded.resize(Code.size() + 16, 0x90);
+
+            size_t Length = ::NSudoDevilModeDecodeLength(
+                Padded.data(),
+                Padded.size(),
+                Is64Bit,
+                nullptr);
+            if (Length != Code.size())
+            {
+                NSudoTests::ReportFailure(
+                    __FILE__,
+                    __LINE__,
+                    Instructions[i].Mnemonic);
+            }
+        }
+    }
+}
+
+#if defined(NSUDO_TESTS_DETOURS_DISASSEMBLER)
+namespace
+{
+    /**
+     * The size of a byte stream of the differential tests. It is longer
+     * than every instruction, so neither decoder reads outside the stream.
+     */
+    const size_t DifferentialStreamSize = 32;
+
+    typedef std::vector<uint8_t> ByteStream;
+
+    /**
+     * Generates the byte streams of the differential tests: every primary
+     * opcode after the common prefixes and escape bytes with the common
+     * ModRM bytes, and pseudo-random streams with a fixed seed.
+     */
+    std::vector<ByteStream> GenerateDifferentialStreams(
+        bool Is64Bit)
+    {
+        std::vector<ByteStream> Prefixes =
+        {
+            {},
+            { 0x66 },
+            { 0x67 },
+            { 0xF2 },
+            { 0xF3 },
+            { 0x0F },
+            { 0x66, 0x0F },
+            { 0xF2, 0x0F },
+            { 0xF3, 0x0F },
+            { 0x0F, 0x38 },
+            { 0x66, 0x0F, 0x38 },
+            { 0x0F, 0x3A },
+            { 0x66, 0x0F, 0x3A },
+        };
+        if (Is64Bit)
+        {
+            Prefixes.push_back({ 0x41 });
+            Prefixes.push_back({ 0x48 });
+            Prefixes.push_back({ 0x48, 0x0F });
+            Prefixes.push_back({ 0x66, 0x48, 0x0F });
+        }
+
+        // Register, [disp32] or [rip+disp32], SIB, disp8, disp32 and the
+        // reg field used by the opcode extensions.
+        const uint8_t ModRMs[] =
+        {
+            0xC0, 0x05, 0x04, 0x44, 0x84, 0x15, 0x25, 0x3D, 0xF8
+        };
+
+        std::mt19937 Random(0x4E53);
+        auto Fill = [&](ByteStream& Stream)
+        {
+            while (Stream.size() < DifferentialStreamSize)
+            {
+                Stream.push_back(static_cast<uint8_t>(Random()));
+            }
+        };
+
+        std::vector<ByteStream> Streams;
+
+        for (const ByteStream& Prefix : Prefixes)
+        {
+            for (unsigned Opcode = 0; Opcode < 256; ++Opcode)
+            {
+                for (uint8_t ModRM : ModRMs)
+                {
+                    ByteStream Stream = Prefix;
+                    Stream.push_back(static_cast<uint8_t>(Opcode));
+                    Stream.push_back(ModRM);
+                    Stream.push_back(0x24);
+                    Fill(Stream);
+                    Streams.push_back(Stream);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < 65536; ++i)
+        {
+            ByteStream Stream;
+            Fill(Stream);
+            Streams.push_back(Stream);
+        }
+
+        return Streams;
+    }
+
+    /**
+     * Runs the length decoder and the Detours disassembler over the same
+     * byte streams. The decoder follows the instruction coverage of the
+     * Detours disassembler, so every length it decodes must match.
+     */
+    void CheckAgainstDetours(
+        bool Is64Bit)
+    {
+        size_t ComparedCount = 0;
+        size_t MismatchCount = 0;
+
+        for (ByteStream& Stream : GenerateDifferentialStreams(Is64Bit))
+        {
+            size_t Length = ::NSudoDevilModeDecodeLength(
+                Stream.data(),
+                Stream.size(),
+                Is64Bit,
+                nullptr);
+            if (!Length)
+            {
+                // The decoder rejects it, Detours only skips a byte.
+                continue;
+            }
+
+            uint8_t* Next = reinterpret_cast<uint8_t*>(Is64Bit
+                ? ::DetourCopyInstructionX64(
+                    nullptr, nullptr, Stream.data(), nullptr, nullptr)
+                : ::DetourCopyInstructionX86(
+                    nullptr, nullptr, Stream.data(), nullptr, nullptr));
+            ++ComparedCount;
+
+            if (Next && static_cast<size_t>(Next - Stream.data()) == Length)
+            {
+                continue;
+            }
+
+            // The first mismatches are enough to find the table entry.
+            if (++MismatchCount <= 8)
+            {
+                const char Digits[] = "0123456789ABCDEF";
+
+                std::string Message = Is64Bit ? "x64" : "x86";
+                for (size_t i = 0; i < Length; ++i)
+                {
+                    Message.push_back(' ');
+                    Message.push_back(Digits[Stream[i] >> 4]);
+                    Message.push_back(Digits[Stream[i] & 0xF]);
+                }
+                NSudoTests::ReportFailure(__FILE__, __LINE__, Message.c_str());
+            }
+        }
+
+        NSUDO_TEST_CHECK(ComparedCount > 65536);
+        NSUDO_TEST_CHECK(MismatchCount == 0);
+    }
+}
+
+NSUDO_TEST_CASE(LengthDecoder, MatchesDetoursX64)
+{
+    CheckAgainstDetours(true);
+}
+
+NSUDO_TEST_CASE(LengthDecoder, MatchesDetoursX86)
+{
+    CheckAgainstDetours(false);
+}
+#endif // defined(NSUDO_TESTS_DETOURS_DISASSEMBLER)
+
+NSUDO_TEST_CASE(LengthDecoder, KnownX64Lengths)
+{
+    CheckKnownInstructions(
+        KnownX64Instructions,
+        sizeof(KnownX64Instructions) / sizeof(*KnownX64Instructions),
+        true);
+}
+
+NSUDO_TEST_CASE(LengthDecoder, KnownX86Lengths)
+{
+    CheckKnownInstructions(
+        KnownX86Instructions,
+        sizeof(KnownX86Instructions) / sizeof(*KnownX86Instructions),
+        false);
+}
+
+NSUDO_TEST_CASE(LengthDecoder, TruncatedInstructions)
+{
+    for (const KnownInstruction& Current : KnownX64Instructions)
+    {
+        std::vector<uint8_t> Code = ParseBytes(Current.Bytes);
+        NSUDO_TEST_CHECK(0 == ::NSudoDevilModeDecodeLength(
+            Code.data(),
+            Code.size() - 1,
+            true,
+            nullptr));
+    }
+}
+
+NSUDO_TEST_CASE(LengthDecoder, RelativeBranches)
+{
+    size_t Length = 0;
+
+    NSUDO_DEVIL_MODE_INSTRUCTION Call = Decode(
+        { 0xE8, 0x01, 0x02, 0x03, 0x04 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 5);
+    NSUDO_TEST_CHECK(Call.Flags == NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE);
+    NSUDO_TEST_CHECK(Call.TargetOffset == 1 && Call.TargetSize == 4);
+
+    NSUDO_DEVIL_MODE_INSTRUCTION Jump = Decode(
+        { 0xEB, 0x10 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 2);
+    NSUDO_TEST_CHECK(Jump.Flags == (NSUDO_DEVIL_MODE_INSTRUCTION_RELATIVE
+        | NSUDO_DEVIL_MODE_INSTRUCTION_SHORT_JUMP));
+    NSUDO_TEST_CHECK(Jump.TargetOffset == 1 && Jump.TargetSize == 1);
+
+    NSUDO_DEVIL_MODE_INSTRUCTION NearJcc = Decode(
+        { 0x0F, 0x84, 0x01, 0x02, 0x03, 0x04 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 6);
+    NSUDO_TEST_CHECK(NearJcc.OpcodeOffset == 1);
+    NSUDO_TEST_CHECK(NearJcc.TargetOffset == 2 && NearJcc.TargetSize == 4);
+
+    // An operand-size prefix makes a near Jcc rel16 in 32-bit code.
+    NSUDO_DEVIL_MODE_INSTRUCTION Jcc16 = Decode(
+        { 0x66, 0x0F, 0x84, 0x01, 0x02 }, false, &Length);
+    NSUDO_TEST_CHECK(Length == 5);
+    NSUDO_TEST_CHECK(Jcc16.TargetOffset == 3 && Jcc16.TargetSize == 2);
+
+    for (uint8_t Opcode : { 0xE0, 0xE1, 0xE2, 0xE3 })
+    {
+        NSUDO_DEVIL_MODE_INSTRUCTION Loop = Decode(
+            { Opcode, 0x10 }, false, &Length);
+        NSUDO_TEST_CHECK(Length == 2);
+        NSUDO_TEST_CHECK(Loop.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_NO_ENLARGE);
+    }
+}
+
+NSUDO_TEST_CASE(LengthDecoder, MemoryOperands)
+{
+    size_t Length = 0;
+
+    NSUDO_DEVIL_MODE_INSTRUCTION RipRelative = Decode(
+        { 0x48, 0x8B, 0x05, 0x01, 0x02, 0x03, 0x04 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 7);
+    NSUDO_TEST_CHECK(
+        RipRelative.Flags == NSUDO_DEVIL_MODE_INSTRUCTION_RIP_RELATIVE);
+    NSUDO_TEST_CHECK(RipRelative.TargetOffset == 3);
+    NSUDO_TEST_CHECK(RipRelative.TargetSize == 4);
+
+    // 0x48 is DEC EAX in 32-bit code, not a REX prefix.
+    Decode({ 0x48, 0x8B, 0x05, 0x01, 0x02, 0x03, 0x04 }, false, &Length);
+    NSUDO_TEST_CHECK(Length == 1);
+
+    NSUDO_DEVIL_MODE_INSTRUCTION Indirect = Decode(
+        { 0xFF, 0x25, 0x01, 0x02, 0x03, 0x04 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 6);
+    NSUDO_TEST_CHECK(Indirect.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_INDIRECT);
+
+    // The moffs forms follow the address size.
+    Decode({ 0xA1, 1, 2, 3, 4, 5, 6, 7, 8 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 9);
+    Decode({ 0x67, 0xA1, 1, 2, 3, 4 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 6);
+    Decode({ 0xA1, 1, 2, 3, 4 }, false, &Length);
+    NSUDO_TEST_CHECK(Length == 5);
+}
+
+NSUDO_TEST_CASE(LengthDecoder, DynamicTargets)
+{
+    size_t Length = 0;
+
+    NSUDO_DEVIL_MODE_INSTRUCTION FarReturn = Decode(
+        { 0xCA, 0x08, 0x00 }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 3);
+    NSUDO_TEST_CHECK(FarReturn.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC);
+
+    NSUDO_DEVIL_MODE_INSTRUCTION Breakpoint = Decode(
+        { 0xCC }, true, &Length);
+    NSUDO_TEST_CHECK(Length == 1);
+    NSUDO_TEST_CHECK(Breakpoint.Flags & NSUDO_DEVIL_MODE_INSTRUCTION_DYNAMIC);
+}
+
+NSUDO_TEST_CASE(LengthDecoder, ArchitecturalLimit)
+{
+    std::vector<uint8_t> Code(
+        NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH - 1,
+        0x66);
+    Code.push_back(0x90);
+
+    size_t Length = 0;
+    Decode(Code, true, &Length);
+    NSUDO_TEST_CHECK(Length == NSUDO_DEVIL_MODE_MAXIMUM_INSTRUCTION_LENGTH);
+
+    Code.insert(Code.begin(), 0x66);
+    Decode(Code, true, &Length);
+    NSUDO_TEST_CHECK(Length == 0);
+
+    NSUDO_TEST_CHECK(0 == ::NSudoDevilModeDecodeLength(
+        Code.data(),
+        0,
+        true,
+        nullptr));
+}
@@ -0,0 +1,152 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModePathFilterTests.cpp
+ * PURPOSE:   Tests for the Path Prefix Filter
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModePathFilter.h>
+
+#include <string>
+
+namespace
+{
+    /**
+     * Widens an ASCII string to UTF-16.
+     */
+    std::u16string Widen(
+        const char* Source)
+    {
+        std::u16string Result;
+        for (; Source && *Source; ++Source)
+        {
+            Result.push_back(static_cast<char16_t>(*Source));
+        }
+        return Result;
+    }
+
+    bool AddPrefixes(
+        PNSUDO_DEVIL_MODE_PATH_FILTER Filter,
+        const char* List)
+    {
+        std::u16string Prefixes = Widen(List);
+        return ::NSudoDevilModeAddPathFilterPrefixes(
+            Filter,
+            reinterpret_cast<const uint16_t*>(Prefixes.data()),
+            Prefixes.size());
+    }
+
+    bool Match(
+        const NSUDO_DEVIL_MODE_PATH_FILTER* Filter,
+        const char* Root,
+        const char* Name)
+    {
+        std::u16string RootPath = Widen(Root);
+        std::u16string NamePath = Widen(Name);
+        return ::NSudoDevilModeMatchPathFilter(
+            Filter,
+            Root ? reinterpret_cast<const uint16_t*>(RootPath.data()) : nullptr,
+            RootPath.size(),
+            reinterpret_cast<const uint16_t*>(NamePath.data()),
+            NamePath.size());
+    }
+}
+
+NSUDO_TEST_CASE(PathFilter, AbsolutePaths)
+{
+    NSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes[256];
+    NSUDO_DEVIL_MODE_PATH_FILTER Filter;
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        256));
+
+    // The empty filter matches no path.
+    NSUDO_TEST_CHECK(!Match(&Filter, nullptr, "\\??\\C:\\Windows"));
+
+    NSUDO_TEST_REQUIRE(AddPrefixes(
+        &Filter,
+        "\\REGISTRY\\MACHINE\\SOFTWARE\\;;"
+        "\\??\\C:\\Windows;\\??\\C:\\Program Files"));
+
+    NSUDO_TEST_CHECK(Match(&Filter, nullptr, "\\??\\C:\\Windows"));
+    NSUDO_TEST_CHECK(Match(
+        &Filter,
+        nullptr,
+        "\\??\\c:\\windows\\system32\\kernel32.dll"));
+    NSUDO_TEST_CHECK(Match(&Filter, nullptr, "\\??\\C:\\Program Files\\A"));
+    NSUDO_TEST_CHECK(Match(&Filter, nullptr, "\\REGISTRY\\MACHINE\\SOFTWARE"));
+
+    // A prefix only matches whole path components.
+    NSUDO_TEST_CHECK(!Match(&Filter, nullptr, "\\??\\C:\\Windows2"));
+    NSUDO_TEST_CHECK(!Match(&Filter, nullptr, "\\??\\C:\\Win"));
+    NSUDO_TEST_CHECK(!Match(&Filter, nullptr, "\\??\\C:\\Program"));
+    NSUDO_TEST_CHECK(!Match(&Filter, nullptr, ""));
+}
+
+NSUDO_TEST_CASE(PathFilter, RelativePaths)
+{
+    NSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes[128];
+    NSUDO_DEVIL_MODE_PATH_FILTER Filter;
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        128));
+    NSUDO_TEST_REQUIRE(AddPrefixes(&Filter, "\\REGISTRY\\MACHINE\\SOFTWARE"));
+
+    // The root and the name are joined by a backslash.
+    NSUDO_TEST_CHECK(Match(
+        &Filter,
+        "\\REGISTRY\\MACHINE",
+        "SOFTWARE\\Microsoft"));
+    NSUDO_TEST_CHECK(Match(&Filter, "\\REGISTRY\\MACHINE\\", "Software"));
+    NSUDO_TEST_CHECK(Match(&Filter, "\\REGISTRY\\MACHINE\\SOFTWARE", ""));
+    NSUDO_TEST_CHECK(Match(
+        &Filter,
+        "\\REGISTRY\\MACHINE\\SOFTWARE\\Classes",
+        "CLSID"));
+
+    NSUDO_TEST_CHECK(!Match(&Filter, "\\REGISTRY\\MACHINE", "SYSTEM"));
+    NSUDO_TEST_CHECK(!Match(&Filter, "\\REGISTRY\\MACHINE", "SOFTWAREX"));
+    NSUDO_TEST_CHECK(!Match(&Filter, "\\REGISTRY\\USER", "SOFTWARE"));
+}
+
+NSUDO_TEST_CASE(PathFilter, Capacity)
+{
+    NSUDO_DEVIL_MODE_PATH_FILTER_NODE Nodes[4];
+    NSUDO_DEVIL_MODE_PATH_FILTER Filter;
+
+    NSUDO_TEST_CHECK(!::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        0));
+
+    // Each character needs a node besides the root.
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        4));
+    NSUDO_TEST_CHECK(!AddPrefixes(&Filter, "\\abc"));
+
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        4));
+    NSUDO_TEST_CHECK(AddPrefixes(&Filter, "\\ab"));
+    NSUDO_TEST_CHECK(AddPrefixes(&Filter, "\\AB"));
+    NSUDO_TEST_CHECK(Filter.NodeCount == 4);
+
+    // The prefix \ matches all paths.
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializePathFilter(
+        &Filter,
+        Nodes,
+        4));
+    NSUDO_TEST_CHECK(AddPrefixes(&Filter, "\\"));
+    NSUDO_TEST_CHECK(Match(&Filter, nullptr, "\\x"));
+    NSUDO_TEST_CHECK(Match(&Filter, "\\REGISTRY", "MACHINE"));
+}
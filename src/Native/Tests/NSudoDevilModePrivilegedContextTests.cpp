@@ -0,0 +1,338 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModePrivilegedContextTests.cpp
+ * PURPOSE:   Tests for the Privileged Context State Machine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModePrivilegedContext.h>
+
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const int32_t AccessDenied = static_cast<int32_t>(0xC0000022);
+
+    /**
+     * The impersonation identities of the fake threads.
+     */
+    int g_ClientIdentity;
+    int g_PrivilegedIdentity;
+
+    /**
+     * A fake thread. The handles are fake pointers which map to the
+     * identities, so the leaked and the double closed handles are visible.
+     */
+    struct FakeThread
+    {
+        void* Identity = nullptr;
+        bool FailImpersonation = false;
+
+        std::map<void*, void*> Handles;
+        uintptr_t NextHandle = 0x1000;
+        size_t InvalidCloseCount = 0;
+
+        NSUDO_DEVIL_MODE_SYSCALL_TABLE Syscalls;
+
+        FakeThread();
+    };
+
+    bool FakeIsImpersonating(
+        void* Context)
+    {
+        return reinterpret_cast<FakeThread*>(Context)->Identity != nullptr;
+    }
+
+    int32_t FakeOpenThreadToken(
+        void* Context,
+        void** TokenHandle)
+    {
+        FakeThread* Thread = reinterpret_cast<FakeThread*>(Context);
+        *TokenHandle = reinterpret_cast<void*>(Thread->NextHandle += 4);
+        Thread->Handles[*TokenHandle] = Thread->Identity;
+        return 0;
+    }
+
+    int32_t FakeSetThreadToken(
+        void* Context,
+        void* TokenHandle)
+    {
+        FakeThread* Thread = reinterpret_cast<FakeThread*>(Context);
+
+        if (!TokenHandle)
+        {
+            Thread->Identity = nullptr;
+        }
+        else if (TokenHandle == &g_PrivilegedIdentity)
+        {
+            if (Thread->FailImpersonation)
+            {
+                return AccessDenied;
+            }
+            Thread->Identity = &g_PrivilegedIdentity;
+        }
+        else
+        {
+            auto Handle = Thread->Handles.find(TokenHandle);
+            if (Handle == Thread->Handles.end())
+            {
+                return AccessDenied;
+            }
+            Thread->Identity = Handle->second;
+        }
+
+        return 0;
+    }
+
+    int32_t FakeCloseHandle(
+        void* Context,
+        void* Handle)
+    {
+        FakeThread* Thread = reinterpret_cast<FakeThread*>(Context);
+        if (!Thread->Handles.erase(Handle))
+        {
+            ++Thread->InvalidCloseCount;
+        }
+        return 0;
+    }
+
+    FakeThread::FakeThread()
+    {
+        this->Syscalls.Context = this;
+        this->Syscalls.IsImpersonating = FakeIsImpersonating;
+        this->Syscalls.OpenThreadToken = FakeOpenThreadToken;
+        this->Syscalls.SetThreadToken = FakeSetThreadToken;
+        this->Syscalls.CloseHandle = FakeCloseHandle;
+    }
+
+    int32_t Enter(
+        NSUDO_DEVIL_MODE_THREAD_STATE_TABLE& Table,
+        NSUDO_DEVIL_MODE_PRIVILEGED_FRAME& Context,
+        uintptr_t ThreadId,
+        FakeThread& Thread)
+    {
+        return ::NSudoDevilModeEnterPrivilegedContext(
+            &Table,
+            &Context,
+            ThreadId,
+            &Thread.Syscalls,
+            &g_PrivilegedIdentity);
+    }
+
+    int32_t Leave(
+        NSUDO_DEVIL_MODE_THREAD_STATE_TABLE& Table,
+        NSUDO_DEVIL_MODE_PRIVILEGED_FRAME& Context,
+        FakeThread& Thread)
+    {
+        return ::NSudoDevilModeLeavePrivilegedContext(
+            &Table,
+            &Context,
+            &Thread.Syscalls);
+    }
+
+    size_t CountOwnedSlots(
+        const NSUDO_DEVIL_MODE_THREAD_STATE_TABLE& Table)
+    {
+        size_t Count = 0;
+        for (const NSUDO_DEVIL_MODE_THREAD_STATE_SLOT& Slot : Table.Slots)
+        {
+            Count += Slot.ThreadId ? 1 : 0;
+        }
+        return Count;
+    }
+}
+
+NSUDO_TEST_CASE(PrivilegedContext, NestedEnterAndLeave)
+{
+    std::unique_ptr<NSUDO_DEVIL_MODE_THREAD_STATE_TABLE> Table(
+        new NSUDO_DEVIL_MODE_THREAD_STATE_TABLE());
+    FakeThread Thread;
+    Thread.Identity = &g_ClientIdentity;
+
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Outer;
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Inner;
+
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, Outer, 7, Thread));
+    NSUDO_TEST_CHECK(Thread.Identity == &g_PrivilegedIdentity);
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, Inner, 7, Thread));
+
+    // The nested enter shares the slot and issues no system call.
+    NSUDO_TEST_CHECK(Inner.Slot && Inner.Slot == Outer.Slot);
+    NSUDO_TEST_CHECK(Outer.Slot->State.Depth == 2);
+    NSUDO_TEST_CHECK(Outer.Slot->State.SyscallCount == 2);
+
+    NSUDO_TEST_CHECK(0 == Leave(*Table, Inner, Thread));
+    NSUDO_TEST_CHECK(Thread.Identity == &g_PrivilegedIdentity);
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 1);
+
+    NSUDO_TEST_CHECK(0 == Leave(*Table, Outer, Thread));
+    NSUDO_TEST_CHECK(Thread.Identity == &g_ClientIdentity);
+    NSUDO_TEST_CHECK(Thread.Handles.empty());
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    // Open, set, set and close for two enters.
+    NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters;
+    ::NSudoDevilModeGetPrivilegedContextCounters(Table.get(), &Counters);
+    NSUDO_TEST_CHECK(Counters.EnterCount == 2);
+    NSUDO_TEST_CHECK(Counters.SyscallCount == 4);
+    NSUDO_TEST_CHECK(Counters.AvoidedSyscallCount == 4);
+}
+
+NSUDO_TEST_CASE(PrivilegedContext, FailedImpersonationKeepsToken)
+{
+    std::unique_ptr<NSUDO_DEVIL_MODE_THREAD_STATE_TABLE> Table(
+        new NSUDO_DEVIL_MODE_THREAD_STATE_TABLE());
+    FakeThread Thread;
+    Thread.Identity = &g_ClientIdentity;
+    Thread.FailImpersonation = true;
+
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context;
+    NSUDO_TEST_CHECK(AccessDenied == Enter(*Table, Context, 7, Thread));
+
+    // The thread keeps its token, and the saved copy and the slot are
+    // released.
+    NSUDO_TEST_CHECK(Thread.Identity == &g_ClientIdentity);
+    NSUDO_TEST_CHECK(Thread.Handles.empty());
+    NSUDO_TEST_CHECK(Thread.InvalidCloseCount == 0);
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    // A later enter of the same thread starts from a clean state.
+    Thread.FailImpersonation = false;
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, Context, 7, Thread));
+    NSUDO_TEST_CHECK(Context.Slot->State.Depth == 1);
+    NSUDO_TEST_CHECK(0 == Leave(*Table, Context, Thread));
+    NSUDO_TEST_CHECK(Thread.Identity == &g_ClientIdentity);
+    NSUDO_TEST_CHECK(Thread.Handles.empty());
+
+    NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters;
+    ::NSudoDevilModeGetPrivilegedContextCounters(Table.get(), &Counters);
+    NSUDO_TEST_CHECK(Counters.EnterCount == 1);
+}
+
+NSUDO_TEST_CASE(PrivilegedContext, ReusesSlotsAcrossThreads)
+{
+    std::unique_ptr<NSUDO_DEVIL_MODE_THREAD_STATE_TABLE> Table(
+        new NSUDO_DEVIL_MODE_THREAD_STATE_TABLE());
+
+    // More threads than slots are inside the privileged context at the same
+    // time, the last ones use the fallback state.
+    const size_t ThreadCount = NSUDO_DEVIL_MODE_THREAD_STATE_SLOT_COUNT + 4;
+    std::vector<FakeThread> Threads(ThreadCount);
+    std::vector<NSUDO_DEVIL_MODE_PRIVILEGED_FRAME> Contexts(ThreadCount);
+
+    for (size_t i = 0; i < ThreadCount; ++i)
+    {
+        NSUDO_TEST_REQUIRE(0 == Enter(*Table, Contexts[i], i + 1, Threads[i]));
+        NSUDO_TEST_CHECK(
+            (Contexts[i].Slot != nullptr) ==
+            (i < NSUDO_DEVIL_MODE_THREAD_STATE_SLOT_COUNT));
+    }
+
+    NSUDO_TEST_CHECK(
+        CountOwnedSlots(*Table) == NSUDO_DEVIL_MODE_THREAD_STATE_SLOT_COUNT);
+
+    for (size_t i = 0; i < ThreadCount; ++i)
+    {
+        NSUDO_TEST_CHECK(0 == Leave(*Table, Contexts[i], Threads[i]));
+        NSUDO_TEST_CHECK(Threads[i].Identity == nullptr);
+    }
+
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    // The real threads claim and free the slots concurrently, every nested
+    // enter finds the slot of its outer enter.
+    const size_t WorkerCount = 8;
+    const size_t Iterations = 2000;
+    std::vector<size_t> Failures(WorkerCount);
+    std::vector<std::thread> Workers;
+    for (size_t i = 0; i < WorkerCount; ++i)
+    {
+        Workers.emplace_back([&, i]()
+        {
+            FakeThread Thread;
+            for (size_t j = 0; j < Iterations; ++j)
+            {
+                NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Outer;
+                NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Inner;
+                if (Enter(*Table, Outer, 1000 + i, Thread) ||
+                    Enter(*Table, Inner, 1000 + i, Thread) ||
+                    Inner.Slot != Outer.Slot ||
+                    Outer.Slot->ThreadId != 1000 + i)
+                {
+                    ++Failures[i];
+                    break;
+                }
+                Leave(*Table, Inner, Thread);
+                Leave(*Table, Outer, Thread);
+            }
+        });
+    }
+    for (std::thread& Worker : Workers)
+    {
+        Worker.join();
+    }
+
+    for (size_t Failure : Failures)
+    {
+        NSUDO_TEST_CHECK(Failure == 0);
+    }
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters;
+    ::NSudoDevilModeGetPrivilegedContextCounters(Table.get(), &Counters);
+    NSUDO_TEST_CHECK(
+        Counters.EnterCount == ThreadCount + WorkerCount * Iterations * 2);
+}
+
+NSUDO_TEST_CASE(PrivilegedContext, ThreadExit)
+{
+    std::unique_ptr<NSUDO_DEVIL_MODE_THREAD_STATE_TABLE> Table(
+        new NSUDO_DEVIL_MODE_THREAD_STATE_TABLE());
+
+    // The thread exits in a hook, the detach closes the saved token and
+    // publishes its counters.
+    FakeThread Exiting;
+    Exiting.Identity = &g_ClientIdentity;
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME Context;
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, Context, 7, Exiting));
+    NSUDO_TEST_CHECK(Exiting.Handles.size() == 1);
+
+    ::NSudoDevilModeDetachThreadState(Table.get(), 7, &Exiting.Syscalls);
+    NSUDO_TEST_CHECK(Exiting.Handles.empty());
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    // Detaching a thread without a slot does nothing.
+    ::NSudoDevilModeDetachThreadState(Table.get(), 8, &Exiting.Syscalls);
+    NSUDO_TEST_CHECK(Exiting.InvalidCloseCount == 0);
+
+    // A thread which is not detached leaves a stale slot, and a new thread
+    // with the same identifier resets it instead of nesting in it.
+    FakeThread Terminated;
+    Terminated.Identity = &g_ClientIdentity;
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, Context, 9, Terminated));
+
+    FakeThread Reused;
+    Reused.Handles = Terminated.Handles;
+    NSUDO_DEVIL_MODE_PRIVILEGED_FRAME ReusedContext;
+    NSUDO_TEST_REQUIRE(0 == Enter(*Table, ReusedContext, 9, Reused));
+    NSUDO_TEST_CHECK(ReusedContext.Slot == Context.Slot);
+    NSUDO_TEST_CHECK(ReusedContext.Slot->State.Depth == 1);
+    NSUDO_TEST_CHECK(ReusedContext.Slot->State.OriginalToken == nullptr);
+    NSUDO_TEST_CHECK(Reused.Handles.empty());
+
+    NSUDO_TEST_CHECK(0 == Leave(*Table, ReusedContext, Reused));
+    NSUDO_TEST_CHECK(Reused.Identity == nullptr);
+    NSUDO_TEST_CHECK(CountOwnedSlots(*Table) == 0);
+
+    NSUDO_DEVIL_MODE_PRIVILEGED_CONTEXT_COUNTERS Counters;
+    ::NSudoDevilModeGetPrivilegedContextCounters(Table.get(), &Counters);
+    NSUDO_TEST_CHECK(Counters.EnterCount == 3);
+}
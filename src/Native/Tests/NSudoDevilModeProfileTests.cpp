@@ -0,0 +1,229 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeProfileTests.cpp
+ * PURPOSE:   Tests for the Hook Call Profile
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeProfile.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * A zero-filled profile aligned to the cache line size.
+     */
+    struct ProfileBuffer
+    {
+        PNSUDO_DEVIL_MODE_PROFILE Profile;
+
+        ProfileBuffer(
+            uint32_t HookCount,
+            uint32_t StripeCount)
+        {
+            size_t Size = ::NSudoDevilModeGetProfileSize(
+                HookCount,
+                StripeCount);
+            Profile = reinterpret_cast<PNSUDO_DEVIL_MODE_PROFILE>(
+                std::aligned_alloc(
+                    NSUDO_DEVIL_MODE_PROFILE_CACHE_LINE_SIZE,
+                    Size));
+            if (Profile)
+            {
+                std::memset(Profile, 0, Size);
+            }
+        }
+
+        ~ProfileBuffer()
+        {
+            std::free(Profile);
+        }
+    };
+}
+
+NSUDO_TEST_CASE(Profile, Initialization)
+{
+    NSUDO_TEST_CHECK(::NSudoDevilModeGetProfileSize(3, 4) ==
+        sizeof(NSUDO_DEVIL_MODE_PROFILE) +
+        sizeof(NSUDO_DEVIL_MODE_HOOK_COUNTERS) * 12);
+
+    ProfileBuffer Buffer(3, 4);
+    NSUDO_TEST_REQUIRE(Buffer.Profile);
+
+    // The profile is not visible to the readers before it is initialized.
+    NSUDO_DEVIL_MODE_HOOK_COUNTERS Counters;
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        0,
+        &Counters));
+
+    NSUDO_TEST_CHECK(!::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        3,
+        3,
+        1000));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        3,
+        0,
+        1000));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS + 1,
+        4,
+        1000));
+
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        3,
+        4,
+        1000));
+    NSUDO_TEST_CHECK(
+        Buffer.Profile->Signature == NSUDO_DEVIL_MODE_PROFILE_SIGNATURE);
+    NSUDO_TEST_CHECK(Buffer.Profile->Frequency == 1000);
+
+    NSUDO_TEST_CHECK(::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        2,
+        &Counters));
+    NSUDO_TEST_CHECK(Counters.CallCount == 0);
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        3,
+        &Counters));
+}
+
+NSUDO_TEST_CASE(Profile, HookNames)
+{
+    ProfileBuffer Buffer(2, 1);
+    NSUDO_TEST_REQUIRE(Buffer.Profile);
+
+    ::NSudoDevilModeSetProfileHookName(Buffer.Profile, 0, "NtOpenKeyEx");
+    ::NSudoDevilModeSetProfileHookName(
+        Buffer.Profile,
+        1,
+        "ANameWhichIsLongerThanTheSlotInTheProfile");
+    ::NSudoDevilModeSetProfileHookName(
+        Buffer.Profile,
+        NSUDO_DEVIL_MODE_PROFILE_MAXIMUM_HOOKS,
+        "Ignored");
+
+    NSUDO_TEST_CHECK(0 == std::strcmp(
+        Buffer.Profile->HookNames[0],
+        "NtOpenKeyEx"));
+    NSUDO_TEST_CHECK(NSUDO_DEVIL_MODE_PROFILE_HOOK_NAME_SIZE - 1 ==
+        std::strlen(Buffer.Profile->HookNames[1]));
+    NSUDO_TEST_CHECK(0 == std::strncmp(
+        Buffer.Profile->HookNames[1],
+        "ANameWhichIsLonger",
+        18));
+}
+
+NSUDO_TEST_CASE(Profile, Histogram)
+{
+    ProfileBuffer Buffer(2, 8);
+    NSUDO_TEST_REQUIRE(Buffer.Profile);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        2,
+        8,
+        1000));
+
+    // The calls are spread across the rows by the thread identifiers.
+    const uint64_t Ticks[] = { 0, 1, 2, 3, 4, 1000, ~0ull >> 1 };
+    for (size_t i = 0; i < sizeof(Ticks) / sizeof(*Ticks); ++i)
+    {
+        ::NSudoDevilModeRecordHookCall(
+            Buffer.Profile,
+            1,
+            static_cast<uint32_t>(i * 4),
+            Ticks[i],
+            i == 0);
+    }
+    ::NSudoDevilModeRecordHookCall(Buffer.Profile, 2, 0, 1, false);
+
+    NSUDO_DEVIL_MODE_HOOK_COUNTERS Counters;
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        1,
+        &Counters));
+    NSUDO_TEST_CHECK(Counters.CallCount == 7);
+    NSUDO_TEST_CHECK(Counters.ContextFailureCount == 1);
+    NSUDO_TEST_CHECK(Counters.TotalTicks == 1010 + (~0ull >> 1));
+
+    NSUDO_TEST_CHECK(Counters.Histogram[0] == 1);
+    NSUDO_TEST_CHECK(Counters.Histogram[1] == 1);
+    NSUDO_TEST_CHECK(Counters.Histogram[2] == 2);
+    NSUDO_TEST_CHECK(Counters.Histogram[3] == 1);
+    NSUDO_TEST_CHECK(Counters.Histogram[10] == 1);
+    NSUDO_TEST_CHECK(
+        Counters.Histogram[NSUDO_DEVIL_MODE_PROFILE_HISTOGRAM_BUCKETS - 1]
+        == 1);
+
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        0,
+        &Counters));
+    NSUDO_TEST_CHECK(Counters.CallCount == 0);
+}
+
+NSUDO_TEST_CASE(Profile, ConcurrentRecording)
+{
+    const uint32_t ThreadCount = 8;
+    const uint32_t CallCount = 20000;
+
+    ProfileBuffer Buffer(1, 4);
+    NSUDO_TEST_REQUIRE(Buffer.Profile);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInitializeProfile(
+        Buffer.Profile,
+        1,
+        4,
+        1000));
+
+    // More threads than rows, so the rows are shared.
+    std::vector<std::thread> Threads;
+    for (uint32_t i = 0; i < ThreadCount; ++i)
+    {
+        Threads.emplace_back([&Buffer, i, CallCount]()
+        {
+            for (uint32_t j = 0; j < CallCount; ++j)
+            {
+                ::NSudoDevilModeRecordHookCall(
+                    Buffer.Profile,
+                    0,
+                    i * 4,
+                    j & 7,
+                    false);
+            }
+        });
+    }
+
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+
+    NSUDO_DEVIL_MODE_HOOK_COUNTERS Counters;
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeAggregateHookCounters(
+        Buffer.Profile,
+        0,
+        &Counters));
+    NSUDO_TEST_CHECK(Counters.CallCount == ThreadCount * CallCount);
+    NSUDO_TEST_CHECK(Counters.TotalTicks == ThreadCount * CallCount / 8 * 28);
+
+    uint64_t HistogramSum = 0;
+    for (uint32_t Count : Counters.Histogram)
+    {
+        HistogramSum += Count;
+    }
+    NSUDO_TEST_CHECK(HistogramSum == Counters.CallCount);
+}
@@ -0,0 +1,201 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeRelocationTests.cpp
+ * PURPOSE:   Tests for the x86 and x64 Instruction Relocation Engine
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeRelocation.h>
+
+#include <vector>
+
+namespace
+{
+    const uint64_t SourceAddress = 0x1000;
+    const uint64_t DestinationAddress = 0x2000;
+
+    /**
+     * Plans the relocation of a window for a 5-byte jump.
+     */
+    NSUDO_DEVIL_MODE_RELOCATION_STATUS Plan(
+        const std::vector<uint8_t>& Code,
+        bool Is64Bit,
+        PNSUDO_DEVIL_MODE_RELOCATION Relocation,
+        uint64_t Destination = DestinationAddress)
+    {
+        return ::NSudoDevilModePlanRelocation(
+            Code.data(),
+            Code.size(),
+            SourceAddress,
+            Destination,
+            5,
+            Is64Bit,
+            Relocation);
+    }
+
+    /**
+     * Plans and emits the relocation of a window for a 5-byte jump.
+     */
+    std::vector<uint8_t> Relocate(
+        const std::vector<uint8_t>& Code,
+        bool Is64Bit,
+        uint64_t Destination = DestinationAddress)
+    {
+        NSUDO_DEVIL_MODE_RELOCATION Relocation;
+        if (NSudoDevilModeRelocationSuccess != Plan(
+            Code,
+            Is64Bit,
+            &Relocation,
+            Destination))
+        {
+            return std::vector<uint8_t>();
+        }
+
+        std::vector<uint8_t> Result(Relocation.DestinationSize);
+        if (NSudoDevilModeRelocationSuccess != ::NSudoDevilModeEmitRelocation(
+            &Relocation,
+            Code.data(),
+            Result.data(),
+            Result.size()))
+        {
+            return std::vector<uint8_t>();
+        }
+
+        return Result;
+    }
+}
+
+NSUDO_TEST_CASE(Relocation, PlainInstructions)
+{
+    // mov [rsp+8], rbx ; push rdi
+    std::vector<uint8_t> Code = { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x57 };
+
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+    NSUDO_TEST_REQUIRE(NSudoDevilModeRelocationSuccess == Plan(
+        Code,
+        true,
+        &Relocation));
+    NSUDO_TEST_CHECK(Relocation.InstructionCount == 1);
+    NSUDO_TEST_CHECK(Relocation.SourceSize == 5);
+    NSUDO_TEST_CHECK(Relocation.DestinationSize == 5);
+
+    NSUDO_TEST_CHECK(Relocate(Code, true) == std::vector<uint8_t>(
+        Code.begin(),
+        Code.begin() + 5));
+
+    uint8_t Small[4];
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationBufferTooSmall ==
+        ::NSudoDevilModeEmitRelocation(
+            &Relocation,
+            Code.data(),
+            Small,
+            sizeof(Small)));
+}
+
+NSUDO_TEST_CASE(Relocation, EnlargedShortJumps)
+{
+    // jmp +0x10, the target moves by -0x1000 relative to the trampoline.
+    NSUDO_TEST_CHECK(Relocate({ 0xEB, 0x10, 0x90, 0x90, 0x90 }, true) ==
+        std::vector<uint8_t>({ 0xE9, 0x0D, 0xF0, 0xFF, 0xFF }));
+
+    // je +7 ; mov rax, [rip+0x10]
+    NSUDO_TEST_CHECK(Relocate(
+        { 0x74, 0x07, 0x48, 0x8B, 0x05, 0x10, 0x00, 0x00, 0x00 },
+        true) == std::vector<uint8_t>({
+            0x0F, 0x84, 0x03, 0xF0, 0xFF, 0xFF,
+            0x48, 0x8B, 0x05, 0x0C, 0xF0, 0xFF, 0xFF }));
+
+    // The segment prefixes are kept when a Jcc is enlarged.
+    NSUDO_TEST_CHECK(Relocate(
+        { 0x3E, 0x74, 0x10, 0x90, 0x90, 0x90 },
+        true) == std::vector<uint8_t>({
+            0x3E, 0x0F, 0x84, 0x0C, 0xF0, 0xFF, 0xFF, 0x90, 0x90 }));
+}
+
+NSUDO_TEST_CASE(Relocation, OperandSizePrefixedShortJumps)
+{
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+
+    // 66 0F 8x is a rel16 Jcc, so the enlarged branch would be truncated.
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidBranch == Plan(
+        { 0x66, 0x74, 0x10, 0x90, 0x90, 0x90 },
+        false,
+        &Relocation));
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidBranch == Plan(
+        { 0x66, 0x74, 0x10, 0x90, 0x90, 0x90 },
+        true,
+        &Relocation));
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidBranch == Plan(
+        { 0x66, 0xEB, 0x10, 0x90, 0x90, 0x90 },
+        true,
+        &Relocation));
+
+    // The 16-bit near Jcc is rejected as it is.
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidBranch == Plan(
+        { 0x66, 0x0F, 0x84, 0x10, 0x00, 0x90 },
+        false,
+        &Relocation));
+}
+
+NSUDO_TEST_CASE(Relocation, BranchesIntoTheWindow)
+{
+    // jne to the next instruction is redirected to the relocated copy.
+    NSUDO_TEST_CHECK(Relocate(
+        { 0x75, 0x00, 0x48, 0x89, 0xC8, 0xC3 },
+        true) == std::vector<uint8_t>({
+            0x0F, 0x85, 0x00, 0x00, 0x00, 0x00, 0x48, 0x89, 0xC8 }));
+
+    // A branch into the middle of a moved instruction cannot be relocated.
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidBranch == Plan(
+        { 0x75, 0x01, 0x48, 0x89, 0xC8, 0x90, 0x90 },
+        true,
+        &Relocation));
+}
+
+NSUDO_TEST_CASE(Relocation, Terminators)
+{
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+
+    // The padding after a return is consumed but not copied.
+    NSUDO_TEST_REQUIRE(NSudoDevilModeRelocationSuccess == Plan(
+        { 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC },
+        true,
+        &Relocation));
+    NSUDO_TEST_CHECK(Relocation.SourceSize == 5);
+    NSUDO_TEST_CHECK(Relocation.DestinationSize == 1);
+
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationTooSmall == Plan(
+        { 0xC3, 0x55, 0x55, 0x55, 0x55 },
+        true,
+        &Relocation));
+    NSUDO_TEST_CHECK(Relocation.InstructionCount == 1);
+}
+
+NSUDO_TEST_CASE(Relocation, Ranges)
+{
+    NSUDO_DEVIL_MODE_RELOCATION Relocation;
+
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationOutOfRange == Plan(
+        { 0xE8, 0x00, 0x00, 0x00, 0x00, 0x90 },
+        true,
+        &Relocation,
+        0x100000000ULL));
+
+    // The x86 addresses wrap around at 4 GiB.
+    NSUDO_TEST_CHECK(Relocate(
+        { 0xE8, 0x10, 0x00, 0x00, 0x00, 0x90 },
+        false,
+        0xFFFFF000ULL) == std::vector<uint8_t>({
+            0xE8, 0x10, 0x20, 0x00, 0x00 }));
+
+    NSUDO_TEST_CHECK(NSudoDevilModeRelocationInvalidInstruction == Plan(
+        { 0x48, 0x89, 0x5C },
+        true,
+        &Relocation));
+}
@@ -0,0 +1,314 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoDevilModeTrampolineAllocatorTests.cpp
+ * PURPOSE:   Tests for the Trampoline Region Allocator
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoDevilModeTrampolineAllocator.h>
+
+#include <cstdlib>
+#include <set>
+
+namespace
+{
+    const size_t RegionSize = 0x1000;
+    const size_t SlotSize = 64;
+    const size_t RegionCount = 4;
+
+    /**
+     * The counters of the memory operations, the regions are carved from a
+     * heap block owned by the test, so they are never really released.
+     */
+    struct MemoryOperations
+    {
+        size_t WritableCount;
+        size_t ExecutableCount;
+        size_t ReleaseCount;
+        bool FailWritable;
+    };
+
+    bool MakeWritable(
+        void* Context,
+        void* Region,
+        size_t Size)
+    {
+        (void)Region;
+        (void)Size;
+
+        MemoryOperations* Operations =
+            reinterpret_cast<MemoryOperations*>(Context);
+        if (Operations->FailWritable)
+        {
+            return false;
+        }
+
+        ++Operations->WritableCount;
+        return true;
+    }
+
+    void MakeExecutable(
+        void* Context,
+        void* Region,
+        size_t Size)
+    {
+        (void)Region;
+        (void)Size;
+
+        ++reinterpret_cast<MemoryOperations*>(Context)->ExecutableCount;
+    }
+
+    void Release(
+        void* Context,
+        void* Region,
+        size_t Size)
+    {
+        (void)Region;
+        (void)Size;
+
+        ++reinterpret_cast<MemoryOperations*>(Context)->ReleaseCount;
+    }
+
+    struct Fixture
+    {
+        MemoryOperations Operations = {};
+        NSUDO_DEVIL_MODE_TRAMPOLINE_REGION_CALLBACKS Callbacks = {};
+        NSUDO_DEVIL_MODE_TRAMPOLINE_ALLOCATOR Allocator;
+        uint8_t* Memory = nullptr;
+
+        Fixture()
+        {
+            Callbacks.Context = &Operations;
+            Callbacks.MakeWritable = MakeWritable;
+            Callbacks.MakeExecutable = MakeExecutable;
+            Callbacks.Release = Release;
+
+            Memory = reinterpret_cast<uint8_t*>(
+                std::aligned_alloc(RegionSize, RegionSize * RegionCount));
+
+            ::NSudoDevilModeInitializeTrampolineAllocator(
+                &Allocator,
+                RegionSize,
+                SlotSize,
+                &Callbacks);
+        }
+
+        ~Fixture()
+        {
+            std::free(Memory);
+        }
+
+        void* GetRegion(
+            size_t Index)
+        {
+            return Memory + RegionSize * Index;
+        }
+
+        uintptr_t GetAddress(
+            size_t Index)
+        {
+            return reinterpret_cast<uintptr_t>(GetRegion(Index));
+        }
+    };
+}
+
+NSUDO_TEST_CASE(TrampolineAllocator, FillsRegions)
+{
+    Fixture Test;
+    NSUDO_TEST_REQUIRE(Test.Memory);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+        &Test.Allocator,
+        Test.GetRegion(0)));
+    NSUDO_TEST_CHECK(Test.Allocator.RegionCount == 1);
+    NSUDO_TEST_CHECK(Test.Allocator.SlotCount == RegionSize / SlotSize - 1);
+
+    uintptr_t Lower = Test.GetAddress(0);
+    uintptr_t Upper = Test.GetAddress(RegionCount);
+
+    std::set<uintptr_t> Slots;
+    for (uint32_t i = 0; i < Test.Allocator.SlotCount; ++i)
+    {
+        uintptr_t Slot = reinterpret_cast<uintptr_t>(
+            ::NSudoDevilModeAllocateTrampoline(
+                &Test.Allocator,
+                Lower,
+                Upper,
+                Lower));
+        NSUDO_TEST_REQUIRE(Slot);
+
+        // The first slot of the region holds its header.
+        NSUDO_TEST_CHECK(Slot >= Lower + SlotSize);
+        NSUDO_TEST_CHECK(Slot + SlotSize <= Lower + RegionSize);
+        NSUDO_TEST_CHECK(Slots.insert(Slot).second);
+    }
+
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAllocateTrampoline(
+        &Test.Allocator,
+        Lower,
+        Upper,
+        Lower));
+
+    // The new region is already writable, so it is only made executable.
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, false);
+    NSUDO_TEST_CHECK(Test.Operations.WritableCount == 0);
+    NSUDO_TEST_CHECK(Test.Operations.ExecutableCount == 1);
+}
+
+NSUDO_TEST_CASE(TrampolineAllocator, ReusesFreedSlots)
+{
+    Fixture Test;
+    NSUDO_TEST_REQUIRE(Test.Memory);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+        &Test.Allocator,
+        Test.GetRegion(1)));
+
+    void* First = ::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(1));
+    void* Second = ::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(1));
+    NSUDO_TEST_REQUIRE(First && Second && First != Second);
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, true);
+
+    uint8_t* Bytes = reinterpret_cast<uint8_t*>(First);
+    for (size_t i = 0; i < SlotSize; ++i)
+    {
+        Bytes[i] = 0xCC;
+    }
+
+    // Each region is made writable once in a batch.
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFreeTrampoline(
+        &Test.Allocator,
+        First));
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFreeTrampoline(
+        &Test.Allocator,
+        Second));
+    NSUDO_TEST_CHECK(Test.Operations.WritableCount == 1);
+
+    bool Cleared = true;
+    for (size_t i = sizeof(void*); i < SlotSize; ++i)
+    {
+        Cleared = Cleared && !Bytes[i];
+    }
+    NSUDO_TEST_CHECK(Cleared);
+
+    // The freed slots are reused in the reverse order.
+    NSUDO_TEST_CHECK(Second == ::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(1)));
+    NSUDO_TEST_CHECK(First == ::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(1)));
+    NSUDO_TEST_CHECK(Test.Operations.WritableCount == 1);
+}
+
+NSUDO_TEST_CASE(TrampolineAllocator, ReleasesEmptyRegions)
+{
+    Fixture Test;
+    NSUDO_TEST_REQUIRE(Test.Memory);
+    for (size_t i = 0; i < RegionCount; ++i)
+    {
+        NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+            &Test.Allocator,
+            Test.GetRegion(i)));
+    }
+
+    void* Slot = ::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(2));
+    NSUDO_TEST_REQUIRE(Slot);
+
+    // Only the regions changed in the batch are released.
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, true);
+    NSUDO_TEST_CHECK(Test.Operations.ReleaseCount == RegionCount - 1);
+    NSUDO_TEST_CHECK(Test.Operations.ExecutableCount == 1);
+    NSUDO_TEST_CHECK(Test.Allocator.RegionCount == 1);
+
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFreeTrampoline(
+        &Test.Allocator,
+        Slot));
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, false);
+    NSUDO_TEST_CHECK(Test.Allocator.RegionCount == 1);
+
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeFreeTrampoline(
+        &Test.Allocator,
+        ::NSudoDevilModeAllocateTrampolineFromRegion(
+            &Test.Allocator,
+            Test.GetRegion(2))));
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, true);
+    NSUDO_TEST_CHECK(Test.Operations.ReleaseCount == RegionCount);
+    NSUDO_TEST_CHECK(Test.Allocator.RegionCount == 0);
+
+    for (size_t i = 0; i < NSUDO_DEVIL_MODE_MAXIMUM_TRAMPOLINE_WINDOWS; ++i)
+    {
+        NSUDO_TEST_CHECK(!Test.Allocator.Windows[i].FirstAvailable);
+        NSUDO_TEST_CHECK(!Test.Allocator.Windows[i].LastAvailable);
+    }
+}
+
+NSUDO_TEST_CASE(TrampolineAllocator, HonorsRanges)
+{
+    Fixture Test;
+    NSUDO_TEST_REQUIRE(Test.Memory);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+        &Test.Allocator,
+        Test.GetRegion(0)));
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+        &Test.Allocator,
+        Test.GetRegion(2)));
+
+    // Only the second region is in the range.
+    uintptr_t Slot = reinterpret_cast<uintptr_t>(
+        ::NSudoDevilModeAllocateTrampoline(
+            &Test.Allocator,
+            Test.GetAddress(1),
+            Test.GetAddress(RegionCount),
+            Test.GetAddress(0)));
+    NSUDO_TEST_CHECK(Slot - Test.GetAddress(2) < RegionSize);
+
+    // The range should contain the whole region.
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAllocateTrampoline(
+        &Test.Allocator,
+        Test.GetAddress(1),
+        Test.GetAddress(3) - 1,
+        Test.GetAddress(2)));
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAllocateTrampoline(
+        &Test.Allocator,
+        Test.GetAddress(0) + 1,
+        Test.GetAddress(2),
+        Test.GetAddress(0)));
+
+    Slot = reinterpret_cast<uintptr_t>(::NSudoDevilModeAllocateTrampoline(
+        &Test.Allocator,
+        Test.GetAddress(0),
+        Test.GetAddress(1),
+        Test.GetAddress(0)));
+    NSUDO_TEST_CHECK(Slot - Test.GetAddress(0) < RegionSize);
+}
+
+NSUDO_TEST_CASE(TrampolineAllocator, WritableFailures)
+{
+    Fixture Test;
+    NSUDO_TEST_REQUIRE(Test.Memory);
+    NSUDO_TEST_REQUIRE(::NSudoDevilModeInsertTrampolineRegion(
+        &Test.Allocator,
+        Test.GetRegion(0)));
+    ::NSudoDevilModeCommitTrampolineRegions(&Test.Allocator, false);
+
+    Test.Operations.FailWritable = true;
+    NSUDO_TEST_CHECK(!::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(0)));
+
+    Test.Operations.FailWritable = false;
+    NSUDO_TEST_CHECK(::NSudoDevilModeAllocateTrampolineFromRegion(
+        &Test.Allocator,
+        Test.GetRegion(0)));
+    NSUDO_TEST_CHECK(Test.Operations.WritableCount == 1);
+}
@@ -0,0 +1,126 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperConfigurationCoreTests.cpp
+ * PURPOSE:   Tests for the Cleanup Handler Configuration Lookup
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperConfigurationCore.h>
+
+#include <string>
+
+namespace
+{
+    const wchar_t Configuration[] =
+        L"# Temporary Folder cleanup handler.\r\n"
+        L"[Metadata]\r\n"
+        L"    [en]\r\n"
+        L"    Name = \"Temporary Folder\"\r\n"
+        L"\r\n"
+        L"[Configuration]\r\n"
+        L"Plugin = \"NSudoSweeperCore.dll\"\r\n"
+        L"OfflineImageSupport = false # Not tested yet.\r\n"
+        L"OfflinePath = \"%SystemRoot%\\\\Temp\\\\\\\"Quoted\\\"\"\r\n"
+        L"LiteralPath = 'C:\\Temp'\r\n"
+        L"OfflinePathSuffix = \"Ignored\"\r\n"
+        L"Broken = \"Unterminated\r\n"
+        L"Escape = \"\\q\"\r\n"
+        L"Trailing = true false\r\n"
+        L"Include = [\r\n"
+        L"    \"File|C:\\\\NSudo\"\r\n"
+        L"]\r\n"
+        L"Last=1";
+}
+
+NSUDO_TEST_CASE(SweeperConfiguration, ReadsStrings)
+{
+    std::wstring Value;
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Name",
+        Value));
+    NSUDO_TEST_CHECK(Value == L"Temporary Folder");
+
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"OfflinePath",
+        Value));
+    NSUDO_TEST_CHECK(Value == L"%SystemRoot%\\Temp\\\"Quoted\"");
+
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"LiteralPath",
+        Value));
+    NSUDO_TEST_CHECK(Value == L"C:\\Temp");
+
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Last",
+        Value));
+    NSUDO_TEST_CHECK(Value == L"1");
+}
+
+NSUDO_TEST_CASE(SweeperConfiguration, RejectsInvalidValues)
+{
+    std::wstring Value = L"Unchanged";
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Broken",
+        Value));
+    NSUDO_TEST_CHECK(Value.empty());
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Escape",
+        Value));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Trailing",
+        Value));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Include",
+        Value));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Missing",
+        Value));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        Configuration,
+        L"Offline",
+        Value));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationValue(
+        nullptr,
+        L"Name",
+        Value));
+}
+
+NSUDO_TEST_CASE(SweeperConfiguration, ReadsBooleans)
+{
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationBoolean(
+        Configuration,
+        L"OfflineImageSupport",
+        true));
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationBoolean(
+        L"OfflineImageSupport=true",
+        L"OfflineImageSupport",
+        false));
+
+    // The missing keys and the other values use the default value.
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationBoolean(
+        Configuration,
+        L"Missing",
+        true));
+    NSUDO_TEST_CHECK(::NSudoSweeperGetConfigurationBoolean(
+        Configuration,
+        L"Name",
+        true));
+    NSUDO_TEST_CHECK(!::NSudoSweeperGetConfigurationBoolean(
+        L"OfflineImageSupport = \"true\"",
+        L"OfflineImageSupport",
+        false));
+}
@@ -0,0 +1,386 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperDeletionCoreTests.cpp
+ * PURPOSE:   Tests for the Batched Deletion Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperDeletionCore.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /**
+     * A list of paths with the pointer array used by the scheduler.
+     */
+    struct FileList
+    {
+        std::vector<std::wstring> Names;
+        std::vector<const wchar_t*> Pointers;
+
+        void Add(
+            const std::wstring& Name)
+        {
+            this->Names.push_back(Name);
+        }
+
+        const wchar_t* const* Get()
+        {
+            this->Pointers.clear();
+            for (const std::wstring& Name : this->Names)
+            {
+                this->Pointers.push_back(Name.c_str());
+            }
+            return this->Pointers.data();
+        }
+    };
+
+    /**
+     * A backend which deletes nothing. The files whose names contain "busy"
+     * are retryable until they are retried BusyPasses times, the files whose
+     * names contain "fail" are failed.
+     */
+    struct FakeBackend
+    {
+        std::unique_ptr<std::atomic<uint32_t>[]> Calls;
+        const wchar_t* const* FileNames;
+        size_t FileCount;
+        uint32_t BusyPasses;
+        std::atomic<uint32_t> RetryPassCalls;
+        std::atomic<uint32_t> ReportCount;
+        uint32_t CancelAfterReports;
+        uint32_t DeleteDelay;
+
+        FakeBackend(
+            const wchar_t* const* FileNames,
+            size_t FileCount) :
+            Calls(new std::atomic<uint32_t>[FileCount]),
+            FileNames(FileNames),
+            FileCount(FileCount),
+            BusyPasses(0),
+            RetryPassCalls(0),
+            ReportCount(0),
+            CancelAfterReports(0),
+            DeleteDelay(0)
+        {
+            for (size_t i = 0; i < FileCount; ++i)
+            {
+                this->Calls[i] = 0;
+            }
+        }
+
+        static NSUDO_SWEEPER_DELETION_RESULT RemoveFile(
+            void* Context,
+            const wchar_t* FileName,
+            bool RetryPass,
+            uint64_t* FreedSize)
+        {
+            FakeBackend* Self = static_cast<FakeBackend*>(Context);
+
+            *FreedSize = 0;
+
+            size_t Index = 0;
+            while (Self->FileNames[Index] != FileName)
+            {
+                ++Index;
+            }
+            uint32_t Call = ++Self->Calls[Index];
+
+            if (RetryPass)
+            {
+                ++Self->RetryPassCalls;
+            }
+
+            if (Self->DeleteDelay)
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(Self->DeleteDelay));
+            }
+
+            std::wstring Name(FileName);
+            if (Name.find(L"fail") != std::wstring::npos)
+            {
+                return NSudoSweeperDeletionFailed;
+            }
+            if (Name.find(L"busy") != std::wstring::npos &&
+                Call <= Self->BusyPasses)
+            {
+                return NSudoSweeperDeletionRetryable;
+            }
+
+            *FreedSize = 100;
+            return NSudoSweeperDeletionDeleted;
+        }
+
+        static bool ReportProgress(
+            void* Context,
+            uint64_t ProcessedFileCount,
+            uint64_t FileCount,
+            uint64_t FreedSize)
+        {
+            FakeBackend* Self = static_cast<FakeBackend*>(Context);
+
+            NSUDO_TEST_CHECK(ProcessedFileCount <= FileCount);
+            NSUDO_TEST_CHECK(FreedSize <= FileCount * 100);
+
+            uint32_t Count = ++Self->ReportCount;
+            return !Self->CancelAfterReports ||
+                Count < Self->CancelAfterReports;
+        }
+
+        NSUDO_SWEEPER_DELETION_BACKEND Get()
+        {
+            NSUDO_SWEEPER_DELETION_BACKEND Backend = {};
+            Backend.Context = this;
+            Backend.RemoveFile = FakeBackend::RemoveFile;
+            Backend.ReportProgress = FakeBackend::ReportProgress;
+            return Backend;
+        }
+    };
+
+    NSUDO_SWEEPER_DELETION_OPTIONS MakeOptions(
+        uint32_t LaneCount,
+        size_t BatchSize)
+    {
+        NSUDO_SWEEPER_DELETION_OPTIONS Options = {};
+        Options.LaneCount = LaneCount;
+        Options.BatchSize = BatchSize;
+        Options.RetryPassCount = 3;
+        Options.RetryDelay = 1;
+        Options.ReportInterval = 1;
+        return Options;
+    }
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, ParentDirectoryLength)
+{
+    NSUDO_TEST_CHECK(::NSudoSweeperGetParentDirectoryLength(
+        L"C:\\Windows\\Temp\\a.tmp") == 15);
+    NSUDO_TEST_CHECK(::NSudoSweeperGetParentDirectoryLength(
+        L"/tmp/sweeper/a.tmp") == 12);
+    NSUDO_TEST_CHECK(::NSudoSweeperGetParentDirectoryLength(
+        L"a.tmp") == 0);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, SortsByDirectory)
+{
+    FileList Files;
+    Files.Add(L"C:\\Temp\\B\\1.tmp");
+    Files.Add(L"C:\\Temp\\a\\2.tmp");
+    Files.Add(L"C:\\Temp\\b\\3.tmp");
+    Files.Add(L"C:\\Temp\\A\\4.tmp");
+    Files.Add(L"C:\\Temp\\5.tmp");
+    const wchar_t* const* Names = Files.Get();
+
+    std::vector<size_t> Items = { 0, 1, 2, 3, 4 };
+    ::NSudoSweeperSortDeletionItems(Names, Items);
+
+    // The parent directories are compared case-insensitively, and the files
+    // of a directory are adjacent.
+    std::vector<NSUDO_SWEEPER_DELETION_BATCH> Batches;
+    ::NSudoSweeperBuildDeletionBatches(Names, Items, 0, Batches);
+    NSUDO_TEST_REQUIRE(Batches.size() == 3);
+    NSUDO_TEST_CHECK(Items[0] == 4);
+    NSUDO_TEST_CHECK(Batches[0].Begin == 0 && Batches[0].End == 1);
+    NSUDO_TEST_CHECK(Batches[1].Begin == 1 && Batches[1].End == 3);
+    NSUDO_TEST_CHECK(Batches[2].Begin == 3 && Batches[2].End == 5);
+    NSUDO_TEST_CHECK(Items[1] == 1 || Items[1] == 3);
+    NSUDO_TEST_CHECK(Items[3] == 0 || Items[3] == 2);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, SplitsLargeDirectories)
+{
+    FileList Files;
+    for (int i = 0; i < 5; ++i)
+    {
+        Files.Add(L"/tmp/large/" + std::to_wstring(i));
+    }
+    Files.Add(L"/tmp/small/0");
+    const wchar_t* const* Names = Files.Get();
+
+    std::vector<size_t> Items = { 0, 1, 2, 3, 4, 5 };
+    ::NSudoSweeperSortDeletionItems(Names, Items);
+
+    std::vector<NSUDO_SWEEPER_DELETION_BATCH> Batches;
+    ::NSudoSweeperBuildDeletionBatches(Names, Items, 2, Batches);
+    NSUDO_TEST_REQUIRE(Batches.size() == 4);
+    NSUDO_TEST_CHECK(Batches[0].End - Batches[0].Begin == 2);
+    NSUDO_TEST_CHECK(Batches[1].End - Batches[1].Begin == 2);
+    NSUDO_TEST_CHECK(Batches[2].End - Batches[2].Begin == 1);
+    NSUDO_TEST_CHECK(Batches[3].End - Batches[3].Begin == 1);
+    NSUDO_TEST_CHECK(Items[5] == 5);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, DeletesEachFileOnce)
+{
+    FileList Files;
+    for (int Directory = 0; Directory < 50; ++Directory)
+    {
+        for (int i = 0; i < 40; ++i)
+        {
+            Files.Add(
+                L"/tmp/" + std::to_wstring(Directory) +
+                L"/" + std::to_wstring(i));
+        }
+    }
+    const wchar_t* const* Names = Files.Get();
+    const size_t Count = Files.Names.size();
+
+    Mile::ThreadPool Pool(4);
+    FakeBackend Fake(Names, Count);
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = Fake.Get();
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = MakeOptions(0, 16);
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+    NSUDO_TEST_CHECK(::NSudoSweeperRunDeletion(
+        Names,
+        Count,
+        Pool,
+        &Options,
+        &Backend,
+        &Counters) == NSudoSweeperDeletionCompleted);
+
+    for (size_t i = 0; i < Count; ++i)
+    {
+        NSUDO_TEST_CHECK(Fake.Calls[i] == 1);
+    }
+    NSUDO_TEST_CHECK(Counters.DeletedFileCount == Count);
+    NSUDO_TEST_CHECK(Counters.FreedSize == Count * 100);
+    NSUDO_TEST_CHECK(Counters.RetriedFileCount == 0);
+    NSUDO_TEST_CHECK(Counters.FailedFileCount == 0);
+    NSUDO_TEST_CHECK(Fake.RetryPassCalls == 0);
+
+    // The final progress is always reported.
+    NSUDO_TEST_CHECK(Fake.ReportCount >= 1);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, RetriesBusyFiles)
+{
+    FileList Files;
+    Files.Add(L"/tmp/a/busy");
+    Files.Add(L"/tmp/a/free");
+    Files.Add(L"/tmp/b/busy");
+    const wchar_t* const* Names = Files.Get();
+
+    Mile::ThreadPool Pool(2);
+    FakeBackend Fake(Names, 3);
+    Fake.BusyPasses = 2;
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = Fake.Get();
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = MakeOptions(0, 0);
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+    NSUDO_TEST_CHECK(::NSudoSweeperRunDeletion(
+        Names,
+        3,
+        Pool,
+        &Options,
+        &Backend,
+        &Counters) == NSudoSweeperDeletionCompleted);
+
+    // The busy files are deleted by the second retry pass.
+    NSUDO_TEST_CHECK(Fake.Calls[0] == 3);
+    NSUDO_TEST_CHECK(Fake.Calls[1] == 1);
+    NSUDO_TEST_CHECK(Fake.Calls[2] == 3);
+    NSUDO_TEST_CHECK(Fake.RetryPassCalls == 4);
+    NSUDO_TEST_CHECK(Counters.DeletedFileCount == 3);
+    NSUDO_TEST_CHECK(Counters.RetriedFileCount == 2);
+    NSUDO_TEST_CHECK(Counters.FailedFileCount == 0);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, ReportsPartialCompletion)
+{
+    FileList Files;
+    Files.Add(L"/tmp/a/busy");
+    Files.Add(L"/tmp/a/fail");
+    Files.Add(L"/tmp/a/free");
+    const wchar_t* const* Names = Files.Get();
+
+    Mile::ThreadPool Pool(2);
+    FakeBackend Fake(Names, 3);
+    Fake.BusyPasses = 100;
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = Fake.Get();
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = MakeOptions(0, 0);
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+    NSUDO_TEST_CHECK(::NSudoSweeperRunDeletion(
+        Names,
+        3,
+        Pool,
+        &Options,
+        &Backend,
+        &Counters) == NSudoSweeperDeletionPartiallyCompleted);
+
+    // The failed file is not retried, the busy file is failed after the last
+    // retry pass.
+    NSUDO_TEST_CHECK(Fake.Calls[0] == 1 + Options.RetryPassCount);
+    NSUDO_TEST_CHECK(Fake.Calls[1] == 1);
+    NSUDO_TEST_CHECK(Counters.DeletedFileCount == 1);
+    NSUDO_TEST_CHECK(Counters.RetriedFileCount == 1);
+    NSUDO_TEST_CHECK(Counters.FailedFileCount == 2);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, CancelsFromProgress)
+{
+    FileList Files;
+    for (int i = 0; i < 200; ++i)
+    {
+        Files.Add(L"/tmp/busy/" + std::to_wstring(i));
+    }
+    const wchar_t* const* Names = Files.Get();
+
+    Mile::ThreadPool Pool(2);
+    FakeBackend Fake(Names, 200);
+    Fake.BusyPasses = 1;
+    Fake.DeleteDelay = 1;
+    Fake.CancelAfterReports = 3;
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = Fake.Get();
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = MakeOptions(1, 0);
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+    NSUDO_TEST_CHECK(::NSudoSweeperRunDeletion(
+        Names,
+        200,
+        Pool,
+        &Options,
+        &Backend,
+        &Counters) == NSudoSweeperDeletionCancelled);
+
+    // The lane stops at the next file and the retry lane is skipped.
+    uint32_t Processed = 0;
+    for (size_t i = 0; i < 200; ++i)
+    {
+        Processed += Fake.Calls[i];
+    }
+    NSUDO_TEST_CHECK(Processed < 200);
+    NSUDO_TEST_CHECK(Fake.RetryPassCalls == 0);
+    NSUDO_TEST_CHECK(Counters.FailedFileCount == 0);
+}
+
+NSUDO_TEST_CASE(SweeperDeletion, EmptyList)
+{
+    Mile::ThreadPool Pool(1);
+    FakeBackend Fake(nullptr, 0);
+    NSUDO_SWEEPER_DELETION_BACKEND Backend = Fake.Get();
+    NSUDO_SWEEPER_DELETION_OPTIONS Options = MakeOptions(0, 0);
+
+    NSUDO_SWEEPER_DELETION_COUNTERS Counters = {};
+    NSUDO_TEST_CHECK(::NSudoSweeperRunDeletion(
+        nullptr,
+        0,
+        Pool,
+        &Options,
+        &Backend,
+        &Counters) == NSudoSweeperDeletionCompleted);
+    NSUDO_TEST_CHECK(Counters.DeletedFileCount == 0);
+}
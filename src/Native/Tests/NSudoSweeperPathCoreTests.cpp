@@ -0,0 +1,181 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperPathCoreTests.cpp
+ * PURPOSE:   Tests for the Offline Image Path Resolution
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperPathCore.h>
+
+#include <string>
+
+namespace
+{
+    const wchar_t SessionRootPath[] = L"C:\\Image\\";
+
+    NSUDO_SWEEPER_PATH_STATUS Resolve(
+        const wchar_t* Path,
+        std::wstring& ResolvedPath)
+    {
+        return ::NSudoSweeperResolveOfflinePath(
+            SessionRootPath,
+            Path,
+            ResolvedPath);
+    }
+
+    bool ResolvesTo(
+        const wchar_t* Path,
+        const wchar_t* Expected)
+    {
+        std::wstring ResolvedPath;
+        return Resolve(Path, ResolvedPath) == NSudoSweeperPathResolved &&
+            ResolvedPath == Expected;
+    }
+
+    bool IsRejected(
+        const wchar_t* Path)
+    {
+        std::wstring ResolvedPath = L"Unchanged";
+        return Resolve(Path, ResolvedPath) == NSudoSweeperPathInvalid &&
+            ResolvedPath.empty();
+    }
+}
+
+NSUDO_TEST_CASE(SweeperPath, DetectsOnlineImage)
+{
+    const wchar_t SystemDirectory[] = L"C:\\Windows\\system32";
+
+    // No session root path means the online image.
+    NSUDO_TEST_CHECK(::NSudoSweeperIsOnlineImageRoot(
+        nullptr,
+        SystemDirectory));
+    NSUDO_TEST_CHECK(::NSudoSweeperIsOnlineImageRoot(nullptr, nullptr));
+
+    NSUDO_TEST_CHECK(::NSudoSweeperIsOnlineImageRoot(
+        L"C:\\",
+        SystemDirectory));
+    NSUDO_TEST_CHECK(::NSudoSweeperIsOnlineImageRoot(
+        L"c:\\",
+        SystemDirectory));
+
+    // A mounted image is an offline image.
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsOnlineImageRoot(
+        L"C:\\Image\\",
+        SystemDirectory));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsOnlineImageRoot(
+        L"D:\\",
+        SystemDirectory));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsOnlineImageRoot(
+        L"C:",
+        SystemDirectory));
+
+    // A system directory without a backslash cannot be matched.
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsOnlineImageRoot(L"C:\\", L"C:"));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsOnlineImageRoot(L"C:\\", nullptr));
+}
+
+NSUDO_TEST_CASE(SweeperPath, FindsOfflineVariables)
+{
+    const wchar_t* Value = ::NSudoSweeperFindOfflineVariable(
+        L"SystemRoot",
+        10);
+    NSUDO_TEST_REQUIRE(Value != nullptr);
+    NSUDO_TEST_CHECK(std::wstring(Value) == L"\\Windows");
+
+    // The names are case-insensitive and not required to be terminated.
+    Value = ::NSudoSweeperFindOfflineVariable(L"WINDIR%\\Temp", 6);
+    NSUDO_TEST_REQUIRE(Value != nullptr);
+    NSUDO_TEST_CHECK(std::wstring(Value) == L"\\Windows");
+
+    Value = ::NSudoSweeperFindOfflineVariable(L"SystemDrive", 11);
+    NSUDO_TEST_REQUIRE(Value != nullptr);
+    NSUDO_TEST_CHECK(std::wstring(Value).empty());
+
+    NSUDO_TEST_CHECK(!::NSudoSweeperFindOfflineVariable(L"SystemRoo", 9));
+    NSUDO_TEST_CHECK(!::NSudoSweeperFindOfflineVariable(L"TEMP", 4));
+    NSUDO_TEST_CHECK(!::NSudoSweeperFindOfflineVariable(L"", 0));
+}
+
+NSUDO_TEST_CASE(SweeperPath, RebasesUnderSessionRoot)
+{
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"%SystemRoot%\\Temp",
+        L"C:\\Image\\Windows\\Temp"));
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"C:\\Windows\\Temp",
+        L"C:\\Image\\Windows\\Temp"));
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"D:\\Data",
+        L"C:\\Image\\Data"));
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"%SystemDrive%\\Users",
+        L"C:\\Image\\Users"));
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"%ProgramFiles(x86)%\\App",
+        L"C:\\Image\\Program Files (x86)\\App"));
+    NSUDO_TEST_CHECK(ResolvesTo(L"%SystemDrive%", L"C:\\Image\\"));
+    NSUDO_TEST_CHECK(ResolvesTo(L"C:\\", L"C:\\Image\\"));
+
+    // A single dot is not a parent directory.
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"C:\\Windows\\.\\Temp",
+        L"C:\\Image\\Windows\\.\\Temp"));
+}
+
+NSUDO_TEST_CASE(SweeperPath, ExpandsInSinglePass)
+{
+    // The unterminated "%" is kept as is.
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"C:\\Temp\\100%",
+        L"C:\\Image\\Temp\\100%"));
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"%SystemRoot%\\50%Off",
+        L"C:\\Image\\Windows\\50%Off"));
+
+    // The expanded values are not expanded again.
+    NSUDO_TEST_CHECK(ResolvesTo(
+        L"%SystemRoot%%SystemDrive%",
+        L"C:\\Image\\Windows"));
+
+    // A variable which only starts the path is rejected as a relative path.
+    NSUDO_TEST_CHECK(IsRejected(L"%SystemRoot\\Temp"));
+}
+
+NSUDO_TEST_CASE(SweeperPath, RejectsUnknownVariables)
+{
+    std::wstring ResolvedPath;
+    NSUDO_TEST_CHECK(
+        Resolve(L"%TEMP%\\Cache", ResolvedPath) ==
+        NSudoSweeperPathVariableNotFound);
+    NSUDO_TEST_CHECK(ResolvedPath.empty());
+    NSUDO_TEST_CHECK(
+        Resolve(L"%USERPROFILE%", ResolvedPath) ==
+        NSudoSweeperPathVariableNotFound);
+    NSUDO_TEST_CHECK(
+        Resolve(L"C:\\%%\\Temp", ResolvedPath) ==
+        NSudoSweeperPathVariableNotFound);
+}
+
+NSUDO_TEST_CASE(SweeperPath, RejectsEscapes)
+{
+    NSUDO_TEST_CHECK(IsRejected(L"%SystemRoot%\\..\\x"));
+    NSUDO_TEST_CHECK(IsRejected(L"C:\\Windows\\..\\..\\x"));
+    NSUDO_TEST_CHECK(IsRejected(L"C:\\.."));
+    NSUDO_TEST_CHECK(IsRejected(L"%SystemRoot%/../../x"));
+    NSUDO_TEST_CHECK(IsRejected(L"C:\\Windows\\../x"));
+
+    // The relative paths cannot be rebased.
+    NSUDO_TEST_CHECK(IsRejected(L"Windows\\Temp"));
+    NSUDO_TEST_CHECK(IsRejected(L"C:Windows\\Temp"));
+    NSUDO_TEST_CHECK(IsRejected(L"..\\x"));
+
+    // The UNC paths and the device paths are rejected.
+    NSUDO_TEST_CHECK(IsRejected(L"\\\\server\\share"));
+    NSUDO_TEST_CHECK(IsRejected(L"\\\\?\\C:\\Windows"));
+    NSUDO_TEST_CHECK(IsRejected(L"C:\\\\Windows"));
+}
@@ -0,0 +1,266 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperSchedulerCoreTests.cpp
+ * PURPOSE:   Tests for the Budgeted Cleanup Handler Scheduler
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperSchedulerCore.h>
+
+#include <Mile.Platform.h>
+
+#include <atomic>
+#include <vector>
+
+namespace
+{
+    const int32_t AccessDenied = static_cast<int32_t>(0x80070005);
+
+    /**
+     * The behavior of a fake cleanup handler.
+     */
+    struct FakeHandler
+    {
+        int Identifier;
+        int ProgressCount;
+        int32_t Result;
+        uint64_t EstimatedFreedSize;
+        bool Cancel;
+
+        int ForwardedCount;
+        int32_t LastProgressResult;
+    };
+
+    /**
+     * The shared state of the fake backend.
+     */
+    struct FakeBackend
+    {
+        std::atomic<uint64_t> Clock;
+        uint64_t TimePerProgress;
+
+        Mile::Mutex OrderLock;
+        std::vector<int> Order;
+    };
+
+    FakeHandler MakeHandler(
+        int Identifier,
+        int ProgressCount,
+        int32_t Result)
+    {
+        FakeHandler Handler = {};
+        Handler.Identifier = Identifier;
+        Handler.ProgressCount = ProgressCount;
+        Handler.Result = Result;
+        Handler.EstimatedFreedSize = 1024 * (Identifier + 1);
+        return Handler;
+    }
+
+    int32_t RunFakeHandler(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        PNSUDO_SWEEPER_TASK_RUN Run,
+        uint64_t* EstimatedFreedSize)
+    {
+        FakeBackend* Backend = reinterpret_cast<FakeBackend*>(Context);
+        FakeHandler* Handler = reinterpret_cast<FakeHandler*>(Task->UserData);
+
+        {
+            Mile::AutoMutexLock Lock(Backend->OrderLock);
+            Backend->Order.push_back(Handler->Identifier);
+        }
+
+        // Like a careless cleanup handler, it ignores the failures of the
+        // progress reports and always finishes its work.
+        for (int i = 0; i < Handler->ProgressCount; ++i)
+        {
+            Backend->Clock += Backend->TimePerProgress;
+            Handler->LastProgressResult = ::NSudoSweeperReportTaskProgress(
+                Run,
+                static_cast<uint32_t>(i),
+                nullptr);
+        }
+
+        *EstimatedFreedSize = Handler->EstimatedFreedSize;
+
+        return Handler->Result;
+    }
+
+    bool ForwardFakeMessage(
+        void* Context,
+        PNSUDO_SWEEPER_SCHEDULED_TASK Task,
+        uint32_t Message,
+        void* Parameter)
+    {
+        static_cast<void>(Context);
+        static_cast<void>(Message);
+        static_cast<void>(Parameter);
+
+        FakeHandler* Handler = reinterpret_cast<FakeHandler*>(Task->UserData);
+        ++Handler->ForwardedCount;
+        return !Handler->Cancel;
+    }
+
+    uint64_t GetFakeTickCount(
+        void* Context)
+    {
+        return reinterpret_cast<FakeBackend*>(Context)->Clock;
+    }
+
+    bool RunFakeHandlers(
+        FakeBackend& Backend,
+        std::vector<FakeHandler>& Handlers,
+        std::vector<NSUDO_SWEEPER_SCHEDULED_TASK>& Tasks,
+        Mile::ThreadPool& Pool,
+        uint32_t MaximumConcurrency)
+    {
+        NSUDO_SWEEPER_SCHEDULER_BACKEND Operations;
+        Operations.Context = &Backend;
+        Operations.RunTask = RunFakeHandler;
+        Operations.ForwardMessage = ForwardFakeMessage;
+        Operations.GetTickCount = GetFakeTickCount;
+
+        for (size_t i = 0; i < Tasks.size(); ++i)
+        {
+            Tasks[i].UserData = &Handlers[i];
+        }
+
+        return ::NSudoSweeperRunScheduledTasks(
+            Tasks.data(),
+            Tasks.size(),
+            Pool,
+            MaximumConcurrency,
+            &Operations);
+    }
+
+    NSUDO_SWEEPER_SCHEDULED_TASK MakeTask(
+        int32_t Priority,
+        uint32_t TimeBudget)
+    {
+        NSUDO_SWEEPER_SCHEDULED_TASK Task = {};
+        Task.Priority = Priority;
+        Task.TimeBudget = TimeBudget;
+        return Task;
+    }
+}
+
+NSUDO_TEST_CASE(SweeperScheduler, RunsByPriorityWithinBudget)
+{
+    Mile::ThreadPool Pool(2);
+
+    FakeBackend Backend;
+    Backend.Clock = 1000;
+    Backend.TimePerProgress = 4;
+
+    std::vector<FakeHandler> Handlers;
+    Handlers.push_back(MakeHandler(0, 2, NSUDO_SWEEPER_TASK_SUCCEEDED));
+    Handlers.push_back(MakeHandler(1, 5, NSUDO_SWEEPER_TASK_SUCCEEDED));
+    Handlers.push_back(MakeHandler(2, 5, NSUDO_SWEEPER_TASK_SUCCEEDED));
+    Handlers.push_back(MakeHandler(3, 1, NSUDO_SWEEPER_TASK_SUCCEEDED));
+
+    std::vector<NSUDO_SWEEPER_SCHEDULED_TASK> Tasks;
+    Tasks.push_back(MakeTask(1, 0));
+    Tasks.push_back(MakeTask(5, 10));
+    Tasks.push_back(MakeTask(5, 0));
+    Tasks.push_back(MakeTask(3, 0));
+
+    // A single lane makes the start order observable.
+    NSUDO_TEST_CHECK(!RunFakeHandlers(Backend, Handlers, Tasks, Pool, 1));
+
+    const std::vector<int> ExpectedOrder = { 1, 2, 3, 0 };
+    NSUDO_TEST_CHECK(Backend.Order == ExpectedOrder);
+
+    // The third report is 12 ms after the start, over the 10 ms budget.
+    NSUDO_TEST_CHECK(Tasks[1].Result == NSUDO_SWEEPER_TASK_ABORTED);
+    NSUDO_TEST_CHECK(Handlers[1].ForwardedCount == 2);
+    NSUDO_TEST_CHECK(
+        Handlers[1].LastProgressResult == NSUDO_SWEEPER_TASK_ABORTED);
+    NSUDO_TEST_CHECK(Tasks[1].ElapsedTime == 20);
+
+    // The task without a budget runs as long as it needs.
+    NSUDO_TEST_CHECK(Tasks[2].Result == NSUDO_SWEEPER_TASK_SUCCEEDED);
+    NSUDO_TEST_CHECK(Handlers[2].ForwardedCount == 5);
+    NSUDO_TEST_CHECK(Tasks[2].ElapsedTime == 20);
+
+    NSUDO_TEST_CHECK(Tasks[0].Result == NSUDO_SWEEPER_TASK_SUCCEEDED);
+    NSUDO_TEST_CHECK(Tasks[3].Result == NSUDO_SWEEPER_TASK_SUCCEEDED);
+    NSUDO_TEST_CHECK(Tasks[3].EstimatedFreedSize == 4096);
+}
+
+NSUDO_TEST_CASE(SweeperScheduler, PropagatesCancellationAsAbort)
+{
+    Mile::ThreadPool Pool(2);
+
+    FakeBackend Backend;
+    Backend.Clock = 0;
+    Backend.TimePerProgress = 1;
+
+    std::vector<FakeHandler> Handlers;
+    Handlers.push_back(MakeHandler(0, 3, NSUDO_SWEEPER_TASK_SUCCEEDED));
+    Handlers.push_back(MakeHandler(1, 3, AccessDenied));
+    Handlers.push_back(MakeHandler(2, 3, NSUDO_SWEEPER_TASK_SUCCEEDED));
+    Handlers[0].Cancel = true;
+    Handlers[1].Cancel = true;
+
+    std::vector<NSUDO_SWEEPER_SCHEDULED_TASK> Tasks;
+    Tasks.push_back(MakeTask(0, 0));
+    Tasks.push_back(MakeTask(0, 0));
+    Tasks.push_back(MakeTask(0, 0));
+
+    NSUDO_TEST_CHECK(!RunFakeHandlers(Backend, Handlers, Tasks, Pool, 0));
+
+    // The handler ignored the cancellation and returned success, the
+    // scheduler still reports the abort.
+    NSUDO_TEST_CHECK(Tasks[0].Result == NSUDO_SWEEPER_TASK_ABORTED);
+    NSUDO_TEST_CHECK(Handlers[0].ForwardedCount == 1);
+    NSUDO_TEST_CHECK(
+        Handlers[0].LastProgressResult == NSUDO_SWEEPER_TASK_ABORTED);
+
+    // A failure returned by the handler itself is kept.
+    NSUDO_TEST_CHECK(Tasks[1].Result == AccessDenied);
+
+    NSUDO_TEST_CHECK(Tasks[2].Result == NSUDO_SWEEPER_TASK_SUCCEEDED);
+    NSUDO_TEST_CHECK(Handlers[2].ForwardedCount == 3);
+}
+
+NSUDO_TEST_CASE(SweeperScheduler, IsolatesFailingHandlers)
+{
+    Mile::ThreadPool Pool(4);
+
+    FakeBackend Backend;
+    Backend.Clock = 0;
+    Backend.TimePerProgress = 0;
+
+    std::vector<FakeHandler> Handlers;
+    std::vector<NSUDO_SWEEPER_SCHEDULED_TASK> Tasks;
+    for (int i = 0; i < 32; ++i)
+    {
+        Handlers.push_back(MakeHandler(
+            i,
+            8,
+            i == 7 ? AccessDenied : NSUDO_SWEEPER_TASK_SUCCEEDED));
+        Tasks.push_back(MakeTask(i % 3, 1));
+    }
+
+    NSUDO_TEST_CHECK(!RunFakeHandlers(Backend, Handlers, Tasks, Pool, 4));
+    NSUDO_TEST_CHECK(Backend.Order.size() == Tasks.size());
+
+    for (size_t i = 0; i < Tasks.size(); ++i)
+    {
+        NSUDO_TEST_CHECK(Tasks[i].Result == (i == 7
+            ? AccessDenied
+            : NSUDO_SWEEPER_TASK_SUCCEEDED));
+        NSUDO_TEST_CHECK(Handlers[i].ForwardedCount == 8);
+        NSUDO_TEST_CHECK(
+            Tasks[i].EstimatedFreedSize == Handlers[i].EstimatedFreedSize);
+    }
+
+    // The results are reset by every run.
+    Handlers[7].Result = NSUDO_SWEEPER_TASK_SUCCEEDED;
+    NSUDO_TEST_CHECK(RunFakeHandlers(Backend, Handlers, Tasks, Pool, 4));
+}
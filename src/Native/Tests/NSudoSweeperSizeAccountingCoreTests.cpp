@@ -0,0 +1,207 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperSizeAccountingCoreTests.cpp
+ * PURPOSE:   Tests for the Size Accounting Reduction
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperSizeAccountingCore.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    NSUDO_SWEEPER_SIZE_RECORD MakeRecord(
+        uint64_t FileId,
+        uint64_t LogicalSize,
+        uint64_t AllocatedSize,
+        uint32_t VolumeSerialNumber,
+        uint32_t RootIndex)
+    {
+        NSUDO_SWEEPER_SIZE_RECORD Record;
+        ::NSudoSweeperInitializeSizeRecord(
+            &Record,
+            FileId,
+            LogicalSize,
+            AllocatedSize,
+            VolumeSerialNumber,
+            RootIndex);
+        return Record;
+    }
+}
+
+NSUDO_TEST_CASE(SweeperSizeAccounting, RoundsToClusterSize)
+{
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(0, 4096) == 0);
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(1, 4096) == 4096);
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(4096, 4096) == 4096);
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(4097, 4096) == 8192);
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(1000, 3) == 1002);
+    NSUDO_TEST_CHECK(::NSudoSweeperRoundToClusterSize(4097, 0) == 4097);
+    NSUDO_TEST_CHECK(
+        ::NSudoSweeperRoundToClusterSize(UINT64_MAX - 1, 4096) ==
+        UINT64_MAX);
+}
+
+NSUDO_TEST_CASE(SweeperSizeAccounting, SeparatesSizeKinds)
+{
+    // A plain file, the compressed size is the logical size.
+    NSUDO_SWEEPER_SIZE_RECORD Record = MakeRecord(1, 5000, 8192, 7, 0);
+    NSUDO_TEST_CHECK(Record.LogicalSize == 5000);
+    NSUDO_TEST_CHECK(Record.AllocatedSize == 8192);
+    NSUDO_TEST_CHECK(Record.CompressedSize == 5000);
+
+    // A compressed or sparse file keeps the allocated size.
+    ::NSudoSweeperSetStoredSize(&Record, 4096, 4096, false);
+    NSUDO_TEST_CHECK(Record.AllocatedSize == 8192);
+    NSUDO_TEST_CHECK(Record.CompressedSize == 4096);
+
+    // A file backed by a stream the entry does not report is charged for
+    // the stored size rounded up to the cluster size.
+    Record = MakeRecord(2, 100000, 0, 7, 0);
+    ::NSudoSweeperSetStoredSize(&Record, 30001, 4096, true);
+    NSUDO_TEST_CHECK(Record.LogicalSize == 100000);
+    NSUDO_TEST_CHECK(Record.CompressedSize == 30001);
+    NSUDO_TEST_CHECK(Record.AllocatedSize == 32768);
+
+    // The allocated size never shrinks.
+    Record = MakeRecord(3, 100000, 65536, 7, 0);
+    ::NSudoSweeperSetStoredSize(&Record, 30001, 4096, true);
+    NSUDO_TEST_CHECK(Record.AllocatedSize == 65536);
+
+    // Without the cluster size the stored size is used as is.
+    Record = MakeRecord(4, 100000, 0, 7, 0);
+    ::NSudoSweeperSetStoredSize(&Record, 30001, 0, true);
+    NSUDO_TEST_CHECK(Record.AllocatedSize == 30001);
+}
+
+NSUDO_TEST_CASE(SweeperSizeAccounting, DeduplicatesHardLinks)
+{
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD> Records;
+
+    // Two links to file 10 in tree 0, and another link in tree 1.
+    Records.push_back(MakeRecord(10, 1000, 4096, 7, 0));
+    Records.push_back(MakeRecord(10, 1000, 4096, 7, 1));
+    Records.push_back(MakeRecord(10, 1000, 4096, 7, 0));
+
+    // The same file ID on another volume is another file.
+    Records.push_back(MakeRecord(10, 2000, 4096, 8, 0));
+
+    // A plain file in tree 1.
+    Records.push_back(MakeRecord(11, 10, 512, 7, 1));
+
+    NSUDO_SWEEPER_SIZE_INFORMATION SizeInformation[2];
+    NSUDO_SWEEPER_SIZE_INFORMATION Total;
+    ::NSudoSweeperReduceSizeRecords(Records, 2, SizeInformation, &Total);
+
+    NSUDO_TEST_CHECK(SizeInformation[0].FileCount == 3);
+    NSUDO_TEST_CHECK(SizeInformation[0].LogicalSize == 4000);
+    NSUDO_TEST_CHECK(SizeInformation[0].AllocatedSize == 12288);
+    NSUDO_TEST_CHECK(SizeInformation[0].CompressedSize == 4000);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueFileCount == 2);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueLogicalSize == 3000);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueAllocatedSize == 8192);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueCompressedSize == 3000);
+
+    NSUDO_TEST_CHECK(SizeInformation[1].FileCount == 2);
+    NSUDO_TEST_CHECK(SizeInformation[1].UniqueFileCount == 2);
+    NSUDO_TEST_CHECK(SizeInformation[1].UniqueAllocatedSize == 4608);
+
+    // The file shared by both trees is counted once in the total.
+    NSUDO_TEST_CHECK(Total.FileCount == 5);
+    NSUDO_TEST_CHECK(Total.AllocatedSize == 16896);
+    NSUDO_TEST_CHECK(Total.UniqueFileCount == 3);
+    NSUDO_TEST_CHECK(Total.UniqueLogicalSize == 3010);
+    NSUDO_TEST_CHECK(Total.UniqueAllocatedSize == 8704);
+}
+
+NSUDO_TEST_CASE(SweeperSizeAccounting, ResetsOutputs)
+{
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD> Records;
+    Records.push_back(MakeRecord(1, 1, 1, 1, 0));
+
+    NSUDO_SWEEPER_SIZE_INFORMATION SizeInformation[1];
+    ::NSudoSweeperReduceSizeRecords(Records, 1, SizeInformation, nullptr);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueFileCount == 1);
+
+    Records.clear();
+    NSUDO_SWEEPER_SIZE_INFORMATION Total;
+    Total.FileCount = 99;
+    ::NSudoSweeperReduceSizeRecords(Records, 1, SizeInformation, &Total);
+    NSUDO_TEST_CHECK(SizeInformation[0].FileCount == 0);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueFileCount == 0);
+    NSUDO_TEST_CHECK(Total.FileCount == 0);
+}
+
+#if defined(__linux__)
+
+NSUDO_TEST_CASE(SweeperSizeAccounting, PosixHardLinks)
+{
+    char Template[] = "/tmp/NSudoSweeperSizeAccounting.XXXXXX";
+    NSUDO_TEST_REQUIRE(::mkdtemp(Template) != nullptr);
+
+    const std::string Root = Template;
+    const std::string Original = Root + "/original";
+    const std::string Link = Root + "/link";
+    const std::string Other = Root + "/other";
+
+    int Descriptor = ::open(
+        Original.c_str(),
+        O_CREAT | O_WRONLY | O_TRUNC,
+        0600);
+    NSUDO_TEST_REQUIRE(Descriptor >= 0);
+    std::vector<char> Data(10000, 'x');
+    NSUDO_TEST_CHECK(
+        ::write(Descriptor, Data.data(), Data.size()) ==
+        static_cast<ssize_t>(Data.size()));
+    ::close(Descriptor);
+
+    NSUDO_TEST_REQUIRE(::link(Original.c_str(), Link.c_str()) == 0);
+
+    Descriptor = ::open(Other.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    NSUDO_TEST_REQUIRE(Descriptor >= 0);
+    ::close(Descriptor);
+
+    std::vector<NSUDO_SWEEPER_SIZE_RECORD> Records;
+    for (const std::string& Path : { Original, Link, Other })
+    {
+        struct stat Status;
+        NSUDO_TEST_REQUIRE(::lstat(Path.c_str(), &Status) == 0);
+        Records.push_back(MakeRecord(
+            static_cast<uint64_t>(Status.st_ino),
+            static_cast<uint64_t>(Status.st_size),
+            static_cast<uint64_t>(Status.st_blocks) * 512,
+            static_cast<uint32_t>(Status.st_dev),
+            0));
+    }
+
+    NSUDO_SWEEPER_SIZE_INFORMATION SizeInformation[1];
+    ::NSudoSweeperReduceSizeRecords(Records, 1, SizeInformation, nullptr);
+    NSUDO_TEST_CHECK(SizeInformation[0].FileCount == 3);
+    NSUDO_TEST_CHECK(SizeInformation[0].LogicalSize == 20000);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueFileCount == 2);
+    NSUDO_TEST_CHECK(SizeInformation[0].UniqueLogicalSize == 10000);
+    NSUDO_TEST_CHECK(
+        SizeInformation[0].AllocatedSize ==
+        2 * SizeInformation[0].UniqueAllocatedSize);
+
+    ::unlink(Original.c_str());
+    ::unlink(Link.c_str());
+    ::unlink(Other.c_str());
+    ::rmdir(Root.c_str());
+}
+
+#endif // defined(__linux__)
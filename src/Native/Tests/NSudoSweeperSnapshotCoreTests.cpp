@@ -0,0 +1,495 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoSweeperSnapshotCoreTests.cpp
+ * PURPOSE:   Tests for the Directory Snapshot Format and Scanner
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <NSudoSweeperSnapshotCore.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /**
+     * A directory of the in-memory tree.
+     */
+    struct FakeDirectory
+    {
+        uint64_t FileId;
+        uint64_t LastWriteTime;
+        uint64_t FileSize;
+        uint32_t FileCount;
+        std::vector<std::u16string> Children;
+    };
+
+    /**
+     * An in-memory directory tree keyed by the full path.
+     */
+    struct FakeTree
+    {
+        std::map<std::u16string, FakeDirectory> Directories;
+        uint64_t NextFileId = 100;
+        uint32_t EnumerateCount = 0;
+
+        void Add(
+            const std::u16string& Path,
+            uint64_t FileSize,
+            uint32_t FileCount)
+        {
+            FakeDirectory& Directory = this->Directories[Path];
+            Directory.FileId = this->NextFileId++;
+            Directory.LastWriteTime = 1;
+            Directory.FileSize = FileSize;
+            Directory.FileCount = FileCount;
+
+            size_t Separator = Path.rfind(u'/');
+            if (Separator != std::u16string::npos &&
+                this->Directories.count(Path.substr(0, Separator)))
+            {
+                this->Directories[Path.substr(0, Separator)].Children.push_back(
+                    Path.substr(Separator + 1));
+            }
+        }
+
+        NSUDO_SWEEPER_SCAN_BACKEND GetBackend()
+        {
+            NSUDO_SWEEPER_SCAN_BACKEND Backend;
+            Backend.Context = this;
+            Backend.Separator = u'/';
+            Backend.QueryDirectory = Query;
+            Backend.EnumerateDirectory = Enumerate;
+            return Backend;
+        }
+
+        static bool Query(
+            void* Context,
+            const char16_t* Path,
+            uint64_t* FileId,
+            uint64_t* LastWriteTime)
+        {
+            FakeTree* Tree = static_cast<FakeTree*>(Context);
+            auto Iterator = Tree->Directories.find(Path);
+            if (Iterator == Tree->Directories.end())
+            {
+                return false;
+            }
+            *FileId = Iterator->second.FileId;
+            *LastWriteTime = Iterator->second.LastWriteTime;
+            return true;
+        }
+
+        static bool Enumerate(
+            void* Context,
+            const char16_t* Path,
+            uint64_t* FileSize,
+            uint32_t* FileCount,
+            std::vector<NSUDO_SWEEPER_SNAPSHOT_CHILD>* Children)
+        {
+            FakeTree* Tree = static_cast<FakeTree*>(Context);
+            ++Tree->EnumerateCount;
+            auto Iterator = Tree->Directories.find(Path);
+            if (Iterator == Tree->Directories.end())
+            {
+                return false;
+            }
+            *FileSize = Iterator->second.FileSize;
+            *FileCount = Iterator->second.FileCount;
+            Children->clear();
+            for (const std::u16string& Name : Iterator->second.Children)
+            {
+                const FakeDirectory& Child =
+                    Tree->Directories[std::u16string(Path) + u'/' + Name];
+                NSUDO_SWEEPER_SNAPSHOT_CHILD Item;
+                Item.FileId = Child.FileId;
+                Item.LastWriteTime = Child.LastWriteTime;
+                Item.Name = Name;
+                Children->push_back(Item);
+            }
+            return true;
+        }
+    };
+
+    /**
+     * Builds the tree used by the most cases, 600 bytes in 6 files.
+     */
+    void BuildTree(
+        FakeTree& Tree)
+    {
+        Tree.Add(u"/root", 100, 1);
+        Tree.Add(u"/root/a", 200, 2);
+        Tree.Add(u"/root/a/c", 50, 1);
+        Tree.Add(u"/root/b", 250, 2);
+    }
+
+    /**
+     * Scans a tree and serializes the result.
+     */
+    std::vector<uint8_t> TakeSnapshot(
+        FakeTree& Tree,
+        const NSUDO_SWEEPER_SNAPSHOT_VIEW* Previous,
+        PNSUDO_SWEEPER_SNAPSHOT_SCAN Scan)
+    {
+        NSUDO_SWEEPER_SCAN_BACKEND Backend = Tree.GetBackend();
+        std::vector<uint8_t> Content;
+        if (::NSudoSweeperScanDirectoryTree(
+            Previous,
+            u"/root",
+            &Backend,
+            Scan))
+        {
+            ::NSudoSweeperSerializeSnapshot(7, Scan, Content);
+        }
+        return Content;
+    }
+
+    /**
+     * Opens a copy of a snapshot, the copy is always aligned by the
+     * allocator.
+     */
+    bool OpenCopy(
+        const std::vector<uint8_t>& Content,
+        size_t Size,
+        std::vector<uint64_t>& Storage,
+        NSUDO_SWEEPER_SNAPSHOT_VIEW& View)
+    {
+        Storage.assign((Size + 7) / 8 + 1, 0);
+        if (Size)
+        {
+            std::memcpy(Storage.data(), Content.data(), Size);
+        }
+        return ::NSudoSweeperOpenSnapshotView(Storage.data(), Size, &View);
+    }
+
+    NSUDO_SWEEPER_SNAPSHOT_ENTRY* GetEntries(
+        std::vector<uint8_t>& Content)
+    {
+        return reinterpret_cast<NSUDO_SWEEPER_SNAPSHOT_ENTRY*>(
+            Content.data() + sizeof(NSUDO_SWEEPER_SNAPSHOT_HEADER));
+    }
+
+    NSUDO_SWEEPER_SNAPSHOT_HEADER* GetHeader(
+        std::vector<uint8_t>& Content)
+    {
+        return reinterpret_cast<NSUDO_SWEEPER_SNAPSHOT_HEADER*>(
+            Content.data());
+    }
+
+    /**
+     * Finds the record of a child directory by its name.
+     */
+    NSUDO_SWEEPER_SNAPSHOT_ENTRY* FindChild(
+        std::vector<uint8_t>& Content,
+        const std::u16string& Name)
+    {
+        NSUDO_SWEEPER_SNAPSHOT_HEADER* Header = GetHeader(Content);
+        NSUDO_SWEEPER_SNAPSHOT_ENTRY* Entries = GetEntries(Content);
+        const char16_t* Names =
+            reinterpret_cast<const char16_t*>(Entries + Header->EntryCount);
+        for (uint32_t i = 1; i < Header->EntryCount; ++i)
+        {
+            if (std::u16string(
+                Names + Entries[i].NameOffset,
+                Entries[i].NameLength) == Name)
+            {
+                return &Entries[i];
+            }
+        }
+        return nullptr;
+    }
+}
+
+NSUDO_TEST_CASE(SweeperSnapshot, RoundTrip)
+{
+    FakeTree Tree;
+    BuildTree(Tree);
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    std::vector<uint8_t> Content = TakeSnapshot(Tree, nullptr, &Scan);
+    NSUDO_TEST_REQUIRE(!Content.empty());
+    NSUDO_TEST_CHECK(Scan.Entries.size() == 4);
+    NSUDO_TEST_CHECK(Scan.Entries[0].TotalSize == 600);
+    NSUDO_TEST_CHECK(Scan.EnumeratedDirectoryCount == 4);
+    NSUDO_TEST_CHECK(Scan.ReusedDirectoryCount == 0);
+
+    std::vector<uint64_t> Storage;
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+    NSUDO_TEST_REQUIRE(OpenCopy(Content, Content.size(), Storage, View));
+    NSUDO_TEST_CHECK(View.Header->EntryCount == 4);
+    NSUDO_TEST_CHECK(View.Header->VolumeSerialNumber == 7);
+    NSUDO_TEST_CHECK(
+        std::u16string(View.Names, View.Entries[0].NameLength) == u"/root");
+
+    for (const NSUDO_SWEEPER_SNAPSHOT_ENTRY& Entry : Scan.Entries)
+    {
+        const NSUDO_SWEEPER_SNAPSHOT_ENTRY* Found =
+            ::NSudoSweeperFindSnapshotEntry(&View, Entry.FileId);
+        NSUDO_TEST_REQUIRE(Found != nullptr);
+        NSUDO_TEST_CHECK(
+            std::memcmp(Found, &Entry, sizeof(Entry)) == 0);
+    }
+    NSUDO_TEST_CHECK(!::NSudoSweeperFindSnapshotEntry(&View, 1));
+    NSUDO_TEST_CHECK(!::NSudoSweeperFindSnapshotEntry(nullptr, 100));
+
+    // Serializing the same tree again produces the same bytes.
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Rescan;
+    std::vector<uint8_t> Again = TakeSnapshot(Tree, &View, &Rescan);
+    NSUDO_TEST_CHECK(Again == Content);
+}
+
+NSUDO_TEST_CASE(SweeperSnapshot, RejectsTruncation)
+{
+    FakeTree Tree;
+    BuildTree(Tree);
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    std::vector<uint8_t> Content = TakeSnapshot(Tree, nullptr, &Scan);
+    NSUDO_TEST_REQUIRE(!Content.empty());
+
+    std::vector<uint64_t> Storage;
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+    for (size_t Size = 0; Size < Content.size(); ++Size)
+    {
+        NSUDO_TEST_CHECK(!OpenCopy(Content, Size, Storage, View));
+        NSUDO_TEST_CHECK(View.Header == nullptr);
+    }
+
+    // The trailing bytes are rejected as well.
+    Content.push_back(0);
+    Content.push_back(0);
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    NSUDO_TEST_CHECK(!::NSudoSweeperOpenSnapshotView(nullptr, 64, &View));
+}
+
+NSUDO_TEST_CASE(SweeperSnapshot, RejectsCorruption)
+{
+    FakeTree Tree;
+    BuildTree(Tree);
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    const std::vector<uint8_t> Original = TakeSnapshot(Tree, nullptr, &Scan);
+    NSUDO_TEST_REQUIRE(!Original.empty());
+
+    std::vector<uint64_t> Storage;
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+
+    std::vector<uint8_t> Content = Original;
+    GetHeader(Content)->Signature ^= 1;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    GetHeader(Content)->Version = NSUDO_SWEEPER_SNAPSHOT_VERSION + 1;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    GetHeader(Content)->EntryCount = 0xFFFFFFFF;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    GetHeader(Content)->NameLength += 1;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    FindChild(Content, u"b")->NameOffset = 0xFFFFFFF0;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    FindChild(Content, u"b")->NameLength = 1000;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    // The children must be stored after their parent and inside the table.
+    Content = Original;
+    GetEntries(Content)[0].ChildCount = 10;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    Content = Original;
+    FindChild(Content, u"a")->FirstChild = 0;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    // A child name which leaves the tree is rejected.
+    const char16_t* BadNames[] = { u"..", u".", u"c/d", u"c\\d" };
+    for (const char16_t* BadName : BadNames)
+    {
+        std::u16string Name = BadName;
+        Content = Original;
+        NSUDO_SWEEPER_SNAPSHOT_ENTRY* Child = FindChild(Content, u"a");
+        char16_t* Names = reinterpret_cast<char16_t*>(
+            GetEntries(Content) + GetHeader(Content)->EntryCount);
+        Child->NameLength = static_cast<uint32_t>(Name.size());
+
+        // "a" is followed by "b" and "c" in the name pool, so the longer
+        // names still fit.
+        std::memcpy(
+            Names + Child->NameOffset,
+            Name.data(),
+            Name.size() * sizeof(char16_t));
+        NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+    }
+
+    Content = Original;
+    FindChild(Content, u"a")->NameLength = 0;
+    NSUDO_TEST_CHECK(!OpenCopy(Content, Content.size(), Storage, View));
+
+    NSUDO_TEST_CHECK(OpenCopy(Original, Original.size(), Storage, View));
+}
+
+NSUDO_TEST_CASE(SweeperSnapshot, MatchesTree)
+{
+    FakeTree Tree;
+    BuildTree(Tree);
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    std::vector<uint8_t> Content = TakeSnapshot(Tree, nullptr, &Scan);
+
+    std::vector<uint64_t> Storage;
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+    NSUDO_TEST_REQUIRE(OpenCopy(Content, Content.size(), Storage, View));
+
+    NSUDO_TEST_CHECK(::NSudoSweeperIsSnapshotOfTree(&View, 7, u"/root", 5));
+    NSUDO_TEST_CHECK(::NSudoSweeperIsSnapshotOfTree(&View, 7, u"/ROOT", 5));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsSnapshotOfTree(&View, 8, u"/root", 5));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsSnapshotOfTree(&View, 7, u"/roo", 4));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsSnapshotOfTree(&View, 7, u"/rooT2", 6));
+    NSUDO_TEST_CHECK(!::NSudoSweeperIsSnapshotOfTree(&View, 7, u"/other", 6));
+}
+
+NSUDO_TEST_CASE(SweeperSnapshot, ReusesUnchangedDirectories)
+{
+    FakeTree Tree;
+    BuildTree(Tree);
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    std::vector<uint8_t> Content = TakeSnapshot(Tree, nullptr, &Scan);
+
+    std::vector<uint64_t> Storage;
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+    NSUDO_TEST_REQUIRE(OpenCopy(Content, Content.size(), Storage, View));
+
+    // Nothing is changed, nothing is enumerated.
+    Tree.EnumerateCount = 0;
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Rescan;
+    TakeSnapshot(Tree, &View, &Rescan);
+    NSUDO_TEST_CHECK(Tree.EnumerateCount == 0);
+    NSUDO_TEST_CHECK(Rescan.ReusedDirectoryCount == 4);
+    NSUDO_TEST_CHECK(Rescan.Entries[0].TotalSize == 600);
+
+    // Only the changed directory is enumerated again, and a size change in
+    // an unchanged directory is not detected by design.
+    FakeDirectory& Changed = Tree.Directories[u"/root/a/c"];
+    Changed.LastWriteTime = 2;
+    Changed.FileSize = 1050;
+    Tree.Directories[u"/root/b"].FileSize = 9999;
+    Tree.EnumerateCount = 0;
+    TakeSnapshot(Tree, &View, &Rescan);
+    NSUDO_TEST_CHECK(Tree.EnumerateCount == 1);
+    NSUDO_TEST_CHECK(Rescan.EnumeratedDirectoryCount == 1);
+    NSUDO_TEST_CHECK(Rescan.ReusedDirectoryCount == 3);
+    NSUDO_TEST_CHECK(Rescan.Entries[0].TotalSize == 1600);
+
+    // A removed child directory is dropped without enumerating the parent.
+    Tree.Directories.erase(u"/root/a/c");
+    Tree.EnumerateCount = 0;
+    TakeSnapshot(Tree, &View, &Rescan);
+    NSUDO_TEST_CHECK(Tree.EnumerateCount == 0);
+    NSUDO_TEST_CHECK(Rescan.Entries.size() == 3);
+    NSUDO_TEST_CHECK(Rescan.Entries[0].TotalSize == 550);
+
+    // A replaced directory has a new file ID and is enumerated again.
+    Tree.Add(u"/root/a/c", 70, 1);
+    Tree.EnumerateCount = 0;
+    TakeSnapshot(Tree, &View, &Rescan);
+    NSUDO_TEST_CHECK(Tree.EnumerateCount == 1);
+    NSUDO_TEST_CHECK(Rescan.Entries[0].TotalSize == 620);
+
+    // The root must exist.
+    Tree.Directories.erase(u"/root");
+    NSUDO_TEST_CHECK(TakeSnapshot(Tree, &View, &Rescan).empty());
+}
+
+#if defined(__linux__)
+
+NSUDO_TEST_CASE(SweeperSnapshot, PosixBackend)
+{
+    char Template[] = "/tmp/NSudoSweeperSnapshot.XXXXXX";
+    NSUDO_TEST_REQUIRE(::mkdtemp(Template) != nullptr);
+
+    const std::string Root = Template;
+    NSUDO_TEST_REQUIRE(::mkdir((Root + "/a").c_str(), 0700) == 0);
+    NSUDO_TEST_REQUIRE(::mkdir((Root + "/a/b").c_str(), 0700) == 0);
+    NSUDO_TEST_REQUIRE(::symlink("/", (Root + "/link").c_str()) == 0);
+
+    const char* Files[] = { "/f", "/a/f", "/a/b/f" };
+    for (const char* File : Files)
+    {
+        int Descriptor = ::open(
+            (Root + File).c_str(),
+            O_CREAT | O_WRONLY | O_TRUNC,
+            0600);
+        NSUDO_TEST_REQUIRE(Descriptor >= 0);
+        std::vector<char> Data(8192, 'x');
+        NSUDO_TEST_CHECK(
+            ::write(Descriptor, Data.data(), Data.size()) ==
+            static_cast<ssize_t>(Data.size()));
+        ::close(Descriptor);
+    }
+
+    std::u16string RootPath(Root.begin(), Root.end());
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Scan;
+    NSUDO_TEST_REQUIRE(::NSudoSweeperScanDirectoryTree(
+        nullptr,
+        RootPath,
+        ::NSudoSweeperGetPosixScanBackend(),
+        &Scan));
+
+    // The symbolic link is counted as a file and is not followed.
+    NSUDO_TEST_CHECK(Scan.Entries.size() == 3);
+    NSUDO_TEST_CHECK(Scan.Entries[0].FileCount == 2);
+    NSUDO_TEST_CHECK(Scan.Entries[0].TotalSize >= 3 * 8192);
+
+    std::vector<uint8_t> Content;
+    ::NSudoSweeperSerializeSnapshot(0, &Scan, Content);
+
+    NSUDO_SWEEPER_SNAPSHOT_VIEW View;
+    NSUDO_TEST_REQUIRE(::NSudoSweeperOpenSnapshotView(
+        Content.data(),
+        Content.size(),
+        &View));
+
+    NSUDO_SWEEPER_SNAPSHOT_SCAN Rescan;
+    NSUDO_TEST_REQUIRE(::NSudoSweeperScanDirectoryTree(
+        &View,
+        RootPath,
+        ::NSudoSweeperGetPosixScanBackend(),
+        &Rescan));
+    NSUDO_TEST_CHECK(Rescan.EnumeratedDirectoryCount == 0);
+    NSUDO_TEST_CHECK(Rescan.ReusedDirectoryCount == 3);
+    NSUDO_TEST_CHECK(Rescan.Entries[0].TotalSize == Scan.Entries[0].TotalSize);
+
+    for (const char* File : Files)
+    {
+        ::unlink((Root + File).c_str());
+    }
+    ::unlink((Root + "/link").c_str());
+    ::rmdir((Root + "/a/b").c_str());
+    ::rmdir((Root + "/a").c_str());
+    ::rmdir(Root.c_str());
+}
+
+#endif // defined(__linux__)
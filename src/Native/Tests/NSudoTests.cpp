@@ -0,0 +1,93 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoTests.cpp
+ * PURPOSE:   Implementation for the Test Runner
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#include "NSudoTests.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    NSudoTests::TestCase* g_FirstCase = nullptr;
+    NSudoTests::TestCase** g_LastCase = &g_FirstCase;
+
+    // The checks can fail on the threads started by the test cases.
+    std::atomic<std::size_t> g_FailureCount(0);
+}
+
+bool NSudoTests::RegisterTestCase(
+    TestCase* Case) noexcept
+{
+    // Keeps the order of the definitions in each source file.
+    *g_LastCase = Case;
+    g_LastCase = &Case->Next;
+    return true;
+}
+
+void NSudoTests::ReportFailure(
+    const char* File,
+    int Line,
+    const char* Expression) noexcept
+{
+    ++g_FailureCount;
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", File, Line, Expression);
+}
+
+std::size_t NSudoTests::GetFailureCount() noexcept
+{
+    return g_FailureCount;
+}
+
+/**
+ * Runs the test cases of the suites named on the command line, or all test
+ * cases if no suite is named.
+ */
+int main(int argc, char* argv[])
+{
+    std::size_t RunCount = 0;
+    std::size_t FailedCount = 0;
+
+    for (NSudoTests::TestCase* Case = g_FirstCase; Case; Case = Case->Next)
+    {
+        bool Selected = argc < 2;
+        for (int i = 1; i < argc && !Selected; ++i)
+        {
+            Selected = std::strcmp(argv[i], Case->Suite) == 0;
+        }
+        if (!Selected)
+        {
+            continue;
+        }
+
+        std::printf("[ RUN    ] %s.%s\n", Case->Suite, Case->Name);
+        std::fflush(stdout);
+
+        g_FailureCount = 0;
+        Case->Function();
+
+        ++RunCount;
+        if (g_FailureCount)
+        {
+            ++FailedCount;
+        }
+
+        std::printf(
+            "[ %s ] %s.%s\n",
+            g_FailureCount ? "FAILED" : "    OK",
+            Case->Suite,
+            Case->Name);
+    }
+
+    std::printf("%zu test cases, %zu failed\n", RunCount, FailedCount);
+
+    // A suite name which matches nothing is a mistake in the build script.
+    return (FailedCount || !RunCount) ? 1 : 0;
+}
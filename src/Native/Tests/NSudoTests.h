@@ -0,0 +1,97 @@
+﻿/*
+ * PROJECT:   NSudo Portable Tests
+ * FILE:      NSudoTests.h
+ * PURPOSE:   Definition for the Test Case Registration and Checks
+ *
+ * LICENSE:   The MIT License
+ *
+ * DEVELOPER: Mouri_Naruto (Mouri_Naruto AT Outlook.com)
+ */
+
+#ifndef NSUDO_TESTS
+#define NSUDO_TESTS
+
+#include <cstddef>
+
+namespace NSudoTests
+{
+    /**
+     * A test case. The test cases register themselves before main runs.
+     */
+    struct TestCase
+    {
+        const char* Suite;
+        const char* Name;
+        void (*Function)();
+        TestCase* Next;
+    };
+
+    /**
+     * Registers a test case, it is called by NSUDO_TEST_CASE.
+     *
+     * @param Case The test case, it should live until the process exits.
+     * @return Always returns true.
+     */
+    bool RegisterTestCase(
+        TestCase* Case) noexcept;
+
+    /**
+     * Records a failed check of the running test case.
+     *
+     * @param File The source file of the check.
+     * @param Line The line of the check.
+     * @param Expression The text of the failed expression.
+     */
+    void ReportFailure(
+        const char* File,
+        int Line,
+        const char* Expression) noexcept;
+
+    /**
+     * Gets the number of the failed checks of the running test case.
+     *
+     * @return The number of the failed checks.
+     */
+    std::size_t GetFailureCount() noexcept;
+}
+
+/**
+ * Defines a test case which belongs to a suite. The suite name is the name of
+ * the ctest test which runs it.
+ */
+#define NSUDO_TEST_CASE(Suite, Name) \
+    static void Suite##Name##Test(); \
+    static NSudoTests::TestCase Suite##Name##Case = \
+    { \
+        #Suite, #Name, Suite##Name##Test, nullptr \
+    }; \
+    static const bool Suite##Name##Registered = \
+        NSudoTests::RegisterTestCase(&Suite##Name##Case); \
+    static void Suite##Name##Test()
+
+/**
+ * Checks an expression, the test case continues when it fails.
+ */
+#define NSUDO_TEST_CHECK(Expression) \
+    do \
+    { \
+        if (!(Expression)) \
+        { \
+            NSudoTests::ReportFailure(__FILE__, __LINE__, #Expression); \
+        } \
+    } while (false)
+
+/**
+ * Checks an expression, the test case returns when it fails.
+ */
+#define NSUDO_TEST_REQUIRE(Expression) \
+    do \
+    { \
+        if (!(Expression)) \
+        { \
+            NSudoTests::ReportFailure(__FILE__, __LINE__, #Expression); \
+            return; \
+        } \
+    } while (false)
+
+#endif // !NSUDO_TESTS